@@ -8,6 +8,7 @@ extern "C" {
 #endif 
 
 typedef struct KatssCounter KatssCounter;
+struct SeqFile; /* File opened with `seqfopen`, see seqfile.h */
 
 typedef enum KATSS_TYPE {
 	KATSS_INT8,
@@ -24,7 +25,8 @@ typedef enum KATSS_TYPE {
 
 
 /**
- * @brief Initialize the hash tables for katss k-mer counting
+ * @brief Initialize the hash tables for katss k-mer counting. K-mers of 1-16 bases get a table of
+ * every one of them, k-mers of 17-32 bases a sparse one, see `katss_init_sparse_counter`.
  * 
  * @param kmer The size of k-mer value to count.
  * @return KatssCounter* 
@@ -33,6 +35,52 @@ KatssCounter *
 katss_init_counter(unsigned int kmer);
 
 
+/**
+ * @brief Same as `katss_init_counter`, but only stores the k-mers that get counted, in a table
+ * that grows with them, instead of a table of every 4^k k-mer. Each k-mer counted takes a 16 byte
+ * slot, of which at most three quarters are taken, instead of 4 bytes for every possible one,
+ * which pays off for k-mers of 13 or more when few of them are seen. Shorter k-mers always get
+ * the dense table.
+ * 
+ * @param kmer The size of k-mer value to count.
+ * @return KatssCounter* 
+ */
+KatssCounter *
+katss_init_sparse_counter(unsigned int kmer);
+
+
+/**
+ * @brief Same as `katss_init_counter`, but only estimates the counts, in a count-min sketch of
+ * `max_bytes` bytes (32 MiB if 0) whatever the k-mer length. Estimates are never below the
+ * true counts, and with w = `max_bytes`/16 cells a row, are over them by at most 2.7*total/w
+ * with high probability. Only the 4096 k-mers estimated to be the most counted are listed,
+ * which are the ones enrichments and `katss_top_enrichment` go through. K-mers of up to 10 bases
+ * always get their exact table, which takes at most 4 MiB.
+ * 
+ * @param kmer      The size of k-mer value to count.
+ * @param max_bytes Bytes the sketch takes, 0 for 32 MiB
+ * @return KatssCounter* 
+ */
+KatssCounter *
+katss_init_sketch_counter(unsigned int kmer, uint64_t max_bytes);
+
+
+/**
+ * @brief Bound the memory of a sparse counter. Once its table would grow past `max_bytes`, the
+ * k-mers counted fewer than `min_count` times so far are dropped instead (at least the ones
+ * counted once), and the bound doubles until enough are dropped to make room. Counts of k-mers
+ * dropped are lost, but stay in the total. K-mers counted fewer than `min_count` times are
+ * left out of the counts listed at the end either way. Does nothing for counters that are not
+ * sparse.
+ * 
+ * @param counter   Pointer to initialized KatssCounter struct
+ * @param max_bytes Most bytes the table may take, 0 for no bound
+ * @param min_count K-mers counted fewer times are the first to be dropped, and aren't listed
+ */
+void
+katss_limit_counter(KatssCounter *counter, uint64_t max_bytes, uint64_t min_count);
+
+
 /**
  * @brief Increments the count of the hashed k-mer by one. Use the hash provided by `KmerHasher`
  * struct in `hash_function.h`
@@ -65,6 +113,17 @@ katss_increments(KatssCounter *counter, uint32_t *hash_values, size_t num_values
 void
 katss_decrement(KatssCounter *counter, uint32_t hash);
 
+/**
+ * @brief Decrements the count of all hash values in an array. Use the hash provided by `KmerHasher`
+ * struct in `hash_functions.h`
+ * 
+ * @param counter     Pointer to KatssCounter struct
+ * @param hash_values Array of hash values
+ * @param num_values  Number of hash values in array
+ */
+void
+katss_decrements(KatssCounter *counter, uint32_t *hash_values, size_t num_values);
+
 
 /**
  * @brief Get the value associated with a key.
@@ -98,6 +157,53 @@ int
 katss_get_from_hash(KatssCounter *counter, KATSS_TYPE numeric_type, void *value, uint32_t hash);
 
 
+/**
+ * @brief Same as `katss_get_from_hash`, for the 64-bit hashes of `katss_get_fh64`. Counters of
+ * k-mers longer than 16 must use this one.
+ * 
+ * @param counter      Pointer to KatssCounter struct
+ * @param numeric_type Type of `value`
+ * @param value        Numeric pointer used to store count
+ * @param hash         Hash to obtain count from
+ * @return int `0` if successfully set value. `1` if `hash` is not in counter.
+ */
+int
+katss_get_from_hash64(KatssCounter *counter, KATSS_TYPE numeric_type, void *value, uint64_t hash);
+
+
+/**
+ * @brief Write the count of every k-mer to `dst` as `numeric_type`, in the order of their
+ * hashes, the count of hash `i` at `i * stride` bytes from `dst`. Same as calling
+ * `katss_get_from_hash` for every hash, with the conversion done a table at a time, so e.g. the
+ * counts can be written straight into an array of structs. Counters of k-mers longer than 16
+ * have too many k-mers to export.
+ * 
+ * @param counter      Pointer to KatssCounter struct
+ * @param numeric_type Type of the values written to `dst`
+ * @param dst          Where the count of the first k-mer is written, room for 4^k of them
+ * @param stride       Bytes from one count to the next, at least the size of `numeric_type`
+ * @return int `0` if the counts were written. `1` if the k-mers are longer than 16.
+ */
+int
+katss_export_counts(KatssCounter *counter, KATSS_TYPE numeric_type, void *dst, size_t stride);
+
+
+/**
+ * @brief Same as `katss_export_counts`, writing the frequency of every k-mer instead, its count
+ * divided by the total of the counter.
+ * 
+ * @param counter      Pointer to KatssCounter struct
+ * @param numeric_type KATSS_FLOAT or KATSS_DOUBLE, the type of the values written to `dst`
+ * @param dst          Where the frequency of the first k-mer is written
+ * @param stride       Bytes from one frequency to the next
+ * @return int `0` if the frequencies were written. `1` if the k-mers are longer than 16, or `2`
+ * if `numeric_type` is neither KATSS_FLOAT nor KATSS_DOUBLE.
+ */
+int
+katss_export_frequencies(KatssCounter *counter, KATSS_TYPE numeric_type, void *dst,
+                         size_t stride);
+
+
 /**
  * @brief Get sum of all kmers in counter
  * 
@@ -117,6 +223,40 @@ void
 katss_free_counter(KatssCounter *counter);
 
 
+/**
+ * @brief Clear a counter as if it was just initialized, forgetting its counts and the k-mers it
+ * removes, without freeing its table. Zeroing a table that was already used is cheaper than
+ * faulting in the pages of a new one.
+ * 
+ * @param counter Pointer to initialized KatssCounter struct
+ */
+void
+katss_reset_counter(KatssCounter *counter);
+
+
+/**
+ * @brief Same as `katss_init_counter`, but reuses a counter of the same k-mer length given to
+ * `katss_release_counter`, reset, if there is one. Loops that count into new counters on every
+ * iteration then keep reusing the same tables instead of allocating and freeing them.
+ * 
+ * @param kmer The size of k-mer value to count.
+ * @return KatssCounter* 
+ */
+KatssCounter *
+katss_acquire_counter(unsigned int kmer);
+
+
+/**
+ * @brief Give back a counter that is no longer used, from `katss_acquire_counter` or
+ * `katss_init_counter`, to be reused by `katss_acquire_counter`. Up to 256 MiB of tables are
+ * kept, until `katss_shutdown_pool`, and counters past that are freed. Does nothing if NULL.
+ * 
+ * @param counter Pointer to initialized KatssCounter struct
+ */
+void
+katss_release_counter(KatssCounter *counter);
+
+
 /**
  * @brief Predict the kmer frequency
  * 
@@ -130,6 +270,23 @@ double
 katss_predict_kmer_freq(uint32_t hash, int kmer, KatssCounter *mono, KatssCounter *dint);
 
 
+/**
+ * @brief Same as `katss_predict_kmer_freq` for the `num` k-mers from hash `first` on, stored in
+ * `freqs`. The products of the frequencies are shared by neighbouring hashes, so most k-mers only
+ * take two multiplications and a division.
+ * 
+ * @param first Hash of the first kmer to predict
+ * @param num   Number of kmers to predict, ending at the last kmer at most
+ * @param kmer  Length of kmers to predict
+ * @param mono  Mono-nucleotide counts
+ * @param dint  Di-nucleotide counts
+ * @param freqs Predicted frequency of every kmer, room for `num` of them
+ */
+void
+katss_predict_kmer_freqs(uint64_t first, uint64_t num, int kmer, KatssCounter *mono,
+                         KatssCounter *dint, double *freqs);
+
+
 /**
  * @brief Predict the kmer count
  * 
@@ -143,6 +300,35 @@ uint64_t
 katss_predict_kmer(uint32_t hash, int kmer, KatssCounter *mono, KatssCounter *dint);
 
 
+/**
+ * @brief Get the counts of shorter k-mers from the k-mers in a counter, without reading the file
+ * again. Every k-mer of length `kmer` starting a k-mer in `counter` is counted. Shorter k-mers
+ * within the last k-1 bases of each sequence are only counted if `counter` kept them while
+ * counting, which the multi-counting functions do for counters of k-mers up to 10 when shorter
+ * ones are counted along with them. In that case the counts are exactly the same as counting
+ * `kmer` from the file, otherwise they miss the k-mers not starting any longer k-mer.
+ * 
+ * @param counter Counter to sum the k-mers of
+ * @param kmer    Length of k-mers to get, between 1 and the k-mer of `counter`
+ * @return KatssCounter* Counter with the k-mers of length `kmer`, or NULL on error
+ */
+KatssCounter *
+katss_counter_marginalize(KatssCounter *counter, unsigned int kmer);
+
+
+/**
+ * @brief Multithreaded version of `katss_counter_marginalize`, each thread sums the k-mers
+ * starting with a contiguous range of the k-mers of length `kmer`.
+ * 
+ * @param counter Counter to sum the k-mers of
+ * @param kmer    Length of k-mers to get, between 1 and the k-mer of `counter`
+ * @param threads Number of threads to use
+ * @return KatssCounter* Counter with the k-mers of length `kmer`, or NULL on error
+ */
+KatssCounter *
+katss_counter_marginalize_mt(KatssCounter *counter, unsigned int kmer, int threads);
+
+
 /**
  * @brief Count all forward-strand k-mers in a file. Currently supports fasta, fastq, and reads
  * files.
@@ -165,6 +351,31 @@ KatssCounter *katss_count_kmers(const char *filename, unsigned int kmer);
 KatssCounter *katss_count_kmers_mt(const char *filename, unsigned int kmer, int threads);
 
 
+/**
+ * @brief Count all k-mers in a file on both strands in a single pass. Every k-mer is counted
+ * under its canonical hash, the smaller of its own hash and the hash of its reverse complement,
+ * so a canonical k-mer counts every occurrence of either itself or its reverse complement. The
+ * other k-mers are left at 0.
+ * 
+ * @param filename Name of the file containing the reads
+ * @param kmer     Size of k-mers to count
+ * @return KatssCounter pointer
+ */
+KatssCounter *katss_count_kmers_canonical(const char *filename, unsigned int kmer);
+
+
+/**
+ * @brief Multithreaded version of `katss_count_kmers_canonical`.
+ * 
+ * @param filename Name of the file containing the reads
+ * @param kmer     Size of k-mers to count
+ * @param threads  Number of threads to use
+ * @return KatssCounter pointer
+ */
+KatssCounter *katss_count_kmers_canonical_mt(const char *filename, unsigned int kmer,
+                                             int threads);
+
+
 /**
  * @brief Count forward-strand k-mers in a sub-sampled file.
  * 
@@ -188,7 +399,9 @@ katss_count_kmers_bootstrap(
  * @param filename Name of the file to count sub-samples k-mers on
  * @param kmer     Length of the k-mer to count
  * @param sample   Percent to sample. Should be between 1 and 100
- * @param seed       Seed to use for random sample, NULL to use a random seed
+ * @param seed     Seed to use for random sample, NULL to use a random seed. The same reads are
+ *                 sampled for a seed whatever the number of threads, and it is updated so the
+ *                 next call samples other reads
  * @param threads  Number of threads to use
  * @return KatssCounter* struct containing the sub-sampled counts
  */
@@ -201,6 +414,152 @@ katss_count_kmers_bootstrap_mt(
 	int threads);
 
 
+/**
+ * @brief Count the forward-strand k-mers of several `counters` from a single pass over a file.
+ * The counters can be of different k-mer lengths; every base is hashed once over the largest
+ * one, and shorter k-mers are taken from the low bits of its hash. Gives the same counts as
+ * calling `katss_count_kmers` for each k-mer, and adds them to what the counters already hold.
+ * 
+ * @param filename     Name of the file containing the reads
+ * @param counters     Counters initialized with `katss_init_counter`
+ * @param num_counters Number of counters in `counters`
+ * @return int 0 if succeeded, otherwise if error was encountered
+ * 
+ * @example
+ * KatssCounter *counters[3] = {
+ *     katss_init_counter(5), katss_init_counter(1), katss_init_counter(2)
+ * };
+ * katss_count_kmers_multi("reads.fq.gz", counters, 3);
+ */
+int
+katss_count_kmers_multi(const char *filename, KatssCounter **counters, int num_counters);
+
+
+/**
+ * @brief Count the forward-strand k-mers of several `counters` from a single pass over a file,
+ * using `threads` threads. See `katss_count_kmers_multi`.
+ * 
+ * @param filename     Name of the file containing the reads
+ * @param counters     Counters initialized with `katss_init_counter`
+ * @param num_counters Number of counters in `counters`
+ * @param threads      Number of threads to use
+ * @return int 0 if succeeded, otherwise if error was encountered
+ */
+int
+katss_count_kmers_multi_mt(const char *filename, KatssCounter **counters, int num_counters,
+                           int threads);
+
+
+/**
+ * @brief Same as `katss_count_kmers_multi_mt`, but reads a file that is already open, e.g. a pipe
+ * opened with `seqfdopen` or a buffer opened with `seqfmemopen`. The file is rewound first, which
+ * pipes only allow if nothing was read from them yet, and is left open. Its type is the one it was
+ * opened with, or the one detected if opened with "d", see `seqfopen` and `seqftype`.
+ * 
+ * @param counters     Counters initialized with `katss_init_counter`
+ * @param num_counters Number of counters in `counters`
+ * @param file         SeqFile containing the reads
+ * @param threads      Number of threads to use
+ * @return int 0 if succeeded, otherwise if error was encountered
+ */
+int
+katss_count_kmers_multi_seqfile(KatssCounter **counters, int num_counters, struct SeqFile *file,
+                                int threads);
+
+
+/**
+ * @brief Count forward-strand k-mers of several `counters` in a sub-sampled file, from a single
+ * pass over it. Every counter counts the same sampled sequences.
+ * 
+ * @param filename     Name of the file to count sub-sampled k-mers on
+ * @param counters     Counters initialized with `katss_init_counter`
+ * @param num_counters Number of counters in `counters`
+ * @param sample       Percent to sample. Should be between 1-100000, each number representing
+ * 0.001%
+ * @param seed         Seed to use for random sample, NULL to use a random seed
+ * @return int 0 if succeeded, otherwise if error was encountered
+ */
+int
+katss_count_kmers_bootstrap_multi(
+	const char *filename,
+	KatssCounter **counters,
+	int num_counters,
+	int sample,
+	unsigned int *seed);
+
+
+/**
+ * @brief Count forward-strand k-mers of several `counters` in a sub-sampled file, from a single
+ * pass over it using `threads` threads. Every counter counts the same sampled sequences.
+ * 
+ * @param filename     Name of the file to count sub-sampled k-mers on
+ * @param counters     Counters initialized with `katss_init_counter`
+ * @param num_counters Number of counters in `counters`
+ * @param sample       Percent to sample. Should be between 1-100000, each number representing
+ * 0.001%
+ * @param seed         Seed to use for random sample, NULL to use a random seed. The same reads
+ *                     are sampled for a seed whatever the number of threads, and it is updated
+ *                     so the next call samples other reads
+ * @param threads      Number of threads to use
+ * @return int 0 if succeeded, otherwise if error was encountered
+ */
+int
+katss_count_kmers_bootstrap_multi_mt(
+	const char *filename,
+	KatssCounter **counters,
+	int num_counters,
+	int sample,
+	unsigned int *seed,
+	int threads);
+
+
+/**
+ * @brief Count forward-strand k-mers of several bootstrap replicates of a file, all from a single
+ * pass over it. Every replicate draws on its own how many times it counts each read: once with a
+ * chance of `sample`, else not at all, or a Poisson(1) number of times if `sample` is 0. Counts
+ * are added to what the replicates already hold.
+ * 
+ * @param filename       Name of the file to count the replicates of
+ * @param replicates     Counters of the same k-mer length initialized with `katss_init_counter`
+ * @param num_replicates Number of counters in `replicates`
+ * @param sample         0 for Poisson weights, or percent to sample between 1-100000, each
+ *                       number representing 0.001%
+ * @param seed           Seed to use for the draws, NULL to use a random seed. It is updated so
+ *                       the next call draws the replicates that would have followed, every
+ *                       replicate being the same however many of them are counted per call
+ * @return int 0 if succeeded, otherwise if error was encountered
+ */
+int
+katss_count_kmers_replicates(
+	const char *filename,
+	KatssCounter **replicates,
+	int num_replicates,
+	int sample,
+	unsigned int *seed);
+
+
+/**
+ * @brief Count forward-strand k-mers of several bootstrap replicates of a file, all from a single
+ * pass over it using `threads` threads. See `katss_count_kmers_replicates`.
+ * 
+ * @param filename       Name of the file to count the replicates of
+ * @param replicates     Counters of the same k-mer length initialized with `katss_init_counter`
+ * @param num_replicates Number of counters in `replicates`
+ * @param sample         0 for Poisson weights, or percent to sample between 1-100000
+ * @param seed           Seed to use for the draws, NULL to use a random seed
+ * @param threads        Number of threads to use
+ * @return int 0 if succeeded, otherwise if error was encountered
+ */
+int
+katss_count_kmers_replicates_mt(
+	const char *filename,
+	KatssCounter **replicates,
+	int num_replicates,
+	int sample,
+	unsigned int *seed,
+	int threads);
+
+
 /**
  * @brief Shuffle the sequences in a file, preserving the klet nucleotide
  * frequency, and count the shuffled kmers.
@@ -214,6 +573,20 @@ KatssCounter *
 katss_count_kmers_ushuffle(const char *filename, unsigned int kmer, int klet);
 
 
+/**
+ * @brief Shuffle the sequences in a file, preserving the klet nucleotide frequency, and count the
+ * shuffled kmers using `threads` threads. Counts are the same for any number of threads.
+ * 
+ * @param filename Name of the file to count the shuffled k-mers in
+ * @param kmer     Length of the k-mer to count
+ * @param klet     Length of k-let to preserve in sequence
+ * @param threads  Number of threads to use
+ * @return KatssCounter* struct containing the shuffled counts
+ */
+KatssCounter *
+katss_count_kmers_ushuffle_mt(const char *filename, unsigned int kmer, int klet, int threads);
+
+
 /**
  * @brief Count the shuffled sequences in a sub-sampled file.
  * 
@@ -234,6 +607,30 @@ katss_count_kmers_ushuffle_bootstrap(
 	unsigned int *seed);
 
 
+/**
+ * @brief Count the shuffled sequences in a sub-sampled file using `threads` threads.
+ * 
+ * @param filename Name of the file to count on
+ * @param kmer     Length of the k-mer to count
+ * @param klet     Length of k-let to preserve in sequence
+ * @param sample   Percent to sample (should be between 1-100000, each number
+ * representing 0.001%. E.g., 12345 -> 12.345%)
+ * @param seed     Seed to use for random sample. NULL to use a random seed. The same reads are
+ *                 sampled and shuffled for a seed whatever the number of threads, and it is
+ *                 updated so the next call samples other reads
+ * @param threads  Number of threads to use
+ * @return KatssCounter* struct containing the sub-sampled shuffled counts
+ */
+KatssCounter *
+katss_count_kmers_ushuffle_bootstrap_mt(
+	const char *filename,
+	unsigned int kmer,
+	int klet,
+	int sample,
+	unsigned int *seed,
+	int threads);
+
+
 /**
  * @brief Recount all k-mers in a KmerCounter
  * 
@@ -265,6 +662,96 @@ int katss_recount_kmer_mt(
 	int threads);
 
 
+/**
+ * @brief Same as `katss_recount_kmer`, but reads a file that is already open, so it isn't opened
+ * and its type detected again on every recount. The file is rewound first, so it has to be
+ * seekable (not a pipe, see `katss_preload_seqfile`), and is left open. Its type is the one it was opened with, or the one
+ * detected if opened with "d", see `seqfopen` and `seqftype`.
+ * 
+ * @param counter   KatssCounter to recount k-mers
+ * @param file      SeqFile containing the reads
+ * @param remove    K-mer to not include in counts
+ * @return int 0 if succeded, otherwise if error was encountered
+ */
+int katss_recount_kmer_seqfile(KatssCounter *counter, struct SeqFile *file, const char *remove);
+
+
+/**
+ * @brief Same as `katss_recount_kmer_seqfile` using `threads` threads.
+ * 
+ * @param counter   KatssCounter to recount k-mers
+ * @param file      SeqFile containing the reads
+ * @param remove    K-mer to not include in counts
+ * @param threads   Number of threads to use
+ * @return int 0 if succeded, otherwise if error was encountered
+ */
+int katss_recount_kmer_seqfile_mt(
+	KatssCounter *counter,
+	struct SeqFile *file,
+	const char *remove,
+	int threads);
+
+
+/**
+ * @brief Recount several KatssCounters from a single pass over a file
+ * 
+ * Same as calling `katss_recount_kmer` on each counter, but the file is read, crossed out and
+ * hashed only once. The counters must have removed the same k-mers so far.
+ * 
+ * @param counters     KatssCounters to recount k-mers
+ * @param num_counters Number of counters in `counters`
+ * @param filename     Name of the file containing the reads
+ * @param remove       K-mer to not include in counts
+ * @return int 0 if succeded, otherwise if error was encountered
+ */
+int
+katss_recount_kmer_multi(
+	KatssCounter **counters,
+	int num_counters,
+	const char *filename,
+	const char *remove);
+
+
+/**
+ * @brief Recount several KatssCounters from a single pass over a file using `threads` threads.
+ * See `katss_recount_kmer_multi`.
+ * 
+ * @param counters     KatssCounters to recount k-mers
+ * @param num_counters Number of counters in `counters`
+ * @param filename     Name of the file containing the reads
+ * @param remove       K-mer to not include in counts
+ * @param threads      Number of threads to use
+ * @return int 0 if succeded, otherwise if error was encountered
+ */
+int
+katss_recount_kmer_multi_mt(
+	KatssCounter **counters,
+	int num_counters,
+	const char *filename,
+	const char *remove,
+	int threads);
+
+
+/**
+ * @brief Same as `katss_recount_kmer_multi_mt`, but reads a file that is already open. See
+ * `katss_recount_kmer_seqfile`.
+ * 
+ * @param counters     KatssCounters to recount k-mers
+ * @param num_counters Number of counters in `counters`
+ * @param file         SeqFile containing the reads
+ * @param remove       K-mer to not include in counts
+ * @param threads      Number of threads to use
+ * @return int 0 if succeded, otherwise if error was encountered
+ */
+int
+katss_recount_kmer_multi_seqfile(
+	KatssCounter **counters,
+	int num_counters,
+	struct SeqFile *file,
+	const char *remove,
+	int threads);
+
+
 /**
  * @brief Recount all shuffled k-mers in a KatssCounter
  * 
@@ -285,6 +772,23 @@ int
 katss_recount_kmer_shuffle(KatssCounter *counter, const char *file, int klet, const char *remove);
 
 
+/**
+ * @brief Recount all shuffled k-mers in a KatssCounter using `threads` threads. See
+ * `katss_recount_kmer_shuffle`, every read is shuffled the same way as in
+ * `katss_count_kmers_ushuffle_mt`.
+ * 
+ * @param counter KatssCounter to recount shuffled k-mers
+ * @param file    File containing the sequences
+ * @param klet    Length of k-let to preserve in sequence
+ * @param remove  K-mer to not include in the counts
+ * @param threads Number of threads to use
+ * @return int 0 if succeded, otherwise if error was encountered
+ */
+int
+katss_recount_kmer_shuffle_mt(KatssCounter *counter, const char *file, int klet,
+                              const char *remove, int threads);
+
+
 /**
  * @brief Uncount a kmer
  * 
@@ -307,6 +811,262 @@ int katss_uncount_kmer(KatssCounter *counter, const char *filename, const char *
  */
 int katss_uncount_kmer_mt(KatssCounter *counter, const char *filename, const char *kmer, int threads);
 
+
+/**
+ * @brief Uncount a kmer from a file that is already open, rewinding it first and leaving it open.
+ * See `katss_recount_kmer_seqfile`.
+ * 
+ * @param counter 
+ * @param file 
+ * @param kmer 
+ * @return int 
+ */
+int katss_uncount_kmer_seqfile(KatssCounter *counter, struct SeqFile *file, const char *kmer);
+
+
+/**
+ * @brief Uncount a kmer multithreaded from a file that is already open, see
+ * `katss_uncount_kmer_seqfile`.
+ * 
+ * @param counter 
+ * @param file 
+ * @param kmer 
+ * @param threads 
+ * @return int 
+ */
+int katss_uncount_kmer_seqfile_mt(KatssCounter *counter, struct SeqFile *file, const char *kmer,
+                                  int threads);
+
+
+/**
+ * @brief Decode the sequences of a file once into memory, 2 bits per base, so the functions
+ * reading it again (recounting, uncounting and sub-sampling) iterate them instead of opening
+ * and decompressing the file every time. Counts are the same as when streaming the file. The
+ * file stays loaded until `katss_unload_file` is called as many times as it was loaded.
+ * 
+ * @param filename  Name of the file to load
+ * @param max_bytes Most memory the sequences may take. The file keeps being streamed if more
+ *                  would be needed
+ * @return int 0 if loaded, 1 if the filetype is not supported, 2 if the file could not be opened,
+ * 3 if the file keeps being streamed, either for being over `max_bytes` or having fasta sequences
+ * spanning several lines, blank lines, or fastq records that aren't four lines, or 4 if reading
+ * the file failed
+ */
+int katss_preload_file(const char *filename, uint64_t max_bytes);
+
+
+/**
+ * @brief Same as `katss_preload_file`, but decodes a file that is already open, e.g. a pipe that
+ * can't be read again, under `name`. Functions reading the file `name` then read the sequences
+ * from memory, as they would for a preloaded file, without `name` having to exist. The file is
+ * rewound first (see `katss_count_kmers_multi_seqfile`), read to its end, and left open.
+ * 
+ * @param name      Name the sequences are read under, and unloaded with
+ * @param file      SeqFile containing the reads
+ * @param max_bytes Most memory the sequences may take
+ * @return int Same as `katss_preload_file`. If `name` is already loaded, it is loaded once more
+ * and `file` isn't read
+ */
+int katss_preload_seqfile(const char *name, struct SeqFile *file, uint64_t max_bytes);
+
+
+/**
+ * @brief Same as `katss_preload_seqfile`, for sequences already in memory, e.g. a character
+ * vector of R, instead of a file. Every sequence is a read, as if it were a line of a raw
+ * sequences file, so functions reading the file `name` count them without any file being
+ * written or read.
+ * 
+ * @param name          Name the sequences are read under, and unloaded with
+ * @param sequences     Sequences, none of which can be NULL
+ * @param num_sequences Number of sequences in `sequences`
+ * @param max_bytes     Most memory the sequences may take, 2 bits per base
+ * @return int 0 if loaded, 2 if `name` or `sequences` is NULL, or 3 if the sequences take more
+ * than `max_bytes`. If `name` is already loaded, it is loaded once more and `sequences` aren't
+ * read
+ */
+int katss_preload_sequences(const char *name, const char *const *sequences,
+                            uint64_t num_sequences, uint64_t max_bytes);
+
+
+/**
+ * @brief Stop reading a file from memory, freeing its sequences once every function reading
+ * them is done. Does nothing if the file isn't loaded.
+ * 
+ * @param filename Name of the file passed to `katss_preload_file`
+ */
+void katss_unload_file(const char *filename);
+
+
+/**
+ * @brief Index where the sequence of every read of an uncompressed file starts, so sub-sampling
+ * it (bootstraps sampling `sample` < 100000) only reads the sampled reads instead of parsing the
+ * whole file every time. Counts are the same as when streaming the file. The index is written
+ * next to the file as `<filename>.kidx` and read back by later calls, until the file changes.
+ * The file stays indexed until `katss_unindex_file` is called as many times as it was indexed.
+ * 
+ * @param filename Name of the file to index
+ * @return int 0 if indexed, 1 if the filetype is not supported, 2 if the file could not be
+ * opened, 3 if the file keeps being streamed, either for being compressed or having fasta
+ * sequences spanning several lines, blank lines, fastq records that aren't four lines, or reads
+ * of 65536 characters or more, or 4 if reading the file failed
+ */
+int katss_index_file(const char *filename);
+
+
+/**
+ * @brief Stop reading a file through its index, freeing the index once every function reading
+ * it is done. The sidecar is kept. Does nothing if the file isn't indexed.
+ * 
+ * @param filename Name of the file passed to `katss_index_file`
+ */
+void katss_unindex_file(const char *filename);
+
+
+/**
+ * @brief Read several files under a single name, as if they were one file holding all of their
+ * reads, e.g. the lanes or shards of a sequencing run. Every function reading `name` then reads
+ * all of the files, and threads reading it together are spread across them, each file being
+ * inflated on its own thread. The files are only opened when `name` is read, and must all be of
+ * the same type.
+ * 
+ * @param name      Name the files are read under, which doesn't have to exist
+ * @param paths     Paths of the files to read
+ * @param num_paths Number of paths in `paths`
+ * @return int 0 if grouped, 1 if `name` is already a group, or 2 if there are no paths
+ */
+int katss_group_files(const char *name, const char *const *paths, int num_paths);
+
+
+/**
+ * @brief Stop reading the files grouped under `name` in its place. Functions still reading them
+ * read on until they are done. Does nothing if `name` isn't a group.
+ * 
+ * @param name Name passed to `katss_group_files`
+ */
+void katss_ungroup_files(const char *name);
+
+
+/**
+ * @brief Add the counts and total of `other` into `counter`, e.g. the counts of the shards of a
+ * dataset counted apart, on several machines. Dense tables are added a block of cells at a time,
+ * counts past 32 bits carrying into the high bits as when counting. No other thread may be
+ * counting into either counter.
+ * 
+ * @param counter Counter to add the counts into
+ * @param other   Counter whose counts are added, left as it is
+ * @param threads Number of threads adding dense tables
+ * @return int 0 on success, 1 if the counters count k-mers of different lengths (or are the same
+ * counter, or either is a sketch), or 2 if they didn't remove the same k-mers
+ */
+int katss_merge_counter(KatssCounter *counter, const KatssCounter *other, int threads);
+
+
+/**
+ * @brief Save the counts, total and removed k-mers of a counter to a file `katss_load_counter`
+ * reads back, e.g. to count a control once and compare several tests against it. The file is
+ * versioned and little-endian whatever the host, e.g. `<name>.kctr`. The tails kept for
+ * marginalizing aren't saved.
+ * 
+ * @param counter  Counter to save, which can't be a sketch counter
+ * @param filename Name of the file to write, overwritten if it exists
+ * @param level    0 to write the file uncompressed, so its table is mapped when loaded, or 1-9
+ *                 to compress it with gzip at that level
+ * @return int 0 if saved, 1 if the file could not be written, or 2 if the counter is a sketch
+ */
+int katss_save_counter(const KatssCounter *counter, const char *filename, int level);
+
+
+/**
+ * @brief Load a counter saved with `katss_save_counter`. Dense tables of uncompressed files are
+ * mapped into memory privately instead of being read, so only the pages used are read from disk,
+ * and counting into the counter never changes the file. Compressed files (gzip, or zstd or lz4
+ * when SeqFile was built with them) are read whole.
+ * 
+ * @param filename Name of the counter file
+ * @return KatssCounter* The counter, to be freed with `katss_free_counter`, or NULL if the file
+ * could not be read or is not a counter file
+ */
+KatssCounter *katss_load_counter(const char *filename);
+
+
+/**
+ * @brief Load the counter files of the `num_paths` shards of a dataset, and merge them into a
+ * single counter, see `katss_merge_counter`.
+ * 
+ * @param paths     Names of the counter files
+ * @param num_paths Number of names in `paths`
+ * @param threads   Number of threads to merge on
+ * @return KatssCounter* The merged counts, to be freed with `katss_free_counter`, or NULL if a
+ * file could not be loaded or the counters can't be merged
+ */
+KatssCounter *katss_merge_counter_files(const char *const *paths, int num_paths, int threads);
+
+
+/**
+ * @brief Whether `filename` is a counter file saved with `katss_save_counter`, compressed or not.
+ * 
+ * @param filename Name of the file
+ * @return int 1 if it is, 0 if it isn't or can't be opened
+ */
+int katss_is_counter_file(const char *filename);
+
+
+/**
+ * @brief Read the counts of `counter` under `name` from now on, as if `name` were a counter file
+ * holding them, e.g. to compare several tests against a control counted once without reading it
+ * again. `katss_count_kmers` and the regular counts and enrichments of katss.h, bootstrapped or
+ * not, take the name in place of a file. The counter is taken over, and freed once unnamed.
+ * 
+ * @param name    Name the counts are read under, e.g. a file name which is then no longer read
+ * @param counter Counter to take over, which can't be a sketch or have had k-mers removed
+ * @return int 0 if named, 1 if `name` is already a named counter, or 2 if the counter is NULL, a
+ * sketch, or had k-mers removed
+ */
+int katss_name_counter(const char *name, KatssCounter *counter);
+
+
+/**
+ * @brief Stop reading counts under `name`, and free its counter. Does nothing if `name` isn't a
+ * named counter.
+ * 
+ * @param name Name passed to `katss_name_counter`
+ */
+void katss_unname_counter(const char *name);
+
+
+/**
+ * @brief Keep the counts of the files counted with `katss_count_kmers` from now on, so counting a
+ * file again reads the counts back instead. Files are told apart by their path, size and
+ * modification time, and by a hash of their contents if `hash_contents`. Counts of k-mers up to
+ * 10 bases also give the counts of any shorter k-mer, which are summed from them. Calling it again
+ * changes the options, keeping what was cached.
+ *
+ * @param max_bytes     Most bytes the counters kept in memory may take, the least recently used
+ *                      ones being dropped past it. 0 to keep none in memory
+ * @param directory     Directory to also save the counts to, as counter files, so other sessions
+ *                      read them too. It is made if it doesn't exist. NULL to keep them in memory
+ * @param hash_contents Nonzero to also hash the contents of files on every lookup, which reads
+ *                      them
+ * @return int 0 on success, or 1 if the directory couldn't be made
+ */
+int katss_enable_count_cache(uint64_t max_bytes, const char *directory, int hash_contents);
+
+
+/**
+ * @brief Stop caching counts, and free the counters kept in memory. The counter files saved in
+ * the directory are left there.
+ */
+void katss_disable_count_cache(void);
+
+
+/**
+ * @brief Stop the threads multithreaded functions share, and free their buffers along with the
+ * calling thread's and the counters kept by `katss_release_counter`. They are started again by
+ * the next call that needs them, so this is only needed before unloading the library. No other
+ * katss function may be running.
+ */
+void katss_shutdown_pool(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -11,7 +11,7 @@ extern "C" {
 
 typedef struct KatssEnrichment {
 	double enrichment;
-	uint32_t key;
+	uint64_t key;
 } KatssEnrichment;
 
 typedef struct KatssEnrichments {
@@ -34,9 +34,14 @@ KatssEnrichments *katss_prob_ikke_mt(const char *test_file, unsigned int kmer, u
 KatssEnrichments *katss_prob_ikke(const char *test_file, unsigned int kmer, uint64_t iterations, bool normalize);
 KatssEnrichments *katss_ikke_shuffle(const char *test, int kmer, int klet, uint64_t iterations, bool normalize);
 KatssEnrichments *katss_ikke_shuffle_mt(const char *test, const char *ctrl, int kmer, int klet, uint64_t iterations, bool normalize, int threads);
+KatssEnrichments *katss_ikke_sketch_mt(const char *test_file, const char *control_file, unsigned int kmer,
+                                       uint64_t iterations, bool normalize, uint64_t max_bytes, int threads);
 
 KatssEnrichment katss_top_enrichment(KatssCounter *test, KatssCounter *control, bool normalize);
 KatssEnrichment katss_top_prediction(KatssCounter *test, KatssCounter *mono, KatssCounter *dint, bool normalize);
+/* Fills `top` with the `num_top` most enriched k-mers, most enriched first, returning how many */
+int katss_top_enrichments(KatssCounter *test, KatssCounter *control, bool normalize, int threads,
+                          KatssEnrichment *top, int num_top);
 void katss_free_enrichments(KatssEnrichments *enrichments);
 void katss_sort_enrichments(KatssEnrichments *enrichments);
 
@@ -2,6 +2,7 @@
 #define KATSS_HASH_FUNCTIONS_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -11,6 +12,9 @@ extern "C" {
 /** Opaque struct for KatssHasher */
 typedef struct KatssHasher KatssHasher;
 
+/** Block hashing kernel specialized for one filetype, see `katss_hash_block_kernel` */
+typedef size_t (*KatssHashBlock)(KatssHasher *hasher, uint32_t *hashes, size_t max);
+
 
 /**
  * @brief Initialize a k-mer hasher data structure. This is used to obtain all hash values
@@ -39,6 +43,18 @@ KatssHasher *katss_init_hasher(unsigned int kmer, char filetype);
 void katss_set_seq(KatssHasher *hasher, char *sequence, char filetype);
 
 
+/**
+ * @brief Make the hasher give canonical hashes, i.e., the smaller of the hash of every k-mer and
+ * the hash of its reverse complement, so both strands of a sequence hash the same. The reverse
+ * complement is rolled alongside the forward hash, and is only used once this is set. Applies to
+ * `katss_get_fh`, `katss_get_fh64` and the block hashing kernels, not to run hashing.
+ * 
+ * @param hasher    KmerHasher struct to set
+ * @param canonical `true` for canonical hashes, `false` for forward-strand ones (the default)
+ */
+void katss_set_canonical(KatssHasher *hasher, bool canonical);
+
+
 /**
  * @brief Get the next 32-bit forward-strand hash value contained in the sequence. If the hasher
  * has hashed all k-mers in the sequence, then it will return false. Works with fastq, fasta, and
@@ -53,6 +69,50 @@ void katss_set_seq(KatssHasher *hasher, char *sequence, char filetype);
 bool katss_get_fh(KatssHasher *hasher, uint32_t *hash, char filetype);
 
 
+/**
+ * @brief Same as `katss_get_fh`, but gets the 64-bit hash of the next k-mer, which holds every
+ * k-mer up to 32 bases. Hashers of k-mers longer than 16 must use this one.
+ * 
+ * @param hasher    KmerHasher struct that contains the sequence information.
+ * @param hash      Pointer that will contain the next hash
+ * @param filetype  Type of file you are hashing from
+ * @return true if `hash` was set successfully
+ * @return false if `hash` there are no more hashes left
+ */
+bool katss_get_fh64(KatssHasher *hasher, uint64_t *hash, char filetype);
+
+
+/**
+ * @brief Get up to `max` consecutive forward-strand hashes contained in the sequence in a single
+ * call. This yields exactly the same hashes as repeated calls to `katss_get_fh`, but runs of
+ * valid bases are encoded with the SIMD kernels supported by the running CPU (AVX2, SSE4.1 or
+ * NEON) and rolled without any per-k-mer branching. Works with fastq, fasta, and raw sequences.
+ * 
+ * @param hasher    KmerHasher struct that contains the sequence information.
+ * @param hashes    Array of at least `max` elements that will contain the hashes
+ * @param max       Maximum number of hashes to store in `hashes`
+ * @param filetype  Type of file you are hashing from
+ * @return size_t   Number of hashes stored in `hashes`. A value of `0` means there are no more
+ * hashes left in the sequence.
+ */
+size_t katss_hash_block(KatssHasher *hasher, uint32_t *hashes, size_t max, char filetype);
+
+
+/**
+ * @brief Get the block hashing kernel specialized for `filetype` and `kmer`. Kernels are compiled
+ * for every filetype with k of 3-8, 10 and 12 known at compile-time, any other k-mer gets a
+ * generic kernel for its filetype. Calling the kernel is equivalent to calling
+ * `katss_hash_block` with the same filetype, without having to dispatch on every call. The
+ * kernel must only be used with hashers initialized with the same `kmer`. A `kmer` of 0 gives
+ * the generic kernel, which reads k from the hasher, e.g. to time the specialized ones against.
+ * 
+ * @param kmer      K-mer length of the hashers the kernel will be used with, or 0
+ * @param filetype  Type of file you are hashing from
+ * @return KatssHashBlock The hashing kernel, or NULL if `filetype` is not supported
+ */
+KatssHashBlock katss_hash_block_kernel(unsigned int kmer, char filetype);
+
+
 /**
  * @brief Stores the k-mer associated with the provided hash_values in `key`.
  * 
@@ -64,6 +124,17 @@ bool katss_get_fh(KatssHasher *hasher, uint32_t *hash, char filetype);
 void katss_unhash(char *key, uint32_t hash_value, unsigned int kmer, bool use_t);
 
 
+/**
+ * @brief Same as `katss_unhash`, for the 64-bit hashes of k-mers up to 32 bases.
+ * 
+ * @param key         String to store the unhashed string
+ * @param hash_value  hash value to unhash
+ * @param kmer        K-mer length that `hash_value` belongs to
+ * @param use_t       Use nucleotide `T` (if true) or `U` (if false) in the key
+ */
+void katss_unhash64(char *key, uint64_t hash_value, unsigned int kmer, bool use_t);
+
+
 /**
  * @brief Determine if the end of sequence has been reached. If this returns true, that means there
  * are no more hash values to obtain from the provided sequence. If false, you can still hash the
@@ -2,6 +2,7 @@
 #define KATSS_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 /*==============================================================================
@@ -12,22 +13,42 @@
  * @brief Information stored for a specific k-mer
  */
 struct KatssDataEntry {
-	uint32_t kmer;
+	uint64_t kmer;
+	double pval;
 	union {
 		float rval;
 		uint32_t count;
 	};
-	double pval;
 	float stdev;
 };
 typedef struct KatssDataEntry KatssDataEntry;
 
+/**
+ * @brief Where the time of a run went, collected with `collect_stats` when katss is built
+ * with KATSS_WITH_STATS. Counts cover every file read by the run, test and control alike
+ */
+struct KatssStats {
+	uint64_t bytes_read;           /** Bytes read from the files, compressed or not */
+	uint64_t bytes_inflated;       /** Bytes decompressed from compressed files */
+	uint64_t records;              /** Sequences, or fasta/fastq records, parsed */
+	uint64_t kmers_hashed;         /** K-mers hashed into the tables */
+	uint64_t invalid_resets;       /** Times a k-mer was cut short by a base other than ACGTU */
+	double seconds;                /** Wall time of the whole run */
+	double load_seconds;           /** Time spent reading and decompressing, summed over threads */
+	double read_wait_seconds;      /** Time threads waited on each other to read a file */
+	double increment_wait_seconds; /** Time threads waited on each other to add to a table */
+	int num_iterations;            /** IKKE or bootstrap iterations timed */
+	double *iteration_seconds;     /** Wall time of each iteration, `num_iterations` of them */
+};
+typedef struct KatssStats KatssStats;
+
 /**
  * @brief All k-mer entries
  */
 struct KatssData {	
 	KatssDataEntry *kmers;
 	uint64_t num_kmers;
+	KatssStats *stats;     /** Statistics of the run, NULL unless `collect_stats` */
 };
 typedef struct KatssData KatssData;
 
@@ -41,11 +62,20 @@ typedef enum {
 	KATSS_PROBS_BOTH
 } KatssProbsAlgo;
 
+/**
+ * @brief How k-mers are counted
+ */
+typedef enum {
+	KATSS_COUNTER_EXACT,
+	KATSS_COUNTER_SKETCH
+} KatssCounterType;
+
 /**
  * @brief Options used to modify the output of the katss_* functions
  */
 struct KatssOptions {
-	int kmer;              /** Set length of k-mers */
+	int kmer;              /** Set length of k-mers, 1-32. K-mers longer than 16 are only
+	                           counted from every read, without probabilistic algorithms */
 	int iters;             /** Set the number of iterations for ikke */
 	int threads;           /** Set the number of threads to use */
 	int normalize;         /** Get the log2 of the enrichments */
@@ -53,21 +83,55 @@ struct KatssOptions {
 	                           result data->kmers[0] to be the kmer with the
 	                           highest rval, and the following kmers in
 	                           decreasing orders based on rval */
+	uint64_t top_kmers;    /** Only keep the `top_kmers` k-mers with the highest rval (or
+	                           count), sorted as with `sort_enrichments`. 0 to keep all.
+	                           Without bootstrapping, only the rows kept are allocated */
 
 	/* bootstrap options */
 	int bootstrap_iters;   /** Number of iterations to bootstrap. 0 to not bootstrap */
 	int bootstrap_sample;  /** Percent to sample. Should be a number between 
 	                           1-100000. Every number represents 0.001%, e.g.,
 	                           250000 -> 25.000%, 12345 -> 12.345% */
+	bool bootstrap_poisson; /** Count every read a Poisson(1) number of times in each
+	                           iteration instead of sub-sampling `bootstrap_sample` */
+	uint64_t memory_budget; /** Bytes of k-mer tables the iterations counted at the same time
+	                           may take, 4^k * 4 bytes per table, which doesn't change the
+	                           results. 0 for the default of 1 GiB */
 	
 	/* Probabilistic Options */
 	KatssProbsAlgo probs_algo;   /* Specify which probabilistic method to use */
 	int            probs_ntprec; /* Precision in kmer prediction. Set it as -1 for recommended value */
 	int            seed;         /* Seed to use for which random sequences to sample */
 
+	/* Input Options */
+	uint64_t preload_bytes;      /* Decode files read several times into memory once, if they
+	                                fit in this many bytes. 0 to always stream them */
+	bool     index_reads;        /* Index where the reads of uncompressed files not kept in
+	                                memory start, in `<file>.kidx` next to them, so bootstraps
+	                                only read the reads they sample */
+	uint64_t spool_bytes;        /* Decode descriptors and buffers read several times (e.g. to
+	                                bootstrap them) into memory, if they fit in this many bytes,
+	                                since pipes can't be read again. 0 to only count them once */
+
+	/* Table options */
+	KatssCounterType counter_type; /* KATSS_COUNTER_SKETCH only estimates counts, in a sketch
+	                                of `max_table_bytes` (32 MiB if 0), and only reports the
+	                                most counted k-mers, see `katss_init_sketch_counter` */
+	uint64_t max_table_bytes;    /* Most bytes the table of k-mers longer than 16 may take, 0
+	                                for no bound, see `katss_limit_counter` */
+	uint64_t min_count;          /* K-mers counted fewer times (in the test file for
+	                                enrichments) are left out of results without bootstrapping,
+	                                which only allocate the rows kept. K-mers longer than 16
+	                                are also the first dropped past `max_table_bytes` */
+	bool     canonical;          /* Count both strands in one pass of `katss_count`, every k-mer
+	                                under the smaller of its hash and its reverse complement's,
+	                                see `katss_count_kmers_canonical`. Plain counts only */
+
 	/* Function information */
 	bool enable_warnings;        /* Display warnings regarding options */
 	bool verbose_output;         /* Display verbose output of calculations */
+	bool collect_stats;          /* Attach the `KatssStats` of the run to the returned data.
+	                                Ignored unless built with KATSS_WITH_STATS */
 };
 typedef struct KatssOptions KatssOptions;
 
@@ -97,6 +161,53 @@ KatssData *
 katss_count(const char *path, KatssOptions *opts);
 
 
+/**
+ * @brief Count all kmers in a dataset split across several files, e.g. the
+ * lanes or shards of a sequencing run, as if they were a single file. The
+ * threads are spread across the files, so they are read and inflated at the
+ * same time, and counted into a single table, which is the same as counting
+ * the files one after the other. The files must all be of the same type.
+ * 
+ * @param paths     File paths of the dataset, a single one is the same as
+ * `katss_count`
+ * @param num_paths Number of paths in `paths`
+ * @param opts      Options struct to modify the counting algorithm
+ * @return KatssData* 
+ */
+KatssData *
+katss_count_files(const char *const *paths, int num_paths, KatssOptions *opts);
+
+
+/**
+ * @brief Count all kmers in a dataset read from a file descriptor, e.g. a pipe
+ * from another program, the same way as `katss_count`. The descriptor is
+ * closed once counted, unless it is stdin, stdout or stderr.
+ * 
+ * Pipes are read once, which is enough to count them. Bootstraps and shuffled
+ * counts read the dataset several times, so it is first decoded into memory,
+ * which takes `opts->spool_bytes` being large enough.
+ * 
+ * @param fd   File descriptor to read the dataset from
+ * @param opts Options struct to modify the counting algorithm
+ * @return KatssData* 
+ */
+KatssData *
+katss_count_fd(int fd, KatssOptions *opts);
+
+
+/**
+ * @brief Count all kmers in a dataset held in memory, the same way as
+ * `katss_count_fd`. The buffer is only read, and belongs to the caller.
+ * 
+ * @param buffer Contents of the dataset, compressed or not
+ * @param size   Number of bytes in `buffer`
+ * @param opts   Options struct to modify the counting algorithm
+ * @return KatssData* 
+ */
+KatssData *
+katss_count_buffer(const void *buffer, size_t size, KatssOptions *opts);
+
+
 /**
  * @brief Compute the most enriched k-mer in a sequence dataset
  * 
@@ -111,6 +222,42 @@ KatssData *
 katss_enrichment(const char *test, const char *ctrl, KatssOptions *opts);
 
 
+/**
+ * @brief Same as `katss_enrichment`, with the test and control datasets each
+ * split across several files, read as in `katss_count_files`.
+ * 
+ * @param test     File paths of the test dataset
+ * @param num_test Number of paths in `test`
+ * @param ctrl     File paths of the control dataset, or NULL if there is none
+ * @param num_ctrl Number of paths in `ctrl`, 0 if there is none
+ * @param opts     Options struct to modify the enrichment algorithm
+ * @return KatssData* Pointer to computed enrichment values
+ */
+KatssData *
+katss_enrichment_files(const char *const *test, int num_test, const char *const *ctrl,
+                       int num_ctrl, KatssOptions *opts);
+
+
+/**
+ * @brief Same as `katss_enrichment` for many test datasets against the same
+ * control, which is counted once, or its replicates once per bootstrap pass,
+ * for all of them. The tests are counted at the same time on the threads.
+ * Only enrichments with no probabilistic algorithm are batched. Statistics,
+ * if collected, are of the whole batch and kept by the first test's data.
+ *
+ * @param tests     File paths of the test datasets
+ * @param num_tests Number of paths in `tests`
+ * @param ctrl      File path of the control dataset, or a counter file
+ * @param opts      Options struct to modify the enrichment algorithm
+ * @return KatssData** The enrichments of every test, in the order of `tests`,
+ * or NULL if any of them failed. Free each with `katss_free_kdata`, and the
+ * array with `free`
+ */
+KatssData **
+katss_enrichment_batch(const char *const *tests, int num_tests, const char *ctrl,
+                       KatssOptions *opts);
+
+
 /**
  * @brief Compute the iterative k-mer knockout enrichments
  * 
@@ -124,6 +271,22 @@ KatssData *
 katss_ikke(const char *test, const char *ctrl, KatssOptions *opts);
 
 
+/**
+ * @brief Same as `katss_ikke`, with the test and control datasets each split
+ * across several files, read as in `katss_count_files`.
+ * 
+ * @param test     File paths of the test dataset
+ * @param num_test Number of paths in `test`
+ * @param ctrl     File paths of the control dataset, or NULL if there is none
+ * @param num_ctrl Number of paths in `ctrl`, 0 if there is none
+ * @param opts     Options struct to modify the output
+ * @return KatssData* Pointer to computed enrichment values
+ */
+KatssData *
+katss_ikke_files(const char *const *test, int num_test, const char *const *ctrl, int num_ctrl,
+                 KatssOptions *opts);
+
+
 /**
  * @brief Free all allocated resources to kdata
  * 
@@ -1,6 +1,16 @@
 #ifndef KATSS_SEQSEQ
 #define KATSS_SEQSEQ
 
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Match of a pattern found by `seqseq_many` */
+typedef struct SeqMatch {
+	uint64_t sequence;  /** Index of the sequence the pattern is in */
+	uint64_t position;  /** Position of the match in the sequence, from 0 */
+	uint32_t pattern;   /** Index of the pattern found */
+} SeqMatch;
+
 /**
  * @brief Find a sequence in a sequence.
  * 
@@ -65,4 +75,27 @@ char *seqseqq(const char *seq, const char *pat);
  */
 char *seqlseqq(const char *seq, const char *pat);
 
+
+/**
+ * @brief Find every pattern in every sequence at once, matching them the same way as `seqseq`.
+ *
+ * The patterns are searched for together, in a single pass over each sequence, and the sequences
+ * are split between threads. Matches are given by sequence, then position, then pattern. Unless
+ * `overlapping`, a match overlapping the previous match of the same pattern in a sequence is left
+ * out, as when searching again with `seqseq` from the end of the previous match.
+ *
+ * @param sequences     Sequences to search, NULL ones being skipped
+ * @param num_sequences Number of sequences
+ * @param patterns      Patterns to search for, none of them empty
+ * @param num_patterns  Number of patterns
+ * @param overlapping   Find every match, including the ones overlapping another of their pattern
+ * @param threads       Number of threads to search on
+ * @param num_matches   Set to the number of matches found
+ * @return SeqMatch* Array of the matches found, to be freed by the caller. NULL if none were
+ * found, or if there are no patterns or any of them is empty
+ */
+SeqMatch *seqseq_many(const char *const *sequences, uint64_t num_sequences,
+                      const char *const *patterns, uint32_t num_patterns, bool overlapping,
+                      int threads, uint64_t *num_matches);
+
 #endif // KATSS_SEQSEQ
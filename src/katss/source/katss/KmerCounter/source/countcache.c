@@ -0,0 +1,477 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#  include <direct.h>
+#  define mkdir(path, mode) _mkdir(path)
+#endif
+
+#if defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L) && !defined(__STDC_NO_THREADS__)
+#  include <threads.h>
+#else
+#  include <tinycthread.h>
+#endif
+
+#include "katss_core.h"
+#include "counter.h"
+#include "memory_utils.h"
+
+#define BUFFER_SIZE  (1U << 20)
+#define CACHE_SUFFIX ".kctr"
+
+#define MIX_PRIME UINT64_C(0x9E3779B97F4A7C15)
+
+/* What a file was when it was counted, the counts are only served while it still is */
+struct KatssCacheKey {
+	char *filename;        /** Path the file was counted from */
+	uint64_t size;         /** Bytes in the file */
+	int64_t mtime;         /** Last modification of the file */
+	uint64_t hash;         /** Hash of the contents of the file, 0 if they aren't hashed */
+	unsigned int kmer;     /** Length of the k-mers counted */
+};
+
+/* Counts of a file kept in memory */
+struct KatssCacheEntry {
+	KatssCacheKey key;             /** File and k-mer the counts are of */
+	KatssCounter *counter;         /** Counts, with the tails of the reads if they were kept */
+	uint64_t bytes;                /** Bytes `counter` takes */
+	int refs;                      /** One while cached, plus the lookups copying it */
+	struct KatssCacheEntry *next;  /** Next entry, the least recently used ones last */
+};
+typedef struct KatssCacheEntry KatssCacheEntry;
+
+static struct {
+	bool enabled;              /** If counts are looked up and kept at all */
+	bool hash_contents;        /** If files are also told apart by the hash of their contents */
+	uint64_t max_bytes;        /** Most bytes the entries in memory may take */
+	uint64_t bytes;            /** Bytes the entries in memory take */
+	char *directory;           /** Directory counter files are kept in, or NULL */
+	KatssCacheEntry *entries;  /** Entries in memory, the most recently used first */
+	mtx_t lock;
+} cache;
+static once_flag cache_once = ONCE_FLAG_INIT;
+
+static void init_cache(void);
+static KatssCacheKey *file_key(const char *filename, unsigned int kmer, bool hash_contents);
+static bool same_file(const KatssCacheKey *a, const KatssCacheKey *b);
+static int hash_file(const char *filename, uint64_t *hash);
+static inline uint64_t mix(uint64_t hash, uint64_t value);
+static char *entry_path(const char *directory, const KatssCacheKey *key);
+static KatssCacheEntry *take_entry(const KatssCacheKey *key);
+static void release_entry(KatssCacheEntry *entry);
+static void evict(uint64_t max_bytes);
+static void save_entry(const char *directory, const KatssCacheKey *key,
+                       const KatssCounter *counter);
+static void keep_entry(KatssCacheKey *key, const KatssCounter *counter, int threads);
+static void free_key(KatssCacheKey *key);
+
+/*
+Notes:
+Files are told apart by their path, size and modification time, like the sidecars of read indexes,
+and optionally by a hash of their contents, which takes reading the file (though not inflating or
+hashing its k-mers) on every lookup. The type of a file is read from its contents, so it needs no
+key of its own.
+
+Counters of k-mers up to KATSS_PRIVATE_KMER bases are counted along with the tails of their reads
+(see `katss_keep_tails`), so the counts of any shorter k-mer are summed from them exactly instead
+of counting the file again, e.g. for k = 4..8 once 8 was counted. Longer ones would take a third
+more memory for them, and threads share their table, which doesn't keep whole tails. Counter
+files don't keep tails either, so the ones in the directory only give the k-mer they were counted
+for.
+
+Lookups hand out copies, which callers are free to change or release. Entries are copied outside
+of the lock, and only freed once the last lookup copying them is done.
+*/
+
+
+/*==================================================================================================
+|                                         Public Functions                                         |
+==================================================================================================*/
+int
+katss_enable_count_cache(uint64_t max_bytes, const char *directory, int hash_contents)
+{
+	call_once(&cache_once, init_cache);
+
+	/* Counter files are written next to each other, in a directory made if it isn't there */
+	char *copy = NULL;
+	if(directory != NULL) {
+		struct stat info;
+		if(mkdir(directory, 0777) != 0 && errno != EEXIST)
+			return 1;
+		if(stat(directory, &info) != 0 || !S_ISDIR(info.st_mode))
+			return 1;
+		copy = s_malloc(strlen(directory) + 1);
+		strcpy(copy, directory);
+	}
+
+	mtx_lock(&cache.lock);
+	free(cache.directory);
+	cache.directory = copy;
+	cache.enabled = true;
+	cache.hash_contents = hash_contents != 0;
+	cache.max_bytes = max_bytes;
+	evict(max_bytes);
+	mtx_unlock(&cache.lock);
+	return 0;
+}
+
+
+void
+katss_disable_count_cache(void)
+{
+	call_once(&cache_once, init_cache);
+
+	mtx_lock(&cache.lock);
+	cache.enabled = false;
+	evict(0);
+	free(cache.directory);
+	cache.directory = NULL;
+	mtx_unlock(&cache.lock);
+}
+
+
+/*==================================================================================================
+|                                        Internal Functions                                        |
+==================================================================================================*/
+KatssCounter *
+katss_cached_counts(const char *filename, unsigned int kmer, int threads, KatssCacheKey **key)
+{
+	*key = NULL;
+	if(filename == NULL)
+		return NULL;
+	call_once(&cache_once, init_cache);
+
+	mtx_lock(&cache.lock);
+	bool enabled = cache.enabled, hash_contents = cache.hash_contents;
+	mtx_unlock(&cache.lock);
+	if(!enabled)
+		return NULL;
+
+	/* Groups are read as one file, but have none of their own to tell whether they changed */
+	int num_members;
+	char **members = katss_group_members(filename, &num_members);
+	if(members != NULL) {
+		for(int i=0; i<num_members; i++)
+			free(members[i]);
+		free(members);
+		return NULL;
+	}
+	KatssCacheKey *file = file_key(filename, kmer, hash_contents);
+	if(file == NULL)
+		return NULL;
+
+	/* The counts of the k-mer itself, or else of the shortest longer one to sum them from */
+	KatssCounter *counter = NULL;
+	KatssCacheEntry *entry = take_entry(file);
+	if(entry != NULL && entry->key.kmer == kmer) {
+		counter = katss_copy_counter(entry->counter, false, threads);
+	} else if(entry != NULL && (counter = katss_acquire_counter(kmer)) != NULL) {
+		katss_marginalize(counter, entry->counter, threads);
+	}
+	if(entry != NULL) {
+		mtx_lock(&cache.lock);
+		release_entry(entry);
+		mtx_unlock(&cache.lock);
+	}
+	if(counter != NULL) {
+		free_key(file);
+		return counter;
+	}
+
+	/* Then the counter file saved for the k-mer, kept in memory too from now on */
+	mtx_lock(&cache.lock);
+	char *path = cache.directory != NULL ? entry_path(cache.directory, file) : NULL;
+	mtx_unlock(&cache.lock);
+	if(path != NULL) {
+		FILE *saved = fopen(path, "rb");
+		if(saved != NULL) {
+			fclose(saved);
+			counter = katss_load_counter(path);
+		}
+		if(counter != NULL && counter->kmer != kmer) {
+			katss_free_counter(counter);
+			counter = NULL;
+		}
+		free(path);
+	}
+	if(counter != NULL) {
+		keep_entry(file, counter, threads);
+		return counter;
+	}
+
+	*key = file;
+	return NULL;
+}
+
+
+void
+katss_cache_counts(KatssCacheKey *key, const KatssCounter *counter, int threads)
+{
+	if(key == NULL)
+		return;
+
+	/* Counts of a file that changed while it was counted are of neither version of it */
+	KatssCacheKey *now = counter != NULL ? file_key(key->filename, key->kmer, key->hash != 0)
+	                                     : NULL;
+	if(now == NULL || !same_file(key, now) || counter->sketch != NULL) {
+		free_key(now);
+		free_key(key);
+		return;
+	}
+	free_key(now);
+
+	mtx_lock(&cache.lock);
+	char *directory = NULL;
+	if(cache.directory != NULL) {
+		directory = s_malloc(strlen(cache.directory) + 1);
+		strcpy(directory, cache.directory);
+	}
+	mtx_unlock(&cache.lock);
+	if(directory != NULL) {
+		save_entry(directory, key, counter);
+		free(directory);
+	}
+	keep_entry(key, counter, threads);
+}
+
+
+/*==================================================================================================
+|                                        Private Functions                                         |
+==================================================================================================*/
+static void
+init_cache(void)
+{
+	mtx_init(&cache.lock, mtx_plain);
+}
+
+
+/**
+ * @brief Key of the regular file `filename` as it is now, hashing its contents if
+ * `hash_contents`. Returns NULL if it isn't one, e.g. a pipe, or can't be read.
+ */
+static KatssCacheKey *
+file_key(const char *filename, unsigned int kmer, bool hash_contents)
+{
+	struct stat info;
+	if(stat(filename, &info) != 0 || !S_ISREG(info.st_mode))
+		return NULL;
+
+	uint64_t hash = 0;
+	if(hash_contents && hash_file(filename, &hash) != 0)
+		return NULL;
+
+	KatssCacheKey *key = s_malloc(sizeof *key);
+	key->filename = s_malloc(strlen(filename) + 1);
+	strcpy(key->filename, filename);
+	key->size = (uint64_t)info.st_size;
+	key->mtime = (int64_t)info.st_mtime;
+	key->hash = hash;
+	key->kmer = kmer;
+	return key;
+}
+
+
+static bool
+same_file(const KatssCacheKey *a, const KatssCacheKey *b)
+{
+	return a->size == b->size && a->mtime == b->mtime && a->hash == b->hash &&
+	       strcmp(a->filename, b->filename) == 0;
+}
+
+
+/**
+ * @brief Hash the bytes of `filename` as they are stored, never 0. Returns 0 on success, or 1
+ * if it couldn't be read.
+ */
+static int
+hash_file(const char *filename, uint64_t *hash)
+{
+	FILE *file = fopen(filename, "rb");
+	if(file == NULL)
+		return 1;
+
+	unsigned char *buffer = s_malloc(BUFFER_SIZE);
+	uint64_t h = MIX_PRIME;
+	size_t n;
+	while((n = fread(buffer, 1, BUFFER_SIZE, file)) > 0) {
+		size_t i = 0;
+		for(; i + 8 <= n; i += 8) {
+			uint64_t word;
+			memcpy(&word, buffer + i, sizeof word);
+			h = mix(h, word);
+		}
+		for(; i < n; i++)
+			h = mix(h, buffer[i]);
+	}
+	int ret = ferror(file) ? 1 : 0;
+	fclose(file);
+	free(buffer);
+
+	*hash = h == 0 ? 1 : h;
+	return ret;
+}
+
+
+static inline uint64_t
+mix(uint64_t hash, uint64_t value)
+{
+	hash = (hash ^ value) * MIX_PRIME;
+	return hash ^ (hash >> 29);
+}
+
+
+/**
+ * @brief Path of the counter file kept in `directory` for `key`, named after a hash of the key.
+ */
+static char *
+entry_path(const char *directory, const KatssCacheKey *key)
+{
+	uint64_t h = mix(mix(mix(MIX_PRIME, key->size), (uint64_t)key->mtime), key->hash);
+	for(const unsigned char *c = (const unsigned char *)key->filename; *c; c++)
+		h = mix(h, *c);
+
+	char *path = s_malloc(strlen(directory) + 32 + sizeof CACHE_SUFFIX);
+	sprintf(path, "%s/%016llx-%u" CACHE_SUFFIX, directory, (unsigned long long)h, key->kmer);
+	return path;
+}
+
+
+/**
+ * @brief Entry of the file of `key` for its k-mer, or else for the shortest longer k-mer it is
+ * exactly summed from, with a reference taken on it. Marks it the most recently used.
+ */
+static KatssCacheEntry *
+take_entry(const KatssCacheKey *key)
+{
+	mtx_lock(&cache.lock);
+	KatssCacheEntry **best = NULL;
+	for(KatssCacheEntry **link = &cache.entries; *link != NULL; link = &(*link)->next) {
+		const KatssCacheEntry *entry = *link;
+		if(entry->key.kmer < key->kmer || !same_file(&entry->key, key))
+			continue;
+		if(entry->key.kmer != key->kmer &&
+		   (entry->counter->tails == NULL || entry->counter->partial_tails))
+			continue;
+		if(best == NULL || entry->key.kmer < (*best)->key.kmer)
+			best = link;
+	}
+
+	KatssCacheEntry *entry = NULL;
+	if(best != NULL) {
+		entry = *best;
+		*best = entry->next;
+		entry->next = cache.entries;
+		cache.entries = entry;
+		entry->refs++;
+	}
+	mtx_unlock(&cache.lock);
+	return entry;
+}
+
+
+static void
+release_entry(KatssCacheEntry *entry)
+{
+	if(--entry->refs > 0)
+		return;
+	katss_free_counter(entry->counter);
+	free(entry->key.filename);
+	free(entry);
+}
+
+
+/**
+ * @brief Drop the least recently used entries until what is left takes at most `max_bytes`.
+ * Entries being copied are freed by the last of their lookups.
+ */
+static void
+evict(uint64_t max_bytes)
+{
+	while(cache.bytes > max_bytes) {
+		KatssCacheEntry **link = &cache.entries;
+		while((*link)->next != NULL)
+			link = &(*link)->next;
+		KatssCacheEntry *entry = *link;
+		*link = NULL;
+		cache.bytes -= entry->bytes;
+		release_entry(entry);
+	}
+}
+
+
+/**
+ * @brief Write the counts of `key` to the directory, through a temporary file renamed once
+ * written, so other sessions sharing the directory never read a partial file.
+ */
+static void
+save_entry(const char *directory, const KatssCacheKey *key, const KatssCounter *counter)
+{
+	char *path = entry_path(directory, key);
+	char *partial = s_malloc(strlen(path) + 32);
+	sprintf(partial, "%s.%llx.tmp", path,
+	        (unsigned long long)mix((uint64_t)time(NULL), (uint64_t)(uintptr_t)counter));
+
+	if(katss_save_counter(counter, partial, 0) != 0 || rename(partial, path) != 0) {
+		warning_message("katss: counts of `%s' couldn't be saved in the cache", key->filename);
+		remove(partial);
+	}
+	free(partial);
+	free(path);
+}
+
+
+/**
+ * @brief Keep a copy of the counts of `key` in memory, if they fit, taking the key. A file
+ * already kept for the k-mer is replaced by it.
+ */
+static void
+keep_entry(KatssCacheKey *key, const KatssCounter *counter, int threads)
+{
+	mtx_lock(&cache.lock);
+	uint64_t max_bytes = cache.enabled ? cache.max_bytes : 0;
+	mtx_unlock(&cache.lock);
+
+	uint64_t bytes = katss_counter_bytes(counter);
+	if(bytes > max_bytes) {
+		free_key(key);
+		return;
+	}
+	KatssCacheEntry *entry = s_malloc(sizeof *entry);
+	entry->key = *key;
+	free(key);
+	entry->counter = katss_copy_counter(counter, true, threads);
+	entry->bytes = bytes;
+	entry->refs = 1;
+
+	mtx_lock(&cache.lock);
+	for(KatssCacheEntry **link = &cache.entries; *link != NULL; link = &(*link)->next) {
+		KatssCacheEntry *old = *link;
+		if(old->key.kmer != entry->key.kmer || strcmp(old->key.filename, entry->key.filename))
+			continue;
+		*link = old->next;
+		cache.bytes -= old->bytes;
+		release_entry(old);
+		break;
+	}
+	entry->next = cache.entries;
+	cache.entries = entry;
+	cache.bytes += bytes;
+	evict(cache.enabled ? cache.max_bytes : 0);
+	mtx_unlock(&cache.lock);
+}
+
+
+static void
+free_key(KatssCacheKey *key)
+{
+	if(key == NULL)
+		return;
+	free(key->filename);
+	free(key);
+}
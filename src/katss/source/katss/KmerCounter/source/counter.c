@@ -1,8 +1,4 @@
-#ifdef _WIN32
-#define _CRT_RAND_S
-#define rand_r rand_s
-#endif
-#include <stdlib.h> // for random functions 
+#include <stdlib.h>
 #include <stdbool.h>
 #include <errno.h>
 #include <string.h>
@@ -14,50 +10,108 @@
 #  include <tinycthread.h>
 #endif
 
+#include "katss_core.h"
 #include "counter.h"
 #include "hash_functions.h"
 #include "memory_utils.h"
 #include "ushuffle.h"
 #include "seqfile.h"
-#include "thread_safe_rand.h"
 #define BUFFER_SIZE 65536U
+#define HASH_BLOCK  4096U
 
 struct threadinfo {
 	SeqFile seqfile;
+	KatssStoreReader *store;   /** Preloaded sequences read instead of `seqfile`, or NULL */
+	KatssIndexReader *index;   /** Index the sampled reads are read through instead, or NULL */
+	uint64_t claimed;          /** Next read taken by the thread from an indexed file */
+	uint64_t claimed_end;      /** End of the reads taken by the thread from an indexed file */
 	KatssCounter *counter;
+	KatssCounter *local;     /** Private table of the thread, NULL to share `counter` */
+	KatssHashBlock hash_block; /** Hashing kernel for the file's k-mer and filetype */
+	KatssMultiHasher *multi;   /** Multi-hasher of the thread when counting several k-mers */
+	const katss_str_node_t *removed; /** Sequences to cross out before counting */
+	KatssCounter **replicates; /** Tables of every replicate when counting replicates */
+	int num_replicates;
+	const unsigned int *replicate_seeds; /** Seed the draws of every replicate are keyed by */
+	bool locked;             /** If the replicate tables are shared between threads */
+	mtx_t *reads_lock;       /** Guards the file and `next_read` when sampling reads */
+	uint64_t *next_read;     /** Index in the file of the next read to sample */
 	unsigned int kmer;
+	int klet;                /** Length of the k-lets shuffled reads keep */
 	int sample;
-	unsigned int *seed;
+	unsigned int seed;       /** Seed the draws for every read are keyed by */
 	char filetype;
 };
 typedef struct threadinfo threadinfo;
 
+#define REPLICATE_BLOCK 32768U /* Hashes counted into every replicate at once */
+#define REPLICATE_READS 1024U  /* Most reads whose hashes are counted at once */
+#define INDEX_CLAIM     1024U  /* Reads of an indexed file a thread takes at once */
+#define BATCH_SIZE      (4*BUFFER_SIZE) /* Characters of the reads a thread takes at once */
+#define BATCH_READS     4096U  /* Most reads a thread takes at once */
+
+/* Reads a thread took from the file shared by the threads, see `next_read` */
+struct read_batch {
+	char *reads;             /** Reads of the batch, each with its null terminator */
+	size_t *ends;            /** Offset of the null terminator of every read */
+	size_t num_reads;        /** Reads in the batch */
+	size_t next;             /** Next read of the batch to hand out */
+	uint64_t first;          /** Index in the file of the first read of the batch */
+};
+typedef struct read_batch read_batch;
+
 /*============ Counting Function Declarations ============*/
 static KatssCounter *
-count_file(const char *filename, unsigned int kmer, const char filetype);
+count_file(const char *filename, unsigned int kmer);
+static KatssCounter *
+count_cached(const char *filename, unsigned int kmer, int threads);
+static KatssCounter *
+count_single(const char *filename, unsigned int kmer);
+static KatssCounter *
+count_threads(const char *filename, unsigned int kmer, int threads);
 static int
 count_file_mt(void *arg);
-
-/*============= Helper Function Declarations =============*/
-static char
-determine_filetype(const char *filename);
-
-static bool
-is_nucleotide(char character);
+static int
+count_long(const char *filename, SeqFile seqfile, KatssCounter *counter,
+           const katss_str_node_t *removed, int threads);
+static int
+count_long_mt(void *arg);
+static int
+count_canonical_mt(void *arg);
+static int
+count_multi_mt(void *arg);
+static int
+count_multi_bootstrap_mt(void *arg);
+static int
+run_multi(const char *filename, SeqFile seqfile, KatssCounter **counters, int num_counters,
+          const katss_str_node_t *removed, int sample, unsigned int *seed, int threads);
+static int
+count_multi_pass(const char *filename, SeqFile seqfile, KatssCounter **counters,
+                 int num_counters, const katss_str_node_t *removed, int sample,
+                 unsigned int seed, int threads);
+static int
+count_replicates_mt(void *arg);
+static int
+count_shuffled_mt(void *arg);
+static void
+flush_replicates(threadinfo *args, const uint32_t *hashes, const uint32_t *read_ends,
+                 const uint8_t *weights, int num_reads, uint32_t *staging);
+static inline uint8_t
+draw_weight(KatssRng *rng, int sample);
+static void
+init_batch(read_batch *batch);
+static void
+free_batch(read_batch *batch);
+static char *
+next_read(threadinfo *args, read_batch *batch, char *buffer, uint64_t *index, size_t *length);
+static char *
+load_read(threadinfo *args, char *read, uint64_t index, size_t *length);
 
 /*============= Actual Functions Declarations =============*/
 KatssCounter *
 katss_count_kmers(const char *filename, unsigned int kmer)
 {
-	char filetype = determine_filetype(filename);
-	if(filetype == 'e') { /* Error determining filetype */
-		return NULL;
-	} else if (filetype == 'N') { /* Error opening file */
-		return NULL;
-	}
-
-	KatssCounter *counter = count_file(filename, kmer, filetype);
-	return counter;
+	return count_cached(filename, kmer, 1);
 }
 
 
@@ -67,226 +121,168 @@ katss_count_kmers_mt(const char *filename, unsigned int kmer, int threads)
 	/* Threads should be at least one, and at most 128 */
 	threads = MAX2(threads, 1);
 	threads = MIN2(threads, 128);
+	return count_cached(filename, kmer, threads);
+}
 
-	/* If one thread, use single threaded computation */
-	if(threads == 1)
-		return katss_count_kmers(filename, kmer);
 
-	/* Begin multithreaded computations */
-	char filetype = determine_filetype(filename);
-	if(filetype == 'e') { /* Error determining filetype */
-		return NULL;
-	} else if (filetype == 'N') { /* Error opening file */
-		return NULL;
-	}
+KatssCounter *
+katss_count_kmers_bootstrap(const char *filename, unsigned int kmer,
+                            int sample, unsigned int *seed)
+{
+	return katss_count_kmers_bootstrap_mt(filename, kmer, sample, seed, 1);
+}
 
-	/* Open SeqFile for reading */
-	char mode[2] = { 0 };
-	mode[0] = filetype == 'r' ? 's' : filetype;
-	SeqFile file = seqfopen(filename, mode);
-	if(file == NULL) {
-		warning_message("seqfopen: error %d: %s",seqferrno,seqfstrerror(seqferrno));
-		return NULL;
-	}
 
-	/* Initialize counter */
-	KatssCounter *counter = katss_init_counter(kmer);
-	if(counter == NULL) {
-		seqfclose(file);
+KatssCounter *
+katss_count_kmers_bootstrap_mt(const char *filename, unsigned int kmer,
+                               int sample, unsigned int *seed, int threads)
+{
+	/* Sampled reads are hashed on their own, the same way as for several k-mers */
+	KatssCounter *counter = katss_acquire_file_counter(kmer, filename);
+	if(counter == NULL)
+		return NULL;
+	if(katss_count_kmers_bootstrap_multi_mt(filename, &counter, 1, sample, seed, threads) != 0) {
+		katss_release_counter(counter);
 		return NULL;
 	}
-
-	threadinfo *jobarg = s_malloc(threads * sizeof *jobarg);
-	thrd_t *jobs = s_malloc(threads * sizeof *jobs);
-	for(int i=0; i<threads; i++) {
-		jobarg[i].seqfile = file;
-		jobarg[i].counter = counter;
-		jobarg[i].kmer = kmer;
-		jobarg[i].filetype = filetype;
-
-		/* Start threads */
-		thrd_create(&jobs[i], count_file_mt, &jobarg[i]);
-	}
-
-	for(int i=0; i<threads; i++) {
-		thrd_join(jobs[i], NULL);
-	}
-
-	/* Free resources */
-	seqfclose(file);
-	free(jobs);
-	free(jobarg);
-
 	return counter;
 }
 
 
 KatssCounter *
-katss_count_kmers_bootstrap(const char *filename, unsigned int kmer,
-                            int sample, unsigned int *seed)
+katss_count_kmers_canonical(const char *filename, unsigned int kmer)
 {
-	char filetype = determine_filetype(filename);
-	if(filetype == 'e' || filetype == 'N')
-		return NULL;
-
-	KatssCounter *counter = NULL;
+	return katss_count_kmers_canonical_mt(filename, kmer, 1);
+}
 
-	/* Initialize buffer */
-	char *buffer = s_calloc(BUFFER_SIZE, sizeof *buffer);
-	uint32_t hash_value;
 
-	/* Open file and hasher */
-	buffer[0] = filetype == 'r' ? 'b' : filetype;
-	SeqFile read_file = seqfopen(filename, buffer);
-	if(read_file == NULL)
-		goto exit;
-	
-	KatssHasher *hasher = katss_init_hasher(kmer, filetype);
-	if(hasher == NULL)
-		goto cleanup_file;
-	
-	counter = katss_init_counter(kmer);
+KatssCounter *
+katss_count_kmers_canonical_mt(const char *filename, unsigned int kmer, int threads)
+{
+	KatssCounter *counter = katss_acquire_file_counter(kmer, filename);
 	if(counter == NULL)
-		goto cleanup_hasher;
-
-	/* sample should be between 1-100000 */
-	sample = MAX2(sample, 1);
-	sample = MIN2(sample, 100000);
-
-	/* Initialize random number generator */
-	thread_safe_rand_t *tsr = thread_safe_rand_init();
-
-	/* If no seed was provided create one */
-	unsigned int local_seed;
-	if(seed == NULL) {
-		local_seed = time(NULL);
-		seed = &local_seed;
+		return NULL;
+	if(katss_count_canonical(filename, NULL, counter, threads) != 0) {
+		katss_release_counter(counter);
+		return NULL;
 	}
+	return counter;
+}
 
-	while(seqfgets_unlocked(read_file, buffer, BUFFER_SIZE)) {
-		if(thread_safe_rand_r(tsr, seed) % 100000 >= sample)
-			continue;
-		katss_set_seq(hasher, buffer, filetype);
-		while(katss_get_fh(hasher, &hash_value, filetype)) {
-			katss_increment(counter, hash_value);
-		}
-	}
 
-	if(seqferrno) {
-		error_message("katss: sample: %s\n", seqfstrerror_r(seqferrno, buffer, BUFFER_SIZE));
+/**
+ * @brief Counts of `filename`, copied from the counter named in its place if there is one, else
+ * from the count cache, or counted and then cached if it is enabled.
+ * K-mers up to KATSS_PRIVATE_KMER bases are counted along with the tails of their reads, which
+ * only the multi-counting functions keep, so shorter k-mers are summed from the cached counts.
+ * The counter returned doesn't keep them.
+ */
+static KatssCounter *
+count_cached(const char *filename, unsigned int kmer, int threads)
+{
+	/* A counter named in place of the file gives a copy of its counts */
+	bool named;
+	KatssCounter *counter = katss_named_counts(filename, threads, &named);
+	if(named && counter != NULL && counter->kmer != kmer) {
+		error_message("katss: `%s' counts k-mers of %u bases, not kmer=(%u)", filename,
+		              counter->kmer, kmer);
 		katss_free_counter(counter);
 		counter = NULL;
 	}
-
-	free(buffer);
-cleanup_hasher:
-	free(hasher);
-cleanup_file:
-	seqfclose(read_file);
-exit:
+	if(named)
+		return counter;
+
+	KatssCacheKey *key;
+	counter = katss_cached_counts(filename, kmer, threads, &key);
+	if(counter != NULL)
+		return counter;
+
+	/* Loaded sequences are only read by the multi-counting functions, and may have no file */
+	uint64_t num_bases;
+	bool stored = katss_stored_bases(filename, &num_bases);
+	if((key != NULL && kmer <= KATSS_PRIVATE_KMER) || stored) {
+		counter = katss_acquire_file_counter(kmer, filename);
+		if(counter != NULL && key != NULL)
+			katss_keep_tails(counter);
+		if(counter != NULL && katss_count_kmers_multi_mt(filename, &counter, 1, threads) != 0) {
+			katss_release_counter(counter);
+			counter = NULL;
+		}
+	} else {
+		counter = threads == 1 ? count_single(filename, kmer) : count_threads(filename, kmer, threads);
+	}
+	katss_cache_counts(key, counter, threads);
+	if(counter != NULL)
+		katss_drop_tails(counter);
 	return counter;
 }
 
 
-static int
-count_file_bootstrap_mt(void *arg)
+static KatssCounter *
+count_single(const char *filename, unsigned int kmer)
 {
-	threadinfo *args = (threadinfo *)arg;
-	char *buffer = s_malloc(BUFFER_SIZE * sizeof *buffer);
-	thread_safe_rand_t *tsr = thread_safe_rand_init();
-
-	KatssHasher *hasher = katss_init_hasher(args->kmer, '\0');
-	if(hasher == NULL)
-		return 1;
-
-	/* Megabyte to store counts */
-	size_t num_counts = 250000;
-	uint32_t *hash_values = s_malloc(num_counts * sizeof *hash_values);
-	size_t cur_hash = 0;
-
-	/* Begin counting */
-	while(seqfgets(args->seqfile, buffer, BUFFER_SIZE)) {
-		if(thread_safe_rand_r(tsr, args->seed) % 100000 >= args->sample)
-			continue;
-		katss_set_seq(hasher, buffer, args->filetype);
-		while(katss_get_fh(hasher, &hash_values[cur_hash], args->filetype)) {
-			if(++cur_hash == num_counts) { // begin flushing
-				katss_increments(args->counter, hash_values, cur_hash);
-				cur_hash = 0;
-			}
+	/* K-mers longer than 16 bases need 64-bit hashes, which only the rolling hasher gives */
+	if(kmer > KATSS_DENSE_KMER) {
+		KatssCounter *counter = katss_init_counter(kmer);
+		if(counter != NULL && count_long(filename, NULL, counter, NULL, 1) != 0) {
+			katss_free_counter(counter);
+			counter = NULL;
 		}
+		return counter;
 	}
 
-	/* Flush values */
-	katss_increments(args->counter, hash_values, cur_hash);
-
-	/* Free resources */
-	thread_safe_rand_free(tsr);
-	free(hasher);
-	free(buffer);
-	free(hash_values);
-
-	return 0;
+	KatssCounter *counter = count_file(filename, kmer);
+	return counter;
 }
 
 
-KatssCounter *
-katss_count_kmers_bootstrap_mt(const char *filename, unsigned int kmer,
-                               int sample, unsigned int *seed, int threads)
+static KatssCounter *
+count_threads(const char *filename, unsigned int kmer, int threads)
 {
-	threads = MAX2(threads, 1);
-	threads = MIN2(threads, 128);
-
-	/* Process single-threaded computation */
-	if(threads == 1)
-		return katss_count_kmers_bootstrap(filename, kmer, sample, seed);
-
-	/* Multi-threading */
-	char filetype = determine_filetype(filename);
-	if(filetype == 'e' || filetype == 'N')
-		return NULL;
-
-	/* sample should be between 1-100000 */
-	sample = MAX2(sample, 1);
-	sample = MIN2(sample, 100000);
+	if(kmer > KATSS_DENSE_KMER) {
+		KatssCounter *counter = katss_init_counter(kmer);
+		if(counter != NULL && count_long(filename, NULL, counter, NULL, threads) != 0) {
+			katss_free_counter(counter);
+			counter = NULL;
+		}
+		return counter;
+	}
 
-	/* Open SeqFile for reading */
-	char mode[2] = { 0 };
-	mode[0] = filetype == 'r' ? 's' : filetype;
-	SeqFile file = seqfopen(filename, mode);
-	if(file == NULL) {
-		warning_message("seqfopen: error %d: %s",seqferrno,seqfstrerror(seqferrno));
+	/* Begin multithreaded computations, plain reads files are hashed from memory */
+	char filetype;
+	SeqFile file = katss_open_file(filename, "m", &filetype);
+	if(file == NULL)
 		return NULL;
-	}
 
 	/* Initialize counter */
-	KatssCounter *counter = katss_init_counter(kmer);
+	KatssCounter *counter = katss_acquire_file_counter(kmer, filename);
 	if(counter == NULL) {
 		seqfclose(file);
 		return NULL;
 	}
 
+	/* Only the sequences of fasta/fastq records are read, which are then hashed as reads */
+	KatssHashBlock hash_block = katss_hash_block_kernel(kmer, 'r');
+	KatssCounter **locals = katss_init_private_counters(kmer, threads);
 	threadinfo *jobarg = s_malloc(threads * sizeof *jobarg);
-	thrd_t *jobs = s_malloc(threads * sizeof *jobs);
+	KatssTaskGroup *jobs = katss_init_task_group();
 	for(int i=0; i<threads; i++) {
 		jobarg[i].seqfile = file;
 		jobarg[i].counter = counter;
+		jobarg[i].local = locals ? locals[i] : NULL;
+		jobarg[i].hash_block = hash_block;
 		jobarg[i].kmer = kmer;
-		jobarg[i].filetype = filetype;
-		jobarg[i].sample = sample;
-		jobarg[i].seed = seed;
+		jobarg[i].filetype = 'r';
 
-		/* Start threads */
-		thrd_create(&jobs[i], count_file_bootstrap_mt, &jobarg[i]);
+		/* Start tasks on the pool */
+		katss_submit_task(jobs, count_file_mt, &jobarg[i]);
 	}
 
-	for(int i=0; i<threads; i++) {
-		thrd_join(jobs[i], NULL);
-	}
+	katss_wait_task_group(jobs);
+	katss_merge_private_counters(counter, locals, threads);
 
 	/* Free resources */
 	seqfclose(file);
-	free(jobs);
 	free(jobarg);
 
 	return counter;
@@ -294,41 +290,63 @@ katss_count_kmers_bootstrap_mt(const char *filename, unsigned int kmer,
 
 
 static KatssCounter *
-count_file(const char *filename, unsigned int kmer, const char filetype)
+count_file(const char *filename, unsigned int kmer)
 {
 	KatssCounter *counter = NULL;
 
-	/* Open file and prepare counter & hasher */
-	SeqFile read_file = seqfopen(filename, "b");
+	/* Open file and prepare counter & hasher, plain files are hashed from memory */
+	char filetype;
+	SeqFile read_file = katss_open_file(filename, "m", &filetype);
 	if(read_file == NULL)
 		goto exit;
 
-	KatssHasher *hasher = katss_init_hasher(kmer, filetype);
+	/* Fasta/fastq files read from their file only have the sequences of their records read, which
+	   are hashed as reads. Either way, they are inflated ahead on another thread */
+	const bool seqs = !seqfismapped(read_file) && filetype != 'r';
+	if(!seqfismapped(read_file))
+		seqfsetahead(read_file, true);
+
+	KatssHasher *hasher = katss_init_hasher(kmer, seqs ? 'r' : filetype);
 	if(hasher == NULL)
 		goto cleanup_file;
 
-	counter = katss_init_counter(kmer);
+	counter = katss_acquire_file_counter(kmer, filename);
 	if(counter == NULL)
 		goto cleanup_hasher;
 
-	/* Prepare file reading & hash int */
+	/* Prepare file reading & hash buffer */
+	KatssHashBlock hash_block = katss_hash_block_kernel(kmer, seqs ? 'r' : filetype);
 	char buffer[BUFFER_SIZE+1] = { 0 };
-	size_t still_reading;
-	uint32_t hash_value;
+	uint32_t *hash_values = s_malloc(HASH_BLOCK * sizeof *hash_values);
+	size_t still_reading, num_hashes;
+
+	/* Spans of a mapped file are hashed where they are, without copying them */
+	const char *span;
+	if(seqfismapped(read_file)) {
+		while((still_reading = seqfview_unlocked(read_file, &span, BUFFER_SIZE))) {
+			katss_set_span(hasher, span, still_reading);
+			while((num_hashes = hash_block(hasher, hash_values, HASH_BLOCK)))
+				katss_increments_unlocked(counter, hash_values, num_hashes);
+		}
+		free(hash_values);
+		goto cleanup_hasher;
+	}
 
+	/* Sequences are whole, other reads go on from one buffer to the next */
 	do {
-		still_reading = seqfread_unlocked(read_file, buffer, BUFFER_SIZE);
+		still_reading = seqs ? seqfreadseqs_unlocked(read_file, buffer, BUFFER_SIZE)
+		                     : seqfread_unlocked(read_file, buffer, BUFFER_SIZE);
 		buffer[still_reading] = '\0';
 
-		katss_set_seq(hasher, buffer, filetype);
-		while(katss_get_fh(hasher, &hash_value, filetype)) {
-			katss_increment(counter, hash_value);
-		}
-	} while(still_reading == BUFFER_SIZE);
+		katss_set_seq(hasher, buffer, seqs ? 'r' : filetype);
+		while((num_hashes = hash_block(hasher, hash_values, HASH_BLOCK)))
+			katss_increments_unlocked(counter, hash_values, num_hashes);
+	} while(still_reading != 0);
+	free(hash_values);
 
 	/* If error was encountered while reading report and return NULL */
 	if(still_reading == 0 && seqferrno) {
-		katss_free_counter(counter);
+		katss_release_counter(counter);
 		counter = NULL;
 		error_message("katss: %d: %s", seqferrno, seqfstrerror(seqferrno));
 	}
@@ -345,7 +363,8 @@ static int
 count_file_mt(void *arg)
 {
 	threadinfo *args = (threadinfo *)arg;
-	char *buffer = s_malloc(BUFFER_SIZE * sizeof *buffer);
+	KatssScratch *scratch = katss_scratch();
+	char *buffer = scratch->buffer;
 
 	KatssHasher *hasher = katss_init_hasher(args->kmer, '\0');
 	if(hasher == NULL) {
@@ -353,15 +372,29 @@ count_file_mt(void *arg)
 	}
 
 	/* Megabyte to store counts */
-	size_t num_counts = 250000;
-	uint32_t *hash_values = s_malloc(num_counts * sizeof *hash_values);
+	size_t num_counts = KATSS_SCRATCH_HASHES;
+	uint32_t *hash_values = scratch->hashes;
 	size_t cur_hash = 0;
 
-	/* Begin counting */
-	while(seqfread(args->seqfile, buffer, BUFFER_SIZE)) {
-		katss_set_seq(hasher, buffer, args->filetype);
-		while(katss_get_fh(hasher, &hash_values[cur_hash], args->filetype)) {
-			if(++cur_hash == num_counts) { // begin flushing
+	/* Begin counting, spans of a mapped reads file are hashed where they are */
+	const bool mapped = seqfismapped(args->seqfile) && seqftype(args->seqfile) == 's';
+	const char *span;
+	size_t length;
+	while((length = mapped ? seqfview(args->seqfile, &span, BUFFER_SIZE)
+	                       : seqfreadseqs(args->seqfile, buffer, BUFFER_SIZE))) {
+		if(mapped)
+			katss_set_span(hasher, span, length);
+		else
+			katss_set_seq(hasher, buffer, args->filetype);
+		if(args->local != NULL) { /* Private table needs no buffering */
+			while((cur_hash = args->hash_block(hasher, hash_values, num_counts)))
+				katss_increments_unlocked(args->local, hash_values, cur_hash);
+			continue;
+		}
+		size_t num_hashes;
+		while((num_hashes = args->hash_block(hasher, hash_values + cur_hash,
+		                                     num_counts - cur_hash))) {
+			if((cur_hash += num_hashes) == num_counts) { // begin flushing
 				katss_increments(args->counter, hash_values, cur_hash);
 				cur_hash = 0;
 			}
@@ -373,239 +406,1120 @@ count_file_mt(void *arg)
 
 	/* Free resources */
 	free(hasher);
-	free(buffer);
-	free(hash_values);
 
 	return 0;
 }
 
-/*==============================================================================
- Ushuffle counting functions
-==============================================================================*/
-KatssCounter *
-katss_count_kmers_ushuffle(const char *filename, unsigned int kmer, int klet)
+
+static int
+count_long(const char *filename, SeqFile seqfile, KatssCounter *counter,
+           const katss_str_node_t *removed, int threads)
 {
-	/* Determine file type, or return NULL on error */
-	char filetype = determine_filetype(filename);
-	if(filetype == 'e' || filetype == 'N')
-		return NULL;
+	/* Read the file from memory if it was preloaded, where it is one read per line. A file
+	   already open is read again, and a single reader is left to parse while inflating */
+	char filetype = 'r';
+	SeqFile file = NULL;
+	KatssStoreReader *store = seqfile == NULL ? katss_open_store(filename) : NULL;
+	if(store == NULL &&
+	   (file = katss_rewind_file(filename, seqfile, threads <= 1 ? "t" : "", &filetype)) == NULL)
+		return 1;
 
-	if(klet < 1)
-		return NULL;
+	threads = MAX2(threads, 1);
+	threads = MIN2(threads, 128);
+	threadinfo *jobarg = s_calloc(threads, sizeof *jobarg);
+	for(int i=0; i<threads; i++) {
+		jobarg[i].seqfile = file;
+		jobarg[i].store = store;
+		jobarg[i].counter = counter;
+		jobarg[i].removed = removed;
+		jobarg[i].kmer = counter->kmer;
+		jobarg[i].filetype = filetype;
+	}
 
-	KatssCounter *counter = NULL;
+	if(threads == 1) {
+		count_long_mt(&jobarg[0]);
+	} else {
+		KatssTaskGroup *jobs = katss_init_task_group();
+		for(int i=0; i<threads; i++)
+			katss_submit_task(jobs, count_long_mt, &jobarg[i]);
+		katss_wait_task_group(jobs);
+	}
 
-	/* Open file and prepare counter & hasher */
-	char *buffer = s_calloc(BUFFER_SIZE, sizeof *buffer);
-	char *shuf   = s_calloc(BUFFER_SIZE, sizeof *shuf);
-	uint32_t hash_value;
+	if(store != NULL)
+		katss_close_store(store);
+	else if(file != seqfile)
+		seqfclose(file);
+	free(jobarg);
+	return 0;
+}
 
-	/* Open file */
-	filetype = filetype == 'r' ? 's' : filetype;
-	buffer[0] = filetype;
-	SeqFile read_file = seqfopen(filename, buffer);
-	if(read_file == NULL)
-		goto exit;
 
-	KatssHasher *hasher = katss_init_hasher(kmer, filetype);
+static int
+count_long_mt(void *arg)
+{
+	threadinfo *args = (threadinfo *)arg;
+	KatssScratch *scratch = katss_scratch();
+	char *buffer = scratch->buffer;
+
+	KatssHasher *hasher = katss_init_hasher(args->kmer, args->filetype);
 	if(hasher == NULL)
-		goto cleanup_file;
+		return 1;
 
-	counter = katss_init_counter(kmer);
-	if(counter == NULL)
-		goto cleanup_hasher;
+	/* The scratch hashes hold half as many 64-bit ones */
+	uint64_t *hash_values = (uint64_t *)scratch->hashes;
+	size_t num_counts = KATSS_SCRATCH_HASHES / 2;
+	size_t cur_hash = 0;
+	KatssMasker *masker = katss_init_masker(args->removed, args->filetype);
 
-	srand(1); // reset rand seed for shuffle
-	while(seqfgets_unlocked(read_file, buffer, BUFFER_SIZE)) {
-		int seqlen = strlen(buffer);
-		shuffle(buffer, shuf, seqlen, klet);
-		shuf[seqlen] = '\0';
-		katss_set_seq(hasher, shuf, 'r');
-		while(katss_get_fh(hasher, &hash_value, 'r')) {
-			katss_increment(counter, hash_value);
+	while(args->store ? katss_store_read(args->store, buffer, BUFFER_SIZE)
+	                  : seqfread(args->seqfile, buffer, BUFFER_SIZE)) {
+		katss_mask(masker, buffer);
+		katss_set_seq(hasher, buffer, args->filetype);
+		while(katss_get_fh64(hasher, &hash_values[cur_hash], args->filetype)) {
+			if(++cur_hash == num_counts) {
+				katss_increments64(args->counter, hash_values, cur_hash);
+				cur_hash = 0;
+			}
 		}
 	}
+	katss_increments64(args->counter, hash_values, cur_hash);
 
-	/* If error was encountered while reading report and return NULL */
-	if(seqferrno) {
-		katss_free_counter(counter);
-		counter = NULL;
-		error_message("katss: %d: %s", seqferrno, seqfstrerror(seqferrno));
-	}
-
-cleanup_hasher:
+	katss_free_masker(masker);
 	free(hasher);
-cleanup_file:
-	seqfclose(read_file);
-exit:
-	free(buffer);
-	free(shuf);
-	return counter;
+	return 0;
 }
 
-KatssCounter *
-katss_count_kmers_ushuffle_bootstrap(const char *filename, unsigned int kmer,
-                                     int klet, int sample, unsigned int *seed)
-{
-	/* sample should be between 1-100000 */
-	sample = MAX2(sample, 1);
-	sample = MIN2(sample, 100000);
-
-	/* If not subsampling, just do regular ushuffle */
-	if(sample == 100000)
-		return katss_count_kmers_ushuffle(filename, kmer, klet);
-
-	/* Check klet */
-	if(klet < 1)
-		return NULL;
-
-	char filetype = determine_filetype(filename);
-	if(filetype == 'e' || filetype == 'N')
-		return NULL;
 
-	KatssCounter *counter = NULL;
+int
+katss_count_canonical(const char *filename, SeqFile seqfile, KatssCounter *counter, int threads)
+{
+	if(counter == NULL)
+		return 3;
 
-	/* Initialize buffer */
-	char *buffer = s_calloc(BUFFER_SIZE, sizeof *buffer);
-	char *shuf   = s_calloc(BUFFER_SIZE, sizeof *shuf);
-	uint32_t hash_value;
+	/* Read the file from memory if it was preloaded, where it is one read per line */
+	char filetype = 'r';
+	SeqFile file = NULL;
+	KatssStoreReader *store = seqfile == NULL ? katss_open_store(filename) : NULL;
+	if(store == NULL &&
+	   (file = katss_rewind_file(filename, seqfile, threads <= 1 ? "t" : "", &filetype)) == NULL)
+		return filetype == 'e' ? 1 : 2;
 
-	/* Open file and hasher */
-	buffer[0] = filetype == 'r' ? 's' : filetype;
-	SeqFile read_file = seqfopen(filename, buffer);
-	if(read_file == NULL)
-		goto exit;
-	
-	KatssHasher *hasher = katss_init_hasher(kmer, filetype);
-	if(hasher == NULL)
-		goto cleanup_file;
-	
-	counter = katss_init_counter(kmer);
-	if(counter == NULL)
-		goto cleanup_hasher;
+	/* With several threads, each counts into a private table when it is small enough */
+	threads = MAX2(threads, 1);
+	threads = MIN2(threads, 128);
+	KatssCounter **locals = NULL;
+	if(threads > 1 && counter->sparse == NULL && counter->sketch == NULL)
+		locals = katss_init_private_counters(counter->kmer, threads);
 
-	/* Initialize random number generator */
-	thread_safe_rand_t *tsr = thread_safe_rand_init();
+	/* K-mers longer than 16 bases need 64-bit hashes, which only the rolling hasher gives */
+	KatssHashBlock hash_block = NULL;
+	if(counter->kmer <= KATSS_DENSE_KMER)
+		hash_block = katss_hash_block_kernel(counter->kmer, filetype);
 
-	/* If no seed was provided create one */
-	unsigned int local_seed;
-	if(seed == NULL) {
-		local_seed = time(NULL);
-		seed = &local_seed;
+	threadinfo *jobarg = s_calloc(threads, sizeof *jobarg);
+	for(int i=0; i<threads; i++) {
+		jobarg[i].seqfile = file;
+		jobarg[i].store = store;
+		jobarg[i].counter = counter;
+		jobarg[i].local = locals ? locals[i] : NULL;
+		jobarg[i].hash_block = hash_block;
+		jobarg[i].kmer = counter->kmer;
+		jobarg[i].filetype = filetype;
 	}
 
-	srand(1); // reset rand seed for shuffle
-	while(seqfgets_unlocked(read_file, buffer, BUFFER_SIZE)) {
-		/* Pick random sequences */
-		if(thread_safe_rand_r(tsr, seed) % 100000 >= sample)
-			continue;
-		/* Shuffle sequences */
-		int seqlen = strlen(buffer);
-		shuffle(buffer, shuf, strlen(buffer), klet);
-		shuf[seqlen] = '\0'; // add null terminator since shuffle uses strncpy
-		katss_set_seq(hasher, shuf, 'r');
-		while(katss_get_fh(hasher, &hash_value, 'r')) {
-			katss_increment(counter, hash_value);
-		}
+	int ret;
+	if(threads == 1) {
+		ret = count_canonical_mt(&jobarg[0]);
+	} else {
+		KatssTaskGroup *jobs = katss_init_task_group();
+		for(int i=0; i<threads; i++)
+			katss_submit_task(jobs, count_canonical_mt, &jobarg[i]);
+		ret = katss_wait_task_group(jobs);
 	}
+	katss_merge_private_counters(counter, locals, threads);
 
-	if(seqferrno) {
-		error_message("katss: sample: %s\n", seqfstrerror_r(seqferrno, buffer, BUFFER_SIZE));
-		katss_free_counter(counter);
-		counter = NULL;
-	}
+	if(store != NULL)
+		katss_close_store(store);
+	else if(file != seqfile)
+		seqfclose(file);
+	free(jobarg);
+	return ret;
+}
 
-cleanup_hasher:
+
+static int
+count_canonical_mt(void *arg)
+{
+	threadinfo *args = (threadinfo *)arg;
+	KatssScratch *scratch = katss_scratch();
+	char *buffer = scratch->buffer;
+
+	KatssHasher *hasher = katss_init_hasher(args->kmer, args->filetype);
+	if(hasher == NULL)
+		return 1;
+	katss_set_canonical(hasher, true);
+
+	/* The scratch hashes hold half as many 64-bit ones */
+	uint32_t *hash_values = scratch->hashes;
+	uint64_t *hash_values64 = (uint64_t *)scratch->hashes;
+	size_t num_counts = KATSS_SCRATCH_HASHES / 2;
+	size_t cur_hash = 0, num_hashes;
+
+	while(args->store ? katss_store_read(args->store, buffer, BUFFER_SIZE)
+	                  : seqfread(args->seqfile, buffer, BUFFER_SIZE)) {
+		katss_set_seq(hasher, buffer, args->filetype);
+		if(args->hash_block == NULL) {
+			while(katss_get_fh64(hasher, &hash_values64[cur_hash], args->filetype)) {
+				if(++cur_hash == num_counts) {
+					katss_increments64(args->counter, hash_values64, cur_hash);
+					cur_hash = 0;
+				}
+			}
+		} else if(args->local != NULL) { /* Private table needs no buffering */
+			while((num_hashes = args->hash_block(hasher, hash_values, KATSS_SCRATCH_HASHES)))
+				katss_increments_unlocked(args->local, hash_values, num_hashes);
+		} else {
+			while((num_hashes = args->hash_block(hasher, hash_values + cur_hash,
+			                                     KATSS_SCRATCH_HASHES - cur_hash))) {
+				if((cur_hash += num_hashes) == KATSS_SCRATCH_HASHES) {
+					katss_increments(args->counter, hash_values, cur_hash);
+					cur_hash = 0;
+				}
+			}
+		}
+	}
+	if(args->hash_block == NULL)
+		katss_increments64(args->counter, hash_values64, cur_hash);
+	else
+		katss_increments(args->counter, hash_values, cur_hash);
 	free(hasher);
-cleanup_file:
-	seqfclose(read_file);
-exit:
-	free(buffer);
-	free(shuf);
-	return counter;
+
+	if(args->store == NULL && seqferrno) {
+		error_message("katss: %d: %s", seqferrno, seqfstrerror(seqferrno));
+		return 4;
+	}
+	return 0;
 }
 
-/*==============================================================
-|  Helper Functions                                            |
-==============================================================*/
-static char
-determine_filetype(const char *file)
-{
-	/* Open the SeqFile, return 'e' upon error */
-	SeqFile reads_file = seqfopen(file, "b");
-	if(reads_file == NULL) {
-		error_message("katss: %s: %s", file, seqfstrerror(seqferrno));
-		seqfclose(reads_file);
-		return 'N';
-	}
-
-	char buffer[BUFFER_SIZE];
-	int lines_read = 0;
-	int fastq_score_lines = 0;
-	int fasta_score_lines = 0;
-	int sequence_lines = 0;
-
-	while (seqfgets(reads_file, buffer, BUFFER_SIZE) != NULL && lines_read < 10) {
-		lines_read++;
-		char first_char = buffer[0];
-
-		/* Check if the first line starts with '@' for FASTQ */
-		if (first_char == '@' && lines_read % 4 == 1) {
-			fastq_score_lines++;
-
-		/* Check if the third line starts with '+' for FASTQ */
-		} else if (first_char == '+' && lines_read % 4 == 3) {
-			fastq_score_lines++;
-
-		/* Check if the line starts with '>' or ';' for FASTA */
-		/* TODO: fastq can potentially have a '>' or ';' in its quality score,
-		meaning that file can be incorrectly guessed as fasta when it is fastq */
-		} else if (first_char == '>' || first_char == ';') {
-			fasta_score_lines++;
-		} else {
-			// Check for nucleotide characters
-			int num_total = 0, num = 0;
-			for(int i = 0; buffer[i] != '\0'; i++) {
-				if(is_nucleotide(buffer[i])) {
-					num++;
+/*==============================================================================
+ Multi-counter counting functions
+==============================================================================*/
+int
+katss_count_kmers_multi(const char *filename, KatssCounter **counters, int num_counters)
+{
+	return run_multi(filename, NULL, counters, num_counters, NULL, 100000, NULL, 1);
+}
+
+
+int
+katss_count_kmers_multi_mt(const char *filename, KatssCounter **counters, int num_counters,
+                           int threads)
+{
+	return run_multi(filename, NULL, counters, num_counters, NULL, 100000, NULL, threads);
+}
+
+
+int
+katss_count_kmers_multi_seqfile(KatssCounter **counters, int num_counters, SeqFile file,
+                                int threads)
+{
+	if(file == NULL)
+		return 2;
+	return run_multi(NULL, file, counters, num_counters, NULL, 100000, NULL, threads);
+}
+
+
+int
+katss_count_kmers_bootstrap_multi(const char *filename, KatssCounter **counters,
+                                  int num_counters, int sample, unsigned int *seed)
+{
+	/* sample should be between 1-100000 */
+	sample = MAX2(sample, 1);
+	sample = MIN2(sample, 100000);
+
+	/* If no seed was provided create one */
+	unsigned int local_seed;
+	if(seed == NULL) {
+		local_seed = time(NULL);
+		seed = &local_seed;
+	}
+
+	return run_multi(filename, NULL, counters, num_counters, NULL, sample, seed, 1);
+}
+
+
+int
+katss_count_kmers_bootstrap_multi_mt(const char *filename, KatssCounter **counters,
+                                     int num_counters, int sample, unsigned int *seed,
+                                     int threads)
+{
+	sample = MAX2(sample, 1);
+	sample = MIN2(sample, 100000);
+
+	unsigned int local_seed;
+	if(seed == NULL) {
+		local_seed = time(NULL);
+		seed = &local_seed;
+	}
+
+	return run_multi(filename, NULL, counters, num_counters, NULL, sample, seed, threads);
+}
+
+
+int
+katss_count_multi(const char *filename, SeqFile seqfile, KatssCounter **counters,
+                  int num_counters, const katss_str_node_t *removed, int threads)
+{
+	return run_multi(filename, seqfile, counters, num_counters, removed, 100000, NULL, threads);
+}
+
+
+static int
+count_multi_mt(void *arg)
+{
+	threadinfo *args = (threadinfo *)arg;
+	char *buffer = katss_scratch()->buffer;
+	KatssMasker *masker = katss_init_masker(args->removed, args->filetype);
+
+	while(args->store ? katss_store_read(args->store, buffer, BUFFER_SIZE)
+	                  : seqfread(args->seqfile, buffer, BUFFER_SIZE)) {
+		/* Remove unwanted k-mers */
+		katss_mask(masker, buffer);
+		katss_multi_hash_seq(args->multi, buffer);
+	}
+	katss_multi_hash_end(args->multi);
+	katss_free_masker(masker);
+
+	if(args->store == NULL && seqferrno) {
+		error_message("katss: %d: %s", seqferrno, seqfstrerror(seqferrno));
+		return 4;
+	}
+	return 0;
+}
+
+
+static int
+count_multi_bootstrap_mt(void *arg)
+{
+	threadinfo *args = (threadinfo *)arg;
+	char *buffer = katss_scratch()->buffer;
+	read_batch batch;
+	init_batch(&batch);
+	KatssRng rng;
+	uint64_t index;
+	size_t length;
+	char *read;
+
+	/* One draw per read decides whether all counters count it */
+	while((read = next_read(args, &batch, buffer, &index, &length))) {
+		katss_seed_rng(&rng, args->seed, index);
+		if(katss_rng_below(&rng, 100000) >= (uint32_t)args->sample)
+			continue;
+		if((read = load_read(args, read, index, &length)) == NULL) {
+			free_batch(&batch);
+			return 4;
+		}
+		katss_multi_hash_read(args->multi, read);
+	}
+	free_batch(&batch);
+
+	if(args->seqfile != NULL && seqferrno) {
+		error_message("katss: %d: %s", seqferrno, seqfstrerror(seqferrno));
+		return 4;
+	}
+	return 0;
+}
+
+
+static int
+run_multi(const char *filename, SeqFile seqfile, KatssCounter **counters, int num_counters,
+          const katss_str_node_t *removed, int sample, unsigned int *seed, int threads)
+{
+	if(counters == NULL || num_counters < 1)
+		return 3;
+	int largest = 0;
+	for(int i=0; i<num_counters; i++) {
+		if(counters[i] == NULL)
+			return 3;
+		if(counters[i]->kmer > counters[largest]->kmer)
+			largest = i;
+	}
+
+	/* K-mers longer than 16 bases are hashed on their own, the rest together as usual */
+	if(counters[largest]->kmer > KATSS_DENSE_KMER) {
+		if(sample != 100000) {
+			error_message("katss: k-mers longer than %d can only be counted over every read",
+			              KATSS_DENSE_KMER);
+			return 3;
+		}
+		KatssCounter **shorter = s_malloc(num_counters * sizeof *shorter);
+		int num_shorter = 0, ret = 0;
+		for(int i=0; i<num_counters && ret == 0; i++) {
+			if(counters[i]->kmer > KATSS_DENSE_KMER)
+				ret = count_long(filename, seqfile, counters[i], removed, threads);
+			else
+				shorter[num_shorter++] = counters[i];
+		}
+		if(ret == 0 && num_shorter > 0)
+			ret = run_multi(filename, seqfile, shorter, num_shorter, removed, sample, seed,
+			                threads);
+		free(shorter);
+		return ret;
+	}
+
+	/* Every pass draws the same reads, following calls draw other ones */
+	unsigned int key = 0;
+	if(seed != NULL) {
+		key = *seed;
+		*seed = *seed * 1103515245U + 12345U;
+	}
+
+	/* Shorter k-mers are summed from the table of the largest one, along with the tails of its
+	   runs. This only pays off when the tables are small enough to be private to each thread */
+	KatssCounter *source = counters[largest];
+	if(source->kmer > KATSS_PRIVATE_KMER || source->total != 0)
+		return count_multi_pass(filename, seqfile, counters, num_counters, removed, sample, key, threads);
+
+	KatssCounter **counted = s_malloc(num_counters * sizeof *counted);
+	KatssCounter **summed = s_malloc(num_counters * sizeof *summed);
+	int num_counted = 0, num_summed = 0;
+	for(int i=0; i<num_counters; i++) {
+		if(counters[i]->kmer < source->kmer)
+			summed[num_summed++] = counters[i];
+		else
+			counted[num_counted++] = counters[i];
+	}
+
+	int ret;
+	if(num_summed == 0) {
+		ret = count_multi_pass(filename, seqfile, counters, num_counters, removed, sample, key, threads);
+		goto cleanup;
+	}
+
+	katss_keep_tails(source);
+	ret = count_multi_pass(filename, seqfile, counted, num_counted, removed, sample, key, threads);
+	if(ret != 0)
+		goto cleanup;
+
+	if(!source->partial_tails) {
+		for(int i=0; i<num_summed; i++)
+			katss_marginalize(summed[i], source, threads);
+	} else {
+		/* Blank lines within a sequence split some runs, count the rest from the same reads */
+		ret = count_multi_pass(filename, seqfile, summed, num_summed, removed, sample, key, threads);
+	}
+
+cleanup:
+	free(counted);
+	free(summed);
+	return ret;
+}
+
+
+static int
+count_multi_pass(const char *filename, SeqFile seqfile, KatssCounter **counters,
+                 int num_counters, const katss_str_node_t *removed, int sample,
+                 unsigned int seed, int threads)
+{
+	threads = MAX2(threads, 1);
+	threads = MIN2(threads, 128);
+
+	/* Read the file from memory if it was preloaded, or only the sampled reads if it is indexed,
+	   where it is one read per line. A file already open is read again instead */
+	char filetype = 'r';
+	SeqFile file = NULL;
+	KatssStoreReader *store = seqfile == NULL ? katss_open_store(filename) : NULL;
+	KatssIndexReader *index = seqfile == NULL && store == NULL && sample < 100000
+	                          ? katss_open_index(filename) : NULL;
+	if(store == NULL && index == NULL &&
+	   (file = katss_rewind_file(filename, seqfile, "", &filetype)) == NULL)
+		return filetype == 'e' ? 1 : 2;
+
+	/* With several threads, each counts into private tables when they are small enough */
+	KatssCounter ***locals = s_calloc(num_counters, sizeof *locals);
+	if(threads > 1) {
+		for(int i=0; i<num_counters; i++) {
+			locals[i] = katss_init_private_counters(counters[i]->kmer, threads);
+			for(int t=0; locals[i] != NULL && counters[i]->tails != NULL && t<threads; t++)
+				katss_keep_tails(locals[i][t]);
+		}
+	}
+
+	KatssCounter **targets = s_malloc(num_counters * sizeof *targets);
+	bool *locked = s_malloc(num_counters * sizeof *locked);
+	threadinfo *jobarg = s_malloc(threads * sizeof *jobarg);
+	mtx_t reads_lock;
+	uint64_t next_index = 0;
+	mtx_init(&reads_lock, mtx_plain);
+	for(int t=0; t<threads; t++) {
+		for(int i=0; i<num_counters; i++) {
+			targets[i] = locals[i] ? locals[i][t] : counters[i];
+			locked[i] = threads > 1 && locals[i] == NULL;
+		}
+		jobarg[t].seqfile = file;
+		jobarg[t].store = store;
+		jobarg[t].index = index;
+		jobarg[t].claimed = jobarg[t].claimed_end = 0;
+		jobarg[t].multi = katss_init_multi_hasher(targets, locked, num_counters, filetype);
+		jobarg[t].removed = removed;
+		jobarg[t].filetype = filetype;
+		jobarg[t].reads_lock = &reads_lock;
+		jobarg[t].next_read = &next_index;
+		jobarg[t].sample = sample;
+		jobarg[t].seed = seed;
+	}
+
+	/* Begin counting, on the calling thread if only one is used */
+	int (*job)(void *) = sample < 100000 ? count_multi_bootstrap_mt : count_multi_mt;
+	int ret = 0;
+	if(threads == 1) {
+		ret = job(&jobarg[0]);
+	} else {
+		KatssTaskGroup *jobs = katss_init_task_group();
+		for(int t=0; t<threads; t++)
+			katss_submit_task(jobs, job, &jobarg[t]);
+		ret = katss_wait_task_group(jobs);
+	}
+
+	/* Merge private tables and free resources */
+	for(int i=0; i<num_counters; i++)
+		katss_merge_private_counters(counters[i], locals[i], threads);
+	for(int t=0; t<threads; t++)
+		katss_free_multi_hasher(jobarg[t].multi);
+	if(store != NULL)
+		katss_close_store(store);
+	else if(index != NULL)
+		katss_close_index(index);
+	else if(file != seqfile)
+		seqfclose(file);
+	mtx_destroy(&reads_lock);
+	free(locals);
+	free(targets);
+	free(locked);
+	free(jobarg);
+
+	return ret;
+}
+
+/*==============================================================================
+ Bootstrap replicate counting functions
+==============================================================================*/
+int
+katss_count_kmers_replicates(const char *filename, KatssCounter **replicates, int num_replicates,
+                             int sample, unsigned int *seed)
+{
+	return katss_count_kmers_replicates_mt(filename, replicates, num_replicates, sample, seed, 1);
+}
+
+
+int
+katss_count_kmers_replicates_mt(const char *filename, KatssCounter **replicates,
+                                int num_replicates, int sample, unsigned int *seed, int threads)
+{
+	if(replicates == NULL || num_replicates < 1)
+		return 3;
+	for(int r=0; r<num_replicates; r++) {
+		if(replicates[r] == NULL || replicates[r]->kmer != replicates[0]->kmer)
+			return 3;
+	}
+	if(replicates[0]->kmer > KATSS_DENSE_KMER) {
+		error_message("katss: k-mers longer than %d can only be counted over every read",
+		              KATSS_DENSE_KMER);
+		return 3;
+	}
+
+	/* sample should be 0 for Poisson weights, or between 1-100000 */
+	sample = sample == 0 ? 0 : MIN2(MAX2(sample, 1), 100000);
+	threads = MAX2(threads, 1);
+	threads = MIN2(threads, 128);
+	unsigned int local_seed;
+	if(seed == NULL) {
+		local_seed = time(NULL);
+		seed = &local_seed;
+	}
+
+	/* Read the file from memory if it was preloaded, or only the sampled reads if it is indexed,
+	   where it is one read per line. Poisson weights count nearly every read, which streams faster */
+	char filetype = 'r';
+	SeqFile file = NULL;
+	KatssStoreReader *store = katss_open_store(filename);
+	KatssIndexReader *index = store == NULL && sample > 0 && sample < 100000
+	                          ? katss_open_index(filename) : NULL;
+	if(store == NULL && index == NULL && (file = katss_open_file(filename, "", &filetype)) == NULL)
+		return filetype == 'e' ? 1 : 2;
+
+	/* Every replicate draws from the seed it would be given counted on its own, so replicates
+	   are the same however many of them are counted at once */
+	unsigned int *replicate_seeds = s_malloc(num_replicates * sizeof *replicate_seeds);
+	for(int r=0; r<num_replicates; r++) {
+		replicate_seeds[r] = *seed;
+		*seed = *seed * 1103515245U + 12345U;
+	}
+
+	/* Threads get private tables for every replicate if they all fit in the budget */
+	unsigned int kmer = replicates[0]->kmer;
+	uint64_t table_bytes = (UINT64_C(1) << 2*kmer) * sizeof(uint32_t);
+	bool private = threads > 1 && kmer <= KATSS_PRIVATE_KMER &&
+	               (uint64_t)threads * num_replicates * table_bytes <= KATSS_REPLICATES_MAX_BYTES;
+	KatssCounter ***locals = s_calloc(num_replicates, sizeof *locals);
+	for(int r=0; private && r<num_replicates; r++)
+		locals[r] = katss_init_private_counters(kmer, threads);
+
+	threadinfo *jobarg = s_malloc(threads * sizeof *jobarg);
+	mtx_t reads_lock;
+	uint64_t next_index = 0;
+	mtx_init(&reads_lock, mtx_plain);
+	for(int t=0; t<threads; t++) {
+		jobarg[t].seqfile = file;
+		jobarg[t].store = store;
+		jobarg[t].index = index;
+		jobarg[t].claimed = jobarg[t].claimed_end = 0;
+		jobarg[t].replicates = s_malloc(num_replicates * sizeof *jobarg[t].replicates);
+		for(int r=0; r<num_replicates; r++)
+			jobarg[t].replicates[r] = private ? locals[r][t] : replicates[r];
+		jobarg[t].num_replicates = num_replicates;
+		jobarg[t].locked = threads > 1 && !private;
+		jobarg[t].reads_lock = &reads_lock;
+		jobarg[t].next_read = &next_index;
+		jobarg[t].replicate_seeds = replicate_seeds;
+		jobarg[t].kmer = kmer;
+		jobarg[t].sample = sample;
+		jobarg[t].filetype = filetype;
+	}
+
+	/* Begin counting, on the calling thread if only one is used */
+	int ret = 0;
+	if(threads == 1) {
+		ret = count_replicates_mt(&jobarg[0]);
+	} else {
+		KatssTaskGroup *jobs = katss_init_task_group();
+		for(int t=0; t<threads; t++)
+			katss_submit_task(jobs, count_replicates_mt, &jobarg[t]);
+		ret = katss_wait_task_group(jobs);
+	}
+
+	/* Merge private tables and free resources */
+	for(int r=0; r<num_replicates; r++)
+		katss_merge_private_counters(replicates[r], locals[r], threads);
+	for(int t=0; t<threads; t++)
+		free(jobarg[t].replicates);
+	if(store != NULL)
+		katss_close_store(store);
+	else if(index != NULL)
+		katss_close_index(index);
+	else
+		seqfclose(file);
+	mtx_destroy(&reads_lock);
+	free(replicate_seeds);
+	free(locals);
+	free(jobarg);
+	return ret;
+}
+
+
+static int
+count_replicates_mt(void *arg)
+{
+	threadinfo *args = (threadinfo *)arg;
+	KatssScratch *scratch = katss_scratch();
+	char *buffer = scratch->buffer;
+	uint32_t *hashes = scratch->hashes;
+	KatssHasher *hasher = katss_init_hasher(args->kmer, '\0');
+	if(hasher == NULL)
+		return 1;
+	KatssHashBlock hash_block = katss_hash_block_kernel(args->kmer, args->filetype);
+
+	/* Reads are hashed once into a block, counted into every replicate when the block is full */
+	const int num_replicates = args->num_replicates;
+	uint32_t *staging = args->locked ? s_malloc(REPLICATE_BLOCK * sizeof *staging) : NULL;
+	uint32_t *read_ends = s_malloc(REPLICATE_READS * sizeof *read_ends);
+	uint8_t *weights = s_malloc(REPLICATE_READS * num_replicates * sizeof *weights);
+	size_t num_hashes = 0;
+	int num_reads = 0;
+	read_batch batch;
+	init_batch(&batch);
+	KatssRng rng;
+	uint64_t index;
+	size_t length;
+	char *read;
+	int ret = 0;
+
+	while((read = next_read(args, &batch, buffer, &index, &length))) {
+		/* Draw how many times every replicate counts the read */
+		uint8_t *weight = weights + (size_t)num_reads * num_replicates;
+		bool counted = false;
+		for(int r=0; r<num_replicates; r++) {
+			katss_seed_rng(&rng, args->replicate_seeds[r], index);
+			weight[r] = draw_weight(&rng, args->sample);
+			counted |= weight[r] != 0;
+		}
+		if(!counted)
+			continue;
+		if((read = load_read(args, read, index, &length)) == NULL) {
+			ret = 4;
+			break;
+		}
+
+		/* Nothing is carried over from the previous read */
+		hasher->previous_hash = 0;
+		hasher->has_previous = false;
+		hasher->endno = 0;
+		hasher->pos = 0;
+		katss_set_seq(hasher, read, args->filetype);
+		size_t hashed;
+		while((hashed = hash_block(hasher, hashes + num_hashes, REPLICATE_BLOCK - num_hashes))) {
+			if((num_hashes += hashed) < REPLICATE_BLOCK)
+				continue;
+			/* The rest of the read starts the next block, with the same weights */
+			read_ends[num_reads] = num_hashes;
+			flush_replicates(args, hashes, read_ends, weights, num_reads + 1, staging);
+			memmove(weights, weight, num_replicates * sizeof *weights);
+			weight = weights;
+			num_reads = 0;
+			num_hashes = 0;
+		}
+		read_ends[num_reads++] = num_hashes;
+		if(num_reads == REPLICATE_READS) {
+			flush_replicates(args, hashes, read_ends, weights, num_reads, staging);
+			num_reads = 0;
+			num_hashes = 0;
+		}
+	}
+	flush_replicates(args, hashes, read_ends, weights, num_reads, staging);
+
+	free_batch(&batch);
+	free(hasher);
+	free(staging);
+	free(read_ends);
+	free(weights);
+
+	if(args->seqfile != NULL && seqferrno) {
+		error_message("katss: %d: %s", seqferrno, seqfstrerror(seqferrno));
+		return 4;
+	}
+	return ret;
+}
+
+
+/**
+ * @brief Count the hashes of every read in the block into the tables of the replicates, as many
+ * times as each replicate drew for it. One table is updated at a time so it stays in cache.
+ */
+static void
+flush_replicates(threadinfo *args, const uint32_t *hashes, const uint32_t *read_ends,
+                 const uint8_t *weights, int num_reads, uint32_t *staging)
+{
+	for(int r=0; r<args->num_replicates; r++) {
+		KatssCounter *replicate = args->replicates[r];
+		size_t staged = 0;
+		for(int j=0; j<num_reads; j++) {
+			uint32_t start = j == 0 ? 0 : read_ends[j-1];
+			uint32_t length = read_ends[j] - start;
+			for(uint8_t w=weights[(size_t)j * args->num_replicates + r]; w>0; w--) {
+				if(!args->locked) {
+					katss_increments_unlocked(replicate, hashes + start, length);
+					continue;
 				}
-				num_total++;
+				/* Shared tables are locked once for many reads */
+				if(staged + length > REPLICATE_BLOCK) {
+					katss_increments(replicate, staging, staged);
+					staged = 0;
+				}
+				memcpy(staging + staged, hashes + start, length * sizeof *staging);
+				staged += length;
 			}
-			if((double)num/num_total > 0.9) {
-				sequence_lines++;
+		}
+		if(staged > 0)
+			katss_increments(replicate, staging, staged);
+	}
+}
+
+
+/**
+ * @brief Number of times a replicate counts a read: 1 with probability `sample` in 100000, else
+ * 0, or a Poisson(1) number of times if `sample` is 0.
+ */
+static inline uint8_t
+draw_weight(KatssRng *rng, int sample)
+{
+	if(sample > 0)
+		return katss_rng_below(rng, 100000) < (uint32_t)sample;
+
+	/* Cumulative probabilities of Poisson(1), anything above is drawn 1 in 10^10 times */
+	static const double poisson_cdf[] = {
+		0.36787944117144233, 0.7357588823428847, 0.9196986029286058, 0.9810118431238463,
+		0.9963401531726563,  0.9994058151824183, 0.999916758850712,  0.9999897508033253,
+		0.999998874797402,   0.9999998885745216, 0.9999999899522336,
+	};
+	double u = katss_rng_uniform(rng);
+	uint8_t k = 0;
+	while(k < sizeof poisson_cdf / sizeof *poisson_cdf && u >= poisson_cdf[k])
+		k++;
+	return k;
+}
+
+
+/**
+ * @brief Prepare an empty batch of reads, allocating it the first time `next_read` fills it.
+ */
+static void
+init_batch(read_batch *batch)
+{
+	batch->reads = NULL;
+	batch->ends = NULL;
+	batch->num_reads = 0;
+	batch->next = 0;
+	batch->first = 0;
+}
+
+
+static void
+free_batch(read_batch *batch)
+{
+	free(batch->reads);
+	free(batch->ends);
+}
+
+
+/**
+ * @brief Get the next read of the file shared by the threads, along with its index in the file,
+ * which the draws for the read are keyed by, and its length. Streamed reads are taken a batch at a
+ * time, with the file locked once for the whole batch, and point into `batch`. Reads of indexed
+ * files are only read into `buffer` once they are known to be sampled, see `load_read`.
+ */
+static char *
+next_read(threadinfo *args, read_batch *batch, char *buffer, uint64_t *index, size_t *length)
+{
+	if(args->index != NULL) {
+		if(args->claimed == args->claimed_end) {
+			mtx_lock(args->reads_lock);
+			args->claimed = *args->next_read;
+			*args->next_read += INDEX_CLAIM;
+			mtx_unlock(args->reads_lock);
+			args->claimed_end = args->claimed + INDEX_CLAIM;
+		}
+		*index = args->claimed++;
+		return *index < katss_index_reads(args->index) ? buffer : NULL;
+	}
+
+	/* Take the next batch once every read of this one was handed out */
+	if(batch->next == batch->num_reads) {
+		if(batch->reads == NULL) {
+			batch->reads = s_malloc(BATCH_SIZE * sizeof *batch->reads);
+			batch->ends = s_malloc(BATCH_READS * sizeof *batch->ends);
+		}
+		mtx_lock(args->reads_lock);
+		batch->num_reads = args->store
+		        ? katss_store_readbatch(args->store, batch->reads, BATCH_SIZE, BUFFER_SIZE,
+		                                batch->ends, BATCH_READS)
+		        : seqfreadbatch_unlocked(args->seqfile, batch->reads, BATCH_SIZE, BUFFER_SIZE,
+		                                 batch->ends, BATCH_READS);
+		batch->first = *args->next_read;
+		*args->next_read += batch->num_reads;
+		mtx_unlock(args->reads_lock);
+		batch->next = 0;
+		if(batch->num_reads == 0)
+			return NULL;
+	}
+
+	size_t start = batch->next == 0 ? 0 : batch->ends[batch->next - 1] + 1;
+	*length = batch->ends[batch->next] - start;
+	*index = batch->first + batch->next++;
+	return batch->reads + start;
+}
+
+
+/**
+ * @brief Read the sampled read `index` of an indexed file into `read`, the buffer `next_read`
+ * returned for it, and set its length. Streamed reads were already read by `next_read`. Returns
+ * NULL if it could not be read.
+ */
+static char *
+load_read(threadinfo *args, char *read, uint64_t index, size_t *length)
+{
+	if(args->index == NULL)
+		return read;
+	if(katss_index_gets(args->index, index, read, BUFFER_SIZE) == NULL)
+		return NULL;
+	*length = strlen(read);
+	return read;
+}
+
+/*==============================================================================
+ Ushuffle counting functions
+==============================================================================*/
+KatssCounter *
+katss_count_kmers_ushuffle(const char *filename, unsigned int kmer, int klet)
+{
+	return katss_count_kmers_ushuffle_mt(filename, kmer, klet, 1);
+}
+
+
+KatssCounter *
+katss_count_kmers_ushuffle_mt(const char *filename, unsigned int kmer, int klet, int threads)
+{
+	if(klet < 1)
+		return NULL;
+
+	KatssCounter *counter = katss_acquire_file_counter(kmer, filename);
+	if(counter == NULL)
+		return NULL;
+
+	/* Every read is shuffled the same way on every call */
+	if(katss_count_shuffled(counter, filename, klet, NULL, 100000, 1, threads) != 0) {
+		katss_release_counter(counter);
+		return NULL;
+	}
+	return counter;
+}
+
+
+KatssCounter *
+katss_count_kmers_ushuffle_bootstrap(const char *filename, unsigned int kmer,
+                                     int klet, int sample, unsigned int *seed)
+{
+	return katss_count_kmers_ushuffle_bootstrap_mt(filename, kmer, klet, sample, seed, 1);
+}
+
+
+KatssCounter *
+katss_count_kmers_ushuffle_bootstrap_mt(const char *filename, unsigned int kmer, int klet,
+                                        int sample, unsigned int *seed, int threads)
+{
+	/* sample should be between 1-100000 */
+	sample = MAX2(sample, 1);
+	sample = MIN2(sample, 100000);
+
+	/* If not subsampling, just do regular ushuffle */
+	if(sample == 100000)
+		return katss_count_kmers_ushuffle_mt(filename, kmer, klet, threads);
+
+	/* Check klet */
+	if(klet < 1)
+		return NULL;
+
+	/* If no seed was provided create one */
+	unsigned int local_seed;
+	if(seed == NULL) {
+		local_seed = time(NULL);
+		seed = &local_seed;
+	}
+
+	KatssCounter *counter = katss_acquire_file_counter(kmer, filename);
+	if(counter == NULL)
+		return NULL;
+
+	if(katss_count_shuffled(counter, filename, klet, NULL, sample, *seed, threads) != 0) {
+		katss_release_counter(counter);
+		counter = NULL;
+	}
+
+	/* Following calls draw other reads */
+	*seed = *seed * 1103515245U + 12345U;
+	return counter;
+}
+
+
+int
+katss_count_shuffled(KatssCounter *counter, const char *filename, int klet,
+                     const katss_str_node_t *removed, int sample, unsigned int seed, int threads)
+{
+	if(counter->kmer > KATSS_DENSE_KMER) {
+		error_message("katss: k-mers longer than %d can't be counted from shuffled reads",
+		              KATSS_DENSE_KMER);
+		return 3;
+	}
+
+	threads = MAX2(threads, 1);
+	threads = MIN2(threads, 128);
+
+	/* Read the file from memory if it was preloaded, or only the sampled reads if it is indexed,
+	   where it is one read per line */
+	char filetype = 'r';
+	SeqFile file = NULL;
+	KatssStoreReader *store = katss_open_store(filename);
+	KatssIndexReader *index = store == NULL && sample < 100000 ? katss_open_index(filename) : NULL;
+	if(store == NULL && index == NULL && (file = katss_open_file(filename, "", &filetype)) == NULL)
+		return filetype == 'e' ? 1 : 2;
+
+	KatssCounter **locals = threads > 1 ? katss_init_private_counters(counter->kmer, threads)
+	                                    : NULL;
+	threadinfo *jobarg = s_malloc(threads * sizeof *jobarg);
+	mtx_t reads_lock;
+	uint64_t next_index = 0;
+	mtx_init(&reads_lock, mtx_plain);
+	for(int t=0; t<threads; t++) {
+		jobarg[t].seqfile = file;
+		jobarg[t].store = store;
+		jobarg[t].index = index;
+		jobarg[t].claimed = jobarg[t].claimed_end = 0;
+		jobarg[t].counter = counter;
+		jobarg[t].local = locals ? locals[t] : NULL;
+		jobarg[t].removed = removed;
+		jobarg[t].reads_lock = &reads_lock;
+		jobarg[t].next_read = &next_index;
+		jobarg[t].kmer = counter->kmer;
+		jobarg[t].klet = klet;
+		jobarg[t].sample = sample;
+		jobarg[t].seed = seed;
+	}
+
+	/* Begin counting, on the calling thread if only one is used */
+	int ret = 0;
+	if(threads == 1) {
+		ret = count_shuffled_mt(&jobarg[0]);
+	} else {
+		KatssTaskGroup *jobs = katss_init_task_group();
+		for(int t=0; t<threads; t++)
+			katss_submit_task(jobs, count_shuffled_mt, &jobarg[t]);
+		ret = katss_wait_task_group(jobs);
+	}
+
+	/* Merge private tables and free resources */
+	katss_merge_private_counters(counter, locals, threads);
+	if(store != NULL)
+		katss_close_store(store);
+	else if(index != NULL)
+		katss_close_index(index);
+	else
+		seqfclose(file);
+	mtx_destroy(&reads_lock);
+	free(jobarg);
+
+	return ret;
+}
+
+
+static int
+count_shuffled_mt(void *arg)
+{
+	threadinfo *args = (threadinfo *)arg;
+	KatssScratch *scratch = katss_scratch();
+	char *buffer = scratch->buffer;
+	uint32_t *hashes = scratch->hashes;
+	KatssHasher *hasher = katss_init_hasher(args->kmer, '\0');
+	if(hasher == NULL)
+		return 3;
+
+	/* Shuffled reads are plain sequences, whatever the file they come from */
+	KatssHashBlock hash_block = katss_hash_block_kernel(args->kmer, 'r');
+	KatssMasker *masker = katss_init_masker(args->removed, 'r');
+	char *shuf = s_malloc(BUFFER_SIZE * sizeof *shuf);
+	KatssRng rng;
+	ushuffle_t *shuffler = ushuffle_new(katss_rng_randfunc, &rng);
+	size_t num_hashes = 0;
+	read_batch batch;
+	init_batch(&batch);
+	uint64_t index;
+	size_t length;
+	char *read;
+	int ret = 0;
+
+	/* The same draws pick a read and shuffle it */
+	while((read = next_read(args, &batch, buffer, &index, &length))) {
+		katss_seed_rng(&rng, args->seed, index);
+		if(args->sample < 100000 && katss_rng_below(&rng, 100000) >= (uint32_t)args->sample)
+			continue;
+		if((read = load_read(args, read, index, &length)) == NULL) {
+			ret = 4;
+			break;
+		}
+		int seqlen = (int)length;
+		ushuffle_r(shuffler, read, shuf, seqlen, args->klet);
+		shuf[seqlen] = '\0'; // null terminate shuf since ushuffle_r uses strncpy
+
+		/* Remove sequences from the shuffled read, which is the one counted */
+		katss_mask(masker, shuf);
+
+		/* Nothing is carried over from the previous read */
+		hasher->previous_hash = 0;
+		hasher->has_previous = false;
+		hasher->endno = 0;
+		hasher->pos = 0;
+		katss_set_seq(hasher, shuf, 'r');
+		if(args->local != NULL) { /* Private table needs no buffering */
+			size_t hashed;
+			while((hashed = hash_block(hasher, hashes, KATSS_SCRATCH_HASHES)))
+				katss_increments_unlocked(args->local, hashes, hashed);
+			continue;
+		}
+		size_t hashed;
+		while((hashed = hash_block(hasher, hashes + num_hashes,
+		                           KATSS_SCRATCH_HASHES - num_hashes))) {
+			if((num_hashes += hashed) == KATSS_SCRATCH_HASHES) {
+				katss_increments(args->counter, hashes, num_hashes);
+				num_hashes = 0;
 			}
 		}
 	}
-    seqfclose(reads_file);
+	katss_increments(args->counter, hashes, num_hashes);
+
+	free_batch(&batch);
+	free(hasher);
+	free(shuf);
+	katss_free_masker(masker);
+	ushuffle_free(shuffler);
+
+	if(args->seqfile != NULL && seqferrno) {
+		error_message("katss: %d: %s", seqferrno, seqfstrerror(seqferrno));
+		return 4;
+	}
+	return ret;
+}
 
-    if (fastq_score_lines >= 2) {
-        return 'q'; // fastq file
-	} else if (fasta_score_lines > 0) {
-		return 'a';
-    } else if (sequence_lines == 10) {
-        return 'r'; // raw sequences file
-    } else {
+/*==============================================================
+|  Helper Functions                                            |
+==============================================================*/
+
+SeqFile
+katss_open_file(const char *filename, const char *mode, char *filetype)
+{
+	/* The type is detected from the first bytes read, which are then read as usual */
+	char detect[8] = "d";
+	strncat(detect, mode, sizeof detect - 2);
+	bool grouped;
+	SeqFile file = katss_open_group(filename, detect, &grouped);
+	if(!grouped)
+		file = seqfopen(filename, detect);
+	if(file == NULL) {
+		error_message("katss: %s: %s", filename, seqfstrerror(seqferrno));
+		*filetype = 'N';
+		return NULL;
+	}
+
+	if((*filetype = katss_file_type(file)) == 'e') {
+		seqfclose(file);
+		return NULL;
+	}
+	return file;
+}
+
+
+char
+katss_file_type(SeqFile file)
+{
+	switch(seqftype(file)) {
+	case 'q': return 'q';
+	case 'a': return 'a';
+	case 's': return 'r'; /* raw sequences file */
+	default:
 		error_message("Unable to read sequence from file.\nCurrent supported file types are:"
 		              " FASTA, FASTQ, and file containing sequences per line.");
-        return 'e'; // unsupported file type
-    }
+		return 'e';
+	}
 }
 
 
-static bool
-is_nucleotide(char character)
+SeqFile
+katss_rewind_file(const char *filename, SeqFile file, const char *mode, char *filetype)
 {
-	switch(character) {
-		case 'A':   return true;
-		case 'a':   return true;
-		case 'C':   return true;
-		case 'c':   return true;
-		case 'G':   return true;
-		case 'g':   return true;
-		case 'T':   return true;
-		case 't':   return true;
-		case 'U':   return true;
-		case 'u':   return true;
-		default:    return false;
+	if(file == NULL)
+		return katss_open_file(filename, mode, filetype);
+	if(seqfrewind(file) != 0) {
+		error_message("katss: seqfrewind: %s", seqfstrerror(seqferrno));
+		*filetype = 'N';
+		return NULL;
 	}
+	*filetype = katss_file_type(file);
+	return *filetype == 'e' ? NULL : file;
 }
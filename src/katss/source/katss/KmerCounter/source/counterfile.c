@@ -0,0 +1,576 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#ifdef _WIN32
+#  include <io.h>
+#  define open _open
+#  define close _close
+#  define O_RDONLY _O_RDONLY
+#else
+#  include <unistd.h>
+#endif
+#ifdef __linux__
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#endif
+
+#include <zlib.h>
+
+#include "katss_core.h"
+#include "counter.h"
+#include "memory_utils.h"
+#include "seqfile.h"
+
+#define BUFFER_SIZE 65536U
+
+#define COUNTER_MAGIC   UINT32_C(0x5254434B) /* "KCTR" when written little-endian */
+#define COUNTER_VERSION UINT32_C(1)
+#define HEADER_BYTES    64U
+#define TABLE_ALIGN     UINT64_C(65536) /* Tables this large start at a multiple of it */
+
+#define LAYOUT_DENSE  UINT32_C(0)
+#define LAYOUT_SPARSE UINT32_C(1)
+
+/* Header of a counter file, written little-endian field by field in `HEADER_BYTES` */
+struct CounterHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t kmer;
+	uint32_t layout;         /** LAYOUT_DENSE or LAYOUT_SPARSE */
+	uint64_t total;          /** Total of the counter */
+	uint64_t num_entries;    /** Cells of the dense table, or k-mers of the sparse one */
+	uint64_t num_spill;      /** Dense counts past 32 bits, after the header */
+	uint64_t num_removed;    /** Removed k-mers, after the spill */
+	uint64_t table_offset;   /** Byte the table, or the sparse k-mers, start at */
+};
+typedef struct CounterHeader CounterHeader;
+
+static int write_counter(gzFile file, const KatssCounter *counter);
+static bool read_counter(SeqFile file, const char *filename, const CounterHeader *header,
+                         KatssCounter **counter);
+static bool read_header(SeqFile file, CounterHeader *header);
+static bool read_bytes(SeqFile file, void *buffer, size_t size);
+static bool write_bytes(gzFile file, const void *buffer, size_t size);
+static bool write_table(gzFile file, const uint32_t *table, uint64_t num);
+static bool read_table(SeqFile file, uint32_t *table, uint64_t num);
+static uint32_t *map_table(const char *filename, const CounterHeader *header);
+static uint64_t removed_bytes(const katss_str_node_t *removed, uint64_t *num_removed);
+static inline bool host_little_endian(void);
+static inline void store_le32(unsigned char *dst, uint32_t value);
+static inline void store_le64(unsigned char *dst, uint64_t value);
+static inline uint32_t load_le32(const unsigned char *src);
+static inline uint64_t load_le64(const unsigned char *src);
+
+/*
+Notes:
+A counter file holds, after its header, the counts past 32 bits of a dense table as (index,
+high bits) pairs, then the removed k-mers as (length, characters), and last the table. Dense
+tables are written as they are counted, a 32-bit cell for every k-mer, starting at a multiple of
+64KiB once they are that large. So an uncompressed file's table is mapped in place of being read
+(privately, counting into it never writes the file), and only the pages counted or looked up are
+ever read from disk. Sparse tables are written as (hash, count) pairs of the k-mers kept instead.
+
+Everything is little-endian whatever the host, big-endian hosts swap the bytes as they read and
+write them, and never map the table. Files are read through SeqFile, so the ones compressed with
+gzip (`katss_save_counter` with a `level`), zstd or lz4 load too, only streamed instead of mapped.
+The tails of a counter aren't saved, the sequences they come from being gone.
+*/
+
+
+/*==================================================================================================
+|                                         Public Functions                                         |
+==================================================================================================*/
+int
+katss_save_counter(const KatssCounter *counter, const char *filename, int level)
+{
+	if(counter == NULL || filename == NULL)
+		return 2;
+	if(counter->sketch != NULL) {
+		error_message("katss_save_counter: sketch counters only estimate their counts");
+		return 2;
+	}
+
+	char mode[8];
+	if(level > 0)
+		snprintf(mode, sizeof mode, "wb%d", MIN2(level, 9));
+	else
+		snprintf(mode, sizeof mode, "wbT");
+	gzFile file = gzopen(filename, mode);
+	if(file == NULL) {
+		error_message("katss_save_counter: Could not open '%s' for writing", filename);
+		return 1;
+	}
+	gzbuffer(file, BUFFER_SIZE);
+
+	int ret = write_counter(file, counter);
+	if(gzclose(file) != Z_OK)
+		ret = 1;
+	if(ret != 0)
+		error_message("katss_save_counter: Failed to write '%s'", filename);
+	return ret;
+}
+
+
+KatssCounter *
+katss_load_counter(const char *filename)
+{
+	if(filename == NULL)
+		return NULL;
+	SeqFile file = seqfopen(filename, "b");
+	if(file == NULL) {
+		error_message("katss_load_counter: Could not open '%s': %s", filename,
+		              seqfstrerror(seqferrno));
+		return NULL;
+	}
+
+	KatssCounter *counter = NULL;
+	CounterHeader header;
+	if(!read_header(file, &header)) {
+		error_message("katss_load_counter: '%s' is not a k-mer counter file", filename);
+		goto close_file;
+	}
+	if(header.version != COUNTER_VERSION) {
+		error_message("katss_load_counter: '%s' is of version %u, only version %u is read",
+		              filename, header.version, COUNTER_VERSION);
+		goto close_file;
+	}
+	if(!read_counter(file, filename, &header, &counter))
+		error_message("katss_load_counter: '%s' is truncated or corrupted", filename);
+
+close_file:
+	seqfclose(file);
+	return counter;
+}
+
+
+KatssCounter *
+katss_merge_counter_files(const char *const *paths, int num_paths, int threads)
+{
+	if(paths == NULL || num_paths < 1)
+		return NULL;
+
+	KatssCounter *merged = katss_load_counter(paths[0]);
+	for(int i=1; merged != NULL && i<num_paths; i++) {
+		KatssCounter *shard = katss_load_counter(paths[i]);
+		int ret = shard == NULL ? -1 : katss_merge_counter(merged, shard, threads);
+		if(ret == 1)
+			error_message("katss_merge_counter_files: '%s' counts k-mers of %u bases, not %u",
+			              paths[i], shard->kmer, merged->kmer);
+		else if(ret == 2)
+			error_message("katss_merge_counter_files: '%s' removed other k-mers than '%s'",
+			              paths[i], paths[0]);
+		katss_free_counter(shard);
+		if(ret != 0) {
+			katss_free_counter(merged);
+			merged = NULL;
+		}
+	}
+	return merged;
+}
+
+
+int
+katss_is_counter_file(const char *filename)
+{
+	if(filename == NULL)
+		return 0;
+	SeqFile file = seqfopen(filename, "b");
+	if(file == NULL)
+		return 0;
+
+	unsigned char magic[4];
+	bool is_counter = read_bytes(file, magic, sizeof magic) && load_le32(magic) == COUNTER_MAGIC;
+	seqfclose(file);
+	return is_counter;
+}
+
+
+/*==================================================================================================
+|                                        Private Functions                                         |
+==================================================================================================*/
+
+/**
+ * @brief Write the header, spill, removed k-mers and table of `counter` to `file`, in the layout
+ * described in the notes. Returns 0 on success or 1 if writing failed.
+ */
+static int
+write_counter(gzFile file, const KatssCounter *counter)
+{
+	bool dense = counter->sparse == NULL;
+	uint64_t num_entries = (uint64_t)counter->capacity + 1;
+	uint64_t *kmers = NULL;
+	if(!dense)
+		num_entries = katss_list_kmers(counter, &kmers);
+
+	/* The indexes of the counts past 32 bits, only looked for if a count ever wrapped */
+	uint64_t num_spill = 0, *spilled = NULL;
+	if(dense && counter->spill != NULL) {
+		spilled = s_malloc(BUFFER_SIZE * sizeof *spilled);
+		uint64_t size = BUFFER_SIZE;
+		for(uint64_t i=0; i<num_entries; i++) {
+			if(katss_table_count(counter, i) >> 32 == 0)
+				continue;
+			if(num_spill == size) {
+				size *= 2;
+				spilled = s_realloc(spilled, size * sizeof *spilled);
+			}
+			spilled[num_spill++] = i;
+		}
+	}
+
+	uint64_t num_removed;
+	uint64_t offset = HEADER_BYTES + 16 * num_spill + removed_bytes(counter->removed, &num_removed);
+	uint64_t table_bytes = dense ? num_entries * sizeof *counter->table : 16 * num_entries;
+	uint64_t align = dense && table_bytes >= TABLE_ALIGN ? TABLE_ALIGN : 8;
+	uint64_t table_offset = (offset + align - 1) / align * align;
+
+	unsigned char *buffer = s_calloc(BUFFER_SIZE, 1);
+	store_le32(buffer, COUNTER_MAGIC);
+	store_le32(buffer + 4, COUNTER_VERSION);
+	store_le32(buffer + 8, counter->kmer);
+	store_le32(buffer + 12, dense ? LAYOUT_DENSE : LAYOUT_SPARSE);
+	store_le64(buffer + 16, counter->total);
+	store_le64(buffer + 24, num_entries);
+	store_le64(buffer + 32, num_spill);
+	store_le64(buffer + 40, num_removed);
+	store_le64(buffer + 48, table_offset);
+	bool written = write_bytes(file, buffer, HEADER_BYTES);
+
+	for(uint64_t i=0; written && i<num_spill; i++) {
+		store_le64(buffer, spilled[i]);
+		store_le64(buffer + 8, katss_table_count(counter, spilled[i]) >> 32);
+		written = write_bytes(file, buffer, 16);
+	}
+	for(katss_str_node_t *node = counter->removed; written && node != NULL; node = node->next) {
+		uint32_t len = strlen(node->str);
+		store_le32(buffer, len);
+		written = write_bytes(file, buffer, 4) && write_bytes(file, node->str, len);
+	}
+
+	/* Pad up to the table */
+	memset(buffer, 0, BUFFER_SIZE);
+	for(uint64_t pad = table_offset - offset; written && pad != 0; ) {
+		size_t n = MIN2(pad, BUFFER_SIZE);
+		written = write_bytes(file, buffer, n);
+		pad -= n;
+	}
+
+	if(dense) {
+		written = written && write_table(file, counter->table, num_entries);
+	} else {
+		for(uint64_t i=0; written && i<num_entries; i++) {
+			store_le64(buffer, kmers[i]);
+			store_le64(buffer + 8, katss_table_count(counter, kmers[i]));
+			written = write_bytes(file, buffer, 16);
+		}
+	}
+
+	free(buffer);
+	free(spilled);
+	free(kmers);
+	return written ? 0 : 1;
+}
+
+
+/**
+ * @brief Read the rest of a counter file whose `header` was read from `file` into a new counter,
+ * mapping its table when it can. Returns false, leaving `counter` NULL, if the file was
+ * truncated or its header doesn't add up.
+ */
+static bool
+read_counter(SeqFile file, const char *filename, const CounterHeader *header,
+             KatssCounter **counter)
+{
+	*counter = NULL;
+	bool dense = header->layout == LAYOUT_DENSE;
+	if(header->kmer < 1 || header->kmer > 32 || header->layout > LAYOUT_SPARSE)
+		return false;
+	if(dense && (header->kmer > KATSS_DENSE_KMER ||
+	             header->num_entries != UINT64_C(1) << 2*header->kmer))
+		return false;
+	if(!dense && (header->kmer < KATSS_SPARSE_KMER || header->num_spill != 0))
+		return false;
+
+	/* The spill and the removed k-mers come first, whatever holds the table */
+	if(header->num_spill > header->num_entries)
+		return false;
+	bool valid = true;
+	unsigned char pair[16];
+	uint64_t *spill = s_malloc(MAX2(header->num_spill, 1) * 2 * sizeof *spill);
+	for(uint64_t i=0; valid && i<header->num_spill; i++) {
+		valid = read_bytes(file, pair, sizeof pair);
+		spill[2*i] = load_le64(pair);
+		spill[2*i + 1] = load_le64(pair + 8);
+		valid = valid && spill[2*i] < header->num_entries;
+	}
+
+	KatssCounter *loaded = NULL;
+	uint32_t *table = NULL;
+	katss_str_node_t *removed = NULL, **link = &removed;
+	uint64_t offset = HEADER_BYTES + 16 * header->num_spill;
+	for(uint64_t i=0; valid && i<header->num_removed; i++) {
+		valid = read_bytes(file, pair, 4);
+		uint32_t len = load_le32(pair);
+		if(!valid || len >= BUFFER_SIZE) {
+			valid = false;
+			break;
+		}
+		katss_str_node_t *node = s_malloc(sizeof *node);
+		node->str = s_malloc(len + 1);
+		node->next = NULL;
+		*link = node;
+		link = &node->next;
+		valid = read_bytes(file, node->str, len);
+		node->str[len] = '\0';
+		offset += 4 + len;
+	}
+	valid = valid && offset <= header->table_offset;
+	if(!valid)
+		goto free_removed;
+
+	/* Map the table of an uncompressed file, read it otherwise */
+	table = dense ? map_table(filename, header) : NULL;
+	if(table != NULL) {
+		loaded = katss_init_table_counter(header->kmer, table, true);
+	} else {
+		loaded = dense ? katss_init_counter(header->kmer) : katss_init_sparse_counter(header->kmer);
+		if(loaded == NULL) {
+			valid = false;
+			goto free_removed;
+		}
+		unsigned char *buffer = s_malloc(BUFFER_SIZE);
+		for(uint64_t pad = header->table_offset - offset; valid && pad != 0; ) {
+			size_t n = MIN2(pad, BUFFER_SIZE);
+			valid = read_bytes(file, buffer, n);
+			pad -= n;
+		}
+		if(dense) {
+			valid = valid && read_table(file, loaded->table, header->num_entries);
+		} else {
+			/* Pairs are read a buffer at a time rather than each on its own */
+			for(uint64_t i=0; valid && i<header->num_entries; ) {
+				size_t num = MIN2(header->num_entries - i, BUFFER_SIZE / 16);
+				valid = read_bytes(file, buffer, 16 * num);
+				for(size_t j=0; valid && j<num; j++)
+					katss_add_count(loaded, load_le64(buffer + 16*j), load_le64(buffer + 16*j + 8));
+				i += num;
+			}
+		}
+		free(buffer);
+	}
+	if(loaded == NULL || !valid)
+		goto free_removed;
+
+	for(uint64_t i=0; i<header->num_spill; i++)
+		katss_add_count(loaded, spill[2*i], spill[2*i + 1] << 32);
+	loaded->total = header->total;
+	loaded->removed = removed;
+	removed = NULL;
+	*counter = loaded;
+	loaded = NULL;
+
+free_removed:
+	while(removed != NULL) {
+		katss_str_node_t *next = removed->next;
+		free(removed->str);
+		free(removed);
+		removed = next;
+	}
+	if(loaded != NULL)
+		katss_free_counter(loaded);
+	free(spill);
+	return valid;
+}
+
+
+/**
+ * @brief Read and decode the header at the start of `file`. Returns false if the file is too
+ * short or isn't a counter file.
+ */
+static bool
+read_header(SeqFile file, CounterHeader *header)
+{
+	unsigned char bytes[HEADER_BYTES];
+	if(!read_bytes(file, bytes, sizeof bytes))
+		return false;
+	header->magic = load_le32(bytes);
+	header->version = load_le32(bytes + 4);
+	header->kmer = load_le32(bytes + 8);
+	header->layout = load_le32(bytes + 12);
+	header->total = load_le64(bytes + 16);
+	header->num_entries = load_le64(bytes + 24);
+	header->num_spill = load_le64(bytes + 32);
+	header->num_removed = load_le64(bytes + 40);
+	header->table_offset = load_le64(bytes + 48);
+	return header->magic == COUNTER_MAGIC;
+}
+
+
+/**
+ * @brief Read exactly `size` bytes of `file` into `buffer`. Returns false if the file ended or
+ * failed before.
+ */
+static bool
+read_bytes(SeqFile file, void *buffer, size_t size)
+{
+	char *dst = buffer;
+	while(size != 0) {
+		size_t n = seqfread(file, dst, size);
+		if(n == 0)
+			return false;
+		dst += n;
+		size -= n;
+	}
+	return true;
+}
+
+
+static bool
+write_bytes(gzFile file, const void *buffer, size_t size)
+{
+	const char *src = buffer;
+	while(size != 0) {
+		unsigned int n = MIN2(size, UINT32_C(1) << 30);
+		if(gzwrite(file, src, n) != (int)n)
+			return false;
+		src += n;
+		size -= n;
+	}
+	return true;
+}
+
+
+/**
+ * @brief Write the `num` cells of `table` little-endian, as they are when the host is.
+ */
+static bool
+write_table(gzFile file, const uint32_t *table, uint64_t num)
+{
+	if(host_little_endian())
+		return write_bytes(file, table, num * sizeof *table);
+
+	unsigned char buffer[BUFFER_SIZE];
+	uint64_t per_block = BUFFER_SIZE / sizeof *table;
+	for(uint64_t i=0; i<num; i+=per_block) {
+		uint64_t n = MIN2(num - i, per_block);
+		for(uint64_t j=0; j<n; j++)
+			store_le32(buffer + 4*j, table[i + j]);
+		if(!write_bytes(file, buffer, n * sizeof *table))
+			return false;
+	}
+	return true;
+}
+
+
+static bool
+read_table(SeqFile file, uint32_t *table, uint64_t num)
+{
+	if(!read_bytes(file, table, num * sizeof *table))
+		return false;
+	if(!host_little_endian()) {
+		for(uint64_t i=0; i<num; i++)
+			table[i] = load_le32((const unsigned char *)&table[i]);
+	}
+	return true;
+}
+
+
+/**
+ * @brief Map the dense table of `filename` privately, or return NULL if it can't be: the file is
+ * compressed, the host isn't little-endian, or the table doesn't start at a multiple of the page
+ * size (small tables aren't aligned for it).
+ */
+static uint32_t *
+map_table(const char *filename, const CounterHeader *header)
+{
+#ifdef __linux__
+	long page = sysconf(_SC_PAGESIZE);
+	if(!host_little_endian() || page <= 0 || header->table_offset % (uint64_t)page != 0)
+		return NULL;
+
+	int fd = open(filename, O_RDONLY);
+	if(fd < 0)
+		return NULL;
+	uint32_t *table = NULL;
+	unsigned char magic[4];
+	size_t bytes = header->num_entries * sizeof *table;
+	struct stat st;
+	if(pread(fd, magic, sizeof magic, 0) == sizeof magic && load_le32(magic) == COUNTER_MAGIC &&
+	   fstat(fd, &st) == 0 && (uint64_t)st.st_size >= header->table_offset + bytes) {
+		void *map = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd,
+		                 (off_t)header->table_offset);
+		if(map != MAP_FAILED)
+			table = map;
+	}
+	close(fd);
+	return table;
+#else
+	(void)filename;
+	(void)header;
+	return NULL;
+#endif
+}
+
+
+/**
+ * @brief Bytes the removed k-mers take in the file, storing how many there are in `num_removed`.
+ */
+static uint64_t
+removed_bytes(const katss_str_node_t *removed, uint64_t *num_removed)
+{
+	uint64_t bytes = 0;
+	*num_removed = 0;
+	for(; removed != NULL; removed = removed->next) {
+		bytes += 4 + strlen(removed->str);
+		(*num_removed)++;
+	}
+	return bytes;
+}
+
+
+static inline bool
+host_little_endian(void)
+{
+	const uint16_t one = 1;
+	return *(const unsigned char *)&one == 1;
+}
+
+
+static inline void
+store_le32(unsigned char *dst, uint32_t value)
+{
+	for(int i=0; i<4; i++)
+		dst[i] = (unsigned char)(value >> 8*i);
+}
+
+
+static inline void
+store_le64(unsigned char *dst, uint64_t value)
+{
+	for(int i=0; i<8; i++)
+		dst[i] = (unsigned char)(value >> 8*i);
+}
+
+
+static inline uint32_t
+load_le32(const unsigned char *src)
+{
+	uint32_t value = 0;
+	for(int i=0; i<4; i++)
+		value |= (uint32_t)src[i] << 8*i;
+	return value;
+}
+
+
+static inline uint64_t
+load_le64(const unsigned char *src)
+{
+	uint64_t value = 0;
+	for(int i=0; i<8; i++)
+		value |= (uint64_t)src[i] << 8*i;
+	return value;
+}
@@ -10,7 +10,32 @@
 #include "hash_functions.h"
 #include "memory_utils.h"
 
-static double predict_kmer(char *kseq, KatssCounter *monomer_counts, KatssCounter *dimer_counts);
+#define COUNTS_BLOCK 4096 /* Counts exported at once by the enrichment loops */
+#define TOP_MIN_KMERS 65536 /* Fewest k-mers scanned by each thread looking for the top ones */
+
+/* Range of k-mers a thread scans for the most enriched ones, see `katss_top_enrichments` */
+struct top_job {
+	KatssCounter *test;      /** Test counts */
+	KatssCounter *control;   /** Control counts */
+	const uint64_t *keys;    /** Hashes of the k-mers to scan, NULL for every hash in order */
+	uint64_t start;          /** First k-mer of the range */
+	uint64_t end;            /** End of the range */
+	KatssEnrichment *top;    /** Most enriched k-mers of the range, most enriched first */
+	int num_top;             /** Room in `top` */
+	int found;               /** K-mers in `top` */
+};
+
+static bool dense_kmer(unsigned int kmer, const char *caller);
+static void block_counts(KatssCounter *counter, const uint64_t *keys, uint64_t first,
+                         uint64_t num, double *counts);
+static int top_range(void *arg);
+static int insert_top(KatssEnrichment *top, int found, int num_top, double enrichment,
+                      uint64_t key);
+static SeqFile open_iterated(const char *filename);
+static int recount_multi(KatssCounter **counters, int num_counters, const char *filename,
+                         SeqFile file, const char *remove, int threads);
+static KatssEnrichment top_enrichment(KatssCounter *test, KatssCounter *control, bool normalize,
+                                      int threads);
 KatssEnrichment katss_top_enrichment(KatssCounter *test, KatssCounter *control, bool normalize);
 KatssEnrichment katss_top_prediction(KatssCounter *test, KatssCounter *mono, KatssCounter *dint, bool normalize);
 
@@ -22,26 +47,39 @@ katss_compute_enrichments(KatssCounter *test, KatssCounter *control, bool normal
 		return NULL;
 	}
 
+	/* Every k-mer gets an enrichment, or only the ones seen in the test when there are too many,
+	   or the most counted ones of a sketch */
+	uint64_t num_enrichments, *keys = NULL;
+	if(test->kmer > KATSS_DENSE_KMER || test->sketch != NULL)
+		num_enrichments = katss_list_kmers(test, &keys);
+	else
+		num_enrichments = ((uint64_t)test->capacity)+1;
+
 	/* Allocate enrichments struct */
-	uint64_t num_enrichments = ((uint64_t)test->capacity)+1;
 	KatssEnrichments *enrichments = s_malloc(sizeof *enrichments);
-	enrichments->enrichments = s_malloc(num_enrichments * sizeof(KatssEnrichment));
+	enrichments->enrichments = s_malloc(MAX2(num_enrichments, 1) * sizeof(KatssEnrichment));
 	enrichments->num_enrichments = num_enrichments;
 
-	/* Compute enrichments */
-	for(uint32_t i=0; i<=test->capacity; i++) {
-		double test_count, control_count;
-		katss_get_from_hash(test, KATSS_DOUBLE, &test_count, i);
-		katss_get_from_hash(control, KATSS_DOUBLE, &control_count, i);
+	/* Compute enrichments, with the counts exported a block at a time */
+	double test_counts[COUNTS_BLOCK], control_counts[COUNTS_BLOCK];
+	for(uint64_t i=0; i<num_enrichments; i++) {
+		if(i % COUNTS_BLOCK == 0) {
+			uint64_t num = MIN2(num_enrichments - i, COUNTS_BLOCK);
+			block_counts(test, keys, i, num, test_counts);
+			block_counts(control, keys, i, num, control_counts);
+		}
+		uint64_t key = keys ? keys[i] : i;
+		double test_count = test_counts[i % COUNTS_BLOCK];
+		double control_count = control_counts[i % COUNTS_BLOCK];
 
-		enrichments->enrichments[i].key = i; // Set key
+		enrichments->enrichments[i].key = key; // Set key
 		if(test_count == 0.0 || control_count == 0.0) { // Determine if enrichment is valid
 			enrichments->enrichments[i].enrichment = NAN;
 			continue;
 		}
 		if(test_count < 20 || control_count < 20) {
-			char kmer_str[20];
-			katss_unhash(kmer_str, i, test->kmer, false);
+			char kmer_str[33];
+			katss_unhash64(kmer_str, key, test->kmer, false);
 			warning_message("count for `%s' is less than 20.", kmer_str);
 		}
 
@@ -52,6 +90,7 @@ katss_compute_enrichments(KatssCounter *test, KatssCounter *control, bool normal
 
 		enrichments->enrichments[i].enrichment = r_val;
 	}
+	free(keys);
 	return enrichments;
 }
 
@@ -65,13 +104,13 @@ katss_enrichments(const char *test_file, const char *control_file, unsigned int
 
 	KatssCounter *control_counts = katss_count_kmers(control_file, kmer);
 	if(control_counts == NULL) {
-		katss_free_counter(test_counts);
+		katss_release_counter(test_counts);
 		return NULL;
 	}
 
 	KatssEnrichments *enrichments = katss_compute_enrichments(test_counts, control_counts, normalize);
-	katss_free_counter(control_counts);
-	katss_free_counter(test_counts);
+	katss_release_counter(control_counts);
+	katss_release_counter(test_counts);
 	return enrichments;
 }
 
@@ -83,6 +122,8 @@ katss_compute_prob_enrichments(KatssCounter *test, KatssCounter *mono,
 	/* Mono and dinucleotides must be of correct length */
 	if(mono->kmer != 1 || dint->kmer != 2)
 		return NULL;
+	if(!dense_kmer(test->kmer, "katss_compute_prob_enrichments"))
+		return NULL;
 
 	/* Allocate enrichments struct */
 	uint64_t num_enrichments = ((uint64_t)test->capacity)+1;
@@ -90,17 +131,19 @@ katss_compute_prob_enrichments(KatssCounter *test, KatssCounter *mono,
 	enrichments->enrichments = s_malloc(num_enrichments * sizeof(KatssEnrichment));
 	enrichments->num_enrichments = num_enrichments;
 
-	/* Compute enrichments */
+	/* Compute enrichments, with the counts and predictions of a block at a time */
+	double test_counts[COUNTS_BLOCK], predictions[COUNTS_BLOCK];
 	for(uint32_t i=0; i<=test->capacity; i++) {
-		char kseq[17] = { 0 };
-		katss_unhash(kseq, i, test->kmer, true);
-
 		/* Get frequencies */
-		double test_count, test_frq, ctrl_frq;
-		katss_get_from_hash(test, KATSS_DOUBLE, &test_count, i);
+		if(i % COUNTS_BLOCK == 0) {
+			uint64_t num = MIN2(num_enrichments - i, COUNTS_BLOCK);
+			block_counts(test, NULL, i, num, test_counts);
+			katss_predict_kmer_freqs(i, num, test->kmer, mono, dint, predictions);
+		}
+		double test_count = test_counts[i % COUNTS_BLOCK], test_frq, ctrl_frq;
 
 		test_frq = test_count / test->total;
-		ctrl_frq = predict_kmer(kseq, mono, dint);
+		ctrl_frq = predictions[i % COUNTS_BLOCK];
 
 		enrichments->enrichments[i].key = i; // Set key
 		if(test_frq == 0.0 || ctrl_frq == 0.0) { // Determine if enrichment is valid
@@ -128,27 +171,22 @@ KatssEnrichments *
 katss_prob_enrichments(const char *test_file, unsigned int kmer, bool normalize)
 {
 	KatssEnrichments *enrichments = NULL;
-	KatssCounter *test_counts = katss_count_kmers(test_file, kmer);
-	if(test_counts == NULL)
-		goto exit;
 
-	KatssCounter *mono_counts = katss_count_kmers(test_file, 1);
-	if(mono_counts == NULL)
-		goto cleanup_mono;
-
-	KatssCounter *dint_counts = katss_count_kmers(test_file, 2);
-	if(dint_counts == NULL)
-		goto cleanup_dint;
+	/* Count k-mers, mono and di-nucleotides in a single pass */
+	KatssCounter *test_counts = katss_acquire_file_counter(kmer, test_file);
+	KatssCounter *mono_counts = katss_acquire_counter(1);
+	KatssCounter *dint_counts = katss_acquire_counter(2);
+	KatssCounter *counters[3] = { test_counts, mono_counts, dint_counts };
+	if(katss_count_kmers_multi(test_file, counters, 3) != 0)
+		goto cleanup;
 
 	enrichments = katss_compute_prob_enrichments(test_counts, mono_counts, dint_counts, normalize);
 
 	/* Cleanup and return */
-	katss_free_counter(dint_counts);
-cleanup_dint:
-	katss_free_counter(mono_counts);
-cleanup_mono:
-	katss_free_counter(test_counts);
-exit:
+cleanup:
+	katss_release_counter(dint_counts);
+	katss_release_counter(mono_counts);
+	katss_release_counter(test_counts);
 	return enrichments;
 }
 
@@ -159,15 +197,18 @@ exit:
 KatssEnrichments *
 katss_ikke_(const char *test_file, const char *control_file, unsigned int kmer, uint64_t iterations, bool normalize)
 {
+	if(!dense_kmer(kmer, "katss_ikke"))
+		return NULL;
 	KatssEnrichments *enrichments = NULL;
+	KatssKmerIndex *test_index = NULL, *control_index = NULL;
 
-	/* Get the counts for the test_file */
-	KatssCounter *test_counts = katss_count_kmers(test_file, kmer);
+	/* Get the counts for the test_file, indexed so iterations don't read it again */
+	KatssCounter *test_counts = katss_count_kmers_index(test_file, kmer, 1, &test_index);
 	if(test_counts == NULL)
 		goto exit;
 
 	/* Get the counts for the control file */
-	KatssCounter *control_counts = katss_count_kmers(control_file, kmer);
+	KatssCounter *control_counts = katss_count_kmers_index(control_file, kmer, 1, &control_index);
 	if(control_counts == NULL)
 		goto cleanup_ctrl;
 
@@ -179,21 +220,26 @@ katss_ikke_(const char *test_file, const char *control_file, unsigned int kmer,
 	enrichments->num_enrichments = iterations;
 
 	/* Get the first top kmer */
+	katss_stats_lap();
 	enrichments->enrichments[0] = katss_top_enrichment(test_counts, control_counts, normalize);
+	katss_stats_iterations(1);
 
 	/* Subsequent iterations begin uncounting */
 	for(uint64_t i=1; i<iterations; i++) {
 		char kseq[17];
 		katss_unhash(kseq, enrichments->enrichments[i-1].key, test_counts->kmer, true);
-		katss_recount_kmer(test_counts, test_file, kseq);
-		katss_recount_kmer(control_counts, control_file, kseq);
+		katss_recount_kmer_index(test_counts, &test_index, test_file, kseq, 1);
+		katss_recount_kmer_index(control_counts, &control_index, control_file, kseq, 1);
 		enrichments->enrichments[i] = katss_top_enrichment(test_counts, control_counts, normalize);
+		katss_stats_iterations(1);
 	}
 
-	katss_free_counter(control_counts);
+	katss_release_counter(control_counts);
 cleanup_ctrl:
-	katss_free_counter(test_counts);
+	katss_release_counter(test_counts);
 exit:
+	katss_free_kmer_index(control_index);
+	katss_free_kmer_index(test_index);
 	return enrichments;
 }
 
@@ -202,17 +248,25 @@ KatssEnrichments *
 katss_ikke_mt(const char *test_file, const char *control_file, unsigned int kmer, 
               uint64_t iterations, bool normalize, int threads)
 {
-	/* Get the counts for the test_file */
-	KatssCounter *test_counts = katss_count_kmers_mt(test_file, kmer, threads);
+	if(!dense_kmer(kmer, "katss_ikke_mt"))
+		return NULL;
+
+	/* Get the counts for the test_file, indexed so iterations don't read it again */
+	KatssKmerIndex *indexes[2];
+	KatssCounter *test_counts = katss_count_kmers_index(test_file, kmer, threads, &indexes[0]);
 	if(test_counts == NULL)
 		return NULL;
 
 	/* Get the counts for the control file */
-	KatssCounter *control_counts = katss_count_kmers_mt(control_file, kmer, threads);
+	KatssCounter *control_counts = katss_count_kmers_index(control_file, kmer, threads,
+	                                                       &indexes[1]);
 	if(control_counts == NULL) {
-		katss_free_counter(test_counts);
+		katss_free_kmer_index(indexes[0]);
+		katss_release_counter(test_counts);
 		return NULL;
 	}
+	KatssCounter *counters[2] = { test_counts, control_counts };
+	const char *files[2] = { test_file, control_file };
 
 	KatssEnrichments *enrichments = s_malloc(sizeof *enrichments);
 	if(iterations > test_counts->capacity)
@@ -221,20 +275,24 @@ katss_ikke_mt(const char *test_file, const char *control_file, unsigned int kmer
 	enrichments->num_enrichments = iterations;
 
 	/* Get the first top kmer */
-	enrichments->enrichments[0] = katss_top_enrichment(test_counts, control_counts, normalize);
+	katss_stats_lap();
+	enrichments->enrichments[0] = top_enrichment(test_counts, control_counts, normalize, threads);
+	katss_stats_iterations(1);
 
-	/* Subsequent iterations begin uncounting */
+	/* Subsequent iterations begin uncounting, recounting both files at the same time */
 	for(uint32_t i=1; i<iterations; i++) {
 		char kseq[17];
 		katss_unhash(kseq, enrichments->enrichments[i-1].key, test_counts->kmer, true);
-		katss_recount_kmer_mt(test_counts, test_file, kseq, threads);
-		katss_recount_kmer_mt(control_counts, control_file, kseq, threads);
-		enrichments->enrichments[i] = katss_top_enrichment(test_counts, control_counts, normalize);
+		katss_recount_kmer_indexes(counters, indexes, files, 2, kseq, threads);
+		enrichments->enrichments[i] = top_enrichment(test_counts, control_counts, normalize, threads);
+		katss_stats_iterations(1);
 	}
 
 	/* Cleanup and return */
-	katss_free_counter(test_counts);
-	katss_free_counter(control_counts);
+	katss_free_kmer_index(indexes[0]);
+	katss_free_kmer_index(indexes[1]);
+	katss_release_counter(test_counts);
+	katss_release_counter(control_counts);
 
 	return enrichments;
 }
@@ -243,20 +301,17 @@ katss_ikke_mt(const char *test_file, const char *control_file, unsigned int kmer
 KatssEnrichments *
 katss_prob_ikke(const char *test_file, unsigned int kmer, uint64_t iterations, bool normalize)
 {
+	if(!dense_kmer(kmer, "katss_prob_ikke"))
+		return NULL;
 	KatssEnrichments *enrichments = NULL;
 
-	/* Get counts for test file */
-	KatssCounter *test_counts = katss_count_kmers(test_file, kmer);
-	if(test_counts == NULL)
-		goto exit;
-
-	/* Get mono and di-nucleotide counts */
-	KatssCounter *mono_counts = katss_count_kmers(test_file, 1);
-	if(mono_counts == NULL)
-		goto cleanup_mono;
-	KatssCounter *dint_counts = katss_count_kmers(test_file, 2);
-	if(dint_counts == NULL)
-		goto cleanup_dint;
+	/* Get k-mer, mono and di-nucleotide counts for test file in a single pass */
+	KatssCounter *test_counts = katss_acquire_file_counter(kmer, test_file);
+	KatssCounter *mono_counts = katss_acquire_counter(1);
+	KatssCounter *dint_counts = katss_acquire_counter(2);
+	KatssCounter *counters[3] = { test_counts, mono_counts, dint_counts };
+	if(katss_count_kmers_multi(test_file, counters, 3) != 0)
+		goto cleanup;
 
 	/* Create enrichments struct */
 	enrichments = s_malloc(sizeof(KatssEnrichments));
@@ -266,46 +321,44 @@ katss_prob_ikke(const char *test_file, unsigned int kmer, uint64_t iterations, b
 	enrichments->num_enrichments = iterations;
 
 	/* Get the first top k-mer */
+	katss_stats_lap();
 	enrichments->enrichments[0] = katss_top_prediction(test_counts, mono_counts, dint_counts, normalize);
+	katss_stats_iterations(1);
 
-	/* Subsequent iterations begin uncounting */
+	/* Subsequent iterations begin uncounting, reading the test file opened once */
 	char kseq[17];
+	SeqFile file = open_iterated(test_file);
 	for(uint64_t i=1; i<enrichments->num_enrichments; i++) {
 		katss_unhash(kseq, enrichments->enrichments[i-1].key, kmer, true);
-		katss_recount_kmer(test_counts, test_file, kseq);
-		katss_recount_kmer(mono_counts, test_file, kseq);
-		katss_recount_kmer(dint_counts, test_file, kseq);
+		recount_multi(counters, 3, test_file, file, kseq, 1);
 		enrichments->enrichments[i] = katss_top_prediction(test_counts, mono_counts, dint_counts, normalize);
+		katss_stats_iterations(1);
 	}
+	seqfclose(file);
 
 	/* Cleanup and return */
-	katss_free_counter(dint_counts);
-	cleanup_dint:
-		katss_free_counter(mono_counts);
-	cleanup_mono:
-		katss_free_counter(test_counts);
-	exit:
-		return enrichments;
+cleanup:
+	katss_release_counter(dint_counts);
+	katss_release_counter(mono_counts);
+	katss_release_counter(test_counts);
+	return enrichments;
 }
 
 
 KatssEnrichments *
 katss_prob_ikke_mt(const char *test_file, unsigned int kmer, uint64_t iterations, bool normalize, int threads)
 {
+	if(!dense_kmer(kmer, "katss_prob_ikke_mt"))
+		return NULL;
 	KatssEnrichments *enrichments = NULL;
 
-	/* Get counts for test file */
-	KatssCounter *test_counts = katss_count_kmers(test_file, kmer);
-	if(test_counts == NULL)
-		goto exit;
-
-	/* Get mono and di-nucleotide counts */
-	KatssCounter *mono_counts = katss_count_kmers(test_file, 1);
-	if(mono_counts == NULL)
-		goto cleanup_mono;
-	KatssCounter *dint_counts = katss_count_kmers(test_file, 2);
-	if(dint_counts == NULL)
-		goto cleanup_dint;
+	/* Get k-mer, mono and di-nucleotide counts for test file in a single pass */
+	KatssCounter *test_counts = katss_acquire_file_counter(kmer, test_file);
+	KatssCounter *mono_counts = katss_acquire_counter(1);
+	KatssCounter *dint_counts = katss_acquire_counter(2);
+	KatssCounter *counters[3] = { test_counts, mono_counts, dint_counts };
+	if(katss_count_kmers_multi_mt(test_file, counters, 3, threads) != 0)
+		goto cleanup;
 
 	/* Create enrichments struct */
 	enrichments = s_malloc(sizeof(KatssEnrichments));
@@ -315,40 +368,51 @@ katss_prob_ikke_mt(const char *test_file, unsigned int kmer, uint64_t iterations
 	enrichments->num_enrichments = iterations;
 
 	/* Get the first top k-mer */
+	katss_stats_lap();
 	enrichments->enrichments[0] = katss_top_prediction(test_counts, mono_counts, dint_counts, normalize);
+	katss_stats_iterations(1);
 
-	/* Subsequent iterations begin uncounting */
+	/* Subsequent iterations begin uncounting, reading the test file opened once */
 	char kseq[17];
+	SeqFile file = open_iterated(test_file);
 	for(uint64_t i=1; i<enrichments->num_enrichments; i++) {
 		katss_unhash(kseq, enrichments->enrichments[i-1].key, kmer, true);
-		katss_recount_kmer_mt(test_counts, test_file, kseq, threads);
-		katss_recount_kmer_mt(mono_counts, test_file, kseq, threads);
-		katss_recount_kmer_mt(dint_counts, test_file, kseq, threads);
+		recount_multi(counters, 3, test_file, file, kseq, threads);
 		enrichments->enrichments[i] = katss_top_prediction(test_counts, mono_counts, dint_counts, normalize);
+		katss_stats_iterations(1);
 	}
+	seqfclose(file);
 
 	/* Cleanup and return */
-	katss_free_counter(dint_counts);
-cleanup_dint:
-	katss_free_counter(mono_counts);
-cleanup_mono:
-	katss_free_counter(test_counts);
-exit:
+cleanup:
+	katss_release_counter(dint_counts);
+	katss_release_counter(mono_counts);
+	katss_release_counter(test_counts);
 	return enrichments;
 }
 
 KatssEnrichments *
 katss_ikke_shuffle(const char *test, int kmer, int klet, uint64_t iterations, bool normalize)
 {
+	return katss_ikke_shuffle_mt(test, NULL, kmer, klet, iterations, normalize, 1);
+}
+
+KatssEnrichments *
+katss_ikke_shuffle_mt(const char *test, const char *ctrl, int kmer, int klet, uint64_t iterations, bool normalize, int threads)
+{
+	(void)ctrl; // the control is the shuffled test file
+	if(!dense_kmer(kmer, "katss_ikke_shuffle_mt"))
+		return NULL;
 	KatssEnrichments *enrichments = NULL;
 
-	/* Get the counts for the test_file */
-	KatssCounter *test_counts = katss_count_kmers(test, kmer);
+	/* Get the counts for the test_file, indexed so iterations don't read it again */
+	KatssKmerIndex *index = NULL;
+	KatssCounter *test_counts = katss_count_kmers_index(test, kmer, threads, &index);
 	if(test_counts == NULL)
 		goto exit;
 
 	/* Get the counts for the control file */
-	KatssCounter *ctrl_counts = katss_count_kmers_ushuffle(test, kmer, klet);
+	KatssCounter *ctrl_counts = katss_count_kmers_ushuffle_mt(test, kmer, klet, threads);
 	if(ctrl_counts == NULL)
 		goto cleanup_ctrl;
 
@@ -360,131 +424,278 @@ katss_ikke_shuffle(const char *test, int kmer, int klet, uint64_t iterations, bo
 	enrichments->num_enrichments = iterations;
 
 	/* Get the first top kmer */
-	enrichments->enrichments[0] = katss_top_enrichment(test_counts, ctrl_counts, normalize);
+	katss_stats_lap();
+	enrichments->enrichments[0] = top_enrichment(test_counts, ctrl_counts, normalize, threads);
+	katss_stats_iterations(1);
 
 	/* Subsequent iterations begin uncounting */
 	for(uint64_t i=1; i<iterations; i++) {
 		char kseq[17];
 		katss_unhash(kseq, enrichments->enrichments[i-1].key, test_counts->kmer, true);
-		katss_recount_kmer(test_counts, test, kseq);
-		katss_recount_kmer_shuffle(ctrl_counts, test, klet, kseq);
-		enrichments->enrichments[i] = katss_top_enrichment(test_counts, ctrl_counts, normalize);
+		katss_recount_kmer_index(test_counts, &index, test, kseq, threads);
+		katss_recount_kmer_shuffle_mt(ctrl_counts, test, klet, kseq, threads);
+		enrichments->enrichments[i] = top_enrichment(test_counts, ctrl_counts, normalize, threads);
+		katss_stats_iterations(1);
 	}
 
-	katss_free_counter(ctrl_counts);
+	katss_release_counter(ctrl_counts);
 cleanup_ctrl:
-	katss_free_counter(test_counts);
+	katss_free_kmer_index(index);
+	katss_release_counter(test_counts);
 exit:
 	return enrichments;
 }
 
 KatssEnrichments *
-katss_ikke_shuffle_mt(const char *test, const char *ctrl, int kmer, int klet, uint64_t iterations, bool normalize, int threads)
+katss_ikke_sketch_mt(const char *test_file, const char *control_file, unsigned int kmer,
+                     uint64_t iterations, bool normalize, uint64_t max_bytes, int threads)
 {
-	if(threads == 1)
-		katss_ikke_shuffle(test, kmer, klet, iterations, normalize);
-
-	// TODO: Implementation
-	// Multithreaded shuffle function will not work as is since `shuffle` function
-	// provided by the ushuffle.c library is not thread-safe. To fix this, we
-	// need to replace the rand() functions with a thread-safe version of it,
-	// or require shuffle() functions to take a seed (prefered).
-	error_message("This function is not yet implemented");
-	return NULL;
+	KatssEnrichments *enrichments = NULL;
+
+	/* Sketches can't be indexed or uncounted from, every iteration reads both files again */
+	KatssCounter *test_counts = katss_init_sketch_counter(kmer, max_bytes);
+	KatssCounter *control_counts = katss_init_sketch_counter(kmer, max_bytes);
+	if(test_counts == NULL || control_counts == NULL)
+		goto cleanup;
+	if(katss_count_kmers_multi_mt(test_file, &test_counts, 1, threads) != 0 ||
+	   katss_count_kmers_multi_mt(control_file, &control_counts, 1, threads) != 0)
+		goto cleanup;
+
+	/* Create enrichments struct */
+	enrichments = s_malloc(sizeof *enrichments);
+	if(kmer < 32 && iterations > UINT64_C(1) << 2*kmer)
+		iterations = UINT64_C(1) << 2*kmer;
+	enrichments->enrichments = s_malloc(MAX2(iterations, 1) * sizeof *enrichments->enrichments);
+	enrichments->num_enrichments = iterations;
+
+	/* Get the first top kmer */
+	katss_stats_lap();
+	enrichments->enrichments[0] = top_enrichment(test_counts, control_counts, normalize, threads);
+	katss_stats_iterations(1);
+
+	/* Subsequent iterations begin uncounting, reading both files opened once */
+	SeqFile test = open_iterated(test_file), control = open_iterated(control_file);
+	for(uint64_t i=1; i<iterations; i++) {
+		char kseq[33];
+		katss_unhash64(kseq, enrichments->enrichments[i-1].key, kmer, true);
+		recount_multi(&test_counts, 1, test_file, test, kseq, threads);
+		recount_multi(&control_counts, 1, control_file, control, kseq, threads);
+		enrichments->enrichments[i] = top_enrichment(test_counts, control_counts, normalize, threads);
+		katss_stats_iterations(1);
+	}
+	seqfclose(control);
+	seqfclose(test);
+
+cleanup:
+	katss_free_counter(control_counts);
+	katss_free_counter(test_counts);
+	return enrichments;
 }
 
 /*==================================================================================================
 |                                         Helper Functions                                         |
 ==================================================================================================*/
-static double
-predict_kmer(char *kseq, KatssCounter *monomer_counts, KatssCounter *dimer_counts)
+/**
+ * @brief Whether k-mers of length `kmer` have a table of every one of them, which the knockout
+ * and probabilistic algorithms go through. Reports an error for `caller` if not.
+ */
+/**
+ * @brief Open a file read once per iteration, so it isn't opened and its type detected again
+ * every time. Preloaded files are read from memory instead, for which NULL is returned, as it is
+ * if the file can't be opened.
+ */
+static SeqFile
+open_iterated(const char *filename)
 {
-	char monoseq[2] = { 0 };
-	char diseq[3]   = { 0 };
+	KatssStoreReader *store = katss_open_store(filename);
+	if(store != NULL) {
+		katss_close_store(store);
+		return NULL;
+	}
+	char filetype;
+	return katss_open_file(filename, "", &filetype);
+}
 
-	double monoprob = 1;
-	double diprob = 1;
+/**
+ * @brief Recount `filename` through `file` if `open_iterated` opened it, or by its name otherwise.
+ */
+static int
+recount_multi(KatssCounter **counters, int num_counters, const char *filename, SeqFile file,
+              const char *remove, int threads)
+{
+	if(file != NULL)
+		return katss_recount_kmer_multi_seqfile(counters, num_counters, file, remove, threads);
+	return katss_recount_kmer_multi_mt(counters, num_counters, filename, remove, threads);
+}
 
-	int kmer = strlen(kseq);
+static bool
+dense_kmer(unsigned int kmer, const char *caller)
+{
+	if(kmer <= KATSS_DENSE_KMER)
+		return true;
+	error_message("%s: k-mers longer than %d are not supported, got %u",
+	              caller, KATSS_DENSE_KMER, kmer);
+	return false;
+}
 
-	/* Get the cumulative probabilities for overlapping monomers */
-	for(int i=1; i<kmer-1; i++) {
-		monoseq[0] = kseq[i];
-		double count;
-		katss_get(monomer_counts, KATSS_DOUBLE, &count, monoseq);
-		monoprob *= count/monomer_counts->total;
+/**
+ * @brief Store in `counts` the counts of the `num` k-mers from the `first` on, the hashes of
+ * `keys` if it isn't NULL, or else every hash in order.
+ */
+static void
+block_counts(KatssCounter *counter, const uint64_t *keys, uint64_t first, uint64_t num,
+             double *counts)
+{
+	if(keys == NULL) {
+		katss_export_range(counter, KATSS_DOUBLE, counts, sizeof *counts, first, num, false);
+		return;
 	}
+	for(uint64_t i=0; i<num; i++)
+		katss_get_from_hash64(counter, KATSS_DOUBLE, &counts[i], keys[first + i]);
+}
+
+/**
+ * @brief Scan the range of a `struct top_job` for its most enriched k-mers. The enrichments of a
+ * block are worked out in a loop of their own, with no branch for the compiler to vectorize it,
+ * and only the ones beating the last of the top k-mers are looked at again.
+ */
+static int
+top_range(void *arg)
+{
+	struct top_job *job = arg;
+	const double test_total = (double)job->test->total;
+	const double control_total = (double)job->control->total;
+	double test_counts[COUNTS_BLOCK], control_counts[COUNTS_BLOCK], enrichments[COUNTS_BLOCK];
+
+	double floor = -DBL_MAX;
+	for(uint64_t i=job->start; i<job->end; i+=COUNTS_BLOCK) {
+		uint64_t num = MIN2(job->end - i, COUNTS_BLOCK);
+		block_counts(job->test, job->keys, i, num, test_counts);
+		block_counts(job->control, job->keys, i, num, control_counts);
+
+		/* K-mers missing from either file have no enrichment */
+		for(uint64_t n=0; n<num; n++) {
+			double enrichment = (test_counts[n] / test_total) / (control_counts[n] / control_total);
+			enrichments[n] = test_counts[n] == 0 || control_counts[n] == 0 ? -DBL_MAX : enrichment;
+		}
 
-	/* Get probabilities for all di-mers in k-mer */
-	for(int i=0; i<kmer-1; i++) {
-		diseq[0] = kseq[i]; diseq[1] = kseq[i+1];
-		double count;
-		katss_get(dimer_counts, KATSS_DOUBLE, &count, diseq);
-		diprob *= count/dimer_counts->total;
+		for(uint64_t n=0; n<num; n++) {
+			if(enrichments[n] <= floor)
+				continue;
+			uint64_t key = job->keys ? job->keys[i + n] : i + n;
+			job->found = insert_top(job->top, job->found, job->num_top, enrichments[n], key);
+			if(job->found == job->num_top)
+				floor = job->top[job->num_top - 1].enrichment;
+		}
 	}
 
-	/* Predicted k-mer probability is dinucleotides / overlapping monomers */
-	return diprob/monoprob;
+	return 0;
 }
 
+/**
+ * @brief Insert a k-mer into the `found` most enriched ones of `top`, after the ones as enriched
+ * as it, keeping at most `num_top` of them. Returns how many `top` then holds.
+ */
+static int
+insert_top(KatssEnrichment *top, int found, int num_top, double enrichment, uint64_t key)
+{
+	int pos = found;
+	while(pos > 0 && top[pos - 1].enrichment < enrichment)
+		pos--;
+	if(pos == num_top)
+		return found;
+	if(found == num_top)
+		found--;
+	memmove(&top[pos + 1], &top[pos], (size_t)(found - pos) * sizeof *top);
+	top[pos].enrichment = enrichment;
+	top[pos].key = key;
+	return found + 1;
+}
 
-KatssEnrichment
-katss_top_enrichment(KatssCounter *test, KatssCounter *control, bool normalize)
+/**
+ * @brief Most enriched k-mer of `test`, using `threads` threads, warning when it was counted less
+ * than 20 times.
+ */
+static KatssEnrichment
+top_enrichment(KatssCounter *test, KatssCounter *control, bool normalize, int threads)
 {
 	KatssEnrichment top_kmer = {.enrichment = -DBL_MAX};
-	uint32_t top_enrichment_hash = 0;
-	double top_enrichment = -DBL_MAX;
-
-	/* Sanity check, make sure total_count is greater than 0 */
-	if(!control->total || !test->total) {
+	if(katss_top_enrichments(test, control, normalize, threads, &top_kmer, 1) == 0)
 		return top_kmer;
+
+	/* Check count of top enrichment */
+	uint64_t count;
+	katss_get_from_hash64(test, KATSS_UINT64, &count, top_kmer.key);
+	if(count < 20) {
+		char kmer_str[33];
+		katss_unhash64(kmer_str, top_kmer.key, test->kmer, false);
+		warning_message("count for `%s' is less than 20.", kmer_str);
 	}
 
-	for(uint32_t i=0; i<control->capacity; i++) {
-		/* Get frequencies of input and bound */
-		double test_frq, control_frq;
-		katss_get_from_hash(test, KATSS_DOUBLE, &test_frq, i);
-		katss_get_from_hash(control, KATSS_DOUBLE, &control_frq, i);
+	/* Everything (probably) worked! Hurray, now return. */
+	return top_kmer;
+}
+
 
-		if(test_frq == 0 || control_frq == 0) {
-			continue;
-		}
+KatssEnrichment
+katss_top_enrichment(KatssCounter *test, KatssCounter *control, bool normalize)
+{
+	return top_enrichment(test, control, normalize, 1);
+}
 
-		control_frq /= control->total;
-		test_frq /= test->total;
 
-		/* get enrichment of current kmer */
-		double cur_enrichment = test_frq/control_frq;
-		if(normalize) {
-			cur_enrichment = log2(cur_enrichment);
-		}
+int
+katss_top_enrichments(KatssCounter *test, KatssCounter *control, bool normalize, int threads,
+                      KatssEnrichment *top, int num_top)
+{
+	/* Sanity check, make sure total_count is greater than 0 */
+	if(!control->total || !test->total || num_top < 1)
+		return 0;
 
-		if(cur_enrichment > top_enrichment) {
-			top_enrichment = cur_enrichment;
-			top_enrichment_hash = i;
-		}
+	/* A sketch only has its most counted k-mers to pick from */
+	uint64_t num_kmers = (uint64_t)control->capacity + 1, *keys = NULL;
+	if(test->sketch != NULL)
+		num_kmers = katss_list_kmers(test, &keys);
+
+	/* Every thread keeps the top k-mers of its share, which are then merged */
+	int num_jobs = (int)MAX2(MIN2((uint64_t)MAX2(threads, 1), num_kmers / TOP_MIN_KMERS), 1);
+	struct top_job *jobs = s_malloc(num_jobs * sizeof *jobs);
+	KatssEnrichment *found = s_malloc((size_t)num_jobs * num_top * sizeof *found);
+	for(int j=0; j<num_jobs; j++) {
+		jobs[j].test = test;
+		jobs[j].control = control;
+		jobs[j].keys = keys;
+		jobs[j].start = num_kmers * j / num_jobs;
+		jobs[j].end = num_kmers * (j + 1) / num_jobs;
+		jobs[j].top = found + (size_t)j * num_top;
+		jobs[j].num_top = num_top;
+		jobs[j].found = 0;
 	}
-
-	/* No top kmer was found (probs because something terrible happened) return empty struct */
-	if(top_enrichment == top_kmer.enrichment) {
-		return top_kmer;
+	if(num_jobs == 1) {
+		top_range(jobs);
+	} else {
+		KatssTaskGroup *group = katss_init_task_group();
+		for(int j=0; j<num_jobs; j++)
+			katss_submit_task(group, top_range, &jobs[j]);
+		katss_wait_task_group(group);
 	}
 
-	/* Fill struct with info */
-	top_kmer.enrichment = top_enrichment;
-	top_kmer.key = top_enrichment_hash;
-
-	/* Check count of top enrichment */
-	uint64_t count;
-	katss_get_from_hash(test, KATSS_UINT64, &count, top_kmer.key);
-	if(count < 20) {
-		char kmer_str[20];
-		katss_unhash(kmer_str, top_kmer.key, test->kmer, false);
-		warning_message("count for `%s' is less than 20.", kmer_str);
+	/* Shares are merged in order, so ties still go to the k-mer with the lowest hash */
+	int num_found = 0;
+	for(int j=0; j<num_jobs; j++) {
+		for(int t=0; t<jobs[j].found; t++)
+			num_found = insert_top(top, num_found, num_top, jobs[j].top[t].enrichment,
+			                       jobs[j].top[t].key);
 	}
 
-	/* Everything (probably) worked! Hurray, now return. */
-	return top_kmer;
+	/* log2 keeps the order of the enrichments, so it is only taken of the top ones */
+	for(int t=0; normalize && t<num_found; t++)
+		top[t].enrichment = log2(top[t].enrichment);
+
+	free(found);
+	free(jobs);
+	free(keys);
+	return num_found;
 }
 
 
@@ -493,16 +704,19 @@ katss_top_prediction(KatssCounter *test, KatssCounter *mono, KatssCounter *dint,
 {
 	KatssEnrichment top_kmer = {.enrichment = DBL_MIN};
 	double top_enrichment = DBL_MIN;
-	char kseq[17];
 
+	double test_counts[COUNTS_BLOCK], predictions[COUNTS_BLOCK];
+	uint64_t num_kmers = (uint64_t)test->capacity + 1;
 	for(uint32_t i=0; i<=test->capacity; i++) {
-		katss_unhash(kseq, i, test->kmer, true);
-
 		/* Get actual and predicted frequencies */
+		if(i % COUNTS_BLOCK == 0) {
+			uint64_t num = MIN2(num_kmers - i, COUNTS_BLOCK);
+			block_counts(test, NULL, i, num, test_counts);
+			katss_predict_kmer_freqs(i, num, test->kmer, mono, dint, predictions);
+		}
 		double kmer_frq, pred_frq;
-		katss_get_from_hash(test, KATSS_DOUBLE, &kmer_frq, i);
-		kmer_frq = kmer_frq / test->total;
-		pred_frq = predict_kmer(kseq, mono, dint);
+		kmer_frq = test_counts[i % COUNTS_BLOCK] / test->total;
+		pred_frq = predictions[i % COUNTS_BLOCK];
 
 		/* if input_frq is 0, then div by 0 error would occur so skip */
 		if(pred_frq == 0) {
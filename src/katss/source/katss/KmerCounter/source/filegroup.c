@@ -0,0 +1,180 @@
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L) && !defined(__STDC_NO_THREADS__)
+#  include <threads.h>
+#else
+#  include <tinycthread.h>
+#endif
+
+#include "katss_core.h"
+#include "counter.h"
+#include "memory_utils.h"
+#include "seqfile.h"
+
+/* Files read under a single name, as if they were one file */
+struct KatssFileGroup {
+	char *name;                    /** Name the files are read under */
+	char **paths;                  /** Paths of the files, in the order they are read */
+	int num_paths;                 /** Number of files in `paths` */
+	struct KatssFileGroup *next;   /** Next group */
+};
+typedef struct KatssFileGroup KatssFileGroup;
+
+static KatssFileGroup *groups = NULL;
+static mtx_t groups_lock;
+static once_flag groups_once = ONCE_FLAG_INIT;
+
+static void init_groups(void);
+static KatssFileGroup *find_group(const char *name);
+static void free_group(KatssFileGroup *group);
+
+/*
+Notes:
+Groups are looked up by name when a file is opened, the same way preloaded files are, so every
+function reading a file reads a group with no change of its own. The files are opened together
+as one SeqFile (see `seqfopenlist`), and threads sharing it read different files at once, each of
+them inflating its own. So several compressed files are counted about as fast as they would be on
+their own, instead of one after the other.
+
+Groups have no file of their own to index, so they are never read through a read index or a
+gzip index, and are streamed unless preloaded.
+
+A group of counter files (see `katss_save_counter`), e.g. the counts of the shards of a library
+counted on different machines, is never opened: the enrichments merge their counters instead.
+*/
+
+
+/*==================================================================================================
+|                                         Public Functions                                         |
+==================================================================================================*/
+int
+katss_group_files(const char *name, const char *const *paths, int num_paths)
+{
+	if(name == NULL || paths == NULL || num_paths < 1)
+		return 2;
+	for(int i=0; i<num_paths; i++) {
+		if(paths[i] == NULL)
+			return 2;
+	}
+	call_once(&groups_once, init_groups);
+
+	mtx_lock(&groups_lock);
+	if(find_group(name) != NULL) {
+		mtx_unlock(&groups_lock);
+		return 1;
+	}
+	KatssFileGroup *group = s_malloc(sizeof *group);
+	group->name = s_malloc(strlen(name) + 1);
+	strcpy(group->name, name);
+	group->paths = s_malloc(num_paths * sizeof *group->paths);
+	for(int i=0; i<num_paths; i++) {
+		group->paths[i] = s_malloc(strlen(paths[i]) + 1);
+		strcpy(group->paths[i], paths[i]);
+	}
+	group->num_paths = num_paths;
+	group->next = groups;
+	groups = group;
+	mtx_unlock(&groups_lock);
+	return 0;
+}
+
+
+void
+katss_ungroup_files(const char *name)
+{
+	if(name == NULL)
+		return;
+	call_once(&groups_once, init_groups);
+
+	mtx_lock(&groups_lock);
+	KatssFileGroup **link = &groups;
+	while(*link != NULL && strcmp((*link)->name, name) != 0)
+		link = &(*link)->next;
+	KatssFileGroup *group = *link;
+	if(group != NULL)
+		*link = group->next;
+	mtx_unlock(&groups_lock);
+
+	/* Files already opened under the name are read on, they no longer depend on the group */
+	if(group != NULL)
+		free_group(group);
+}
+
+
+/*==================================================================================================
+|                                        Internal Functions                                        |
+==================================================================================================*/
+SeqFile
+katss_open_group(const char *name, const char *mode, bool *grouped)
+{
+	*grouped = false;
+	if(name == NULL)
+		return NULL;
+	call_once(&groups_once, init_groups);
+
+	mtx_lock(&groups_lock);
+	KatssFileGroup *group = find_group(name);
+	SeqFile file = NULL;
+	if(group != NULL) {
+		*grouped = true;
+		file = seqfopenlist((const char *const *)group->paths, group->num_paths, mode);
+	}
+	mtx_unlock(&groups_lock);
+	return file;
+}
+
+
+char **
+katss_group_members(const char *name, int *num_paths)
+{
+	*num_paths = 0;
+	if(name == NULL)
+		return NULL;
+	call_once(&groups_once, init_groups);
+
+	mtx_lock(&groups_lock);
+	KatssFileGroup *group = find_group(name);
+	char **paths = NULL;
+	if(group != NULL) {
+		paths = s_malloc(group->num_paths * sizeof *paths);
+		for(int i=0; i<group->num_paths; i++) {
+			paths[i] = s_malloc(strlen(group->paths[i]) + 1);
+			strcpy(paths[i], group->paths[i]);
+		}
+		*num_paths = group->num_paths;
+	}
+	mtx_unlock(&groups_lock);
+	return paths;
+}
+
+
+/*==================================================================================================
+|                                        Private Functions                                         |
+==================================================================================================*/
+static void
+init_groups(void)
+{
+	mtx_init(&groups_lock, mtx_plain);
+}
+
+
+static KatssFileGroup *
+find_group(const char *name)
+{
+	KatssFileGroup *group = groups;
+	while(group != NULL && strcmp(group->name, name) != 0)
+		group = group->next;
+	return group;
+}
+
+
+static void
+free_group(KatssFileGroup *group)
+{
+	for(int i=0; i<group->num_paths; i++)
+		free(group->paths[i]);
+	free(group->paths);
+	free(group->name);
+	free(group);
+}
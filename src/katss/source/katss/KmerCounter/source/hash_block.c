@@ -0,0 +1,676 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L) && !defined(__STDC_NO_THREADS__)
+#  include <threads.h>
+#else
+#  include <tinycthread.h>
+#endif
+
+#include "katss_core.h"
+#include "hash_functions.h"
+#include "memory_utils.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  include <immintrin.h>
+#  define KATSS_X86_SIMD 1
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#  include <arm_neon.h>
+#  define KATSS_NEON_SIMD 1
+#endif
+
+/* Number of bytes encoded at a time before being rolled into hashes */
+#define ENCODE_WINDOW 256
+
+typedef size_t (*encode_fn)(const unsigned char *sequence, size_t length, uint8_t *codes);
+
+static size_t encode_scalar(const unsigned char *sequence, size_t length, uint8_t *codes);
+#ifdef KATSS_X86_SIMD
+static size_t encode_sse41(const unsigned char *sequence, size_t length, uint8_t *codes);
+static size_t encode_avx2(const unsigned char *sequence, size_t length, uint8_t *codes);
+#endif
+#ifdef KATSS_NEON_SIMD
+static size_t encode_neon(const unsigned char *sequence, size_t length, uint8_t *codes);
+#endif
+
+static void select_encoder(void);
+
+/* Largest specialized k-mer + 1 */
+#define NUM_KERNELS 13
+static const KatssHashBlock kernels[NUM_KERNELS][3];
+
+/* Number of hashes computed at a time by a multi-hasher */
+#define MULTI_BLOCK 4096U
+
+static size_t select_run_tails(uint32_t *selected, const uint32_t *hashes, const uint8_t *runs,
+                               size_t num_hashes, KatssCounter *counter, unsigned int *run,
+                               uint32_t last_hash);
+static inline void add_tail(KatssCounter *counter, unsigned int run, uint32_t last_hash);
+static size_t hash_block_runs_r(KatssHasher *hasher, uint32_t *hashes, uint8_t *runs, size_t max);
+static size_t hash_block_runs_a(KatssHasher *hasher, uint32_t *hashes, uint8_t *runs, size_t max);
+static size_t hash_block_runs_q(KatssHasher *hasher, uint32_t *hashes, uint8_t *runs, size_t max);
+
+static encode_fn encode_run = encode_scalar;
+static once_flag encoder_flag = ONCE_FLAG_INIT;
+
+/*==========  Legend:  ==========*
+0: 'A', 'a'                      |
+1: 'C', 'c'                      |
+2: 'G', 'g'                      |
+3: 'T', 'U', 't', 'u'            |
+4: Every other character         |
+================================*/
+static const uint8_t code[256] = {
+	4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,  //0..15
+	4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,  //16..31
+	4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,  //32..47
+	4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,  //48..63
+	4, 0, 4, 1, 4, 4, 4, 2, 4, 4, 4, 4, 4, 4, 4, 4,  //64..79
+	4, 4, 4, 4, 3, 3, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,  //80..95
+	4, 0, 4, 1, 4, 4, 4, 2, 4, 4, 4, 4, 4, 4, 4, 4,  //96..111
+	4, 4, 4, 4, 3, 3, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,  //112..127
+	4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,  //128..143
+	4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,  //144..159
+	4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,  //160..175
+	4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,  //176..191
+	4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,  //192..207
+	4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,  //208..223
+	4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,  //224..239
+	4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,  //240..255
+};
+
+/*=================================================
+| Block hashing                                   |
+=================================================*/
+
+size_t
+katss_hash_block(KatssHasher *hasher, uint32_t *hashes, size_t max, char filetype)
+{
+	KatssHashBlock kernel = katss_hash_block_kernel(hasher->kmer, filetype);
+	return kernel ? kernel(hasher, hashes, max) : 0;
+}
+
+
+KatssHashBlock
+katss_hash_block_kernel(unsigned int kmer, char filetype)
+{
+	int type;
+	switch(filetype) {
+	case 'r': type = 0; break;
+	case 'a': type = 1; break;
+	case 'q': type = 2; break;
+	default:
+		error_message("Filetype '%c' currently not supported.", filetype);
+		return NULL;
+	}
+
+	if(kmer < NUM_KERNELS && kernels[kmer][type] != NULL)
+		return kernels[kmer][type];
+	return kernels[0][type];
+}
+
+/*=================================================
+| Multi k-mer hashing                             |
+=================================================*/
+
+KatssMultiHasher *
+katss_init_multi_hasher(KatssCounter **counters, const bool *locked, int num_counters,
+                        char filetype)
+{
+	if(counters == NULL || num_counters < 1)
+		return NULL;
+
+	unsigned int kmer = 0;
+	for(int i=0; i<num_counters; i++) {
+		if(counters[i] == NULL) {
+			error_message("katss: multi-hasher: counter %d is NULL", i);
+			return NULL;
+		}
+		kmer = MAX2(kmer, counters[i]->kmer);
+	}
+
+	KatssHasher *hasher = katss_init_hasher(kmer, filetype);
+	if(hasher == NULL)
+		return NULL;
+
+	KatssMultiHasher *multi = s_malloc(sizeof *multi);
+	multi->hasher = hasher;
+	multi->filetype = filetype;
+	multi->num_counters = num_counters;
+	multi->counters = s_malloc(num_counters * sizeof *multi->counters);
+	multi->locked = s_malloc(num_counters * sizeof *multi->locked);
+	multi->run = s_calloc(num_counters, sizeof *multi->run);
+	multi->last_hash = 0;
+	for(int i=0; i<num_counters; i++) {
+		multi->counters[i] = counters[i];
+		multi->locked[i] = locked != NULL && locked[i];
+
+		/* Tails are only kept without contention, a shared counter won't have all of them */
+		if(multi->locked[i] && counters[i]->tails != NULL)
+			counters[i]->partial_tails = true;
+	}
+
+	multi->hash_values = s_malloc(MULTI_BLOCK * sizeof *multi->hash_values);
+	multi->runs = s_malloc(MULTI_BLOCK * sizeof *multi->runs);
+	multi->selected = s_malloc(MULTI_BLOCK * sizeof *multi->selected);
+
+	return multi;
+}
+
+
+void
+katss_multi_hash_seq(KatssMultiHasher *multi, char *sequence)
+{
+	katss_set_seq(multi->hasher, sequence, multi->filetype);
+
+	size_t num_hashes, num_selected;
+	while((num_hashes = katss_hash_block_runs(multi->hasher, multi->hash_values, multi->runs,
+	                                          MULTI_BLOCK, multi->filetype))) {
+		for(int i=0; i<multi->num_counters; i++) {
+			KatssCounter *counter = multi->counters[i];
+			if(counter->tails != NULL && !multi->locked[i])
+				num_selected = select_run_tails(multi->selected, multi->hash_values, multi->runs,
+				                                num_hashes, counter, &multi->run[i],
+				                                multi->last_hash);
+			else
+				num_selected = katss_select_run_hashes(multi->selected, multi->hash_values,
+				                                       multi->runs, num_hashes, counter->kmer,
+				                                       &multi->run[i]);
+			if(multi->locked[i])
+				katss_increments(counter, multi->selected, num_selected);
+			else
+				katss_increments_unlocked(counter, multi->selected, num_selected);
+		}
+		multi->last_hash = multi->hash_values[num_hashes - 1];
+	}
+}
+
+
+void
+katss_multi_hash_read(KatssMultiHasher *multi, char *read)
+{
+	/* Nothing is carried over from the previous read */
+	KatssHasher *hasher = multi->hasher;
+	hasher->previous_hash = 0;
+	hasher->has_previous = false;
+	hasher->endno = 0;
+	hasher->pos = 0;
+	memset(multi->run, 0, multi->num_counters * sizeof *multi->run);
+
+	katss_multi_hash_seq(multi, read);
+	katss_multi_hash_end(multi);
+}
+
+
+void
+katss_multi_hash_end(KatssMultiHasher *multi)
+{
+	for(int i=0; i<multi->num_counters; i++) {
+		KatssCounter *counter = multi->counters[i];
+		if(counter->tails != NULL && !multi->locked[i])
+			add_tail(counter, multi->run[i], multi->last_hash);
+		multi->run[i] = 0;
+	}
+}
+
+
+void
+katss_free_multi_hasher(KatssMultiHasher *multi)
+{
+	if(multi == NULL)
+		return;
+
+	free(multi->hasher);
+	free(multi->counters);
+	free(multi->locked);
+	free(multi->run);
+	free(multi->hash_values);
+	free(multi->runs);
+	free(multi->selected);
+	free(multi);
+}
+
+
+void
+katss_set_span(KatssHasher *hasher, const char *sequence, size_t length)
+{
+	/* Same as `katss_set_seq`, but bounded by the span rather than a null terminator */
+	unsigned char *seq = (unsigned char *)sequence, *end = seq + length;
+	while(hasher->endno > 0 && seq < end) {
+		if(*seq++ == '\n')
+			hasher->endno--;
+	}
+	hasher->sequence = seq;
+	hasher->seqend = end;
+	hasher->end_of_seq = seq == end;
+}
+
+
+size_t
+katss_hash_block_runs(KatssHasher *hasher, uint32_t *hashes, uint8_t *runs, size_t max,
+                      char filetype)
+{
+	switch(filetype) {
+	case 'r': return hash_block_runs_r(hasher, hashes, runs, max);
+	case 'a': return hash_block_runs_a(hasher, hashes, runs, max);
+	case 'q': return hash_block_runs_q(hasher, hashes, runs, max);
+	default:
+		error_message("Filetype '%c' currently not supported.", filetype);
+		return 0;
+	}
+}
+
+
+size_t
+katss_select_run_hashes(uint32_t *selected, const uint32_t *hashes, const uint8_t *runs,
+                        size_t num_hashes, unsigned int kmer, unsigned int *run)
+{
+	const uint32_t mask = (uint32_t)((1ULL << 2*kmer) - 1);
+	unsigned int cur = *run;
+	size_t num_selected = 0;
+	for(size_t i=0; i<num_hashes; i++) {
+		if(runs[i] == 0) { /* Blank line, resets only if a previous k-mer exists */
+			if(cur >= kmer)
+				cur = 0;
+			continue;
+		}
+		cur = runs[i] == 1 ? 1 : cur + (cur < kmer);
+		if(cur >= kmer)
+			selected[num_selected++] = hashes[i] & mask;
+	}
+	*run = cur;
+
+	return num_selected;
+}
+
+/**
+ * Same as `katss_select_run_hashes`, also adding to the counter's tails the tail of every run that
+ * ends. `last_hash` is the hash of the base before the first one in `hashes`.
+ */
+static size_t
+select_run_tails(uint32_t *selected, const uint32_t *hashes, const uint8_t *runs,
+                 size_t num_hashes, KatssCounter *counter, unsigned int *run, uint32_t last_hash)
+{
+	const unsigned int kmer = counter->kmer;
+	const uint32_t mask = (uint32_t)((1ULL << 2*kmer) - 1);
+	unsigned int cur = *run;
+	size_t num_selected = 0;
+	for(size_t i=0; i<num_hashes; i++) {
+		if(runs[i] == 0) {
+			if(cur >= kmer) {
+				add_tail(counter, cur, hashes[i]);
+				cur = 0;
+			} else if(cur > 0) { /* Shorter k-mers of the run would have been reset */
+				counter->partial_tails = true;
+			}
+			continue;
+		}
+		if(runs[i] == 1) {
+			add_tail(counter, cur, i ? hashes[i-1] : last_hash);
+			cur = 1;
+		} else {
+			cur += cur < kmer;
+		}
+		if(cur >= kmer)
+			selected[num_selected++] = hashes[i] & mask;
+	}
+	*run = cur;
+
+	return num_selected;
+}
+
+/**
+ * Add the tail of a run of `run` bases (capped at the k-mer) ending with the hash `last_hash`.
+ */
+static inline void
+add_tail(KatssCounter *counter, unsigned int run, uint32_t last_hash)
+{
+	unsigned int len = MIN2(run, counter->kmer - 1);
+	if(len == 0)
+		return;
+	counter->tails[KATSS_TAIL_OFFSET(len) + (last_hash & ((1U << 2*len) - 1))]++;
+}
+
+/*=================================================
+| Specialized kernels                             |
+=================================================*/
+
+/**
+ * Template for all block hashing kernels. `filetype` and `kmer` are compile-time constants in
+ * every instantiation, so the filetype branches fold away and the first k-mer of each run is
+ * unrolled. A `kmer` of 0 instantiates the generic kernel that reads k from the hasher.
+ * 
+ * With `runs` set, a hash is emitted for every base instead, along with the number of bases in
+ * the current run (saturating at 255) or 0 for a blank line that is carried over, see
+ * `katss_hash_block_runs`. Otherwise canonical hashers also roll the reverse complement, and
+ * emit the smaller of both hashes.
+ */
+static inline __attribute__((always_inline)) size_t
+hash_block_impl(KatssHasher *hasher, uint32_t *hashes, uint8_t *runs, size_t max,
+                const char filetype, const unsigned int k)
+{
+	if(hasher->sequence == NULL || hashes == NULL)
+		return 0;
+
+	call_once(&encoder_flag, select_encoder);
+	if(hasher->seqend == NULL)
+		hasher->seqend = hasher->sequence + strlen((char *)hasher->sequence);
+
+	/* Work on local copies of the hasher state, written back once done */
+	const unsigned int kmer = k ? k : hasher->kmer;
+	const uint32_t mask = k ? (uint32_t)((1ULL << 2*k) - 1) : hasher->mask;
+	unsigned char *seq = hasher->sequence, *end = hasher->seqend, *eol;
+	uint32_t hash = hasher->previous_hash;
+	uint32_t rc = (uint32_t)hasher->previous_rc;
+	const bool canonical = runs == NULL && hasher->canonical;
+	const unsigned int shift = 2*(kmer - 1);
+	unsigned int pos = hasher->pos;
+	bool has_previous = hasher->has_previous;
+	if(!has_previous && pos == 0)
+		hash = 0;
+
+	uint8_t codes[ENCODE_WINDOW];
+	size_t num_hashes = 0, resets = 0;
+	while(num_hashes < max && !hasher->end_of_seq) {
+		/* Encode the run of valid bases at the current position */
+		size_t length = MIN2((size_t)(end - seq), ENCODE_WINDOW);
+		size_t valid = encode_run(seq, length, codes);
+		size_t i = 0;
+
+		/* Every base ends a k-mer of some length, only track how long the run is */
+		if(runs != NULL) {
+			size_t stop = MIN2(valid, max - num_hashes);
+			for(; i < stop; i++) {
+				hash = ((hash << 2) | codes[i]) & mask;
+				pos += pos < UINT8_MAX;
+				hashes[num_hashes] = hash;
+				runs[num_hashes++] = (uint8_t)pos;
+			}
+			has_previous = pos > 0;
+		}
+
+		/* Finish the first k-mer of the run, then roll over the rest of it */
+		if(runs == NULL && !has_previous) {
+			if(pos == 0 && valid >= kmer) { /* Unrolled when `kmer` is known at compile-time */
+				for(unsigned int j = 0; j < kmer; j++)
+					hash = (hash << 2) | codes[j];
+				for(unsigned int j = 0; canonical && j < kmer; j++)
+					rc = (rc >> 2) | ((uint32_t)(3 - codes[j]) << shift);
+				i = pos = kmer;
+			}
+			for(; i < valid && pos < kmer; i++, pos++) {
+				hash = (hash << 2) | codes[i];
+				if(canonical) /* Rolled out entirely by the k-mer's bases, so never reset */
+					rc = (rc >> 2) | ((uint32_t)(3 - codes[i]) << shift);
+			}
+			if(pos == kmer) {
+				hashes[num_hashes++] = canonical ? MIN2(hash, rc) : hash;
+				has_previous = true;
+				pos = 0;
+			}
+		}
+		if(runs == NULL && has_previous) {
+			size_t stop = MIN2(valid, i + (max - num_hashes));
+			for(; canonical && i < stop; i++) {
+				hash = ((hash << 2) | codes[i]) & mask;
+				rc = (rc >> 2) | ((uint32_t)(3 - codes[i]) << shift);
+				hashes[num_hashes++] = MIN2(hash, rc);
+			}
+			for(; i < stop; i++) {
+				hash = ((hash << 2) | codes[i]) & mask;
+				hashes[num_hashes++] = hash;
+			}
+		}
+		seq += i;
+		if(i < valid || (valid == length && seq != end))
+			continue; /* Either `hashes` is full, or the run continues past the window */
+
+		/* Reached the end of sequence, keep state to continue from in the next sequence */
+		if(seq == end) {
+			hasher->end_of_seq = true;
+			break;
+		}
+
+		/* A rolling hash is only carried over a single newline in fasta/fastq files */
+		if(has_previous) {
+			if(filetype != 'r' && *seq == '\n') {
+				if(++seq == end) {
+					hasher->end_of_seq = true;
+					break;
+				}
+				if(code[*seq] < 4) {
+					if(runs != NULL)
+						hasher->joined = true;
+					continue;
+				}
+
+				/* A blank line only resets k-mers of the run's length or shorter, which are
+				   the only ones that would have had a previous hash. Let the caller decide */
+				if(runs != NULL && *seq == '\n') {
+					hasher->joined = true;
+					if(num_hashes == max) {
+						--seq;
+						break;
+					}
+					hashes[num_hashes] = hash;
+					runs[num_hashes++] = 0;
+					++seq;
+					continue;
+				}
+			}
+			has_previous = false;
+			pos = 0;
+			hash = 0;
+		}
+
+		/* Handle the character the same way the filetype parsers do */
+		if(filetype != 'r' && *seq == '\n') {
+			++seq; /* newline, just skip! */
+		} else if((filetype == 'a' && *seq == '>') || (filetype == 'q' && *seq == '@')) {
+			pos = 0;
+			hash = 0;
+			if((eol = memchr(seq, '\n', (size_t)(end - seq))) == NULL) {
+				hasher->end_of_seq = true;
+				hasher->endno = 1;
+				break;
+			}
+			seq = eol + 1;
+		} else if(filetype == 'q' && *seq == '+') { /* skip two lines */
+			pos = 0;
+			hash = 0;
+			if((eol = memchr(seq, '\n', (size_t)(end - seq))) == NULL) {
+				hasher->end_of_seq = true;
+				hasher->endno = 2;
+				break;
+			}
+			seq = eol + 1;
+			if((eol = memchr(seq, '\n', (size_t)(end - seq))) == NULL) {
+				hasher->end_of_seq = true;
+				hasher->endno = 1;
+				break;
+			}
+			seq = eol + 1;
+		} else {
+			resets += *seq != '\n'; /* Reads end their line here */
+			pos = 0;
+			hash = 0;
+			++seq;
+		}
+	}
+	KATSS_STAT_ADD(kmers_hashed, num_hashes);
+	KATSS_STAT_ADD(invalid_resets, resets);
+
+	hasher->sequence = seq;
+	hasher->previous_hash = hash;
+	hasher->previous_rc = rc;
+	hasher->has_previous = has_previous;
+	hasher->pos = (int)pos;
+
+	return num_hashes;
+}
+
+#define HASH_BLOCK_KERNEL(name, filetype, k)                                    \
+	static size_t name(KatssHasher *hasher, uint32_t *hashes, size_t max)       \
+	{                                                                           \
+		return hash_block_impl(hasher, hashes, NULL, max, filetype, k);         \
+	}
+
+#define HASH_BLOCK_KERNELS(k)                                                   \
+	HASH_BLOCK_KERNEL(hash_block_r##k, 'r', k)                                  \
+	HASH_BLOCK_KERNEL(hash_block_a##k, 'a', k)                                  \
+	HASH_BLOCK_KERNEL(hash_block_q##k, 'q', k)
+
+HASH_BLOCK_KERNELS(0)
+HASH_BLOCK_KERNELS(3)
+HASH_BLOCK_KERNELS(4)
+HASH_BLOCK_KERNELS(5)
+HASH_BLOCK_KERNELS(6)
+HASH_BLOCK_KERNELS(7)
+HASH_BLOCK_KERNELS(8)
+HASH_BLOCK_KERNELS(10)
+HASH_BLOCK_KERNELS(12)
+
+#define HASH_BLOCK_RUNS_KERNEL(name, filetype)                                  \
+	static size_t name(KatssHasher *hasher, uint32_t *hashes, uint8_t *runs, size_t max) \
+	{                                                                           \
+		return hash_block_impl(hasher, hashes, runs, max, filetype, 0);         \
+	}
+
+HASH_BLOCK_RUNS_KERNEL(hash_block_runs_r, 'r')
+HASH_BLOCK_RUNS_KERNEL(hash_block_runs_a, 'a')
+HASH_BLOCK_RUNS_KERNEL(hash_block_runs_q, 'q')
+
+#define KERNEL_ROW(k) [k] = { hash_block_r##k, hash_block_a##k, hash_block_q##k }
+
+/* Kernels indexed by k-mer and filetype (reads, fasta, fastq). Row 0 holds the generic ones */
+static const KatssHashBlock kernels[NUM_KERNELS][3] = {
+	KERNEL_ROW(0), KERNEL_ROW(3), KERNEL_ROW(4), KERNEL_ROW(5), KERNEL_ROW(6),
+	KERNEL_ROW(7), KERNEL_ROW(8), KERNEL_ROW(10), KERNEL_ROW(12),
+};
+
+/*=================================================
+| Encoding kernels                                |
+=================================================*/
+
+/**
+ * All kernels store the 2-bit code of every base in `sequence` into `codes`, stopping at the
+ * first character that is not a nucleotide. They return the number of bases encoded, so a
+ * return value smaller than `length` means `sequence[return]` is not a nucleotide.
+ */
+static size_t
+encode_scalar(const unsigned char *sequence, size_t length, uint8_t *codes)
+{
+	for(size_t i=0; i<length; i++) {
+		uint8_t x = code[sequence[i]];
+		if(x > 3)
+			return i;
+		codes[i] = x;
+	}
+	return length;
+}
+
+#ifdef KATSS_X86_SIMD
+__attribute__((target("sse4.1"))) static size_t
+encode_sse41(const unsigned char *sequence, size_t length, uint8_t *codes)
+{
+	const __m128i lower = _mm_set1_epi8(0x20);
+	const __m128i a = _mm_set1_epi8('a'), c = _mm_set1_epi8('c');
+	const __m128i g = _mm_set1_epi8('g'), t = _mm_set1_epi8('t'), u = _mm_set1_epi8('u');
+	const __m128i one = _mm_set1_epi8(1), two = _mm_set1_epi8(2), three = _mm_set1_epi8(3);
+
+	size_t i = 0;
+	for(; i + 16 <= length; i += 16) {
+		/* OR-ing 0x20 lowercases letters while keeping every other byte distinct from acgtu */
+		__m128i v = _mm_or_si128(_mm_loadu_si128((const __m128i *)(sequence + i)), lower);
+		__m128i is_a = _mm_cmpeq_epi8(v, a);
+		__m128i is_c = _mm_cmpeq_epi8(v, c);
+		__m128i is_g = _mm_cmpeq_epi8(v, g);
+		__m128i is_t = _mm_or_si128(_mm_cmpeq_epi8(v, t), _mm_cmpeq_epi8(v, u));
+
+		__m128i nt = _mm_or_si128(_mm_and_si128(is_c, one), _mm_and_si128(is_g, two));
+		nt = _mm_or_si128(nt, _mm_and_si128(is_t, three));
+		_mm_storeu_si128((__m128i *)(codes + i), nt);
+
+		unsigned int valid = (unsigned int)_mm_movemask_epi8(
+			_mm_or_si128(_mm_or_si128(is_a, is_c), _mm_or_si128(is_g, is_t)));
+		if(valid != 0xFFFFu)
+			return i + (size_t)__builtin_ctz(~valid);
+	}
+
+	return i + encode_scalar(sequence + i, length - i, codes + i);
+}
+
+__attribute__((target("avx2"))) static size_t
+encode_avx2(const unsigned char *sequence, size_t length, uint8_t *codes)
+{
+	const __m256i lower = _mm256_set1_epi8(0x20);
+	const __m256i a = _mm256_set1_epi8('a'), c = _mm256_set1_epi8('c');
+	const __m256i g = _mm256_set1_epi8('g'), t = _mm256_set1_epi8('t');
+	const __m256i u = _mm256_set1_epi8('u');
+	const __m256i one = _mm256_set1_epi8(1), two = _mm256_set1_epi8(2);
+	const __m256i three = _mm256_set1_epi8(3);
+
+	size_t i = 0;
+	for(; i + 32 <= length; i += 32) {
+		__m256i v = _mm256_or_si256(_mm256_loadu_si256((const __m256i *)(sequence + i)), lower);
+		__m256i is_a = _mm256_cmpeq_epi8(v, a);
+		__m256i is_c = _mm256_cmpeq_epi8(v, c);
+		__m256i is_g = _mm256_cmpeq_epi8(v, g);
+		__m256i is_t = _mm256_or_si256(_mm256_cmpeq_epi8(v, t), _mm256_cmpeq_epi8(v, u));
+
+		__m256i nt = _mm256_or_si256(_mm256_and_si256(is_c, one), _mm256_and_si256(is_g, two));
+		nt = _mm256_or_si256(nt, _mm256_and_si256(is_t, three));
+		_mm256_storeu_si256((__m256i *)(codes + i), nt);
+
+		uint32_t valid = (uint32_t)_mm256_movemask_epi8(
+			_mm256_or_si256(_mm256_or_si256(is_a, is_c), _mm256_or_si256(is_g, is_t)));
+		if(valid != 0xFFFFFFFFu)
+			return i + (size_t)__builtin_ctz(~valid);
+	}
+
+	return i + encode_sse41(sequence + i, length - i, codes + i);
+}
+#endif
+
+#ifdef KATSS_NEON_SIMD
+static size_t
+encode_neon(const unsigned char *sequence, size_t length, uint8_t *codes)
+{
+	const uint8x16_t lower = vdupq_n_u8(0x20);
+	const uint8x16_t one = vdupq_n_u8(1), two = vdupq_n_u8(2), three = vdupq_n_u8(3);
+
+	size_t i = 0;
+	for(; i + 16 <= length; i += 16) {
+		uint8x16_t v = vorrq_u8(vld1q_u8(sequence + i), lower);
+		uint8x16_t is_a = vceqq_u8(v, vdupq_n_u8('a'));
+		uint8x16_t is_c = vceqq_u8(v, vdupq_n_u8('c'));
+		uint8x16_t is_g = vceqq_u8(v, vdupq_n_u8('g'));
+		uint8x16_t is_t = vorrq_u8(vceqq_u8(v, vdupq_n_u8('t')), vceqq_u8(v, vdupq_n_u8('u')));
+
+		uint8x16_t nt = vorrq_u8(vandq_u8(is_c, one), vandq_u8(is_g, two));
+		nt = vorrq_u8(nt, vandq_u8(is_t, three));
+		vst1q_u8(codes + i, nt);
+
+		uint8x16_t valid = vorrq_u8(vorrq_u8(is_a, is_c), vorrq_u8(is_g, is_t));
+		if(vminvq_u8(valid) != 0xFF)
+			return i + encode_scalar(sequence + i, 16, codes + i);
+	}
+
+	return i + encode_scalar(sequence + i, length - i, codes + i);
+}
+#endif
+
+static void
+select_encoder(void)
+{
+#ifdef KATSS_X86_SIMD
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2"))
+		encode_run = encode_avx2;
+	else if(__builtin_cpu_supports("sse4.1"))
+		encode_run = encode_sse41;
+#elif defined(KATSS_NEON_SIMD)
+	encode_run = encode_neon; /* NEON is part of the aarch64 baseline */
+#endif
+}
@@ -11,10 +11,13 @@ static void handle_endno(KatssHasher *hasher);
 static inline int indxchr(const unsigned char *sequence, const char match);
 
 /* Forward strand rolling hash functions */
-static inline uint32_t fbh_r(KatssHasher *hasher);
-static inline uint32_t fbh_a(KatssHasher *hasher);
-static inline uint32_t fbh_q(KatssHasher *hasher);
-static inline uint32_t frh(uint32_t previous_hash, uint32_t nt_value, uint32_t mask);
+static inline uint64_t fbh_r(KatssHasher *hasher);
+static inline uint64_t fbh_a(KatssHasher *hasher);
+static inline uint64_t fbh_q(KatssHasher *hasher);
+static inline uint64_t frh(uint64_t previous_hash, uint64_t nt_value, uint64_t mask);
+
+/* Reverse strand rolling hash function */
+static inline uint64_t rrh(uint64_t previous_rc, uint64_t nt_value, unsigned int kmer);
 
 
 /*==========  Legend:  ==========*
@@ -56,14 +59,18 @@ KatssHasher *
 katss_init_hasher(unsigned int kmer, char filetype)
 {
 	KatssHasher *hasher = s_malloc(sizeof *hasher);
-	hasher->mask = ((1ULL << 2*kmer) - 1);
+	hasher->mask = kmer < 32 ? ((1ULL << 2*kmer) - 1) : UINT64_MAX;
 	hasher->end_of_seq = false;
 	hasher->kmer = kmer;
 	hasher->sequence = NULL;
+	hasher->seqend = NULL;
 	hasher->endno = 0;
 	hasher->has_previous = false;
 	hasher->previous_hash = 0;
+	hasher->previous_rc = 0;
+	hasher->canonical = false;
 	hasher->pos = 0;
+	hasher->joined = false;
 	(void)filetype; // silence compiler warnings.
 	return hasher;
 }
@@ -73,15 +80,29 @@ void
 katss_set_seq(KatssHasher *hasher, char *sequence, char filetype)
 {
 	hasher->sequence = (unsigned char *)sequence;
+	hasher->seqend = NULL;
 	hasher->end_of_seq = false;
 	handle_endno(hasher);
-	hasher->endno = 0;
 	(void)filetype; // silence compiler warnings. todo: fix this
 }
 
 
+void
+katss_set_canonical(KatssHasher *hasher, bool canonical)
+{
+	hasher->canonical = canonical;
+}
+
+
 void
 katss_unhash(char *key, uint32_t hash_value, unsigned int kmer, bool use_t) 
+{
+	katss_unhash64(key, hash_value, kmer, use_t);
+}
+
+
+void
+katss_unhash64(char *key, uint64_t hash_value, unsigned int kmer, bool use_t)
 {
 	key[kmer] = '\0'; // Null-terminate the string
 
@@ -107,21 +128,13 @@ katss_eos(KatssHasher *hasher)
 static void
 handle_endno(KatssHasher *hasher)
 {
-	if(hasher->endno == 1) {
-		while(*hasher->sequence && *hasher->sequence != '\n') {
-			++hasher->sequence;
-		}
-		++hasher->sequence;
-	} else if(hasher->endno == 2) {
-		bool first = true;
-		while(*hasher->sequence && (*hasher->sequence != '\n' || first)) {
-			if(*hasher->sequence == '\n') first = false;
-			++hasher->sequence;
-		}
-		++hasher->sequence;
+	/* Finish skipping the `endno` lines the previous sequence ended in. If the new sequence is
+	consumed before that, the remaining count carries over to the next one. */
+	while(hasher->endno > 0 && *hasher->sequence) {
+		if(*hasher->sequence++ == '\n')
+			hasher->endno--;
 	}
 	if(*hasher->sequence == '\0') {
-		hasher->endno = 1;
 		hasher->end_of_seq = true;
 	}
 }
@@ -139,6 +152,21 @@ katss_get_fh(KatssHasher *hasher, uint32_t *hash, char filetype)
 		return false;
 	}
 
+	uint64_t wide;
+	bool more = katss_get_fh64(hasher, &wide, filetype);
+	*hash = (uint32_t)wide;
+	return more;
+}
+
+
+bool
+katss_get_fh64(KatssHasher *hasher, uint64_t *hash, char filetype)
+{
+	/* If int pointer is NULL, can't modify it so return false */
+	if(hash == NULL) {
+		return false;
+	}
+
 	/* No previous hash to build off of, get new hash from observed */
 	if(!hasher->has_previous) {
 		switch(filetype) {
@@ -148,6 +176,8 @@ katss_get_fh(KatssHasher *hasher, uint32_t *hash, char filetype)
 		default: error_message("Filetype '%c' currently not supported.", filetype); break;
 		}
 		hasher->previous_hash = *hash;
+		if(hasher->canonical)
+			*hash = MIN2(*hash, hasher->previous_rc);
 		if(!hasher->end_of_seq)
 			hasher->has_previous = true;
 
@@ -158,9 +188,11 @@ katss_get_fh(KatssHasher *hasher, uint32_t *hash, char filetype)
 	if(filetype != 'r' && *hasher->sequence == '\n') ++hasher->sequence;
 
 	/* Begin actual hash computations */
-	uint32_t x = base[*hasher->sequence];
+	uint64_t x = base[*hasher->sequence];
 	if(x < 4) {
 		*hash = frh(hasher->previous_hash, x, hasher->mask);
+		if(hasher->canonical)
+			hasher->previous_rc = rrh(hasher->previous_rc, x, hasher->kmer);
 		++hasher->sequence;
 	} else if(x > 4) {
 		switch(filetype) {
@@ -169,35 +201,43 @@ katss_get_fh(KatssHasher *hasher, uint32_t *hash, char filetype)
 		case 'q': *hash = fbh_q(hasher); break;
 		default: error_message("Filetype '%c' currently not supported.", filetype); break;
 		}
-	} else { // x == 4
+	} else { // x == 4, keep previous hash to continue from in the next sequence
 		hasher->end_of_seq = true;
+		return false;
 	}
 
 	hasher->previous_hash = *hash;
+	if(hasher->canonical)
+		*hash = MIN2(*hash, hasher->previous_rc);
 	return !hasher->end_of_seq;
 }
 
 
 /* Forward-strand base hash of read file */
-static inline uint32_t
+static inline uint64_t
 fbh_r(KatssHasher *hasher)
 {
 	/* Variables for looping */
-	uint32_t hash = hasher->pos ? hasher->previous_hash : 0;
+	uint64_t hash = hasher->pos ? hasher->previous_hash : 0;
+	uint64_t rc = hasher->previous_rc; /* Rolled out entirely by the k-mer's bases */
 	unsigned int kmer = hasher->kmer;
 
 	/* Hash each nucleotide in sequence */
 	for(unsigned int i = hasher->pos; i < kmer; i++) {
-		switch (base[*hasher->sequence]) {
-		case 0: hash = hash * 4;     hasher->pos++; break; // A
-		case 1: hash = hash * 4 + 1; hasher->pos++; break; // C
-		case 2: hash = hash * 4 + 2; hasher->pos++; break; // G
-		case 3: hash = hash * 4 + 3; hasher->pos++; break; // T/U
+		uint64_t x = base[*hasher->sequence];
+		switch (x) {
+		case 0: case 1: case 2: case 3: // A, C, G, T/U
+			hash = hash * 4 + x;
+			rc = rrh(rc, x, kmer);
+			hasher->pos++;
+			break;
 		case 4: 
 			hasher->end_of_seq = true;
 			hasher->has_previous = false;
+			hasher->previous_rc = rc;
 			return hash; // \0
 		default: 
+			KATSS_STAT_ADD(invalid_resets, *hasher->sequence != '\n'); /* Reads end their line */
 			hasher->pos = 0;
 			hash = 0;
 			i = -1;
@@ -206,27 +246,32 @@ fbh_r(KatssHasher *hasher)
 		++hasher->sequence;
 	}
 	hasher->pos = 0;
+	hasher->previous_rc = rc;
 	return hash;
 }
 
 /* Forward-strand base hash of fasta file */
-static inline uint32_t
+static inline uint64_t
 fbh_a(KatssHasher *hasher)
 {
-	uint32_t hash = hasher->pos ? hasher->previous_hash : 0;
+	uint64_t hash = hasher->pos ? hasher->previous_hash : 0;
+	uint64_t rc = hasher->previous_rc;
 	int kmer = hasher->kmer;
 	int shift;
 
 	/* Hash each nucleotide in sequence */
 	for(int i = hasher->pos; i < kmer; i++) {
-		switch (base[*hasher->sequence]) {
-		case 0: hash = hash * 4;     hasher->pos++; break; // A
-		case 1: hash = hash * 4 + 1; hasher->pos++; break; // C
-		case 2: hash = hash * 4 + 2; hasher->pos++; break; // G
-		case 3: hash = hash * 4 + 3; hasher->pos++; break; // T/U
+		uint64_t x = base[*hasher->sequence];
+		switch (x) {
+		case 0: case 1: case 2: case 3: // A, C, G, T/U
+			hash = hash * 4 + x;
+			rc = rrh(rc, x, kmer);
+			hasher->pos++;
+			break;
 		case 4: 
 			hasher->end_of_seq = true;
 			hasher->has_previous = false;
+			hasher->previous_rc = rc;
 			return hash; // \0
 		case 5: // encountered '>' (seq info, we dont want that)
 			hasher->pos = 0;
@@ -235,6 +280,7 @@ fbh_a(KatssHasher *hasher)
 				hasher->end_of_seq = true; 
 				hasher->endno = 1; 
 				hasher->has_previous = false; 
+				hasher->previous_rc = rc;
 				return 0; 
 			}
 			hasher->sequence+=shift;
@@ -244,6 +290,7 @@ fbh_a(KatssHasher *hasher)
 			i--;
 			break; // newline, just skip!
 		default: 
+			KATSS_STAT_ADD(invalid_resets, 1);
 			hash = 0;
 			i = -1;
 			hasher->pos = 0;
@@ -252,29 +299,34 @@ fbh_a(KatssHasher *hasher)
 		++hasher->sequence;
 	}
 	hasher->pos = 0;
+	hasher->previous_rc = rc;
 	return hash;
 }
 
 
 /* Forward-strand base hash of a fastq file 
 TODO: FIX SKIPPING! CURRENTLY DOES NOT PROPERLY WORKS. */
-static inline uint32_t
+static inline uint64_t
 fbh_q(KatssHasher *hasher)
 {
-	uint32_t hash = hasher->pos ? hasher->previous_hash : 0;
+	uint64_t hash = hasher->pos ? hasher->previous_hash : 0;
+	uint64_t rc = hasher->previous_rc;
 	int kmer = hasher->kmer;
 	int shift;
 
 	/* Hash each nucleotide & handle non-sequence */
 	for(int i = hasher->pos; i < kmer; i++) {
-		switch (base[*hasher->sequence]) {
-		case 0: hash = hash * 4;     hasher->pos++; break; // A
-		case 1: hash = hash * 4 + 1; hasher->pos++; break; // C
-		case 2: hash = hash * 4 + 2; hasher->pos++; break; // G
-		case 3: hash = hash * 4 + 3; hasher->pos++; break; // T/U
+		uint64_t x = base[*hasher->sequence];
+		switch (x) {
+		case 0: case 1: case 2: case 3: // A, C, G, T/U
+			hash = hash * 4 + x;
+			rc = rrh(rc, x, kmer);
+			hasher->pos++;
+			break;
 		case 4:
 			hasher->end_of_seq = true;
 			hasher->has_previous = false;
+			hasher->previous_rc = rc;
 			return hash; // \0
 		case 6: // encountered '@' (seq info, we dont want that)
 			hasher->pos = 0;
@@ -283,6 +335,7 @@ fbh_q(KatssHasher *hasher)
 				hasher->end_of_seq = true; 
 				hasher->endno = 1; 
 				hasher->has_previous = false; 
+				hasher->previous_rc = rc;
 				return 0; 
 			}
 			hasher->sequence+=shift;
@@ -295,6 +348,7 @@ fbh_q(KatssHasher *hasher)
 				hasher->end_of_seq = true;
 				hasher->endno = 2;
 				hasher->has_previous = false;
+				hasher->previous_rc = rc;
 				return 0;
 			}
 			hasher->sequence+=shift+1;
@@ -303,6 +357,7 @@ fbh_q(KatssHasher *hasher)
 				hasher->end_of_seq = true;
 				hasher->endno = 1;
 				hasher->has_previous = false;
+				hasher->previous_rc = rc;
 				return 0;
 			}
 			hasher->sequence+=shift;
@@ -312,6 +367,7 @@ fbh_q(KatssHasher *hasher)
 			i--;
 			break; // newline, just skip!
 		default:
+			KATSS_STAT_ADD(invalid_resets, 1);
 			hash = 0;
 			i = -1;
 			hasher->pos = 0;
@@ -320,17 +376,25 @@ fbh_q(KatssHasher *hasher)
 		++hasher->sequence;
 	}
 	hasher->pos = 0;
+	hasher->previous_rc = rc;
 	return hash;
 }
 
 
 /* Forward-strand rolling hash */
-static inline uint32_t
-frh(uint32_t previous_hash, uint32_t nt_value, uint32_t mask)
+static inline uint64_t
+frh(uint64_t previous_hash, uint64_t nt_value, uint64_t mask)
 {
 	return ((previous_hash << 2) | nt_value) & mask;
 }
 
+/* Reverse strand rolling hash, the complement of every new base enters at the top */
+static inline uint64_t
+rrh(uint64_t previous_rc, uint64_t nt_value, unsigned int kmer)
+{
+	return (previous_rc >> 2) | ((3 - nt_value) << 2*(kmer - 1));
+}
+
 /*========== Helper functions ==========*/
 
 /**
@@ -4,6 +4,10 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "counter.h"
+#include "hash_functions.h"
+#include "seqfile.h"
+
 #if defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L) && !defined(__STDC_NO_THREADS__)
 #  include <threads.h>
 #else
@@ -12,6 +16,45 @@
 
 
 
+/* Number of locks guarding disjoint ranges of a counter's table */
+#define KATSS_COUNTER_STRIPES 64
+
+/* Largest k-mer for which every counting thread gets its own private table */
+#define KATSS_PRIVATE_KMER 10
+
+/* Smallest k-mer whose table may be kept sparse, see `katss_acquire_file_counter` */
+#define KATSS_SPARSE_KMER 13
+
+/* Largest k-mer counted with 32-bit hashes, longer ones need `katss_get_fh64` */
+#define KATSS_DENSE_KMER 16
+
+/* Largest in-memory k-mer index kept for a file, see `katss_count_kmers_index` */
+#ifndef KATSS_INDEX_MAX_BYTES
+#  define KATSS_INDEX_MAX_BYTES (UINT64_C(2) << 30)
+#endif
+
+/* Most memory the tables of bootstrap replicates counted at once may take */
+#ifndef KATSS_REPLICATES_MAX_BYTES
+#  define KATSS_REPLICATES_MAX_BYTES (UINT64_C(1) << 30)
+#endif
+
+/* Most memory the tables of released counters kept to be acquired again may take */
+#ifndef KATSS_IDLE_MAX_BYTES
+#  define KATSS_IDLE_MAX_BYTES (UINT64_C(1) << 28)
+#endif
+
+/* Bytes of the count-min sketch of a sketch counter unless told otherwise */
+#ifndef KATSS_SKETCH_BYTES
+#  define KATSS_SKETCH_BYTES (UINT64_C(32) << 20)
+#endif
+
+/* Most counted k-mers a sketch counter keeps track of, a quarter of the slots finding them */
+#define KATSS_SKETCH_TOP 4096
+
+/* Tails of length 1 to k-1 are stored one after the other, the ones of length `len` at this index */
+#define KATSS_TAIL_OFFSET(len) (((UINT64_C(1) << 2*(len)) - 4) / 3)
+
+
 /* Linked list used to store the removed k-mers */
 typedef struct katss_str_node {
 	char *str;
@@ -19,30 +62,48 @@ typedef struct katss_str_node {
 } katss_str_node_t;
 
 
+/* Counts of a table that went past 32 bits, defined in tables.c */
+typedef struct KatssSpill KatssSpill;
+
+/* Counts of only the k-mers seen, for long k-mers, defined in tables.c */
+typedef struct KatssSparse KatssSparse;
+
+/* Estimated counts of every k-mer, defined in sketch.c */
+typedef struct KatssSketch KatssSketch;
+
 /* Internal structure for KatssCounter */
 struct KatssCounter {
 	unsigned int kmer;              /** Length of k-mer being counter */
 	uint32_t capacity;              /** Number of k-mers in hash table (4^k) */
 	uint64_t total;        /** Total k-mers counted so far */
-	union {
-		uint64_t *small;  /** for k<=12 use long to store large amounts */
-		uint32_t *medium; /** K>12 use 32bit to save memory */
-	} table;                       /** Table to store counts */
+	uint32_t *table;               /** Low 32 bits of the count of every k-mer */
+	KatssSpill *spill;             /** High bits of the counts that wrapped, NULL until one did */
+	KatssSparse *sparse;           /** Counts of the k-mers seen instead of table, or NULL */
+	KatssSketch *sketch;           /** Estimated counts instead of table, or NULL */
+	bool mapped;                   /** The table was mapped on its own to get huge pages */
 	katss_str_node_t *removed;     /** Linked list of removed kmers */
-	mtx_t lock;
+	uint64_t *tails;               /** Counts of the last k-1 bases of every run, NULL if not kept */
+	bool partial_tails;            /** A blank line split a run the tails can't account for */
+	mtx_t lock;                    /** Guards total, the removed list, the spill, sparse and
+	                                   sketch */
+	mtx_t stripes[KATSS_COUNTER_STRIPES]; /** Guards contiguous ranges of table */
 };
 
 
 /* Internal structure for KatssHasher */
 struct KatssHasher {
 	unsigned char *sequence;      /** Sequence that is being processed */
+	unsigned char *seqend;        /** Null terminator of sequence, found on first block hash */
 	unsigned int kmer;            /** K-mer size to hash */
 	bool end_of_seq;              /** If hasher has finished hashing the sequence */
-	uint32_t mask;                /** 32-bit mask for specified k-mer length */
-	uint32_t previous_hash;       /** Previous calculated hash. Used for rolling hash */
+	uint64_t mask;                /** Mask of the 2k bits of a hash of the k-mer length */
+	uint64_t previous_hash;       /** Previous calculated hash. Used for rolling hash */
+	uint64_t previous_rc;         /** Reverse complement of `previous_hash`, rolled alongside it */
+	bool canonical;               /** Hash k-mers as the smaller hash of both strands */
 	bool has_previous;            /** Test if there is a previous hash */
 	int endno;                    /** The state KatssHasher ended on while processing */
 	int pos;                      /** The position to hash from. Used in case hashing was cut off early */
+	bool joined;                  /** A run was carried over a newline, only set by run hashing */
 };
 /*
 Notes:
@@ -52,4 +113,719 @@ Mainly for fastq/fasta files when buffering their file.
 1 means it ended hashing a non-sequence.
 */
 
+
+/*==================================
+|  Internal functions (tables.c)   |
+==================================*/
+
+/**
+ * @brief Increment the counts of `num_values` hashes without taking any lock. Only for counters
+ * owned by a single thread.
+ */
+void
+katss_increments_unlocked(KatssCounter *counter, const uint32_t *hash_values, size_t num_values);
+
+/**
+ * @brief Allocate one private counter per thread, so counting threads never contend on a shared
+ * table. Returns NULL when `kmer` is too large for per-thread tables to pay off, in which case
+ * threads should flush into the shared counter with `katss_increments`.
+ */
+KatssCounter **
+katss_init_private_counters(unsigned int kmer, int threads);
+
+/**
+ * @brief Add the private counters into `counter` using `threads` threads, each summing a
+ * contiguous range of the table, then free them. Does nothing if `locals` is NULL.
+ */
+void
+katss_merge_private_counters(KatssCounter *counter, KatssCounter **locals, int threads);
+
+/**
+ * @brief Start keeping the tails of the counter, clearing them if they were already kept. The
+ * tail of a run of bases is its last k-1 bases, or all of them if the run is shorter than k.
+ * They hold every shorter k-mer the table misses, see `katss_marginalize`.
+ */
+void
+katss_keep_tails(KatssCounter *counter);
+
+/**
+ * @brief Stop keeping the tails of the counter, once its table no longer matches them.
+ */
+void
+katss_drop_tails(KatssCounter *counter);
+
+/**
+ * @brief Zero the table and total of the counter, and drop its tails, keeping the k-mers it
+ * removes. The pages of the table stay mapped.
+ */
+void
+katss_clear_counts(KatssCounter *counter);
+
+/**
+ * @brief Count of the k-mer at `index` of the counter's table, with the bits that spilled.
+ */
+uint64_t
+katss_table_count(const KatssCounter *counter, uint64_t index);
+
+/**
+ * @brief Counter of k-mers up to 16 bases counting into `table`, of a cell for every k-mer, which
+ * it takes over. A `mapped` table was mapped on its own with `mmap`, and is unmapped once freed.
+ * Doesn't change the total.
+ */
+KatssCounter *
+katss_init_table_counter(unsigned int kmer, uint32_t *table, bool mapped);
+
+/**
+ * @brief Add `count` to the k-mer at `index` of the counter's table, spilling the bits past 32
+ * of dense tables. Doesn't change the total.
+ */
+void
+katss_add_count(KatssCounter *counter, uint64_t index, uint64_t count);
+
+/**
+ * @brief Bytes the counts of the counter take: its table (or sparse table), spill and tails.
+ */
+uint64_t
+katss_counter_bytes(const KatssCounter *counter);
+
+/**
+ * @brief New counter with the counts and total of `counter`, and its tails too if `tails`, or
+ * NULL if it is a sketch or had k-mers removed.
+ */
+KatssCounter *
+katss_copy_counter(const KatssCounter *counter, bool tails, int threads);
+
+/**
+ * @brief Same as `katss_export_counts` (or `katss_export_frequencies` if `frequencies` is set)
+ * for the `num` k-mers from hash `first` on, written from `dst` on. Works for counters of any
+ * k-mer length. Returns 0 on success, 1 if a hash is not in the counter, or 2 if frequencies
+ * aren't asked as a float or double.
+ */
+int
+katss_export_range(KatssCounter *counter, KATSS_TYPE numeric_type, void *dst, size_t stride,
+                   uint64_t first, uint64_t num, bool frequencies);
+
+/**
+ * @brief Store in `kmers` the hashes of every k-mer the counter counted at least once, or at
+ * least the `min_count` of `katss_limit_counter`, in increasing order, and return how many
+ * there are. `kmers` must be freed.
+ */
+uint64_t
+katss_list_kmers(const KatssCounter *counter, uint64_t **kmers);
+
+/**
+ * @brief Increment the counts of `num_values` 64-bit hashes, from `katss_get_fh64`. Safe to call
+ * from several threads sharing the counter.
+ */
+void
+katss_increments64(KatssCounter *counter, const uint64_t *hash_values, size_t num_values);
+
+/**
+ * @brief Same as `katss_acquire_counter`, but gives a sparse counter when counting `filename`
+ * into a dense table would leave most of it zero. The k-mers of a file are at most as many as its
+ * bytes (about four times them once decompressed), so long k-mers of small files get one.
+ */
+KatssCounter *
+katss_acquire_file_counter(unsigned int kmer, const char *filename);
+
+/**
+ * @brief Free the counters `katss_release_counter` kept to be acquired again.
+ */
+void
+katss_free_idle_counters(void);
+
+/**
+ * @brief Add to `marginal` the counts of its k-mers within the k-mers of `counter`, using
+ * `threads` threads. If `counter` kept complete tails, this is exactly what counting k-mers of
+ * the marginal's length in the same sequences would have added.
+ */
+void
+katss_marginalize(KatssCounter *marginal, KatssCounter *counter, int threads);
+
+
+/*==================================
+|  Internal functions (counter.c)  |
+==================================*/
+
+/**
+ * @brief Open `filename` with `mode` (see `seqfopen`), or the files grouped under it (see
+ * `katss_group_files`), detecting its type from the bytes read first, so the file is only opened
+ * once. Sets `filetype` to 'a' for fasta, 'q' for fastq, or 'r'
+ * for a file of reads. Returns NULL with `filetype` set to 'N' if the file could not be opened, or
+ * to 'e' if its type is not supported.
+ */
+SeqFile
+katss_open_file(const char *filename, const char *mode, char *filetype);
+
+/**
+ * @brief Type of a file opened with `katss_open_file`, see `filetype` there. Unsupported types
+ * give 'e', along with an error message.
+ */
+char
+katss_file_type(SeqFile file);
+
+/**
+ * @brief Rewind `file` to be read again, or open `filename` with `katss_open_file` if it is NULL.
+ * `mode` is only used to open the file. Returns NULL with `filetype` set to 'N' if the file could
+ * not be opened or rewound, as with pipes, or to 'e' if its type is not supported.
+ */
+SeqFile
+katss_rewind_file(const char *filename, SeqFile file, const char *mode, char *filetype);
+
+/**
+ * @brief Count the k-mers of all `counters` in a single pass over `filename`, after crossing out
+ * every sequence in `removed` (can be NULL). Counts are added to what the counters already hold.
+ * If `seqfile` isn't NULL, it is rewound and read instead of `filename`, see
+ * `katss_rewind_file`. Returns 0 on success, 1 if the filetype is not supported, 2 if the file
+ * could not be opened, 3 if any counter is NULL, or 4 if reading the file failed.
+ */
+int
+katss_count_multi(const char *filename, SeqFile seqfile, KatssCounter **counters,
+                  int num_counters, const katss_str_node_t *removed, int threads);
+
+/**
+ * @brief Count every k-mer of `filename` under the smaller of its hash and the hash of its
+ * reverse complement, so a k-mer and its reverse complement are counted as one. Counts are added
+ * to what `counter` already holds, and `seqfile` is read instead of `filename` as in
+ * `katss_count_multi`, which this returns the same values as.
+ */
+int
+katss_count_canonical(const char *filename, SeqFile seqfile, KatssCounter *counter, int threads);
+
+/**
+ * @brief Shuffle every read of `filename` preserving its k-lets of length `klet`, cross out every
+ * sequence in `removed` (can be NULL) from the shuffled read and add its k-mers to `counter`.
+ * Only reads drawn with probability `sample` in 100000 are counted. Draws for a read are keyed
+ * by `seed` and its index, so the counts are the same for any number of threads. Returns 0 on
+ * success, 1 if the filetype is not supported, 2 if the file could not be opened, 3 if the
+ * hasher could not be created, or 4 if reading the file failed.
+ */
+int
+katss_count_shuffled(KatssCounter *counter, const char *filename, int klet,
+                     const katss_str_node_t *removed, int sample, unsigned int seed, int threads);
+
+
+/*====================================
+|  Internal functions (recounter.c)  |
+====================================*/
+
+/**
+ * @brief Replace every occurrence of `s2` in `s1` with 'X's, so no k-mer overlapping it is
+ * counted.
+ */
+void
+katss_cross_out(char *s1, const char *s2, char filetype);
+
+/* Where the k-mers counted from a file occur, see `katss_count_kmers_index` */
+typedef struct KatssKmerIndex KatssKmerIndex;
+
+/**
+ * @brief Count the k-mers in `filename`, same as `katss_count_kmers_mt`, and index where every
+ * counted k-mer occurs so `katss_recount_kmer_index` doesn't have to read the file again. The
+ * index keeps every base of the file in 2 bits. It is set to NULL if the file can't be indexed:
+ * k-mers longer than 12, more than KATSS_INDEX_MAX_BYTES of index, or fasta/fastq sequences
+ * spanning several lines or containing blank lines. `threads` are only used for k-mers longer
+ * than 12, which are counted without an index.
+ * 
+ * @return KatssCounter* The counts, or NULL on error
+ */
+KatssCounter *
+katss_count_kmers_index(const char *filename, unsigned int kmer, int threads,
+                        KatssKmerIndex **index);
+
+/**
+ * @brief Same as `katss_recount_kmer_mt`, but only uncounts the k-mers overlapping occurrences
+ * of `remove` found through the index, so the cost is proportional to the number of them. If
+ * `remove` isn't a k-mer of the index's length, `filename` is recounted instead and the index is
+ * freed and set to NULL, as it is when `*index` is already NULL.
+ */
+int
+katss_recount_kmer_index(KatssCounter *counter, KatssKmerIndex **index, const char *filename,
+                         const char *remove, int threads);
+
+/**
+ * @brief Same as calling `katss_recount_kmer_index` on every counter, index and file, but the
+ * files that have to be read are all read at the same time, splitting `threads` among them in
+ * proportion to their size. Returns the first non-zero return of a file, or 3 if an array is
+ * NULL.
+ */
+int
+katss_recount_kmer_indexes(KatssCounter **counters, KatssKmerIndex **indexes,
+                           const char **filenames, int num_files, const char *remove, int threads);
+
+/**
+ * @brief Free the k-mer index, does nothing if NULL.
+ */
+void
+katss_free_kmer_index(KatssKmerIndex *index);
+
+
+/*==================================
+|  Internal functions (sketch.c)   |
+==================================*/
+
+/**
+ * @brief Initialize a sketch of at most `max_bytes` bytes (KATSS_SKETCH_BYTES if 0), and at
+ * least 16 KiB.
+ */
+KatssSketch *
+katss_init_sketch(uint64_t max_bytes);
+
+/**
+ * @brief Free the sketch, does nothing if NULL.
+ */
+void
+katss_free_sketch(KatssSketch *sketch);
+
+/**
+ * @brief Zero every estimate of the sketch, and forget its most counted k-mers.
+ */
+void
+katss_clear_sketch(KatssSketch *sketch);
+
+/**
+ * @brief Count the k-mer `hash` `count` more times.
+ */
+void
+katss_sketch_add(KatssSketch *sketch, uint64_t hash, uint64_t count);
+
+/**
+ * @brief Count the k-mer `hash` one time less, if none of its cells is zero.
+ */
+void
+katss_sketch_sub(KatssSketch *sketch, uint64_t hash);
+
+/**
+ * @brief Estimated count of the k-mer `hash`, never below how many times it was counted.
+ */
+uint64_t
+katss_sketch_get(const KatssSketch *sketch, uint64_t hash);
+
+/**
+ * @brief Store in `kmers` the hashes of the k-mers estimated to be the most counted, at most
+ * KATSS_SKETCH_TOP of them, in increasing order, and return how many there are. `kmers` must be
+ * freed.
+ */
+uint64_t
+katss_sketch_top(const KatssSketch *sketch, uint64_t **kmers);
+
+
+/*==================================
+|  Internal functions (masker.c)   |
+==================================*/
+
+/* Crosses out every removed sequence at once, see `katss_init_masker` */
+typedef struct KatssMasker KatssMasker;
+
+/**
+ * @brief Initialize a masker crossing out every sequence in `removed`, in order, from sequences
+ * of a file of type `filetype`. Sequences made only of bases are all found in a single pass, no
+ * matter how many were removed. The list must outlive the masker, which is owned by a single
+ * thread.
+ */
+KatssMasker *
+katss_init_masker(const katss_str_node_t *removed, char filetype);
+
+/**
+ * @brief Same as calling `katss_cross_out` on `sequence` for every removed sequence, in order.
+ */
+void
+katss_mask(KatssMasker *masker, char *sequence);
+
+/**
+ * @brief Free the masker, does nothing if NULL.
+ */
+void
+katss_free_masker(KatssMasker *masker);
+
+
+/*=====================================
+|  Internal functions (filegroup.c)   |
+=====================================*/
+
+/**
+ * @brief Open the files grouped under `name` with `katss_group_files` as one SeqFile (see
+ * `seqfopenlist`) with `mode`. Sets `grouped` to whether `name` is a group, the file having to be
+ * opened as usual if it isn't. Returns NULL if it isn't, or if the files could not be opened.
+ */
+SeqFile
+katss_open_group(const char *name, const char *mode, bool *grouped);
+
+/**
+ * @brief Copy of the paths grouped under `name`, setting `num_paths` to their number, or NULL if
+ * `name` isn't a group. Every path is freed, and then the array.
+ */
+char **
+katss_group_members(const char *name, int *num_paths);
+
+
+/*======================================
+|  Internal functions (namedcounter.c)  |
+======================================*/
+
+/**
+ * @brief Copy of the counts of the counter named `name` with `katss_name_counter`, without its
+ * tails. Sets `is_named` to whether `name` is a named counter, NULL being returned if it isn't or
+ * if the counts could not be copied.
+ */
+KatssCounter *
+katss_named_counts(const char *name, int threads, bool *is_named);
+
+/**
+ * @brief Whether `name` is a counter named with `katss_name_counter`.
+ */
+bool
+katss_is_named(const char *name);
+
+
+/*====================================
+|  Internal functions (countcache.c) |
+====================================*/
+
+/* What a file was when it was counted, see `katss_cached_counts` */
+typedef struct KatssCacheKey KatssCacheKey;
+
+/**
+ * @brief Copy of the cached counts of `filename`, summed from a longer k-mer if only it was
+ * cached, or NULL if they weren't. On a miss `key` is set if the counts are to be cached, which
+ * `katss_cache_counts` does once they were counted, else to NULL.
+ */
+KatssCounter *
+katss_cached_counts(const char *filename, unsigned int kmer, int threads, KatssCacheKey **key);
+
+/**
+ * @brief Cache the counts of the file of `key` (NULL if counting failed), unless it changed while
+ * it was counted. Takes the key, does nothing if it is NULL. `counter` is only read.
+ */
+void
+katss_cache_counts(KatssCacheKey *key, const KatssCounter *counter, int threads);
+
+
+/*====================================
+|  Internal functions (seqstore.c)   |
+====================================*/
+
+/* Reads the sequences of a file loaded with `katss_preload_file` */
+typedef struct KatssStoreReader KatssStoreReader;
+
+/**
+ * @brief Start reading the sequences of `filename` from memory. Returns NULL if the file isn't
+ * loaded, in which case it has to be streamed.
+ */
+KatssStoreReader *
+katss_open_store(const char *filename);
+
+/**
+ * @brief Same as `seqfread` in a reads file: fill `buffer` with whole reads, one per line, and
+ * return the number of characters written. Characters that weren't bases are written as 'N'.
+ * Safe to call from several threads sharing the reader. Returns 0 once every read was read.
+ */
+size_t
+katss_store_read(KatssStoreReader *reader, char *buffer, size_t size);
+
+/**
+ * @brief Same as `seqfgets` in a reads file: write the next read to `buffer` without its newline.
+ * Returns NULL once every read was read.
+ */
+char *
+katss_store_gets(KatssStoreReader *reader, char *buffer, size_t size);
+
+/**
+ * @brief Same as `seqfreadbatch` in a reads file: write the next reads to `buffer` as
+ * `katss_store_gets` would with `read_size` characters each, one after the other with their own
+ * null terminator, and set `ends` to the offset of each terminator. Locks the reader once.
+ * Returns the number of reads written, 0 once every read was read.
+ */
+size_t
+katss_store_readbatch(KatssStoreReader *reader, char *buffer, size_t size, size_t read_size,
+                      size_t *ends, size_t max_reads);
+
+/**
+ * @brief Stop reading, does nothing if NULL.
+ */
+void
+katss_close_store(KatssStoreReader *reader);
+
+/**
+ * @brief Whether the sequences of `filename` are loaded, setting `num_bases` to their number of
+ * bases, e.g. sequences of `katss_preload_sequences` which have no file.
+ */
+bool
+katss_stored_bases(const char *filename, uint64_t *num_bases);
+
+
+/*====================================
+|  Internal functions (readindex.c)  |
+====================================*/
+
+/* Reads the sequences of a file indexed with `katss_index_file` by their number */
+typedef struct KatssIndexReader KatssIndexReader;
+
+/**
+ * @brief Start reading the sequences of `filename` through its index. Returns NULL if the file
+ * isn't indexed, in which case it has to be streamed.
+ */
+KatssIndexReader *
+katss_open_index(const char *filename);
+
+/**
+ * @brief Number of reads in the indexed file.
+ */
+uint64_t
+katss_index_reads(const KatssIndexReader *reader);
+
+/**
+ * @brief Same as the `read`-th call to `seqfgets` on the file: write the sequence of that read to
+ * `buffer` without its newline. Safe to call from several threads sharing the reader. Returns
+ * NULL if there is no such read or it could not be read.
+ */
+char *
+katss_index_gets(KatssIndexReader *reader, uint64_t read, char *buffer, size_t size);
+
+/**
+ * @brief Stop reading, does nothing if NULL.
+ */
+void
+katss_close_index(KatssIndexReader *reader);
+
+
+/*=================================
+|  Internal functions (random.c)  |
+=================================*/
+
+/* xoshiro256** generator, see `katss_seed_rng` */
+struct KatssRng {
+	uint64_t s[4];
+};
+typedef struct KatssRng KatssRng;
+
+/**
+ * @brief Seed the generator for `stream`, which gives the same draws for the same seed and stream
+ * on any thread. Sampling uses the index of the read in its file as the stream.
+ */
+void
+katss_seed_rng(KatssRng *rng, uint64_t seed, uint64_t stream);
+
+/**
+ * @brief Next 64 random bits of the generator.
+ */
+uint64_t
+katss_rng_next(KatssRng *rng);
+
+/**
+ * @brief Random number in [0, bound).
+ */
+uint32_t
+katss_rng_below(KatssRng *rng, uint32_t bound);
+
+/**
+ * @brief Random number in [0, 1).
+ */
+double
+katss_rng_uniform(KatssRng *rng);
+
+/**
+ * @brief Random number in [0, 2^31) from the generator `rng` points to, for `set_randfunc`.
+ */
+unsigned long
+katss_rng_randfunc(void *rng);
+
+/**
+ * @brief Number of successes of `n` trials of probability `p`.
+ */
+uint64_t
+katss_rng_binomial(KatssRng *rng, uint64_t n, double p);
+
+/**
+ * @brief Poisson draw of mean `mean`.
+ */
+uint64_t
+katss_rng_poisson(KatssRng *rng, double mean);
+
+
+/*================================
+|  Internal functions (stats.c)  |
+================================*/
+
+/* Hot-path counters of the run collecting statistics, compiled in with KATSS_WITH_STATS */
+#ifndef KATSS_STATS
+#  define KATSS_STATS 0
+#endif
+
+#if KATSS_STATS
+#  include <stdatomic.h>
+
+struct KatssCounters {
+	atomic_bool on;                         /** If a run is collecting statistics */
+	atomic_uint_fast64_t kmers_hashed;      /** K-mers hashed, by blocks */
+	atomic_uint_fast64_t invalid_resets;    /** K-mers cut short by a base other than ACGTU */
+	atomic_uint_fast64_t increment_wait_ns; /** Nanoseconds waited on the locks of the tables */
+};
+extern struct KatssCounters katss_counters;
+
+/**
+ * @brief Lock `mutex`, timing how long it waited for it when it was held by another thread.
+ */
+void
+katss_lock(mtx_t *mutex);
+
+#  define KATSS_STATS_ON() atomic_load_explicit(&katss_counters.on, memory_order_relaxed)
+#  define KATSS_STAT_ADD(field, n) \
+	do { if(KATSS_STATS_ON()) \
+		atomic_fetch_add_explicit(&katss_counters.field, (n), memory_order_relaxed); } while(0)
+#  define KATSS_LOCK(mutex) katss_lock(mutex)
+#else
+#  define KATSS_STATS_ON() false
+#  define KATSS_STAT_ADD(field, n) ((void)(n))
+#  define KATSS_LOCK(mutex) mtx_lock(mutex)
+#endif
+
+/**
+ * @brief Start timing the next iteration of the run collecting statistics, leaving out the time
+ * since the last one, e.g. the counts the iterations start from.
+ */
+void
+katss_stats_lap(void);
+
+/**
+ * @brief Add `num` iterations of the run collecting statistics, done together since the last
+ * lap, each taking an equal share of the time.
+ */
+void
+katss_stats_iterations(int num);
+
+
+/*=====================================
+|  Internal functions (threadpool.c)  |
+=====================================*/
+
+#define KATSS_SCRATCH_BUFFER 65536U  /* Characters of a scratch read buffer */
+#define KATSS_SCRATCH_HASHES 250000U /* Hash values of a scratch hash buffer */
+
+/* Buffers a thread keeps from one task to the next, see `katss_scratch` */
+struct KatssScratch {
+	char *buffer;      /** KATSS_SCRATCH_BUFFER characters to read sequences into */
+	uint32_t *hashes;  /** KATSS_SCRATCH_HASHES hash values to count */
+	uint32_t *sorted;  /** KATSS_SCRATCH_HASHES hash values, only used by `katss_increments` */
+};
+typedef struct KatssScratch KatssScratch;
+
+/* Tasks submitted to the pool that are waited on together */
+typedef struct KatssTaskGroup KatssTaskGroup;
+
+/**
+ * @brief Scratch buffers of the calling thread, allocated on its first call and kept until it
+ * exits. Tasks use them instead of allocating their own, so the pool's workers reuse them across
+ * calls. A task holding them may not wait on a group.
+ */
+KatssScratch *
+katss_scratch(void);
+
+/**
+ * @brief Initialize an empty group of tasks, starting the pool if this is the first one.
+ */
+KatssTaskGroup *
+katss_init_task_group(void);
+
+/**
+ * @brief Run `func(arg)` on the pool as part of `group`. Every task submitted runs at the same
+ * time as the others, the pool starting a worker whenever all of them are busy, the same as if
+ * each task had a thread of its own.
+ */
+void
+katss_submit_task(KatssTaskGroup *group, int (*func)(void *), void *arg);
+
+/**
+ * @brief Wait for every task of the group to return, running queued tasks meanwhile, then free
+ * the group.
+ * 
+ * @return int The first non-zero return of a task, or 0
+ */
+int
+katss_wait_task_group(KatssTaskGroup *group);
+
+
+/*====================================
+|  Internal functions (hash_block.c)  |
+====================================*/
+
+/**
+ * @brief Replace the sequence of the hasher with the `length` bytes at `sequence`, which need
+ * not be null terminated, e.g. a span from `seqfview`. Only the block kernels hash it, which
+ * never write to it.
+ */
+void
+katss_set_span(KatssHasher *hasher, const char *sequence, size_t length);
+
+/**
+ * @brief Hash every base of the sequence over the hasher's k-mer, storing in `runs` the number
+ * of consecutive bases the hash covers (saturating at 255). A run of 0 marks a blank line carried
+ * over in fasta/fastq files, which only resets the k-mers the run was already long enough for.
+ * Sets `joined` in the hasher whenever a run is carried over a newline.
+ */
+size_t
+katss_hash_block_runs(KatssHasher *hasher, uint32_t *hashes, uint8_t *runs, size_t max,
+                      char filetype);
+
+/**
+ * @brief Store in `selected` the hashes from `katss_hash_block_runs` that complete a k-mer of
+ * length `kmer`, masked down to it. `run` is the length of the run seen so far for this k-mer,
+ * 0 before the first block.
+ */
+size_t
+katss_select_run_hashes(uint32_t *selected, const uint32_t *hashes, const uint8_t *runs,
+                        size_t num_hashes, unsigned int kmer, unsigned int *run);
+
+/* Hashes a sequence once to count k-mers of several lengths, see `katss_init_multi_hasher` */
+typedef struct KatssMultiHasher {
+	KatssHasher *hasher;          /** Hasher over the largest k-mer of all counters */
+	char filetype;                /** Type of file the sequences come from */
+	int num_counters;             /** Number of counters k-mers are added to */
+	KatssCounter **counters;      /** Counters to add the k-mers of their length to */
+	bool *locked;                 /** If a counter is shared between threads */
+	unsigned int *run;            /** Length of the current run seen by each counter */
+	uint32_t last_hash;           /** Hash of the last base, which ends the current run */
+	uint32_t *hash_values;        /** Hash of every base over the largest k-mer */
+	uint8_t *runs;                /** Run length of every hash */
+	uint32_t *selected;           /** Hashes that complete a k-mer of a given counter */
+} KatssMultiHasher;
+
+/**
+ * @brief Initialize a hasher counting the k-mers of every counter in `counters` from a single
+ * pass over each sequence. A hash is computed for every base over the largest k-mer, and every
+ * shorter k-mer is in its low bits. Counters marked in `locked` (NULL for none) are shared with
+ * other threads and incremented with `katss_increments`. Returns NULL if any counter is NULL.
+ */
+KatssMultiHasher *
+katss_init_multi_hasher(KatssCounter **counters, const bool *locked, int num_counters,
+                        char filetype);
+
+/**
+ * @brief Add all k-mers in `sequence` to the counters of the multi-hasher. Same as calling
+ * `katss_set_seq` and `katss_hash_block` with one hasher per counter. Counters keeping their
+ * tails also get the tail of every run that ends, see `katss_multi_hash_end`.
+ */
+void
+katss_multi_hash_seq(KatssMultiHasher *multi, char *sequence);
+
+/**
+ * @brief Add all k-mers in a single `read` to the counters of the multi-hasher, without any
+ * k-mer spanning from the previous read.
+ */
+void
+katss_multi_hash_read(KatssMultiHasher *multi, char *read);
+
+/**
+ * @brief End the run the last sequence left open, adding its tail to the counters keeping them.
+ * Call once all sequences were hashed.
+ */
+void
+katss_multi_hash_end(KatssMultiHasher *multi);
+
+/**
+ * @brief Free the multi-hasher, leaving its counters untouched.
+ */
+void
+katss_free_multi_hasher(KatssMultiHasher *multi);
+
 #endif // KATSS_CORE_H
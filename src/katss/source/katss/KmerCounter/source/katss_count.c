@@ -1,77 +1,164 @@
 #include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
 
 #include "katss.h"
+#include "katss_core.h"
 #include "katss_helpers.h"
 #include "memory_utils.h"
 
 #include "counter.h"
+#include "seqfile.h"
 #include "ushuffle.h"
 
-static int
-compare1(const void *a, const void *b)
+#define COUNTS_BLOCK 4096 /* Counts exported at once, see `add_iteration` and `counter_rows` */
+
+static void
+running_stdev(float value, float *mean, float *stdev, int run)
 {
-	const KatssDataEntry *p1 = (KatssDataEntry *)a;
-	const KatssDataEntry *p2 = (KatssDataEntry *)b;
+	float tmp_mean = *mean;
+	*mean  += (value - tmp_mean) / run;
+	*stdev += (value - tmp_mean) * (value - *mean);
+}
 
-	if(p1->count < p2->count) {
-		return 1;
-	} else if(p1->count > p2->count) {
-		return -1;
-	} else {
-		return 0;
+/**
+ * @brief Add the counts of `counter` to the running means and deviations of `counts` as iteration
+ * `run`, exporting a block of counts at a time. Returns 0 on success, 1 if the counter doesn't
+ * hold the k-mers of `counts`.
+ */
+static int
+add_iteration(KatssData *counts, KatssCounter *counter, int run)
+{
+	float block[COUNTS_BLOCK];
+	for(uint64_t n=0; n<counts->num_kmers; n+=COUNTS_BLOCK) {
+		uint64_t num = MIN2(counts->num_kmers - n, COUNTS_BLOCK);
+		if(katss_export_range(counter, KATSS_FLOAT, block, sizeof *block, n, num, false) != 0)
+			return 1;
+		for(uint64_t j=0; j<num; j++)
+			running_stdev(block[j], &counts->kmers[n + j].rval, &counts->kmers[n + j].stdev, run);
 	}
+	return 0;
 }
 
+/* Shuffled bootstrap iteration counted by a task, next to the other iterations of its batch */
+struct iteration_job {
+	const char *path;      /** File sampled by the iteration */
+	KatssOptions *opts;    /** Options of the bootstrap */
+	unsigned int seed;     /** Seed of the iteration's draws */
+	int threads;           /** Threads counting the iteration */
+	KatssCounter *counter; /** Counts of the iteration */
+};
+
 static int
-compare2(const void *a, const void *b)
+ushuffle_iteration(void *arg)
 {
-	const KatssDataEntry *p1 = (KatssDataEntry *)a;
-	const KatssDataEntry *p2 = (KatssDataEntry *)b;
-
-	if(isnan(p1->rval) && isnan(p2->rval)) {
-		return 0;
-	} else if(isnan(p1->rval)) {
-		return 1;
-	} else if(isnan(p2->rval)) {
-		return -1;
-	}
+	struct iteration_job *job = arg;
+	KatssOptions *opts = job->opts;
+	unsigned int seed = job->seed;
+	job->counter = katss_count_kmers_ushuffle_bootstrap_mt(job->path, opts->kmer,
+	                                                       opts->probs_ntprec,
+	                                                       opts->bootstrap_sample, &seed,
+	                                                       job->threads);
+	return job->counter == NULL;
+}
 
-	if(p1->rval < p2->rval) {
-		return 1;
-	} else if(p1->rval > p2->rval) {
-		return -1;
-	} else {
-		return 0;
+/**
+ * @brief Rows of the counts of `ctr` the options keep, exported a block at a time.
+ */
+static KatssData *
+counter_rows(KatssCounter *ctr, const KatssOptions *opts)
+{
+	uint64_t num_kmers = (uint64_t)ctr->capacity + 1;
+	KatssRows *rows = katss_init_rows(num_kmers, true, opts);
+	uint32_t counts[COUNTS_BLOCK];
+	for(uint64_t i=0; i<num_kmers; i++) {
+		if(i % COUNTS_BLOCK == 0)
+			katss_export_range(ctr, KATSS_UINT32, counts, sizeof *counts, i,
+			                   MIN2(num_kmers - i, COUNTS_BLOCK), false);
+		KatssDataEntry entry = {.kmer = i, .count = counts[i % COUNTS_BLOCK]};
+		katss_add_row(rows, &entry, entry.count);
 	}
+	return katss_finish_rows(rows);
 }
 
-static void
-running_stdev(float value, float *mean, float *stdev, int run)
+/**
+ * @brief Rows of the k-mers of `ctr` that were seen, or the most counted of a sketch.
+ */
+static KatssData *
+listed_rows(KatssCounter *ctr, const KatssOptions *opts)
 {
-	float tmp_mean = *mean;
-	*mean  += (value - tmp_mean) / run;
-	*stdev += (value - tmp_mean) * (value - *mean);
+	uint64_t *keys;
+	uint64_t num_keys = katss_list_kmers(ctr, &keys);
+	KatssRows *rows = katss_init_rows(num_keys, true, opts);
+	for(uint64_t i=0; i<num_keys; i++) {
+		KatssDataEntry entry = {.kmer = keys[i]};
+		katss_get_from_hash64(ctr, KATSS_UINT32, &entry.count, keys[i]);
+		katss_add_row(rows, &entry, entry.count);
+	}
+	free(keys);
+	return katss_finish_rows(rows);
 }
 
 static KatssData *
-regular(const char *path, KatssOptions *opts)
+listed_regular(const char *path, SeqFile file, KatssOptions *opts)
 {
 	/* Compute counts */
-	KatssCounter *ctr = katss_count_kmers_mt(path, opts->kmer, opts->threads);
+	KatssCounter *ctr = katss_count_listed_kmers(path, file, opts);
+	if(ctr == NULL)
+		return NULL;
+
+	/* Only the k-mers that were seen, or the most counted of a sketch, have an entry */
+	KatssData *counts = listed_rows(ctr, opts);
+
+	/* Free data */
+	katss_free_counter(ctr);
+
+	return counts;
+}
+
+static KatssData *
+regular(const char *path, SeqFile file, KatssOptions *opts)
+{
+	/* Counter files are their counts already */
+	bool failed = false;
+	KatssCounter *saved = file == NULL ? katss_saved_counts(path, opts, &failed) : NULL;
+	if(saved != NULL) {
+		KatssData *counts = saved->sparse ? listed_rows(saved, opts) : counter_rows(saved, opts);
+		katss_free_counter(saved);
+		return counts;
+	}
+	if(failed)
+		return NULL;
+
+	if(katss_listed_kmers(opts))
+		return listed_regular(path, file, opts);
+
+	/* Compute counts, from the file already open if there is one */
+	KatssCounter *ctr;
+	if(opts->canonical) {
+		ctr = katss_acquire_file_counter(opts->kmer, path);
+		if(ctr != NULL && katss_count_canonical(path, file, ctr, opts->threads) != 0) {
+			katss_release_counter(ctr);
+			ctr = NULL;
+		}
+	} else if(file != NULL) {
+		ctr = katss_acquire_counter(opts->kmer);
+		if(ctr != NULL && katss_count_kmers_multi_seqfile(&ctr, 1, file, opts->threads) != 0) {
+			katss_release_counter(ctr);
+			ctr = NULL;
+		}
+	} else {
+		ctr = katss_count_kmers_mt(path, opts->kmer, opts->threads);
+	}
 	if(ctr == NULL)
 		return NULL;
 	
 	/* Move counts to KatssData */
-	KatssData *counts = katss_init_kdata(opts->kmer);
-	for(uint64_t i=0; i<counts->num_kmers; i++) {
-		counts->kmers[i].kmer = (uint32_t)i;
-		katss_get_from_hash(ctr, KATSS_UINT32, &counts->kmers[i].count, (uint32_t)i);
-	}
+	KatssData *counts = counter_rows(ctr, opts);
 
 	/* Free data */
-	katss_free_counter(ctr);
+	katss_release_counter(ctr);
 
 	return counts;
 }
@@ -80,16 +167,13 @@ static KatssData *
 ushuffle(const char *path, KatssOptions *opts)
 {
 	/* Compute shuffled counts */
-	KatssCounter *ctr = katss_count_kmers_ushuffle(path, opts->kmer, opts->probs_ntprec);
+	KatssCounter *ctr = katss_count_kmers_ushuffle_mt(path, opts->kmer, opts->probs_ntprec,
+	                                                  opts->threads);
 	if(ctr == NULL)
 		return NULL;
 	
 	/* Move counts to KatssData */
-	KatssData *counts = katss_init_kdata(opts->kmer);
-	for(uint64_t i=0; i<counts->num_kmers; i++) {
-		counts->kmers[i].kmer = (uint32_t)i;
-		katss_get_from_hash(ctr, KATSS_UINT32, &counts->kmers[i].count, (uint32_t)i);
-	}
+	KatssData *counts = counter_rows(ctr, opts);
 
 	/* Free data */
 	free(ctr);
@@ -103,34 +187,42 @@ bootstrap_regular(const char *path, KatssOptions *opts)
 	KatssData *counts = katss_init_kdata(opts->kmer);
 	if(counts == NULL)
 		return NULL;
-	KatssCounter *ctr = NULL;
+	for(uint64_t n=0; n<counts->num_kmers; n++)
+		counts->kmers[n].kmer = (uint32_t)n;
 	unsigned int seed = opts->seed;
 	unsigned int kmer = opts->kmer;
-	int sample        = opts->bootstrap_sample;
+	int sample        = opts->bootstrap_poisson ? 0 : opts->bootstrap_sample;
 	int threads       = opts->threads;
 
-	/* Process n number of iterations */
-	for(int i=1; i<=opts->bootstrap_iters; i++) {
+	/* Every pass over the file counts as many iterations as fit in memory */
+	int batch = katss_replicate_batch(kmer, 1, opts->bootstrap_iters, opts->memory_budget);
+	KatssCounter **ctrs = s_calloc(batch, sizeof *ctrs);
+	katss_stats_lap();
+	for(int i=1; i<=opts->bootstrap_iters; i+=batch) {
 		/* Compute counts */
-		ctr = katss_count_kmers_bootstrap_mt(path, kmer, sample, &seed, threads);
-		if(ctr == NULL) {
+		int num = MIN2(batch, opts->bootstrap_iters - i + 1);
+		for(int r=0; r<num; r++)
+			ctrs[r] = katss_acquire_file_counter(kmer, path);
+		if(katss_count_kmers_replicates_mt(path, ctrs, num, sample, &seed, threads) != 0) {
 			error_message("katss_count: Failed to get counts on iteration=(%d)", i);
-			katss_free_kdata(counts);
-			return NULL;
+			goto error;
 		}
 
 		/* Move counts to KatssData */
-		float count;
-		for(uint64_t n=0; n<counts->num_kmers; n++) {
-			counts->kmers[n].kmer = (uint32_t)n;
-			if(katss_get_from_hash(ctr, KATSS_FLOAT, &count, (uint32_t)n) != 0)
+		for(int r=0; r<num; r++) {
+			if(add_iteration(counts, ctrs[r], i + r) != 0)
 				goto error;
-			running_stdev(count, &counts->kmers[n].rval, &counts->kmers[n].stdev, i);
 		}
 
 		/* Free data */
-		katss_free_counter(ctr);
+		for(int r=0; r<num; r++) {
+			katss_release_counter(ctrs[r]);
+			ctrs[r] = NULL;
+		}
+
+		katss_stats_iterations(num);
 	}
+	free(ctrs);
 
 	/* Finish computing stdev */
 	if(opts->bootstrap_iters > 1)
@@ -140,7 +232,9 @@ bootstrap_regular(const char *path, KatssOptions *opts)
 	return counts;
 
 error:
-	katss_free_counter(ctr);
+	for(int r=0; r<batch; r++)
+		katss_release_counter(ctrs[r]);
+	free(ctrs);
 	katss_free_kdata(counts);
 	return NULL;
 }
@@ -151,33 +245,47 @@ bootstrap_ushuffle(const char *path, KatssOptions *opts)
 	KatssData *counts = katss_init_kdata(opts->kmer);
 	if(counts == NULL)
 		return NULL;
-	KatssCounter *ctr;
+	for(uint64_t n=0; n<counts->num_kmers; n++)
+		counts->kmers[n].kmer = (uint32_t)n;
 	unsigned int seed = opts->seed;
-	unsigned int kmer = opts->kmer;
-	int klet          = opts->probs_ntprec;
-	int sample        = opts->bootstrap_sample;
+
+	/* Count as many iterations at once as fit in memory, each on its share of the threads */
+	int batch = katss_replicate_batch(opts->kmer, 1, opts->bootstrap_iters, opts->memory_budget);
+	batch = MIN2(batch, MAX2(opts->threads, 1));
+	struct iteration_job *jobs = s_calloc(batch, sizeof *jobs);
+	for(int j=0; j<batch; j++) {
+		jobs[j].path = path;
+		jobs[j].opts = opts;
+		jobs[j].threads = MAX2(opts->threads / batch, 1);
+	}
 
 	/* Process n number of iterations */
-	for(int i=1; i<=opts->bootstrap_iters; i++) {
-		/* Compute counts */
-		ctr = katss_count_kmers_ushuffle_bootstrap(path, kmer, klet, sample, &seed);
-		if(ctr == NULL) {
+	katss_stats_lap();
+	for(int i=1; i<=opts->bootstrap_iters; i+=batch) {
+		/* Compute counts, with the seeds the iterations get when counted one after the other */
+		int num = MIN2(batch, opts->bootstrap_iters - i + 1);
+		for(int j=0; j<num; j++) {
+			jobs[j].seed = seed;
+			seed = seed * 1103515245U + 12345U;
+		}
+		if(katss_run_jobs(ushuffle_iteration, jobs, sizeof *jobs, num) != 0) {
 			error_message("katss_count: Failed to get counts on iteration=(%d)", i);
-			katss_free_kdata(counts);
-			return NULL;
+			goto error;
 		}
 		
-		/* Move counts to KatssData */
-		float count;
-		for(uint64_t n=0; n<counts->num_kmers; n++) {
-			counts->kmers[n].kmer = (uint32_t)n;
-			katss_get_from_hash(ctr, KATSS_FLOAT, &count, (uint32_t)n);
-			running_stdev(count, &counts->kmers[n].rval, &counts->kmers[n].stdev, i);
-		}
+		/* Move counts to KatssData, in the order of the iterations */
+		for(int j=0; j<num; j++)
+			add_iteration(counts, jobs[j].counter, i + j);
 
 		/* Free data */
-		katss_free_counter(ctr);
+		for(int j=0; j<num; j++) {
+			katss_release_counter(jobs[j].counter);
+			jobs[j].counter = NULL;
+		}
+
+		katss_stats_iterations(num);
 	}
+	free(jobs);
 
 	/* Finish computing stdev */
 	for(uint64_t n=0; n<counts->num_kmers; n++) {
@@ -185,26 +293,38 @@ bootstrap_ushuffle(const char *path, KatssOptions *opts)
 	}
 
 	return counts;
+
+error:
+	for(int j=0; j<batch; j++)
+		katss_release_counter(jobs[j].counter);
+	free(jobs);
+	katss_free_kdata(counts);
+	return NULL;
 }
 
-KatssData *
-katss_count(const char *path, KatssOptions *opts)
+/**
+ * @brief Count the dataset `path`, read from `file` instead if it isn't NULL, which is only done
+ * for counts reading the dataset once.
+ */
+static KatssData *
+count_dataset(const char *path, SeqFile file, KatssOptions *opts)
 {
-	/* Make sure test file was passed */
-	if(path == NULL)
-		return NULL;
-
 	/* Parse the options */
 	if(katss_parse_options(opts) != 0)
 		return NULL;
 
 
+	/* Counter files were counted a strand at a time */
+	if(opts->canonical && file == NULL &&
+	   katss_reject_counter_files(path, NULL, opts, "katss_count"))
+		return NULL;
+
 	/* BEGIN COMPUTATION: No bootstrap */
 	KatssData *data = NULL;
 	if(opts->bootstrap_iters == 0) {
 		switch(opts->probs_algo) {
 		case KATSS_PROBS_NONE:
-			data = regular(path, opts);  // Just get the counts
+			data = regular(path, file, opts);  // Just get the counts
 			break;
 
 		case KATSS_PROBS_REGULAR:
@@ -213,6 +333,8 @@ katss_count(const char *path, KatssOptions *opts)
 			return NULL; // can't compute
 
 		case KATSS_PROBS_USHUFFLE:
+			if(file == NULL && katss_reject_counter_files(path, NULL, opts, "katss_count"))
+				return NULL;
 			data = ushuffle(path, opts); // Get counts of shuffled seq
 			break;
 
@@ -226,6 +348,11 @@ katss_count(const char *path, KatssOptions *opts)
 
 	/* BEGIN COMPUTATION: bootstrap */
 	} else {
+		if(file == NULL && katss_reject_counter_files(path, NULL, opts, "katss_count"))
+			return NULL;
+
+		/* Every iteration samples the same file again */
+		int loaded = katss_preload_files(path, NULL, opts);
 		switch(opts->probs_algo) {
 		case KATSS_PROBS_NONE:
 			data = bootstrap_regular(path, opts); // bootstrap counts
@@ -234,7 +361,7 @@ katss_count(const char *path, KatssOptions *opts)
 		case KATSS_PROBS_REGULAR:
 			if(opts->enable_warnings)
 				error_message("katss_count: KATSS_PROBS_REGULAR is not supported");
-			return NULL; // can't compute
+			break; // can't compute
 
 		case KATSS_PROBS_USHUFFLE:
 			data = bootstrap_ushuffle(path, opts); // bootstrap ushuffle counts
@@ -243,23 +370,110 @@ katss_count(const char *path, KatssOptions *opts)
 		case KATSS_PROBS_BOTH:
 			if(opts->enable_warnings)
 				error_message("katss_count: KATSS_PROBS_BOTH is not supported");
-			return NULL;
+			break;
 
-		default: return NULL;
+		default: break;
 		}
+		katss_unload_files(path, NULL, loaded);
 	}
 
 	/* If data is NULL, reeturn NULL */
 	if(data == NULL)
 		return NULL;
 
-	/* Sort if necessary */
-	if(opts->sort_enrichments && opts->bootstrap_iters == 0) {
-		qsort(data->kmers, data->num_kmers, sizeof *data->kmers, compare1);
-	} else if(opts->sort_enrichments) {
-		qsort(data->kmers, data->num_kmers, sizeof *data->kmers, compare2);
-	}
+	/* Sort if necessary, plain counts by count and bootstraps by their mean */
+	if(opts->sort_enrichments || opts->top_kmers)
+		katss_sort_kdata(data, opts->bootstrap_iters == 0, opts->top_kmers, opts->threads);
 
 	/* DONE: return data */
 	return data;
 }
+
+/**
+ * @brief Count the dataset of `file`, opened from a descriptor or buffer and called `name` in
+ * messages. Datasets read several times are decoded into memory under `name` first, and counted
+ * from there the way a file of that name would be. Closes `file`.
+ */
+static KatssData *
+count_seqfile(SeqFile file, const char *name, KatssOptions *opts)
+{
+	if(file == NULL) {
+		error_message("katss: %s: %s", name, seqfstrerror(seqferrno));
+		return NULL;
+	}
+	KatssData *data = NULL;
+	if(katss_parse_options(opts) != 0)
+		goto close_file;
+
+	/* Plain counts read the dataset once, as it is read */
+	if(opts->bootstrap_iters == 0 && opts->probs_algo == KATSS_PROBS_NONE) {
+		data = count_dataset(name, file, opts);
+		goto close_file;
+	}
+
+	if(opts->spool_bytes == 0) {
+		if(opts->enable_warnings)
+			error_message("katss_count: %s can only be read once, set spool_bytes to keep it in "
+			              "memory", name);
+		goto close_file;
+	}
+	if(katss_preload_seqfile(name, file, opts->spool_bytes) != 0) {
+		if(opts->enable_warnings)
+			error_message("katss_count: %s could not be kept in memory within spool_bytes=(%llu)",
+			              name, (unsigned long long)opts->spool_bytes);
+		goto close_file;
+	}
+
+	/* It is then preloaded, as far as counting it goes */
+	uint64_t preload_bytes = opts->preload_bytes;
+	opts->preload_bytes = opts->spool_bytes;
+	data = count_dataset(name, NULL, opts);
+	opts->preload_bytes = preload_bytes;
+	katss_unload_file(name);
+
+close_file:
+	seqfclose(file);
+	return data;
+}
+
+KatssData *
+katss_count(const char *path, KatssOptions *opts)
+{
+	/* Make sure test file was passed */
+	if(path == NULL)
+		return NULL;
+	KatssStats *stats = katss_start_stats(opts);
+	return katss_stop_stats(stats, count_dataset(path, NULL, opts));
+}
+
+KatssData *
+katss_count_files(const char *const *paths, int num_paths, KatssOptions *opts)
+{
+	char *name = katss_group_paths(paths, num_paths);
+	if(name == NULL)
+		return NULL;
+	KatssStats *stats = katss_start_stats(opts);
+	KatssData *data = katss_stop_stats(stats, count_dataset(name, NULL, opts));
+	katss_ungroup_paths(name);
+	return data;
+}
+
+KatssData *
+katss_count_fd(int fd, KatssOptions *opts)
+{
+	/* Pipes are read ahead on a thread, so they are inflated while being counted */
+	char name[32];
+	snprintf(name, sizeof name, "<fd %d>", fd);
+	KatssStats *stats = katss_start_stats(opts);
+	return katss_stop_stats(stats, count_seqfile(seqfdopen(fd, "dt"), name, opts));
+}
+
+KatssData *
+katss_count_buffer(const void *buffer, size_t size, KatssOptions *opts)
+{
+	/* Uncompressed buffers are hashed where they are */
+	char name[48];
+	snprintf(name, sizeof name, "<buffer %p>", buffer);
+	KatssStats *stats = katss_start_stats(opts);
+	return katss_stop_stats(stats, count_seqfile(seqfmemopen(buffer, size, "dm"), name, opts));
+}
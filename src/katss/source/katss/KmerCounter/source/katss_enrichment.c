@@ -10,35 +10,289 @@
 #include "enrichments.h"
 #include "t_test.h"
 
+static void
+running_stdev(double value, double *mean, double *stdev, int run)
+{
+	double tmp_mean = *mean;
+	*mean  += (value - tmp_mean) / run;
+	*stdev += (value - tmp_mean) * (value - *mean);
+}
+
+/* Running statistics of every k-mer while bootstrapping */
+struct bootstrap_stats {
+	t_test2_array *tests;  /** T-test of the test and control values of every k-mer */
+	double *rval_mean;     /** Running mean of the rval of every k-mer */
+	double *rval_M2;       /** Running sum of squared differences from the mean of every rval */
+	double *test_vals;     /** Test value of every k-mer in the current iteration */
+	double *ctrl_vals;     /** Control value of every k-mer in the current iteration */
+};
+typedef struct bootstrap_stats bootstrap_stats;
+
+/* Range of t-tests finalized by a task */
+struct finalize_job {
+	t_test2_array *tests;
+	size_t start;
+	size_t end;
+};
+
+/* Bootstrap iteration counted by a task, next to the other iterations of its batch */
+struct iteration_job {
+	const char *test;          /** File sampled by the iteration */
+	KatssOptions *opts;        /** Options of the bootstrap */
+	unsigned int seed;         /** Seed of the iteration's draws */
+	int threads;               /** Threads counting the iteration */
+	KatssCounter *counters[3]; /** Counts of the iteration */
+};
+
+/* Tests of a batch enriched by a task against the control they share, every `stride`-th one */
+struct batch_job {
+	const char *const *tests;  /** Tests of the batch */
+	KatssData **data;          /** Enrichments of every test of the batch */
+	int first;                 /** First test of the task */
+	int stride;                /** Tasks enriching the tests of the batch */
+	int num_tests;
+	KatssOptions opts;         /** Options of the batch, with the task's share of the threads */
+	KatssCounter *ctrl_counts; /** Counts of the control, NULL when bootstrapping sampled reads */
+	bootstrap_stats **stats;   /** Running statistics of every test, for sampled reads */
+	KatssCounter **ctrl_reps;  /** Control replicates of the current pass, for sampled reads */
+	KatssCounter **test_reps;  /** Replicates of the task's test being counted */
+	int iter;                  /** Iterations before the current pass */
+	int num;                   /** Iterations of the current pass */
+	unsigned int seed;         /** Seed of the replicates of every test in the current pass */
+};
+
+/* K-mers whose bootstrap counts are drawn from a stream of their own */
+#define RESAMPLE_BLOCK 65536
+
+/* Range of k-mers whose counts a task draws, for a bootstrap iteration of saved counts */
+struct resample_job {
+	const KatssCounter *counts; /** Counts drawn from */
+	double *values;             /** Counts drawn, NAN for the ones drawn 0 */
+	unsigned int seed;          /** Seed of the iteration */
+	int stream;                 /** 0 for the test, 1 for the control */
+	double fraction;            /** Reads sampled, 0 for a Poisson bootstrap */
+	uint64_t start;             /** First k-mer drawn, the start of a block */
+	uint64_t end;
+};
+
+static bootstrap_stats *
+init_bootstrap_stats(uint64_t total)
+{
+	bootstrap_stats *stats = s_malloc(sizeof *stats);
+	stats->tests = t_test2_array_create(total);
+	stats->rval_mean = s_calloc(total, sizeof *stats->rval_mean);
+	stats->rval_M2 = s_calloc(total, sizeof *stats->rval_M2);
+	stats->test_vals = s_malloc(total * sizeof *stats->test_vals);
+	stats->ctrl_vals = s_malloc(total * sizeof *stats->ctrl_vals);
+	return stats;
+}
+
+static void
+free_bootstrap_stats(bootstrap_stats *stats)
+{
+	t_test2_array_destroy(stats->tests);
+	free(stats->rval_mean);
+	free(stats->rval_M2);
+	free(stats->test_vals);
+	free(stats->ctrl_vals);
+	free(stats);
+}
+
+/**
+ * @brief Copy the counts of every k-mer in the counter's table into `values`, NAN for k-mers
+ * never counted if `zero_nan` is set.
+ */
+static void
+table_values(KatssCounter *counter, double *values, bool zero_nan)
+{
+	uint64_t total = (uint64_t)counter->capacity + 1;
+	for(uint64_t k=0; k<total; k++) {
+		double count = (double)katss_table_count(counter, k);
+		values[k] = zero_nan && count == 0 ? NAN : count;
+	}
+}
+
 static int
-compare(const void *a, const void *b)
+finalize_range(void *arg)
 {
-	const KatssDataEntry *p1 = (KatssDataEntry *)a;
-	const KatssDataEntry *p2 = (KatssDataEntry *)b;
+	struct finalize_job *job = arg;
+	t_test2_array_finalize(job->tests, job->start, job->end);
+	return 0;
+}
 
-	if(isnan(p1->rval) && isnan(p2->rval)) {
-		return 0;
-	} else if(isnan(p1->rval)) {
-		return 1;
-	} else if(isnan(p2->rval)) {
-		return -1;
+/**
+ * @brief Finalize the t-tests of every k-mer, using `opts->threads` threads, and move the
+ * statistics to KatssData. Frees the statistics.
+ */
+static KatssData *
+finish_bootstrap(bootstrap_stats *stats, KatssOptions *opts)
+{
+	size_t total = stats->tests->size;
+	int threads = MAX2(opts->threads, 1);
+	if((size_t)threads > total)
+		threads = (int)total;
+	struct finalize_job *jobarg = s_malloc(threads * sizeof *jobarg);
+	size_t chunk = total / threads;
+	for(int i=0; i<threads; i++) {
+		jobarg[i].tests = stats->tests;
+		jobarg[i].start = chunk * i;
+		jobarg[i].end = i == threads - 1 ? total : chunk * (i + 1);
 	}
+	katss_run_jobs(finalize_range, jobarg, sizeof *jobarg, threads);
+	free(jobarg);
 
-	if(p1->rval < p2->rval) {
-		return 1;
-	} else if(p1->rval > p2->rval) {
-		return -1;
-	} else {
-		return 0;
+	KatssData *enrichments = katss_init_kdata(opts->kmer);
+	for(uint64_t i=0; i<enrichments->num_kmers; i++) {
+		enrichments->kmers[i].kmer = i;
+		enrichments->kmers[i].stdev = sqrt(stats->rval_M2[i] / (opts->bootstrap_iters - 1));
+		enrichments->kmers[i].rval = opts->normalize ? log2(stats->rval_mean[i])
+		                                             : stats->rval_mean[i];
+		enrichments->kmers[i].pval = stats->tests->pval[i];
 	}
+	free_bootstrap_stats(stats);
+	return enrichments;
+}
+
+/**
+ * @brief Jobs of the iterations counted at the same time, each holding `num_tables` tables, as
+ * many as `opts->memory_budget` and `opts->threads` allow. Sets `batch` to their number.
+ */
+static struct iteration_job *
+init_iterations(const char *test, KatssOptions *opts, int num_tables, int *batch)
+{
+	*batch = katss_replicate_batch(opts->kmer, num_tables, opts->bootstrap_iters,
+	                               opts->memory_budget);
+	*batch = MIN2(*batch, MAX2(opts->threads, 1));
+	struct iteration_job *jobs = s_calloc(*batch, sizeof *jobs);
+	for(int j=0; j<*batch; j++) {
+		jobs[j].test = test;
+		jobs[j].opts = opts;
+		jobs[j].threads = MAX2(opts->threads / *batch, 1);
+	}
+	return jobs;
 }
 
+/**
+ * @brief Give the next `num` iterations their seeds, which are the ones they would have been
+ * given counting one after the other, so results don't depend on how many run at once.
+ */
 static void
-running_stdev(double value, double *mean, double *stdev, int run)
+seed_iterations(struct iteration_job *jobs, int num, unsigned int *seed)
 {
-	double tmp_mean = *mean;
-	*mean  += (value - tmp_mean) / run;
-	*stdev += (value - tmp_mean) * (value - *mean);
+	for(int j=0; j<num; j++) {
+		jobs[j].seed = *seed;
+		*seed = *seed * 1103515245U + 12345U;
+	}
+}
+
+/**
+ * @brief Free the counters of the first `num` iterations, so the jobs can count the next ones.
+ */
+static void
+clear_iterations(struct iteration_job *jobs, int num)
+{
+	for(int j=0; j<num; j++) {
+		for(int c=0; c<3; c++) {
+			katss_release_counter(jobs[j].counters[c]);
+			jobs[j].counters[c] = NULL;
+		}
+	}
+}
+
+static void
+free_iterations(struct iteration_job *jobs, int batch)
+{
+	clear_iterations(jobs, batch);
+	free(jobs);
+}
+
+/**
+ * @brief Count the k-mers, mono and di-nucleotides of the same sampled sequences.
+ */
+static int
+probs_iteration(void *arg)
+{
+	struct iteration_job *job = arg;
+	unsigned int seed = job->seed;
+	job->counters[0] = katss_acquire_file_counter(job->opts->kmer, job->test);
+	job->counters[1] = katss_acquire_counter(1);
+	job->counters[2] = katss_acquire_counter(2);
+	return katss_count_kmers_bootstrap_multi_mt(job->test, job->counters, 3,
+	                                            job->opts->bootstrap_sample, &seed, job->threads);
+}
+
+/**
+ * @brief Count the k-mers of the sampled sequences, and of the sampled sequences shuffled.
+ */
+static int
+ushuffle_iteration(void *arg)
+{
+	struct iteration_job *job = arg;
+	KatssOptions *opts = job->opts;
+	unsigned int seed1, seed2;
+	seed1 = seed2 = job->seed;
+	job->counters[0] = katss_count_kmers_bootstrap_mt(job->test, opts->kmer,
+	                                                  opts->bootstrap_sample, &seed1, job->threads);
+	job->counters[1] = katss_count_kmers_ushuffle_bootstrap_mt(job->test, opts->kmer,
+	                                                           opts->probs_ntprec,
+	                                                           opts->bootstrap_sample, &seed2,
+	                                                           job->threads);
+	return job->counters[0] == NULL || job->counters[1] == NULL;
+}
+
+/**
+ * @brief Count the k-mers, mono and di-nucleotides of `test` in a single pass, and compute their
+ * probabilistic enrichments, as `katss_prob_enrichments` does. The k-mer counts are kept in
+ * `test_counts`, to release once done.
+ */
+static KatssEnrichments *
+prob_enrichments(const char *test, unsigned int kmer, bool normalize, KatssCounter **test_counts)
+{
+	KatssEnrichments *enrichments = NULL;
+	*test_counts = katss_acquire_file_counter(kmer, test);
+	KatssCounter *mono_counts = katss_acquire_counter(1);
+	KatssCounter *dint_counts = katss_acquire_counter(2);
+	KatssCounter *counters[3] = { *test_counts, mono_counts, dint_counts };
+	if(katss_count_kmers_multi(test, counters, 3) == 0)
+		enrichments = katss_compute_prob_enrichments(*test_counts, mono_counts, dint_counts,
+		                                             normalize);
+
+	katss_release_counter(dint_counts);
+	katss_release_counter(mono_counts);
+	if(enrichments == NULL) {
+		katss_release_counter(*test_counts);
+		*test_counts = NULL;
+	}
+	return enrichments;
+}
+
+/**
+ * @brief Times `key` was counted in `counts`, only looked up when the options leave out rows
+ * by their count.
+ */
+static uint64_t
+row_count(KatssCounter *counts, uint64_t key, const KatssOptions *opts)
+{
+	uint64_t count = 0;
+	if(opts->min_count)
+		katss_get_from_hash64(counts, KATSS_UINT64, &count, key);
+	return count;
+}
+
+/**
+ * @brief Rows of the enrichments `enr` the options keep, leaving out k-mers counted fewer than
+ * `min_count` times in `test_counts`.
+ */
+static KatssData *
+enrichment_rows(KatssEnrichments *enr, KatssCounter *test_counts, const KatssOptions *opts)
+{
+	KatssRows *rows = katss_init_rows(enr->num_enrichments, false, opts);
+	for(uint64_t i=0; i<enr->num_enrichments; i++) {
+		KatssDataEntry entry = {.kmer = enr->enrichments[i].key,
+		                        .rval = (float)enr->enrichments[i].enrichment};
+		katss_add_row(rows, &entry, row_count(test_counts, entry.kmer, opts));
+	}
+	return katss_finish_rows(rows);
 }
 
 /**
@@ -49,27 +303,68 @@ running_stdev(double value, double *mean, double *stdev, int run)
  * @param opts Options to modify output
  * @return KatssData* Data containing rval's
  */
-static KatssData *
-regular(const char *test, const char *ctrl, KatssOptions *opts)
+/**
+ * @brief Counts of the dataset `path` for plain enrichments, loaded if it is a counter file.
+ * Sets `owned` if they are to be freed rather than released.
+ */
+static KatssCounter *
+dataset_counts(const char *path, const KatssOptions *opts, bool *owned)
 {
-	KatssEnrichments *enr;
-	KatssData *enrichments;
+	bool failed;
+	KatssCounter *counts = katss_saved_counts(path, opts, &failed);
+	*owned = true;
+	if(counts != NULL || failed)
+		return counts;
+	if(katss_listed_kmers(opts))
+		return katss_count_listed_kmers(path, NULL, opts);
+	*owned = false;
+	return katss_count_kmers_mt(path, opts->kmer, MAX2(opts->threads, 1));
+}
 
-	/* Compute enrichments */
-	enr = katss_enrichments(test, ctrl, opts->kmer, opts->normalize);
-	if(enr == NULL)
+static void
+drop_counts(KatssCounter *counts, bool owned)
+{
+	if(owned)
+		katss_free_counter(counts);
+	else
+		katss_release_counter(counts);
+}
+
+/**
+ * @brief Enrichments of `test` against the counts of the control, which are only read.
+ */
+static KatssData *
+enrichments_against(const char *test, KatssCounter *ctrl_counts, KatssOptions *opts)
+{
+	bool test_owned;
+	KatssCounter *test_counts = dataset_counts(test, opts, &test_owned);
+	if(test_counts == NULL)
 		return NULL;
 
-	/* Move enrichments to KatssData */
-	enrichments = katss_init_kdata(opts->kmer);
-	for(uint64_t i=0; i<enrichments->num_kmers; i++) {
-		enrichments->kmers[i].kmer = enr->enrichments[i].key;
-		enrichments->kmers[i].rval = (float)enr->enrichments[i].enrichment;
-	}
+	/* Compute enrichments */
+	KatssData *enrichments = NULL;
+	KatssEnrichments *enr = katss_compute_enrichments(test_counts, ctrl_counts, opts->normalize);
 
-	/* Free data */
+	/* Move enrichments to KatssData, there are fewer than 4^k of them for listed k-mers */
+	if(enr != NULL)
+		enrichments = enrichment_rows(enr, test_counts, opts);
 	katss_free_enrichments(enr);
 
+	drop_counts(test_counts, test_owned);
+	return enrichments;
+}
+
+static KatssData *
+regular(const char *test, const char *ctrl, KatssOptions *opts)
+{
+	/* Compute the counts, long k-mers and sketches into tables bounded by the options */
+	bool ctrl_owned;
+	KatssCounter *ctrl_counts = dataset_counts(ctrl, opts, &ctrl_owned);
+	if(ctrl_counts == NULL)
+		return NULL;
+
+	KatssData *enrichments = enrichments_against(test, ctrl_counts, opts);
+	drop_counts(ctrl_counts, ctrl_owned);
 	return enrichments;
 }
 
@@ -83,26 +378,17 @@ regular(const char *test, const char *ctrl, KatssOptions *opts)
 static KatssData *
 probs(const char *test, KatssOptions *opts)
 {
-	KatssEnrichments *enr = NULL;
-
 	/* Compute probabilistic enrichments */
-	enr = katss_prob_enrichments(test, opts->kmer, opts->normalize);
+	KatssCounter *test_counts;
+	KatssEnrichments *enr = prob_enrichments(test, opts->kmer, opts->normalize, &test_counts);
 	if(enr == NULL)
 		return NULL;
 
-	/* Initialize kdata */
-	KatssData *data = katss_init_kdata(opts->kmer);
-	if(data == NULL)
-		goto exit;
-	
 	/* Move enrichments to KatssData */
-	for(uint64_t i=0; i<data->num_kmers; i++) {
-		data->kmers[i].kmer = enr->enrichments[i].key;
-		data->kmers[i].rval = (float)enr->enrichments[i].enrichment;
-	}
+	KatssData *data = enrichment_rows(enr, test_counts, opts);
 
-exit:
 	katss_free_enrichments(enr);
+	katss_release_counter(test_counts);
 	return data;
 }
 
@@ -121,12 +407,15 @@ ushuffle(const char *test, KatssOptions *opts)
 	unsigned int kmer = opts->kmer;
 	int klet          = opts->probs_ntprec;
 	bool normalize    = opts->normalize;
+	int threads       = opts->threads;
+	KatssCounter *test_counts = NULL;
+	KatssCounter *shuf_counts = NULL;
 
 	/* Compute the counts */
-	KatssCounter *test_counts = katss_count_kmers(test, kmer);
+	test_counts = katss_count_kmers_mt(test, kmer, threads);
 	if(test_counts == NULL)
 		goto exit_error;
-	KatssCounter *shuf_counts = katss_count_kmers_ushuffle(test, kmer, klet);
+	shuf_counts = katss_count_kmers_ushuffle_mt(test, kmer, klet, threads);
 	if(shuf_counts == NULL)
 		goto exit_error;
 
@@ -134,32 +423,20 @@ ushuffle(const char *test, KatssOptions *opts)
 	enr = katss_compute_enrichments(test_counts, shuf_counts, normalize);
 	if(enr == NULL)
 		goto exit_error;
-	
-	/* Free counts */
-	katss_free_counter(test_counts);
-	katss_free_counter(shuf_counts);
-
-	/* Initialize kdata */
-	data = katss_init_kdata(kmer);
-	if(data == NULL)
-		goto undo_enrichment;
 
 	/* Move enrichments to KatssData */
-	for(uint64_t i=0; i<data->num_kmers; i++) {
-		data->kmers[i].kmer = enr->enrichments[i].key;
-		data->kmers[i].rval = (float)enr->enrichments[i].enrichment;
-	}
+	data = enrichment_rows(enr, test_counts, opts);
 
 	/* Success: return */
 	katss_free_enrichments(enr);
+	katss_release_counter(test_counts);
+	katss_release_counter(shuf_counts);
 	return data;
 
 /* ERRORS ENCOUNTERED */
-undo_enrichment:
-	katss_free_enrichments(enr);
 exit_error:
-	katss_free_counter(test_counts);
-	katss_free_counter(shuf_counts);
+	katss_release_counter(test_counts);
+	katss_release_counter(shuf_counts);
 	return NULL;
 }
 
@@ -179,11 +456,12 @@ both(const char *test, KatssOptions *opts)
 	KatssEnrichments *prob = NULL;
 	unsigned int kmer = opts->kmer;
 	int klet          = opts->probs_ntprec;
+	int threads       = opts->threads;
 
 	/* Compute the counts */	
-	KatssCounter *test_counts = katss_count_kmers_ushuffle(test, kmer, klet);
-	KatssCounter *mono_counts = katss_count_kmers_ushuffle(test, 1, klet);
-	KatssCounter *dint_counts = katss_count_kmers_ushuffle(test, 2, klet);
+	KatssCounter *test_counts = katss_count_kmers_ushuffle_mt(test, kmer, klet, threads);
+	KatssCounter *mono_counts = katss_count_kmers_ushuffle_mt(test, 1, klet, threads);
+	KatssCounter *dint_counts = katss_count_kmers_ushuffle_mt(test, 2, klet, threads);
 	if(test_counts == NULL || mono_counts == NULL || dint_counts == NULL)
 		goto exit_error;
 
@@ -193,35 +471,51 @@ both(const char *test, KatssOptions *opts)
 		goto exit_error;
 
 	/* Free counters */
-	katss_free_counter(test_counts);
-	katss_free_counter(mono_counts);
-	katss_free_counter(dint_counts);
+	katss_release_counter(test_counts);
+	katss_release_counter(mono_counts);
+	katss_release_counter(dint_counts);
 
 	/* Compute the probabilistic enrichments */
-	prob = katss_prob_enrichments(test, kmer, false);
+	KatssCounter *prob_counts;
+	prob = prob_enrichments(test, kmer, false, &prob_counts);
 	if(prob == NULL)
 		goto exit;
 
 	/* Compute rval from both probabilistic methods */
-	data = katss_init_kdata(kmer);
+	KatssRows *rows = katss_init_rows(shuf->num_enrichments, false, opts);
 	for(uint64_t i=0; i<shuf->num_enrichments; i++) {
 		double rval = prob->enrichments[i].enrichment / shuf->enrichments[i].enrichment;
-		data->kmers[i].rval = opts->normalize ? log2(rval) : rval;
-		data->kmers[i].kmer = (uint32_t)i;
+		KatssDataEntry entry = {.kmer = i, .rval = opts->normalize ? log2(rval) : rval};
+		katss_add_row(rows, &entry, row_count(prob_counts, i, opts));
 	}
+	data = katss_finish_rows(rows);
 
 	katss_free_enrichments(prob);
+	katss_release_counter(prob_counts);
 exit:
 	katss_free_enrichments(shuf);
 	return data;
 
 exit_error:
-	katss_free_counter(test_counts);
-	katss_free_counter(mono_counts);
-	katss_free_counter(dint_counts);
+	katss_release_counter(test_counts);
+	katss_release_counter(mono_counts);
+	katss_release_counter(dint_counts);
 	return NULL;
 }
 
+/**
+ * @brief Seed `katss_count_kmers_replicates_mt` leaves after drawing `num` replicates from
+ * `seed`. The control replicates of a bootstrap start from the one after every test replicate,
+ * so the two never draw from the same seed.
+ */
+static unsigned int
+skip_seeds(unsigned int seed, int num)
+{
+	for(int i=0; i<num; i++)
+		seed = seed * 1103515245U + 12345U;
+	return seed;
+}
+
 /**
  * @brief Compute the bootstrap enrichments of a dataset.
  * 
@@ -233,72 +527,173 @@ exit_error:
 static KatssData *
 bootstrap_regular(const char *test, const char *ctrl, KatssOptions *opts)
 {
-	KatssCounter *test_counts = NULL;
-	KatssCounter *ctrl_counts = NULL;
-	KatssData *enrichments    = NULL;
-	unsigned int seed         = opts->seed;
+	unsigned int test_seed    = opts->seed;
+	unsigned int ctrl_seed    = skip_seeds(opts->seed, opts->bootstrap_iters);
 	unsigned int kmer         = opts->kmer;
-	int sample                = opts->bootstrap_sample;
+	int sample                = opts->bootstrap_poisson ? 0 : opts->bootstrap_sample;
 	int threads               = opts->threads;
 
 	/* Create T-test aggregates */
 	uint64_t total = 1ULL << (2*opts->kmer);
-	t_test2_aggregate **ttest2 = s_malloc(sizeof *ttest2 * total);
-	for(uint64_t i=0; i<total; i++)
-		ttest2[i] = t_test2_create();
+	bootstrap_stats *stats = init_bootstrap_stats(total);
+	double *test_vals = stats->test_vals, *ctrl_vals = stats->ctrl_vals;
+
+	/* Every pass over the files counts as many iterations as fit in memory */
+	int batch = katss_replicate_batch(kmer, 2, opts->bootstrap_iters, opts->memory_budget);
+	KatssCounter **test_counts = s_calloc(batch, sizeof *test_counts);
+	KatssCounter **ctrl_counts = s_calloc(batch, sizeof *ctrl_counts);
 
 	/* Compute bootstrap values */
-	double test_val, ctrl_val;
-	for(int i=0; i<opts->bootstrap_iters; i++) {
-		test_counts = katss_count_kmers_bootstrap_mt(test, kmer, sample, &seed, threads);
-		ctrl_counts = katss_count_kmers_bootstrap_mt(ctrl, kmer, sample, &seed, threads);
-		if(test_counts == NULL || ctrl_counts == NULL)
+	katss_stats_lap();
+	for(int i=0; i<opts->bootstrap_iters; i+=batch) {
+		int num = MIN2(batch, opts->bootstrap_iters - i);
+		for(int r=0; r<num; r++) {
+			test_counts[r] = katss_acquire_file_counter(kmer, test);
+			ctrl_counts[r] = katss_acquire_file_counter(kmer, ctrl);
+		}
+		if(katss_count_kmers_replicates_mt(test, test_counts, num, sample, &test_seed,
+		                                   threads) != 0 ||
+		   katss_count_kmers_replicates_mt(ctrl, ctrl_counts, num, sample, &ctrl_seed,
+		                                   threads) != 0)
 			goto exit_error;
 
-		for(uint64_t k=0; k<total; k++) {
-			katss_get_from_hash(test_counts, KATSS_DOUBLE, &test_val, (uint32_t)k);
-			katss_get_from_hash(ctrl_counts, KATSS_DOUBLE, &ctrl_val, (uint32_t)k);
-			test_val = test_val == 0 ? NAN : test_val;
-			ctrl_val = ctrl_val == 0 ? NAN : ctrl_val;
-
-			/* Update the t-test aggregate */
-			t_test2_update(ttest2[k], test_val, ctrl_val);
-
-			/* Use unused df and pval to be able to store rval stdev */
-			if(!isnan(test_val) && !isnan(ctrl_val))
-				running_stdev(test_val/ctrl_val, &ttest2[k]->df, &ttest2[k]->pval, i+1);
+		for(int r=0; r<num; r++) {
+			/* Update the t-test aggregates */
+			table_values(test_counts[r], test_vals, true);
+			table_values(ctrl_counts[r], ctrl_vals, true);
+			t_test2_array_update(stats->tests, test_vals, ctrl_vals);
+
+			for(uint64_t k=0; k<total; k++) {
+				if(!isnan(test_vals[k]) && !isnan(ctrl_vals[k]))
+					running_stdev(test_vals[k]/ctrl_vals[k], &stats->rval_mean[k],
+					              &stats->rval_M2[k], i+r+1);
+			}
 		}
 
 		/* Free the counters */
-		katss_free_counter(test_counts);
-		katss_free_counter(ctrl_counts);
+		for(int r=0; r<num; r++) {
+			katss_release_counter(test_counts[r]);
+			katss_release_counter(ctrl_counts[r]);
+			test_counts[r] = ctrl_counts[r] = NULL;
+		}
+
+		katss_stats_iterations(num);
 	}
+	free(test_counts);
+	free(ctrl_counts);
 
 	/* Finalize the bootstrap */
-	enrichments = katss_init_kdata(opts->kmer);
-	for(uint64_t i=0; i<enrichments->num_kmers; i++) {
-		enrichments->kmers[i].kmer = i;
-		enrichments->kmers[i].stdev = sqrt(ttest2[i]->pval / (opts->bootstrap_iters - 1));
-		enrichments->kmers[i].rval = opts->normalize ? log2(ttest2[i]->df) : ttest2[i]->df;
+	return finish_bootstrap(stats, opts);
 
-		t_test2_finalize(ttest2[i]);
-		enrichments->kmers[i].pval = ttest2[i]->pval;
-		t_test2_destroy(ttest2[i]);
+exit_error:
+	for(int r=0; r<batch; r++) {
+		katss_release_counter(test_counts[r]);
+		katss_release_counter(ctrl_counts[r]);
 	}
+	free(test_counts);
+	free(ctrl_counts);
+	free_bootstrap_stats(stats);
+	return NULL;
+}
 
-	/* Clean up and return */
-	free(ttest2);
-	return enrichments;
+/**
+ * @brief Draw the counts of the k-mers of a job's range for a bootstrap iteration, each block of
+ * k-mers from a stream of its own.
+ */
+static int
+resample_range(void *arg)
+{
+	struct resample_job *job = arg;
+	KatssRng rng;
+	for(uint64_t k=job->start; k<job->end; k++) {
+		if(k % RESAMPLE_BLOCK == 0)
+			katss_seed_rng(&rng, job->seed, 2 * (k / RESAMPLE_BLOCK) + job->stream);
+		uint64_t count = katss_table_count(job->counts, k);
+		uint64_t drawn = job->fraction > 0 ? katss_rng_binomial(&rng, count, job->fraction)
+		                                   : katss_rng_poisson(&rng, (double)count);
+		job->values[k] = drawn == 0 ? NAN : (double)drawn;
+	}
+	return 0;
+}
 
-exit_error:
-	katss_free_counter(test_counts);
-	katss_free_counter(ctrl_counts);
-	for(uint64_t i=0; i<total; i++)
-		t_test2_destroy(ttest2[i]);
-	free(ttest2);
-	return NULL;
+/**
+ * @brief Bootstrap enrichments of the counts of a test against those of a control, drawing the
+ * counts of every iteration as `bootstrap_saved` does. The counts are only read.
+ */
+static KatssData *
+bootstrap_counts(KatssCounter *test_counts, KatssCounter *ctrl_counts, KatssOptions *opts)
+{
+	uint64_t total = (uint64_t)test_counts->capacity + 1;
+	bootstrap_stats *stats = init_bootstrap_stats(total);
+	double *test_vals = stats->test_vals, *ctrl_vals = stats->ctrl_vals;
+
+	/* Every thread draws a range of whole blocks, of the test and of the control */
+	uint64_t num_blocks = (total + RESAMPLE_BLOCK - 1) / RESAMPLE_BLOCK;
+	int num_jobs = (int)MIN2((uint64_t)MAX2(opts->threads, 1), num_blocks);
+	struct resample_job *jobs = s_malloc(2 * num_jobs * sizeof *jobs);
+	for(int j=0; j<2*num_jobs; j++) {
+		int part = j % num_jobs;
+		jobs[j].counts = j < num_jobs ? test_counts : ctrl_counts;
+		jobs[j].values = j < num_jobs ? test_vals : ctrl_vals;
+		jobs[j].stream = j >= num_jobs;
+		jobs[j].fraction = opts->bootstrap_poisson ? 0 : opts->bootstrap_sample / 100000.0;
+		jobs[j].start = MIN2(num_blocks * part / num_jobs * RESAMPLE_BLOCK, total);
+		jobs[j].end = MIN2(num_blocks * (part + 1) / num_jobs * RESAMPLE_BLOCK, total);
+	}
+
+	unsigned int seed = opts->seed;
+	katss_stats_lap();
+	for(int i=0; i<opts->bootstrap_iters; i++) {
+		for(int j=0; j<2*num_jobs; j++)
+			jobs[j].seed = seed;
+		seed = seed * 1103515245U + 12345U;
+		katss_run_jobs(resample_range, jobs, sizeof *jobs, 2 * num_jobs);
+
+		/* Update the t-test aggregates, as for sampled reads */
+		t_test2_array_update(stats->tests, test_vals, ctrl_vals);
+		for(uint64_t k=0; k<total; k++) {
+			if(!isnan(test_vals[k]) && !isnan(ctrl_vals[k]))
+				running_stdev(test_vals[k]/ctrl_vals[k], &stats->rval_mean[k],
+				              &stats->rval_M2[k], i+1);
+		}
+
+		katss_stats_iterations(1);
+	}
+	free(jobs);
+	return finish_bootstrap(stats, opts);
 }
 
+/**
+ * @brief Compute the bootstrap enrichments of a test or control saved as counts, e.g. merged from
+ * the counts of the shards of a dataset. There are no reads to sample, so every iteration draws
+ * the count of each k-mer instead: the occurrences a sample of `bootstrap_sample` reads would
+ * keep, binomial, or the Poisson of the count for a Poisson bootstrap. These are the counts of a
+ * sampled dataset if the k-mers of a read are independent, the occurrences of a k-mer being
+ * spread over many reads. A dataset that isn't saved is counted once.
+ * 
+ * @param test Test counter file or dataset
+ * @param ctrl Control counter file or dataset
+ * @param opts Options to modify output
+ * @return KatssData* Data containing rval's, stdev, and pvalue
+ */
+static KatssData *
+bootstrap_saved(const char *test, const char *ctrl, KatssOptions *opts)
+{
+	KatssData *enrichments = NULL;
+	bool test_owned, ctrl_owned = true;
+	KatssCounter *test_counts = dataset_counts(test, opts, &test_owned);
+	if(test_counts == NULL)
+		return NULL;
+	KatssCounter *ctrl_counts = dataset_counts(ctrl, opts, &ctrl_owned);
+	if(ctrl_counts != NULL)
+		enrichments = bootstrap_counts(test_counts, ctrl_counts, opts);
+
+	drop_counts(ctrl_counts, ctrl_owned);
+	drop_counts(test_counts, test_owned);
+	return enrichments;
+}
+
+
 /**
  * @brief Compute the bootstrap enrichments of using the probabilistic method.
  * 
@@ -309,78 +704,53 @@ exit_error:
 static KatssData *
 bootstrap_probs(const char *test, KatssOptions *opts)
 {
-	KatssCounter *test_counts = NULL;
-	KatssCounter *mono_counts = NULL;
-	KatssCounter *dint_counts = NULL;
-	KatssData *enrichments    = NULL;
-	unsigned int kmer         = opts->kmer;
-	int sample                = opts->bootstrap_sample;
-	int threads               = opts->threads;
-	unsigned int seed1,seed2,seed3;
-	seed1 = seed2 = seed3 = opts->seed;
+	unsigned int kmer = opts->kmer;
+	unsigned int seed = opts->seed;
 
 	/* Create T-test aggregates */
 	uint64_t total = 1ULL << (2*opts->kmer);
-	t_test2_aggregate **ttest2 = s_malloc(sizeof *ttest2 * total);
-	for(uint64_t i=0; i<total; i++)
-		ttest2[i] = t_test2_create();
-
-	/* Compute bootstrap values */
-	double test_val;
-	for(int i=0; i<opts->bootstrap_iters; i++) {
-		test_counts = katss_count_kmers_bootstrap_mt(test, kmer, sample, &seed1, threads);
-		mono_counts = katss_count_kmers_bootstrap_mt(test, 1,    sample, &seed2, threads);
-		dint_counts = katss_count_kmers_bootstrap_mt(test, 2,    sample, &seed3, threads);
-		if(test_counts == NULL || mono_counts == NULL || dint_counts == NULL)
+	bootstrap_stats *stats = init_bootstrap_stats(total);
+	double *test_vals = stats->test_vals, *ctrl_vals = stats->ctrl_vals;
+
+	/* Compute bootstrap values, counting as many iterations at once as fit in memory */
+	int batch;
+	struct iteration_job *jobs = init_iterations(test, opts, 3, &batch);
+	katss_stats_lap();
+	for(int i=0; i<opts->bootstrap_iters; i+=batch) {
+		int num = MIN2(batch, opts->bootstrap_iters - i);
+		seed_iterations(jobs, num, &seed);
+		if(katss_run_jobs(probs_iteration, jobs, sizeof *jobs, num) != 0)
 			goto exit_error;
 
-		for(uint64_t k=0; k<total; k++) {
-			katss_get_from_hash(test_counts, KATSS_DOUBLE, &test_val, (uint32_t)k);
-			double ctrl_val = katss_predict_kmer_freq((uint32_t)k, kmer, mono_counts, dint_counts);
-			ctrl_val *= katss_get_total(test_counts);
-
-			/* Update the t-test aggregate */
-			t_test2_update(ttest2[k], test_val, ctrl_val);
-
-			/* Use unused df and pval to be able to store rval stdev */
-			test_val /= katss_get_total(test_counts); // normalize the test_val
-			ctrl_val = katss_predict_kmer_freq((uint32_t)k, kmer, mono_counts, dint_counts);
-			running_stdev(test_val/ctrl_val, &ttest2[k]->df, &ttest2[k]->pval, i+1);
+		/* Update the t-test aggregates in order, control values being the predicted counts */
+		for(int j=0; j<num; j++) {
+			KatssCounter *test_counts = jobs[j].counters[0];
+			KatssCounter *mono_counts = jobs[j].counters[1];
+			KatssCounter *dint_counts = jobs[j].counters[2];
+			double test_total = katss_get_total(test_counts);
+			table_values(test_counts, test_vals, false);
+			katss_predict_kmer_freqs(0, total, kmer, mono_counts, dint_counts, ctrl_vals);
+			for(uint64_t k=0; k<total; k++) {
+				double rval = (test_vals[k] / test_total) / ctrl_vals[k];
+				running_stdev(rval, &stats->rval_mean[k], &stats->rval_M2[k], i+j+1);
+				ctrl_vals[k] *= test_total;
+			}
+			t_test2_array_update(stats->tests, test_vals, ctrl_vals);
 		}
 
 		/* Free the counters */
-		katss_free_counter(test_counts);
-		katss_free_counter(mono_counts);
-		katss_free_counter(dint_counts);
-	}
+		clear_iterations(jobs, num);
 
-	/* Finalize the bootstrap */
-	enrichments = katss_init_kdata(opts->kmer);
-	for(uint64_t i=0; i<enrichments->num_kmers; i++) {
-		enrichments->kmers[i].kmer = i;
-		enrichments->kmers[i].stdev = sqrt(ttest2[i]->pval / (opts->bootstrap_iters - 1));
-		if(opts->normalize) {
-			enrichments->kmers[i].rval = log2(ttest2[i]->df); // df holds rval
-		} else {
-			enrichments->kmers[i].rval = ttest2[i]->df; // df holds rval
-		}
-
-		t_test2_finalize(ttest2[i]);
-		enrichments->kmers[i].pval = ttest2[i]->pval;
-		t_test2_destroy(ttest2[i]);
+		katss_stats_iterations(num);
 	}
+	free_iterations(jobs, batch);
 
-	/* Clean up and return */
-	free(ttest2);
-	return enrichments;
+	/* Finalize the bootstrap */
+	return finish_bootstrap(stats, opts);
 
 exit_error:
-	katss_free_counter(test_counts);
-	katss_free_counter(mono_counts);
-	katss_free_counter(dint_counts);
-	for(uint64_t i=0; i<total; i++)
-		t_test2_destroy(ttest2[i]);
-	free(ttest2);
+	free_iterations(jobs, batch);
+	free_bootstrap_stats(stats);
 	return NULL;
 }
 
@@ -394,77 +764,52 @@ exit_error:
 static KatssData *
 bootstrap_ushuffle(const char *test, KatssOptions *opts)
 {
-	KatssCounter *test_counts = NULL;
-	KatssCounter *shuf_counts = NULL;
-	KatssData *enrichments    = NULL;
-	unsigned int kmer         = opts->kmer;
-	int klet                  = opts->probs_ntprec;
-	int sample                = opts->bootstrap_sample;
-	bool normalize            = opts->normalize;
-	unsigned int seed1,seed2,seed3;
-	seed1 = seed2 = seed3 = opts->seed;
+	unsigned int seed = opts->seed;
 
 	/* Create T-test aggregates */
 	uint64_t total = 1ULL << (2*opts->kmer);
-	t_test2_aggregate **ttest2 = s_malloc(sizeof *ttest2 * total);
-	for(uint64_t i=0; i<total; i++)
-		ttest2[i] = t_test2_create();
-
-	/* Compute bootstrap values */
-	for(int i=1; i<=opts->bootstrap_iters; i++) {
-		test_counts = katss_count_kmers_bootstrap(test, kmer, sample, &seed1);
-		if(test_counts == NULL)
-			goto exit_error;
-		shuf_counts = katss_count_kmers_ushuffle_bootstrap(test, kmer, klet, sample, &seed2);
-		if(shuf_counts == NULL)
+	bootstrap_stats *stats = init_bootstrap_stats(total);
+	double *test_vals = stats->test_vals, *ctrl_vals = stats->ctrl_vals;
+
+	/* Compute bootstrap values, counting as many iterations at once as fit in memory */
+	int batch;
+	struct iteration_job *jobs = init_iterations(test, opts, 2, &batch);
+	katss_stats_lap();
+	for(int i=0; i<opts->bootstrap_iters; i+=batch) {
+		int num = MIN2(batch, opts->bootstrap_iters - i);
+		seed_iterations(jobs, num, &seed);
+		if(katss_run_jobs(ushuffle_iteration, jobs, sizeof *jobs, num) != 0)
 			goto exit_error;
 
-		/* Update the statistics for all kmers in this iteration */
-		for(uint64_t k=0; k<total; k++) {
-			/* Obtain the predicted and actual counts for kmer k */
-			double test_count, ctrl_count;
-			katss_get_from_hash(test_counts, KATSS_DOUBLE, &test_count, (uint32_t)k);
-			katss_get_from_hash(shuf_counts, KATSS_DOUBLE, &ctrl_count, (uint32_t)k);
-
-			/* Update the t-test aggregate */
-			t_test2_update(ttest2[k], test_count, ctrl_count);
-
-			/* Use unused df and pval to be able to store rval stdev */
-			test_count /= katss_get_total(test_counts);
-			ctrl_count /= katss_get_total(shuf_counts);
-			running_stdev(test_count/ctrl_count, &ttest2[k]->df, &ttest2[k]->pval, i);
+		/* Update the statistics for all kmers, one iteration after the other */
+		for(int j=0; j<num; j++) {
+			KatssCounter *test_counts = jobs[j].counters[0];
+			KatssCounter *shuf_counts = jobs[j].counters[1];
+			table_values(test_counts, test_vals, false);
+			table_values(shuf_counts, ctrl_vals, false);
+			t_test2_array_update(stats->tests, test_vals, ctrl_vals);
+
+			double test_total = katss_get_total(test_counts);
+			double shuf_total = katss_get_total(shuf_counts);
+			for(uint64_t k=0; k<total; k++) {
+				double rval = (test_vals[k] / test_total) / (ctrl_vals[k] / shuf_total);
+				running_stdev(rval, &stats->rval_mean[k], &stats->rval_M2[k], i+j+1);
+			}
 		}
 
 		/* Free the counters */
-		katss_free_counter(test_counts);
-		katss_free_counter(shuf_counts);
-	}
+		clear_iterations(jobs, num);
 
-	/* Finalize the bootstrap */
-	enrichments = katss_init_kdata(opts->kmer);
-	for(uint64_t i=0; i<enrichments->num_kmers; i++) {
-		/* df currently holds the rval (due to running_stdev) */
-		double rval = ttest2[i]->df;
-		enrichments->kmers[i].rval = normalize ? log2(rval) : rval;
-		enrichments->kmers[i].kmer = i;
-		enrichments->kmers[i].stdev = sqrt(ttest2[i]->pval / (opts->bootstrap_iters - 1));
-
-		/* Finalize the t-test to get pvalue */
-		t_test2_finalize(ttest2[i]);
-		enrichments->kmers[i].pval = ttest2[i]->pval;
-		t_test2_destroy(ttest2[i]);
+		katss_stats_iterations(num);
 	}
+	free_iterations(jobs, batch);
 
-	/* Clean up and return */
-	free(ttest2);
-	return enrichments;
+	/* Finalize the bootstrap */
+	return finish_bootstrap(stats, opts);
 
 exit_error:
-	katss_free_counter(test_counts);
-	katss_free_counter(shuf_counts);
-	for(uint64_t i=0; i<total; i++)
-		t_test2_destroy(ttest2[i]);
-	free(ttest2);
+	free_iterations(jobs, batch);
+	free_bootstrap_stats(stats);
 	return NULL;
 }
 
@@ -493,26 +838,25 @@ bootstrap_both(const char *test, KatssOptions *opts)
 	KatssCounter *dint_counts = NULL;
 	KatssEnrichments *shuf    = NULL;
 	KatssEnrichments *prob    = NULL;
-	KatssData *enrichments    = NULL;
 	unsigned int kmer         = opts->kmer;
 	int klet                  = opts->probs_ntprec;
 	int sample                = opts->bootstrap_sample;
 	int threads               = opts->threads;
-	unsigned int seed1,seed2,seed3,seed4,seed5,seed6;
-	seed1 = seed2 = seed3 = seed4 = seed5 = seed6 = opts->seed;
+	unsigned int seed1,seed2,seed3,seed4;
+	seed1 = seed2 = seed3 = seed4 = opts->seed;
 
 	/* Create T-test aggregates */
 	uint64_t total = 1ULL << (2*opts->kmer);
-	t_test2_aggregate **ttest2 = s_malloc(sizeof *ttest2 * total);
-	for(uint64_t i=0; i<total; i++)
-		ttest2[i] = t_test2_create();
+	bootstrap_stats *stats = init_bootstrap_stats(total);
+	double *test_vals = stats->test_vals, *ctrl_vals = stats->ctrl_vals;
 
 	/* Compute bootstrap values */
+	katss_stats_lap();
 	for(int i=1; i<=opts->bootstrap_iters; i++) {
 		/* Get the shuffled counts */
-		test_counts = katss_count_kmers_ushuffle_bootstrap(test, kmer, klet, sample, &seed1);
-		mono_counts = katss_count_kmers_ushuffle_bootstrap(test, 1,    klet, sample, &seed2);
-		dint_counts = katss_count_kmers_ushuffle_bootstrap(test, 2,    klet, sample, &seed3);
+		test_counts = katss_count_kmers_ushuffle_bootstrap_mt(test, kmer, klet, sample, &seed1, threads);
+		mono_counts = katss_count_kmers_ushuffle_bootstrap_mt(test, 1,    klet, sample, &seed2, threads);
+		dint_counts = katss_count_kmers_ushuffle_bootstrap_mt(test, 2,    klet, sample, &seed3, threads);
 		if(test_counts == NULL || mono_counts == NULL || dint_counts == NULL)
 			goto exit_error;
 
@@ -521,73 +865,54 @@ bootstrap_both(const char *test, KatssOptions *opts)
 		if(shuf == NULL)
 			goto exit_error;
 
-		katss_free_counter(test_counts);
-		katss_free_counter(mono_counts);
-		katss_free_counter(dint_counts);
+		katss_release_counter(test_counts);
+		katss_release_counter(mono_counts);
+		katss_release_counter(dint_counts);
 
 		/* Compute probabilistic enrichment of dataset */
-		test_counts = katss_count_kmers_bootstrap_mt(test, kmer, sample, &seed4, threads);
-		mono_counts = katss_count_kmers_bootstrap_mt(test, 1,    sample, &seed5, threads);
-		dint_counts = katss_count_kmers_bootstrap_mt(test, 2,    sample, &seed6, threads);
-		if(test_counts == NULL || mono_counts == NULL || dint_counts == NULL)
+		test_counts = katss_acquire_file_counter(kmer, test);
+		mono_counts = katss_acquire_counter(1);
+		dint_counts = katss_acquire_counter(2);
+		KatssCounter *counters[3] = { test_counts, mono_counts, dint_counts };
+		if(katss_count_kmers_bootstrap_multi_mt(test, counters, 3, sample, &seed4, threads) != 0)
 			goto exit_error_probs;
 		prob = katss_compute_prob_enrichments(test_counts, mono_counts, dint_counts, false);
 		if(prob == NULL)
 			goto exit_error_probs;
-		katss_free_counter(test_counts);
-		katss_free_counter(mono_counts);
-		katss_free_counter(dint_counts);
+		katss_release_counter(test_counts);
+		katss_release_counter(mono_counts);
+		katss_release_counter(dint_counts);
 
 		/* Update the statistics for all kmers in this iteration */
 		for(uint64_t k=0; k<total; k++) {
-			/* Update the t-test aggregate */
-			double test_rval = prob->enrichments[k].enrichment;
-			double ctrl_rval = shuf->enrichments[k].enrichment;
-			t_test2_update(ttest2[k], test_rval, ctrl_rval);
-
-			/* Store the standard deviation for R value */
-			running_stdev(test_rval/ctrl_rval, &ttest2[k]->df, &ttest2[k]->pval, i);
+			test_vals[k] = prob->enrichments[k].enrichment;
+			ctrl_vals[k] = shuf->enrichments[k].enrichment;
+			running_stdev(test_vals[k]/ctrl_vals[k], &stats->rval_mean[k], &stats->rval_M2[k], i);
 		}
+		t_test2_array_update(stats->tests, test_vals, ctrl_vals);
 
 		/* Free the enrichments */
 		katss_free_enrichments(prob);
 		katss_free_enrichments(shuf);
-	}
-
-	/* Finalize the bootstrap */
-	enrichments = katss_init_kdata(opts->kmer);
-	for(uint64_t i=0; i<enrichments->num_kmers; i++) {
-		enrichments->kmers[i].kmer = i;
-		enrichments->kmers[i].stdev = sqrt(ttest2[i]->pval / (opts->bootstrap_iters - 1));
-		if(opts->normalize) {
-			enrichments->kmers[i].rval = log2(ttest2[i]->df);
-		} else {
-			enrichments->kmers[i].rval = ttest2[i]->df; // df holds rval currently
-		} 
 
-		t_test2_finalize(ttest2[i]);
-		enrichments->kmers[i].pval = ttest2[i]->pval;
-		t_test2_destroy(ttest2[i]);
+		katss_stats_iterations(1);
 	}
 
-	/* Clean up and return */
-	free(ttest2);
-	return enrichments;
+	/* Finalize the bootstrap */
+	return finish_bootstrap(stats, opts);
 
 exit_error_probs:
 	katss_free_enrichments(shuf);
 exit_error:
-	katss_free_counter(test_counts);
-	katss_free_counter(mono_counts);
-	katss_free_counter(dint_counts);
-	for(uint64_t i=0; i<total; i++)
-		t_test2_destroy(ttest2[i]);
-	free(ttest2);
+	katss_release_counter(test_counts);
+	katss_release_counter(mono_counts);
+	katss_release_counter(dint_counts);
+	free_bootstrap_stats(stats);
 	return NULL;
 }
 
-KatssData *
-katss_enrichment(const char *test, const char *ctrl, KatssOptions *opts)
+static KatssData *
+enrichment_dataset(const char *test, const char *ctrl, KatssOptions *opts)
 {
 	/* Make sure test file was passed */
 	if(test == NULL)
@@ -597,6 +922,12 @@ katss_enrichment(const char *test, const char *ctrl, KatssOptions *opts)
 	if(katss_parse_options(opts) != 0)
 		return NULL;
 
+	/* Enrichments are of forward-strand counts */
+	if(opts->canonical && opts->enable_warnings)
+		error_message("katss_enrichment: canonical counts are only supported by katss_count");
+	if(opts->canonical)
+		return NULL;
+
 	/* Ensure control file exists if not using a probabilistic algo */
 	if(ctrl == NULL && opts->probs_algo == KATSS_PROBS_NONE && opts->enable_warnings)
 		error_message("katss_enrichment: If no probabilistic algorithm is set,"
@@ -606,6 +937,12 @@ katss_enrichment(const char *test, const char *ctrl, KatssOptions *opts)
 	if(ctrl && opts->probs_algo != KATSS_PROBS_NONE && opts->enable_warnings)
 		warning_message("katss_enrichment: Ignoring `ctrl=(%s)'",ctrl);
 
+	/* Counter files only stand in for datasets for plain enrichments, bootstraps resampling
+	   their counts */
+	if(opts->probs_algo != KATSS_PROBS_NONE &&
+	   katss_reject_counter_files(test, NULL, opts, "katss_enrichment"))
+		return NULL;
+
 	/* BEGIN COMPUTATION: No bootstrap */
 	KatssData *data = NULL;
 	if(opts->bootstrap_iters == 0) {
@@ -617,15 +954,23 @@ katss_enrichment(const char *test, const char *ctrl, KatssOptions *opts)
 		default: return NULL; // silence compiler warnings
 		}
 
+	/* BEGIN COMPUTATION: bootstrap of saved counts */
+	} else if(opts->probs_algo == KATSS_PROBS_NONE && (katss_is_saved(test) ||
+	                                                   katss_is_saved(ctrl))) {
+		data = bootstrap_saved(test, ctrl, opts);
+
 	/* BEGIN COMPUTATION: bootstrap */
 	} else {
+		/* Every iteration samples the same files again */
+		int loaded = katss_preload_files(test, opts->probs_algo ? NULL : ctrl, opts);
 		switch(opts->probs_algo) {
 		case KATSS_PROBS_NONE:     data = bootstrap_regular(test, ctrl, opts); break;
 		case KATSS_PROBS_REGULAR:  data = bootstrap_probs(test, opts);         break;
 		case KATSS_PROBS_USHUFFLE: data = bootstrap_ushuffle(test, opts);      break;
 		case KATSS_PROBS_BOTH:     data = bootstrap_both(test, opts);          break;
-		default: return NULL; // silence compiler warnings
+		default: break;
 		}
+		katss_unload_files(test, opts->probs_algo ? NULL : ctrl, loaded);
 	}
 
 	/* If data is NULL, return NULL */
@@ -633,9 +978,321 @@ katss_enrichment(const char *test, const char *ctrl, KatssOptions *opts)
 		return NULL;
 
 	/* Sort if necessary */
-	if(opts->sort_enrichments)
-		qsort(data->kmers, data->num_kmers, sizeof *data->kmers, compare);
+	if(opts->sort_enrichments || opts->top_kmers)
+		katss_sort_kdata(data, false, opts->top_kmers, opts->threads);
 
 	/* Return data! */
 	return data;
 }
+
+KatssData *
+katss_enrichment(const char *test, const char *ctrl, KatssOptions *opts)
+{
+	KatssStats *stats = katss_start_stats(opts);
+	return katss_stop_stats(stats, enrichment_dataset(test, ctrl, opts));
+}
+
+KatssData *
+katss_enrichment_files(const char *const *test, int num_test, const char *const *ctrl, int num_ctrl,
+                       KatssOptions *opts)
+{
+	char *test_name = katss_group_paths(test, num_test);
+	if(test_name == NULL)
+		return NULL;
+
+	/* No control files is the same as a NULL control file, but a NULL path among them isn't */
+	char *ctrl_name = katss_group_paths(ctrl, num_ctrl);
+	KatssData *data = NULL;
+	if(ctrl_name != NULL || ctrl == NULL || num_ctrl < 1)
+		data = katss_enrichment(test_name, ctrl_name, opts);
+	katss_ungroup_paths(ctrl_name);
+	katss_ungroup_paths(test_name);
+	return data;
+}
+
+/**
+ * @brief Jobs of `num_jobs` tasks sharing the `num_tests` tests of a batch, each with its share
+ * of `opts->threads`.
+ */
+static struct batch_job *
+init_batch_jobs(const char *const *tests, KatssData **data, int num_tests, KatssOptions *opts,
+                int num_jobs)
+{
+	struct batch_job *jobs = s_calloc(num_jobs, sizeof *jobs);
+	for(int j=0; j<num_jobs; j++) {
+		jobs[j].tests = tests;
+		jobs[j].data = data;
+		jobs[j].first = j;
+		jobs[j].stride = num_jobs;
+		jobs[j].num_tests = num_tests;
+		jobs[j].opts = *opts;
+		jobs[j].opts.threads = MAX2(opts->threads / num_jobs, 1);
+	}
+	return jobs;
+}
+
+/**
+ * @brief Enrichments of the tests of a batch job against the counts of the control, bootstrapped
+ * by drawing their counts as `bootstrap_saved` does if there are iterations.
+ */
+static int
+batch_counts(void *arg)
+{
+	struct batch_job *job = arg;
+	KatssOptions *opts = &job->opts;
+	for(int t=job->first; t<job->num_tests; t+=job->stride) {
+		if(opts->bootstrap_iters == 0) {
+			job->data[t] = enrichments_against(job->tests[t], job->ctrl_counts, opts);
+		} else {
+			bool owned;
+			KatssCounter *test_counts = dataset_counts(job->tests[t], opts, &owned);
+			if(test_counts != NULL)
+				job->data[t] = bootstrap_counts(test_counts, job->ctrl_counts, opts);
+			drop_counts(test_counts, owned);
+		}
+		if(job->data[t] == NULL)
+			return 1;
+	}
+	return 0;
+}
+
+/**
+ * @brief Count the replicates of the current pass of every test of a batch job, a test at a
+ * time, and add them to the statistics of the test against the control replicates of the pass.
+ */
+static int
+batch_replicates(void *arg)
+{
+	struct batch_job *job = arg;
+	KatssOptions *opts = &job->opts;
+	int sample = opts->bootstrap_poisson ? 0 : opts->bootstrap_sample;
+	uint64_t total = 1ULL << (2*opts->kmer);
+	for(int t=job->first; t<job->num_tests; t+=job->stride) {
+		const char *test = job->tests[t];
+		bootstrap_stats *stats = job->stats[t];
+		unsigned int seed = job->seed;
+		for(int r=0; r<job->num; r++)
+			job->test_reps[r] = katss_acquire_file_counter(opts->kmer, test);
+		int ret = katss_count_kmers_replicates_mt(test, job->test_reps, job->num, sample, &seed,
+		                                          opts->threads);
+
+		for(int r=0; ret == 0 && r<job->num; r++) {
+			/* Update the t-test aggregates */
+			table_values(job->test_reps[r], stats->test_vals, true);
+			table_values(job->ctrl_reps[r], stats->ctrl_vals, true);
+			t_test2_array_update(stats->tests, stats->test_vals, stats->ctrl_vals);
+
+			for(uint64_t k=0; k<total; k++) {
+				if(!isnan(stats->test_vals[k]) && !isnan(stats->ctrl_vals[k]))
+					running_stdev(stats->test_vals[k]/stats->ctrl_vals[k], &stats->rval_mean[k],
+					              &stats->rval_M2[k], job->iter+r+1);
+			}
+		}
+
+		for(int r=0; r<job->num; r++) {
+			katss_release_counter(job->test_reps[r]);
+			job->test_reps[r] = NULL;
+		}
+		if(ret != 0)
+			return ret;
+	}
+	return 0;
+}
+
+/**
+ * @brief Enrichments of tests against the counts of the control, which is counted or loaded
+ * once for all of them. The tests are spread over up to `opts->threads` tasks.
+ */
+static int
+batch_of_counts(const char *const *tests, KatssData **data, int num_tests, const char *ctrl,
+                KatssOptions *opts)
+{
+	bool ctrl_owned;
+	KatssCounter *ctrl_counts = dataset_counts(ctrl, opts, &ctrl_owned);
+	if(ctrl_counts == NULL)
+		return 1;
+
+	int num_jobs = MIN2(num_tests, MAX2(opts->threads, 1));
+	struct batch_job *jobs = init_batch_jobs(tests, data, num_tests, opts, num_jobs);
+	for(int j=0; j<num_jobs; j++)
+		jobs[j].ctrl_counts = ctrl_counts;
+	int ret = katss_run_jobs(batch_counts, jobs, sizeof *jobs, num_jobs);
+
+	free(jobs);
+	drop_counts(ctrl_counts, ctrl_owned);
+	return ret;
+}
+
+/**
+ * @brief Bootstrap enrichments of tests sampled from their reads, as `bootstrap_regular` gives
+ * them. Every pass over the files counts the replicates of the control once, which every test
+ * shares, while the tests are counted on up to `opts->threads` tasks, as many as the tables of
+ * their replicates fit in `opts->memory_budget`. The statistics of every test are kept until the
+ * last pass.
+ */
+static int
+batch_of_reads(const char *const *tests, KatssData **data, int num_tests, const char *ctrl,
+               KatssOptions *opts)
+{
+	unsigned int test_seed = opts->seed;
+	unsigned int ctrl_seed = skip_seeds(opts->seed, opts->bootstrap_iters);
+	unsigned int kmer      = opts->kmer;
+	int sample             = opts->bootstrap_poisson ? 0 : opts->bootstrap_sample;
+	int threads            = MAX2(opts->threads, 1);
+	uint64_t total    = 1ULL << (2*kmer);
+
+	/* Passes hold as many iterations as they would for a single test, with room for the
+	   replicates of the control and of every task */
+	int batch = katss_replicate_batch(kmer, 2, opts->bootstrap_iters, opts->memory_budget);
+	uint64_t budget = opts->memory_budget ? opts->memory_budget : KATSS_REPLICATES_MAX_BYTES;
+	uint64_t room = budget / (total * sizeof(uint32_t) * batch);
+	int num_jobs = MIN2(num_tests, threads);
+	if((uint64_t)num_jobs >= room)
+		num_jobs = (int)MAX2(room, 2) - 1;
+
+	struct batch_job *jobs = init_batch_jobs(tests, data, num_tests, opts, num_jobs);
+	bootstrap_stats **stats = s_malloc(num_tests * sizeof *stats);
+	for(int t=0; t<num_tests; t++)
+		stats[t] = init_bootstrap_stats(total);
+	KatssCounter **ctrl_reps = s_calloc(batch, sizeof *ctrl_reps);
+	for(int j=0; j<num_jobs; j++) {
+		jobs[j].stats = stats;
+		jobs[j].ctrl_reps = ctrl_reps;
+		jobs[j].test_reps = s_calloc(batch, sizeof *jobs[j].test_reps);
+	}
+
+	/* Only the control is kept in memory, the tests being too many to, but they are indexed */
+	KatssOptions streamed = *opts;
+	streamed.preload_bytes = 0;
+	int *loaded = s_malloc(num_tests * sizeof *loaded);
+	for(int t=0; t<num_tests; t++)
+		loaded[t] = katss_preload_files(tests[t], NULL, &streamed);
+	int ctrl_loaded = katss_preload_files(NULL, ctrl, opts);
+
+	/* Compute bootstrap values, every test drawing the replicates of a pass from the same seeds,
+	   as each would for a single test */
+	int ret = 0;
+	katss_stats_lap();
+	for(int i=0; ret == 0 && i<opts->bootstrap_iters; i+=batch) {
+		int num = MIN2(batch, opts->bootstrap_iters - i);
+		for(int j=0; j<num_jobs; j++) {
+			jobs[j].iter = i;
+			jobs[j].num = num;
+			jobs[j].seed = test_seed;
+		}
+		test_seed = skip_seeds(test_seed, num);
+		for(int r=0; r<num; r++)
+			ctrl_reps[r] = katss_acquire_file_counter(kmer, ctrl);
+		ret = katss_count_kmers_replicates_mt(ctrl, ctrl_reps, num, sample, &ctrl_seed, threads);
+		if(ret == 0)
+			ret = katss_run_jobs(batch_replicates, jobs, sizeof *jobs, num_jobs);
+
+		/* Free the counters */
+		for(int r=0; r<num; r++) {
+			katss_release_counter(ctrl_reps[r]);
+			ctrl_reps[r] = NULL;
+		}
+
+		katss_stats_iterations(num);
+	}
+	katss_unload_files(NULL, ctrl, ctrl_loaded);
+	for(int t=0; t<num_tests; t++)
+		katss_unload_files(tests[t], NULL, loaded[t]);
+	free(loaded);
+
+	/* Finalize the bootstraps */
+	for(int t=0; t<num_tests; t++) {
+		if(ret == 0)
+			data[t] = finish_bootstrap(stats[t], opts);
+		else
+			free_bootstrap_stats(stats[t]);
+	}
+	for(int j=0; j<num_jobs; j++)
+		free(jobs[j].test_reps);
+	free(ctrl_reps);
+	free(stats);
+	free(jobs);
+	return ret;
+}
+
+static KatssData **
+enrichment_batch(const char *const *tests, int num_tests, const char *ctrl, KatssOptions *opts)
+{
+	/* Make sure every test file was passed */
+	if(tests == NULL || num_tests < 1)
+		return NULL;
+	for(int t=0; t<num_tests; t++) {
+		if(tests[t] == NULL)
+			return NULL;
+	}
+
+	/* Parse the options */
+	if(katss_parse_options(opts) != 0)
+		return NULL;
+
+	/* Only plain enrichments of forward-strand counts have a control to share */
+	if(opts->enable_warnings && (opts->canonical || opts->probs_algo != KATSS_PROBS_NONE))
+		error_message("katss_enrichment_batch: only enrichments with no probabilistic algorithm"
+		              " and no canonical counts are batched");
+	if(opts->enable_warnings && ctrl == NULL)
+		error_message("katss_enrichment_batch: `ctrl' can't be NULL");
+	if(opts->canonical || opts->probs_algo != KATSS_PROBS_NONE || ctrl == NULL)
+		return NULL;
+
+	/* Tests are bootstrapped from their reads unless either them or the control are saved as
+	   counts, as with `katss_enrichment`, and the other tests are enriched against its counts */
+	KatssData **data = s_calloc(num_tests, sizeof *data);
+	const char **group = s_malloc(num_tests * sizeof *group);
+	KatssData **group_data = s_malloc(num_tests * sizeof *group_data);
+	int *indices = s_malloc(num_tests * sizeof *indices);
+	bool all_counts = opts->bootstrap_iters == 0 || katss_is_saved(ctrl);
+	int ret = 0;
+	for(int reads=0; reads<2 && ret == 0; reads++) {
+		int num = 0;
+		for(int t=0; t<num_tests; t++) {
+			bool counts = all_counts || katss_is_saved(tests[t]);
+			if(counts == !reads)
+				indices[num++] = t;
+		}
+		if(num == 0)
+			continue;
+
+		for(int g=0; g<num; g++) {
+			group[g] = tests[indices[g]];
+			group_data[g] = NULL;
+		}
+		ret = reads ? batch_of_reads(group, group_data, num, ctrl, opts)
+		            : batch_of_counts(group, group_data, num, ctrl, opts);
+		for(int g=0; g<num; g++)
+			data[indices[g]] = group_data[g];
+	}
+	free(indices);
+	free(group_data);
+	free(group);
+
+	/* A test that failed fails the batch */
+	if(ret != 0) {
+		for(int t=0; t<num_tests; t++) {
+			if(data[t] != NULL)
+				katss_free_kdata(data[t]);
+		}
+		free(data);
+		return NULL;
+	}
+
+	/* Sort if necessary */
+	for(int t=0; t<num_tests && (opts->sort_enrichments || opts->top_kmers); t++)
+		katss_sort_kdata(data[t], false, opts->top_kmers, opts->threads);
+
+	return data;
+}
+
+KatssData **
+katss_enrichment_batch(const char *const *tests, int num_tests, const char *ctrl,
+                       KatssOptions *opts)
+{
+	KatssStats *stats = katss_start_stats(opts);
+	KatssData **data = enrichment_batch(tests, num_tests, ctrl, opts);
+	katss_stop_stats(stats, data != NULL ? data[0] : NULL);
+	return data;
+}
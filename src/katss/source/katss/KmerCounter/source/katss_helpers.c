@@ -1,10 +1,19 @@
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
 #include <math.h>
 #include <time.h>
 
 #include "memory_utils.h"
 #include "katss.h"
+#include "counter.h"
+#include "katss_core.h"
+#include "katss_helpers.h"
+#include "seqfile.h"
+
+static char **counter_paths(const char *path, int *num_paths);
+static void free_paths(char **paths, int num_paths);
 
 void
 katss_init_options(KatssOptions *opts)
@@ -14,26 +23,56 @@ katss_init_options(KatssOptions *opts)
 	opts->threads = 1;
 	opts->normalize = false;
 	opts->sort_enrichments = true;
+	opts->top_kmers = 0;
 
 	opts->bootstrap_iters = 0;
 	opts->bootstrap_sample = 25000;
+	opts->bootstrap_poisson = false;
+	opts->memory_budget = 0;
 
 	opts->probs_algo = KATSS_PROBS_NONE;
 	opts->probs_ntprec = -1;
 	opts->seed = -1;
 
+	opts->preload_bytes = 0;
+	opts->index_reads = false;
+	opts->spool_bytes = 0;
+
+	opts->counter_type = KATSS_COUNTER_EXACT;
+	opts->max_table_bytes = 0;
+	opts->min_count = 0;
+	opts->canonical = false;
+
 	opts->enable_warnings = true;
 	opts->verbose_output = false;
+	opts->collect_stats = false;
 }
 
 int
 katss_parse_options(KatssOptions *opts)
 {
 	/*================= Catch all possible errors in options =================*/
-	/* Check that k-mer is between 1-16 */
-	if((opts->kmer < 1 || 16 < opts->kmer) && opts->enable_warnings)
-		error_message("KatssOptions: kmer=(%d) must be between 1-16", opts->kmer);
-	if(opts->kmer < 1 || 16 < opts->kmer)
+	/* Check that k-mer is between 1-32 */
+	if((opts->kmer < 1 || 32 < opts->kmer) && opts->enable_warnings)
+		error_message("KatssOptions: kmer=(%d) must be between 1-32", opts->kmer);
+	if(opts->kmer < 1 || 32 < opts->kmer)
+		return 1;
+
+	/* K-mers longer than 16 and sketches are only counted in full, none of the other
+	   algorithms apply */
+	bool plain = opts->probs_algo == KATSS_PROBS_NONE && opts->bootstrap_iters == 0;
+	bool listed = katss_listed_kmers(opts);
+	if(listed && !plain && opts->enable_warnings)
+		error_message("KatssOptions: kmer=(%d) above %d or a sketch counter can't be "
+		              "bootstrapped or used with probs_algo", opts->kmer, KATSS_DENSE_KMER);
+	if(listed && !plain)
+		return 1;
+
+	/* Both strands are only counted in full as well */
+	if(opts->canonical && !plain && opts->enable_warnings)
+		error_message("KatssOptions: canonical counts can't be bootstrapped or used with "
+		              "probs_algo");
+	if(opts->canonical && !plain)
 		return 1;
 
 	/* Check that iters is within range */
@@ -43,9 +82,9 @@ katss_parse_options(KatssOptions *opts)
 		return 1;
 	
 	/* Check that iters is less than 4^k */
-	if(opts->iters > 1ULL << (2*opts->kmer))
+	if(opts->kmer < 32 && opts->iters > 1ULL << (2*opts->kmer))
 		error_message("KatssOptions: iters=(%d) must be less than 4^kmer", opts->iters);
-	if(opts->iters > 1ULL << (2*opts->kmer))
+	if(opts->kmer < 32 && opts->iters > 1ULL << (2*opts->kmer))
 		return 1;
 
 	/* Check that threads is greater than 0 */
@@ -65,6 +104,11 @@ katss_parse_options(KatssOptions *opts)
 		error_message("KatssOptions: bootstrap_sample=(%d) must be in range of 1-100000", opts->bootstrap_sample);
 	if(opts->bootstrap_sample < 1 || opts->bootstrap_sample > 100000)
 		return 1;
+
+	/* Statistics are only collected when compiled in, which isn't worth failing over */
+	if(!KATSS_STATS && opts->collect_stats && opts->enable_warnings)
+		warning_message("KatssOptions: collect_stats is ignored, katss was built without "
+		                "KATSS_WITH_STATS");
 	
 	/*================= Update values =================*/
 	if(opts->probs_ntprec == -1)
@@ -79,17 +123,264 @@ katss_parse_options(KatssOptions *opts)
 KatssData *
 katss_init_kdata(int kmer)
 {
-	uint64_t total = 1ULL << (2*kmer);
+	return katss_alloc_kdata(1ULL << (2*kmer));
+}
+
+KatssData *
+katss_alloc_kdata(uint64_t num_kmers)
+{
 	KatssData *kdata = s_malloc(sizeof *kdata);
-	kdata->num_kmers = total;
-	kdata->kmers = s_calloc(total, sizeof *kdata->kmers);
+	kdata->num_kmers = num_kmers;
+	kdata->kmers = s_calloc(MAX2(num_kmers, 1), sizeof *kdata->kmers);
+	kdata->stats = NULL;
 
 	return kdata;
 }
 
+bool
+katss_listed_kmers(const KatssOptions *opts)
+{
+	return opts->kmer > KATSS_DENSE_KMER || opts->counter_type == KATSS_COUNTER_SKETCH;
+}
+
+KatssCounter *
+katss_count_listed_kmers(const char *path, SeqFile file, const KatssOptions *opts)
+{
+	KatssCounter *counter;
+	if(opts->counter_type == KATSS_COUNTER_SKETCH)
+		counter = katss_init_sketch_counter(opts->kmer, opts->max_table_bytes);
+	else
+		counter = katss_init_counter(opts->kmer);
+	if(counter == NULL)
+		return NULL;
+	katss_limit_counter(counter, opts->max_table_bytes, opts->min_count);
+	int ret = opts->canonical ? katss_count_canonical(path, file, counter, opts->threads)
+	                          : katss_count_multi(path, file, &counter, 1, NULL, opts->threads);
+	if(ret != 0) {
+		katss_free_counter(counter);
+		return NULL;
+	}
+	return counter;
+}
+
+KatssCounter *
+katss_saved_counts(const char *path, const KatssOptions *opts, bool *failed)
+{
+	*failed = false;
+	/* A counter named in place of the dataset gives a copy of its counts */
+	bool named;
+	KatssCounter *counter = katss_named_counts(path, opts->threads, &named);
+	int num_paths = 0;
+	char **paths = NULL;
+	if(!named) {
+		paths = counter_paths(path, &num_paths);
+		if(num_paths == 0)
+			return NULL;
+		if(num_paths < 0) {
+			if(opts->enable_warnings)
+				error_message("katss: `%s' groups counter files with sequence files", path);
+		} else {
+			counter = katss_merge_counter_files((const char *const *)paths, num_paths,
+			                                    opts->threads);
+		}
+	}
+	if(counter != NULL && counter->kmer != opts->kmer) {
+		if(opts->enable_warnings)
+			error_message("katss: `%s' counts k-mers of %u bases, not kmer=(%u)", path,
+			              counter->kmer, opts->kmer);
+		katss_free_counter(counter);
+		counter = NULL;
+	}
+	free_paths(paths, num_paths);
+	*failed = counter == NULL;
+	return counter;
+}
+
+bool
+katss_is_saved(const char *path)
+{
+	if(katss_is_named(path))
+		return true;
+	int num_paths;
+	char **paths = counter_paths(path, &num_paths);
+	free_paths(paths, num_paths);
+	return num_paths != 0;
+}
+
+bool
+katss_reject_counter_files(const char *test, const char *ctrl, const KatssOptions *opts,
+                           const char *caller)
+{
+	const char *saved = NULL;
+	if(katss_is_saved(test))
+		saved = test;
+	else if(katss_is_saved(ctrl))
+		saved = ctrl;
+	if(saved != NULL && opts->enable_warnings)
+		error_message("%s: `%s' holds counts, and no sequences to sample, shuffle, or "
+		              "recount", caller, saved);
+	return saved != NULL;
+}
+
+int
+katss_preload_files(const char *test, const char *ctrl, const KatssOptions *opts)
+{
+	int loaded = 0;
+	if(opts->preload_bytes != 0) {
+		if(test != NULL && katss_preload_file(test, opts->preload_bytes) == 0)
+			loaded |= 1;
+		if(ctrl != NULL && katss_preload_file(ctrl, opts->preload_bytes) == 0)
+			loaded |= 2;
+		if(opts->verbose_output && test != NULL && !(loaded & 1))
+			warning_message("katss: streaming `%s', it could not be kept in memory", test);
+		if(opts->verbose_output && ctrl != NULL && !(loaded & 2))
+			warning_message("katss: streaming `%s', it could not be kept in memory", ctrl);
+	}
+
+	/* Gzip files streamed on several threads are inflated on all of them after the first pass */
+	if(opts->threads > 1) {
+		if(test != NULL && !(loaded & 1) && seqfindex(test) == 0)
+			loaded |= 16;
+		if(ctrl != NULL && !(loaded & 2) && seqfindex(ctrl) == 0)
+			loaded |= 32;
+	}
+
+	/* Files kept in memory are sampled from there */
+	if(!opts->index_reads)
+		return loaded;
+	if(test != NULL && !(loaded & 1) && katss_index_file(test) == 0)
+		loaded |= 4;
+	if(ctrl != NULL && !(loaded & 2) && katss_index_file(ctrl) == 0)
+		loaded |= 8;
+	if(opts->verbose_output && test != NULL && !(loaded & 5))
+		warning_message("katss: streaming `%s', its reads could not be indexed", test);
+	if(opts->verbose_output && ctrl != NULL && !(loaded & 10))
+		warning_message("katss: streaming `%s', its reads could not be indexed", ctrl);
+	return loaded;
+}
+
+void
+katss_unload_files(const char *test, const char *ctrl, int loaded)
+{
+	if(loaded & 1)
+		katss_unload_file(test);
+	if(loaded & 2)
+		katss_unload_file(ctrl);
+	if(loaded & 4)
+		katss_unindex_file(test);
+	if(loaded & 8)
+		katss_unindex_file(ctrl);
+	if(loaded & 16)
+		seqfunindex(test);
+	if(loaded & 32)
+		seqfunindex(ctrl);
+}
+
+char *
+katss_group_paths(const char *const *paths, int num_paths)
+{
+	if(paths == NULL || num_paths < 1)
+		return NULL;
+	for(int i=0; i<num_paths; i++) {
+		if(paths[i] == NULL)
+			return NULL;
+	}
+
+	/* A single file is read as it is, keeping its index and access points */
+	size_t size = strlen(paths[0]) + 32;
+	char *name = s_malloc(size);
+	if(num_paths == 1) {
+		strcpy(name, paths[0]);
+		return name;
+	}
+
+	/* Names taken by other groups, e.g. of another thread, are skipped */
+	int id = 0;
+	do {
+		snprintf(name, size, "<group %d: %s>", id++, paths[0]);
+	} while(katss_group_files(name, paths, num_paths) == 1);
+	return name;
+}
+
+void
+katss_ungroup_paths(char *name)
+{
+	if(name == NULL)
+		return;
+	katss_ungroup_files(name);
+	free(name);
+}
+
 void
 katss_free_kdata(KatssData *data)
 {
+	if(data->stats != NULL)
+		free(data->stats->iteration_seconds);
+	free(data->stats);
 	free(data->kmers);
 	free(data);
 }
+
+int
+katss_replicate_batch(unsigned int kmer, int num_tables, int iters, uint64_t budget)
+{
+	uint64_t table_bytes = (UINT64_C(1) << 2*kmer) * sizeof(uint32_t);
+	budget = budget ? budget : KATSS_REPLICATES_MAX_BYTES;
+	uint64_t batch = budget / (table_bytes * MAX2(num_tables, 1));
+	return (int)MAX2(MIN2(batch, (uint64_t)MAX2(iters, 1)), 1);
+}
+
+int
+katss_run_jobs(int (*func)(void *), void *jobs, size_t size, int num)
+{
+	if(num == 1)
+		return func(jobs);
+
+	KatssTaskGroup *group = katss_init_task_group();
+	for(int i=0; i<num; i++)
+		katss_submit_task(group, func, (char *)jobs + i * size);
+	return katss_wait_task_group(group);
+}
+
+/**
+ * @brief Counter files the dataset `path` is made of: `path` itself if it is one, or the files
+ * grouped under it if they all are. Sets `num_paths` to their number, 0 if it is none of them,
+ * or -1 if the group mixes counter files and sequence files. Free with `free_paths`.
+ */
+static char **
+counter_paths(const char *path, int *num_paths)
+{
+	*num_paths = 0;
+	if(path == NULL)
+		return NULL;
+
+	int num_members;
+	char **paths = katss_group_members(path, &num_members);
+	if(paths == NULL) {
+		if(!katss_is_counter_file(path))
+			return NULL;
+		paths = s_malloc(sizeof *paths);
+		paths[0] = s_malloc(strlen(path) + 1);
+		strcpy(paths[0], path);
+		*num_paths = 1;
+		return paths;
+	}
+
+	int num_saved = 0;
+	for(int i=0; i<num_members; i++)
+		num_saved += katss_is_counter_file(paths[i]) != 0;
+	*num_paths = num_saved == 0 ? 0 : num_saved == num_members ? num_members : -1;
+	if(*num_paths <= 0) {
+		free_paths(paths, num_members);
+		return NULL;
+	}
+	return paths;
+}
+
+static void
+free_paths(char **paths, int num_paths)
+{
+	for(int i=0; i<num_paths; i++)
+		free(paths[i]);
+	free(paths);
+}
@@ -2,6 +2,7 @@
 #define KATSS_HELPERS_H
 
 #include "katss.h"
+#include "counter.h"
 
 /**
  * @brief Parse the KatssOptions options to ensure they are correct.
@@ -22,4 +23,201 @@ katss_parse_options(KatssOptions *opts);
 KatssData *
 katss_init_kdata(int kmer);
 
+
+/**
+ * @brief Initialize a KatssData struct with `num_kmers` entries, for k-mers too long to have an
+ * entry for every one of them
+ * 
+ * @param num_kmers Number of entries
+ * @return KatssData* Pointer to KatssData struct
+ */
+KatssData *
+katss_alloc_kdata(uint64_t num_kmers);
+
+
+/**
+ * @brief Whether the options count k-mers into a table that only lists some of them, long
+ * k-mers or a sketch, rather than a table of every k-mer.
+ */
+bool
+katss_listed_kmers(const KatssOptions *opts);
+
+
+/**
+ * @brief Count the k-mers of `path` for options where `katss_listed_kmers` holds, in a sketch
+ * if `counter_type` asks for one, or else a table bounded by the `max_table_bytes` and
+ * `min_count` options.
+ * 
+ * @param path File to count
+ * @param file File already open to count instead of `path`, or NULL
+ * @param opts Options of the count
+ * @return KatssCounter* The counts, or NULL on error
+ */
+KatssCounter *
+katss_count_listed_kmers(const char *path, struct SeqFile *file, const KatssOptions *opts);
+
+
+/**
+ * @brief Counts saved in `path` with `katss_save_counter`, if it is a counter file, to use in
+ * place of counting a dataset. A group of counter files (see `katss_group_files`), e.g. of the
+ * shards of a dataset, gives their counts merged, and a counter named `path` with
+ * `katss_name_counter` a copy of its counts. Sets `failed` if it is a counter file that
+ * could not be loaded, a group mixing counter files and sequence files, or if its k-mers aren't
+ * of `opts->kmer` bases.
+ * 
+ * @return KatssCounter* The counts, to be freed with `katss_free_counter`, or NULL if `path`
+ * isn't a counter file or `failed` was set
+ */
+KatssCounter *
+katss_saved_counts(const char *path, const KatssOptions *opts, bool *failed);
+
+
+/**
+ * @brief Whether `path` (can be NULL) is a counter file, a group holding counter files or a named
+ * counter, whose counts `katss_saved_counts` gives.
+ */
+bool
+katss_is_saved(const char *path);
+
+
+/**
+ * @brief Whether `test` or `ctrl` (either can be NULL) is a counter file, giving an error from
+ * `caller` if so, for the computations that read the sequences of a dataset and not only its
+ * counts (bootstraps, shuffles, and recounts).
+ */
+bool
+katss_reject_counter_files(const char *test, const char *ctrl, const KatssOptions *opts,
+                           const char *caller);
+
+
+/**
+ * @brief Load the test and control files into memory if `opts->preload_bytes` allows it, see
+ * `katss_preload_file`, and index the ones that weren't if `opts->index_reads` is set, see
+ * `katss_index_file`. Gzip files that weren't loaded keep their access points when counting on
+ * several threads, see `seqfindex`. Either file can be NULL.
+ * 
+ * @return int Which files were loaded, 1 for test and 2 for control, indexed, 4 for test and
+ * 8 for control, and kept access points, 16 for test and 32 for control, to pass to
+ * `katss_unload_files`
+ */
+int
+katss_preload_files(const char *test, const char *ctrl, const KatssOptions *opts);
+
+
+/**
+ * @brief Unload and unindex the files `katss_preload_files` loaded and indexed, and drop the
+ * access points it kept.
+ */
+void
+katss_unload_files(const char *test, const char *ctrl, int loaded);
+
+
+/**
+ * @brief Name to read the `num_paths` files of `paths` under as a single dataset, grouping them
+ * under a name of their own (see `katss_group_files`) when there are several. Free it with
+ * `katss_ungroup_paths`.
+ * 
+ * @return char* The name, or NULL if there are no paths or one of them is NULL
+ */
+char *
+katss_group_paths(const char *const *paths, int num_paths);
+
+
+/**
+ * @brief Ungroup the files `katss_group_paths` grouped, and free their name. Does nothing if
+ * `name` is NULL.
+ */
+void
+katss_ungroup_paths(char *name);
+
+
+/**
+ * @brief Number of bootstrap iterations to hold at once, so their tables stay within `budget`
+ * bytes when every iteration holds `num_tables` k-mer tables, KATSS_REPLICATES_MAX_BYTES if
+ * `budget` is 0. At least 1, and at most `iters`.
+ */
+int
+katss_replicate_batch(unsigned int kmer, int num_tables, int iters, uint64_t budget);
+
+
+/**
+ * @brief Run `func` on each of the `num` jobs of `size` bytes in `jobs` at the same time on the
+ * pool, or on the calling thread if there is only one.
+ * 
+ * @return int The first non-zero return of `func`, or 0
+ */
+int
+katss_run_jobs(int (*func)(void *), void *jobs, size_t size, int num);
+
+
+/**
+ * @brief Sort the entries of `data` from highest to lowest count, or `rval` with NaN last,
+ * keeping ties in the order they were in, on `threads` threads. Keeps only the first `top` of
+ * them if `top` is not 0.
+ * 
+ * @param data Entries to sort
+ * @param by_count Sort by `count` instead of `rval`
+ * @param top Number of entries to keep, 0 to keep all of them
+ * @param threads Number of threads to sort on
+ */
+void
+katss_sort_kdata(KatssData *data, bool by_count, uint64_t top, int threads);
+
+
+/**
+ * @brief Rows of a KatssData added one at a time, keeping only the ones the options ask for
+ */
+typedef struct KatssRows KatssRows;
+
+
+/**
+ * @brief Start the rows of a result with `num_kmers` k-mers. Only the `opts->top_kmers` highest
+ * rows (or counts if `by_count`) are kept if it isn't 0, sorted as by `katss_sort_kdata`, and
+ * only the rows of k-mers counted at least `opts->min_count` times, in the order they are added.
+ * Only the rows kept take memory.
+ * 
+ * @param num_kmers Most rows that will be added
+ * @param by_count Rank rows by `count` instead of `rval`
+ * @param opts Options of the result
+ * @return KatssRows* Rows to add to with `katss_add_row`
+ */
+KatssRows *
+katss_init_rows(uint64_t num_kmers, bool by_count, const KatssOptions *opts);
+
+
+/**
+ * @brief Add the row `entry`, of a k-mer counted `count` times, leaving it out unless the options
+ * of `rows` keep it. Rows are added in the order of their k-mers.
+ */
+void
+katss_add_row(KatssRows *rows, const KatssDataEntry *entry, uint64_t count);
+
+
+/**
+ * @brief Rows kept of the ones added, freeing `rows`.
+ * 
+ * @return KatssData* The rows kept
+ */
+KatssData *
+katss_finish_rows(KatssRows *rows);
+
+
+/**
+ * @brief Start collecting the statistics of a run, if `opts->collect_stats` asks for them and
+ * katss was built with KATSS_WITH_STATS. Only one run collects them at a time, so a run started
+ * by another one (e.g. the counts of an enrichment) leaves them to it.
+ * 
+ * @return KatssStats* Statistics to pass to `katss_stop_stats`, NULL if none are collected
+ */
+KatssStats *
+katss_start_stats(const KatssOptions *opts);
+
+
+/**
+ * @brief Stop collecting `stats` and attach them to `data`, which is returned. Frees `stats`
+ * instead if `data` is NULL. Does nothing if `stats` is NULL.
+ */
+KatssData *
+katss_stop_stats(KatssStats *stats, KatssData *data);
+
 #endif
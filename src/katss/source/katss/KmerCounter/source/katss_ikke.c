@@ -2,23 +2,71 @@
 #include <stdlib.h>
 
 #include "katss.h"
+#include "katss_core.h"
 #include "katss_helpers.h"
 #include "memory_utils.h"
 
 #include "enrichments.h"
 
+/**
+ * @brief First iteration of IKKE when the test or control is a counter file. It is the most
+ * enriched k-mer of the counts, the iterations after it recount the sequences without the k-mers
+ * before, which a counter file doesn't have.
+ */
+static KatssData *
+saved_regular(const char *test, const char *ctrl, KatssOptions *opts)
+{
+	if(opts->iters > 1 || opts->kmer > KATSS_DENSE_KMER) {
+		if(opts->enable_warnings)
+			error_message("katss_ikke: Counter files only give the first iteration, of k-mers up "
+			              "to %d bases, as the next ones recount the sequences", KATSS_DENSE_KMER);
+		return NULL;
+	}
+
+	KatssData *data = NULL;
+	const char *paths[2] = { test, ctrl };
+	KatssCounter *counts[2] = { NULL, NULL };
+	for(int i=0; i<2; i++) {
+		bool failed;
+		counts[i] = katss_saved_counts(paths[i], opts, &failed);
+		if(counts[i] == NULL && !failed)
+			counts[i] = katss_count_kmers_mt(paths[i], opts->kmer, opts->threads);
+		if(counts[i] == NULL)
+			goto free_counts;
+	}
+
+	KatssEnrichment top = katss_top_enrichment(counts[0], counts[1], opts->normalize);
+	if((data = katss_alloc_kdata(1)) == NULL)
+		goto free_counts;
+	data->kmers[0].kmer = top.key;
+	data->kmers[0].rval = top.enrichment;
+	data->num_kmers = 1;
+
+free_counts:
+	katss_free_counter(counts[0]);
+	katss_free_counter(counts[1]);
+	return data;
+}
+
 static KatssData *
 regular(const char *test, const char *ctrl, KatssOptions *opts)
 {
+	if(katss_is_saved(test) || katss_is_saved(ctrl))
+		return saved_regular(test, ctrl, opts);
+
 	/* Compute iterative kmer knockout enrichments */
 	KatssEnrichments *enr;
-	enr = katss_ikke_mt(test, ctrl, opts->kmer, opts->iters, opts->normalize, opts->threads);
+	if(opts->counter_type == KATSS_COUNTER_SKETCH)
+		enr = katss_ikke_sketch_mt(test, ctrl, opts->kmer, opts->iters, opts->normalize,
+		                           opts->max_table_bytes, opts->threads);
+	else
+		enr = katss_ikke_mt(test, ctrl, opts->kmer, opts->iters, opts->normalize, opts->threads);
 	if(enr == NULL)
 		return NULL;
 
 	/* Move enrichments to data */
 	KatssData *data;
-	if((data = katss_init_kdata(opts->kmer)) == NULL)
+	if((data = katss_alloc_kdata(enr->num_enrichments)) == NULL)
 		goto exit;
 	for(uint64_t i=0; i<enr->num_enrichments; i++) {
 		data->kmers[i].kmer = enr->enrichments[i].key;
@@ -57,7 +105,8 @@ static KatssData *
 ushuffle(const char *test, KatssOptions *opts)
 {
 	KatssEnrichments *enr;
-	enr = katss_ikke_shuffle(test, opts->kmer, opts->probs_ntprec, opts->iters, opts->normalize);
+	enr = katss_ikke_shuffle_mt(test, NULL, opts->kmer, opts->probs_ntprec, opts->iters,
+	                            opts->normalize, opts->threads);
 	if(enr == NULL)
 		return NULL;
 	
@@ -105,8 +154,8 @@ bootstrap_both(const char *test, KatssOptions *opts)
 	return NULL;
 }
 
-KatssData *
-katss_ikke(const char *test, const char *ctrl, KatssOptions *opts)
+static KatssData *
+ikke_dataset(const char *test, const char *ctrl, KatssOptions *opts)
 {
 	/* Make sure test file was passed */
 	if(test == NULL)
@@ -115,6 +164,12 @@ katss_ikke(const char *test, const char *ctrl, KatssOptions *opts)
 	/* Parse the options */
 	if(katss_parse_options(opts) != 0)
 		return NULL;
+
+	/* Enrichments are of forward-strand counts */
+	if(opts->canonical && opts->enable_warnings)
+		error_message("katss_ikke: canonical counts are only supported by katss_count");
+	if(opts->canonical)
+		return NULL;
 	
 	/* Ensure control file exists if not using a probabilistic algo */
 	if(ctrl == NULL && opts->probs_algo == KATSS_PROBS_NONE && opts->enable_warnings)
@@ -125,24 +180,66 @@ katss_ikke(const char *test, const char *ctrl, KatssOptions *opts)
 	if(ctrl && opts->probs_algo != KATSS_PROBS_NONE && opts->enable_warnings)
 		warning_message("katss_enrichment: Ignoring `ctrl=(%s)'",ctrl);
 
+	/* Counter files only stand in for a dataset counted once, see `saved_regular` */
+	if((opts->bootstrap_iters != 0 || opts->probs_algo != KATSS_PROBS_NONE) &&
+	   katss_reject_counter_files(test, opts->probs_algo ? NULL : ctrl, opts, "katss_ikke"))
+		return NULL;
+
+	/* Every iteration recounts the files, unless they are indexed, which k-mers up to 12 are
+	   unless they are sketched */
+	int loaded = 0;
+	if((opts->probs_algo != KATSS_PROBS_NONE || opts->bootstrap_iters != 0 || opts->kmer > 12 ||
+	    opts->counter_type == KATSS_COUNTER_SKETCH) && !katss_is_saved(test) &&
+	   !katss_is_saved(ctrl))
+		loaded = katss_preload_files(test, opts->probs_algo ? NULL : ctrl, opts);
+
 	/* BEGIN COMPUTATION: No bootstrap */
+	KatssData *data = NULL;
 	if(opts->bootstrap_iters == 0) {
 		switch(opts->probs_algo) {
-		case KATSS_PROBS_NONE:     return regular(test, ctrl, opts);
-		case KATSS_PROBS_REGULAR:  return probs(test, opts);
-		case KATSS_PROBS_USHUFFLE: return ushuffle(test, opts);
-		case KATSS_PROBS_BOTH:     return both(test, opts);
-		default: return NULL;
+		case KATSS_PROBS_NONE:     data = regular(test, ctrl, opts); break;
+		case KATSS_PROBS_REGULAR:  data = probs(test, opts);         break;
+		case KATSS_PROBS_USHUFFLE: data = ushuffle(test, opts);      break;
+		case KATSS_PROBS_BOTH:     data = both(test, opts);          break;
+		default: break;
 		}
 
 	/* BEGIN COMPUTATION: bootstrap */
 	} else {
 		switch(opts->probs_algo) {
-		case KATSS_PROBS_NONE:     return bootstrap_regular(test, ctrl, opts);
-		case KATSS_PROBS_REGULAR:  return bootstrap_probs(test, opts);
-		case KATSS_PROBS_USHUFFLE: return bootstrap_ushuffle(test, opts);
-		case KATSS_PROBS_BOTH:     return bootstrap_both(test, opts);
-		default: return NULL;
+		case KATSS_PROBS_NONE:     data = bootstrap_regular(test, ctrl, opts); break;
+		case KATSS_PROBS_REGULAR:  data = bootstrap_probs(test, opts);         break;
+		case KATSS_PROBS_USHUFFLE: data = bootstrap_ushuffle(test, opts);      break;
+		case KATSS_PROBS_BOTH:     data = bootstrap_both(test, opts);          break;
+		default: break;
 		}
 	}
+
+	katss_unload_files(test, opts->probs_algo ? NULL : ctrl, loaded);
+	return data;
+}
+
+KatssData *
+katss_ikke(const char *test, const char *ctrl, KatssOptions *opts)
+{
+	KatssStats *stats = katss_start_stats(opts);
+	return katss_stop_stats(stats, ikke_dataset(test, ctrl, opts));
+}
+
+KatssData *
+katss_ikke_files(const char *const *test, int num_test, const char *const *ctrl, int num_ctrl,
+                 KatssOptions *opts)
+{
+	char *test_name = katss_group_paths(test, num_test);
+	if(test_name == NULL)
+		return NULL;
+
+	/* No control files is the same as a NULL control file, but a NULL path among them isn't */
+	char *ctrl_name = katss_group_paths(ctrl, num_ctrl);
+	KatssData *data = NULL;
+	if(ctrl_name != NULL || ctrl == NULL || num_ctrl < 1)
+		data = katss_ikke(test_name, ctrl_name, opts);
+	katss_ungroup_paths(ctrl_name);
+	katss_ungroup_paths(test_name);
+	return data;
 }
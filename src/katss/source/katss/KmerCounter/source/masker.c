@@ -0,0 +1,267 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "katss_core.h"
+#include "memory_utils.h"
+
+/* Occurrence of a removed sequence in the sequence being masked */
+struct MaskMatch {
+	uint32_t rank;    /** Position of the removed sequence in the list */
+	uint32_t length;  /** Length of the removed sequence */
+	size_t start;     /** Index of the first character of the occurrence */
+	size_t end;       /** Index of the last character of the occurrence */
+};
+typedef struct MaskMatch MaskMatch;
+
+struct KatssMasker {
+	char filetype;                     /** Type of file the masked sequences come from */
+	const katss_str_node_t *removed;   /** Sequences to cross out, in order */
+	bool automaton;                    /** If matches are found in a single pass, see below */
+	uint32_t num_states;               /** States of the automaton */
+	uint32_t states_size;              /** Room for states in the arrays below */
+	int32_t *next;                     /** Next state for every state and base, 4 per state */
+	int32_t *fail;                     /** Longest proper suffix of each state that is a state */
+	int32_t *rank;                     /** First removed sequence ending at each state, or -1 */
+	int32_t *output;                   /** Next state along `fail` with a rank, or -1 */
+	uint32_t *lengths;                 /** Length of the removed sequence of every rank */
+	uint64_t window;                   /** Power of two above the longest removed sequence */
+	size_t *ring;                      /** Index of each of the last `window` bases */
+	MaskMatch *matches;                /** Occurrences found in the sequence being masked */
+	size_t num_matches;                /** Number of occurrences in `matches` */
+	size_t matches_size;               /** Room for occurrences in `matches` */
+};
+/*
+Notes:
+A removed sequence made of bases only is found along with every other one through an Aho-Corasick
+automaton, in a single pass over the sequence. Crossing them out one after the other then only
+needs their occurrences: one is crossed out if none of its characters were crossed out by an
+earlier sequence, or an earlier occurrence of its own. Anything else is crossed out with
+`katss_cross_out`, as are one or two sequences, which `seqseq` skips through faster.
+*/
+
+static int32_t add_state(KatssMasker *masker);
+static void build_links(KatssMasker *masker);
+static inline void add_match(KatssMasker *masker, int32_t rank, uint64_t bases, size_t end);
+static int compare_matches(const void *a, const void *b);
+
+static const uint8_t nt_code[256] = {
+	['A'] = 1, ['a'] = 1, ['C'] = 2, ['c'] = 2, ['G'] = 3, ['g'] = 3,
+	['T'] = 4, ['t'] = 4, ['U'] = 4, ['u'] = 4,
+}; // code + 1, 0 for any other character
+
+
+KatssMasker *
+katss_init_masker(const katss_str_node_t *removed, char filetype)
+{
+	KatssMasker *masker = s_calloc(1, sizeof *masker);
+	masker->filetype = filetype;
+	masker->removed = removed;
+
+	/* Only sequences of bases can be matched by the automaton */
+	uint32_t num_removed = 0;
+	size_t longest = 0;
+	for(const katss_str_node_t *cur = removed; cur != NULL; cur = cur->next) {
+		size_t len = strlen(cur->str);
+		for(size_t i=0; i<len; i++) {
+			if(!nt_code[(unsigned char)cur->str[i]])
+				return masker;
+		}
+		if(len == 0 || len > 256) // `seqseq` only finds longer sequences at the very start
+			return masker;
+		longest = MAX2(longest, len);
+		num_removed++;
+	}
+	if(num_removed < 3)
+		return masker;
+
+	/* Trie of the removed sequences, the first one ending at a state gives it its rank */
+	masker->automaton = true;
+	masker->lengths = s_malloc(num_removed * sizeof *masker->lengths);
+	add_state(masker);
+	int32_t rank = 0;
+	for(const katss_str_node_t *cur = removed; cur != NULL; cur = cur->next, rank++) {
+		masker->lengths[rank] = strlen(cur->str);
+		int32_t state = 0;
+		for(const unsigned char *c = (const unsigned char *)cur->str; *c; c++) {
+			int code = nt_code[*c] - 1;
+			if(masker->next[4*state + code] < 0) {
+				int32_t child = add_state(masker);
+				masker->next[4*state + code] = child;
+			}
+			state = masker->next[4*state + code];
+		}
+		if(masker->rank[state] < 0)
+			masker->rank[state] = rank;
+	}
+	build_links(masker);
+
+	masker->window = 1;
+	while(masker->window < longest)
+		masker->window <<= 1;
+	masker->ring = s_malloc(masker->window * sizeof *masker->ring);
+
+	return masker;
+}
+
+
+void
+katss_mask(KatssMasker *masker, char *sequence)
+{
+	if(masker == NULL)
+		return;
+	if(!masker->automaton) {
+		for(const katss_str_node_t *cur = masker->removed; cur != NULL; cur = cur->next)
+			katss_cross_out(sequence, cur->str, masker->filetype);
+		return;
+	}
+
+	/* Find every occurrence the same way `seqseq` would, or `seqseqa` in fasta files, which skips
+	   headers and matches across newlines */
+	const bool fasta = masker->filetype == 'a';
+	const int32_t *next = masker->next;
+	const int32_t *ranks = masker->rank;
+	const int32_t *output = masker->output;
+	const uint64_t wrap = masker->window - 1;
+	size_t *ring = masker->ring;
+	bool header = false, overlapping = false;
+	size_t last_end = 0;
+	uint64_t bases = 0;
+	int32_t state = 0;
+	masker->num_matches = 0;
+	for(size_t i=0; sequence[i]; i++) {
+		unsigned char c = (unsigned char)sequence[i];
+		if(header) {
+			header = c != '\n';
+			continue;
+		}
+		if(!nt_code[c]) {
+			if(fasta && c == '\n')
+				continue;
+			header = fasta && c == '>';
+			state = 0;
+			continue;
+		}
+
+		ring[bases++ & wrap] = i;
+		state = next[4*state + nt_code[c] - 1];
+		for(int32_t s = ranks[state] >= 0 ? state : output[state]; s >= 0; s = output[s]) {
+			add_match(masker, ranks[s], bases, i);
+			overlapping |= masker->num_matches > 1 && masker->matches[masker->num_matches-1].start
+			                                          <= last_end;
+			last_end = i;
+		}
+	}
+
+	/* Occurrences that don't overlap are all crossed out, whatever the order */
+	MaskMatch *matches = masker->matches;
+	size_t num_matches = masker->num_matches;
+	if(overlapping)
+		qsort(matches, num_matches, sizeof *matches, compare_matches);
+	for(size_t m=0; m<num_matches; m++) {
+		size_t span = matches[m].end - matches[m].start + 1;
+		if(overlapping && memchr(sequence + matches[m].start, 'X', span) != NULL)
+			continue;
+		memset(sequence + matches[m].start, 'X', matches[m].length);
+	}
+}
+
+
+void
+katss_free_masker(KatssMasker *masker)
+{
+	if(masker == NULL)
+		return;
+	free(masker->next);
+	free(masker->fail);
+	free(masker->rank);
+	free(masker->output);
+	free(masker->lengths);
+	free(masker->ring);
+	free(masker->matches);
+	free(masker);
+}
+
+
+static int32_t
+add_state(KatssMasker *masker)
+{
+	if(masker->num_states == masker->states_size) {
+		masker->states_size = MAX2(2 * masker->states_size, 64);
+		masker->next = s_realloc(masker->next, 4 * masker->states_size * sizeof *masker->next);
+		masker->fail = s_realloc(masker->fail, masker->states_size * sizeof *masker->fail);
+		masker->rank = s_realloc(masker->rank, masker->states_size * sizeof *masker->rank);
+		masker->output = s_realloc(masker->output, masker->states_size * sizeof *masker->output);
+	}
+	int32_t state = masker->num_states++;
+	for(int c=0; c<4; c++)
+		masker->next[4*state + c] = -1;
+	masker->fail[state] = 0;
+	masker->rank[state] = -1;
+	masker->output[state] = -1;
+	return state;
+}
+
+
+/**
+ * @brief Link every state to its longest suffix in the trie, breadth first, and complete the
+ * transitions so none of them is missing.
+ */
+static void
+build_links(KatssMasker *masker)
+{
+	int32_t *queue = s_malloc(masker->num_states * sizeof *queue);
+	uint32_t head = 0, tail = 0;
+	for(int c=0; c<4; c++) {
+		int32_t child = masker->next[c];
+		if(child < 0) {
+			masker->next[c] = 0;
+			continue;
+		}
+		queue[tail++] = child;
+	}
+
+	while(head < tail) {
+		int32_t state = queue[head++];
+		int32_t fail = masker->fail[state];
+		masker->output[state] = masker->rank[fail] >= 0 ? fail : masker->output[fail];
+		for(int c=0; c<4; c++) {
+			int32_t child = masker->next[4*state + c];
+			if(child < 0) {
+				masker->next[4*state + c] = masker->next[4*fail + c];
+				continue;
+			}
+			masker->fail[child] = masker->next[4*fail + c];
+			queue[tail++] = child;
+		}
+	}
+	free(queue);
+}
+
+
+static inline void
+add_match(KatssMasker *masker, int32_t rank, uint64_t bases, size_t end)
+{
+	if(masker->num_matches == masker->matches_size) {
+		masker->matches_size = MAX2(2 * masker->matches_size, 256);
+		masker->matches = s_realloc(masker->matches,
+		                            masker->matches_size * sizeof *masker->matches);
+	}
+
+	/* The occurrence starts at the base its length before the last one */
+	MaskMatch *match = &masker->matches[masker->num_matches++];
+	match->rank = rank;
+	match->length = masker->lengths[rank];
+	match->start = masker->ring[(bases - match->length) & (masker->window - 1)];
+	match->end = end;
+}
+
+
+static int
+compare_matches(const void *a, const void *b)
+{
+	const MaskMatch *m1 = a, *m2 = b;
+	if(m1->rank != m2->rank)
+		return m1->rank < m2->rank ? -1 : 1;
+	return (m1->start > m2->start) - (m1->start < m2->start);
+}
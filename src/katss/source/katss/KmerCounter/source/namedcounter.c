@@ -0,0 +1,146 @@
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L) && !defined(__STDC_NO_THREADS__)
+#  include <threads.h>
+#else
+#  include <tinycthread.h>
+#endif
+
+#include "katss_core.h"
+#include "counter.h"
+#include "memory_utils.h"
+
+/* Counter whose counts are read under a name, as if it were a counter file */
+struct KatssNamedCounter {
+	char *name;                      /** Name the counts are read under */
+	KatssCounter *counter;           /** Counter taken over by `katss_name_counter` */
+	struct KatssNamedCounter *next;  /** Next named counter */
+};
+typedef struct KatssNamedCounter KatssNamedCounter;
+
+static KatssNamedCounter *named = NULL;
+static mtx_t named_lock;
+static once_flag named_once = ONCE_FLAG_INIT;
+
+static void init_named(void);
+static KatssNamedCounter *find_named(const char *name);
+
+/*
+Notes:
+Named counters are looked up where counter files are (see `katss_saved_counts`), so the counts,
+enrichments and first IKKE iteration of a dataset counted once are computed again from memory,
+e.g. by an R session holding the counter, instead of reading the file every time.
+
+Every reader gets a copy of the counts, since the enrichments count into and free the counters
+they read. Copying a dense table costs about as much as one pass over it, which is little next
+to reading the file again.
+*/
+
+
+/*==================================================================================================
+|                                         Public Functions                                         |
+==================================================================================================*/
+int
+katss_name_counter(const char *name, KatssCounter *counter)
+{
+	if(name == NULL || counter == NULL || counter->sketch != NULL || counter->removed != NULL)
+		return 2;
+	call_once(&named_once, init_named);
+
+	mtx_lock(&named_lock);
+	if(find_named(name) != NULL) {
+		mtx_unlock(&named_lock);
+		return 1;
+	}
+	KatssNamedCounter *entry = s_malloc(sizeof *entry);
+	entry->name = s_malloc(strlen(name) + 1);
+	strcpy(entry->name, name);
+	entry->counter = counter;
+	entry->next = named;
+	named = entry;
+	mtx_unlock(&named_lock);
+	return 0;
+}
+
+
+void
+katss_unname_counter(const char *name)
+{
+	if(name == NULL)
+		return;
+	call_once(&named_once, init_named);
+
+	mtx_lock(&named_lock);
+	KatssNamedCounter **link = &named;
+	while(*link != NULL && strcmp((*link)->name, name) != 0)
+		link = &(*link)->next;
+	KatssNamedCounter *entry = *link;
+	if(entry != NULL)
+		*link = entry->next;
+	mtx_unlock(&named_lock);
+
+	/* Readers copied the counts under the lock, none of them still reads the counter */
+	if(entry != NULL) {
+		katss_free_counter(entry->counter);
+		free(entry->name);
+		free(entry);
+	}
+}
+
+
+/*==================================================================================================
+|                                        Internal Functions                                        |
+==================================================================================================*/
+KatssCounter *
+katss_named_counts(const char *name, int threads, bool *is_named)
+{
+	*is_named = false;
+	if(name == NULL)
+		return NULL;
+	call_once(&named_once, init_named);
+
+	mtx_lock(&named_lock);
+	KatssNamedCounter *entry = find_named(name);
+	KatssCounter *counter = NULL;
+	if(entry != NULL) {
+		*is_named = true;
+		counter = katss_copy_counter(entry->counter, false, threads);
+	}
+	mtx_unlock(&named_lock);
+	return counter;
+}
+
+
+bool
+katss_is_named(const char *name)
+{
+	if(name == NULL)
+		return false;
+	call_once(&named_once, init_named);
+
+	mtx_lock(&named_lock);
+	bool found = find_named(name) != NULL;
+	mtx_unlock(&named_lock);
+	return found;
+}
+
+
+/*==================================================================================================
+|                                        Private Functions                                         |
+==================================================================================================*/
+static void
+init_named(void)
+{
+	mtx_init(&named_lock, mtx_plain);
+}
+
+
+static KatssNamedCounter *
+find_named(const char *name)
+{
+	KatssNamedCounter *entry = named;
+	while(entry != NULL && strcmp(entry->name, name) != 0)
+		entry = entry->next;
+	return entry;
+}
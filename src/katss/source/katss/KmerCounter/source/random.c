@@ -0,0 +1,149 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "katss_core.h"
+
+/*
+Notes:
+Draws come from xoshiro256**, whose state is built from the seed and a stream number through
+splitmix64. Code that samples reads uses the index of the read as the stream, so what is drawn
+for a read only depends on the seed and the read, not on which thread counted it or what that
+thread drew before, and no state is ever shared between threads.
+
+Binomial and Poisson draws are exact while their mean is below NORMAL_MEAN, counting geometric
+waiting times between successes or multiplying uniforms. Past it they take the normal of the same
+mean and variance, rounded, whose error is far below the spread of the draws themselves.
+*/
+
+#define NORMAL_MEAN 64.0 /* Binomial and Poisson draws of a larger mean are drawn as normals */
+#define TWO_PI 6.283185307179586476925286766559
+
+static double normal(KatssRng *rng);
+
+static inline uint64_t
+splitmix64(uint64_t *state)
+{
+	uint64_t z = (*state += UINT64_C(0x9E3779B97F4A7C15));
+	z = (z ^ (z >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+	z = (z ^ (z >> 27)) * UINT64_C(0x94D049BB133111EB);
+	return z ^ (z >> 31);
+}
+
+
+static inline uint64_t
+rotl(uint64_t x, int k)
+{
+	return (x << k) | (x >> (64 - k));
+}
+
+
+void
+katss_seed_rng(KatssRng *rng, uint64_t seed, uint64_t stream)
+{
+	/* Mixing the seed first keeps nearby seeds from giving overlapping streams */
+	uint64_t state = seed;
+	state = splitmix64(&state) ^ stream;
+	state = splitmix64(&state);
+	for(int i=0; i<4; i++)
+		rng->s[i] = splitmix64(&state);
+}
+
+
+uint64_t
+katss_rng_next(KatssRng *rng)
+{
+	uint64_t *s = rng->s;
+	uint64_t result = rotl(s[1] * 5, 7) * 9;
+	uint64_t t = s[1] << 17;
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = rotl(s[3], 45);
+	return result;
+}
+
+
+uint32_t
+katss_rng_below(KatssRng *rng, uint32_t bound)
+{
+	/* Multiply-shift, which is uniform enough for bounds this far below 2^32 */
+	return (uint32_t)(((katss_rng_next(rng) >> 32) * bound) >> 32);
+}
+
+
+double
+katss_rng_uniform(KatssRng *rng)
+{
+	return (double)(katss_rng_next(rng) >> 11) * 0x1.0p-53;
+}
+
+
+unsigned long
+katss_rng_randfunc(void *rng)
+{
+	return (unsigned long)(katss_rng_next(rng) >> 33);
+}
+
+
+uint64_t
+katss_rng_binomial(KatssRng *rng, uint64_t n, double p)
+{
+	if(n == 0 || p <= 0)
+		return 0;
+	if(p >= 1)
+		return n;
+	if(p > 0.5)
+		return n - katss_rng_binomial(rng, n, 1 - p);
+
+	double mean = (double)n * p;
+	if(mean >= NORMAL_MEAN) {
+		double x = round(mean + sqrt(mean * (1 - p)) * normal(rng));
+		return x <= 0 ? 0 : x >= (double)n ? n : (uint64_t)x;
+	}
+
+	/* Trials up to the next success are geometric, and there are about `mean` of them */
+	double log_q = log1p(-p);
+	double trials = 0;
+	uint64_t successes = 0;
+	while(true) {
+		trials += floor(log1p(-katss_rng_uniform(rng)) / log_q) + 1;
+		if(trials > (double)n)
+			return successes;
+		successes++;
+	}
+}
+
+
+uint64_t
+katss_rng_poisson(KatssRng *rng, double mean)
+{
+	if(mean <= 0)
+		return 0;
+	if(mean >= NORMAL_MEAN) {
+		double x = round(mean + sqrt(mean) * normal(rng));
+		return x <= 0 ? 0 : (uint64_t)x;
+	}
+
+	double limit = exp(-mean), product = katss_rng_uniform(rng);
+	uint64_t draws = 0;
+	while(product > limit) {
+		product *= katss_rng_uniform(rng);
+		draws++;
+	}
+	return draws;
+}
+
+
+/**
+ * @brief Standard normal draw, by Box-Muller.
+ */
+static double
+normal(KatssRng *rng)
+{
+	double u = 1 - katss_rng_uniform(rng); /* in (0, 1] */
+	double v = katss_rng_uniform(rng);
+	return sqrt(-2 * log(u)) * cos(TWO_PI * v);
+}
@@ -0,0 +1,522 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <fcntl.h>
+#ifdef _WIN32
+#  include <io.h>
+#  define open _open
+#  define close _close
+#  define O_RDONLY _O_RDONLY
+#else
+#  include <unistd.h>
+#endif
+
+#if defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L) && !defined(__STDC_NO_THREADS__)
+#  include <threads.h>
+#else
+#  include <tinycthread.h>
+#endif
+
+#include "katss_core.h"
+#include "counter.h"
+#include "memory_utils.h"
+#include "seqfile.h"
+
+#define BUFFER_SIZE 65536U
+
+#define INDEX_MAGIC   UINT32_C(0x5844494B) /* "KIDX" when written little-endian */
+#define INDEX_VERSION UINT32_C(1)
+#define INDEX_SUFFIX  ".kidx"
+
+/* Where the sequence of every read of a file starts, and how long it is */
+struct KatssReadIndex {
+	char *filename;                /** File the reads were indexed from */
+	int indexes;                   /** Times the file was indexed and not unindexed yet */
+	int refs;                      /** Indexes plus the readers still open, freed once 0 */
+	uint64_t num_reads;            /** Reads in the file */
+	uint64_t size;                 /** Reads `offsets` and `lengths` have room for */
+	uint64_t *offsets;             /** Byte offset of the sequence of every read */
+	uint32_t *lengths;             /** Characters in the sequence of every read */
+	struct KatssReadIndex *next;   /** Next indexed file */
+};
+typedef struct KatssReadIndex KatssReadIndex;
+
+struct KatssIndexReader {
+	KatssReadIndex *index;  /** Reads being read */
+	int fd;                 /** File the reads are read from */
+#ifdef _WIN32
+	mtx_t lock;             /** Guards the position of `fd`, as there is no pread */
+#endif
+};
+
+/* Follows the lines of the file being indexed, see `index_chunk` */
+struct IndexParser {
+	char filetype;         /** Type of the file indexed */
+	uint64_t offset;       /** Bytes of the file parsed so far */
+	uint64_t line;         /** Lines fully read so far */
+	bool line_start;       /** If the next character starts a line */
+	bool in_seq;           /** If the current line is a sequence */
+	bool has_header;       /** Fasta only: a header was read */
+	bool has_seq;          /** Fasta only: the sequence under the last header was read */
+	uint64_t seq_start;    /** Offset of the current sequence */
+};
+typedef struct IndexParser IndexParser;
+
+/* Header of the sidecar index, followed by the offsets and then the lengths */
+struct IndexHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t file_size;    /** Size of the file when it was indexed */
+	int64_t file_mtime;    /** Modification time of the file when it was indexed */
+	uint64_t num_reads;
+};
+typedef struct IndexHeader IndexHeader;
+
+static KatssReadIndex *indexes = NULL;
+static mtx_t indexes_lock;
+static once_flag indexes_once = ONCE_FLAG_INIT;
+
+static void init_indexes(void);
+static KatssReadIndex *find_index(const char *filename);
+static void release_index(KatssReadIndex *index);
+static void free_index(KatssReadIndex *index);
+static int build_index(KatssReadIndex *index, const char *filename, char filetype);
+static int index_chunk(KatssReadIndex *index, IndexParser *parser, const char *chunk, size_t len);
+static int end_read(KatssReadIndex *index, IndexParser *parser);
+static bool load_sidecar(KatssReadIndex *index, const char *sidecar, const IndexHeader *expected);
+static void save_sidecar(const KatssReadIndex *index, const char *sidecar, IndexHeader header);
+static bool is_compressed(FILE *file);
+
+
+/*==================================================================================================
+|                                         Public Functions                                         |
+==================================================================================================*/
+int
+katss_index_file(const char *filename)
+{
+	if(filename == NULL)
+		return 2;
+	call_once(&indexes_once, init_indexes);
+
+	/* Indexing a file again only keeps it indexed until it is unindexed as many times */
+	mtx_lock(&indexes_lock);
+	KatssReadIndex *index = find_index(filename);
+	if(index != NULL) {
+		index->indexes++;
+		index->refs++;
+	}
+	mtx_unlock(&indexes_lock);
+	if(index != NULL)
+		return 0;
+
+	/* Only the type of the file is needed from it, mapping plain files saves reading them */
+	char filetype;
+	SeqFile file = katss_open_file(filename, "m", &filetype);
+	if(file == NULL)
+		return 1;
+	seqfclose(file);
+
+	struct stat info;
+	if(stat(filename, &info) != 0)
+		return 2;
+	IndexHeader header = {
+		.magic = INDEX_MAGIC, .version = INDEX_VERSION,
+		.file_size = (uint64_t)info.st_size, .file_mtime = (int64_t)info.st_mtime,
+	};
+
+	/* The sidecar is only trusted if the file didn't change since it was written */
+	char *sidecar = s_malloc(strlen(filename) + sizeof INDEX_SUFFIX);
+	strcpy(sidecar, filename);
+	strcat(sidecar, INDEX_SUFFIX);
+	index = s_calloc(1, sizeof *index);
+	int ret = 0;
+	if(!load_sidecar(index, sidecar, &header)) {
+		ret = build_index(index, filename, filetype);
+		if(ret == 0) {
+			header.num_reads = index->num_reads;
+			save_sidecar(index, sidecar, header);
+		}
+	}
+	free(sidecar);
+	if(ret != 0) {
+		free_index(index);
+		return ret;
+	}
+
+	index->filename = s_malloc(strlen(filename) + 1);
+	strcpy(index->filename, filename);
+	index->indexes = index->refs = 1;
+
+	/* Another thread may have indexed the same file in the meantime */
+	mtx_lock(&indexes_lock);
+	KatssReadIndex *indexed = find_index(filename);
+	if(indexed != NULL) {
+		indexed->indexes++;
+		indexed->refs++;
+	} else {
+		index->next = indexes;
+		indexes = index;
+	}
+	mtx_unlock(&indexes_lock);
+
+	if(indexed != NULL)
+		free_index(index);
+	return 0;
+}
+
+
+void
+katss_unindex_file(const char *filename)
+{
+	if(filename == NULL)
+		return;
+	call_once(&indexes_once, init_indexes);
+
+	mtx_lock(&indexes_lock);
+	KatssReadIndex *index = find_index(filename);
+	if(index != NULL && --index->indexes == 0) {
+		/* Readers still open keep it until they are closed, new ones stream the file */
+		KatssReadIndex **link = &indexes;
+		while(*link != index)
+			link = &(*link)->next;
+		*link = index->next;
+		index->next = NULL;
+	}
+	if(index != NULL)
+		release_index(index);
+	mtx_unlock(&indexes_lock);
+}
+
+
+/*==================================================================================================
+|                                        Internal Functions                                        |
+==================================================================================================*/
+KatssIndexReader *
+katss_open_index(const char *filename)
+{
+	if(filename == NULL)
+		return NULL;
+	call_once(&indexes_once, init_indexes);
+
+	mtx_lock(&indexes_lock);
+	KatssReadIndex *index = find_index(filename);
+	if(index != NULL)
+		index->refs++;
+	mtx_unlock(&indexes_lock);
+	if(index == NULL)
+		return NULL;
+
+	int flags = O_RDONLY;
+#ifdef _WIN32
+	flags |= O_BINARY;
+#endif
+	int fd = open(filename, flags);
+	if(fd < 0) {
+		mtx_lock(&indexes_lock);
+		release_index(index);
+		mtx_unlock(&indexes_lock);
+		return NULL;
+	}
+
+	KatssIndexReader *reader = s_malloc(sizeof *reader);
+	reader->index = index;
+	reader->fd = fd;
+#ifdef _WIN32
+	mtx_init(&reader->lock, mtx_plain);
+#endif
+	return reader;
+}
+
+
+uint64_t
+katss_index_reads(const KatssIndexReader *reader)
+{
+	return reader ? reader->index->num_reads : 0;
+}
+
+
+char *
+katss_index_gets(KatssIndexReader *reader, uint64_t read, char *buffer, size_t size)
+{
+	if(reader == NULL || read >= reader->index->num_reads || size < 1)
+		return NULL;
+
+	uint64_t offset = reader->index->offsets[read];
+	size_t length = MIN2(reader->index->lengths[read], size - 1);
+	size_t done = 0;
+#ifdef _WIN32
+	mtx_lock(&reader->lock);
+	if(_lseeki64(reader->fd, (__int64)offset, SEEK_SET) < 0)
+		length = 0;
+#endif
+	while(done < length) {
+#ifdef _WIN32
+		int n = _read(reader->fd, buffer + done, (unsigned int)(length - done));
+#else
+		ssize_t n = pread(reader->fd, buffer + done, length - done, (off_t)(offset + done));
+#endif
+		if(n <= 0)
+			break;
+		done += (size_t)n;
+	}
+#ifdef _WIN32
+	mtx_unlock(&reader->lock);
+#endif
+	if(done < length) {
+		error_message("katss: %s: read %llu could not be read", reader->index->filename,
+		              (unsigned long long)read);
+		return NULL;
+	}
+	buffer[length] = '\0';
+
+	return buffer;
+}
+
+
+void
+katss_close_index(KatssIndexReader *reader)
+{
+	if(reader == NULL)
+		return;
+
+	mtx_lock(&indexes_lock);
+	release_index(reader->index);
+	mtx_unlock(&indexes_lock);
+
+	close(reader->fd);
+#ifdef _WIN32
+	mtx_destroy(&reader->lock);
+#endif
+	free(reader);
+}
+
+
+/*==================================================================================================
+|                                        Private Functions                                         |
+==================================================================================================*/
+static void
+init_indexes(void)
+{
+	mtx_init(&indexes_lock, mtx_plain);
+}
+
+
+static KatssReadIndex *
+find_index(const char *filename)
+{
+	KatssReadIndex *index = indexes;
+	while(index != NULL && strcmp(index->filename, filename) != 0)
+		index = index->next;
+	return index;
+}
+
+
+static void
+release_index(KatssReadIndex *index)
+{
+	if(--index->refs > 0)
+		return;
+	free_index(index);
+}
+
+
+static void
+free_index(KatssReadIndex *index)
+{
+	free(index->filename);
+	free(index->offsets);
+	free(index->lengths);
+	free(index);
+}
+
+
+/**
+ * @brief Index the reads of a file. Returns 0 on success, 2 if it could not be opened, 3 if it
+ * has to be streamed, or 4 if reading it failed.
+ */
+static int
+build_index(KatssReadIndex *index, const char *filename, char filetype)
+{
+	FILE *file = fopen(filename, "rb");
+	if(file == NULL)
+		return 2;
+
+	/* Offsets in compressed files aren't known without decompressing everything before them */
+	if(is_compressed(file)) {
+		fclose(file);
+		return 3;
+	}
+
+	IndexParser parser = { .filetype = filetype, .line_start = true };
+	char *buffer = s_malloc(BUFFER_SIZE);
+	size_t len;
+	int ret = 0;
+	while(ret == 0 && (len = fread(buffer, 1, BUFFER_SIZE, file)) > 0)
+		ret = index_chunk(index, &parser, buffer, len);
+	if(ret == 0 && ferror(file))
+		ret = 4;
+	if(ret == 0 && parser.in_seq)
+		ret = end_read(index, &parser);
+	if(ret == 0 && filetype == 'a' && parser.has_header && !parser.has_seq)
+		ret = 3;
+	free(buffer);
+	fclose(file);
+
+	return ret;
+}
+
+
+/**
+ * @brief Index the reads starting in a chunk of the file. Returns 0 on success, or 3 if reads
+ * aren't a single line each as `seqfgets` returns them: fasta sequences spanning several lines,
+ * blank lines, fastq records that aren't four lines, or reads that don't fit in a buffer.
+ */
+static int
+index_chunk(KatssReadIndex *index, IndexParser *parser, const char *chunk, size_t len)
+{
+	for(size_t i=0; i<len; i++, parser->offset++) {
+		char c = chunk[i];
+		if(parser->line_start) {
+			parser->line_start = false;
+			switch(parser->filetype) {
+			case 'r':
+				if(c == '\n')
+					return 3;
+				parser->in_seq = true;
+				break;
+			case 'a':
+				if(c == '>') {
+					if(parser->has_header && !parser->has_seq)
+						return 3;
+					parser->has_header = true;
+					parser->has_seq = false;
+				} else if(c == '\n' || !parser->has_header || parser->has_seq) {
+					return 3;
+				} else {
+					parser->has_seq = true;
+					parser->in_seq = true;
+				}
+				break;
+			case 'q':
+				if((parser->line % 4 == 0 && c != '@') || (parser->line % 4 == 2 && c != '+'))
+					return 3;
+				parser->in_seq = parser->line % 4 == 1;
+				break;
+			}
+			parser->seq_start = parser->offset;
+		}
+
+		if(c == '\n') {
+			if(parser->in_seq && end_read(index, parser) != 0)
+				return 3;
+			parser->line++;
+			parser->line_start = true;
+			parser->in_seq = false;
+		}
+	}
+	return 0;
+}
+
+
+static int
+end_read(KatssReadIndex *index, IndexParser *parser)
+{
+	uint64_t length = parser->offset - parser->seq_start;
+	if(length >= BUFFER_SIZE)
+		return 3;
+
+	if(index->num_reads == index->size) {
+		index->size = MAX2(2 * index->size, BUFFER_SIZE);
+		index->offsets = s_realloc(index->offsets, index->size * sizeof *index->offsets);
+		index->lengths = s_realloc(index->lengths, index->size * sizeof *index->lengths);
+	}
+	index->offsets[index->num_reads] = parser->seq_start;
+	index->lengths[index->num_reads] = (uint32_t)length;
+	index->num_reads++;
+	parser->in_seq = false;
+	return 0;
+}
+
+
+/**
+ * @brief Read the index from its sidecar, if the sidecar was written for the file as it is now.
+ */
+static bool
+load_sidecar(KatssReadIndex *index, const char *sidecar, const IndexHeader *expected)
+{
+	FILE *file = fopen(sidecar, "rb");
+	if(file == NULL)
+		return false;
+
+	IndexHeader header;
+	bool loaded = fread(&header, sizeof header, 1, file) == 1 &&
+	              header.magic == expected->magic && header.version == expected->version &&
+	              header.file_size == expected->file_size &&
+	              header.file_mtime == expected->file_mtime;
+	if(loaded) {
+		index->num_reads = index->size = header.num_reads;
+		index->offsets = s_malloc(MAX2(header.num_reads, 1) * sizeof *index->offsets);
+		index->lengths = s_malloc(MAX2(header.num_reads, 1) * sizeof *index->lengths);
+		loaded = fread(index->offsets, sizeof *index->offsets, header.num_reads, file) ==
+		         header.num_reads &&
+		         fread(index->lengths, sizeof *index->lengths, header.num_reads, file) ==
+		         header.num_reads;
+	}
+	fclose(file);
+
+	if(!loaded) {
+		free(index->offsets);
+		free(index->lengths);
+		index->offsets = NULL;
+		index->lengths = NULL;
+		index->num_reads = index->size = 0;
+	}
+	return loaded;
+}
+
+
+/**
+ * @brief Write the index next to the file, so it is only built once. The index is still used if
+ * the sidecar can't be written, e.g., in a read-only directory.
+ */
+static void
+save_sidecar(const KatssReadIndex *index, const char *sidecar, IndexHeader header)
+{
+	FILE *file = fopen(sidecar, "wb");
+	if(file == NULL)
+		return;
+
+	bool saved = fwrite(&header, sizeof header, 1, file) == 1 &&
+	             fwrite(index->offsets, sizeof *index->offsets, index->num_reads, file) ==
+	             index->num_reads &&
+	             fwrite(index->lengths, sizeof *index->lengths, index->num_reads, file) ==
+	             index->num_reads;
+	saved = fclose(file) == 0 && saved;
+
+	/* A partial sidecar would fail to load anyway, but isn't worth keeping */
+	if(!saved)
+		remove(sidecar);
+}
+
+
+/**
+ * @brief If the file starts with the magic bytes of gzip or zlib, leaving it at its start.
+ */
+static bool
+is_compressed(FILE *file)
+{
+	unsigned char magic[2];
+	size_t nread = fread(magic, 1, 2, file);
+	rewind(file);
+	if(nread < 2)
+		return false;
+	return (magic[0] == 0x1F && magic[1] == 0x8B) ||
+	       (magic[0] == 0x78 && (magic[1] == 0x01 || magic[1] == 0x5E ||
+	                             magic[1] == 0x9C || magic[1] == 0xDA));
+}
+
+
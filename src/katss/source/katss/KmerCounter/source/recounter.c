@@ -1,6 +1,7 @@
 #include <stdbool.h>
 #include <errno.h>
 #include <string.h>
+#include <sys/stat.h>
 
 #if defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L) && !defined(__STDC_NO_THREADS__)
 #  include <threads.h>
@@ -14,86 +15,122 @@
 #include "memory_utils.h"
 #include "seqfile.h"
 #include "seqseq.h"
-#include "ushuffle.h"
 
 #define BUFFER_SIZE 65536U
+#define HASH_BLOCK  4096U
+
+#define BIT_TEST(set, i)  (((set)[(i) >> 6] >> ((i) & 63)) & 1)
+#define BIT_SET(set, i)   ((set)[(i) >> 6] |= UINT64_C(1) << ((i) & 63))
+#define BASE_CODE(bases, i) (((bases)[(i) >> 2] >> 2*((i) & 3)) & 3)
 
 struct threadinfo {
 	SeqFile seqfile;
+	KatssStoreReader *store; /** Preloaded sequences read instead of `seqfile`, or NULL */
 	KatssCounter *counter;
+	KatssCounter *local;     /** Private table of the thread, NULL to share `counter` */
+	KatssHashBlock hash_block; /** Hashing kernel for the file's k-mer and filetype */
 	char filetype;
 };
 typedef struct threadinfo threadinfo;
 
-static char determine_filetype(const char *filename);
-static inline void cross_out(char *s1, const char *s2, char filetype);
+/* Tasks recounting a file, started by `start_recount` and waited on by `finish_recount` */
+struct recountjob {
+	KatssCounter *counter;
+	SeqFile seqfile;
+	KatssStoreReader *store;
+	bool owned;              /** If `seqfile` was opened for the recount, and is closed after it */
+	KatssCounter **locals;   /** Private tables of the threads, or NULL */
+	threadinfo *jobarg;
+	KatssTaskGroup *jobs;
+	int threads;
+};
+typedef struct recountjob recountjob;
+
+static int recount_file(KatssCounter *counter, const char *filename, SeqFile seqfile,
+                        const char *remove);
+static int recount_multi(KatssCounter **counters, int num_counters, const char *filename,
+                         SeqFile seqfile, const char *remove, int threads);
+static void close_file(SeqFile file, KatssStoreReader *store);
 static void kctr_push(KatssCounter *counter, const char *str);
+static int index_bases(KatssKmerIndex *index, const uint32_t *hashes, const uint8_t *runs,
+                       size_t num_hashes);
+static void group_occurrences(KatssKmerIndex *index, KatssCounter *counter);
+static inline uint64_t index_size(uint64_t num_bases, uint64_t num_windows, unsigned int kmer);
+static inline bool any_crossed(const KatssKmerIndex *index, uint64_t start, uint64_t end);
+static inline uint32_t window_hash(const KatssKmerIndex *index, uint64_t window);
+static int hash_kmer(const char *kmer, unsigned int length, uint32_t *hash);
+static int start_recount(recountjob *job, KatssCounter *counter, const char *filename,
+                         SeqFile seqfile, const char *remove, int threads);
+static int finish_recount(recountjob *job);
+static void split_threads(const char **filenames, const bool *reading, int num_files, int threads,
+                          int *shares);
 
 int
 katss_recount_kmer(KatssCounter *counter, const char *filename, const char *remove)
 {
+	return recount_file(counter, filename, NULL, remove);
+}
+
+int
+katss_recount_kmer_seqfile(KatssCounter *counter, SeqFile file, const char *remove)
+{
+	return recount_file(counter, NULL, file, remove);
+}
+
+static int
+recount_file(KatssCounter *counter, const char *filename, SeqFile seqfile, const char *remove)
+{
+	/* Read the file from memory if it was preloaded, where it is one read per line. A file
+	   already open is read again instead */
 	int ret = 0;
-	char filetype = determine_filetype(filename);
-	if(filetype == 'e' || filetype == 'N')
+	char filetype = 'r';
+	SeqFile read_file = NULL;
+	KatssStoreReader *store = seqfile == NULL ? katss_open_store(filename) : NULL;
+	if(store == NULL && (read_file = katss_rewind_file(filename, seqfile, "", &filetype)) == NULL)
 		return 1;
 
 	/* Clear counter */
-	uint64_t total = ((uint64_t)counter->capacity) + 1;
-	if(counter->kmer <= 12)
-		memset(counter->table.small,  0x00, total * sizeof(uint64_t));
-	else
-		memset(counter->table.medium, 0x00, total * sizeof(uint32_t));
+	katss_clear_counts(counter);
 	
 	/* Push kmer to remove to counter */
 	kctr_push(counter, remove);
 
-	/* Open SeqFile for reading */
-	char mode[2] = { 0 };
-	mode[0] = filetype == 'r' ? 's' : filetype;
-	SeqFile read_file = seqfopen(filename, mode);
-	if(read_file == NULL) { /* Error opening SeqFile */
-		error_message("katss: seqfopen: %s\n", seqfstrerror(seqferrno));
-		return 2;
-	}
-
 	/* Initialize hasher */
 	KatssHasher *hasher = katss_init_hasher(counter->kmer, filetype);
 	if(hasher == NULL) {
-		seqfclose(read_file);
+		close_file(read_file != seqfile ? read_file : NULL, store);
 		return 3;
 	}
 
+	KatssHashBlock hash_block = katss_hash_block_kernel(counter->kmer, filetype);
+	KatssMasker *masker = katss_init_masker(counter->removed, filetype);
 	char *buffer = s_malloc(BUFFER_SIZE+1);
-	size_t still_reading;
-	uint32_t hash_value;
+	uint32_t *hash_values = s_malloc(HASH_BLOCK * sizeof *hash_values);
+	size_t num_hashes;
 
 	/* Begin recounting */
-	do {
-		still_reading = seqfread_unlocked(read_file, buffer, BUFFER_SIZE);
-
+	while(store ? katss_store_read(store, buffer, BUFFER_SIZE)
+	            : seqfread_unlocked(read_file, buffer, BUFFER_SIZE)) {
 		/* Remove sequences in line */
-		katss_str_node_t *cur = counter->removed;
-		while(cur != NULL) {
-			cross_out(buffer, cur->str, filetype);
-			cur = cur->next;
-		}
+		katss_mask(masker, buffer);
 
 		katss_set_seq(hasher, buffer, filetype);
-		while(katss_get_fh(hasher, &hash_value, filetype)) {
-			katss_increment(counter, hash_value);
-		}
-	} while(still_reading);
+		while((num_hashes = hash_block(hasher, hash_values, HASH_BLOCK)))
+			katss_increments_unlocked(counter, hash_values, num_hashes);
+	}
 
 	/* If error was encountered while reading report and return NULL */
-	if(still_reading == 0 && seqferrno) {
+	if(store == NULL && seqferrno) {
 		ret = 4;
 		error_message("katss: %d: %s", seqferrno, seqfstrerror(seqferrno));
 	}
 
 	/* Cleanup */
+	katss_free_masker(masker);
 	free(hasher);
+	free(hash_values);
 	free(buffer);
-	seqfclose(read_file);
+	close_file(read_file != seqfile ? read_file : NULL, store);
 
 	return ret;
 }
@@ -101,84 +138,29 @@ katss_recount_kmer(KatssCounter *counter, const char *filename, const char *remo
 int
 katss_recount_kmer_shuffle(KatssCounter *counter, const char *file, int klet, const char *remove)
 {
-	int ret = 0;
-	char filetype = determine_filetype(file);
-	if(filetype == 'e' || filetype == 'N')
-		return 1;
+	return katss_recount_kmer_shuffle_mt(counter, file, klet, remove, 1);
+}
 
+int
+katss_recount_kmer_shuffle_mt(KatssCounter *counter, const char *file, int klet,
+                              const char *remove, int threads)
+{
 	/* Clear counter */
-	uint64_t total = ((uint64_t)counter->capacity) + 1;
-	if(counter->kmer <= 12)
-		memset(counter->table.small,  0x00, total * sizeof(uint64_t));
-	else
-		memset(counter->table.medium, 0x00, total * sizeof(uint32_t));
+	katss_clear_counts(counter);
 	
 	/* Push kmer to remove to counter */
 	kctr_push(counter, remove);
 
-	/* Open SeqFile for reading */
-	char mode[2] = { 0 };
-	mode[0] = filetype == 'r' ? 's' : filetype;
-	SeqFile read_file = seqfopen(file, mode);
-	if(read_file == NULL) { /* Error opening SeqFile */
-		error_message("katss: seqfopen: %s\n", seqfstrerror(seqferrno));
-		return 2;
-	}
-
-	/* Initialize hasher */
-	KatssHasher *hasher = katss_init_hasher(counter->kmer, filetype);
-	if(hasher == NULL) {
-		seqfclose(read_file);
-		return 3;
-	}
-
-	char *buffer = s_malloc(BUFFER_SIZE);
-	char *shuf   = s_malloc(BUFFER_SIZE);
-	size_t still_reading;
-	uint32_t hash_value;
-
-	/* Begin recounting */
-	srand(1); // reset seed for ushuffle
-	while(seqfgets_unlocked(read_file, buffer, BUFFER_SIZE)) {
-		/* Shuffle the sequence */
-		int seqlen = strlen(buffer);
-		shuffle(buffer, shuf, seqlen, klet);
-		shuf[seqlen] = '\0'; // null terminate shuf since shuffle uses strncpy
-
-		/* Remove sequences in line */
-		katss_str_node_t *cur = counter->removed;
-		while(cur != NULL) {
-			cross_out(buffer, cur->str, filetype);
-			cur = cur->next;
-		}
-
-		/* Count the kemrs */
-		katss_set_seq(hasher, shuf, filetype);
-		while(katss_get_fh(hasher, &hash_value, filetype)) {
-			katss_increment(counter, hash_value);
-		}
-	}
-
-	/* If error was encountered while reading report and return NULL */
-	if(seqferrno) {
-		ret = 4;
-		error_message("katss: %d: %s", seqferrno, seqfstrerror(seqferrno));
-	}
-
-	/* Cleanup */
-	free(hasher);
-	free(buffer);
-	free(shuf);
-	seqfclose(read_file);
-
-	return ret;
+	/* Every read is shuffled the same way `katss_count_kmers_ushuffle` does */
+	return katss_count_shuffled(counter, file, klet, counter->removed, 100000, 1, threads);
 }
 
 static int
 recount_mt(void *arg)
 {
 	threadinfo *args = (threadinfo *)arg;
-	char *buffer = s_malloc(BUFFER_SIZE);
+	KatssScratch *scratch = katss_scratch();
+	char *buffer = scratch->buffer;
 
 	/* Hasher to hash k-mers */
 	KatssHasher *hasher = katss_init_hasher(args->counter->kmer, '\0');
@@ -186,23 +168,28 @@ recount_mt(void *arg)
 		return 1;
 
 	/* Megabyte to store counts */
-	size_t num_counts = 250000;
-	uint32_t *hash_values = s_malloc(num_counts * sizeof *hash_values);
+	size_t num_counts = KATSS_SCRATCH_HASHES;
+	uint32_t *hash_values = scratch->hashes;
 	size_t cur_hash = 0;
+	KatssMasker *masker = katss_init_masker(args->counter->removed, args->filetype);
 
 	/* Begin re-counting */
-	while(seqfread(args->seqfile, buffer, BUFFER_SIZE)) {
+	while(args->store ? katss_store_read(args->store, buffer, BUFFER_SIZE)
+	                  : seqfread(args->seqfile, buffer, BUFFER_SIZE)) {
 		/* Remove unwanted k-mers */
-		katss_str_node_t *cur = args->counter->removed;
-		while(cur != NULL) {
-			cross_out(buffer, cur->str, args->filetype);
-			cur = cur->next;
-		}
+		katss_mask(masker, buffer);
 
 		/* Count the k-mers */
 		katss_set_seq(hasher, buffer, args->filetype);
-		while(katss_get_fh(hasher, &hash_values[cur_hash], args->filetype)) {
-			if(++cur_hash == num_counts) { // begin flushing
+		if(args->local != NULL) { /* Private table needs no buffering */
+			while((cur_hash = args->hash_block(hasher, hash_values, num_counts)))
+				katss_increments_unlocked(args->local, hash_values, cur_hash);
+			continue;
+		}
+		size_t num_hashes;
+		while((num_hashes = args->hash_block(hasher, hash_values + cur_hash,
+		                                     num_counts - cur_hash))) {
+			if((cur_hash += num_hashes) == num_counts) { // begin flushing
 				katss_increments(args->counter, hash_values, cur_hash);
 				cur_hash = 0;
 			}
@@ -213,29 +200,26 @@ recount_mt(void *arg)
 	katss_increments(args->counter, hash_values, cur_hash);
 
 	/* Free resources */
+	katss_free_masker(masker);
 	free(hasher);
-	free(buffer);
-	free(hash_values);
 
 	return 0;
 }
 
-int
-katss_recount_kmer_mt(KatssCounter *counter, const char *filename, const char *remove, int threads)
+static int
+start_recount(recountjob *job, KatssCounter *counter, const char *filename, SeqFile seqfile,
+              const char *remove, int threads)
 {
-	int ret = 0;
-
-	/* Check type of file, or throw error if not supported */
-	char filetype = determine_filetype(filename);
-	if(filetype == 'e' || filetype == 'N')
+	/* Read the file from memory if it was preloaded, where it is one read per line. A file
+	   already open is read again instead */
+	char filetype = 'r';
+	SeqFile read_file = NULL;
+	KatssStoreReader *store = seqfile == NULL ? katss_open_store(filename) : NULL;
+	if(store == NULL && (read_file = katss_rewind_file(filename, seqfile, "", &filetype)) == NULL)
 		return 1;
 
 	/* Clear counter */
-	uint64_t total = ((uint64_t)counter->capacity) + 1;
-	if(counter->kmer <= 12)
-		memset(counter->table.small,  0x00, total * sizeof(uint64_t));
-	else
-		memset(counter->table.medium, 0x00, total * sizeof(uint32_t));
+	katss_clear_counts(counter);
 	
 	/* Push kmer to remove to counter */
 	kctr_push(counter, remove);
@@ -244,124 +228,327 @@ katss_recount_kmer_mt(KatssCounter *counter, const char *filename, const char *r
 	threads = MAX2(threads, 1);
 	threads = MIN2(threads, 128);
 
-	/* Open SeqFile for reading */
-	char mode[2] = { 0 };
-	mode[0] = filetype == 'r' ? 's' : filetype;
-	SeqFile read_file = seqfopen(filename, mode);
-	if(read_file == NULL) { /* Error opening SeqFile */
-		error_message("katss: seqfopen: %s\n", seqfstrerror(seqferrno));
-		return 2;
-	}
-
 	/* Begin preparing threads */
-	threadinfo *jobarg = s_malloc(threads * sizeof *jobarg);
-	thrd_t *jobs = s_malloc(threads * sizeof *jobs);
+	KatssHashBlock hash_block = katss_hash_block_kernel(counter->kmer, filetype);
+	job->counter = counter;
+	job->seqfile = read_file;
+	job->store = store;
+	job->owned = read_file != seqfile;
+	job->locals = katss_init_private_counters(counter->kmer, threads);
+	job->jobarg = s_malloc(threads * sizeof *job->jobarg);
+	job->jobs = katss_init_task_group();
+	job->threads = threads;
 
 	for(int i=0; i<threads; i++) {
-		jobarg[i].seqfile = read_file;
-		jobarg[i].counter = counter;
-		jobarg[i].filetype = filetype;
-
-		/* Start threads */
-		thrd_create(&jobs[i], recount_mt, &jobarg[i]);
+		job->jobarg[i].seqfile = read_file;
+		job->jobarg[i].store = store;
+		job->jobarg[i].counter = counter;
+		job->jobarg[i].local = job->locals ? job->locals[i] : NULL;
+		job->jobarg[i].hash_block = hash_block;
+		job->jobarg[i].filetype = filetype;
+
+		/* Start tasks on the pool */
+		katss_submit_task(job->jobs, recount_mt, &job->jobarg[i]);
 	}
 
-	for(int i=0; i<threads; i++) {
-		thrd_join(jobs[i], &ret);
-	}
+	return 0;
+}
+
+static int
+finish_recount(recountjob *job)
+{
+	int ret = katss_wait_task_group(job->jobs);
+	katss_merge_private_counters(job->counter, job->locals, job->threads);
 
 	/* Free resources */
-	seqfclose(read_file);
-	free(jobs);
-	free(jobarg);
+	close_file(job->owned ? job->seqfile : NULL, job->store);
+	free(job->jobarg);
 
 	return ret;
 }
 
+int
+katss_recount_kmer_mt(KatssCounter *counter, const char *filename, const char *remove, int threads)
+{
+	recountjob job;
+	int ret = start_recount(&job, counter, filename, NULL, remove, threads);
+	if(ret != 0)
+		return ret;
+	return finish_recount(&job);
+}
+
+int
+katss_recount_kmer_seqfile_mt(KatssCounter *counter, SeqFile file, const char *remove,
+                              int threads)
+{
+	recountjob job;
+	int ret = start_recount(&job, counter, NULL, file, remove, threads);
+	if(ret != 0)
+		return ret;
+	return finish_recount(&job);
+}
+
+int
+katss_recount_kmer_multi(KatssCounter **counters, int num_counters, const char *filename,
+                         const char *remove)
+{
+	return katss_recount_kmer_multi_mt(counters, num_counters, filename, remove, 1);
+}
+
+int
+katss_recount_kmer_multi_mt(KatssCounter **counters, int num_counters, const char *filename,
+                            const char *remove, int threads)
+{
+	return recount_multi(counters, num_counters, filename, NULL, remove, threads);
+}
+
+int
+katss_recount_kmer_multi_seqfile(KatssCounter **counters, int num_counters, SeqFile file,
+                                 const char *remove, int threads)
+{
+	return recount_multi(counters, num_counters, NULL, file, remove, threads);
+}
+
+static int
+recount_multi(KatssCounter **counters, int num_counters, const char *filename, SeqFile seqfile,
+              const char *remove, int threads)
+{
+	if(counters == NULL || num_counters < 1)
+		return 3;
+	for(int i=0; i<num_counters; i++) {
+		if(counters[i] == NULL)
+			return 3;
+	}
+
+	/* Clear counters, and push kmer to remove to each of them */
+	for(int i=0; i<num_counters; i++) {
+		katss_clear_counts(counters[i]);
+		kctr_push(counters[i], remove);
+	}
+
+	/* All counters removed the same k-mers, so cross out the ones of the first */
+	return katss_count_multi(filename, seqfile, counters, num_counters, counters[0]->removed,
+	                         threads);
+}
+
 /*==================================================================================================
-|                                         Helper Functions                                         |
+|                                     Indexed Recount Functions                                     |
 ==================================================================================================*/
-static bool
-is_nucleotide(char character)
+struct KatssKmerIndex {
+	unsigned int kmer;        /** Length of the indexed k-mers */
+	uint64_t num_bases;       /** Number of bases hashed from the file */
+	uint64_t num_windows;     /** Number of k-mers counted from the file */
+	uint64_t capacity;        /** Number of bases `bases` and `windows` have room for */
+	uint8_t *bases;           /** 2-bit code of every base, four per byte */
+	uint64_t *windows;        /** Bit set of the bases that end a counted k-mer */
+	uint64_t *crossed;        /** Bit set of the bases crossed out so far */
+	uint32_t *offsets;        /** Where the occurrences of every k-mer start in `occurrences` */
+	uint32_t *occurrences;    /** Last base of every counted k-mer, grouped by k-mer */
+};
+
+
+KatssCounter *
+katss_count_kmers_index(const char *filename, unsigned int kmer, int threads,
+                        KatssKmerIndex **index)
 {
-	switch(character) {
-		case 'A':   return true;
-		case 'a':   return true;
-		case 'C':   return true;
-		case 'c':   return true;
-		case 'G':   return true;
-		case 'g':   return true;
-		case 'T':   return true;
-		case 't':   return true;
-		case 'U':   return true;
-		case 'u':   return true;
-		default:    return false;
+	*index = NULL;
+
+	/* Occurrences are grouped with a table as large as the counter's, only small ones have it */
+	if(kmer > 12)
+		return threads > 1 ? katss_count_kmers_mt(filename, kmer, threads)
+		                   : katss_count_kmers(filename, kmer);
+
+	/* Read the file from memory if it was preloaded, where it is one read per line */
+	char filetype = 'r';
+	SeqFile read_file = NULL;
+	KatssStoreReader *store = katss_open_store(filename);
+	if(store == NULL && (read_file = katss_open_file(filename, "", &filetype)) == NULL)
+		return NULL;
+
+	KatssCounter *counter = katss_acquire_counter(kmer);
+	KatssHasher *hasher = katss_init_hasher(kmer, filetype);
+	if(counter == NULL || hasher == NULL) {
+		katss_release_counter(counter);
+		free(hasher);
+		close_file(read_file, store);
+		return NULL;
+	}
+
+	char *buffer = s_malloc(BUFFER_SIZE+1);
+	uint32_t *hash_values = s_malloc(HASH_BLOCK * sizeof *hash_values);
+	uint32_t *selected = s_malloc(HASH_BLOCK * sizeof *selected);
+	uint8_t *runs = s_malloc(HASH_BLOCK * sizeof *runs);
+	size_t num_hashes, num_selected;
+	unsigned int run = 0;
+
+	/* Count k-mers while keeping every base, unless the index can't stand in for the file */
+	KatssKmerIndex *idx = s_calloc(1, sizeof *idx);
+	idx->kmer = kmer;
+	while(store ? katss_store_read(store, buffer, BUFFER_SIZE)
+	            : seqfread_unlocked(read_file, buffer, BUFFER_SIZE)) {
+		katss_set_seq(hasher, buffer, filetype);
+		while((num_hashes = katss_hash_block_runs(hasher, hash_values, runs, HASH_BLOCK,
+		                                          filetype))) {
+			if(idx != NULL && (hasher->joined || index_bases(idx, hash_values, runs, num_hashes))) {
+				katss_free_kmer_index(idx);
+				idx = NULL;
+			}
+			num_selected = katss_select_run_hashes(selected, hash_values, runs, num_hashes, kmer,
+			                                       &run);
+			katss_increments_unlocked(counter, selected, num_selected);
+		}
+	}
+
+	if(store == NULL && seqferrno) {
+		error_message("katss: %d: %s", seqferrno, seqfstrerror(seqferrno));
+		katss_release_counter(counter);
+		katss_free_kmer_index(idx);
+		counter = NULL;
+		idx = NULL;
 	}
+	if(idx != NULL)
+		group_occurrences(idx, counter);
+	*index = idx;
+
+	free(hasher);
+	free(hash_values);
+	free(selected);
+	free(runs);
+	free(buffer);
+	close_file(read_file, store);
+
+	return counter;
 }
 
-static char
-determine_filetype(const char *file)
+
+int
+katss_recount_kmer_index(KatssCounter *counter, KatssKmerIndex **index, const char *filename,
+                         const char *remove, int threads)
 {
-	/* Open the SeqFile, return 'e' upon error */
-	SeqFile reads_file = seqfopen(file, "b");
-	if(reads_file == NULL) {
-		error_message("katss: %s: %s", file, strerror(errno));
-		seqfclose(reads_file);
-		return 'N';
+	/* Only k-mers of the index can be found through it, anything else has to read the file */
+	KatssKmerIndex *idx = *index;
+	uint32_t hash = 0;
+	if(idx != NULL && hash_kmer(remove, idx->kmer, &hash)) {
+		katss_free_kmer_index(idx);
+		*index = idx = NULL;
 	}
+	if(idx == NULL)
+		return threads > 1 ? katss_recount_kmer_mt(counter, filename, remove, threads)
+		                   : katss_recount_kmer(counter, filename, remove);
 
-	char buffer[BUFFER_SIZE];
-	int lines_read = 0;
-	int fastq_score_lines = 0;
-	int fasta_score_lines = 0;
-	int sequence_lines = 0;
-
-	while (seqfgets(reads_file, buffer, BUFFER_SIZE) != NULL && lines_read < 10) {
-		lines_read++;
-		char first_char = buffer[0];
-
-		/* Check if the first line starts with '@' for FASTQ */
-		if (first_char == '@' && lines_read % 4 == 1) {
-			fastq_score_lines++;
-
-		/* Check if the third line starts with '+' for FASTQ */
-		} else if (first_char == '+' && lines_read % 4 == 3) {
-			fastq_score_lines++;
-
-		/* Check if the line starts with '>' or ';' for FASTA */
-		} else if (first_char == '>' || first_char == ';') {
-			fasta_score_lines++;
-		} else {
-			// Check for nucleotide characters
-			int num_total = 0, num = 0;
-			for(int i = 0; buffer[i] != '\0'; i++) {
-				if(is_nucleotide(buffer[i])) {
-					num++;
-				}
-				num_total++;
-			}
-			if((double)num/num_total > 0.9) {
-				sequence_lines++;
-			}
+	kctr_push(counter, remove);
+	katss_drop_tails(counter);
+
+	/* Cross out occurrences from left to right like `katss_cross_out`, skipping any that overlap
+	   a base crossed out before. Only the k-mers still counted around them are uncounted */
+	const unsigned int kmer = idx->kmer;
+	for(uint32_t i=idx->offsets[hash]; i<idx->offsets[hash+1]; i++) {
+		uint64_t end = idx->occurrences[i];
+		uint64_t start = end - (kmer - 1);
+		if(any_crossed(idx, start, end))
+			continue;
+
+		uint64_t last = MIN2(end + (kmer - 1), idx->num_bases - 1);
+		for(uint64_t window=start; window<=last; window++) {
+			if(!BIT_TEST(idx->windows, window) || any_crossed(idx, window - (kmer - 1), window))
+				continue;
+			counter->table[window_hash(idx, window)]--;
+			counter->total--;
 		}
+		for(uint64_t base=start; base<=end; base++)
+			BIT_SET(idx->crossed, base);
 	}
-    seqfclose(reads_file);
-
-    if (fastq_score_lines >= 2) {
-        return 'q'; // fastq file
-	} else if (fasta_score_lines > 0) {
-		return 'a';
-    } else if (sequence_lines == 10) {
-        return 'r'; // raw sequences file
-    } else {
-		error_message("Unable to read sequence from file.\nCurrent supported file types are:"
-		              " FASTA, FASTQ, and file containing sequences per line.");
-        return 'e'; // unsupported file type
-    }
+
+	return 0;
+}
+
+
+int
+katss_recount_kmer_indexes(KatssCounter **counters, KatssKmerIndex **indexes,
+                           const char **filenames, int num_files, const char *remove, int threads)
+{
+	if(counters == NULL || indexes == NULL || filenames == NULL || num_files < 1)
+		return 3;
+
+	/* Files whose index can't find `remove` are read again, see `katss_recount_kmer_index` */
+	bool *reading = s_malloc(num_files * sizeof *reading);
+	int *shares = s_malloc(num_files * sizeof *shares);
+	int *rets = s_calloc(num_files, sizeof *rets);
+	recountjob *jobs = s_malloc(num_files * sizeof *jobs);
+	int num_reading = 0, ret = 0;
+	for(int i=0; i<num_files; i++) {
+		uint32_t hash = 0;
+		if(indexes[i] != NULL && hash_kmer(remove, indexes[i]->kmer, &hash)) {
+			katss_free_kmer_index(indexes[i]);
+			indexes[i] = NULL;
+		}
+		reading[i] = indexes[i] == NULL;
+		num_reading += reading[i];
+	}
+
+	/* Not enough threads to read the files at the same time, so read them one after the other */
+	if(threads < num_reading) {
+		for(int i=0; i<num_files; i++)
+			rets[i] = katss_recount_kmer_index(counters[i], &indexes[i], filenames[i], remove,
+			                                   threads);
+		goto cleanup;
+	}
+
+	/* Start reading every file with its share of the threads, and go through the indexes while
+	   they run */
+	split_threads(filenames, reading, num_files, threads, shares);
+	for(int i=0; i<num_files; i++) {
+		if(reading[i])
+			rets[i] = start_recount(&jobs[i], counters[i], filenames[i], NULL, remove, shares[i]);
+	}
+	for(int i=0; i<num_files; i++) {
+		if(!reading[i])
+			rets[i] = katss_recount_kmer_index(counters[i], &indexes[i], filenames[i], remove, 1);
+	}
+	for(int i=0; i<num_files; i++) {
+		if(reading[i] && rets[i] == 0)
+			rets[i] = finish_recount(&jobs[i]);
+	}
+
+cleanup:
+	for(int i=0; i<num_files && ret == 0; i++)
+		ret = rets[i];
+	free(reading);
+	free(shares);
+	free(rets);
+	free(jobs);
+	return ret;
+}
+
+
+void
+katss_free_kmer_index(KatssKmerIndex *index)
+{
+	if(index == NULL)
+		return;
+
+	free(index->bases);
+	free(index->windows);
+	free(index->crossed);
+	free(index->offsets);
+	free(index->occurrences);
+	free(index);
+}
+
+/*==================================================================================================
+|                                         Helper Functions                                         |
+==================================================================================================*/
+static void
+close_file(SeqFile file, KatssStoreReader *store)
+{
+	if(store != NULL)
+		katss_close_store(store);
+	else
+		seqfclose(file);
 }
 
-static inline void
-cross_out(char *s1, const char *s2, char filetype) {
+void
+katss_cross_out(char *s1, const char *s2, char filetype) {
 	register size_t s2_len = strlen(s2);
 	register char *ptr = s1;
 	if(filetype == 'a') {
@@ -397,3 +584,165 @@ kctr_push(KatssCounter *counter, const char *str)
 	cur->next->str = strdup(str);
 	cur->next->next = NULL;
 }
+
+static int
+index_bases(KatssKmerIndex *index, const uint32_t *hashes, const uint8_t *runs, size_t num_hashes)
+{
+	/* Occurrences are 32-bit positions, and the whole index has to fit within its budget */
+	uint64_t num_bases = index->num_bases + num_hashes;
+	if(num_bases > UINT32_MAX ||
+	   index_size(num_bases, index->num_windows + num_hashes, index->kmer) > KATSS_INDEX_MAX_BYTES)
+		return 1;
+
+	if(num_bases > index->capacity) {
+		uint64_t capacity = MAX2(2 * index->capacity, UINT64_C(1) << 20);
+		while(capacity < num_bases)
+			capacity *= 2;
+		index->bases = s_realloc(index->bases, capacity / 4);
+		index->windows = s_realloc(index->windows, capacity / 8);
+		memset(index->bases + index->capacity / 4, 0, (capacity - index->capacity) / 4);
+		memset(index->windows + index->capacity / 64, 0, (capacity - index->capacity) / 8);
+		index->capacity = capacity;
+	}
+
+	for(size_t i=0; i<num_hashes; i++) {
+		/* Crossing out bases before a blank line can change which k-mers span it */
+		if(runs[i] == 0)
+			return 1;
+
+		uint64_t base = index->num_bases++;
+		index->bases[base >> 2] |= (uint8_t)((hashes[i] & 3) << 2*(base & 3));
+		if(runs[i] >= index->kmer) {
+			BIT_SET(index->windows, base);
+			index->num_windows++;
+		}
+	}
+
+	return 0;
+}
+
+static void
+group_occurrences(KatssKmerIndex *index, KatssCounter *counter)
+{
+	uint64_t num_kmers = (uint64_t)counter->capacity + 1;
+	index->offsets = s_malloc((num_kmers + 1) * sizeof *index->offsets);
+	index->occurrences = s_malloc(MAX2(index->num_windows, 1) * sizeof *index->occurrences);
+	index->crossed = s_calloc(MAX2(index->capacity / 64, 1), sizeof *index->crossed);
+
+	/* The count of each k-mer is the number of occurrences it has, fill them by position */
+	uint32_t start = 0;
+	for(uint64_t i=0; i<num_kmers; i++) {
+		index->offsets[i] = start;
+		start += counter->table[i];
+	}
+
+	const uint32_t mask = counter->capacity;
+	uint32_t hash = 0;
+	for(uint64_t base=0; base<index->num_bases; base++) {
+		hash = ((hash << 2) | BASE_CODE(index->bases, base)) & mask;
+		if(BIT_TEST(index->windows, base))
+			index->occurrences[index->offsets[hash]++] = (uint32_t)base;
+	}
+
+	/* Each offset now points at the end of its k-mer, which is the start of the next one */
+	memmove(index->offsets + 1, index->offsets, num_kmers * sizeof *index->offsets);
+	index->offsets[0] = 0;
+}
+
+static inline uint64_t
+index_size(uint64_t num_bases, uint64_t num_windows, unsigned int kmer)
+{
+	/* Bases, both bit sets, occurrences and offsets */
+	return num_bases / 4 + num_bases / 4 + 4 * num_windows + 4 * ((UINT64_C(1) << 2*kmer) + 1);
+}
+
+static inline bool
+any_crossed(const KatssKmerIndex *index, uint64_t start, uint64_t end)
+{
+	for(uint64_t base=start; base<=end; base++) {
+		if(BIT_TEST(index->crossed, base))
+			return true;
+	}
+	return false;
+}
+
+static inline uint32_t
+window_hash(const KatssKmerIndex *index, uint64_t window)
+{
+	uint32_t hash = 0;
+	for(uint64_t base=window - (index->kmer - 1); base<=window; base++)
+		hash = (hash << 2) | BASE_CODE(index->bases, base);
+	return hash;
+}
+
+/**
+ * @brief Split `threads` among the files being read, in proportion to their size on disk. Every
+ * file gets at least one thread, and files whose size is unknown count as the average.
+ */
+static void
+split_threads(const char **filenames, const bool *reading, int num_files, int threads,
+              int *shares)
+{
+	uint64_t *sizes = s_calloc(num_files, sizeof *sizes);
+	uint64_t total = 0;
+	int num_reading = 0, num_known = 0;
+	for(int i=0; i<num_files; i++) {
+		struct stat info;
+		shares[i] = 0;
+		if(!reading[i])
+			continue;
+		num_reading++;
+		if(stat(filenames[i], &info) == 0 && info.st_size > 0) {
+			sizes[i] = (uint64_t)info.st_size;
+			total += sizes[i];
+			num_known++;
+		}
+	}
+	if(num_reading == 0)
+		goto cleanup;
+	for(int i=0; i<num_files; i++) {
+		if(reading[i] && sizes[i] == 0) {
+			sizes[i] = num_known ? MAX2(total / num_known, 1) : 1;
+			total += sizes[i];
+		}
+	}
+
+	/* One thread each, then the rest by size, and what rounding left to the most loaded files */
+	int spare = threads - num_reading, given = num_reading;
+	for(int i=0; i<num_files; i++) {
+		if(!reading[i])
+			continue;
+		shares[i] = 1 + (int)((uint64_t)spare * sizes[i] / total);
+		given += shares[i] - 1;
+	}
+	while(given < threads) {
+		int most = -1;
+		for(int i=0; i<num_files; i++) {
+			if(reading[i] && (most < 0 || sizes[i] * shares[most] > sizes[most] * shares[i]))
+				most = i;
+		}
+		shares[most]++;
+		given++;
+	}
+
+cleanup:
+	free(sizes);
+}
+
+
+static int
+hash_kmer(const char *kmer, unsigned int length, uint32_t *hash)
+{
+	*hash = 0;
+	for(unsigned int i=0; i<length; i++) {
+		switch(kmer[i]) {
+		case 'A': case 'a': *hash = *hash * 4;     break;
+		case 'C': case 'c': *hash = *hash * 4 + 1; break;
+		case 'G': case 'g': *hash = *hash * 4 + 2; break;
+		case 'T': case 't':
+		case 'U': case 'u': *hash = *hash * 4 + 3; break;
+		default: return 1; /* not a k-mer, or shorter than the index's */
+		}
+	}
+	return kmer[length] != '\0'; /* longer than the index's k-mers */
+}
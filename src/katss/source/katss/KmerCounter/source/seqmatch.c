@@ -0,0 +1,361 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "katss_core.h"
+#include "memory_utils.h"
+#include "seqseq.h"
+
+#define CHUNKS_PER_THREAD 8 /* Ranges of sequences given to every thread, evening out their load */
+
+/* Automaton finding every pattern in a single pass over a sequence */
+struct SeqAutomaton {
+	uint8_t classes[256];    /** Symbol of every character, 0 for the ones in no pattern */
+	unsigned int num_symbols; /** Number of symbols, including 0 */
+	int32_t num_states;      /** Number of states, the first one being the root */
+	int32_t states_size;     /** Room for states in the arrays below */
+	int32_t *next;           /** Next state by state and symbol */
+	int32_t *fail;           /** Longest proper suffix of a state that is a state too */
+	int32_t *output;         /** State itself or its nearest suffix a pattern ends at, or -1 */
+	int32_t *first;          /** First pattern ending at a state, or -1 */
+	int32_t *same_end;       /** Next pattern ending at the same state as a pattern, or -1 */
+	uint64_t *lengths;       /** Length of every pattern */
+	uint32_t num_patterns;   /** Number of patterns */
+};
+typedef struct SeqAutomaton SeqAutomaton;
+
+/* Sequences searched by one task, and the matches found in them */
+struct SeqChunk {
+	const SeqAutomaton *automaton;
+	const char *const *sequences;  /** Every sequence searched */
+	uint64_t start;                /** First sequence of the chunk */
+	uint64_t end;                  /** Sequence after the last one of the chunk */
+	bool overlapping;              /** If matches of a pattern may overlap */
+	SeqMatch *matches;             /** Matches found, by sequence, position and pattern */
+	uint64_t num_matches;          /** Number of matches in `matches` */
+	uint64_t matches_size;         /** Room for matches in `matches` */
+};
+typedef struct SeqChunk SeqChunk;
+
+/* Chunks searched by one task, every `stride` chunk from `first` */
+struct SeqTask {
+	SeqChunk *chunks;
+	uint64_t first;
+	uint64_t stride;
+	uint64_t num_chunks;
+};
+
+static SeqAutomaton *init_automaton(const char *const *patterns, uint32_t num_patterns);
+static void free_automaton(SeqAutomaton *automaton);
+static int32_t add_state(SeqAutomaton *automaton);
+static void build_links(SeqAutomaton *automaton);
+static int search_chunks(void *arg);
+static void search_chunk(SeqChunk *chunk, uint64_t *last_end, uint64_t *last_seq);
+static inline void add_match(SeqChunk *chunk, uint64_t sequence, uint64_t position,
+                             uint32_t pattern);
+static int compare_matches(const void *a, const void *b);
+static inline int clean_char(unsigned char c);
+
+/*
+Notes:
+Patterns are matched the way `seqseq` matches them, ignoring case with U the same as T: characters
+are cleaned before being given a symbol, and every character whose cleaned form is in no pattern
+shares symbol 0, which leads back to the root. The transitions of every state are filled in once
+the failure links are known, so each character of a sequence takes a single lookup.
+
+Matches end in order, the ones of a pattern in the order they start too, so a match of a pattern
+overlapping the last one kept is dropped unless overlaps are asked for. This keeps the same matches
+as searching again with `seqseq` from the end of the last one. The matches of a sequence are then
+sorted by position, since matches of several patterns end in order but not start in order.
+*/
+
+
+/*==================================================================================================
+|                                         Public Functions                                         |
+==================================================================================================*/
+SeqMatch *
+seqseq_many(const char *const *sequences, uint64_t num_sequences, const char *const *patterns,
+            uint32_t num_patterns, bool overlapping, int threads, uint64_t *num_matches)
+{
+	*num_matches = 0;
+	if(sequences == NULL || patterns == NULL || num_sequences == 0)
+		return NULL;
+	SeqAutomaton *automaton = init_automaton(patterns, num_patterns);
+	if(automaton == NULL)
+		return NULL;
+
+	/* Chunks are searched in any order, and joined back in the order of their sequences */
+	threads = threads < 1 ? 1 : threads;
+	uint64_t num_chunks = (uint64_t)threads * CHUNKS_PER_THREAD;
+	num_chunks = num_chunks > num_sequences ? num_sequences : num_chunks;
+	SeqChunk *chunks = s_calloc(num_chunks, sizeof *chunks);
+	for(uint64_t i=0; i<num_chunks; i++) {
+		chunks[i].automaton = automaton;
+		chunks[i].sequences = sequences;
+		chunks[i].start = num_sequences * i / num_chunks;
+		chunks[i].end = num_sequences * (i + 1) / num_chunks;
+		chunks[i].overlapping = overlapping;
+	}
+
+	int num_tasks = (uint64_t)threads < num_chunks ? threads : (int)num_chunks;
+	struct SeqTask *tasks = s_malloc(num_tasks * sizeof *tasks);
+	KatssTaskGroup *jobs = katss_init_task_group();
+	for(int t=0; t<num_tasks; t++) {
+		tasks[t].chunks = chunks;
+		tasks[t].first = (uint64_t)t;
+		tasks[t].stride = (uint64_t)num_tasks;
+		tasks[t].num_chunks = num_chunks;
+		katss_submit_task(jobs, search_chunks, &tasks[t]);
+	}
+	katss_wait_task_group(jobs);
+	free(tasks);
+
+	uint64_t total = 0;
+	for(uint64_t i=0; i<num_chunks; i++)
+		total += chunks[i].num_matches;
+	SeqMatch *matches = total ? s_malloc(total * sizeof *matches) : NULL;
+	for(uint64_t i=0; i<num_chunks; i++) {
+		if(chunks[i].num_matches)
+			memcpy(matches + *num_matches, chunks[i].matches,
+			       chunks[i].num_matches * sizeof *matches);
+		*num_matches += chunks[i].num_matches;
+		free(chunks[i].matches);
+	}
+
+	free(chunks);
+	free_automaton(automaton);
+	return matches;
+}
+
+
+/*==================================================================================================
+|                                        Private Functions                                         |
+==================================================================================================*/
+/**
+ * @brief Build the automaton of `patterns`, or NULL if there are none or any of them is empty.
+ */
+static SeqAutomaton *
+init_automaton(const char *const *patterns, uint32_t num_patterns)
+{
+	if(num_patterns == 0)
+		return NULL;
+	for(uint32_t p=0; p<num_patterns; p++) {
+		if(patterns[p] == NULL || patterns[p][0] == '\0')
+			return NULL;
+	}
+
+	/* Every cleaned character of the patterns gets a symbol of its own */
+	SeqAutomaton *automaton = s_calloc(1, sizeof *automaton);
+	uint8_t symbols[256] = { 0 };
+	automaton->num_symbols = 1;
+	for(uint32_t p=0; p<num_patterns; p++) {
+		for(const unsigned char *c = (const unsigned char *)patterns[p]; *c; c++) {
+			int cleaned = clean_char(*c);
+			if(symbols[cleaned] == 0)
+				symbols[cleaned] = (uint8_t)automaton->num_symbols++;
+		}
+	}
+	for(int c=1; c<256; c++)
+		automaton->classes[c] = symbols[clean_char((unsigned char)c)];
+
+	/* Trie of the patterns, patterns ending at the same state chained in the order given */
+	automaton->num_patterns = num_patterns;
+	automaton->lengths = s_malloc(num_patterns * sizeof *automaton->lengths);
+	automaton->same_end = s_malloc(num_patterns * sizeof *automaton->same_end);
+	add_state(automaton);
+	for(uint32_t p=0; p<num_patterns; p++) {
+		int32_t state = 0;
+		uint64_t length = 0;
+		for(const unsigned char *c = (const unsigned char *)patterns[p]; *c; c++, length++) {
+			uint8_t symbol = automaton->classes[*c];
+			int32_t child = automaton->next[(size_t)state * automaton->num_symbols + symbol];
+			if(child < 0) {
+				child = add_state(automaton);
+				automaton->next[(size_t)state * automaton->num_symbols + symbol] = child;
+			}
+			state = child;
+		}
+		automaton->lengths[p] = length;
+		automaton->same_end[p] = -1;
+		int32_t *link = &automaton->first[state];
+		while(*link >= 0)
+			link = &automaton->same_end[*link];
+		*link = (int32_t)p;
+	}
+	build_links(automaton);
+
+	return automaton;
+}
+
+
+static void
+free_automaton(SeqAutomaton *automaton)
+{
+	free(automaton->next);
+	free(automaton->fail);
+	free(automaton->output);
+	free(automaton->first);
+	free(automaton->same_end);
+	free(automaton->lengths);
+	free(automaton);
+}
+
+
+static int32_t
+add_state(SeqAutomaton *automaton)
+{
+	if(automaton->num_states == automaton->states_size) {
+		int32_t size = automaton->states_size ? 2 * automaton->states_size : 64;
+		automaton->next = s_realloc(automaton->next,
+		                            (size_t)size * automaton->num_symbols * sizeof(int32_t));
+		automaton->fail = s_realloc(automaton->fail, (size_t)size * sizeof(int32_t));
+		automaton->output = s_realloc(automaton->output, (size_t)size * sizeof(int32_t));
+		automaton->first = s_realloc(automaton->first, (size_t)size * sizeof(int32_t));
+		automaton->states_size = size;
+	}
+
+	int32_t state = automaton->num_states++;
+	for(unsigned int s=0; s<automaton->num_symbols; s++)
+		automaton->next[(size_t)state * automaton->num_symbols + s] = -1;
+	automaton->fail[state] = 0;
+	automaton->output[state] = -1;
+	automaton->first[state] = -1;
+	return state;
+}
+
+
+/**
+ * @brief Set the failure link and output of every state, breadth first so the links of shorter
+ * states are known first, and fill the missing transitions in from the failure links.
+ */
+static void
+build_links(SeqAutomaton *automaton)
+{
+	const unsigned int num_symbols = automaton->num_symbols;
+	int32_t *next = automaton->next;
+	int32_t *queue = s_malloc((size_t)automaton->num_states * sizeof *queue);
+	size_t head = 0, tail = 0;
+
+	automaton->output[0] = automaton->first[0] >= 0 ? 0 : -1;
+	for(unsigned int s=0; s<num_symbols; s++) {
+		int32_t child = next[s];
+		if(child < 0) {
+			next[s] = 0;
+			continue;
+		}
+		automaton->fail[child] = 0;
+		queue[tail++] = child;
+	}
+
+	while(head < tail) {
+		int32_t state = queue[head++];
+		int32_t fail = automaton->fail[state];
+		automaton->output[state] = automaton->first[state] >= 0 ? state : automaton->output[fail];
+
+		for(unsigned int s=0; s<num_symbols; s++) {
+			int32_t *child = &next[(size_t)state * num_symbols + s];
+			if(*child < 0) {
+				*child = next[(size_t)fail * num_symbols + s];
+				continue;
+			}
+			automaton->fail[*child] = next[(size_t)fail * num_symbols + s];
+			queue[tail++] = *child;
+		}
+	}
+
+	free(queue);
+}
+
+
+static int
+search_chunks(void *arg)
+{
+	struct SeqTask *task = (struct SeqTask *)arg;
+	uint32_t num_patterns = task->chunks[0].automaton->num_patterns;
+
+	/* End of the last match kept of every pattern, and the sequence it was in */
+	uint64_t *last_end = s_malloc(num_patterns * sizeof *last_end);
+	uint64_t *last_seq = s_malloc(num_patterns * sizeof *last_seq);
+	for(uint32_t p=0; p<num_patterns; p++)
+		last_seq[p] = UINT64_MAX;
+
+	for(uint64_t i=task->first; i<task->num_chunks; i+=task->stride)
+		search_chunk(&task->chunks[i], last_end, last_seq);
+
+	free(last_end);
+	free(last_seq);
+	return 0;
+}
+
+
+static void
+search_chunk(SeqChunk *chunk, uint64_t *last_end, uint64_t *last_seq)
+{
+	const SeqAutomaton *automaton = chunk->automaton;
+	const unsigned int num_symbols = automaton->num_symbols;
+	const int32_t *next = automaton->next;
+	const int32_t *output = automaton->output;
+
+	for(uint64_t seq=chunk->start; seq<chunk->end; seq++) {
+		const unsigned char *sequence = (const unsigned char *)chunk->sequences[seq];
+		if(sequence == NULL)
+			continue;
+
+		uint64_t first_match = chunk->num_matches;
+		int32_t state = 0;
+		for(uint64_t i=0; sequence[i]; i++) {
+			state = next[(size_t)state * num_symbols + automaton->classes[sequence[i]]];
+			for(int32_t out = output[state]; out >= 0; out = output[automaton->fail[out]]) {
+				for(int32_t p = automaton->first[out]; p >= 0; p = automaton->same_end[p]) {
+					uint64_t start = i + 1 - automaton->lengths[p];
+					if(!chunk->overlapping && last_seq[p] == seq && start < last_end[p])
+						continue;
+					last_seq[p] = seq;
+					last_end[p] = i + 1;
+					add_match(chunk, seq, start, (uint32_t)p);
+				}
+			}
+		}
+
+		uint64_t found = chunk->num_matches - first_match;
+		if(found > 1)
+			qsort(chunk->matches + first_match, found, sizeof *chunk->matches, compare_matches);
+	}
+}
+
+
+static inline void
+add_match(SeqChunk *chunk, uint64_t sequence, uint64_t position, uint32_t pattern)
+{
+	if(chunk->num_matches == chunk->matches_size) {
+		chunk->matches_size = chunk->matches_size ? 2 * chunk->matches_size : 1024;
+		chunk->matches = s_realloc(chunk->matches, chunk->matches_size * sizeof *chunk->matches);
+	}
+	SeqMatch *match = &chunk->matches[chunk->num_matches++];
+	match->sequence = sequence;
+	match->position = position;
+	match->pattern = pattern;
+}
+
+
+static int
+compare_matches(const void *a, const void *b)
+{
+	const SeqMatch *x = (const SeqMatch *)a, *y = (const SeqMatch *)b;
+	if(x->position != y->position)
+		return x->position < y->position ? -1 : 1;
+	return (x->pattern > y->pattern) - (x->pattern < y->pattern);
+}
+
+
+/**
+ * @brief Same as `clean_nt` of seqseq.c: uppercase letters, with U turned into T.
+ */
+static inline int
+clean_char(unsigned char c)
+{
+	int ret = c;
+	if('a' <= c && c <= 'z')
+		ret = c - 32;
+	return ret == 'U' ? 'T' : ret;
+}
@@ -25,23 +25,510 @@
  * - Added clean_nt function for case-insensitive and U-to-T conversion
  * - Modified seqseq function to use clean_nt for nucleotide sequences
  * - Added seqncmp and seqchr functions for nucleotide sequence comparison
+ * - Added SIMD kernels filtering on the first and last nucleotide of the pattern, selected for
+ *   the running CPU at first use
  *
  * This modified code retains the LGPL license of the original work.
  */
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
 
+#if defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L) && !defined(__STDC_NO_THREADS__)
+#  include <threads.h>
+#else
+#  include <tinycthread.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  include <immintrin.h>
+#  define KATSS_X86_SIMD 1
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#  include <arm_neon.h>
+#  define KATSS_NEON_SIMD 1
+#endif
+
+#define SEARCH_AHEAD_MIN 256    /* Bytes first read ahead for the end of the sequence */
+#define SEARCH_AHEAD_MAX 65536  /* Most bytes read ahead at once */
+
+/* Pattern searched for by the search kernels */
+struct needle {
+	const unsigned char *pat;  /** Pattern searched for */
+	size_t len;                /** Length of the pattern */
+	size_t mid;                /** Position of the middle nucleotide of the pattern */
+	unsigned char fold_first;  /** OR-ed into the bytes compared to the first nucleotide */
+	unsigned char first[2];    /** Folded bytes the first nucleotide of the pattern matches */
+	unsigned char fold_mid;    /** OR-ed into the bytes compared to the middle nucleotide */
+	unsigned char middle[2];   /** Folded bytes the middle nucleotide of the pattern matches */
+	unsigned char fold_last;   /** OR-ed into the bytes compared to the last nucleotide */
+	unsigned char last[2];     /** Folded bytes the last nucleotide of the pattern matches */
+};
+
+typedef const unsigned char *(*search_fn)(const unsigned char *hs, size_t len,
+                                          const struct needle *ne);
+
+static void init_needle(struct needle *ne, const char *pat);
+static void fold_nt(unsigned char nt, unsigned char *fold, unsigned char *match);
+static const unsigned char *search_scalar(const unsigned char *hs, size_t len,
+                                          const struct needle *ne);
+#ifdef KATSS_X86_SIMD
+static const unsigned char *search_sse2(const unsigned char *hs, size_t len,
+                                        const struct needle *ne);
+static const unsigned char *search_avx2(const unsigned char *hs, size_t len,
+                                        const struct needle *ne);
+#endif
+#ifdef KATSS_NEON_SIMD
+static const unsigned char *search_neon(const unsigned char *hs, size_t len,
+                                        const struct needle *ne);
+#endif
+static void select_search(void);
+static search_fn get_search(void);
+static const char *search_fasta(const char *seq, const struct needle *ne, search_fn kernel,
+                                const char **line);
+static const char *search_lines(const char *seq, size_t len, const struct needle *ne,
+                                search_fn kernel);
+static const char *search_fastq(const char *seq, const struct needle *ne, search_fn kernel,
+                                const char **line);
+static inline const char *skip_lines(const char *seq, int num_lines);
+static bool is_plain(const char *pat, const char *breaks);
+
+static char *seqseq_twoway(const char *seq, const char *pat);
+static char *seqseqa_scan(const char *seq, const char *pat);
+static char *seqlseqa_scan(const char *seq, const char *pat);
+static char *seqseqq_scan(const char *seq, const char *pat);
+static char *seqlseqq_scan(const char *seq, const char *pat);
+
 static inline int clean_nt(const char c1);
 static inline int seqcmp(const char *seq, const char *pat);
 static inline int seqncmp(const unsigned char *seq, const unsigned char *pat, size_t len);
 static inline int seqcmpa(const char *seq, const char *pat);
 static inline char *seqchr(const char *seq, int nt);
 
+static search_fn search = NULL;
+static once_flag search_flag = ONCE_FLAG_INIT;
+
+/*
+Notes:
+The kernels compare a block of the sequence against the first nucleotide of the pattern, and the
+blocks the middle and the length of the pattern after it against the middle and last ones, so
+only the positions matching all three are compared in full. With four bases, two nucleotides
+alone would still leave a sixteenth of the positions to compare. Letters are folded to lowercase
+by OR-ing 0x20 into them, which keeps every other byte distinct, and T also matches u, the same
+equivalence `clean_nt` gives.
+
+Sequences are searched a block at a time as their end is found, so an early match doesn't read
+the whole buffer. FASTA and FASTQ sequences are searched between the lines that break them, found
+with the string functions of the C library, which are vectorized themselves. Patterns with a
+character that breaks sequences are still searched one character at a time. Single nucleotides,
+matched too often for a block to pay off, and patterns longer than 256 bases, which the two-way
+search only finds at the start of a sequence, are searched as they were.
+*/
+
 /*==================================================================================================
 |                                    Sequence Search Functions                                     |
 ==================================================================================================*/
+char *
+seqseq(const char *seq, const char *pat)
+{
+	search_fn kernel = get_search();
+	size_t ne_len = strlen(pat);
+	if(kernel == search_scalar || ne_len < 2 || ne_len > 256)
+		return seqseq_twoway(seq, pat);
+
+	struct needle ne;
+	init_needle(&ne, pat);
+	const unsigned char *hs = (const unsigned char *)seq;
+
+	/* Positions before `done` can't start a match, the sequence is known to go on up to `avail` */
+	size_t avail = 0, done = 0, ahead = SEARCH_AHEAD_MIN;
+	while(1) {
+		avail += strnlen((const char *)hs + avail, ahead);
+		if(avail >= done + ne_len) {
+			const unsigned char *found = kernel(hs + done, avail - done, &ne);
+			if(found != NULL)
+				return (char *)found;
+			done = avail - ne_len + 1;
+		}
+		if(hs[avail] == '\0')
+			return NULL;
+		ahead = ahead < SEARCH_AHEAD_MAX ? 2 * ahead : ahead;
+	}
+}
+
+
+char *
+seqlseq(const char *seq, const char *pat)
+{
+	register char *ret = seqseq(seq, pat);
+	if(ret == NULL)
+		return NULL;
+
+	while(ret > seq && *(ret - 1) != '\n') ret--;
+	return ret;
+}
+
+
+char *
+seqseqa(const char *seq, const char *pat)
+{
+	if(!is_plain(pat, ">"))
+		return seqseqa_scan(seq, pat);
+
+	struct needle ne;
+	init_needle(&ne, pat);
+	const char *line = NULL;
+	return (char *)search_fasta(seq, &ne, get_search(), &line);
+}
+
+
+char *
+seqlseqa(const char *seq, const char *pat)
+{
+	if(!is_plain(pat, ">"))
+		return seqlseqa_scan(seq, pat);
+
+	/* Matches before the first header have no sequence to begin */
+	struct needle ne;
+	init_needle(&ne, pat);
+	const char *line = NULL;
+	if(search_fasta(seq, &ne, get_search(), &line) == NULL)
+		return NULL;
+	return (char *)line;
+}
+
+
+char *
+seqseqq(const char *seq, const char *pat)
+{
+	if(!is_plain(pat, "@+"))
+		return seqseqq_scan(seq, pat);
+
+	struct needle ne;
+	init_needle(&ne, pat);
+	const char *line = NULL;
+	return (char *)search_fastq(seq, &ne, get_search(), &line);
+}
+
+
+char *
+seqlseqq(const char *seq, const char *pat)
+{
+	if(!is_plain(pat, "@+"))
+		return seqlseqq_scan(seq, pat);
+
+	struct needle ne;
+	init_needle(&ne, pat);
+	const char *line = NULL;
+	const char *found = search_fastq(seq, &ne, get_search(), &line);
+	if(found == NULL)
+		return NULL;
+
+	/* Matches before the first record begin at the start of their line */
+	if(line == NULL)
+		for(line = found; line > seq && line[-1] != '\n'; line--);
+	return (char *)line;
+}
+
+
+/*==================================================================================================
+|                                          Search Kernels                                          |
+==================================================================================================*/
+/**
+ * @brief Fold the first and last nucleotide of `pat` into the bytes the kernels compare against.
+ */
+static void
+init_needle(struct needle *ne, const char *pat)
+{
+	ne->pat = (const unsigned char *)pat;
+	ne->len = strlen(pat);
+	ne->mid = ne->len / 2;
+	fold_nt(ne->pat[0], &ne->fold_first, ne->first);
+	fold_nt(ne->pat[ne->mid], &ne->fold_mid, ne->middle);
+	fold_nt(ne->pat[ne->len - 1], &ne->fold_last, ne->last);
+}
+
+
+/**
+ * @brief Bytes matching `nt` once OR-ed with `fold`. Both cases of a letter match it, and u
+ * matches T, as with `clean_nt`. Any other character only matches itself.
+ */
+static void
+fold_nt(unsigned char nt, unsigned char *fold, unsigned char *match)
+{
+	int c = clean_nt((char)nt);
+	if('A' <= c && c <= 'Z') {
+		*fold = 0x20;
+		match[0] = (unsigned char)(c | 0x20);
+		match[1] = c == 'T' ? 'u' : match[0];
+	} else {
+		*fold = 0;
+		match[0] = match[1] = (unsigned char)c;
+	}
+}
+
+
+/**
+ * @brief Find the first match of `ne` that ends within the `len` bytes of `hs`, none of which are
+ * null. The SIMD kernels search blocks of 16 or 32 positions, and the last ones with this one.
+ */
+static const unsigned char *
+search_scalar(const unsigned char *hs, size_t len, const struct needle *ne)
+{
+	int first = clean_nt((char)ne->pat[0]);
+	for(size_t i=0; i + ne->len <= len; i++) {
+		if(clean_nt((char)hs[i]) == first && seqncmp(hs + i, ne->pat, ne->len))
+			return hs + i;
+	}
+	return NULL;
+}
+
+#ifdef KATSS_X86_SIMD
+static const unsigned char *
+search_sse2(const unsigned char *hs, size_t len, const struct needle *ne)
+{
+	const __m128i fold_first = _mm_set1_epi8((char)ne->fold_first);
+	const __m128i fold_last = _mm_set1_epi8((char)ne->fold_last);
+	const __m128i first0 = _mm_set1_epi8((char)ne->first[0]);
+	const __m128i first1 = _mm_set1_epi8((char)ne->first[1]);
+	const __m128i fold_mid = _mm_set1_epi8((char)ne->fold_mid);
+	const __m128i middle0 = _mm_set1_epi8((char)ne->middle[0]);
+	const __m128i middle1 = _mm_set1_epi8((char)ne->middle[1]);
+	const __m128i last0 = _mm_set1_epi8((char)ne->last[0]);
+	const __m128i last1 = _mm_set1_epi8((char)ne->last[1]);
+	const size_t m1 = ne->len - 1;
+
+	size_t i = 0;
+	for(; i + m1 + 16 <= len; i += 16) {
+		__m128i f = _mm_or_si128(_mm_loadu_si128((const __m128i *)(hs + i)), fold_first);
+		__m128i c = _mm_or_si128(_mm_loadu_si128((const __m128i *)(hs + i + ne->mid)), fold_mid);
+		__m128i l = _mm_or_si128(_mm_loadu_si128((const __m128i *)(hs + i + m1)), fold_last);
+		__m128i is_first = _mm_or_si128(_mm_cmpeq_epi8(f, first0), _mm_cmpeq_epi8(f, first1));
+		__m128i is_mid = _mm_or_si128(_mm_cmpeq_epi8(c, middle0), _mm_cmpeq_epi8(c, middle1));
+		__m128i is_last = _mm_or_si128(_mm_cmpeq_epi8(l, last0), _mm_cmpeq_epi8(l, last1));
+
+		__m128i all = _mm_and_si128(_mm_and_si128(is_first, is_mid), is_last);
+		unsigned int mask = (unsigned int)_mm_movemask_epi8(all);
+		while(mask) {
+			const unsigned char *at = hs + i + __builtin_ctz(mask);
+			if(seqncmp(at, ne->pat, ne->len))
+				return at;
+			mask &= mask - 1;
+		}
+	}
+
+	return search_scalar(hs + i, len - i, ne);
+}
+
+__attribute__((target("avx2"))) static const unsigned char *
+search_avx2(const unsigned char *hs, size_t len, const struct needle *ne)
+{
+	const __m256i fold_first = _mm256_set1_epi8((char)ne->fold_first);
+	const __m256i fold_last = _mm256_set1_epi8((char)ne->fold_last);
+	const __m256i first0 = _mm256_set1_epi8((char)ne->first[0]);
+	const __m256i first1 = _mm256_set1_epi8((char)ne->first[1]);
+	const __m256i fold_mid = _mm256_set1_epi8((char)ne->fold_mid);
+	const __m256i middle0 = _mm256_set1_epi8((char)ne->middle[0]);
+	const __m256i middle1 = _mm256_set1_epi8((char)ne->middle[1]);
+	const __m256i last0 = _mm256_set1_epi8((char)ne->last[0]);
+	const __m256i last1 = _mm256_set1_epi8((char)ne->last[1]);
+	const size_t m1 = ne->len - 1;
+
+	size_t i = 0;
+	for(; i + m1 + 32 <= len; i += 32) {
+		__m256i f = _mm256_or_si256(_mm256_loadu_si256((const __m256i *)(hs + i)), fold_first);
+		__m256i c = _mm256_or_si256(_mm256_loadu_si256((const __m256i *)(hs + i + ne->mid)),
+		                            fold_mid);
+		__m256i l = _mm256_or_si256(_mm256_loadu_si256((const __m256i *)(hs + i + m1)),
+		                            fold_last);
+		__m256i is_first = _mm256_or_si256(_mm256_cmpeq_epi8(f, first0),
+		                                   _mm256_cmpeq_epi8(f, first1));
+		__m256i is_mid = _mm256_or_si256(_mm256_cmpeq_epi8(c, middle0),
+		                                 _mm256_cmpeq_epi8(c, middle1));
+		__m256i is_last = _mm256_or_si256(_mm256_cmpeq_epi8(l, last0),
+		                                  _mm256_cmpeq_epi8(l, last1));
+
+		__m256i all = _mm256_and_si256(_mm256_and_si256(is_first, is_mid), is_last);
+		uint32_t mask = (uint32_t)_mm256_movemask_epi8(all);
+		while(mask) {
+			const unsigned char *at = hs + i + __builtin_ctz(mask);
+			if(seqncmp(at, ne->pat, ne->len))
+				return at;
+			mask &= mask - 1;
+		}
+	}
+
+	return search_sse2(hs + i, len - i, ne);
+}
+#endif
+
+#ifdef KATSS_NEON_SIMD
+static const unsigned char *
+search_neon(const unsigned char *hs, size_t len, const struct needle *ne)
+{
+	const uint8x16_t fold_first = vdupq_n_u8(ne->fold_first);
+	const uint8x16_t fold_last = vdupq_n_u8(ne->fold_last);
+	const uint8x16_t first0 = vdupq_n_u8(ne->first[0]), first1 = vdupq_n_u8(ne->first[1]);
+	const uint8x16_t fold_mid = vdupq_n_u8(ne->fold_mid);
+	const uint8x16_t middle0 = vdupq_n_u8(ne->middle[0]), middle1 = vdupq_n_u8(ne->middle[1]);
+	const uint8x16_t last0 = vdupq_n_u8(ne->last[0]), last1 = vdupq_n_u8(ne->last[1]);
+	const size_t m1 = ne->len - 1;
+
+	size_t i = 0;
+	for(; i + m1 + 16 <= len; i += 16) {
+		uint8x16_t f = vorrq_u8(vld1q_u8(hs + i), fold_first);
+		uint8x16_t c = vorrq_u8(vld1q_u8(hs + i + ne->mid), fold_mid);
+		uint8x16_t l = vorrq_u8(vld1q_u8(hs + i + m1), fold_last);
+		uint8x16_t is_first = vorrq_u8(vceqq_u8(f, first0), vceqq_u8(f, first1));
+		uint8x16_t is_mid = vorrq_u8(vceqq_u8(c, middle0), vceqq_u8(c, middle1));
+		uint8x16_t is_last = vorrq_u8(vceqq_u8(l, last0), vceqq_u8(l, last1));
+		uint8x16_t all = vandq_u8(vandq_u8(is_first, is_mid), is_last);
+		if(vmaxvq_u8(all) == 0)
+			continue;
+
+		uint8_t lanes[16];
+		vst1q_u8(lanes, all);
+		for(int b=0; b<16; b++) {
+			if(lanes[b] && seqncmp(hs + i + b, ne->pat, ne->len))
+				return hs + i + b;
+		}
+	}
+
+	return search_scalar(hs + i, len - i, ne);
+}
+#endif
+
+static void
+select_search(void)
+{
+	search = search_scalar;
+#ifdef KATSS_X86_SIMD
+	__builtin_cpu_init();
+	search = __builtin_cpu_supports("avx2") ? search_avx2 : search_sse2;
+#elif defined(KATSS_NEON_SIMD)
+	search = search_neon; /* NEON is part of the aarch64 baseline */
+#endif
+}
+
+
+static search_fn
+get_search(void)
+{
+	call_once(&search_flag, select_search);
+	return search;
+}
+
+
+/**
+ * @brief Find the first match of `ne` in the FASTA formatted `seq`, as `seqseqa_scan` does. Matches
+ * go across newlines, headers are skipped over. `line` is set to the start of the sequence after
+ * the last header skipped.
+ */
+static const char *
+search_fasta(const char *seq, const struct needle *ne, search_fn kernel, const char **line)
+{
+	while(1) {
+		size_t len = strcspn(seq, ">");
+		const char *found = search_lines(seq, len, ne, kernel);
+		if(found != NULL)
+			return found;
+
+		seq += len;
+		if(*seq == '\0' || (seq = skip_lines(seq, 1)) == NULL)
+			return NULL;
+		*line = seq;
+	}
+}
+
+
+/**
+ * @brief Find the first match of `ne` starting in the `len` bytes of `seq`, the lines of one FASTA
+ * sequence. Matches within a line are found with `kernel`, the ones going past the end of a line
+ * are compared one position at a time.
+ */
+static const char *
+search_lines(const char *seq, size_t len, const struct needle *ne, search_fn kernel)
+{
+	const char *end = seq + len;
+	int first = clean_nt((char)ne->pat[0]);
+	while(seq < end) {
+		const char *eol = memchr(seq, '\n', (size_t)(end - seq));
+		if(eol == NULL)
+			eol = end;
+		const char *found = (const char *)kernel((const unsigned char *)seq,
+		                                         (size_t)(eol - seq), ne);
+		if(found != NULL)
+			return found;
+
+		if(eol == end)
+			return NULL;
+		size_t line_len = (size_t)(eol - seq);
+		const char *from = line_len >= ne->len ? eol - (ne->len - 1) : seq;
+		for(; from < eol; from++) {
+			if(clean_nt(*from) == first && seqcmpa(from, (const char *)ne->pat))
+				return from;
+		}
+		seq = eol + 1;
+	}
+	return NULL;
+}
+
+
+/**
+ * @brief Find the first match of `ne` in the FASTQ formatted `seq`, as `seqseqq_scan` does.
+ * Headers are skipped over, as are '+' lines along with the quality scores and header after them.
+ * `line` is set to the start of the sequence after the last lines skipped.
+ */
+static const char *
+search_fastq(const char *seq, const struct needle *ne, search_fn kernel, const char **line)
+{
+	while(1) {
+		/* Matches don't go across newlines, so the lines between breaks are searched at once */
+		size_t len = strcspn(seq, "@+");
+		const char *found = (const char *)kernel((const unsigned char *)seq, len, ne);
+		if(found != NULL)
+			return found;
+
+		seq += len;
+		if(*seq == '\0' || (seq = skip_lines(seq, *seq == '@' ? 1 : 3)) == NULL)
+			return NULL;
+		*line = seq;
+	}
+}
+
+
+/**
+ * @brief Start of the line `num_lines` newlines after `seq`, or NULL if the sequence ends first.
+ */
+static inline const char *
+skip_lines(const char *seq, int num_lines)
+{
+	for(int i=0; i<num_lines; i++) {
+		if((seq = strchr(seq, '\n')) == NULL)
+			return NULL;
+		seq++;
+	}
+	return seq;
+}
+
+
+/**
+ * @brief Whether `pat` can be searched for between the lines that break sequences, i.e. it isn't
+ * empty and has no newline or character of `breaks`.
+ */
+static bool
+is_plain(const char *pat, const char *breaks)
+{
+	if(*pat == '\0')
+		return false;
+	return pat[strcspn(pat, breaks)] == '\0' && strchr(pat, '\n') == NULL;
+}
+
+
+/*==================================================================================================
+|                                     Scalar Search Functions                                      |
+==================================================================================================*/
 static inline char *
 seqseq2(const unsigned char *hs, const unsigned char *ne)
 {
@@ -70,8 +557,8 @@ seqseq3(const unsigned char *hs, const unsigned char *ne)
 #define hash2(p) (((size_t)clean_nt((p)[0]) - ((size_t)clean_nt((p)[-1]) << 3)) % sizeof(shift))
 
 
-char *
-seqseq(const char *seq, const char *pat)
+static char *
+seqseq_twoway(const char *seq, const char *pat)
 {
 	register const unsigned char *hs = (const unsigned char *)seq;
 	register const unsigned char *ne = (const unsigned char *)pat;
@@ -153,20 +640,8 @@ seqseq(const char *seq, const char *pat)
 }
 
 
-char *
-seqlseq(const char *seq, const char *pat)
-{
-	register char *ret = seqseq(seq, pat);
-	if(ret == NULL)
-		return NULL;
-
-	while(ret > seq && *(ret - 1) != '\n') ret--;
-	return ret;
-}
-
-
-char *
-seqseqa(const char *seq, const char *pat)
+static char *
+seqseqa_scan(const char *seq, const char *pat)
 {
 	register int c, sc;
 
@@ -188,8 +663,8 @@ seqseqa(const char *seq, const char *pat)
 }
 
 
-char *
-seqlseqa(const char *seq, const char *pat)
+static char *
+seqlseqa_scan(const char *seq, const char *pat)
 {
 	register int c, sc;
 	register char *l = NULL;
@@ -215,8 +690,8 @@ seqlseqa(const char *seq, const char *pat)
 }
 
 
-char *
-seqseqq(const char *seq, const char *pat)
+static char *
+seqseqq_scan(const char *seq, const char *pat)
 {
 	register int c, sc, cnt;
 
@@ -245,11 +720,12 @@ seqseqq(const char *seq, const char *pat)
 }
 
 
-char *
-seqlseqq(const char *seq, const char *pat)
+static char *
+seqlseqq_scan(const char *seq, const char *pat)
 {
 	register int c, sc, cnt;
-	register char *l;
+	register char *l = NULL;
+	register const char *start = seq;
 
 	/* Check pat > 0 */
 	if((c = clean_nt(*pat++)) == 0)
@@ -273,6 +749,9 @@ seqlseqq(const char *seq, const char *pat)
 		} while(sc != c);
 	} while(!seqcmp(seq, pat));
 
+	/* Matches before the first record begin at the start of their line */
+	if(l == NULL)
+		for(l = (char *)seq - 1; l > start && l[-1] != '\n'; l--);
 	return l;
 }
 
@@ -0,0 +1,656 @@
+#include <stdbool.h>
+#include <errno.h>
+#include <string.h>
+
+#if defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L) && !defined(__STDC_NO_THREADS__)
+#  include <threads.h>
+#else
+#  include <tinycthread.h>
+#endif
+
+#include "katss_core.h"
+#include "counter.h"
+#include "memory_utils.h"
+#include "seqfile.h"
+
+#define BUFFER_SIZE 65536U
+
+#define BASE_CODE(bases, i) (((bases)[(i) >> 2] >> 2*((i) & 3)) & 3)
+
+/* Sequences of a file, one per read */
+struct KatssSeqStore {
+	char *filename;              /** File the sequences were decoded from */
+	int loads;                   /** Times the file was preloaded and not unloaded yet */
+	int refs;                    /** Loads plus the readers still open, freed once 0 */
+	uint64_t max_bytes;          /** Most bytes the sequences may take while being loaded */
+	uint64_t num_bases;          /** Number of bases in `bases` */
+	uint64_t bases_size;         /** Bytes allocated for `bases` */
+	uint8_t *bases;              /** 2-bit code of every base, four per byte */
+	uint64_t layout_len;         /** Bytes used in `layout` */
+	uint64_t layout_size;        /** Bytes allocated for `layout` */
+	uint8_t *layout;             /** Per read, varints of its length, number of non-base
+	                                 characters, and bases before each of them */
+	struct KatssSeqStore *next;  /** Next preloaded file */
+};
+typedef struct KatssSeqStore KatssSeqStore;
+
+struct KatssStoreReader {
+	KatssSeqStore *store;  /** Sequences being read */
+	uint64_t base;         /** Next base to decode */
+	uint64_t offset;       /** Next byte of the layout to decode */
+	bool in_read;          /** If a read was started and not ended with its newline yet */
+	uint64_t read_left;    /** Characters of the read left to decode */
+	uint64_t run_left;     /** Bases left before the next non-base character */
+	uint64_t breaks_left;  /** Non-base characters left in the read */
+	mtx_t lock;            /** Guards the position, as readers are shared between threads */
+};
+
+/* Decodes the sequences being read before being stored, see `store_chunk` */
+struct StoreParser {
+	char filetype;         /** Type of file the chunks come from */
+	uint64_t line;         /** Lines fully read so far */
+	bool line_start;       /** If the next character starts a line */
+	bool in_seq;           /** If the current line is a sequence being stored */
+	bool skip;             /** If the current line isn't a sequence */
+	bool has_header;       /** Fasta only: a header was read */
+	bool has_seq;          /** Fasta only: the sequence under the last header was read */
+	uint64_t read_len;     /** Characters of the current read */
+	uint64_t run;          /** Bases since the last non-base character of the current read */
+	uint64_t num_breaks;   /** Non-base characters in the current read */
+	uint64_t breaks_size;  /** Room in `breaks` */
+	uint64_t *breaks;      /** Bases before each non-base character of the current read */
+};
+typedef struct StoreParser StoreParser;
+
+static KatssSeqStore *stores = NULL;
+static mtx_t stores_lock;
+static once_flag stores_once = ONCE_FLAG_INIT;
+static char quads[256][4];
+
+static int preload(const char *filename, SeqFile seqfile, uint64_t max_bytes);
+static bool load_again(const char *filename);
+static void add_store(KatssSeqStore *store, const char *filename);
+static void free_store(KatssSeqStore *store);
+static void init_stores(void);
+static KatssSeqStore *find_store(const char *filename);
+static void release_store(KatssSeqStore *store);
+static int store_chunk(KatssSeqStore *store, StoreParser *parser, const char *chunk);
+static void end_read(KatssSeqStore *store, StoreParser *parser);
+static inline uint64_t grow_size(const KatssSeqStore *store, uint64_t size);
+static inline void push_base(KatssSeqStore *store, uint8_t code);
+static inline void push_varint(KatssSeqStore *store, uint64_t value);
+static inline uint64_t pull_varint(const KatssSeqStore *store, uint64_t *offset);
+static int64_t next_read(KatssStoreReader *reader, char *buffer, size_t size);
+static void start_read(KatssStoreReader *reader);
+static void decode(KatssStoreReader *reader, char *buffer, uint64_t length);
+static inline void decode_bases(const uint8_t *bases, uint64_t base, char *buffer, uint64_t length);
+static inline uint64_t store_bytes(const KatssSeqStore *store);
+
+static const uint8_t nt_code[256] = {
+	['A'] = 1, ['a'] = 1, ['C'] = 2, ['c'] = 2, ['G'] = 3, ['g'] = 3,
+	['T'] = 4, ['t'] = 4, ['U'] = 4, ['u'] = 4,
+}; // code + 1, 0 for any other character
+
+
+/*==================================================================================================
+|                                         Public Functions                                         |
+==================================================================================================*/
+int
+katss_preload_file(const char *filename, uint64_t max_bytes)
+{
+	return preload(filename, NULL, max_bytes);
+}
+
+
+int
+katss_preload_seqfile(const char *name, SeqFile file, uint64_t max_bytes)
+{
+	if(file == NULL)
+		return 2;
+	return preload(name, file, max_bytes);
+}
+
+
+int
+katss_preload_sequences(const char *name, const char *const *sequences, uint64_t num_sequences,
+                        uint64_t max_bytes)
+{
+	if(name == NULL || (sequences == NULL && num_sequences != 0))
+		return 2;
+	call_once(&stores_once, init_stores);
+	if(load_again(name))
+		return 0;
+
+	/* Every sequence is a line of a raw sequences file */
+	KatssSeqStore *store = s_calloc(1, sizeof *store);
+	store->max_bytes = max_bytes;
+	StoreParser parser = { .filetype = 'r', .line_start = true };
+	int ret = 0;
+	for(uint64_t i=0; ret == 0 && i<num_sequences; i++) {
+		store_chunk(store, &parser, sequences[i]);
+		store_chunk(store, &parser, "\n");
+		if(store_bytes(store) > max_bytes)
+			ret = 3;
+	}
+	free(parser.breaks);
+
+	if(ret != 0) {
+		free_store(store);
+		return ret;
+	}
+	add_store(store, name);
+	return 0;
+}
+
+
+void
+katss_unload_file(const char *filename)
+{
+	if(filename == NULL)
+		return;
+	call_once(&stores_once, init_stores);
+
+	mtx_lock(&stores_lock);
+	KatssSeqStore *store = find_store(filename);
+	if(store != NULL && --store->loads == 0) {
+		/* Readers still open keep it until they are closed, new ones stream the file */
+		KatssSeqStore **link = &stores;
+		while(*link != store)
+			link = &(*link)->next;
+		*link = store->next;
+		store->next = NULL;
+	}
+	if(store != NULL)
+		release_store(store);
+	mtx_unlock(&stores_lock);
+}
+
+
+/*==================================================================================================
+|                                        Internal Functions                                        |
+==================================================================================================*/
+KatssStoreReader *
+katss_open_store(const char *filename)
+{
+	if(filename == NULL)
+		return NULL;
+	call_once(&stores_once, init_stores);
+
+	mtx_lock(&stores_lock);
+	KatssSeqStore *store = find_store(filename);
+	if(store != NULL)
+		store->refs++;
+	mtx_unlock(&stores_lock);
+	if(store == NULL)
+		return NULL;
+
+	KatssStoreReader *reader = s_calloc(1, sizeof *reader);
+	reader->store = store;
+	mtx_init(&reader->lock, mtx_plain);
+	return reader;
+}
+
+
+size_t
+katss_store_read(KatssStoreReader *reader, char *buffer, size_t size)
+{
+	if(reader == NULL || size < 2)
+		return 0;
+
+	mtx_lock(&reader->lock);
+	const KatssSeqStore *store = reader->store;
+	uint64_t length = 0, space = size - 1;
+	while(length < space) {
+		/* End the read with a newline, even if it had to wait for the next chunk */
+		if(reader->in_read && reader->read_left == 0) {
+			buffer[length++] = '\n';
+			reader->in_read = false;
+			continue;
+		}
+
+		/* Only start a read that fits whole, unless it doesn't fit even on its own */
+		if(!reader->in_read) {
+			if(reader->offset == store->layout_len)
+				break;
+			uint64_t offset = reader->offset;
+			if(length != 0 && pull_varint(store, &offset) + 1 > space - length)
+				break;
+			start_read(reader);
+		}
+
+		uint64_t decoded = MIN2(reader->read_left, space - length);
+		decode(reader, buffer + length, decoded);
+		length += decoded;
+	}
+	buffer[length] = '\0';
+	mtx_unlock(&reader->lock);
+
+	return length;
+}
+
+
+char *
+katss_store_gets(KatssStoreReader *reader, char *buffer, size_t size)
+{
+	if(reader == NULL || size < 1)
+		return NULL;
+
+	mtx_lock(&reader->lock);
+	int64_t decoded = next_read(reader, buffer, size);
+	mtx_unlock(&reader->lock);
+
+	return decoded < 0 ? NULL : buffer;
+}
+
+
+size_t
+katss_store_readbatch(KatssStoreReader *reader, char *buffer, size_t size, size_t read_size,
+                      size_t *ends, size_t max_reads)
+{
+	if(reader == NULL || read_size < 1)
+		return 0;
+
+	mtx_lock(&reader->lock);
+	size_t used = 0, reads = 0;
+	while(reads < max_reads && size - used >= read_size) {
+		int64_t decoded = next_read(reader, buffer + used, read_size);
+		if(decoded < 0)
+			break;
+		ends[reads++] = used + (size_t)decoded;
+		used += (size_t)decoded + 1;
+	}
+	mtx_unlock(&reader->lock);
+
+	return reads;
+}
+
+
+void
+katss_close_store(KatssStoreReader *reader)
+{
+	if(reader == NULL)
+		return;
+
+	mtx_lock(&stores_lock);
+	release_store(reader->store);
+	mtx_unlock(&stores_lock);
+
+	mtx_destroy(&reader->lock);
+	free(reader);
+}
+
+
+bool
+katss_stored_bases(const char *filename, uint64_t *num_bases)
+{
+	*num_bases = 0;
+	if(filename == NULL)
+		return false;
+	call_once(&stores_once, init_stores);
+
+	mtx_lock(&stores_lock);
+	KatssSeqStore *store = find_store(filename);
+	if(store != NULL)
+		*num_bases = store->num_bases;
+	mtx_unlock(&stores_lock);
+	return store != NULL;
+}
+
+
+/*==================================================================================================
+|                                        Private Functions                                         |
+==================================================================================================*/
+/**
+ * @brief Load the sequences of `filename`, read from `seqfile` instead if it isn't NULL, see
+ * `katss_preload_file` and `katss_preload_seqfile`.
+ */
+static int
+preload(const char *filename, SeqFile seqfile, uint64_t max_bytes)
+{
+	if(filename == NULL)
+		return 2;
+	call_once(&stores_once, init_stores);
+
+	if(load_again(filename))
+		return 0;
+
+	/* A file already open is read from its start, e.g. a pipe no one read from yet */
+	char filetype;
+	SeqFile file = katss_rewind_file(filename, seqfile, "", &filetype);
+	if(file == NULL)
+		return filetype == 'e' ? 1 : 2;
+
+	KatssSeqStore *store = s_calloc(1, sizeof *store);
+	store->max_bytes = max_bytes;
+	StoreParser parser = { .filetype = filetype, .line_start = true };
+	char *buffer = s_malloc(BUFFER_SIZE);
+	int ret = 0;
+	while(ret == 0 && seqfread_unlocked(file, buffer, BUFFER_SIZE)) {
+		ret = store_chunk(store, &parser, buffer);
+		if(store_bytes(store) > max_bytes)
+			ret = 3;
+	}
+	if(ret == 0 && seqferrno) {
+		error_message("katss: %d: %s", seqferrno, seqfstrerror(seqferrno));
+		ret = 4;
+	}
+	if(ret == 0 && parser.in_seq)
+		end_read(store, &parser);
+	if(ret == 0 && filetype == 'a' && parser.has_header && !parser.has_seq)
+		ret = 3;
+	free(parser.breaks);
+	free(buffer);
+	if(file != seqfile)
+		seqfclose(file);
+
+	if(ret != 0) {
+		free_store(store);
+		return ret;
+	}
+	add_store(store, filename);
+	return 0;
+}
+
+
+/**
+ * @brief Load `filename` once more if it is loaded already, returning whether it was.
+ */
+static bool
+load_again(const char *filename)
+{
+	/* Loading a file again only keeps it loaded until it is unloaded as many times */
+	mtx_lock(&stores_lock);
+	KatssSeqStore *store = find_store(filename);
+	if(store != NULL) {
+		store->loads++;
+		store->refs++;
+	}
+	mtx_unlock(&stores_lock);
+	return store != NULL;
+}
+
+
+/**
+ * @brief Make the sequences of `store` those read for `filename`, unless another thread loaded
+ * them in the meantime, in which case they are loaded once more and `store` is freed.
+ */
+static void
+add_store(KatssSeqStore *store, const char *filename)
+{
+	store->filename = s_malloc(strlen(filename) + 1);
+	strcpy(store->filename, filename);
+	store->loads = store->refs = 1;
+
+	mtx_lock(&stores_lock);
+	KatssSeqStore *loaded = find_store(filename);
+	if(loaded != NULL) {
+		loaded->loads++;
+		loaded->refs++;
+	} else {
+		store->next = stores;
+		stores = store;
+	}
+	mtx_unlock(&stores_lock);
+
+	if(loaded != NULL)
+		free_store(store);
+}
+
+
+static void
+free_store(KatssSeqStore *store)
+{
+	free(store->filename);
+	free(store->bases);
+	free(store->layout);
+	free(store);
+}
+
+
+static void
+init_stores(void)
+{
+	mtx_init(&stores_lock, mtx_plain);
+	for(int i=0; i<256; i++) {
+		for(int j=0; j<4; j++)
+			quads[i][j] = "ACGT"[(i >> 2*j) & 3];
+	}
+}
+
+
+static KatssSeqStore *
+find_store(const char *filename)
+{
+	KatssSeqStore *store = stores;
+	while(store != NULL && strcmp(store->filename, filename) != 0)
+		store = store->next;
+	return store;
+}
+
+
+static void
+release_store(KatssSeqStore *store)
+{
+	if(--store->refs > 0)
+		return;
+	free_store(store);
+}
+
+
+/**
+ * @brief Store the reads of a chunk from `seqfread`. Returns 0 on success, or 3 if the layout of
+ * the file can't be kept: fasta sequences spanning several lines, blank lines, or fastq records
+ * that aren't four lines. Those keep being streamed, as hashing them depends on their newlines.
+ */
+static int
+store_chunk(KatssSeqStore *store, StoreParser *parser, const char *chunk)
+{
+	for(const unsigned char *c = (const unsigned char *)chunk; *c; c++) {
+		if(parser->line_start) {
+			parser->line_start = false;
+			switch(parser->filetype) {
+			case 'r':
+				parser->in_seq = true;
+				break;
+			case 'a':
+				if(*c == '>') {
+					if(parser->has_header && !parser->has_seq)
+						return 3;
+					parser->has_header = true;
+					parser->has_seq = false;
+					parser->skip = true;
+				} else if(*c == '\n' || !parser->has_header || parser->has_seq) {
+					return 3;
+				} else {
+					parser->has_seq = true;
+					parser->in_seq = true;
+				}
+				break;
+			case 'q':
+				if((parser->line % 4 == 0 && *c != '@') || (parser->line % 4 == 2 && *c != '+'))
+					return 3;
+				parser->in_seq = parser->line % 4 == 1;
+				parser->skip = !parser->in_seq;
+				break;
+			}
+		}
+
+		if(*c == '\n') {
+			if(parser->in_seq)
+				end_read(store, parser);
+			parser->line++;
+			parser->line_start = true;
+			parser->in_seq = parser->skip = false;
+			continue;
+		}
+		if(parser->skip)
+			continue;
+
+		/* Only bases are stored, other characters only need their position in the read */
+		parser->read_len++;
+		if(nt_code[*c]) {
+			push_base(store, nt_code[*c] - 1);
+			parser->run++;
+			continue;
+		}
+		if(parser->num_breaks == parser->breaks_size) {
+			parser->breaks_size = MAX2(2 * parser->breaks_size, 16);
+			parser->breaks = s_realloc(parser->breaks, parser->breaks_size * sizeof *parser->breaks);
+		}
+		parser->breaks[parser->num_breaks++] = parser->run;
+		parser->run = 0;
+	}
+	return 0;
+}
+
+
+static void
+end_read(KatssSeqStore *store, StoreParser *parser)
+{
+	push_varint(store, parser->read_len);
+	push_varint(store, parser->num_breaks);
+	for(uint64_t i=0; i<parser->num_breaks; i++)
+		push_varint(store, parser->breaks[i]);
+
+	parser->read_len = parser->run = parser->num_breaks = 0;
+	parser->in_seq = false;
+}
+
+
+static inline void
+push_base(KatssSeqStore *store, uint8_t code)
+{
+	if((store->num_bases >> 2) == store->bases_size) {
+		store->bases_size = grow_size(store, store->bases_size);
+		store->bases = s_realloc(store->bases, store->bases_size);
+	}
+	if((store->num_bases & 3) == 0)
+		store->bases[store->num_bases >> 2] = 0;
+	store->bases[store->num_bases >> 2] |= code << 2*(store->num_bases & 3);
+	store->num_bases++;
+}
+
+
+static inline void
+push_varint(KatssSeqStore *store, uint64_t value)
+{
+	if(store->layout_size - store->layout_len < 10) {
+		store->layout_size = grow_size(store, store->layout_size);
+		store->layout = s_realloc(store->layout, store->layout_size);
+	}
+	while(value >= 0x80) {
+		store->layout[store->layout_len++] = (uint8_t)(value | 0x80);
+		value >>= 7;
+	}
+	store->layout[store->layout_len++] = (uint8_t)value;
+}
+
+
+/**
+ * @brief Double the size of an array, but no further than what gets past the store's limit to
+ * be noticed, so a file too large to load never takes twice the limit.
+ */
+static inline uint64_t
+grow_size(const KatssSeqStore *store, uint64_t size)
+{
+	uint64_t grown = MAX2(2 * size, BUFFER_SIZE);
+	return MAX2(MIN2(grown, store->max_bytes + BUFFER_SIZE), size + 16);
+}
+
+
+static inline uint64_t
+pull_varint(const KatssSeqStore *store, uint64_t *offset)
+{
+	uint64_t value = 0;
+	int shift = 0;
+	uint8_t byte;
+	do {
+		byte = store->layout[(*offset)++];
+		value |= (uint64_t)(byte & 0x7f) << shift;
+		shift += 7;
+	} while(byte & 0x80);
+	return value;
+}
+
+
+/**
+ * @brief Write the next read to `buffer` the way `katss_store_gets` does, with the reader locked.
+ * Returns the number of characters written, or -1 once every read was read.
+ */
+static int64_t
+next_read(KatssStoreReader *reader, char *buffer, size_t size)
+{
+	if(!reader->in_read && reader->offset == reader->store->layout_len)
+		return -1;
+	if(!reader->in_read)
+		start_read(reader);
+
+	/* Reads longer than the buffer continue on the next call */
+	uint64_t decoded = MIN2(reader->read_left, size - 1);
+	decode(reader, buffer, decoded);
+	buffer[decoded] = '\0';
+	if(reader->read_left == 0)
+		reader->in_read = false;
+	return (int64_t)decoded;
+}
+
+
+static void
+start_read(KatssStoreReader *reader)
+{
+	reader->read_left = pull_varint(reader->store, &reader->offset);
+	reader->breaks_left = pull_varint(reader->store, &reader->offset);
+	reader->run_left = reader->breaks_left ? pull_varint(reader->store, &reader->offset)
+	                                       : reader->read_left;
+	reader->in_read = true;
+}
+
+
+/**
+ * @brief Decode the next `length` characters of the current read, writing an 'N' for every
+ * character that wasn't a base.
+ */
+static void
+decode(KatssStoreReader *reader, char *buffer, uint64_t length)
+{
+	const KatssSeqStore *store = reader->store;
+	while(length > 0) {
+		if(reader->run_left == 0) {
+			*buffer++ = 'N';
+			length--;
+			reader->read_left--;
+			reader->run_left = --reader->breaks_left ? pull_varint(store, &reader->offset)
+			                                         : reader->read_left;
+			continue;
+		}
+		uint64_t run = MIN2(reader->run_left, length);
+		decode_bases(store->bases, reader->base, buffer, run);
+		buffer += run;
+		length -= run;
+		reader->base += run;
+		reader->run_left -= run;
+		reader->read_left -= run;
+	}
+}
+
+
+static inline void
+decode_bases(const uint8_t *bases, uint64_t base, char *buffer, uint64_t length)
+{
+	/* Single bases until aligned on a byte, then four bases at a time */
+	for(; length > 0 && (base & 3); length--, base++)
+		*buffer++ = "ACGT"[BASE_CODE(bases, base)];
+	for(; length >= 4; length -= 4, base += 4, buffer += 4)
+		memcpy(buffer, quads[bases[base >> 2]], 4);
+	for(; length > 0; length--, base++)
+		*buffer++ = "ACGT"[BASE_CODE(bases, base)];
+}
+
+
+static inline uint64_t
+store_bytes(const KatssSeqStore *store)
+{
+	return ((store->num_bases + 3) >> 2) + store->layout_len;
+}
+
+
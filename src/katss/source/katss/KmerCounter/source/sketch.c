@@ -0,0 +1,326 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "katss_core.h"
+#include "memory_utils.h"
+
+#define SKETCH_DEPTH 4          /* Rows of the sketch, every k-mer has a cell in each of them */
+#define SKETCH_MIN_BITS 10      /* Log2 of the fewest cells a row has */
+#define SKETCH_MAX_BITS 32      /* Log2 of the most cells a row has */
+#define SLOT_BITS 14            /* Log2 of the slots finding k-mers in the heap, 4 per k-mer */
+
+/* Estimated counts of every k-mer, and the k-mers estimated to be the most counted */
+struct KatssSketch {
+	unsigned int bits;      /** Log2 of the cells in a row */
+	uint32_t *cells;        /** SKETCH_DEPTH rows of 2^bits counts, one after the other */
+	uint32_t num_top;       /** K-mers in the heap */
+	uint64_t *top_keys;     /** Min-heap of the KATSS_SKETCH_TOP most counted k-mers */
+	uint64_t *top_counts;   /** Estimate of every k-mer of the heap, which orders it */
+	uint32_t *top_slots;    /** Slot of every k-mer of the heap */
+	uint32_t *slots;        /** Position in the heap plus one, by k-mer, 0 for a free slot */
+};
+/*
+Notes:
+A k-mer is estimated by the smallest of its cells, which only ever count more than it: every
+other k-mer landing on the same cell adds to it. Counting is a conservative update, which only
+raises the cells of a k-mer to its new estimate rather than adding to each of them, so the
+cells it shares with more frequent k-mers aren't pushed further past them. With w cells a row,
+an estimate is over by at most e*total/w with probability 1 - e^-4.
+
+The heap holds the k-mers whose estimate was highest when they were counted. A k-mer replaces
+the least of them once its estimate passes it, and the slots find a k-mer already in the heap
+without going through it. Taking counts away is only approximate: it lowers every cell of the
+k-mer, some of which other k-mers were counted in.
+*/
+
+static inline uint64_t mix(uint64_t x);
+static inline void cell_indexes(const KatssSketch *sketch, uint64_t hash, uint64_t *indexes);
+static inline uint32_t home_slot(uint64_t hash);
+static inline uint32_t find_slot(const KatssSketch *sketch, uint64_t hash);
+static void free_slot(KatssSketch *sketch, uint32_t slot);
+static void track(KatssSketch *sketch, uint64_t hash, uint64_t estimate);
+static inline void swap_top(KatssSketch *sketch, uint32_t a, uint32_t b);
+static void sift_up(KatssSketch *sketch, uint32_t pos);
+static void sift_down(KatssSketch *sketch, uint32_t pos);
+static int compare_keys(const void *a, const void *b);
+
+
+/*===================================
+|  Internal functions               |
+===================================*/
+KatssSketch *
+katss_init_sketch(uint64_t max_bytes)
+{
+	if(max_bytes == 0)
+		max_bytes = KATSS_SKETCH_BYTES;
+
+	/* Largest rows that fit, a power of two so a cell is the high bits of a hash */
+	unsigned int bits = SKETCH_MIN_BITS;
+	while(bits < SKETCH_MAX_BITS &&
+	      (SKETCH_DEPTH * sizeof(uint32_t)) << (bits + 1) <= max_bytes)
+		bits++;
+
+	KatssSketch *sketch = s_malloc(sizeof *sketch);
+	sketch->bits = bits;
+	sketch->cells = s_calloc((size_t)SKETCH_DEPTH << bits, sizeof *sketch->cells);
+	sketch->num_top = 0;
+	sketch->top_keys = s_malloc(KATSS_SKETCH_TOP * sizeof *sketch->top_keys);
+	sketch->top_counts = s_malloc(KATSS_SKETCH_TOP * sizeof *sketch->top_counts);
+	sketch->top_slots = s_malloc(KATSS_SKETCH_TOP * sizeof *sketch->top_slots);
+	sketch->slots = s_calloc(UINT32_C(1) << SLOT_BITS, sizeof *sketch->slots);
+
+	return sketch;
+}
+
+
+void
+katss_free_sketch(KatssSketch *sketch)
+{
+	if(sketch == NULL)
+		return;
+	free(sketch->cells);
+	free(sketch->top_keys);
+	free(sketch->top_counts);
+	free(sketch->top_slots);
+	free(sketch->slots);
+	free(sketch);
+}
+
+
+void
+katss_clear_sketch(KatssSketch *sketch)
+{
+	memset(sketch->cells, 0, ((size_t)SKETCH_DEPTH << sketch->bits) * sizeof *sketch->cells);
+	memset(sketch->slots, 0, (UINT32_C(1) << SLOT_BITS) * sizeof *sketch->slots);
+	sketch->num_top = 0;
+}
+
+
+void
+katss_sketch_add(KatssSketch *sketch, uint64_t hash, uint64_t count)
+{
+	uint64_t indexes[SKETCH_DEPTH];
+	cell_indexes(sketch, hash, indexes);
+
+	uint64_t estimate = UINT32_MAX;
+	for(int r=0; r<SKETCH_DEPTH; r++)
+		estimate = MIN2(estimate, sketch->cells[indexes[r]]);
+	estimate = MIN2(estimate + count, UINT32_MAX);
+
+	/* Only the cells that fall short of the new estimate are raised to it */
+	for(int r=0; r<SKETCH_DEPTH; r++) {
+		if(sketch->cells[indexes[r]] < estimate)
+			sketch->cells[indexes[r]] = (uint32_t)estimate;
+	}
+	track(sketch, hash, estimate);
+}
+
+
+void
+katss_sketch_sub(KatssSketch *sketch, uint64_t hash)
+{
+	uint64_t indexes[SKETCH_DEPTH];
+	cell_indexes(sketch, hash, indexes);
+	for(int r=0; r<SKETCH_DEPTH; r++) {
+		if(sketch->cells[indexes[r]] != 0)
+			sketch->cells[indexes[r]]--;
+	}
+
+	/* A k-mer of the heap moves up it, it is only ever replaced by a k-mer being counted */
+	uint32_t slot = find_slot(sketch, hash);
+	if(sketch->slots[slot] != 0) {
+		uint32_t pos = sketch->slots[slot] - 1;
+		sketch->top_counts[pos] = katss_sketch_get(sketch, hash);
+		sift_up(sketch, pos);
+	}
+}
+
+
+uint64_t
+katss_sketch_get(const KatssSketch *sketch, uint64_t hash)
+{
+	uint64_t indexes[SKETCH_DEPTH];
+	cell_indexes(sketch, hash, indexes);
+
+	uint32_t estimate = UINT32_MAX;
+	for(int r=0; r<SKETCH_DEPTH; r++)
+		estimate = MIN2(estimate, sketch->cells[indexes[r]]);
+	return estimate;
+}
+
+
+uint64_t
+katss_sketch_top(const KatssSketch *sketch, uint64_t **kmers)
+{
+	uint64_t num = 0;
+	*kmers = s_malloc(MAX2(sketch->num_top, 1) * sizeof **kmers);
+	for(uint32_t i=0; i<sketch->num_top; i++) {
+		if(sketch->top_counts[i] != 0)
+			(*kmers)[num++] = sketch->top_keys[i];
+	}
+	qsort(*kmers, num, sizeof **kmers, compare_keys);
+	return num;
+}
+
+
+/*===================================
+|  Helper functions                 |
+===================================*/
+static inline uint64_t
+mix(uint64_t x)
+{
+	x = (x ^ (x >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+	x = (x ^ (x >> 27)) * UINT64_C(0x94D049BB133111EB);
+	return x ^ (x >> 31);
+}
+
+
+/**
+ * @brief Index of the cell of `hash` in every row. Rows are told apart by adding multiples of a
+ * second hash to the first, which is as good as hashing each row on its own.
+ */
+static inline void
+cell_indexes(const KatssSketch *sketch, uint64_t hash, uint64_t *indexes)
+{
+	uint64_t h1 = mix(hash + UINT64_C(0x9E3779B97F4A7C15));
+	uint64_t h2 = mix(hash ^ UINT64_C(0xD1B54A32D192ED03)) | 1;
+	for(int r=0; r<SKETCH_DEPTH; r++)
+		indexes[r] = ((uint64_t)r << sketch->bits) + ((h1 + r * h2) >> (64 - sketch->bits));
+}
+
+
+static inline uint32_t
+home_slot(uint64_t hash)
+{
+	return (uint32_t)((hash * UINT64_C(0x9E3779B97F4A7C15)) >> (64 - SLOT_BITS));
+}
+
+
+/**
+ * @brief Slot of `hash` if it is in the heap, or else the free slot it would take.
+ */
+static inline uint32_t
+find_slot(const KatssSketch *sketch, uint64_t hash)
+{
+	const uint32_t mask = (UINT32_C(1) << SLOT_BITS) - 1;
+	uint32_t slot = home_slot(hash);
+	while(sketch->slots[slot] != 0 && sketch->top_keys[sketch->slots[slot] - 1] != hash)
+		slot = (slot + 1) & mask;
+	return slot;
+}
+
+
+/**
+ * @brief Free `slot`, moving back the k-mers after it that would no longer be found past it.
+ */
+static void
+free_slot(KatssSketch *sketch, uint32_t slot)
+{
+	const uint32_t mask = (UINT32_C(1) << SLOT_BITS) - 1;
+	sketch->slots[slot] = 0;
+	for(uint32_t next = (slot + 1) & mask; sketch->slots[next] != 0; next = (next + 1) & mask) {
+		uint32_t home = home_slot(sketch->top_keys[sketch->slots[next] - 1]);
+		if(((next - home) & mask) < ((next - slot) & mask))
+			continue;
+		sketch->slots[slot] = sketch->slots[next];
+		sketch->top_slots[sketch->slots[slot] - 1] = slot;
+		sketch->slots[next] = 0;
+		slot = next;
+	}
+}
+
+
+/**
+ * @brief Keep `hash` in the heap if its estimate is among the highest.
+ */
+static void
+track(KatssSketch *sketch, uint64_t hash, uint64_t estimate)
+{
+	uint32_t slot = find_slot(sketch, hash);
+	if(sketch->slots[slot] != 0) {
+		uint32_t pos = sketch->slots[slot] - 1;
+		sketch->top_counts[pos] = estimate;
+		sift_down(sketch, pos);
+		return;
+	}
+
+	uint32_t pos;
+	if(sketch->num_top < KATSS_SKETCH_TOP) {
+		pos = sketch->num_top++;
+	} else if(estimate > sketch->top_counts[0]) {
+		/* Freeing the slot of the least k-mer may move the free slot of this one */
+		pos = 0;
+		free_slot(sketch, sketch->top_slots[0]);
+		slot = find_slot(sketch, hash);
+	} else {
+		return;
+	}
+
+	sketch->top_keys[pos] = hash;
+	sketch->top_counts[pos] = estimate;
+	sketch->top_slots[pos] = slot;
+	sketch->slots[slot] = pos + 1;
+	if(pos == 0)
+		sift_down(sketch, pos);
+	else
+		sift_up(sketch, pos);
+}
+
+
+static inline void
+swap_top(KatssSketch *sketch, uint32_t a, uint32_t b)
+{
+	uint64_t key = sketch->top_keys[a];
+	sketch->top_keys[a] = sketch->top_keys[b];
+	sketch->top_keys[b] = key;
+
+	uint64_t count = sketch->top_counts[a];
+	sketch->top_counts[a] = sketch->top_counts[b];
+	sketch->top_counts[b] = count;
+
+	uint32_t slot = sketch->top_slots[a];
+	sketch->top_slots[a] = sketch->top_slots[b];
+	sketch->top_slots[b] = slot;
+
+	sketch->slots[sketch->top_slots[a]] = a + 1;
+	sketch->slots[sketch->top_slots[b]] = b + 1;
+}
+
+
+static void
+sift_up(KatssSketch *sketch, uint32_t pos)
+{
+	while(pos > 0) {
+		uint32_t parent = (pos - 1) / 2;
+		if(sketch->top_counts[parent] <= sketch->top_counts[pos])
+			return;
+		swap_top(sketch, parent, pos);
+		pos = parent;
+	}
+}
+
+
+static void
+sift_down(KatssSketch *sketch, uint32_t pos)
+{
+	for(;;) {
+		uint32_t least = pos, child = 2 * pos + 1;
+		if(child < sketch->num_top && sketch->top_counts[child] < sketch->top_counts[least])
+			least = child;
+		if(child + 1 < sketch->num_top && sketch->top_counts[child + 1] < sketch->top_counts[least])
+			least = child + 1;
+		if(least == pos)
+			return;
+		swap_top(sketch, pos, least);
+		pos = least;
+	}
+}
+
+
+static int
+compare_keys(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
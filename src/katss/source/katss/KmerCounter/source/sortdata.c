@@ -0,0 +1,382 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "memory_utils.h"
+#include "katss.h"
+#include "katss_helpers.h"
+
+#define SORT_MIN_KMERS 65536 /* Fewest entries each thread sorts */
+#define SORT_RADIX 256       /* Buckets of every pass, a byte of the key */
+#define ROWS_ROOM 4096       /* Rows first allocated when it isn't known how many are kept */
+
+/* Share of the entries of a KatssData a thread sorts */
+struct sort_job {
+	const KatssDataEntry *kmers; /** Entries to sort */
+	KatssDataEntry *sorted;      /** Where `gather_entries` writes them in order */
+	uint64_t *keys;              /** Keys of the entries, see `sort_key` */
+	uint64_t *swap;              /** Where a pass writes the keys in order of its byte */
+	uint64_t start;              /** First entry (or key) of the share */
+	uint64_t end;                /** End of the share */
+	bool by_count;               /** Sort by `count` instead of `rval` */
+	int shift;                   /** Bit the byte of the current pass starts at */
+	uint64_t buckets[SORT_RADIX]; /** Keys of the share in each bucket, then where they go */
+};
+
+/* Row kept among the top ones of a KatssRows, with the key sorting it */
+struct top_row {
+	uint64_t key;          /** Key of the row, see `sort_key` */
+	KatssDataEntry entry;  /** The row */
+};
+
+/* Rows of a KatssData, kept as they are added */
+struct KatssRows {
+	KatssData *data;       /** Rows kept in the order they were added, when not keeping the top */
+	uint64_t room;         /** Rows `data` has room for */
+	uint64_t num_kmers;    /** Rows that may be added */
+	struct top_row *top;   /** Heap of the top rows, the last of them first, or NULL */
+	uint64_t num_top;      /** Top rows to keep, 0 to keep them all */
+	uint64_t kept;         /** Rows in `top` */
+	uint64_t min_count;    /** Rows counted fewer times are left out */
+	bool by_count;         /** Rows are ranked by `count` instead of `rval` */
+	uint64_t added;        /** Rows added so far, the rank of the next one */
+};
+
+static int make_keys(void *arg);
+static int fill_buckets(void *arg);
+static int scatter_keys(void *arg);
+static int gather_entries(void *arg);
+static uint64_t sort_key(const KatssDataEntry *entry, uint64_t index, bool by_count);
+static void select_keys(uint64_t *keys, uint64_t num, uint64_t nth);
+static int compare_keys(const void *a, const void *b);
+static void sift_down(struct top_row *heap, uint64_t num, uint64_t pos);
+static int compare_rows(const void *a, const void *b);
+
+/*
+Notes:
+Every entry is sorted by a 64-bit key, its rank in the low 32 bits and the value sorted by in the
+high ones, flipped so that higher values come first and NaN last (see `sort_key`). Keys are then
+sorted as plain integers, so ties stay in the order of the k-mers, as a stable sort leaves them,
+and the entries are copied in the order of their sorted keys at the end.
+
+A full sort is an LSD radix sort on the bytes of the value, each pass counting the keys of every
+byte on all threads, and then moving them to their place on all threads. A pass whose byte is the
+same for every key moves nothing, and is skipped, as the high bytes of small counts are.
+
+Keeping only the top entries selects them (an nth_element) before sorting them alone, since the
+top 500 of the 16 million k-mers of 12 bases are only a small part of them. The entries selected
+are the ones a full sort would have put first, in the same order.
+
+Results that only keep some rows never hold the others, see `katss_init_rows`. The top rows are a
+heap as large as the rows kept, whose root is the last of them, so a row is only looked at again
+if it ranks above it, and the heap is sorted once every row was added. Rows are ranked by the same
+keys, their rank being the order they were added in, so they end as `katss_sort_kdata` puts them.
+*/
+
+
+/*==================================================================================================
+|                                        Internal Functions                                        |
+==================================================================================================*/
+void
+katss_sort_kdata(KatssData *data, bool by_count, uint64_t top, int threads)
+{
+	uint64_t num = data->num_kmers;
+	uint64_t keep = top ? MIN2(top, num) : num;
+	if(num == 0)
+		return;
+
+	/* Every thread sorts at least SORT_MIN_KMERS of the entries */
+	int num_jobs = (int)MAX2(MIN2((uint64_t)MAX2(threads, 1), num / SORT_MIN_KMERS), 1);
+	struct sort_job *jobs = s_malloc(num_jobs * sizeof *jobs);
+	uint64_t *keys = s_malloc(num * sizeof *keys);
+	uint64_t *swap = keep == num ? s_malloc(num * sizeof *swap) : NULL;
+	for(int j=0; j<num_jobs; j++) {
+		jobs[j].kmers = data->kmers;
+		jobs[j].keys = keys;
+		jobs[j].swap = swap;
+		jobs[j].start = num * j / num_jobs;
+		jobs[j].end = num * (j + 1) / num_jobs;
+		jobs[j].by_count = by_count;
+	}
+	katss_run_jobs(make_keys, jobs, sizeof *jobs, num_jobs);
+
+	/* Only the top keys are sorted, once they are picked out */
+	if(keep < num) {
+		select_keys(keys, num, keep);
+		qsort(keys, keep, sizeof *keys, compare_keys);
+	}
+
+	/* Sort on a byte of the value at a time, lowest first */
+	for(int shift=32; keep == num && shift<64; shift+=8) {
+		for(int j=0; j<num_jobs; j++)
+			jobs[j].shift = shift;
+		katss_run_jobs(fill_buckets, jobs, sizeof *jobs, num_jobs);
+
+		/* Keys go after the ones of lower buckets, and of the same bucket in earlier shares */
+		uint64_t offset = 0;
+		bool moved = true;
+		for(int b=0; b<SORT_RADIX; b++) {
+			uint64_t in_bucket = 0;
+			for(int j=0; j<num_jobs; j++) {
+				uint64_t count = jobs[j].buckets[b];
+				jobs[j].buckets[b] = offset + in_bucket;
+				in_bucket += count;
+			}
+			moved = moved && in_bucket != num;
+			offset += in_bucket;
+		}
+		if(!moved)
+			continue;
+		katss_run_jobs(scatter_keys, jobs, sizeof *jobs, num_jobs);
+
+		uint64_t *tmp = keys;
+		keys = swap;
+		swap = tmp;
+		for(int j=0; j<num_jobs; j++) {
+			jobs[j].keys = keys;
+			jobs[j].swap = swap;
+		}
+	}
+
+	/* Copy the entries kept in the order of their keys */
+	KatssDataEntry *sorted = s_malloc(keep * sizeof *sorted);
+	for(int j=0; j<num_jobs; j++) {
+		jobs[j].sorted = sorted;
+		jobs[j].start = keep * j / num_jobs;
+		jobs[j].end = keep * (j + 1) / num_jobs;
+	}
+	katss_run_jobs(gather_entries, jobs, sizeof *jobs, num_jobs);
+
+	free(data->kmers);
+	data->kmers = sorted;
+	data->num_kmers = keep;
+	free(swap);
+	free(keys);
+	free(jobs);
+}
+
+
+KatssRows *
+katss_init_rows(uint64_t num_kmers, bool by_count, const KatssOptions *opts)
+{
+	KatssRows *rows = s_malloc(sizeof *rows);
+	rows->num_kmers = num_kmers;
+	rows->num_top = opts->top_kmers ? MIN2(opts->top_kmers, num_kmers) : 0;
+	rows->kept = 0;
+	rows->min_count = opts->min_count;
+	rows->by_count = by_count;
+	rows->added = 0;
+
+	/* Rows left out by their count aren't known in advance, they are made room for as needed */
+	rows->room = rows->min_count ? MIN2(num_kmers, ROWS_ROOM) : num_kmers;
+	rows->top = NULL;
+	rows->data = NULL;
+	if(rows->num_top)
+		rows->top = s_malloc(rows->num_top * sizeof *rows->top);
+	else
+		rows->data = katss_alloc_kdata(rows->room);
+	if(rows->data != NULL)
+		rows->data->num_kmers = 0;
+	return rows;
+}
+
+
+void
+katss_add_row(KatssRows *rows, const KatssDataEntry *entry, uint64_t count)
+{
+	uint64_t rank = rows->added++;
+	if(count < rows->min_count)
+		return;
+
+	/* Rows are kept in order when every row passing the count is */
+	if(rows->top == NULL) {
+		KatssData *data = rows->data;
+		if(data->num_kmers == rows->room) {
+			rows->room = MIN2(rows->room * 2, rows->num_kmers);
+			data->kmers = s_realloc(data->kmers, rows->room * sizeof *data->kmers);
+		}
+		data->kmers[data->num_kmers++] = *entry;
+		return;
+	}
+
+	/* Past the first rows, only the ones above the last of the top replace it */
+	uint64_t key = sort_key(entry, rank, rows->by_count);
+	if(rows->kept < rows->num_top) {
+		uint64_t pos = rows->kept++;
+		while(pos > 0 && rows->top[(pos - 1) / 2].key < key) {
+			rows->top[pos] = rows->top[(pos - 1) / 2];
+			pos = (pos - 1) / 2;
+		}
+		rows->top[pos].key = key;
+		rows->top[pos].entry = *entry;
+	} else if(key < rows->top[0].key) {
+		rows->top[0].key = key;
+		rows->top[0].entry = *entry;
+		sift_down(rows->top, rows->kept, 0);
+	}
+}
+
+
+KatssData *
+katss_finish_rows(KatssRows *rows)
+{
+	KatssData *data = rows->data;
+	if(rows->top != NULL) {
+		qsort(rows->top, rows->kept, sizeof *rows->top, compare_rows);
+		data = katss_alloc_kdata(rows->kept);
+		for(uint64_t i=0; i<rows->kept; i++)
+			data->kmers[i] = rows->top[i].entry;
+		free(rows->top);
+	} else if(data->num_kmers < rows->room) {
+		data->kmers = s_realloc(data->kmers, MAX2(data->num_kmers, 1) * sizeof *data->kmers);
+	}
+
+	free(rows);
+	return data;
+}
+
+
+/*==================================================================================================
+|                                        Private Functions                                         |
+==================================================================================================*/
+static int
+make_keys(void *arg)
+{
+	struct sort_job *job = arg;
+	for(uint64_t i=job->start; i<job->end; i++)
+		job->keys[i] = sort_key(&job->kmers[i], i, job->by_count);
+	return 0;
+}
+
+
+static int
+fill_buckets(void *arg)
+{
+	struct sort_job *job = arg;
+	memset(job->buckets, 0, sizeof job->buckets);
+	for(uint64_t i=job->start; i<job->end; i++)
+		job->buckets[(job->keys[i] >> job->shift) & (SORT_RADIX - 1)]++;
+	return 0;
+}
+
+
+static int
+scatter_keys(void *arg)
+{
+	struct sort_job *job = arg;
+	for(uint64_t i=job->start; i<job->end; i++) {
+		uint64_t key = job->keys[i];
+		job->swap[job->buckets[(key >> job->shift) & (SORT_RADIX - 1)]++] = key;
+	}
+	return 0;
+}
+
+
+static int
+gather_entries(void *arg)
+{
+	struct sort_job *job = arg;
+	for(uint64_t i=job->start; i<job->end; i++)
+		job->sorted[i] = job->kmers[job->keys[i] & UINT32_MAX];
+	return 0;
+}
+
+
+/**
+ * @brief Key sorting the entry of rank `index` as the old comparisons `qsort` used did: highest
+ * count, or highest `rval` with NaN last, first, and 0 the same as -0. Ties are broken by rank.
+ */
+static uint64_t
+sort_key(const KatssDataEntry *entry, uint64_t index, bool by_count)
+{
+	uint32_t value;
+	if(by_count) {
+		value = ~entry->count;
+	} else if(isnan(entry->rval)) {
+		value = UINT32_MAX;
+	} else {
+		/* Flip the bits of floats so they order as unsigned integers, highest first */
+		float rval = entry->rval == 0 ? 0 : entry->rval;
+		uint32_t bits;
+		memcpy(&bits, &rval, sizeof bits);
+		value = bits & UINT32_C(0x80000000) ? bits : ~bits & UINT32_C(0x7fffffff);
+	}
+	return (uint64_t)value << 32 | index;
+}
+
+
+/**
+ * @brief Move the `nth` lowest of the `num` keys to the front of `keys`, in no particular order.
+ */
+static void
+select_keys(uint64_t *keys, uint64_t num, uint64_t nth)
+{
+	uint64_t low = 0, high = num;
+	while(high - low > 1) {
+		/* Partition around the median of the first, middle and last keys, which is never the
+		   highest key with three or more of them, so neither side is ever empty */
+		uint64_t a = keys[low], b = keys[low + (high - low) / 2], c = keys[high - 1];
+		uint64_t pivot = a < b ? (b < c ? b : MAX2(a, c)) : (a < c ? a : MAX2(b, c));
+		if(high - low < 3)
+			pivot = a;
+		uint64_t i = low, j = high - 1;
+		while(true) {
+			while(keys[i] < pivot)
+				i++;
+			while(keys[j] > pivot)
+				j--;
+			if(i >= j)
+				break;
+			uint64_t tmp = keys[i];
+			keys[i++] = keys[j];
+			keys[j--] = tmp;
+		}
+
+		/* keys[low..j] are now the lowest ones */
+		if(j + 1 == nth)
+			return;
+		if(j + 1 < nth)
+			low = j + 1;
+		else
+			high = j + 1;
+	}
+}
+
+
+static int
+compare_keys(const void *a, const void *b)
+{
+	uint64_t key1 = *(const uint64_t *)a;
+	uint64_t key2 = *(const uint64_t *)b;
+	return (key1 > key2) - (key1 < key2);
+}
+
+
+/**
+ * @brief Move the row at `pos` of the `num` rows of `heap` down to its place, below every row
+ * with a higher key.
+ */
+static void
+sift_down(struct top_row *heap, uint64_t num, uint64_t pos)
+{
+	struct top_row row = heap[pos];
+	while(2 * pos + 1 < num) {
+		uint64_t child = 2 * pos + 1;
+		if(child + 1 < num && heap[child + 1].key > heap[child].key)
+			child++;
+		if(heap[child].key < row.key)
+			break;
+		heap[pos] = heap[child];
+		pos = child;
+	}
+	heap[pos] = row;
+}
+
+
+static int
+compare_rows(const void *a, const void *b)
+{
+	return compare_keys(&((const struct top_row *)a)->key, &((const struct top_row *)b)->key);
+}
@@ -0,0 +1,172 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "katss.h"
+#include "katss_core.h"
+#include "katss_helpers.h"
+#include "memory_utils.h"
+#include "seqfile.h"
+
+/*
+Notes:
+The counters are shared by every thread and only added to while a run collects statistics, so a
+build with them costs a relaxed load per block of hashes, or per lock taken, otherwise. They are
+never reset: a run keeps their values when it starts, and takes the difference once it stops.
+Runs that don't collect statistics, but count at the same time as one that does, add to it.
+
+Locks are only timed when another thread holds them, so uncontended locks never read the clock.
+*/
+
+#if KATSS_STATS
+struct KatssCounters katss_counters;
+
+/* The run collecting statistics, set between `katss_start_stats` and `katss_stop_stats` */
+static struct {
+	mtx_t lock;                  /** Guards the fields below */
+	KatssStats *stats;           /** Statistics being collected, NULL if none are */
+	int iterations_size;         /** Room in `stats->iteration_seconds` */
+	uint64_t start_ns;           /** When the run started */
+	uint64_t lap_ns;             /** When the current iteration started */
+	uint64_t kmers_hashed;       /** Counters when the run started */
+	uint64_t invalid_resets;
+	uint64_t increment_wait_ns;
+	struct SeqfStats seqf;
+} run;
+static once_flag run_flag = ONCE_FLAG_INIT;
+
+static void
+init_run(void)
+{
+	mtx_init(&run.lock, mtx_plain);
+}
+
+static uint64_t
+clock_ns(void)
+{
+	struct timespec now;
+	timespec_get(&now, TIME_UTC);
+	return (uint64_t)now.tv_sec * 1000000000U + (uint64_t)now.tv_nsec;
+}
+
+void
+katss_lock(mtx_t *mutex)
+{
+	if(!KATSS_STATS_ON()) {
+		mtx_lock(mutex);
+		return;
+	}
+	if(mtx_trylock(mutex) == thrd_success)
+		return;
+	uint64_t start = clock_ns();
+	mtx_lock(mutex);
+	KATSS_STAT_ADD(increment_wait_ns, clock_ns() - start);
+}
+#endif
+
+
+KatssStats *
+katss_start_stats(const KatssOptions *opts)
+{
+#if KATSS_STATS
+	/* A run started by the one collecting them leaves them to it */
+	bool off = false;
+	if(!opts->collect_stats || !atomic_compare_exchange_strong(&katss_counters.on, &off, true))
+		return NULL;
+
+	call_once(&run_flag, init_run);
+	KatssStats *stats = s_calloc(1, sizeof *stats);
+	mtx_lock(&run.lock);
+	run.stats = stats;
+	run.iterations_size = 0;
+	run.kmers_hashed = atomic_load(&katss_counters.kmers_hashed);
+	run.invalid_resets = atomic_load(&katss_counters.invalid_resets);
+	run.increment_wait_ns = atomic_load(&katss_counters.increment_wait_ns);
+	seqfstats(&run.seqf);
+	run.start_ns = run.lap_ns = clock_ns();
+	mtx_unlock(&run.lock);
+	seqfsetstats(true);
+	return stats;
+#else
+	(void)opts;
+	return NULL;
+#endif
+}
+
+
+KatssData *
+katss_stop_stats(KatssStats *stats, KatssData *data)
+{
+	if(stats == NULL)
+		return data;
+#if KATSS_STATS
+	seqfsetstats(false);
+	struct SeqfStats seqf;
+	seqfstats(&seqf);
+
+	mtx_lock(&run.lock);
+	stats->bytes_read = seqf.bytes_read - run.seqf.bytes_read;
+	stats->bytes_inflated = seqf.bytes_inflated - run.seqf.bytes_inflated;
+	stats->records = seqf.records - run.seqf.records;
+	stats->kmers_hashed = atomic_load(&katss_counters.kmers_hashed) - run.kmers_hashed;
+	stats->invalid_resets = atomic_load(&katss_counters.invalid_resets) - run.invalid_resets;
+	stats->seconds = (double)(clock_ns() - run.start_ns) / 1e9;
+	stats->load_seconds = (double)(seqf.load_ns - run.seqf.load_ns) / 1e9;
+	stats->read_wait_seconds = (double)(seqf.lock_wait_ns - run.seqf.lock_wait_ns) / 1e9;
+	stats->increment_wait_seconds =
+		(double)(atomic_load(&katss_counters.increment_wait_ns) - run.increment_wait_ns) / 1e9;
+	run.stats = NULL;
+	mtx_unlock(&run.lock);
+	atomic_store(&katss_counters.on, false);
+#endif
+
+	if(data == NULL) {
+		free(stats->iteration_seconds);
+		free(stats);
+		return NULL;
+	}
+	data->stats = stats;
+	return data;
+}
+
+
+void
+katss_stats_lap(void)
+{
+#if KATSS_STATS
+	if(!KATSS_STATS_ON())
+		return;
+	mtx_lock(&run.lock);
+	if(run.stats != NULL)
+		run.lap_ns = clock_ns();
+	mtx_unlock(&run.lock);
+#endif
+}
+
+
+void
+katss_stats_iterations(int num)
+{
+#if KATSS_STATS
+	if(!KATSS_STATS_ON() || num < 1)
+		return;
+	mtx_lock(&run.lock);
+	KatssStats *stats = run.stats;
+	if(stats != NULL) {
+		uint64_t now = clock_ns();
+		double each = (double)(now - run.lap_ns) / 1e9 / num;
+		if(stats->num_iterations + num > run.iterations_size) {
+			run.iterations_size = MAX2(2 * run.iterations_size, stats->num_iterations + num);
+			stats->iteration_seconds = s_realloc(stats->iteration_seconds,
+			                                     run.iterations_size * sizeof(double));
+		}
+		for(int i=0; i<num; i++)
+			stats->iteration_seconds[stats->num_iterations++] = each;
+		run.lap_ns = now;
+	}
+	mtx_unlock(&run.lock);
+#else
+	(void)num;
+#endif
+}
@@ -2,6 +2,12 @@
 #include <float.h>
 #include <limits.h>
 #include <math.h>
+#include <string.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#  include <sys/mman.h>
+#endif
 
 #include "katss_core.h"
 #include "counter.h"
@@ -9,8 +15,110 @@
 #include "hash_functions.h"
 
 /* Function declarations */
-static void init_small_table(KatssCounter *counter, unsigned int kmer);
-static void init_medium_table(KatssCounter *counter, unsigned int kmer);
+static KatssCounter *new_counter(unsigned int kmer);
+static void init_table(KatssCounter *counter, unsigned int kmer);
+static void init_sparse(KatssCounter *counter);
+static void free_table(KatssCounter *counter);
+static uint64_t *sparse_slot(KatssSparse *sparse, uint64_t hash);
+static uint64_t sparse_get(const KatssSparse *sparse, uint64_t hash);
+static void make_room(KatssSparse *sparse);
+static void rehash_sparse(KatssSparse *sparse, unsigned int bits, uint64_t threshold);
+static int compare_keys(const void *a, const void *b);
+static bool is_compressed(const char *filename);
+static void spill_add(KatssCounter *counter, uint64_t index, uint32_t high);
+static void spill_sub(KatssCounter *counter, uint64_t index);
+static inline uint64_t spill_get(const KatssCounter *counter, uint64_t index);
+static void merge_spill(KatssCounter *counter, const KatssCounter *local);
+static inline unsigned int stripe_shift(unsigned int kmer);
+static void sort_by_stripe(const KatssCounter *counter, const uint32_t *hash_values,
+                           size_t num_values, uint32_t *sorted, size_t *offsets);
+static int merge_range(void *arg);
+static void merge_tables(KatssCounter *counter, KatssCounter **locals, int num_locals, int threads);
+static void merge_totals(KatssCounter *counter, const KatssCounter *other);
+static int marginalize_range(void *arg);
+static inline uint64_t table_get(KatssCounter *counter, uint64_t index);
+static inline void table_add(KatssCounter *counter, uint64_t index, uint64_t value);
+static void free_removed(KatssCounter *counter);
+static void init_idle(void);
+static inline uint64_t table_bytes(const KatssCounter *counter);
+static void store_value(uint64_t count, KATSS_TYPE numeric_type, void *value);
+static inline void store_export(uint64_t count, KATSS_TYPE numeric_type, void *value,
+                                double total);
+static void export_block(const uint32_t *counts, uint64_t num, KATSS_TYPE numeric_type,
+                         unsigned char *dst, size_t stride, double total);
+static void export_spill(KatssCounter *counter, uint64_t first, uint64_t num,
+                         KATSS_TYPE numeric_type, unsigned char *dst, size_t stride, double total);
+
+#define IDLE_COUNTERS 64 /* Most released counters kept to be acquired again */
+#define HUGE_PAGE_BYTES (UINT64_C(2) << 20) /* Smallest table mapped to be given huge pages */
+#define HASH_BLOCK64 1024 /* 64-bit hashes narrowed at once for a dense table */
+#define SPARSE_MIN_BITS 16 /* A sparse table starts with 2^16 slots */
+#define SPARSE_EMPTY UINT64_MAX /* Key of a free slot of a sparse table */
+#define SPARSE_BYTES 43 /* Most bytes a sparse table takes per k-mer, 16 byte slots 3/8 taken */
+#define MERGE_BLOCK 1024 /* Cells added at once before looking for the ones that wrapped */
+#define EXPORT_BLOCK 4096 /* Counts of a sparse table or sketch gathered at once to export */
+
+/* Every 2^32 a count wrapped, by k-mer, in an open-addressed table */
+struct KatssSpill {
+	uint64_t size;       /** Slots, a power of two */
+	uint64_t used;       /** Slots taken */
+	uint64_t *keys;      /** Index of the k-mer plus one, 0 for a free slot */
+	uint32_t *highs;     /** High 32 bits of the count of the k-mer */
+};
+/*
+Notes:
+Cells are 32 bits whatever the k-mer length, half of what a 64-bit table takes, so twice as many
+of them share a cache line. The few counts that go past 2^32 keep their high bits in the spill,
+which increments only touch when a cell wraps back to 0, so counting stays a single add and a
+branch that is never taken. Reading a count only looks at the spill if one was ever needed.
+*/
+
+/* Count of every k-mer seen, by k-mer, in an open-addressed table */
+struct KatssSparse {
+	uint64_t size;       /** Slots, a power of two */
+	uint64_t used;       /** Slots taken */
+	unsigned int bits;   /** Log2 of size */
+	uint64_t *keys;      /** Index of the k-mer, SPARSE_EMPTY for a free slot */
+	uint64_t *counts;    /** Count of the k-mer */
+	uint64_t last;       /** Count of the k-mer whose index is SPARSE_EMPTY, only k = 32 has it */
+	uint64_t max_bytes;  /** Most bytes the slots may take, 0 for no bound */
+	uint64_t min_count;  /** K-mers counted fewer times are the first dropped past max_bytes */
+	uint64_t threshold;  /** K-mers counted fewer times are dropped, raised on every drop */
+};
+/*
+Notes:
+A dense table of 16-mers takes 16 GiB, most of which stays zero for a library of a few million
+reads, and a dense table of longer k-mers can't be allocated at all. Sparse tables only hold the
+k-mers that were counted, at 16 bytes a slot, kept at most three quarters full. Slots are found
+with Fibonacci hashing and linear probing, so the k-mers of a small library stay within a table
+that fits in cache rather than spread over gigabytes. A bounded table drops its rarest k-mers
+instead of growing past its bound, which keeps the frequent ones exact.
+*/
+
+/* Counters released to be acquired again, their pages already mapped */
+static struct {
+	mtx_t lock;                                /** Guards the fields below */
+	KatssCounter *counters[IDLE_COUNTERS];     /** Counters waiting to be acquired */
+	int num_counters;                          /** Counters in `counters` */
+	uint64_t bytes;                            /** Bytes their tables take */
+} idle;
+static once_flag idle_once = ONCE_FLAG_INIT;
+
+struct merge_job {
+	KatssCounter *counter;
+	KatssCounter **locals;
+	int num_locals;
+	uint64_t start;
+	uint64_t end;
+};
+
+struct marginalize_job {
+	KatssCounter *marginal;
+	KatssCounter *counter;
+	uint64_t start;
+	uint64_t end;
+	uint64_t total;
+};
 
 /*===================================
 |  Main functions (used in header)  |
@@ -18,70 +126,191 @@ static void init_medium_table(KatssCounter *counter, unsigned int kmer);
 KatssCounter *
 katss_init_counter(unsigned int kmer)
 {
-	KatssCounter *counter = s_malloc(sizeof *counter);
-	counter->kmer = kmer;
-	counter->total = 0;
-	// atomic_init(&counter->total, 0);
-	mtx_init(&counter->lock, mtx_plain);
-	counter->removed = NULL;
+	/* There is no room for a table of every k-mer longer than 16 bases */
+	if(kmer > KATSS_DENSE_KMER)
+		return katss_init_sparse_counter(kmer);
 
-	if(kmer == 0 || kmer > 16) {
-		error_message("KatssCounter currently does not support kmer value of '%d'.\n"
-		              "Currently supported: 1-16.", kmer);
-		free(counter);
+	KatssCounter *counter = new_counter(kmer);
+	if(counter == NULL)
 		return NULL;
-	}
+	init_table(counter, kmer);
+
+	return counter;
+}
+
+
+KatssCounter *
+katss_init_sparse_counter(unsigned int kmer)
+{
+	if(kmer < KATSS_SPARSE_KMER)
+		return katss_init_counter(kmer);
+
+	KatssCounter *counter = new_counter(kmer);
+	if(counter == NULL)
+		return NULL;
+	init_sparse(counter);
+
+	return counter;
+}
+
+
+KatssCounter *
+katss_init_sketch_counter(unsigned int kmer, uint64_t max_bytes)
+{
+	/* Tables this small are exact for less memory, and are private to counting threads */
+	if(kmer <= KATSS_PRIVATE_KMER)
+		return katss_init_counter(kmer);
 
-	if(kmer <= 12)
-		init_small_table(counter, kmer);
-	else if(kmer <= 16)
-		init_medium_table(counter, kmer);
+	KatssCounter *counter = new_counter(kmer);
+	if(counter == NULL)
+		return NULL;
+	counter->sketch = katss_init_sketch(max_bytes);
 
 	return counter;
 }
 
 
+void
+katss_limit_counter(KatssCounter *counter, uint64_t max_bytes, uint64_t min_count)
+{
+	if(counter == NULL || counter->sparse == NULL)
+		return;
+	mtx_lock(&counter->lock);
+	counter->sparse->max_bytes = max_bytes;
+	counter->sparse->min_count = min_count;
+	counter->sparse->threshold = MAX2(counter->sparse->threshold, min_count);
+	mtx_unlock(&counter->lock);
+}
+
+
 void
 katss_free_counter(KatssCounter *counter)
 {
 	if(counter == NULL)
 		return;
 
-	if(counter->kmer <= 12) {
-		free(counter->table.small);
-	} else if(counter->kmer <= 16) {
-		free(counter->table.medium);
-	} else {
-		error_message("Kmer value of '%d' is greater than allowed range.", counter->kmer);
+	free_table(counter);
+	free(counter->tails);
+	if(counter->spill != NULL) {
+		free(counter->spill->keys);
+		free(counter->spill->highs);
+		free(counter->spill);
 	}
 
 	mtx_destroy(&counter->lock);
+	for(int i=0; i<KATSS_COUNTER_STRIPES; i++)
+		mtx_destroy(&counter->stripes[i]);
 
-	katss_str_node_t *head = counter->removed;
-	while(head != NULL) {
-		katss_str_node_t *tmp = head;
-		head = head->next;
-		if(tmp->str) free(tmp->str);
-		free(tmp);
+	free_removed(counter);
+	free(counter);
+}
+
+
+void
+katss_reset_counter(KatssCounter *counter)
+{
+	if(counter == NULL)
+		return;
+	katss_clear_counts(counter);
+	free_removed(counter);
+}
+
+
+KatssCounter *
+katss_acquire_counter(unsigned int kmer)
+{
+	call_once(&idle_once, init_idle);
+
+	/* The most recently released counter has the pages most likely to still be cached */
+	KatssCounter *counter = NULL;
+	mtx_lock(&idle.lock);
+	for(int i=idle.num_counters-1; i>=0; i--) {
+		if(idle.counters[i]->kmer != kmer)
+			continue;
+		counter = idle.counters[i];
+		idle.counters[i] = idle.counters[--idle.num_counters];
+		idle.bytes -= table_bytes(counter);
+		break;
 	}
+	mtx_unlock(&idle.lock);
 
-	free(counter);
+	if(counter == NULL)
+		return katss_init_counter(kmer);
+	katss_reset_counter(counter);
+	return counter;
 }
 
 
 void
-katss_increments(KatssCounter *counter, uint32_t *hash_values, size_t num_values)
+katss_release_counter(KatssCounter *counter)
 {
-	mtx_lock(&counter->lock);
+	if(counter == NULL)
+		return;
+	call_once(&idle_once, init_idle);
+
+	/* Counters past what the pool keeps are freed, as they would have been. Sparse and sketch
+	   counters are always freed, as `katss_acquire_counter` gives dense ones */
+	bool kept = false;
+	mtx_lock(&idle.lock);
+	if(counter->sparse == NULL && counter->sketch == NULL && idle.num_counters < IDLE_COUNTERS &&
+	   idle.bytes + table_bytes(counter) <= KATSS_IDLE_MAX_BYTES) {
+		idle.counters[idle.num_counters++] = counter;
+		idle.bytes += table_bytes(counter);
+		kept = true;
+	}
+	mtx_unlock(&idle.lock);
+
+	if(!kept)
+		katss_free_counter(counter);
+}
+
 
-	if(counter->kmer <= 12)
+void
+katss_increments(KatssCounter *counter, uint32_t *hash_values, size_t num_values)
+{
+	/* Adding a k-mer may move every other one of a sparse table, which takes the whole lock */
+	if(counter->sparse != NULL) {
+		KATSS_LOCK(&counter->lock);
 		for(size_t i=0; i<num_values; i++)
-			counter->table.small[hash_values[i]]++;
-	else
+			(*sparse_slot(counter->sparse, hash_values[i]))++;
+		counter->total += num_values;
+		mtx_unlock(&counter->lock);
+		return;
+	}
+	if(counter->sketch != NULL) {
+		KATSS_LOCK(&counter->lock);
 		for(size_t i=0; i<num_values; i++)
-			counter->table.medium[hash_values[i]]++;
-	counter->total++;
+			katss_sketch_add(counter->sketch, hash_values[i], 1);
+		counter->total += num_values;
+		mtx_unlock(&counter->lock);
+		return;
+	}
+
+	if(num_values == 0)
+		return;
+
+	/* Bucket hashes by the stripe that guards them, so each lock is taken once */
+	size_t offsets[KATSS_COUNTER_STRIPES+1];
+	bool scratch = num_values <= KATSS_SCRATCH_HASHES;
+	uint32_t *sorted = scratch ? katss_scratch()->sorted : s_malloc(num_values * sizeof *sorted);
+	sort_by_stripe(counter, hash_values, num_values, sorted, offsets);
 
+	/* Threads flushing different ranges of the table no longer wait on each other */
+	for(int s=0; s<KATSS_COUNTER_STRIPES; s++) {
+		if(offsets[s] == offsets[s+1])
+			continue;
+		KATSS_LOCK(&counter->stripes[s]);
+		for(size_t i=offsets[s]; i<offsets[s+1]; i++) {
+			if(++counter->table[sorted[i]] == 0)
+				spill_add(counter, sorted[i], 1);
+		}
+		mtx_unlock(&counter->stripes[s]);
+	}
+	if(!scratch)
+		free(sorted);
+
+	KATSS_LOCK(&counter->lock);
+	counter->total += num_values;
 	mtx_unlock(&counter->lock);
 }
 
@@ -89,13 +318,12 @@ katss_increments(KatssCounter *counter, uint32_t *hash_values, size_t num_values
 void
 katss_increment(KatssCounter *counter, uint32_t hash)
 {
-	if(counter->kmer <= 12) {
-		// atomic_fetch_add_explicit(&counter->table.small[hash], 1, memory_order_relaxed);
-		counter->table.small[hash]++;
-	} else {
-		// atomic_fetch_add_explicit(&counter->table.medium[hash], 1, memory_order_relaxed);
-		counter->table.medium[hash]++;
-	}
+	if(counter->sparse != NULL)
+		(*sparse_slot(counter->sparse, hash))++;
+	else if(counter->sketch != NULL)
+		katss_sketch_add(counter->sketch, hash, 1);
+	else if(++counter->table[hash] == 0)
+		spill_add(counter, hash, 1);
 	counter->total++;
 	// atomic_fetch_add_explicit(&counter->total, 1, memory_order_relaxed);
 }
@@ -104,14 +332,28 @@ katss_increment(KatssCounter *counter, uint32_t hash)
 void
 katss_decrement(KatssCounter *counter, uint32_t hash)
 {
-	mtx_lock(&counter->lock);
-	if(counter->kmer <=12) {
-		counter->table.small[hash]--;
-		// atomic_fetch_sub_explicit(&counter->table.small[hash], 1, memory_order_relaxed);
-	} else {
-		counter->table.medium[hash]--;
-		// atomic_fetch_sub_explicit(&counter->table.medium[hash], 1, memory_order_relaxed);
+	if(counter->sparse != NULL) {
+		mtx_lock(&counter->lock);
+		(*sparse_slot(counter->sparse, hash))--;
+		counter->total--;
+		mtx_unlock(&counter->lock);
+		return;
 	}
+	if(counter->sketch != NULL) {
+		mtx_lock(&counter->lock);
+		katss_sketch_sub(counter->sketch, hash);
+		counter->total--;
+		mtx_unlock(&counter->lock);
+		return;
+	}
+
+	mtx_t *stripe = &counter->stripes[hash >> stripe_shift(counter->kmer)];
+	mtx_lock(stripe);
+	if(counter->table[hash]-- == 0)
+		spill_sub(counter, hash);
+	mtx_unlock(stripe);
+
+	mtx_lock(&counter->lock);
 	counter->total--;
 	// atomic_fetch_sub_explicit(&counter->total, 1, memory_order_relaxed);
 
@@ -119,10 +361,59 @@ katss_decrement(KatssCounter *counter, uint32_t hash)
 }
 
 
+void
+katss_decrements(KatssCounter *counter, uint32_t *hash_values, size_t num_values)
+{
+	if(counter->sparse != NULL) {
+		mtx_lock(&counter->lock);
+		for(size_t i=0; i<num_values; i++)
+			(*sparse_slot(counter->sparse, hash_values[i]))--;
+		counter->total -= num_values;
+		mtx_unlock(&counter->lock);
+		return;
+	}
+	if(counter->sketch != NULL) {
+		mtx_lock(&counter->lock);
+		for(size_t i=0; i<num_values; i++)
+			katss_sketch_sub(counter->sketch, hash_values[i]);
+		counter->total -= num_values;
+		mtx_unlock(&counter->lock);
+		return;
+	}
+
+	if(num_values == 0)
+		return;
+
+	/* Same as `katss_increments`, each stripe is locked once for every hash it guards */
+	size_t offsets[KATSS_COUNTER_STRIPES+1];
+	bool scratch = num_values <= KATSS_SCRATCH_HASHES;
+	uint32_t *sorted = scratch ? katss_scratch()->sorted : s_malloc(num_values * sizeof *sorted);
+	sort_by_stripe(counter, hash_values, num_values, sorted, offsets);
+
+	for(int s=0; s<KATSS_COUNTER_STRIPES; s++) {
+		if(offsets[s] == offsets[s+1])
+			continue;
+		mtx_lock(&counter->stripes[s]);
+		for(size_t i=offsets[s]; i<offsets[s+1]; i++) {
+			if(counter->table[sorted[i]]-- == 0)
+				spill_sub(counter, sorted[i]);
+		}
+		mtx_unlock(&counter->stripes[s]);
+	}
+	if(!scratch)
+		free(sorted);
+
+	mtx_lock(&counter->lock);
+	counter->total -= num_values;
+	mtx_unlock(&counter->lock);
+}
+
+
 int
 katss_get(KatssCounter *counter, KATSS_TYPE numeric_type, void *value, const char *key)
 {
-	uint32_t hash = 0, keylen = 0;
+	uint64_t hash = 0;
+	uint32_t keylen = 0;
 
 	/* Get the hash of key */
 	while(*key) {
@@ -143,50 +434,7 @@ katss_get(KatssCounter *counter, KATSS_TYPE numeric_type, void *value, const cha
 	}
 
 	/* Get value from key */
-
-	uint64_t count;
-	switch(numeric_type) {
-	case KATSS_INT8:
-		count = (counter->kmer <= 12 ? counter->table.small[hash] : counter->table.medium[hash]);
-		*((int8_t *)value) = (int8_t)(count > INT8_MAX) ? INT8_MAX : count;
-		break;
-	case KATSS_UINT8:
-		count = (counter->kmer <= 12 ? counter->table.small[hash] : counter->table.medium[hash]);
-		*((uint8_t *)value) = (uint8_t)(count > UINT8_MAX) ? UINT8_MAX : count;
-		break;
-	case KATSS_INT16:
-		count = (counter->kmer <= 12 ? counter->table.small[hash] : counter->table.medium[hash]);
-		*((int16_t *)value) = (int16_t)(count > INT16_MAX) ? INT16_MAX : count;
-		break;
-	case KATSS_UINT16:
-		count = (counter->kmer <= 12 ? counter->table.small[hash] : counter->table.medium[hash]);
-		*((uint16_t *)value) = (uint16_t)(count > UINT16_MAX) ? UINT16_MAX : count;
-		break;
-	case KATSS_INT32:
-		count = (counter->kmer <= 12 ? counter->table.small[hash] : counter->table.medium[hash]);
-		*((int32_t *)value) = (int32_t)(count > INT32_MAX) ? INT32_MAX : count;
-		break;
-	case KATSS_UINT32:
-		count = (counter->kmer <= 12 ? counter->table.small[hash] : counter->table.medium[hash]);
-		*((uint32_t *)value) = (uint32_t)(count > UINT32_MAX) ? UINT32_MAX : count;
-		break;
-	case KATSS_INT64:
-		count = (counter->kmer <= 12 ? counter->table.small[hash] : counter->table.medium[hash]);
-		*((int64_t *)value) = (int64_t)(count > INT64_MAX) ? INT64_MAX : count;
-		break;
-	case KATSS_UINT64:
-		count = (counter->kmer <= 12 ? counter->table.small[hash] : counter->table.medium[hash]);
-		*((uint64_t *)value) = count;
-		break;
-	case KATSS_FLOAT:
-		*((float *)value) = (float)(counter->kmer <= 12 ? counter->table.small[hash] : counter->table.medium[hash]);
-		break;
-	case KATSS_DOUBLE:
-		*((double *)value) = (double)(counter->kmer <= 12 ? counter->table.small[hash] : counter->table.medium[hash]);
-		break;
-	}
-
-	return 0;
+	return katss_get_from_hash64(counter, numeric_type, value, hash);
 }
 
 
@@ -198,52 +446,44 @@ katss_get_from_hash(KatssCounter *counter, KATSS_TYPE numeric_type, void *value,
 		return 1;
 	}
 
-	uint64_t count;
-	switch(numeric_type) {
-	case KATSS_INT8:
-		count = (counter->kmer <= 12 ? counter->table.small[hash] : counter->table.medium[hash]);
-		*((int8_t *)value) = (int8_t)(count > INT8_MAX) ? INT8_MAX : count;
-		break;
-	case KATSS_UINT8:
-		count = (counter->kmer <= 12 ? counter->table.small[hash] : counter->table.medium[hash]);
-		*((uint8_t *)value) = (uint8_t)(count > UINT8_MAX) ? UINT8_MAX : count;
-		break;
-	case KATSS_INT16:
-		count = (counter->kmer <= 12 ? counter->table.small[hash] : counter->table.medium[hash]);
-		*((int16_t *)value) = (int16_t)(count > INT16_MAX) ? INT16_MAX : count;
-		break;
-	case KATSS_UINT16:
-		count = (counter->kmer <= 12 ? counter->table.small[hash] : counter->table.medium[hash]);
-		*((uint16_t *)value) = (uint16_t)(count > UINT16_MAX) ? UINT16_MAX : count;
-		break;
-	case KATSS_INT32:
-		count = (counter->kmer <= 12 ? counter->table.small[hash] : counter->table.medium[hash]);
-		*((int32_t *)value) = (int32_t)(count > INT32_MAX) ? INT32_MAX : count;
-		break;
-	case KATSS_UINT32:
-		count = (counter->kmer <= 12 ? counter->table.small[hash] : counter->table.medium[hash]);
-		*((uint32_t *)value) = (uint32_t)(count > UINT32_MAX) ? UINT32_MAX : count;
-		break;
-	case KATSS_INT64:
-		count = (counter->kmer <= 12 ? counter->table.small[hash] : counter->table.medium[hash]);
-		*((int64_t *)value) = (int64_t)(count > INT64_MAX) ? INT64_MAX : count;
-		break;
-	case KATSS_UINT64:
-		count = (counter->kmer <= 12 ? counter->table.small[hash] : counter->table.medium[hash]);
-		*((uint64_t *)value) = count;
-		break;
-	case KATSS_FLOAT:
-		*((float *)value) = (float)(counter->kmer <= 12 ? counter->table.small[hash] : counter->table.medium[hash]);
-		break;
-	case KATSS_DOUBLE:
-		*((double *)value) = (double)(counter->kmer <= 12 ? counter->table.small[hash] : counter->table.medium[hash]);
-		break;
+	return katss_get_from_hash64(counter, numeric_type, value, hash);
+}
+
+
+int
+katss_get_from_hash64(KatssCounter *counter, KATSS_TYPE numeric_type, void *value, uint64_t hash)
+{
+	/* hash is not contained within counter */
+	if(counter->kmer < 32 && (hash >> 2*counter->kmer) != 0) {
+		return 1;
 	}
 
+	store_value(table_get(counter, hash), numeric_type, value);
 	return 0;
 }
 
 
+int
+katss_export_counts(KatssCounter *counter, KATSS_TYPE numeric_type, void *dst, size_t stride)
+{
+	if(counter->kmer > 16)
+		return 1;
+	return katss_export_range(counter, numeric_type, dst, stride, 0,
+	                          (uint64_t)counter->capacity + 1, false);
+}
+
+
+int
+katss_export_frequencies(KatssCounter *counter, KATSS_TYPE numeric_type, void *dst,
+                         size_t stride)
+{
+	if(counter->kmer > 16)
+		return 1;
+	return katss_export_range(counter, numeric_type, dst, stride, 0,
+	                          (uint64_t)counter->capacity + 1, true);
+}
+
+
 uint64_t
 katss_get_total(KatssCounter *counter)
 {
@@ -254,32 +494,55 @@ katss_get_total(KatssCounter *counter)
 double
 katss_predict_kmer_freq(uint32_t hash, int kmer, KatssCounter *mono, KatssCounter *dint)
 {
-	char kseq[32];
-	katss_unhash(kseq, hash, kmer, true);
-	char monoseq[2] = { 0 };
-	char diseq[3]   = { 0 };
+	double freq;
+	katss_predict_kmer_freqs(hash, 1, kmer, mono, dint, &freq);
+	return freq;
+}
 
-	double monoprob = 1;
-	double diprob = 1;
 
-	/* Get the cumulative probabilities for overlapping monomers */
-	for(int i=1; i<kmer-1; i++) {
-		monoseq[0] = kseq[i];
-		double count;
-		katss_get(mono, KATSS_DOUBLE, &count, monoseq);
-		monoprob *= count/mono->total;
-	}
+void
+katss_predict_kmer_freqs(uint64_t first, uint64_t num, int kmer, KatssCounter *mono,
+                         KatssCounter *dint, double *freqs)
+{
+	if(num == 0)
+		return;
 
-	/* Get probabilities for all di-mers in k-mer */
-	for(int i=0; i<kmer-1; i++) {
-		diseq[0] = kseq[i]; diseq[1] = kseq[i+1];
-		double count;
-		katss_get(dint, KATSS_DOUBLE, &count, diseq);
-		diprob *= count/dint->total;
+	/* Frequencies of every mono and dinucleotide, the way they are read one at a time */
+	double mono_frq[4], dint_frq[16];
+	for(uint32_t i=0; i<4; i++) {
+		double count = 0;
+		katss_get_from_hash(mono, KATSS_DOUBLE, &count, i);
+		mono_frq[i] = count/mono->total;
+	}
+	for(uint32_t i=0; i<16; i++) {
+		double count = 0;
+		katss_get_from_hash(dint, KATSS_DOUBLE, &count, i);
+		dint_frq[i] = count/dint->total;
 	}
 
-	/* Predicted k-mer probability is dinucleotides / overlapping monomers */
-	return diprob/monoprob;
+	/* The products up to each base of the k-mer are kept for the next hash, which only changes
+	   the bases after the last one that isn't a T */
+	int bases[32];
+	double diprob[32], monoprob[32];
+	for(int i=0; i<kmer; i++)
+		bases[i] = (int)((first >> 2*(kmer - 1 - i)) & 3);
+	int from = 0;
+	for(uint64_t n=0; n<num; n++) {
+		for(int i=from; i<kmer; i++) {
+			diprob[i] = i == 0 ? 1 : diprob[i - 1] * dint_frq[4*bases[i - 1] + bases[i]];
+			monoprob[i] = i == 0 ? 1 : monoprob[i - 1] * mono_frq[bases[i]];
+		}
+
+		/* Predicted k-mer probability is dinucleotides / overlapping monomers */
+		freqs[n] = kmer < 2 ? 1 : diprob[kmer - 1] / monoprob[kmer - 2];
+
+		from = kmer - 1;
+		while(from >= 0 && bases[from] == 3)
+			bases[from--] = 0;
+		if(from < 0)
+			break;
+		bases[from]++;
+	}
 }
 
 
@@ -293,26 +556,1118 @@ katss_predict_kmer(uint32_t hash, int kmer, KatssCounter *mono, KatssCounter *di
 }
 
 
+KatssCounter *
+katss_counter_marginalize(KatssCounter *counter, unsigned int kmer)
+{
+	return katss_counter_marginalize_mt(counter, kmer, 1);
+}
+
+
+KatssCounter *
+katss_counter_marginalize_mt(KatssCounter *counter, unsigned int kmer, int threads)
+{
+	if(counter == NULL)
+		return NULL;
+	if(kmer == 0 || kmer > counter->kmer) {
+		error_message("katss: marginalize: k-mer must be between 1 and %u, got %u",
+		              counter->kmer, kmer);
+		return NULL;
+	}
+
+	KatssCounter *marginal = katss_init_counter(kmer);
+	if(marginal == NULL)
+		return NULL;
+	katss_marginalize(marginal, counter, threads);
+
+	return marginal;
+}
+
+
 /*===================================
-|  Helper functions                 |
+|  Internal functions               |
 ===================================*/
-static void
-init_small_table(KatssCounter *counter, unsigned int kmer)
+void
+katss_increments_unlocked(KatssCounter *counter, const uint32_t *hash_values, size_t num_values)
+{
+	if(counter->sparse != NULL) {
+		for(size_t i=0; i<num_values; i++)
+			(*sparse_slot(counter->sparse, hash_values[i]))++;
+		counter->total += num_values;
+		return;
+	}
+	if(counter->sketch != NULL) {
+		for(size_t i=0; i<num_values; i++)
+			katss_sketch_add(counter->sketch, hash_values[i], 1);
+		counter->total += num_values;
+		return;
+	}
+
+	uint32_t *table = counter->table;
+	for(size_t i=0; i<num_values; i++) {
+		if(++table[hash_values[i]] == 0)
+			spill_add(counter, hash_values[i], 1);
+	}
+	counter->total += num_values;
+}
+
+
+KatssCounter **
+katss_init_private_counters(unsigned int kmer, int threads)
 {
-	counter->capacity = (1ULL << 2*kmer) - 1; /* Capacity is 4^kmer */
-	counter->table.small = s_calloc(((size_t)counter->capacity+1), sizeof *counter->table.small);
-	// for(uint32_t i=0; i <= counter->capacity; i++) {
-	// 	atomic_init(&counter->table.small[i], 0);
-	// }
+	/* Larger tables would cost more memory (and merge time) than the contention they avoid */
+	if(kmer > KATSS_PRIVATE_KMER)
+		return NULL;
+
+	KatssCounter **locals = s_malloc(threads * sizeof *locals);
+	for(int i=0; i<threads; i++) {
+		locals[i] = katss_acquire_counter(kmer);
+	}
+
+	return locals;
 }
 
 
-static void
-init_medium_table(KatssCounter *counter, unsigned int kmer)
+void
+katss_merge_private_counters(KatssCounter *counter, KatssCounter **locals, int threads)
 {
-	counter->capacity = (1ULL << 2*kmer ) - 1;
-	counter->table.medium = s_calloc(((size_t)counter->capacity+1), sizeof *counter->table.medium);
-	// for(uint32_t i=0; i <= counter->capacity; i++) {
-	// 	atomic_init(&counter->table.medium[i], 0);
-	// }
+	if(locals == NULL)
+		return;
+
+	int num_locals = threads;
+	merge_tables(counter, locals, num_locals, threads);
+	for(int i=0; i<num_locals; i++) {
+		merge_totals(counter, locals[i]);
+		merge_spill(counter, locals[i]);
+		katss_release_counter(locals[i]);
+	}
+
+	free(locals);
+}
+
+
+int
+katss_merge_counter(KatssCounter *counter, const KatssCounter *other, int threads)
+{
+	if(counter == NULL || other == NULL || counter == other || counter->kmer != other->kmer ||
+	   counter->sketch != NULL || other->sketch != NULL)
+		return 1;
+
+	/* Counts of different removed k-mers don't add up to the counts of any dataset */
+	const katss_str_node_t *a = counter->removed, *b = other->removed;
+	while(a != NULL && b != NULL && strcmp(a->str, b->str) == 0) {
+		a = a->next;
+		b = b->next;
+	}
+	if(a != NULL || b != NULL)
+		return 2;
+
+	if(counter->sparse == NULL && other->sparse == NULL) {
+		KatssCounter *locals[1] = { (KatssCounter *)other };
+		merge_tables(counter, locals, 1, threads);
+		merge_spill(counter, other);
+	} else if(other->sparse != NULL) {
+		/* Only the k-mers a sparse table holds are added, one at a time. An unbounded sparse
+		   table is grown to the size of the other one at once, instead of doubling up to it */
+		const KatssSparse *sparse = other->sparse;
+		if(counter->sparse != NULL && counter->sparse->max_bytes == 0 &&
+		   counter->sparse->bits < sparse->bits)
+			rehash_sparse(counter->sparse, sparse->bits, 0);
+		for(uint64_t s=0; s<sparse->size; s++) {
+			if(sparse->keys[s] != SPARSE_EMPTY && sparse->counts[s] != 0)
+				table_add(counter, sparse->keys[s], sparse->counts[s]);
+		}
+		if(sparse->last != 0)
+			table_add(counter, SPARSE_EMPTY, sparse->last);
+	} else {
+		for(uint64_t i=0; i<=other->capacity; i++) {
+			uint64_t count = katss_table_count(other, i);
+			if(count != 0)
+				table_add(counter, i, count);
+		}
+	}
+	merge_totals(counter, other);
+
+	return 0;
+}
+
+
+void
+katss_keep_tails(KatssCounter *counter)
+{
+	/* Only tables that are cheap to keep the tails of, all shorter tails take a third of it */
+	if(counter->kmer > 12 || counter->sketch != NULL)
+		return;
+
+	size_t size = KATSS_TAIL_OFFSET(counter->kmer);
+	if(counter->tails == NULL)
+		counter->tails = s_calloc(MAX2(size, 1), sizeof *counter->tails);
+	else
+		memset(counter->tails, 0, size * sizeof *counter->tails);
+	counter->partial_tails = false;
+}
+
+
+void
+katss_drop_tails(KatssCounter *counter)
+{
+	free(counter->tails);
+	counter->tails = NULL;
+	counter->partial_tails = false;
+}
+
+
+void
+katss_clear_counts(KatssCounter *counter)
+{
+	uint64_t total = (uint64_t)counter->capacity + 1;
+	if(counter->sparse != NULL) {
+		KatssSparse *sparse = counter->sparse;
+		memset(sparse->keys, 0xFF, sparse->size * sizeof *sparse->keys);
+		sparse->used = 0;
+		sparse->last = 0;
+		sparse->threshold = sparse->min_count;
+	} else if(counter->sketch != NULL) {
+		katss_clear_sketch(counter->sketch);
+	} else {
+		memset(counter->table, 0x00, total * sizeof *counter->table);
+	}
+	if(counter->spill != NULL) {
+		memset(counter->spill->keys, 0x00, counter->spill->size * sizeof *counter->spill->keys);
+		counter->spill->used = 0;
+	}
+	counter->total = 0;
+	katss_drop_tails(counter);
+}
+
+
+uint64_t
+katss_table_count(const KatssCounter *counter, uint64_t index)
+{
+	if(counter->sparse != NULL)
+		return sparse_get(counter->sparse, index);
+	if(counter->sketch != NULL)
+		return katss_sketch_get(counter->sketch, index);
+	return counter->table[index] + (counter->spill ? spill_get(counter, index) : 0);
+}
+
+
+KatssCounter *
+katss_init_table_counter(unsigned int kmer, uint32_t *table, bool mapped)
+{
+	if(kmer > KATSS_DENSE_KMER)
+		return NULL;
+
+	KatssCounter *counter = new_counter(kmer);
+	if(counter == NULL)
+		return NULL;
+	counter->table = table;
+	counter->mapped = mapped;
+
+	return counter;
+}
+
+
+void
+katss_add_count(KatssCounter *counter, uint64_t index, uint64_t count)
+{
+	table_add(counter, index, count);
+}
+
+
+uint64_t
+katss_counter_bytes(const KatssCounter *counter)
+{
+	uint64_t bytes = 0;
+	if(counter->sparse != NULL)
+		bytes += counter->sparse->size * (sizeof *counter->sparse->keys +
+		                                  sizeof *counter->sparse->counts);
+	else if(counter->table != NULL)
+		bytes += table_bytes(counter);
+	if(counter->spill != NULL)
+		bytes += counter->spill->size * (sizeof *counter->spill->keys +
+		                                 sizeof *counter->spill->highs);
+	if(counter->tails != NULL)
+		bytes += KATSS_TAIL_OFFSET(counter->kmer) * sizeof *counter->tails;
+	return bytes;
+}
+
+
+KatssCounter *
+katss_copy_counter(const KatssCounter *counter, bool tails, int threads)
+{
+	KatssCounter *copy = counter->sparse != NULL ? katss_init_sparse_counter(counter->kmer)
+	                                             : katss_acquire_counter(counter->kmer);
+	if(copy == NULL)
+		return NULL;
+	if(katss_merge_counter(copy, counter, threads) != 0) {
+		katss_free_counter(copy);
+		return NULL;
+	}
+	if(tails && counter->tails != NULL) {
+		katss_keep_tails(copy);
+		size_t size = KATSS_TAIL_OFFSET(counter->kmer);
+		memcpy(copy->tails, counter->tails, size * sizeof *copy->tails);
+		copy->partial_tails = counter->partial_tails;
+	}
+	return copy;
+}
+
+
+int
+katss_export_range(KatssCounter *counter, KATSS_TYPE numeric_type, void *dst, size_t stride,
+                   uint64_t first, uint64_t num, bool frequencies)
+{
+	if(counter->kmer < 32 && (first + num - 1) >> 2*counter->kmer != 0 && num != 0)
+		return 1;
+	if(frequencies && numeric_type != KATSS_FLOAT && numeric_type != KATSS_DOUBLE)
+		return 2;
+
+	/* A total of 0 exports counts, frequencies divide by the total as `count / total` would */
+	double total = frequencies ? (double)counter->total : 0;
+	if(frequencies && total == 0)
+		total = NAN;
+	unsigned char *out = dst;
+
+	/* Cells of a dense table are converted where they are, patching the few that spilled */
+	if(counter->sparse == NULL && counter->sketch == NULL) {
+		export_block(counter->table + first, num, numeric_type, out, stride, total);
+		if(counter->spill != NULL)
+			export_spill(counter, first, num, numeric_type, out, stride, total);
+		return 0;
+	}
+
+	/* Other counts are gathered a block at a time, wider than a cell only if they have to be */
+	uint32_t counts[EXPORT_BLOCK];
+	for(uint64_t i=0; i<num; i+=EXPORT_BLOCK) {
+		uint64_t n = MIN2(num - i, EXPORT_BLOCK);
+		bool wide = false;
+		for(uint64_t j=0; j<n; j++) {
+			uint64_t count = table_get(counter, first + i + j);
+			counts[j] = (uint32_t)count;
+			wide |= count > UINT32_MAX;
+		}
+		if(!wide) {
+			export_block(counts, n, numeric_type, out + i*stride, stride, total);
+			continue;
+		}
+		for(uint64_t j=0; j<n; j++)
+			store_export(table_get(counter, first + i + j), numeric_type, out + (i + j)*stride,
+			             total);
+	}
+	return 0;
+}
+
+
+uint64_t
+katss_list_kmers(const KatssCounter *counter, uint64_t **kmers)
+{
+	/* A sketch can't tell which k-mers were counted, only the most counted */
+	if(counter->sketch != NULL)
+		return katss_sketch_top(counter->sketch, kmers);
+
+	const KatssSparse *sparse = counter->sparse;
+	if(sparse == NULL) {
+		uint64_t num = 0;
+		*kmers = s_malloc(((uint64_t)counter->capacity + 1) * sizeof **kmers);
+		for(uint64_t i=0; i<=counter->capacity; i++) {
+			if(katss_table_count(counter, i) != 0)
+				(*kmers)[num++] = i;
+		}
+		return num;
+	}
+
+	uint64_t num = 0, min_count = MAX2(sparse->min_count, 1);
+	*kmers = s_malloc((sparse->used + 1) * sizeof **kmers);
+	for(uint64_t s=0; s<sparse->size; s++) {
+		if(sparse->keys[s] != SPARSE_EMPTY && sparse->counts[s] >= min_count)
+			(*kmers)[num++] = sparse->keys[s];
+	}
+	qsort(*kmers, num, sizeof **kmers, compare_keys);
+	if(sparse->last >= min_count)
+		(*kmers)[num++] = SPARSE_EMPTY;
+	return num;
+}
+
+
+void
+katss_increments64(KatssCounter *counter, const uint64_t *hash_values, size_t num_values)
+{
+	/* Long k-mers are hashed one at a time, so they are counted once they are added */
+	KATSS_STAT_ADD(kmers_hashed, num_values);
+	if(counter->sketch != NULL) {
+		KATSS_LOCK(&counter->lock);
+		for(size_t i=0; i<num_values; i++)
+			katss_sketch_add(counter->sketch, hash_values[i], 1);
+		counter->total += num_values;
+		mtx_unlock(&counter->lock);
+		return;
+	}
+
+	/* Dense tables only hold k-mers of up to 16 bases, whose hashes fit in 32 bits */
+	if(counter->sparse == NULL) {
+		uint32_t block[HASH_BLOCK64];
+		for(size_t i=0; i<num_values; i+=HASH_BLOCK64) {
+			size_t num = MIN2(num_values - i, HASH_BLOCK64);
+			for(size_t j=0; j<num; j++)
+				block[j] = (uint32_t)hash_values[i + j];
+			katss_increments(counter, block, num);
+		}
+		return;
+	}
+
+	KATSS_LOCK(&counter->lock);
+	for(size_t i=0; i<num_values; i++)
+		(*sparse_slot(counter->sparse, hash_values[i]))++;
+	counter->total += num_values;
+	mtx_unlock(&counter->lock);
+}
+
+
+KatssCounter *
+katss_acquire_file_counter(unsigned int kmer, const char *filename)
+{
+	if(kmer < KATSS_SPARSE_KMER || kmer > KATSS_DENSE_KMER)
+		return katss_acquire_counter(kmer);
+
+	/* Sequences loaded in memory may have no file, their number of bases is known instead */
+	uint64_t kmers;
+	if(!katss_stored_bases(filename, &kmers)) {
+		struct stat st;
+		if(filename == NULL || stat(filename, &st) != 0)
+			return katss_acquire_counter(kmer);
+		kmers = (uint64_t)st.st_size * (is_compressed(filename) ? 4 : 1);
+	}
+
+	/* Even if every k-mer of the file is a new one, the sparse table is the smaller one */
+	uint64_t dense = (UINT64_C(1) << 2*kmer) * sizeof(uint32_t);
+	if(kmers * SPARSE_BYTES < dense)
+		return katss_init_sparse_counter(kmer);
+	return katss_acquire_counter(kmer);
+}
+
+
+void
+katss_free_idle_counters(void)
+{
+	call_once(&idle_once, init_idle);
+	mtx_lock(&idle.lock);
+	for(int i=0; i<idle.num_counters; i++)
+		katss_free_counter(idle.counters[i]);
+	idle.num_counters = 0;
+	idle.bytes = 0;
+	mtx_unlock(&idle.lock);
+}
+
+
+void
+katss_marginalize(KatssCounter *marginal, KatssCounter *counter, int threads)
+{
+	/* The k-mers of a sketch are mixed together, shorter ones can't be told apart in it */
+	if(counter->sketch != NULL) {
+		error_message("katss: marginalize: counts of a sketch counter can't be marginalized");
+		return;
+	}
+
+	/* A sparse table only has the k-mers that were seen, add each where it falls. Its k-mers
+	   are too long to keep tails for */
+	if(counter->sparse != NULL) {
+		const KatssSparse *sparse = counter->sparse;
+		const unsigned int shift = 2*(counter->kmer - marginal->kmer);
+		for(uint64_t s=0; s<sparse->size; s++) {
+			if(sparse->keys[s] == SPARSE_EMPTY || sparse->counts[s] == 0)
+				continue;
+			table_add(marginal, sparse->keys[s] >> shift, sparse->counts[s]);
+			marginal->total += sparse->counts[s];
+		}
+		if(sparse->last != 0) {
+			table_add(marginal, SPARSE_EMPTY >> shift, sparse->last);
+			marginal->total += sparse->last;
+		}
+		return;
+	}
+
+	/* Every k-mer starts with one of the marginal's k-mers. Each thread sums the k-mers of a
+	   contiguous range of the marginal's table, which is a contiguous range of the counter's */
+	uint64_t size = (uint64_t)marginal->capacity + 1;
+	threads = MAX2(threads, 1);
+	threads = (uint64_t)threads > size ? (int)size : threads;
+
+	struct marginalize_job *jobarg = s_malloc(threads * sizeof *jobarg);
+	uint64_t chunk = size / threads;
+	for(int i=0; i<threads; i++) {
+		jobarg[i].marginal = marginal;
+		jobarg[i].counter = counter;
+		jobarg[i].start = chunk * i;
+		jobarg[i].end = i == threads - 1 ? size : chunk * (i + 1);
+		jobarg[i].total = 0;
+	}
+	if(threads == 1) {
+		marginalize_range(&jobarg[0]);
+	} else {
+		KatssTaskGroup *jobs = katss_init_task_group();
+		for(int i=0; i<threads; i++)
+			katss_submit_task(jobs, marginalize_range, &jobarg[i]);
+		katss_wait_task_group(jobs);
+	}
+	for(int i=0; i<threads; i++)
+		marginal->total += jobarg[i].total;
+	free(jobarg);
+
+	if(counter->tails == NULL || marginal->kmer == counter->kmer)
+		return;
+
+	/* The marginal's k-mers within a tail are the first of them, and the ones in the tail
+	   without its first base. Carry every tail down into the one a base shorter than it */
+	unsigned int mkmer = marginal->kmer;
+	uint64_t *carry = s_calloc((size_t)1 << 2*(counter->kmer - 2), sizeof *carry);
+	for(unsigned int len = counter->kmer - 1; len >= mkmer; len--) {
+		const uint64_t *tails = counter->tails + KATSS_TAIL_OFFSET(len);
+		const uint64_t mask = (UINT64_C(1) << 2*(len - 1)) - 1;
+		const unsigned int shift = 2*(len - mkmer);
+		for(uint64_t t=0; t < (UINT64_C(1) << 2*len); t++) {
+			uint64_t count = tails[t];
+			if(t < (UINT64_C(1) << 2*(counter->kmer - 2))) {
+				count += carry[t];
+				carry[t] = 0;
+			}
+			if(count == 0)
+				continue;
+			table_add(marginal, t >> shift, count);
+			marginal->total += count;
+			if(len > mkmer)
+				carry[t & mask] += count;
+		}
+	}
+	free(carry);
+}
+
+
+/*===================================
+|  Helper functions                 |
+===================================*/
+static inline unsigned int
+stripe_shift(unsigned int kmer)
+{
+	/* Tables with fewer entries than stripes get one stripe per entry */
+	return kmer > 3 ? 2*kmer - 6 : 0; /* 2^6 == KATSS_COUNTER_STRIPES */
+}
+
+
+/**
+ * @brief Copy `hash_values` to `sorted` grouped by the stripe that guards them, the hashes of
+ * stripe `s` being `sorted[offsets[s]]` up to `sorted[offsets[s+1]]`. `offsets` takes
+ * KATSS_COUNTER_STRIPES+1 values.
+ */
+static void
+sort_by_stripe(const KatssCounter *counter, const uint32_t *hash_values, size_t num_values,
+               uint32_t *sorted, size_t *offsets)
+{
+	unsigned int shift = stripe_shift(counter->kmer);
+	size_t fill[KATSS_COUNTER_STRIPES];
+	memset(offsets, 0, (KATSS_COUNTER_STRIPES+1) * sizeof *offsets);
+
+	for(size_t i=0; i<num_values; i++)
+		offsets[(hash_values[i] >> shift) + 1]++;
+	for(int s=0; s<KATSS_COUNTER_STRIPES; s++) {
+		offsets[s+1] += offsets[s];
+		fill[s] = offsets[s];
+	}
+	for(size_t i=0; i<num_values; i++)
+		sorted[fill[hash_values[i] >> shift]++] = hash_values[i];
+}
+
+
+static int
+merge_range(void *arg)
+{
+	struct merge_job *job = (struct merge_job *)arg;
+	KatssCounter *counter = job->counter;
+
+	/* The spills of the private tables are added once they are all merged. The adds of a block
+	   vectorize, and only a block where a cell wrapped is looked at again to find it */
+	uint32_t *table = counter->table;
+	for(int l=0; l<job->num_locals; l++) {
+		const uint32_t *src = job->locals[l]->table;
+		for(uint64_t block=job->start; block<job->end; block+=MERGE_BLOCK) {
+			uint64_t end = MIN2(block + MERGE_BLOCK, job->end);
+			uint32_t wrapped = 0;
+			for(uint64_t i=block; i<end; i++) {
+				uint32_t sum = table[i] + src[i];
+				wrapped |= sum < src[i];
+				table[i] = sum;
+			}
+			for(uint64_t i=block; wrapped && i<end; i++) {
+				if(table[i] < src[i])
+					spill_add(counter, i, 1);
+			}
+		}
+	}
+
+	return 0;
+}
+
+
+/**
+ * @brief Add the dense tables of the `num_locals` counters of `locals` into the table of
+ * `counter` on `threads` threads, each summing a contiguous range of it. Spills aside.
+ */
+static void
+merge_tables(KatssCounter *counter, KatssCounter **locals, int num_locals, int threads)
+{
+	uint64_t size = (uint64_t)counter->capacity + 1;
+	threads = MAX2(threads, 1);
+	threads = (uint64_t)threads > size ? (int)size : threads;
+
+	struct merge_job *jobarg = s_malloc(threads * sizeof *jobarg);
+	KatssTaskGroup *jobs = katss_init_task_group();
+	uint64_t chunk = size / threads;
+	for(int i=0; i<threads; i++) {
+		jobarg[i].counter = counter;
+		jobarg[i].locals = locals;
+		jobarg[i].num_locals = num_locals;
+		jobarg[i].start = chunk * i;
+		jobarg[i].end = i == threads - 1 ? size : chunk * (i + 1);
+		katss_submit_task(jobs, merge_range, &jobarg[i]);
+	}
+	katss_wait_task_group(jobs);
+	free(jobarg);
+}
+
+
+/**
+ * @brief Add the total and tails of `other` to the ones of `counter`, whose tails no longer
+ * account for every run if `other` didn't keep them.
+ */
+static void
+merge_totals(KatssCounter *counter, const KatssCounter *other)
+{
+	counter->total += other->total;
+	if(counter->tails != NULL && other->tails != NULL) {
+		for(uint64_t t=0; t<KATSS_TAIL_OFFSET(counter->kmer); t++)
+			counter->tails[t] += other->tails[t];
+		counter->partial_tails |= other->partial_tails;
+	} else if(counter->tails != NULL) {
+		counter->partial_tails = true;
+	}
+}
+
+
+static int
+marginalize_range(void *arg)
+{
+	struct marginalize_job *job = (struct marginalize_job *)arg;
+	const unsigned int shift = 2*(job->counter->kmer - job->marginal->kmer);
+
+	for(uint64_t i=job->start; i<job->end; i++) {
+		uint64_t sum = 0;
+		for(uint64_t j=i << shift; j < (i + 1) << shift; j++)
+			sum += table_get(job->counter, j);
+		table_add(job->marginal, i, sum);
+		job->total += sum;
+	}
+
+	return 0;
+}
+
+
+static inline uint64_t
+table_get(KatssCounter *counter, uint64_t index)
+{
+	if(counter->sparse != NULL)
+		return sparse_get(counter->sparse, index);
+	if(counter->sketch != NULL)
+		return katss_sketch_get(counter->sketch, index);
+	return counter->table[index] + (counter->spill ? spill_get(counter, index) : 0);
+}
+
+
+static inline void
+table_add(KatssCounter *counter, uint64_t index, uint64_t value)
+{
+	if(counter->sparse != NULL) {
+		*sparse_slot(counter->sparse, index) += value;
+		return;
+	}
+	if(counter->sketch != NULL) {
+		katss_sketch_add(counter->sketch, index, value);
+		return;
+	}
+
+	uint64_t low = (uint64_t)counter->table[index] + (uint32_t)value;
+	counter->table[index] = (uint32_t)low;
+	uint32_t high = (uint32_t)(value >> 32) + (uint32_t)(low >> 32);
+	if(high != 0)
+		spill_add(counter, index, high);
+}
+
+
+/**
+ * @brief Add `high` to the high bits of the count at `index`, once its cell wrapped. Takes the
+ * lock of the counter, as threads holding different stripes may spill at the same time.
+ */
+static void
+spill_add(KatssCounter *counter, uint64_t index, uint32_t high)
+{
+	mtx_lock(&counter->lock);
+	KatssSpill *spill = counter->spill;
+	if(spill == NULL) {
+		spill = s_calloc(1, sizeof *spill);
+		counter->spill = spill;
+	}
+
+	/* Grow before the table is half full, rehashing every k-mer that spilled */
+	if(2 * (spill->used + 1) > spill->size) {
+		uint64_t size = MAX2(2 * spill->size, 16);
+		uint64_t *keys = s_calloc(size, sizeof *keys);
+		uint32_t *highs = s_malloc(size * sizeof *highs);
+		for(uint64_t i=0; i<spill->size; i++) {
+			if(spill->keys[i] == 0)
+				continue;
+			uint64_t slot = (spill->keys[i] * UINT64_C(0x9E3779B97F4A7C15)) & (size - 1);
+			while(keys[slot] != 0)
+				slot = (slot + 1) & (size - 1);
+			keys[slot] = spill->keys[i];
+			highs[slot] = spill->highs[i];
+		}
+		free(spill->keys);
+		free(spill->highs);
+		spill->keys = keys;
+		spill->highs = highs;
+		spill->size = size;
+	}
+
+	uint64_t key = index + 1;
+	uint64_t slot = (key * UINT64_C(0x9E3779B97F4A7C15)) & (spill->size - 1);
+	while(spill->keys[slot] != 0 && spill->keys[slot] != key)
+		slot = (slot + 1) & (spill->size - 1);
+	if(spill->keys[slot] == 0) {
+		spill->keys[slot] = key;
+		spill->highs[slot] = 0;
+		spill->used++;
+	}
+	spill->highs[slot] += high;
+	mtx_unlock(&counter->lock);
+}
+
+
+/**
+ * @brief Borrow from the high bits of the count at `index`, once its cell wrapped below 0.
+ */
+static void
+spill_sub(KatssCounter *counter, uint64_t index)
+{
+	/* Adding 2^32 - 1 to the high bits takes one off them */
+	spill_add(counter, index, UINT32_MAX);
+}
+
+
+static inline uint64_t
+spill_get(const KatssCounter *counter, uint64_t index)
+{
+	const KatssSpill *spill = counter->spill;
+	if(spill->used == 0)
+		return 0;
+	uint64_t key = index + 1;
+	uint64_t slot = (key * UINT64_C(0x9E3779B97F4A7C15)) & (spill->size - 1);
+	while(spill->keys[slot] != 0) {
+		if(spill->keys[slot] == key)
+			return (uint64_t)spill->highs[slot] << 32;
+		slot = (slot + 1) & (spill->size - 1);
+	}
+	return 0;
+}
+
+
+/**
+ * @brief Add the high bits a private table spilled into `counter`.
+ */
+static void
+merge_spill(KatssCounter *counter, const KatssCounter *local)
+{
+	const KatssSpill *spill = local->spill;
+	for(uint64_t i=0; spill != NULL && i<spill->size; i++) {
+		if(spill->keys[i] != 0 && spill->highs[i] != 0)
+			spill_add(counter, spill->keys[i] - 1, spill->highs[i]);
+	}
+}
+
+
+static KatssCounter *
+new_counter(unsigned int kmer)
+{
+	if(kmer == 0 || kmer > 32) {
+		error_message("KatssCounter currently does not support kmer value of '%d'.\n"
+		              "Currently supported: 1-32.", kmer);
+		return NULL;
+	}
+
+	/* Capacity is 4^kmer, k-mers longer than 16 bases are only ever in a sparse table */
+	KatssCounter *counter = s_malloc(sizeof *counter);
+	counter->kmer = kmer;
+	counter->capacity = kmer < 16 ? (1U << 2*kmer) - 1 : UINT32_MAX;
+	counter->total = 0;
+	// atomic_init(&counter->total, 0);
+	counter->removed = NULL;
+	counter->tails = NULL;
+	counter->partial_tails = false;
+	counter->table = NULL;
+	counter->spill = NULL;
+	counter->sparse = NULL;
+	counter->sketch = NULL;
+	counter->mapped = false;
+
+	mtx_init(&counter->lock, mtx_plain);
+	for(int i=0; i<KATSS_COUNTER_STRIPES; i++)
+		mtx_init(&counter->stripes[i], mtx_plain);
+
+	return counter;
+}
+
+
+static void
+init_table(KatssCounter *counter, unsigned int kmer)
+{
+	size_t size = (size_t)1 << 2*kmer;
+#ifdef __linux__
+	/* Large tables are mapped on their own so they can be backed by huge pages, which take 512
+	   times fewer TLB entries to cover them. The kernel gives the pages already zeroed */
+	size_t bytes = size * sizeof *counter->table;
+	if(bytes >= HUGE_PAGE_BYTES) {
+		void *table = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(table != MAP_FAILED) {
+#  ifdef MADV_HUGEPAGE
+			madvise(table, bytes, MADV_HUGEPAGE);
+#  endif
+			counter->table = table;
+			counter->mapped = true;
+			return;
+		}
+	}
+#endif
+	counter->table = s_calloc(size, sizeof *counter->table);
+}
+
+
+static void
+init_sparse(KatssCounter *counter)
+{
+	KatssSparse *sparse = s_malloc(sizeof *sparse);
+	sparse->bits = SPARSE_MIN_BITS;
+	sparse->size = UINT64_C(1) << sparse->bits;
+	sparse->used = 0;
+	sparse->last = 0;
+	sparse->max_bytes = 0;
+	sparse->min_count = 0;
+	sparse->threshold = 0;
+	sparse->keys = s_malloc(sparse->size * sizeof *sparse->keys);
+	sparse->counts = s_malloc(sparse->size * sizeof *sparse->counts);
+	memset(sparse->keys, 0xFF, sparse->size * sizeof *sparse->keys);
+	counter->sparse = sparse;
+}
+
+
+static void
+free_table(KatssCounter *counter)
+{
+	if(counter->sparse != NULL) {
+		free(counter->sparse->keys);
+		free(counter->sparse->counts);
+		free(counter->sparse);
+		return;
+	}
+	if(counter->sketch != NULL) {
+		katss_free_sketch(counter->sketch);
+		return;
+	}
+#ifdef __linux__
+	if(counter->mapped) {
+		munmap(counter->table, ((size_t)counter->capacity + 1) * sizeof *counter->table);
+		return;
+	}
+#endif
+	free(counter->table);
+}
+
+
+static inline uint64_t
+sparse_hash(uint64_t hash, unsigned int bits)
+{
+	return (hash * UINT64_C(0x9E3779B97F4A7C15)) >> (64 - bits);
+}
+
+
+/**
+ * @brief Count of the k-mer `hash` in the sparse table, added as a new k-mer if it was not in it.
+ */
+static uint64_t *
+sparse_slot(KatssSparse *sparse, uint64_t hash)
+{
+	if(hash == SPARSE_EMPTY)
+		return &sparse->last;
+
+	uint64_t mask = sparse->size - 1;
+	uint64_t slot = sparse_hash(hash, sparse->bits);
+	while(sparse->keys[slot] != hash) {
+		if(sparse->keys[slot] == SPARSE_EMPTY) {
+			/* Keep at most three quarters of the slots taken, so that probes stay short */
+			if(4 * (sparse->used + 1) > 3 * sparse->size) {
+				make_room(sparse);
+				return sparse_slot(sparse, hash);
+			}
+			sparse->keys[slot] = hash;
+			sparse->counts[slot] = 0;
+			sparse->used++;
+			break;
+		}
+		slot = (slot + 1) & mask;
+	}
+	return &sparse->counts[slot];
+}
+
+
+static uint64_t
+sparse_get(const KatssSparse *sparse, uint64_t hash)
+{
+	if(hash == SPARSE_EMPTY)
+		return sparse->last;
+
+	uint64_t mask = sparse->size - 1;
+	uint64_t slot = sparse_hash(hash, sparse->bits);
+	while(sparse->keys[slot] != SPARSE_EMPTY) {
+		if(sparse->keys[slot] == hash)
+			return sparse->counts[slot];
+		slot = (slot + 1) & mask;
+	}
+	return 0;
+}
+
+
+/**
+ * @brief Make room for a new k-mer in a full sparse table, doubling it if its bound allows it and
+ * dropping the k-mers counted the fewest times otherwise.
+ */
+static void
+make_room(KatssSparse *sparse)
+{
+	uint64_t bytes = 2 * sparse->size * (sizeof *sparse->keys + sizeof *sparse->counts);
+	if(sparse->max_bytes == 0 || bytes <= sparse->max_bytes) {
+		rehash_sparse(sparse, sparse->bits + 1, 0);
+		return;
+	}
+
+	/* Free at least half the slots that may be taken, so the next drop is far off */
+	sparse->threshold = MAX2(sparse->threshold, 2);
+	rehash_sparse(sparse, sparse->bits, sparse->threshold);
+	while(8 * sparse->used > 3 * sparse->size) {
+		sparse->threshold *= 2;
+		rehash_sparse(sparse, sparse->bits, sparse->threshold);
+	}
+}
+
+
+/**
+ * @brief Move the k-mers of the sparse table counted at least `threshold` times into a table of
+ * 2^`bits` slots, dropping the others.
+ */
+static void
+rehash_sparse(KatssSparse *sparse, unsigned int bits, uint64_t threshold)
+{
+	uint64_t old_size = sparse->size;
+	uint64_t *old_keys = sparse->keys;
+	uint64_t *old_counts = sparse->counts;
+
+	sparse->bits = bits;
+	sparse->size = UINT64_C(1) << bits;
+	sparse->used = 0;
+	sparse->keys = s_malloc(sparse->size * sizeof *sparse->keys);
+	sparse->counts = s_malloc(sparse->size * sizeof *sparse->counts);
+	memset(sparse->keys, 0xFF, sparse->size * sizeof *sparse->keys);
+
+	uint64_t mask = sparse->size - 1;
+	for(uint64_t i=0; i<old_size; i++) {
+		if(old_keys[i] == SPARSE_EMPTY || old_counts[i] < threshold)
+			continue;
+		uint64_t slot = sparse_hash(old_keys[i], sparse->bits);
+		while(sparse->keys[slot] != SPARSE_EMPTY)
+			slot = (slot + 1) & mask;
+		sparse->keys[slot] = old_keys[i];
+		sparse->counts[slot] = old_counts[i];
+		sparse->used++;
+	}
+	free(old_keys);
+	free(old_counts);
+}
+
+
+static int
+compare_keys(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+
+static bool
+is_compressed(const char *filename)
+{
+	FILE *file = fopen(filename, "rb");
+	if(file == NULL)
+		return false;
+	unsigned char magic[2] = { 0 };
+	size_t read = fread(magic, 1, 2, file);
+	fclose(file);
+	return read == 2 && magic[0] == 0x1f && magic[1] == 0x8b;
+}
+
+
+static void
+free_removed(KatssCounter *counter)
+{
+	katss_str_node_t *head = counter->removed;
+	while(head != NULL) {
+		katss_str_node_t *tmp = head;
+		head = head->next;
+		if(tmp->str) free(tmp->str);
+		free(tmp);
+	}
+	counter->removed = NULL;
+}
+
+
+static void
+init_idle(void)
+{
+	mtx_init(&idle.lock, mtx_plain);
+	idle.num_counters = 0;
+	idle.bytes = 0;
+}
+
+
+static inline uint64_t
+table_bytes(const KatssCounter *counter)
+{
+	return ((uint64_t)counter->capacity + 1) * sizeof *counter->table;
+}
+
+
+/**
+ * @brief Write `count` to `value` as `numeric_type`, saturating the integer types too narrow to
+ * hold it.
+ */
+static void
+store_value(uint64_t count, KATSS_TYPE numeric_type, void *value)
+{
+	switch(numeric_type) {
+	case KATSS_INT8:
+		*((int8_t *)value) = (int8_t)(count > INT8_MAX) ? INT8_MAX : count;
+		break;
+	case KATSS_UINT8:
+		*((uint8_t *)value) = (uint8_t)(count > UINT8_MAX) ? UINT8_MAX : count;
+		break;
+	case KATSS_INT16:
+		*((int16_t *)value) = (int16_t)(count > INT16_MAX) ? INT16_MAX : count;
+		break;
+	case KATSS_UINT16:
+		*((uint16_t *)value) = (uint16_t)(count > UINT16_MAX) ? UINT16_MAX : count;
+		break;
+	case KATSS_INT32:
+		*((int32_t *)value) = (int32_t)(count > INT32_MAX) ? INT32_MAX : count;
+		break;
+	case KATSS_UINT32:
+		*((uint32_t *)value) = (uint32_t)(count > UINT32_MAX) ? UINT32_MAX : count;
+		break;
+	case KATSS_INT64:
+		*((int64_t *)value) = (int64_t)(count > INT64_MAX) ? INT64_MAX : count;
+		break;
+	case KATSS_UINT64:
+		*((uint64_t *)value) = count;
+		break;
+	case KATSS_FLOAT:
+		*((float *)value) = (float)count;
+		break;
+	case KATSS_DOUBLE:
+		*((double *)value) = (double)count;
+		break;
+	}
+}
+
+
+/**
+ * @brief Write `count` to `value` as `katss_export_range` does, its frequency out of `total`
+ * unless `total` is 0.
+ */
+static inline void
+store_export(uint64_t count, KATSS_TYPE numeric_type, void *value, double total)
+{
+	if(total == 0)
+		store_value(count, numeric_type, value);
+	else if(numeric_type == KATSS_FLOAT)
+		*((float *)value) = (float)((double)count / total);
+	else
+		*((double *)value) = (double)count / total;
+}
+
+
+/* Converts the cells of a block, with the type and stride known to the compiler */
+#define EXPORT_LOOP(type, expr) \
+	do { \
+		if(stride == sizeof(type)) { \
+			type *out = (type *)dst; \
+			for(uint64_t i=0; i<num; i++) \
+				out[i] = (expr); \
+		} else { \
+			for(uint64_t i=0; i<num; i++) \
+				*(type *)(dst + i*stride) = (expr); \
+		} \
+	} while(0)
+
+/**
+ * @brief Write the `num` 32-bit `counts` to `dst`, one every `stride` bytes, as `store_export`
+ * would write each of them. The type is looked at once for the whole block.
+ */
+static void
+export_block(const uint32_t *counts, uint64_t num, KATSS_TYPE numeric_type, unsigned char *dst,
+             size_t stride, double total)
+{
+	if(total != 0) {
+		if(numeric_type == KATSS_FLOAT)
+			EXPORT_LOOP(float, (float)((double)counts[i] / total));
+		else
+			EXPORT_LOOP(double, (double)counts[i] / total);
+		return;
+	}
+
+	switch(numeric_type) {
+	case KATSS_INT8:   EXPORT_LOOP(int8_t, (int8_t)MIN2(counts[i], INT8_MAX));       break;
+	case KATSS_UINT8:  EXPORT_LOOP(uint8_t, (uint8_t)MIN2(counts[i], UINT8_MAX));    break;
+	case KATSS_INT16:  EXPORT_LOOP(int16_t, (int16_t)MIN2(counts[i], INT16_MAX));    break;
+	case KATSS_UINT16: EXPORT_LOOP(uint16_t, (uint16_t)MIN2(counts[i], UINT16_MAX)); break;
+	case KATSS_INT32:  EXPORT_LOOP(int32_t, (int32_t)MIN2(counts[i], INT32_MAX));    break;
+	case KATSS_UINT32: EXPORT_LOOP(uint32_t, counts[i]);                             break;
+	case KATSS_INT64:  EXPORT_LOOP(int64_t, (int64_t)counts[i]);                     break;
+	case KATSS_UINT64: EXPORT_LOOP(uint64_t, (uint64_t)counts[i]);                   break;
+	case KATSS_FLOAT:  EXPORT_LOOP(float, (float)counts[i]);                         break;
+	case KATSS_DOUBLE: EXPORT_LOOP(double, (double)counts[i]);                       break;
+	}
+}
+
+#undef EXPORT_LOOP
+
+
+/**
+ * @brief Write again the counts of the cells in [first, first + num) that spilled, which
+ * `export_block` only had the low bits of.
+ */
+static void
+export_spill(KatssCounter *counter, uint64_t first, uint64_t num, KATSS_TYPE numeric_type,
+             unsigned char *dst, size_t stride, double total)
+{
+	const KatssSpill *spill = counter->spill;
+	for(uint64_t s=0; s<spill->size; s++) {
+		uint64_t index = spill->keys[s] - 1;
+		if(spill->keys[s] == 0 || spill->highs[s] == 0 || index < first || index - first >= num)
+			continue;
+		uint64_t count = counter->table[index] + ((uint64_t)spill->highs[s] << 32);
+		store_export(count, numeric_type, dst + (index - first)*stride, total);
+	}
 }
@@ -0,0 +1,330 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#if defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L) && !defined(__STDC_NO_THREADS__)
+#  include <threads.h>
+#else
+#  include <tinycthread.h>
+#endif
+
+#include "katss_core.h"
+#include "counter.h"
+#include "memory_utils.h"
+
+#define MAX_WORKERS 128
+#define OUTSIDE MAX_WORKERS /* Queue of the tasks submitted by threads outside the pool */
+
+/* Task waiting to be run by the pool */
+struct KatssTask {
+	int (*func)(void *);   /** Function to run */
+	void *arg;             /** Argument passed to `func` */
+	KatssTaskGroup *group; /** Group to report to once `func` returned */
+};
+typedef struct KatssTask KatssTask;
+
+/* Tasks of a worker, which runs the newest first while others steal the oldest */
+struct TaskQueue {
+	mtx_t lock;        /** Guards the queue, taken after the lock of the pool if both are */
+	KatssTask *tasks;  /** Ring of tasks */
+	size_t head;       /** Oldest task, the next one to be stolen */
+	size_t count;      /** Tasks in the ring */
+	size_t size;       /** Room in `tasks` */
+};
+typedef struct TaskQueue TaskQueue;
+
+struct KatssTaskGroup {
+	mtx_t lock;     /** Guards the fields below */
+	cnd_t done;     /** Signaled once every task of the group returned */
+	int pending;    /** Tasks submitted that didn't return yet */
+	int ret;        /** First non-zero return of a task */
+};
+
+/* The pool, created on the first submitted task */
+static struct {
+	mtx_t lock;                       /** Guards the fields below, except the queues */
+	cnd_t wake;                       /** Signaled when tasks are queued or the pool stops */
+	int num_workers;                  /** Threads of the pool */
+	thrd_t workers[MAX_WORKERS];      /** The threads, which work until `stopping` */
+	TaskQueue queues[MAX_WORKERS+1];  /** One per worker, and one for outside the pool */
+	int queued;                       /** Tasks in the queues */
+	int active;                       /** Tasks queued or running */
+	unsigned int next;                /** Queue the next task from outside the pool goes to */
+	bool stopping;                    /** If the workers should return */
+} pool;
+/*
+Notes:
+Threads are only created when more tasks are queued or running than there are workers, so the
+pool grows to the largest number of tasks ever run at the same time, at most MAX_WORKERS, and
+every task starts as soon as it is submitted like a thread of its own would. Workers stay idle
+between calls, keeping their scratch buffers, until `katss_shutdown_pool`.
+*/
+
+static once_flag pool_once = ONCE_FLAG_INIT;
+static tss_t scratch_key;
+static tss_t worker_key;
+
+static void init_pool(void);
+static void free_scratch(void *scratch);
+static int worker(void *arg);
+static int current_worker(void);
+static void push_task(TaskQueue *queue, KatssTask task);
+static bool take_task(int self, KatssTask *task);
+static void run_task(KatssTask *task);
+
+
+KatssScratch *
+katss_scratch(void)
+{
+	call_once(&pool_once, init_pool);
+	KatssScratch *scratch = tss_get(scratch_key);
+	if(scratch == NULL) {
+		scratch = s_malloc(sizeof *scratch);
+		scratch->buffer = s_malloc(KATSS_SCRATCH_BUFFER * sizeof *scratch->buffer);
+		scratch->hashes = s_malloc(KATSS_SCRATCH_HASHES * sizeof *scratch->hashes);
+		scratch->sorted = s_malloc(KATSS_SCRATCH_HASHES * sizeof *scratch->sorted);
+		tss_set(scratch_key, scratch);
+	}
+	return scratch;
+}
+
+
+KatssTaskGroup *
+katss_init_task_group(void)
+{
+	call_once(&pool_once, init_pool);
+	KatssTaskGroup *group = s_malloc(sizeof *group);
+	mtx_init(&group->lock, mtx_plain);
+	cnd_init(&group->done);
+	group->pending = 0;
+	group->ret = 0;
+	return group;
+}
+
+
+void
+katss_submit_task(KatssTaskGroup *group, int (*func)(void *), void *arg)
+{
+	KatssTask task = { func, arg, group };
+	mtx_lock(&group->lock);
+	group->pending++;
+	mtx_unlock(&group->lock);
+
+	/* Start a worker if every one of them is busy */
+	int self = current_worker();
+	mtx_lock(&pool.lock);
+	if(pool.active >= pool.num_workers && pool.num_workers < MAX_WORKERS) {
+		int id = pool.num_workers;
+		if(thrd_create(&pool.workers[id], worker, (void *)(intptr_t)id) == thrd_success)
+			pool.num_workers++;
+	}
+
+	/* Workers run the tasks they submit themselves first, others are spread among them */
+	int queue = self;
+	if(queue < 0)
+		queue = pool.num_workers ? (int)(pool.next++ % pool.num_workers) : OUTSIDE;
+	push_task(&pool.queues[queue], task);
+	pool.active++;
+	pool.queued++;
+	cnd_signal(&pool.wake);
+	mtx_unlock(&pool.lock);
+}
+
+
+int
+katss_wait_task_group(KatssTaskGroup *group)
+{
+	/* Help with queued tasks, unless this is a worker whose own scratch buffers may be in use */
+	bool helping = current_worker() < 0;
+	KatssTask task;
+	mtx_lock(&group->lock);
+	while(group->pending > 0) {
+		mtx_unlock(&group->lock);
+		if(helping && take_task(-1, &task)) {
+			run_task(&task);
+		} else {
+			mtx_lock(&group->lock);
+			if(group->pending > 0)
+				cnd_wait(&group->done, &group->lock);
+			mtx_unlock(&group->lock);
+		}
+		mtx_lock(&group->lock);
+	}
+	int ret = group->ret;
+	mtx_unlock(&group->lock);
+
+	mtx_destroy(&group->lock);
+	cnd_destroy(&group->done);
+	free(group);
+	return ret;
+}
+
+
+void
+katss_shutdown_pool(void)
+{
+	call_once(&pool_once, init_pool);
+	mtx_lock(&pool.lock);
+	pool.stopping = true;
+	cnd_broadcast(&pool.wake);
+	int num_workers = pool.num_workers;
+	mtx_unlock(&pool.lock);
+
+	for(int i=0; i<num_workers; i++)
+		thrd_join(pool.workers[i], NULL);
+
+	mtx_lock(&pool.lock);
+	pool.num_workers = 0;
+	pool.stopping = false;
+	mtx_unlock(&pool.lock);
+
+	/* Scratch buffers of the calling thread as well, as it may be about to unload the library */
+	free_scratch(tss_get(scratch_key));
+	tss_set(scratch_key, NULL);
+	katss_free_idle_counters();
+}
+
+
+static void
+init_pool(void)
+{
+	mtx_init(&pool.lock, mtx_plain);
+	cnd_init(&pool.wake);
+	for(int i=0; i<=MAX_WORKERS; i++) {
+		mtx_init(&pool.queues[i].lock, mtx_plain);
+		pool.queues[i].tasks = NULL;
+		pool.queues[i].head = pool.queues[i].count = pool.queues[i].size = 0;
+	}
+	pool.num_workers = pool.queued = pool.active = 0;
+	pool.next = 0;
+	pool.stopping = false;
+	tss_create(&scratch_key, free_scratch);
+	tss_create(&worker_key, NULL);
+}
+
+
+static void
+free_scratch(void *arg)
+{
+	KatssScratch *scratch = arg;
+	if(scratch == NULL)
+		return;
+	free(scratch->buffer);
+	free(scratch->hashes);
+	free(scratch->sorted);
+	free(scratch);
+}
+
+
+static int
+worker(void *arg)
+{
+	int self = (int)(intptr_t)arg;
+	tss_set(worker_key, (void *)(intptr_t)(self + 1));
+
+	KatssTask task;
+	for(;;) {
+		if(take_task(self, &task)) {
+			run_task(&task);
+			continue;
+		}
+
+		/* Sleep until a task is queued, the queues are checked again in case it was taken */
+		mtx_lock(&pool.lock);
+		while(pool.queued == 0 && !pool.stopping)
+			cnd_wait(&pool.wake, &pool.lock);
+		bool stop = pool.stopping && pool.queued == 0;
+		mtx_unlock(&pool.lock);
+		if(stop)
+			break;
+	}
+	return 0;
+}
+
+
+/**
+ * @brief Index of the worker running on the calling thread, or -1 if it isn't one.
+ */
+static int
+current_worker(void)
+{
+	return (int)(intptr_t)tss_get(worker_key) - 1;
+}
+
+
+static void
+push_task(TaskQueue *queue, KatssTask task)
+{
+	mtx_lock(&queue->lock);
+	if(queue->count == queue->size) {
+		size_t size = MAX2(2 * queue->size, 16);
+		KatssTask *tasks = s_malloc(size * sizeof *tasks);
+		for(size_t i=0; i<queue->count; i++)
+			tasks[i] = queue->tasks[(queue->head + i) % queue->size];
+		free(queue->tasks);
+		queue->tasks = tasks;
+		queue->head = 0;
+		queue->size = size;
+	}
+	queue->tasks[(queue->head + queue->count++) % queue->size] = task;
+	mtx_unlock(&queue->lock);
+}
+
+
+/**
+ * @brief Take the newest task of queue `self`, or else steal the oldest task of another queue.
+ * `self` is -1 for threads outside the pool, which only steal.
+ */
+static bool
+take_task(int self, KatssTask *task)
+{
+	bool found = false;
+	if(self >= 0) {
+		TaskQueue *queue = &pool.queues[self];
+		mtx_lock(&queue->lock);
+		if(queue->count > 0) {
+			*task = queue->tasks[(queue->head + --queue->count) % queue->size];
+			found = true;
+		}
+		mtx_unlock(&queue->lock);
+	}
+
+	for(int i=0; !found && i<=MAX_WORKERS; i++) {
+		TaskQueue *queue = &pool.queues[(self + 1 + i) % (MAX_WORKERS + 1)];
+		mtx_lock(&queue->lock);
+		if(queue->count > 0) {
+			*task = queue->tasks[queue->head];
+			queue->head = (queue->head + 1) % queue->size;
+			queue->count--;
+			found = true;
+		}
+		mtx_unlock(&queue->lock);
+	}
+
+	if(found) {
+		mtx_lock(&pool.lock);
+		pool.queued--;
+		mtx_unlock(&pool.lock);
+	}
+	return found;
+}
+
+
+static void
+run_task(KatssTask *task)
+{
+	int ret = task->func(task->arg);
+
+	mtx_lock(&pool.lock);
+	pool.active--;
+	mtx_unlock(&pool.lock);
+
+	/* The group may be freed by its waiter as soon as the lock is released */
+	KatssTaskGroup *group = task->group;
+	mtx_lock(&group->lock);
+	if(ret != 0 && group->ret == 0)
+		group->ret = ret;
+	if(--group->pending == 0)
+		cnd_broadcast(&group->done);
+	mtx_unlock(&group->lock);
+}
@@ -16,40 +16,60 @@ struct DecrementValues {
 	int start;
 };
 
+/* Hashes of the k-mers to decrement, taken off the counter at once */
+struct Decrements {
+	KatssCounter *counter;  /** Counter the k-mers are uncounted from */
+	uint32_t *hashes;       /** KATSS_SCRATCH_HASHES hashes not yet decremented */
+	size_t num_hashes;      /** Hashes in `hashes` */
+};
+
 struct threadinfo {
 	SeqFile file;
+	KatssStoreReader *store; /** Preloaded sequences read instead of `file`, or NULL */
 	KatssCounter *counter;
 	char *kmer;
 	char *(*find)(const char *, const char *);
 	size_t(*read)(SeqFile, char *, size_t);
-	char *(*proc)(KatssCounter *, char *, const char *);
+	char *(*proc)(struct Decrements *, char *, const char *);
 };
 
 typedef struct DecrementValues DecrementValues;
+typedef struct Decrements Decrements;
 typedef struct threadinfo threadinfo;
 
 /*==================== file specific uncounting functions ====================*/
-static int uncount_kmer_fasta(KatssCounter *counter, const char *filename, const char *kmer);
-static int uncount_kmer_fastq(KatssCounter *counter, const char *filename, const char *kmer);
-static int uncount_kmer_reads(KatssCounter *counter, const char *filename, const char *kmer);
+static int uncount_file(KatssCounter *counter, SeqFile file, char filetype, const char *kmer);
+static int uncount_mt(KatssCounter *counter, const char *filename, SeqFile seqfile,
+                      const char *kmer, int threads);
+static int uncount_kmer_fasta(KatssCounter *counter, SeqFile seqfile, const char *kmer);
+static int uncount_kmer_fastq(KatssCounter *counter, SeqFile seqfile, const char *kmer);
+static int uncount_kmer_reads(KatssCounter *counter, SeqFile seqfile, const char *kmer);
 static int remove_kmer(void *arg);
 
 /*========================= Line processing functions =========================*/
-static char *process_line_fasta(KatssCounter *counter, char *found, const char *pat);
-static DecrementValues decrement_kmer_fasta(KatssCounter *counter, const char *sequence, const char *pat, int min_start, int max_end);
-static char *process_line(KatssCounter *counter, char *found, const char *pat);
-static DecrementValues decrement_kmer(KatssCounter *counter, const char *sequence, const char *pat, int min_start, int max_end);
+static char *process_line_fasta(Decrements *decs, char *found, const char *pat);
+static DecrementValues decrement_kmer_fasta(Decrements *decs, const char *sequence, const char *pat, int min_start, int max_end);
+static char *process_line(Decrements *decs, char *found, const char *pat);
+static DecrementValues decrement_kmer(Decrements *decs, const char *sequence, const char *pat, int min_start, int max_end);
+static void decrement_windows(Decrements *decs, const char *sequence, int start, int end);
+static void flush_decrements(Decrements *decs);
 
 /*========================== File parsing functions ==========================*/
-static inline bool nhash(const char *key, uint32_t *hash_value, int start, int length);
 static inline void cross_out(char *s1, const char *s2);
 static inline void cross_out_fasta(char *s1, const char *s2);
 static inline int subindx(const char *s1, const char *s2);
 static inline int subindx_fasta(const char *s1, const char *s2);
-static char determine_filetype(const char *file);
-static bool is_nucleotide(char character);
+static void close_file(SeqFile file, KatssStoreReader *store);
 static void push(KatssCounter *counter, const char *str);
 
+/*
+Notes:
+The k-mers overlapping every match are hashed with a rolling hash over the bases around it, and
+kept in a buffer of the thread until it fills, which `katss_decrements` takes off the counter
+taking each lock once. Decrementing them one at a time locked the counter for every k-mer, so
+threads uncounting a common k-mer waited on each other more than they read.
+*/
+
 
 /*==================================================================================================
 |                                         Public Functions                                         |
@@ -57,25 +77,59 @@ static void push(KatssCounter *counter, const char *str);
 int
 katss_uncount_kmer(KatssCounter *counter, const char *filename, const char *kmer)
 {
-	char filetype = determine_filetype(filename);
-	if(filetype == 'N') {
+	char filetype;
+	SeqFile file = katss_open_file(filename, "", &filetype);
+	if(file == NULL)
 		return -1;
-	} else if (filetype == 'e') {
-		error_message("Unable to read sequence from file.\nCurrent supported file types are:"
-		              " FASTA, FASTQ, and file containing sequences per line.");
+
+	int num_removed = uncount_file(counter, file, filetype, kmer);
+	seqfclose(file);
+	return num_removed;
+}
+
+
+int
+katss_uncount_kmer_seqfile(KatssCounter *counter, SeqFile file, const char *kmer)
+{
+	/* The file is read again from its start */
+	char filetype;
+	if(file == NULL || katss_rewind_file(NULL, file, "", &filetype) == NULL)
 		return -1;
-	}
+	return uncount_file(counter, file, filetype, kmer);
+}
+
+
+int
+katss_uncount_kmer_mt(KatssCounter *counter, const char *filename, const char *kmer, int threads)
+{
+	return uncount_mt(counter, filename, NULL, kmer, threads);
+}
+
 
+int
+katss_uncount_kmer_seqfile_mt(KatssCounter *counter, SeqFile file, const char *kmer, int threads)
+{
+	if(file == NULL)
+		return -1;
+	return uncount_mt(counter, NULL, file, kmer, threads);
+}
+
+/*==================================================================================================
+|                                        Private Functions                                         |
+==================================================================================================*/
+static int
+uncount_file(KatssCounter *counter, SeqFile file, char filetype, const char *kmer)
+{
 	int num_removed;
 	switch (filetype) {
 	case 'a':
-		num_removed = uncount_kmer_fasta(counter, filename, kmer);
+		num_removed = uncount_kmer_fasta(counter, file, kmer);
 		break;
 	case 'q':
-		num_removed = uncount_kmer_fastq(counter, filename, kmer);
+		num_removed = uncount_kmer_fastq(counter, file, kmer);
 		break;
-	case 's':
-		num_removed = uncount_kmer_reads(counter, filename, kmer);
+	case 'r':
+		num_removed = uncount_kmer_reads(counter, file, kmer);
 		break;
 	default:
 		error_message("katss_uncount_kmer: This error message should be impossible to reach. "
@@ -89,38 +143,30 @@ katss_uncount_kmer(KatssCounter *counter, const char *filename, const char *kmer
 }
 
 
-int
-katss_uncount_kmer_mt(KatssCounter *counter, const char *filename, const char *kmer, int threads)
+static int
+uncount_mt(KatssCounter *counter, const char *filename, SeqFile seqfile, const char *kmer,
+           int threads)
 {
-	char filetype = determine_filetype(filename);
-	if(filetype == 'N') {
+	/* Read the file from memory if it was preloaded, where it is one read per line. A file
+	   already open is read again instead */
+	char filetype = 'r';
+	SeqFile file = NULL;
+	KatssStoreReader *store = seqfile == NULL ? katss_open_store(filename) : NULL;
+	if(store == NULL && (file = katss_rewind_file(filename, seqfile, "", &filetype)) == NULL)
 		return -1;
-	} else if (filetype == 'e') {
-		error_message("Unable to read sequence from file.\nCurrent supported file types are:"
-		              " FASTA, FASTQ, and file containing sequences per line.");
-		return -1;
-	}
 
 	/* Get the total before */
 	int previous_total;
 	katss_get(counter, KATSS_INT32, &previous_total, kmer);
 
-	/* Open SeqFile for reading */
-	char mode[2] = { 0 };
-	mode[0] = filetype;
-	SeqFile file = seqfopen(filename, mode);
-	if(file == NULL) {
-		warning_message("seqfopen: error %d: %s",seqferrno,seqfstrerror(seqferrno));
-		return -1;
-	}
-
-	/* Create threads for reading */
+	/* Create tasks for reading */
 	threads = threads < 1 ? 1 : threads;
-	thrd_t *jobs = s_malloc(threads * sizeof *jobs);
+	KatssTaskGroup *jobs = katss_init_task_group();
 	threadinfo *jobarg = s_malloc(threads * sizeof *jobarg);
 	for(int i=0; i<threads; i++) {
 		jobarg[i].counter = counter;
 		jobarg[i].file = file;
+		jobarg[i].store = store;
 		jobarg[i].kmer = (char *)kmer;
 		switch(filetype) {
 		case 'a': 
@@ -133,31 +179,28 @@ katss_uncount_kmer_mt(KatssCounter *counter, const char *filename, const char *k
 			jobarg[i].find = seqlseqq;
 			jobarg[i].proc = process_line;
 			break;
-		case 's':
+		case 'r':
 			jobarg[i].read = seqfsread;
 			jobarg[i].find = seqlseq;
 			jobarg[i].proc = process_line;
 			break;
 		default:
-			seqfclose(file);
+			katss_wait_task_group(jobs);
+			close_file(file != seqfile ? file : NULL, store);
 			free(jobarg);
-			free(jobs);
 			return -1;
 		}
 
-		/* Start threads */
-		thrd_create(&jobs[i], remove_kmer, &jobarg[i]);
+		/* Start tasks on the pool */
+		katss_submit_task(jobs, remove_kmer, &jobarg[i]);
 	}
 
-	/* Join all threads */
-	for(int i=0; i<threads; i++) {
-		thrd_join(jobs[i], NULL);
-	}
+	/* Wait for all tasks */
+	katss_wait_task_group(jobs);
 
 	/* Free allocated resources */
-	seqfclose(file);
+	close_file(file != seqfile ? file : NULL, store);
 	free(jobarg);
-	free(jobs);
 
 	/* Add kmer to removed list */
 	push(counter, kmer);
@@ -166,71 +209,54 @@ katss_uncount_kmer_mt(KatssCounter *counter, const char *filename, const char *k
 	return previous_total - current_total;
 }
 
-/*==================================================================================================
-|                                        Private Functions                                         |
-==================================================================================================*/
-static int
-uncount_kmer_fasta(KatssCounter *counter, const char *filename, const char *kmer) {
-	SeqFile seqfile = seqfopen(filename, "a");
-	if(seqfile == NULL) {
-		error_message("seqfopen: %s", seqfstrerror(seqferrno));
-		return -1;
-	}
 
+static int
+uncount_kmer_fasta(KatssCounter *counter, SeqFile seqfile, const char *kmer) {
 	uint64_t previous_total = counter->total;
 	char buffer[BUFFER_SIZE] = { 0 };
+	Decrements decs = {.counter = counter, .hashes = katss_scratch()->hashes, .num_hashes = 0};
 	while(seqfagets_unlocked(seqfile, buffer, BUFFER_SIZE)) {
-		process_line(counter, buffer, kmer);
+		process_line(&decs, buffer, kmer);
 	}
-	seqfclose(seqfile);
+	flush_decrements(&decs);
 
 	return previous_total - counter->total;
 }
 
 
 static int
-uncount_kmer_fastq(KatssCounter *counter, const char *filename, const char *kmer)
+uncount_kmer_fastq(KatssCounter *counter, SeqFile seqfile, const char *kmer)
 {
-	SeqFile seqfile = seqfopen(filename, "q");
-	if(seqfile == NULL) {
-		error_message("seqfopen: %s", seqfstrerror(seqferrno));
-		return -1;
-	}
-
 	uint64_t previous_total = counter->total;
 	char buffer[BUFFER_SIZE] = { 0 };
+	Decrements decs = {.counter = counter, .hashes = katss_scratch()->hashes, .num_hashes = 0};
 	register char *ptr;
 	while(seqfqread_unlocked(seqfile, buffer, BUFFER_SIZE)) {
 		ptr = buffer;
 		while((ptr = seqlseqq(ptr, kmer)) != NULL) {
-			ptr = process_line(counter, ptr, kmer);
+			ptr = process_line(&decs, ptr, kmer);
 		}
 	}
-	seqfclose(seqfile);
+	flush_decrements(&decs);
 
 	return previous_total - counter->total;
 }
 
 
 static int
-uncount_kmer_reads(KatssCounter *counter, const char *filename, const char *kmer)
+uncount_kmer_reads(KatssCounter *counter, SeqFile seqfile, const char *kmer)
 {
-	SeqFile seqfile = seqfopen(filename, "s");
-	if(seqfile == NULL) {
-		error_message("seqfopen: %s", seqfstrerror(seqferrno));
-		return -1;
-	}
-
 	uint64_t previous_total = counter->total;
 	char buffer[BUFFER_SIZE] = { 0 };
+	Decrements decs = {.counter = counter, .hashes = katss_scratch()->hashes, .num_hashes = 0};
 	register char *ptr;
 	while(seqfsread_unlocked(seqfile, buffer, BUFFER_SIZE)) {
 		ptr = buffer;
 		while((ptr = seqlseq(ptr, kmer)) != NULL) {
-			ptr = process_line(counter, ptr, kmer);
+			ptr = process_line(&decs, ptr, kmer);
 		}
 	}
-	seqfclose(seqfile);
+	flush_decrements(&decs);
 
 	return previous_total - counter->total;
 }
@@ -240,22 +266,26 @@ static int
 remove_kmer(void *arg)
 {
 	threadinfo *rec = (threadinfo *)arg;
-	char *buffer = s_malloc(BUFFER_SIZE * sizeof(char));
+	KatssScratch *scratch = katss_scratch();
+	char *buffer = scratch->buffer;
+	Decrements decs = {.counter = rec->counter, .hashes = scratch->hashes, .num_hashes = 0};
 	register char *ptr;
-	while(rec->read(rec->file, buffer, BUFFER_SIZE)) {
+	while(rec->store ? katss_store_read(rec->store, buffer, BUFFER_SIZE)
+	                 : rec->read(rec->file, buffer, BUFFER_SIZE)) {
 		ptr = buffer;
 		while((ptr = rec->find(ptr, rec->kmer)) != NULL) {
-			ptr = rec->proc(rec->counter, ptr, rec->kmer);
+			ptr = rec->proc(&decs, ptr, rec->kmer);
 		}
 	}
-	free(buffer);
+	flush_decrements(&decs);
 	return 0;
 }
 
 
 static char *
-process_line_fasta(KatssCounter *counter, char *found, const char *pat)
+process_line_fasta(Decrements *decs, char *found, const char *pat)
 {
+	KatssCounter *counter = decs->counter;
 	int end = 0;
 	bool found_newseq = false;
 	for(end=0; found[end]; end++) {
@@ -279,7 +309,7 @@ process_line_fasta(KatssCounter *counter, char *found, const char *pat)
 	DecrementValues vals = {.shift = 0, .start = 0};
 
 	while(shift < num_kmers_in_seq) {
-		vals = decrement_kmer_fasta(counter, found+shift, pat, vals.start, num_kmers_in_seq-shift);
+		vals = decrement_kmer_fasta(decs, found+shift, pat, vals.start, num_kmers_in_seq-shift);
 		shift += vals.shift;
 	}
 
@@ -290,8 +320,9 @@ process_line_fasta(KatssCounter *counter, char *found, const char *pat)
 
 
 static DecrementValues
-decrement_kmer_fasta(KatssCounter *counter, const char *sequence, const char *pat, int min_start, int max_end)
+decrement_kmer_fasta(Decrements *decs, const char *sequence, const char *pat, int min_start, int max_end)
 {
+	KatssCounter *counter = decs->counter;
 	DecrementValues vals = {.shift = max_end, .start = 0};
 
 	int pat_indx = subindx_fasta(sequence, pat);
@@ -316,17 +347,7 @@ decrement_kmer_fasta(KatssCounter *counter, const char *sequence, const char *pa
 		start--;
 	}
 	start = start < min_start ? min_start : start; 
-
-	uint32_t hash_value;
-	while(start < end) {
-		if(sequence[start] == '\n') {
-			start++;
-			continue;
-		}
-		bool is_valid = nhash(sequence, &hash_value, start++, counter->kmer);
-		if(!is_valid) { continue; }
-		katss_decrement(counter, hash_value);
-	}
+	decrement_windows(decs, sequence, start, end);
 
 	vals.shift = end;
 	vals.start = end - vals.shift;
@@ -335,8 +356,9 @@ decrement_kmer_fasta(KatssCounter *counter, const char *sequence, const char *pa
 }
 
 static char *
-process_line(KatssCounter *counter, char *found, const char *pat)
+process_line(Decrements *decs, char *found, const char *pat)
 {
+	KatssCounter *counter = decs->counter;
 	int end = 0;
 	bool found_newline = false;
 	for(end=0; found[end]; end++) {
@@ -360,7 +382,7 @@ process_line(KatssCounter *counter, char *found, const char *pat)
 	DecrementValues vals = {.shift = 0, .start = 0};
 
 	while(shift < num_kmers_in_seq) {
-		vals = decrement_kmer(counter, found+shift, pat, vals.start, num_kmers_in_seq-shift);
+		vals = decrement_kmer(decs, found+shift, pat, vals.start, num_kmers_in_seq-shift);
 		shift += vals.shift;
 	}
 
@@ -371,8 +393,9 @@ process_line(KatssCounter *counter, char *found, const char *pat)
 
 
 static DecrementValues
-decrement_kmer(KatssCounter *counter, const char *sequence, const char *pat, int min_start, int max_end)
+decrement_kmer(Decrements *decs, const char *sequence, const char *pat, int min_start, int max_end)
 {
+	KatssCounter *counter = decs->counter;
 	DecrementValues vals = {.shift = max_end, .start = 0};
 
 	int pat_indx = subindx(sequence, pat);
@@ -386,13 +409,7 @@ decrement_kmer(KatssCounter *counter, const char *sequence, const char *pat, int
 
 	int start = pat_indx - counter->kmer + 1;
 	start = start < min_start ? min_start : start; 
-
-	uint32_t hash_value;
-	while(start < end) {
-		bool is_valid = nhash(sequence, &hash_value, start++, counter->kmer);
-		if(!is_valid) { continue; }
-		katss_decrement(counter, hash_value);
-	}
+	decrement_windows(decs, sequence, start, end);
 
 	vals.shift = pat_indx + pat_len;
 	vals.start = end - vals.shift;
@@ -401,102 +418,70 @@ decrement_kmer(KatssCounter *counter, const char *sequence, const char *pat, int
 }
 
 
-static char
-determine_filetype(const char *file)
+static void
+close_file(SeqFile file, KatssStoreReader *store)
 {
-	/* Open the seqfFile, return 'N' upon error */
-	SeqFile reads_file = seqfopen(file, "b");
-	if(reads_file == NULL) {
-		error_message("katss: %s: %s", file, strerror(errno));
-		seqfclose(reads_file);
-		return 'N';
-	}
-
-	char buffer[BUFFER_SIZE];
-	int lines_read = 0;
-	int fastq_score_lines = 0;
-	int sequence_lines = 0;
-
-	while (seqfgets(reads_file, buffer, BUFFER_SIZE) != NULL && lines_read < 10) {
-		lines_read++;
-		char first_char = buffer[0];
-
-		/* Check if the first line starts with '@' for FASTQ */
-		if (first_char == '@' && lines_read % 4 == 1) {
-			fastq_score_lines++;
-
-		/* Check if the third line starts with '+' for FASTQ */
-		} else if (first_char == '+' && lines_read % 4 == 3) {
-			fastq_score_lines++;
-
-		/* Check if the line starts with '>' or ';' for FASTA */
-		} else if (first_char == '>' || first_char == ';') {
-			seqfclose(reads_file);
-			return 'a';
-		} else {
-			// Check for nucleotide characters
-			int num_total = 0, num = 0;
-			for(int i = 0; buffer[i] != '\0'; i++) {
-				if(is_nucleotide(buffer[i])) {
-					num++;
-				}
-				num_total++;
-			}
-			if((double)num/num_total > 0.9) {
-				sequence_lines++;
-			}
-		}
-	}
-
-    seqfclose(reads_file);
-
-    if (fastq_score_lines >= 2) {
-        return 'q'; // fastq file
-    } else if (sequence_lines == 10) {
-        return 's'; // raw sequences file
-    } else {
-        return 'e'; // unsupported file type
-    }
+	if(store != NULL)
+		katss_close_store(store);
+	else
+		seqfclose(file);
 }
 
 
-static bool
-is_nucleotide(char character)
+/**
+ * @brief Add to `decs` the hash of every k-mer starting in [start, end) of `sequence`, skipping
+ * the ones with a base other than A, C, G, T or U. Newlines are skipped over, as FASTA sequences
+ * span several lines.
+ */
+static void
+decrement_windows(Decrements *decs, const char *sequence, int start, int end)
 {
-	switch(character) {
-		case 'A':   return true;
-		case 'a':   return true;
-		case 'C':   return true;
-		case 'c':   return true;
-		case 'G':   return true;
-		case 'g':   return true;
-		case 'T':   return true;
-		case 't':   return true;
-		case 'U':   return true;
-		case 'u':   return true;
-		default:    return false;
+	unsigned int kmer = decs->counter->kmer;
+	int num_windows = 0;
+	for(int i=start; i<end; i++)
+		num_windows += sequence[i] != '\n';
+	if(num_windows <= 0)
+		return;
+
+	/* Hashes wrap as they did when every k-mer was hashed on its own */
+	uint32_t mask = kmer < 16 ? (UINT32_C(1) << 2*kmer) - 1 : UINT32_MAX;
+	uint32_t hash = 0;
+	unsigned int run = 0; /* Valid bases ending at the current one */
+	int last_base = num_windows + (int)kmer - 1;
+	const char *ptr = sequence + start;
+	for(int base=0; base<last_base; ptr++) {
+		uint32_t value;
+		switch(*ptr) {
+		case 'A': case 'a': value = 0; break;
+		case 'C': case 'c': value = 1; break;
+		case 'G': case 'g': value = 2; break;
+		case 'T': case 't': value = 3; break;
+		case 'U': case 'u': value = 3; break;
+		case '\n': continue;
+		case '\0': return; /* Every k-mer left would run past the sequence */
+		default: value = 4; break;
+		}
+		base++;
+		if(value == 4) {
+			run = 0;
+			continue;
+		}
+
+		hash = ((hash << 2) | value) & mask;
+		if(++run < kmer)
+			continue;
+		decs->hashes[decs->num_hashes++] = hash;
+		if(decs->num_hashes == KATSS_SCRATCH_HASHES)
+			flush_decrements(decs);
 	}
 }
 
 
-static inline bool
-nhash(const char *key, uint32_t *hash_value, int start, int length)
+static void
+flush_decrements(Decrements *decs)
 {
-	register uint32_t hash_value_ = 0;
-	register char *ptr = (char *)key+start;
-	for(int i=0; i<length; i++) {
-		switch(*ptr++) {
-		case 'A': hash_value_ = hash_value_ * 4;     break;
-		case 'C': hash_value_ = hash_value_ * 4 + 1; break;
-		case 'G': hash_value_ = hash_value_ * 4 + 2; break;
-		case 'T': hash_value_ = hash_value_ * 4 + 3; break;
-		case 'U': hash_value_ = hash_value_ * 4 + 3; break;
-		case '\n': i--; break;
-		default : return false;
-		}
-	}
-	*hash_value = hash_value_;
-	return true;
+	katss_decrements(decs->counter, decs->hashes, decs->num_hashes);
+	decs->num_hashes = 0;
 }
 
 
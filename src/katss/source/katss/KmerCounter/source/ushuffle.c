@@ -38,24 +38,6 @@
 #include <string.h>
 #include "ushuffle.h"
 
-/* set random function */
-
-#if defined(_WIN32) || defined(_WIN64)
-	static randfunc_t randfunc = rand;
-#else
-	static randfunc_t randfunc = random;
-#endif
-
-void set_randfunc(randfunc_t func) {
-	randfunc = func;
-}
-
-/* global variables for the Euler algorithm */
-
-static const char *s_ = NULL;
-static int l_ = 0;
-static int k_ = 0;
-
 typedef struct vertex {
 	int *indices;
 	int n_indices;
@@ -64,10 +46,33 @@ typedef struct vertex {
 	int i_sequence;
 } vertex;
 
-static vertex *vertices = NULL;
-static int n_vertices;
-static int *indices = NULL;
-static int root;
+typedef struct hentry {
+	struct hentry *next;
+	int i_sequence;
+	int i_vertices;
+} hentry;
+
+/* state of the Euler algorithm, one per thread shuffling sequences */
+struct ushuffle_t {
+	randfunc_t randfunc;
+	void *randstate;
+
+	const char *s_;
+	int l_;
+	int k_;
+
+	vertex *vertices;
+	int n_vertices;
+	int *indices;
+	int root;
+
+	hentry *entries;
+	hentry **htable;
+	int htablesize;
+	double hmagic;
+
+	int size;	/* (k-1)-lets the work arrays have room for */
+};
 
 /* memory utility */
 
@@ -81,88 +86,119 @@ static void *malloc0(size_t size) {
 	return memset(mem, 0, size);
 }
 
-/* hashtable utility */
+/* random function */
 
-typedef struct hentry {
-	struct hentry *next;
-	int i_sequence;
-	int i_vertices;
-} hentry;
+static unsigned long stdrand(void *state) {
+	(void) state;
+	return (unsigned long) rand();
+}
+
+/* context of the functions without one */
+
+static ushuffle_t global = { stdrand, NULL };
+
+void set_randfunc(randfunc_t func, void *state) {
+	global.randfunc = func ? func : stdrand;
+	global.randstate = state;
+}
 
-static hentry *entries = NULL;
-static hentry **htable = NULL;
-static int htablesize = 0;
-static double hmagic;
+ushuffle_t *ushuffle_new(randfunc_t randfunc, void *randstate) {
+	ushuffle_t *ctx = malloc0(sizeof(ushuffle_t));
 
-static int hcode(int i_sequence) {
+	ctx->randfunc = randfunc ? randfunc : stdrand;
+	ctx->randstate = randstate;
+	return ctx;
+}
+
+void ushuffle_free(ushuffle_t *ctx) {
+	if (ctx == NULL)
+		return;
+	free(ctx->vertices);
+	free(ctx->indices);
+	free(ctx->entries);
+	free(ctx->htable);
+	free(ctx);
+}
+
+/* work arrays are kept from one sequence to the next, growing when needed */
+
+static void reserve(ushuffle_t *ctx, int n_lets) {
+	if (n_lets <= ctx->size)
+		return;
+	free(ctx->vertices);
+	free(ctx->indices);
+	free(ctx->entries);
+	free(ctx->htable);
+	ctx->vertices = malloc0(n_lets * sizeof(vertex));
+	ctx->indices = malloc0(n_lets * sizeof(int));
+	ctx->entries = malloc0(n_lets * sizeof(hentry));
+	ctx->htable = malloc0(n_lets * sizeof(hentry *));
+	ctx->size = n_lets;
+}
+
+/* hashtable utility */
+
+static int hcode(ushuffle_t *ctx, int i_sequence) {
 	double f = 0.0;
 	int i;
 
-	for (i = 0; i < k_ - 1; i++) {
-		f += s_[i_sequence + i];
-		f *= hmagic;
+	for (i = 0; i < ctx->k_ - 1; i++) {
+		f += ctx->s_[i_sequence + i];
+		f *= ctx->hmagic;
 	}
 	if (f < 0.0)
 		f = -f;
-	return (int) (htablesize * f) % htablesize;
+	return (int) (ctx->htablesize * f) % ctx->htablesize;
 }
 
-static void hinit(int size) {
-	entries = malloc0(size * sizeof(hentry));
-	htable = malloc0(size * sizeof(hentry *));
-	htablesize = size;
-	hmagic = (sqrt(5.0) - 1.0) / 2.0;
+static void hinit(ushuffle_t *ctx, int size) {
+	memset(ctx->htable, 0, size * sizeof(hentry *));
+	ctx->htablesize = size;
+	ctx->hmagic = (sqrt(5.0) - 1.0) / 2.0;
 }
 
-static void hcleanup() {
-	free(entries);
-	entries = NULL;
-	free(htable);
-	htable = NULL;
-	htablesize = 0;
-}
-
-static void hinsert(int i_sequence) {
-	int code = hcode(i_sequence);
-	hentry *e, *e2 = &entries[i_sequence];
+static void hinsert(ushuffle_t *ctx, int i_sequence) {
+	int code = hcode(ctx, i_sequence);
+	hentry *e, *e2 = &ctx->entries[i_sequence];
 
-	for (e = htable[code]; e; e = e->next)
-		if (strncmp(&s_[e->i_sequence], &s_[i_sequence], k_ - 1) == 0) {
+	for (e = ctx->htable[code]; e; e = e->next)
+		if (strncmp(&ctx->s_[e->i_sequence], &ctx->s_[i_sequence], ctx->k_ - 1) == 0) {
 			e2->i_sequence = e->i_sequence;
 			e2->i_vertices = e->i_vertices;
 			return;
 		}
 	e2->i_sequence = i_sequence;
-	e2->i_vertices = n_vertices++;
-	e2->next = htable[code];
-	htable[code] = e2;
+	e2->i_vertices = ctx->n_vertices++;
+	e2->next = ctx->htable[code];
+	ctx->htable[code] = e2;
 }
 
 /* the Euler algorithm */
 
-void shuffle1(const char *s, int l, int k) {
+void ushuffle1_r(ushuffle_t *ctx, const char *s, int l, int k) {
 	int i, j, n_lets;
+	vertex *vertices;
 
-	s_ = s;
-	l_ = l;
-	k_ = k;
-	if (k_ >= l_ || k_ <= 1)	/* two special cases */
+	ctx->s_ = s;
+	ctx->l_ = l;
+	ctx->k_ = k;
+	if (k >= l || k <= 1)	/* two special cases */
 		return;
 
 	/* use hashtable to find distinct vertices */
-	n_lets = l_ - k_ + 2;	/* number of (k-1)-lets */
-	n_vertices = 0;
-	hinit(n_lets);
+	n_lets = l - k + 2;	/* number of (k-1)-lets */
+	reserve(ctx, n_lets);
+	ctx->n_vertices = 0;
+	hinit(ctx, n_lets);
 	for (i = 0; i < n_lets; i++)
-		hinsert(i);
-	root = entries[n_lets - 1].i_vertices;	/* the last let */
-	if (vertices)
-		free(vertices);
-	vertices = malloc0(n_vertices * sizeof(vertex));
+		hinsert(ctx, i);
+	ctx->root = ctx->entries[n_lets - 1].i_vertices;	/* the last let */
+	vertices = ctx->vertices;
+	memset(vertices, 0, ctx->n_vertices * sizeof(vertex));
 
 	/* set i_sequence and n_indices for each vertex */
 	for (i = 0; i < n_lets; i++) {	/* for each let */
-		hentry *ev = &entries[i];
+		hentry *ev = &ctx->entries[i];
 		vertex *v = &vertices[ev->i_vertices];
 
 		v->i_sequence = ev->i_sequence;
@@ -171,50 +207,48 @@ void shuffle1(const char *s, int l, int k) {
 	}
 
 	/* distribute indices for each vertex */
-	if (indices)
-		free(indices);
-	indices = malloc0((n_lets - 1) * sizeof(int));
 	j = 0;
-	for (i = 0; i < n_vertices; i++) {	/* for each vertex */
+	for (i = 0; i < ctx->n_vertices; i++) {	/* for each vertex */
 		vertex *v = &vertices[i];
 
-		v->indices = indices + j;
+		v->indices = ctx->indices + j;
 		j += v->n_indices;
 	}
 
 	/* populate indices for each vertex */
 	for (i = 0; i < n_lets - 1; i++) {	/* for each edge */
-		hentry *eu = &entries[i];
-		hentry *ev = &entries[i + 1];
+		hentry *eu = &ctx->entries[i];
+		hentry *ev = &ctx->entries[i + 1];
 		vertex *u = &vertices[eu->i_vertices];
 
 		u->indices[u->i_indices++] = ev->i_vertices;
 	}
-	hcleanup();
 }
 
-void permutec(char *t, int l) {
+static void upermutec(ushuffle_t *ctx, char *t, int l) {
 	int i, j;
 	char tmp;
 
 	for (i = l - 1; i > 0; i--) {
-		j = rand() % (i + 1);
+		j = ctx->randfunc(ctx->randstate) % (i + 1);
 		tmp = t[i]; t[i] = t[j]; t[j] = tmp;	/* swap */
 	}
 }
 
-static void permutei(int *t, int l) {
+static void upermutei(ushuffle_t *ctx, int *t, int l) {
 	int i, j;
 	int tmp;
 
 	for (i = l - 1; i > 0; i--) {
-		j = rand() % (i + 1);
+		j = ctx->randfunc(ctx->randstate) % (i + 1);
 		tmp = t[i]; t[i] = t[j]; t[j] = tmp;	/* swap */
 	}
 }
 
-void shuffle2(char *t) {
-	vertex *u, *v;
+void ushuffle2_r(ushuffle_t *ctx, char *t) {
+	vertex *u, *v, *vertices = ctx->vertices;
+	const char *s_ = ctx->s_;
+	int l_ = ctx->l_, k_ = ctx->k_, root = ctx->root;
 	int i, j;
 
 	/* exact copy case */
@@ -226,18 +260,18 @@ void shuffle2(char *t) {
 	/* simple permutation case */
 	if (k_ <= 1) {
 		strncpy(t, s_, l_);
-		permutec(t, l_);
+		upermutec(ctx, t, l_);
 		return;
 	}
 
 	/* the Wilson algorithm for random arborescence */
-	for (i = 0; i < n_vertices; i++)
+	for (i = 0; i < ctx->n_vertices; i++)
 		vertices[i].intree = 0;
 	vertices[root].intree = 1;
-	for (i = 0; i < n_vertices; i++) {
+	for (i = 0; i < ctx->n_vertices; i++) {
 		u = &vertices[i];
 		while (!u->intree) {
-			u->next = rand() % u->n_indices;
+			u->next = ctx->randfunc(ctx->randstate) % u->n_indices;
 			u = &vertices[u->indices[u->next]];
 		}
 		u = &vertices[i];
@@ -248,15 +282,15 @@ void shuffle2(char *t) {
 	}
 
 	/* shuffle indices to prepare for walk */
-	for (i = 0; i < n_vertices; i++) {
+	for (i = 0; i < ctx->n_vertices; i++) {
 		u = &vertices[i];
 		if (i != root) {
 			j = u->indices[u->n_indices - 1];	/* swap the last one */
 			u->indices[u->n_indices - 1] = u->indices[u->next];
 			u->indices[u->next] = j;
-			permutei(u->indices, u->n_indices - 1);	/* permute the rest */
+			upermutei(ctx, u->indices, u->n_indices - 1);	/* permute the rest */
 		} else
-			permutei(u->indices, u->n_indices);
+			upermutei(ctx, u->indices, u->n_indices);
 		u->i_indices = 0;	/* reset to zero before walk */
 	}
 
@@ -273,6 +307,25 @@ void shuffle2(char *t) {
 	}
 }
 
+void ushuffle_r(ushuffle_t *ctx, const char *s, char *t, int l, int k) {
+	ushuffle1_r(ctx, s, l, k);
+	ushuffle2_r(ctx, t);
+}
+
+/* functions without a context share a global one */
+
+void permutec(char *t, int l) {
+	upermutec(&global, t, l);
+}
+
+void shuffle1(const char *s, int l, int k) {
+	ushuffle1_r(&global, s, l, k);
+}
+
+void shuffle2(char *t) {
+	ushuffle2_r(&global, t);
+}
+
 void shuffle(const char *s, char *t, int l, int k) {
 	shuffle1(s, l, k);
 	shuffle2(t);
@@ -31,16 +31,23 @@
  *	Mon Apr 23 14:35:21 MDT 2007
  */
 
+/* random function, called with the state it was given along with it */
+typedef unsigned long (*randfunc_t)(void *state);
+
+/* re-entrant interface, each context holding its own random function and work arrays */
+typedef struct ushuffle_t ushuffle_t;
+
+ushuffle_t *ushuffle_new(randfunc_t randfunc, void *randstate);
+void ushuffle_free(ushuffle_t *ctx);
+void ushuffle_r(ushuffle_t *ctx, const char *s, char *t, int l, int k);
+void ushuffle1_r(ushuffle_t *ctx, const char *s, int l, int k);
+void ushuffle2_r(ushuffle_t *ctx, char *t);
+
+/* functions below share a global context, and are not thread-safe */
 void shuffle(const char *s, char *t, int l, int k);
 void shuffle1(const char *s, int l, int k);
 void shuffle2(char *t);
 
-#if defined (_WIN32) || defined (_WIN64)
-typedef int (*randfunc_t)();
-#else
-typedef long (*randfunc_t)();
-#endif
-
-void set_randfunc(randfunc_t randfunc);
+void set_randfunc(randfunc_t randfunc, void *state);
 
 void permutec(char *t, int l);	/* for use by test.c */
@@ -0,0 +1,898 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L) && !defined(__STDC_NO_THREADS__)
+#  include <threads.h>
+#else
+#  include <tinycthread.h>
+#endif
+
+#include <zlib.h>
+
+#include "counter.h"
+#include "enrichments.h"
+#include "katss.h"
+#include "hash_functions.h"
+#include "memory_utils.h"
+#include "seqfile.h"
+#include "synthetic.h"
+
+/*
+Notes:
+Every stage is run `repeats` times and the fastest run is reported, as the slower ones mostly
+measure whatever else the machine was doing. Inputs of a stage, such as the counters recounted
+or the hashes incremented, are made before its clock starts.
+
+The hash, increment and kernel stages work on files loaded into memory, so they measure the
+hasher and the tables alone, without the file being read. The kernel stage compares the block
+hashing kernels specialized for a k-mer against the generic one reading k from the hasher. Every other stage reads the files
+written by `synth_write` from disk, through the page cache once the first repeat has run.
+*/
+
+#define BUFFER_SIZE   65536U    /* Bytes read at a time, as when counting */
+#define INCREMENTS    4096U     /* Hash values given to `katss_increments` at a time */
+#define INFLATE_CHUNK 1048576U  /* Bytes inflated at a time by the inflate stage */
+#define MAX_THREADS   128       /* As many threads as the counters use */
+#define BUDGET_ITERS  8         /* Bootstrap iterations of the budget stage */
+#define BUDGET_KMAX   12        /* Largest k-mer of the budget stage, its tables take 64 MiB */
+
+enum {
+	STAGE_INFLATE   = 1 << 0,
+	STAGE_PARSE     = 1 << 1,
+	STAGE_HASH      = 1 << 2,
+	STAGE_INCREMENT = 1 << 3,
+	STAGE_COUNT     = 1 << 4,
+	STAGE_RECOUNT   = 1 << 5,
+	STAGE_BOOTSTRAP = 1 << 6,
+	STAGE_TOP       = 1 << 7,
+	STAGE_BUDGET    = 1 << 8,
+	STAGE_KERNEL    = 1 << 9,
+};
+
+static const struct { const char *name; int flag; } stage_names[] = {
+	{"inflate", STAGE_INFLATE}, {"parse", STAGE_PARSE}, {"hash", STAGE_HASH},
+	{"increment", STAGE_INCREMENT}, {"count", STAGE_COUNT}, {"recount", STAGE_RECOUNT},
+	{"bootstrap", STAGE_BOOTSTRAP}, {"top", STAGE_TOP}, {"budget", STAGE_BUDGET},
+	{"kernel", STAGE_KERNEL},
+};
+
+/* What is run, as given on the command line */
+typedef struct {
+	const char *output;     /** JSON is written here, stdout if NULL */
+	const char *prefix;     /** Generated files start with this */
+	SynthOptions synth;     /** What the generated reads look like */
+	unsigned int kmin;      /** Smallest k-mer of the sweep */
+	unsigned int kmax;      /** Largest k-mer of the sweep */
+	int threads;            /** Threads are swept in powers of 2 up to this */
+	int repeats;            /** Runs of every measurement, the fastest is kept */
+	int stages;             /** STAGE_* flags of the stages run */
+	bool keep;              /** Leave the generated files behind */
+} BenchOptions;
+
+/* One measurement of a stage */
+typedef struct {
+	const char *stage;
+	const char *variant;    /** What was measured in the stage, e.g. the function or format */
+	unsigned int kmer;      /** 0 when the stage doesn't depend on it */
+	int threads;
+	uint64_t bytes;         /** Bytes processed, 0 if they don't apply */
+	uint64_t items;         /** Records, k-mers or hashes processed */
+	double seconds;
+} BenchResult;
+
+/* Sequences of the reads file held in memory, as `seqfread` returns them */
+typedef struct {
+	char **chunks;
+	size_t num_chunks;
+	uint64_t bytes;
+	char filetype;
+} LoadedReads;
+
+/* A slice of the hashes incremented by a thread */
+typedef struct {
+	KatssCounter *counter;
+	uint32_t *hashes;
+	size_t num_hashes;
+} IncrementJob;
+
+static FILE *out;
+static bool first_result = true;
+
+
+static double
+now(void)
+{
+	struct timespec ts;
+#ifdef _WIN32
+	timespec_get(&ts, TIME_UTC);
+#else
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+
+static void
+report(const BenchResult *result)
+{
+	fprintf(out, "%s\n    {\"stage\": \"%s\", \"variant\": \"%s\", ", first_result ? "" : ",",
+	        result->stage, result->variant);
+	if(result->kmer)
+		fprintf(out, "\"kmer\": %u, ", result->kmer);
+	else
+		fprintf(out, "\"kmer\": null, ");
+	fprintf(out, "\"threads\": %d, \"bytes\": %llu, \"items\": %llu, \"seconds\": %.6f, "
+	        "\"mb_per_s\": %.3f, \"items_per_s\": %.1f}",
+	        result->threads, (unsigned long long)result->bytes,
+	        (unsigned long long)result->items, result->seconds,
+	        result->seconds > 0 ? (double)result->bytes / result->seconds / 1e6 : 0.0,
+	        result->seconds > 0 ? (double)result->items / result->seconds : 0.0);
+	fflush(out);
+	first_result = false;
+}
+
+
+/* Keep the fastest of `seconds` and the best so far, negative if the run failed */
+static void
+keep_fastest(BenchResult *result, double seconds, int repeat)
+{
+	if(seconds >= 0 && (repeat == 0 || result->seconds < 0 || seconds < result->seconds))
+		result->seconds = seconds;
+	else if(repeat == 0)
+		result->seconds = -1;
+}
+
+
+static void
+path_of(char *path, size_t size, const char *prefix, const char *name, SynthFormat format,
+        bool compressed)
+{
+	snprintf(path, size, "%s.%s.%s%s", prefix, name, synth_extension(format),
+	         compressed ? ".gz" : "");
+}
+
+
+/*==============================================================================
+ Stages reading files
+==============================================================================*/
+
+static double
+time_inflate(const char *path, uint64_t *bytes)
+{
+	gzFile file = gzopen(path, "rb");
+	if(file == NULL)
+		return -1;
+	char *buffer = s_malloc(INFLATE_CHUNK);
+	double start = now();
+	int read;
+	*bytes = 0;
+	while((read = gzread(file, buffer, INFLATE_CHUNK)) > 0)
+		*bytes += (uint64_t)read;
+	double seconds = now() - start;
+	gzclose(file);
+	free(buffer);
+	return read < 0 ? -1 : seconds;
+}
+
+
+static double
+time_seqfread(const char *path, uint64_t *bytes)
+{
+	char *buffer = s_malloc(BUFFER_SIZE);
+	double start = now();
+	SeqFile file = seqfopen(path, "d");
+	if(file == NULL) {
+		free(buffer);
+		return -1;
+	}
+	size_t read;
+	*bytes = 0;
+	while((read = seqfread(file, buffer, BUFFER_SIZE)) > 0)
+		*bytes += read;
+	seqfclose(file);
+	double seconds = now() - start;
+	free(buffer);
+	return seconds;
+}
+
+
+static double
+time_seqfgets(const char *path, uint64_t *bytes, uint64_t *records)
+{
+	char *buffer = s_malloc(BUFFER_SIZE);
+	double start = now();
+	SeqFile file = seqfopen(path, "d");
+	if(file == NULL) {
+		free(buffer);
+		return -1;
+	}
+	*bytes = *records = 0;
+	while(seqfgets(file, buffer, BUFFER_SIZE) != NULL) {
+		*bytes += strlen(buffer);
+		++*records;
+	}
+	seqfclose(file);
+	double seconds = now() - start;
+	free(buffer);
+	return seconds;
+}
+
+
+static void
+bench_files(const BenchOptions *opts)
+{
+	static const SynthFormat formats[] = {SYNTH_READS, SYNTH_FASTA, SYNTH_FASTQ};
+	char path[4096];
+
+	for(size_t f = 0; f < sizeof formats / sizeof *formats; f++) {
+		for(int compressed = 0; compressed <= 1; compressed++) {
+			path_of(path, sizeof path, opts->prefix, "test", formats[f], compressed);
+			char variant[32];
+
+			if(compressed && (opts->stages & STAGE_INFLATE)) {
+				BenchResult result = {.stage = "inflate", .variant = synth_extension(formats[f]),
+				                      .threads = 1};
+				for(int r = 0; r < opts->repeats; r++)
+					keep_fastest(&result, time_inflate(path, &result.bytes), r);
+				result.items = opts->synth.num_reads;
+				report(&result);
+			}
+			if(!(opts->stages & STAGE_PARSE))
+				continue;
+
+			snprintf(variant, sizeof variant, "seqfread:%s%s", synth_extension(formats[f]),
+			         compressed ? ".gz" : "");
+			BenchResult result = {.stage = "parse", .variant = variant, .threads = 1};
+			for(int r = 0; r < opts->repeats; r++)
+				keep_fastest(&result, time_seqfread(path, &result.bytes), r);
+			result.items = opts->synth.num_reads;
+			report(&result);
+
+			snprintf(variant, sizeof variant, "seqfgets:%s%s", synth_extension(formats[f]),
+			         compressed ? ".gz" : "");
+			result = (BenchResult){.stage = "parse", .variant = variant, .threads = 1};
+			for(int r = 0; r < opts->repeats; r++)
+				keep_fastest(&result, time_seqfgets(path, &result.bytes, &result.items), r);
+			report(&result);
+		}
+	}
+}
+
+
+/*==============================================================================
+ Stages on the reads in memory
+==============================================================================*/
+
+static int
+load_reads(const char *path, LoadedReads *reads)
+{
+	SeqFile file = seqfopen(path, "d");
+	if(file == NULL)
+		return 1;
+	switch(seqftype(file)) {
+	case 'a': reads->filetype = 'a'; break;
+	case 'q': reads->filetype = 'q'; break;
+	default:  reads->filetype = 'r'; break;
+	}
+
+	size_t size = 64;
+	reads->chunks = s_malloc(size * sizeof *reads->chunks);
+	reads->num_chunks = 0;
+	reads->bytes = 0;
+	char *buffer = s_malloc(BUFFER_SIZE);
+	size_t read;
+	while((read = seqfread(file, buffer, BUFFER_SIZE)) > 0) {
+		if(reads->num_chunks == size) {
+			size *= 2;
+			reads->chunks = s_realloc(reads->chunks, size * sizeof *reads->chunks);
+		}
+		char *chunk = s_malloc(read + 1);
+		memcpy(chunk, buffer, read);
+		chunk[read] = '\0';
+		reads->chunks[reads->num_chunks++] = chunk;
+		reads->bytes += read;
+	}
+	free(buffer);
+	seqfclose(file);
+	return 0;
+}
+
+
+static void
+free_reads(LoadedReads *reads)
+{
+	for(size_t i = 0; i < reads->num_chunks; i++)
+		free(reads->chunks[i]);
+	free(reads->chunks);
+}
+
+
+/* Hash every k-mer of `reads`, storing the hashes in `hashes` if not NULL */
+static double
+time_hash(const LoadedReads *reads, unsigned int kmer, uint32_t *hashes, uint64_t *num_hashes)
+{
+	KatssHasher *hasher = katss_init_hasher(kmer, reads->filetype);
+	if(hasher == NULL)
+		return -1;
+	uint64_t n = 0;
+	uint32_t hash, sum = 0;
+	double start = now();
+	for(size_t i = 0; i < reads->num_chunks; i++) {
+		katss_set_seq(hasher, reads->chunks[i], reads->filetype);
+		while(katss_get_fh(hasher, &hash, reads->filetype)) {
+			if(hashes != NULL)
+				hashes[n] = hash;
+			sum += hash;
+			n++;
+		}
+	}
+	double seconds = now() - start;
+	free(hasher);
+
+	/* Keeps the hashes from being optimized away when not stored */
+	if(sum == UINT32_MAX)
+		fputc('\0', stderr);
+	*num_hashes = n;
+	return seconds;
+}
+
+
+/* Hash every k-mer of `reads` a block at a time with `kernel`, summing the hashes in `sum` */
+static double
+time_kernel(const LoadedReads *reads, unsigned int kmer, KatssHashBlock kernel,
+            uint64_t *num_hashes, uint32_t *sum)
+{
+	KatssHasher *hasher = katss_init_hasher(kmer, reads->filetype);
+	if(hasher == NULL)
+		return -1;
+	uint32_t *hashes = s_malloc(INCREMENTS * sizeof *hashes);
+	uint64_t n = 0;
+	uint32_t total = 0;
+	double start = now();
+	for(size_t i = 0; i < reads->num_chunks; i++) {
+		katss_set_seq(hasher, reads->chunks[i], reads->filetype);
+		size_t block;
+		while((block = kernel(hasher, hashes, INCREMENTS)) > 0) {
+			for(size_t j = 0; j < block; j++)
+				total += hashes[j];
+			n += block;
+		}
+	}
+	double seconds = now() - start;
+	free(hashes);
+	free(hasher);
+	*num_hashes = n;
+	*sum = total;
+	return seconds;
+}
+
+
+static int
+increment_job(void *arg)
+{
+	IncrementJob *job = arg;
+	for(size_t i = 0; i < job->num_hashes; i += INCREMENTS)
+		katss_increments(job->counter, job->hashes + i, MIN2(INCREMENTS, job->num_hashes - i));
+	return 0;
+}
+
+
+static double
+time_increment(uint32_t *hashes, uint64_t num_hashes, unsigned int kmer, int threads)
+{
+	KatssCounter *counter = katss_init_counter(kmer);
+	if(counter == NULL)
+		return -1;
+	IncrementJob jobs[MAX_THREADS];
+	thrd_t thrds[MAX_THREADS];
+	uint64_t per_thread = (num_hashes + threads - 1) / threads;
+	for(int t = 0; t < threads; t++) {
+		uint64_t first = MIN2(num_hashes, per_thread * t);
+		jobs[t] = (IncrementJob){counter, hashes + first, MIN2(per_thread, num_hashes - first)};
+	}
+
+	double start = now();
+	if(threads == 1) {
+		increment_job(&jobs[0]);
+	} else {
+		for(int t = 0; t < threads; t++)
+			thrd_create(&thrds[t], increment_job, &jobs[t]);
+		for(int t = 0; t < threads; t++)
+			thrd_join(thrds[t], NULL);
+	}
+	double seconds = now() - start;
+	katss_free_counter(counter);
+	return seconds;
+}
+
+
+static void
+bench_memory(const BenchOptions *opts, const int *sweep, int num_sweep)
+{
+	char path[4096];
+	path_of(path, sizeof path, opts->prefix, "test", SYNTH_READS, false);
+	LoadedReads reads;
+	if(load_reads(path, &reads) != 0) {
+		error_message("katss_bench: unable to read '%s'", path);
+		return;
+	}
+
+	/* At most a hash per base, plus one per chunk for the newline ending it */
+	uint32_t *hashes = NULL;
+	if(opts->stages & STAGE_INCREMENT)
+		hashes = s_malloc((reads.bytes + reads.num_chunks + 1) * sizeof *hashes);
+
+	for(unsigned int k = opts->kmin; k <= opts->kmax && k <= 16; k++) {
+		uint64_t num_hashes = 0;
+		if(opts->stages & STAGE_HASH) {
+			BenchResult result = {.stage = "hash", .variant = "katss_get_fh", .kmer = k,
+			                      .threads = 1, .bytes = reads.bytes};
+			for(int r = 0; r < opts->repeats; r++)
+				keep_fastest(&result, time_hash(&reads, k, NULL, &result.items), r);
+			report(&result);
+		}
+		if(!(opts->stages & STAGE_INCREMENT))
+			continue;
+
+		time_hash(&reads, k, hashes, &num_hashes);
+		for(int t = 0; t < num_sweep; t++) {
+			BenchResult result = {.stage = "increment", .variant = "katss_increments", .kmer = k,
+			                      .threads = sweep[t], .items = num_hashes};
+			for(int r = 0; r < opts->repeats; r++)
+				keep_fastest(&result, time_increment(hashes, num_hashes, k, sweep[t]), r);
+			report(&result);
+		}
+	}
+	free(hashes);
+	free_reads(&reads);
+}
+
+
+/* Specialized block hashing kernels against the generic one, on every format in memory. K-mers
+   without a kernel of their own are skipped, as they get the generic one. Both must give the
+   same hashes, so the stage fails if they don't */
+static int
+bench_kernels(const BenchOptions *opts)
+{
+	static const SynthFormat formats[] = {SYNTH_READS, SYNTH_FASTA, SYNTH_FASTQ};
+	char path[4096], special_name[32], generic_name[32];
+
+	int ret = 0;
+	for(size_t f = 0; f < sizeof formats / sizeof *formats; f++) {
+		path_of(path, sizeof path, opts->prefix, "test", formats[f], false);
+		LoadedReads reads;
+		if(load_reads(path, &reads) != 0) {
+			error_message("katss_bench: unable to read '%s'", path);
+			ret = 1;
+			continue;
+		}
+
+		KatssHashBlock generic = katss_hash_block_kernel(0, reads.filetype);
+		for(unsigned int k = opts->kmin; k <= opts->kmax && k <= 16; k++) {
+			KatssHashBlock kernel = katss_hash_block_kernel(k, reads.filetype);
+			if(kernel == NULL || kernel == generic)
+				continue;
+
+			snprintf(special_name, sizeof special_name, "specialized:%s",
+			         synth_extension(formats[f]));
+			snprintf(generic_name, sizeof generic_name, "generic:%s",
+			         synth_extension(formats[f]));
+			BenchResult special = {.stage = "kernel", .variant = special_name, .kmer = k,
+			                       .threads = 1, .bytes = reads.bytes};
+			BenchResult runtime = {.stage = "kernel", .variant = generic_name, .kmer = k,
+			                       .threads = 1, .bytes = reads.bytes};
+			uint32_t special_sum = 0, runtime_sum = 0;
+			for(int r = 0; r < opts->repeats; r++) {
+				keep_fastest(&special, time_kernel(&reads, k, kernel, &special.items,
+				                                   &special_sum), r);
+				keep_fastest(&runtime, time_kernel(&reads, k, generic, &runtime.items,
+				                                   &runtime_sum), r);
+			}
+			report(&special);
+			report(&runtime);
+
+			if(special.items != runtime.items || special_sum != runtime_sum) {
+				error_message("katss_bench: the %u-mer kernel of %s files hashes differently "
+				              "than the generic one", k, synth_extension(formats[f]));
+				ret = 1;
+			}
+		}
+		free_reads(&reads);
+	}
+	return ret;
+}
+
+
+/*==============================================================================
+ Stages counting files
+==============================================================================*/
+
+static double
+time_count(const char *path, unsigned int kmer, int threads)
+{
+	double start = now();
+	KatssCounter *counter = katss_count_kmers_mt(path, kmer, threads);
+	double seconds = now() - start;
+	if(counter == NULL)
+		return -1;
+	katss_free_counter(counter);
+	return seconds;
+}
+
+
+static double
+time_recount(KatssCounter *counter, const char *path, const char *remove, int threads)
+{
+	double start = now();
+	int ret = katss_recount_kmer_mt(counter, path, remove, threads);
+	double seconds = now() - start;
+	return ret == 0 ? seconds : -1;
+}
+
+
+static double
+time_bootstrap(const char *path, unsigned int kmer, unsigned int seed, int threads)
+{
+	double start = now();
+	KatssCounter *counter = katss_count_kmers_bootstrap_mt(path, kmer, 25, &seed, threads);
+	double seconds = now() - start;
+	if(counter == NULL)
+		return -1;
+	katss_free_counter(counter);
+	return seconds;
+}
+
+
+static double
+time_top(KatssCounter *test, KatssCounter *ctrl, int threads)
+{
+	KatssEnrichment top;
+	double start = now();
+	int found = katss_top_enrichments(test, ctrl, false, threads, &top, 1);
+	double seconds = now() - start;
+	return found == 1 ? seconds : -1;
+}
+
+
+static void
+bench_counting(const BenchOptions *opts, const int *sweep, int num_sweep)
+{
+	char test[4096], ctrl[4096], remove[17];
+	path_of(test, sizeof test, opts->prefix, "test", SYNTH_READS, false);
+	path_of(ctrl, sizeof ctrl, opts->prefix, "ctrl", SYNTH_READS, false);
+	uint64_t bytes = opts->synth.num_reads * (opts->synth.length + 1);
+
+	for(unsigned int k = opts->kmin; k <= opts->kmax && k <= 16; k++) {
+		/* Recounts remove the k-mer of all A's, as IKKE would its top k-mer */
+		memset(remove, 'A', k);
+		remove[k] = '\0';
+		KatssCounter *test_counter = NULL, *ctrl_counter = NULL;
+		if(opts->stages & (STAGE_RECOUNT | STAGE_TOP))
+			test_counter = katss_count_kmers_mt(test, k, sweep[num_sweep - 1]);
+		if(opts->stages & STAGE_TOP)
+			ctrl_counter = katss_count_kmers_mt(ctrl, k, sweep[num_sweep - 1]);
+
+		for(int t = 0; t < num_sweep; t++) {
+			int threads = sweep[t];
+			if(opts->stages & STAGE_COUNT) {
+				BenchResult result = {.stage = "count", .variant = "katss_count_kmers_mt",
+				                      .kmer = k, .threads = threads, .bytes = bytes,
+				                      .items = opts->synth.num_reads};
+				for(int r = 0; r < opts->repeats; r++)
+					keep_fastest(&result, time_count(test, k, threads), r);
+				report(&result);
+			}
+			if((opts->stages & STAGE_BOOTSTRAP)) {
+				BenchResult result = {.stage = "bootstrap",
+				                      .variant = "katss_count_kmers_bootstrap_mt",
+				                      .kmer = k, .threads = threads, .bytes = bytes,
+				                      .items = opts->synth.num_reads};
+				for(int r = 0; r < opts->repeats; r++)
+					keep_fastest(&result, time_bootstrap(test, k, (unsigned int)r + 1, threads), r);
+				report(&result);
+			}
+			if((opts->stages & STAGE_RECOUNT) && test_counter != NULL) {
+				BenchResult result = {.stage = "recount", .variant = "katss_recount_kmer_mt",
+				                      .kmer = k, .threads = threads, .bytes = bytes,
+				                      .items = opts->synth.num_reads};
+				for(int r = 0; r < opts->repeats; r++)
+					keep_fastest(&result, time_recount(test_counter, test, remove, threads), r);
+				report(&result);
+			}
+		}
+
+		/* Recounts leave the counter with the k-mer removed, so it is counted again for top */
+		if((opts->stages & STAGE_TOP) && test_counter != NULL && ctrl_counter != NULL) {
+			if(opts->stages & STAGE_RECOUNT) {
+				katss_free_counter(test_counter);
+				test_counter = katss_count_kmers_mt(test, k, sweep[num_sweep - 1]);
+			}
+			for(int t = 0; t < num_sweep && test_counter != NULL; t++) {
+				BenchResult result = {.stage = "top", .variant = "katss_top_enrichments", .kmer = k,
+				                      .threads = sweep[t], .items = UINT64_C(1) << 2*k};
+				for(int r = 0; r < opts->repeats; r++)
+					keep_fastest(&result, time_top(test_counter, ctrl_counter, sweep[t]), r);
+				report(&result);
+			}
+		}
+		if(test_counter != NULL)
+			katss_free_counter(test_counter);
+		if(ctrl_counter != NULL)
+			katss_free_counter(ctrl_counter);
+	}
+}
+
+
+/*==============================================================================
+ Bootstrap memory budget
+==============================================================================*/
+
+static double
+time_budget(const char *test, const char *ctrl, unsigned int kmer, int threads, uint64_t budget,
+            KatssData **data)
+{
+	KatssOptions kopts;
+	katss_init_options(&kopts);
+	kopts.kmer = (int)kmer;
+	kopts.threads = threads;
+	kopts.bootstrap_iters = BUDGET_ITERS;
+	kopts.seed = 1;
+	kopts.memory_budget = budget;
+	kopts.sort_enrichments = false;
+
+	double start = now();
+	*data = katss_enrichment(test, ctrl, &kopts);
+	double seconds = now() - start;
+	return *data != NULL ? seconds : -1;
+}
+
+
+/* Whether two bootstraps gave the same enrichments, bit for bit but for NaNs */
+static bool
+same_bootstrap(const KatssData *a, const KatssData *b)
+{
+	if(a->num_kmers != b->num_kmers)
+		return false;
+	for(uint64_t i = 0; i < a->num_kmers; i++) {
+		const KatssDataEntry *x = &a->kmers[i], *y = &b->kmers[i];
+		if(x->kmer != y->kmer ||
+		   (x->rval != y->rval && !(isnan(x->rval) && isnan(y->rval))) ||
+		   (x->stdev != y->stdev && !(isnan(x->stdev) && isnan(y->stdev))) ||
+		   (x->pval != y->pval && !(isnan(x->pval) && isnan(y->pval))))
+			return false;
+	}
+	return true;
+}
+
+
+/* Regular bootstraps counted one iteration per pass over the files, the least memory there is,
+   and as many as fit in the default budget. Both must give the same enrichments, so the stage
+   fails if they don't */
+static int
+bench_budget(const BenchOptions *opts, const int *sweep, int num_sweep)
+{
+	char test[4096], ctrl[4096];
+	path_of(test, sizeof test, opts->prefix, "test", SYNTH_READS, false);
+	path_of(ctrl, sizeof ctrl, opts->prefix, "ctrl", SYNTH_READS, false);
+	uint64_t bytes = 2 * opts->synth.num_reads * (opts->synth.length + 1);
+
+	int ret = 0;
+	for(unsigned int k = opts->kmin; k <= opts->kmax && k <= BUDGET_KMAX; k++) {
+		uint64_t least = 2 * (UINT64_C(1) << 2*k) * sizeof(uint32_t);
+		for(int t = 0; t < num_sweep; t++) {
+			KatssData *small = NULL, *large = NULL, *data;
+			BenchResult pass = {.stage = "budget", .variant = "one_iteration_per_pass", .kmer = k,
+			                    .threads = sweep[t], .bytes = bytes, .items = BUDGET_ITERS};
+			BenchResult batched = {.stage = "budget", .variant = "default_budget", .kmer = k,
+			                       .threads = sweep[t], .bytes = bytes, .items = BUDGET_ITERS};
+			for(int r = 0; r < opts->repeats; r++) {
+				keep_fastest(&pass, time_budget(test, ctrl, k, sweep[t], least, &data), r);
+				if(small == NULL)
+					small = data;
+				else if(data != NULL)
+					katss_free_kdata(data);
+				keep_fastest(&batched, time_budget(test, ctrl, k, sweep[t], 0, &data), r);
+				if(large == NULL)
+					large = data;
+				else if(data != NULL)
+					katss_free_kdata(data);
+			}
+			report(&pass);
+			report(&batched);
+
+			if(small == NULL || large == NULL || !same_bootstrap(small, large)) {
+				error_message("katss_bench: bootstrap of k=%u on %d threads depends on the "
+				              "memory budget", k, sweep[t]);
+				ret = 1;
+			}
+			if(small != NULL)
+				katss_free_kdata(small);
+			if(large != NULL)
+				katss_free_kdata(large);
+		}
+	}
+	return ret;
+}
+
+
+/*==============================================================================
+ Command line
+==============================================================================*/
+
+static void
+usage(FILE *stream)
+{
+	fprintf(stream,
+	"Usage: katss_bench [options]\n"
+	"Generate synthetic reads and measure the throughput of every stage of counting.\n\n"
+	"  -o FILE     Write the JSON results to FILE instead of stdout\n"
+	"  -p PREFIX   Prefix of the generated files (default: katss_bench)\n"
+	"  -n NUM      Reads in every file (default: 100000)\n"
+	"  -l LENGTH   Bases in every read (default: 100)\n"
+	"  -N RATE     Chance of a base being an N (default: 0.001)\n"
+	"  -k MIN-MAX  K-mer lengths swept, at most 16 (default: 1-16)\n"
+	"  -t NUM      Threads are swept in powers of 2 up to NUM (default: 4)\n"
+	"  -r NUM      Runs of every measurement, the fastest is kept (default: 3)\n"
+	"  -s SEED     Seed of the generated reads (default: 1)\n"
+	"  -S LIST     Comma separated stages to run (default: all), out of\n"
+	"              inflate,parse,hash,increment,count,recount,bootstrap,top,budget,\n"
+	"              kernel\n"
+	"              budget fails if bootstraps depend on the memory budget, and kernel if\n"
+	"              a specialized hashing kernel hashes differently than the generic one\n"
+	"  -K          Keep the generated files\n"
+	"  -h          Show this message\n");
+}
+
+
+static int
+parse_stages(const char *list)
+{
+	int stages = 0;
+	while(*list) {
+		size_t length = strcspn(list, ",");
+		size_t i;
+		for(i = 0; i < sizeof stage_names / sizeof *stage_names; i++) {
+			if(strlen(stage_names[i].name) == length &&
+			   strncmp(stage_names[i].name, list, length) == 0)
+				break;
+		}
+		if(i == sizeof stage_names / sizeof *stage_names)
+			return -1;
+		stages |= stage_names[i].flag;
+		list += length + (list[length] == ',');
+	}
+	return stages;
+}
+
+
+static int
+parse_args(int argc, char **argv, BenchOptions *opts)
+{
+	*opts = (BenchOptions){
+		.prefix = "katss_bench",
+		.synth = {.num_reads = 100000, .length = 100, .n_rate = 0.001, .seed = 1},
+		.kmin = 1, .kmax = 16, .threads = 4, .repeats = 3, .stages = -1,
+	};
+
+	for(int i = 1; i < argc; i++) {
+		const char *arg = argv[i];
+		if(arg[0] != '-' || arg[1] == '\0' || arg[2] != '\0')
+			return 1;
+		if(arg[1] == 'h') {
+			usage(stdout);
+			exit(EXIT_SUCCESS);
+		}
+		if(arg[1] == 'K') {
+			opts->keep = true;
+			continue;
+		}
+		if(i + 1 == argc)
+			return 1;
+		const char *value = argv[++i];
+		switch(arg[1]) {
+		case 'o': opts->output = value; break;
+		case 'p': opts->prefix = value; break;
+		case 'n': opts->synth.num_reads = strtoull(value, NULL, 10); break;
+		case 'l': opts->synth.length = (unsigned int)strtoul(value, NULL, 10); break;
+		case 'N': opts->synth.n_rate = strtod(value, NULL); break;
+		case 't': opts->threads = atoi(value); break;
+		case 'r': opts->repeats = atoi(value); break;
+		case 's': opts->synth.seed = strtoull(value, NULL, 10); break;
+		case 'S': if((opts->stages = parse_stages(value)) < 0) return 1; break;
+		case 'k':
+			if(sscanf(value, "%u-%u", &opts->kmin, &opts->kmax) != 2)
+				opts->kmin = opts->kmax = (unsigned int)atoi(value);
+			break;
+		default: return 1;
+		}
+	}
+
+	if(opts->synth.num_reads == 0 || opts->synth.length == 0 || opts->synth.n_rate < 0 ||
+	   opts->synth.n_rate > 1 || opts->kmin < 1 || opts->kmax > 16 || opts->kmin > opts->kmax ||
+	   opts->threads < 1 || opts->threads > MAX_THREADS || opts->repeats < 1)
+		return 1;
+	return 0;
+}
+
+
+static int
+generate(const BenchOptions *opts, bool cleanup)
+{
+	static const SynthFormat formats[] = {SYNTH_READS, SYNTH_FASTA, SYNTH_FASTQ};
+	char path[4096];
+	for(size_t f = 0; f < sizeof formats / sizeof *formats; f++) {
+		for(int compressed = 0; compressed <= 1; compressed++) {
+			path_of(path, sizeof path, opts->prefix, "test", formats[f], compressed);
+			if(cleanup)
+				(void)remove(path);
+			else if(synth_write(path, formats[f], compressed, &opts->synth) != 0)
+				return 1;
+		}
+	}
+
+	/* The control of top-enrichments and bootstraps is the same reads drawn from another seed */
+	path_of(path, sizeof path, opts->prefix, "ctrl", SYNTH_READS, false);
+	if(cleanup) {
+		(void)remove(path);
+		return 0;
+	}
+	SynthOptions ctrl = opts->synth;
+	ctrl.seed = ~ctrl.seed;
+	return synth_write(path, SYNTH_READS, false, &ctrl);
+}
+
+
+int
+main(int argc, char **argv)
+{
+	BenchOptions opts;
+	if(parse_args(argc, argv, &opts) != 0) {
+		usage(stderr);
+		return EXIT_FAILURE;
+	}
+
+	out = opts.output ? fopen(opts.output, "w") : stdout;
+	if(out == NULL) {
+		error_message("katss_bench: unable to write '%s'", opts.output);
+		return EXIT_FAILURE;
+	}
+	if(generate(&opts, false) != 0)
+		return EXIT_FAILURE;
+
+	int sweep[16], num_sweep = 0;
+	for(int t = 1; t < opts.threads; t *= 2)
+		sweep[num_sweep++] = t;
+	sweep[num_sweep++] = opts.threads;
+
+	fprintf(out, "{\n  \"config\": {\"reads\": %llu, \"length\": %u, \"n_rate\": %g, "
+	        "\"seed\": %llu, \"kmin\": %u, \"kmax\": %u, \"threads\": %d, \"repeats\": %d},\n"
+	        "  \"results\": [",
+	        (unsigned long long)opts.synth.num_reads, opts.synth.length, opts.synth.n_rate,
+	        (unsigned long long)opts.synth.seed, opts.kmin, opts.kmax, opts.threads,
+	        opts.repeats);
+
+	if(opts.stages & (STAGE_INFLATE | STAGE_PARSE))
+		bench_files(&opts);
+	if(opts.stages & (STAGE_HASH | STAGE_INCREMENT))
+		bench_memory(&opts, sweep, num_sweep);
+	int failed = 0;
+	if(opts.stages & STAGE_KERNEL)
+		failed |= bench_kernels(&opts);
+	if(opts.stages & (STAGE_COUNT | STAGE_RECOUNT | STAGE_BOOTSTRAP | STAGE_TOP))
+		bench_counting(&opts, sweep, num_sweep);
+	if(opts.stages & STAGE_BUDGET)
+		failed |= bench_budget(&opts, sweep, num_sweep);
+
+	fprintf(out, "\n  ]\n}\n");
+	if(out != stdout)
+		fclose(out);
+	if(!opts.keep)
+		generate(&opts, true);
+	katss_shutdown_pool();
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,124 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <zlib.h>
+
+#include "synthetic.h"
+#include "memory_utils.h"
+
+#define FASTA_WIDTH 60    /* Bases per line of fasta records */
+#define CLEAN_READS 10    /* Leading reads without an 'N', which the file type is detected on */
+
+/* Either a plain or a gzipped file being written */
+typedef struct {
+	FILE *plain;
+	gzFile gz;
+	bool failed;
+} SynthWriter;
+
+static inline uint64_t
+splitmix64(uint64_t *state)
+{
+	uint64_t z = (*state += UINT64_C(0x9E3779B97F4A7C15));
+	z = (z ^ (z >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+	z = (z ^ (z >> 27)) * UINT64_C(0x94D049BB133111EB);
+	return z ^ (z >> 31);
+}
+
+
+static void
+write_bytes(SynthWriter *writer, const char *bytes, size_t length)
+{
+	if(writer->failed || length == 0)
+		return;
+	if(writer->gz != NULL)
+		writer->failed = gzwrite(writer->gz, bytes, (unsigned int)length) != (int)length;
+	else
+		writer->failed = fwrite(bytes, 1, length, writer->plain) != length;
+}
+
+
+static void
+draw_read(char *read, unsigned int length, double n_rate, bool clean, uint64_t *state)
+{
+	/* N-rate as a threshold on 32 random bits, so a single draw gives both the base and the N */
+	uint64_t n_threshold = clean ? 0 : (uint64_t)(n_rate * 4294967296.0);
+	for(unsigned int i = 0; i < length; i++) {
+		uint64_t draw = splitmix64(state);
+		read[i] = (draw & UINT32_MAX) < n_threshold ? 'N' : "ACGT"[draw >> 62];
+	}
+}
+
+
+const char *
+synth_extension(SynthFormat format)
+{
+	switch(format) {
+	case SYNTH_READS: return "txt";
+	case SYNTH_FASTA: return "fa";
+	case SYNTH_FASTQ: return "fq";
+	}
+	return "";
+}
+
+
+int
+synth_write(const char *path, SynthFormat format, bool compressed, const SynthOptions *opts)
+{
+	SynthWriter writer = {0};
+	if(compressed)
+		writer.gz = gzopen(path, "wb6");
+	else
+		writer.plain = fopen(path, "wb");
+	if(writer.gz == NULL && writer.plain == NULL) {
+		error_message("katss_bench: unable to write '%s'", path);
+		return 1;
+	}
+
+	/* Room for the read, its header and, for fastq, its qualities */
+	unsigned int length = opts->length;
+	char *read = s_malloc(length + 1);
+	char *quals = s_malloc(length + 1);
+	memset(quals, 'I', length);
+	quals[length] = '\n';
+	char header[64];
+
+	uint64_t state = opts->seed;
+	for(uint64_t r = 0; r < opts->num_reads && !writer.failed; r++) {
+		draw_read(read, length, opts->n_rate, r < CLEAN_READS, &state);
+		read[length] = '\n';
+		switch(format) {
+		case SYNTH_READS:
+			write_bytes(&writer, read, length + 1);
+			break;
+		case SYNTH_FASTA:
+			write_bytes(&writer, header, (size_t)sprintf(header, ">read_%llu\n",
+			                                             (unsigned long long)r));
+			for(unsigned int i = 0; i < length; i += FASTA_WIDTH) {
+				write_bytes(&writer, read + i, MIN2(FASTA_WIDTH, length - i));
+				write_bytes(&writer, "\n", 1);
+			}
+			break;
+		case SYNTH_FASTQ:
+			write_bytes(&writer, header, (size_t)sprintf(header, "@read_%llu\n",
+			                                             (unsigned long long)r));
+			write_bytes(&writer, read, length + 1);
+			write_bytes(&writer, "+\n", 2);
+			write_bytes(&writer, quals, length + 1);
+			break;
+		}
+	}
+	free(read);
+	free(quals);
+
+	bool failed = writer.failed;
+	if(writer.gz != NULL)
+		failed |= gzclose(writer.gz) != Z_OK;
+	else
+		failed |= fclose(writer.plain) != 0;
+	if(failed)
+		error_message("katss_bench: unable to write '%s'", path);
+	return failed ? 1 : 0;
+}
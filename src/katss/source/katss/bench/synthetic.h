@@ -0,0 +1,42 @@
+#ifndef KATSS_BENCH_SYNTHETIC_H
+#define KATSS_BENCH_SYNTHETIC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** File formats written by `synth_write` */
+typedef enum {
+	SYNTH_READS,  /** One read per line */
+	SYNTH_FASTA,  /** Reads as fasta records, wrapped every 60 bases */
+	SYNTH_FASTQ,  /** Reads as fastq records with constant qualities */
+} SynthFormat;
+
+/** What the synthetic reads look like */
+typedef struct {
+	uint64_t num_reads;   /** Reads written */
+	unsigned int length;  /** Bases in every read */
+	double n_rate;        /** Chance of every base being an 'N' */
+	uint64_t seed;        /** Same seed, same reads, whatever the format */
+} SynthOptions;
+
+
+/**
+ * @brief Write reads drawn uniformly from ACGT into `path`, in `format`, gzipped when
+ * `compressed`. The first 10 reads never hold an 'N', so the file type is still detected
+ * for high N-rates.
+ *
+ * @param path       File to write, replaced if it exists
+ * @param format     Format of the reads
+ * @param compressed Write the file through gzip
+ * @param opts       How many reads, and of what length
+ * @return int 0 if succeeded, otherwise if the file could not be written
+ */
+int synth_write(const char *path, SynthFormat format, bool compressed, const SynthOptions *opts);
+
+
+/**
+ * @brief Extension of the files of `format`, without the ".gz" of compressed ones.
+ */
+const char *synth_extension(SynthFormat format);
+
+#endif // KATSS_BENCH_SYNTHETIC_H
@@ -1,6 +1,8 @@
 #ifndef KATSS_T_TEST_H
 #define KATSS_T_TEST_H
 
+#include <stddef.h>
+
 
 /**
  * @brief Two sample T-test aggregate
@@ -22,6 +24,30 @@ struct t_test2_aggregate {
 typedef struct t_test2_aggregate t_test2_aggregate;
 
 
+/**
+ * @brief Two sample T-test aggregates of many variables, each field holding
+ * the values of every variable contiguously
+ */
+struct t_test2_array {
+	size_t size;
+
+	/* What we want to compute */
+	double *t_stat;
+	double *df;
+	double *pval;
+
+	/* What we need to compute rolling t-tests */
+	double *x_mean;
+	double *x_M2;
+	unsigned int *x_count;
+
+	double *y_mean;
+	double *y_M2;
+	unsigned int *y_count;
+};
+typedef struct t_test2_array t_test2_array;
+
+
 /**
  * @brief One-sample T-test aggregate
  * 
@@ -76,6 +102,45 @@ void t_test2_update(t_test2_aggregate *aggregate, double x_value, double y_value
 void t_test2_finalize(t_test2_aggregate *aggregate);
 
 
+/**
+ * @brief Create the two-sample T-test aggregates of `size` variables.
+ * 
+ * @param size Number of variables
+ * @return t_test2_array* 
+ */
+t_test2_array *t_test2_array_create(size_t size);
+
+
+/**
+ * @brief Free all resources allocated to the aggregates.
+ * 
+ * @param tests T-test aggregates to destroy
+ */
+void t_test2_array_destroy(t_test2_array *tests);
+
+
+/**
+ * @brief Add one value of every variable, same as `t_test2_update` on each.
+ * 
+ * @param tests    Aggregates to update by adding values
+ * @param x_values X value of every variable, NAN if none
+ * @param y_values Y value of every variable, NAN if none
+ */
+void t_test2_array_update(t_test2_array *tests, const double *x_values, const double *y_values);
+
+
+/**
+ * @brief Compute the two-sample T-tests of the variables from `start` up
+ * to `end` (excluded), same as `t_test2_finalize` on each. Disjoint ranges
+ * can be finalized from different threads.
+ * 
+ * @param tests Aggregates to compute from
+ * @param start First variable to compute
+ * @param end   Variable after the last one to compute
+ */
+void t_test2_array_finalize(t_test2_array *tests, size_t start, size_t end);
+
+
 /**
  * @brief Create the student's T-test aggregate.
  * 
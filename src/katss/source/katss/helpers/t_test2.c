@@ -22,6 +22,25 @@ struct t_test2_aggregate {
 };
 typedef struct t_test2_aggregate t_test2_aggregate;
 
+struct t_test2_array {
+	size_t size;
+
+	/* What we want to compute */
+	double *t_stat;
+	double *df;
+	double *pval;
+
+	/* What we need to compute rolling t-tests */
+	double *x_mean;
+	double *x_M2;
+	unsigned int *x_count;
+
+	double *y_mean;
+	double *y_M2;
+	unsigned int *y_count;
+};
+typedef struct t_test2_array t_test2_array;
+
 t_test2_aggregate *
 t_test2_create(void)
 {
@@ -150,3 +169,83 @@ t_test2_finalize(t_test2_aggregate *aggregate)
 	/* Compute the p-value */
 	aggregate->pval = 2 * t_test_cdf(-fabs(aggregate->t_stat), aggregate->df, true, false);
 }
+
+t_test2_array *
+t_test2_array_create(size_t size)
+{
+	t_test2_array *tests = malloc(sizeof *tests);
+	tests->size    = size;
+	tests->t_stat  = calloc(size, sizeof *tests->t_stat);
+	tests->df      = calloc(size, sizeof *tests->df);
+	tests->pval    = calloc(size, sizeof *tests->pval);
+	tests->x_mean  = calloc(size, sizeof *tests->x_mean);
+	tests->x_M2    = calloc(size, sizeof *tests->x_M2);
+	tests->x_count = calloc(size, sizeof *tests->x_count);
+	tests->y_mean  = calloc(size, sizeof *tests->y_mean);
+	tests->y_M2    = calloc(size, sizeof *tests->y_M2);
+	tests->y_count = calloc(size, sizeof *tests->y_count);
+
+	return tests;
+}
+
+void
+t_test2_array_destroy(t_test2_array *tests)
+{
+	if(tests == NULL)
+		return;
+	free(tests->t_stat);
+	free(tests->df);
+	free(tests->pval);
+	free(tests->x_mean);
+	free(tests->x_M2);
+	free(tests->x_count);
+	free(tests->y_mean);
+	free(tests->y_M2);
+	free(tests->y_count);
+	free(tests);
+}
+
+/**
+ * @brief Add the values of every variable to one sample of the aggregates.
+ */
+static void
+update_sample(double *mean, double *M2, unsigned int *count, const double *values, size_t size)
+{
+	for(size_t i=0; i<size; i++) {
+		if(isnan(values[i]))
+			continue;
+		count[i]++;
+
+		/* Update the running mean */
+		double delta = values[i] - mean[i];
+		mean[i] += delta / count[i];
+
+		/* Update the running variance */
+		double delta2 = values[i] - mean[i];
+		M2[i] += delta * delta2;
+	}
+}
+
+void
+t_test2_array_update(t_test2_array *tests, const double *x_values, const double *y_values)
+{
+	update_sample(tests->x_mean, tests->x_M2, tests->x_count, x_values, tests->size);
+	update_sample(tests->y_mean, tests->y_M2, tests->y_count, y_values, tests->size);
+}
+
+void
+t_test2_array_finalize(t_test2_array *tests, size_t start, size_t end)
+{
+	end = end < tests->size ? end : tests->size;
+	for(size_t i=start; i<end; i++) {
+		t_test2_aggregate test = {
+			.t_stat = tests->t_stat[i], .df = tests->df[i], .pval = tests->pval[i],
+			.x_mean = tests->x_mean[i], .x_M2 = tests->x_M2[i], .x_count = tests->x_count[i],
+			.y_mean = tests->y_mean[i], .y_M2 = tests->y_M2[i], .y_count = tests->y_count[i],
+		};
+		t_test2_finalize(&test);
+		tests->t_stat[i] = test.t_stat;
+		tests->df[i]     = test.df;
+		tests->pval[i]   = test.pval;
+	}
+}
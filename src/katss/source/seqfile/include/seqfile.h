@@ -26,6 +26,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -67,6 +68,24 @@ typedef struct SeqFile *SeqFile;
  * which type of file is used for reading. "a" for fasta, "q" for fastq, "s"
  * for sequence file, and "b" for binary.
  * 
+ * Files compressed with gzip (BGZF included), zlib, zstd, or lz4 are found by
+ * their magic bytes and decompressed as they are read. zstd and lz4 files fail
+ * to open with seqferrno 9 unless SeqFile was built with their libraries.
+ * 
+ * Adding "m" to the mode (e.g. "sm") maps uncompressed files into memory,
+ * which lets `seqfview` read them without copying. Compressed files, and files
+ * that can't be mapped, are read as usual.
+ * 
+ * Adding "t" to the mode (e.g. "qt") reads and inflates the file ahead of the
+ * reader on a thread of its own, see `seqfsetahead`. Files mapped into memory
+ * are not read ahead.
+ * 
+ * Adding "d" to the mode detects the type of the file from its first lines,
+ * see `seqftype`. Without a type (e.g. "d" or "dm"), the file is then read as
+ * the type detected, or as binary if it could not be told. The first lines
+ * are looked at in the bytes the file is read from first, so opening the file
+ * again to read it after its type is known is not needed.
+ * 
  * @param path Path to the file you want to open for reading
  * @param mode Type of file being opened
  * @return SeqFile 
@@ -85,6 +104,9 @@ SeqFile seqfopen(const char *path, const char *mode);
  * `seqfclose` is called, the the file descriptor will be closed alongside the
  * SeqFile handle.
  * 
+ * Pipes and other descriptors that can't be seeked are read once from start
+ * to end, and can't be rewound. Their type can still be detected with "d".
+ * 
  * @param fd    File descriptor of the file you want to read
  * @param mode  Type of file being opened
  * @return SeqFile 
@@ -92,6 +114,42 @@ SeqFile seqfopen(const char *path, const char *mode);
 SeqFile seqfdopen(int fd, const char *mode);
 
 
+/**
+ * @brief Open a buffer in memory for reading, as if it were the contents of a
+ * file opened with `seqfopen` with the same mode. Its compression is found the
+ * same way, and "m" reads uncompressed buffers in place, so `seqfview`
+ * returns spans of the buffer.
+ * 
+ * The buffer belongs to the caller: it is never written or freed, and must
+ * stay valid until `seqfclose` is called.
+ * 
+ * @param buffer  Bytes to read, may be NULL if `size` is 0
+ * @param size    Number of bytes in `buffer`
+ * @param mode    Type of file being opened
+ * @return SeqFile 
+ */
+SeqFile seqfmemopen(const void *buffer, size_t size, const char *mode);
+
+
+/**
+ * @brief Open several files as one SeqFile, as if they were concatenated, e.g.
+ * the lanes of a sequencing run. Every file is opened with `seqfopen` and the
+ * same mode, and the type of the list is the one they all have, or '\0' when
+ * they don't (they are then read as the type of the first file).
+ *
+ * The `_unlocked` functions read the files one after the other. Threads sharing
+ * the list with the locking functions are spread across the files instead, so
+ * several files are read and inflated at the same time, each thread still
+ * getting whole records. Closing or rewinding the list does so to every file.
+ *
+ * @param paths     Paths of the files to read
+ * @param num_paths Number of paths in `paths`, at least 1
+ * @param mode      Type of the files being opened
+ * @return SeqFile
+ */
+SeqFile seqfopenlist(const char *const *paths, int num_paths, const char *mode);
+
+
 /**
  * @brief Close an SeqFile handle.
  * 
@@ -103,7 +161,8 @@ int seqfclose(SeqFile file);
 
 
 /**
- * @brief Rewind a SeqFile to read from the beginning of the file.
+ * @brief Rewind a SeqFile to read from the beginning of the file. Fails for
+ * pipes (see `seqfdopen`), unless nothing was read from them yet.
  * 
  * @param file SeqFile to rewind
  * @return int return code: 0 if success, failure otherwise
@@ -121,6 +180,62 @@ int seqfrewind(SeqFile file);
 bool seqfeof(SeqFile file);
 
 
+/**
+ * @brief Type of the file, the one detected if it was opened with "d" (see
+ * `seqfopen`), otherwise the one it was opened with.
+ * 
+ * Fastq files are told by their first headers and '+' lines, fasta files by
+ * any header (or ';' comment) in their first 10 lines, and sequence files by
+ * their first 10 lines being mostly nucleotides.
+ * 
+ * @param file SeqFile to get the type of
+ * @return char 'a' for fasta, 'q' for fastq, 's' for sequence files, 'b' for
+ * binary, or '\0' if the type could not be detected
+ */
+char seqftype(SeqFile file);
+
+
+/**
+ * @brief Test if SeqFile was mapped into memory, see `seqfopen`.
+ * 
+ * @param file SeqFile pointer to test
+ * @return true if the file is read from memory, and `seqfview` can be used
+ * @return false if the file is read from its file descriptor
+ */
+bool seqfismapped(SeqFile file);
+
+
+/**
+ * @brief Test if SeqFile is read ahead on a thread of its own, see `seqfsetahead`.
+ * 
+ * @param file SeqFile pointer to test
+ * @return true if the file is read ahead
+ * @return false if the file is read when its bytes are needed
+ */
+bool seqfisahead(SeqFile file);
+
+
+/**
+ * @brief Read and inflate the file ahead of the reader on a thread of its own.
+ * 
+ * The thread fills a few buffers as large as the output buffer while the
+ * reader parses the ones filled before, so inflating the file overlaps with
+ * what is done with its bytes. This also applies to the `_unlocked` functions.
+ * BGZF files and indexed gzip files are then inflated by the thread only, not
+ * by every reader, so it is mostly worth it with a single reader. Files mapped
+ * into memory are not read ahead.
+ * 
+ * Not thread safe, call it before reading the file from several threads.
+ * 
+ * @param file  SeqFile handle to read ahead
+ * @param ahead If the file should be read ahead, or when it is needed
+ * @return int 0 on success, 1 when stopping with bytes read ahead that weren't
+ * read yet (the file is still read ahead), -1 when the thread couldn't be started
+ */
+int
+seqfsetahead(SeqFile file, bool ahead);
+
+
 /**
  * @brief Set the input buffer of the SeqFile handle
  * 
@@ -165,6 +280,69 @@ int
 seqfsetbuf(SeqFile file, size_t bufsize);
 
 
+/**
+ * @brief Keep the access points of the gzip file `path`, so it is inflated on several threads.
+ * 
+ * BGZF files are always inflated on the threads reading them with the locking
+ * seqf* functions, as they are made of blocks that inflate on their own. Plain
+ * gzip files are a single stream instead, which is only inflated from its
+ * start. Once a file is kept, the first time it is read through to its end
+ * finds places to inflate it from, about every megabyte, which the files
+ * opened on it after that are inflated from on several threads.
+ * 
+ * The access points take about 32 KiB per megabyte of inflated file. They are
+ * kept until `seqfunindex` is called as many times as `seqfindex` was.
+ * 
+ * @param path Path to the gzip file
+ * @return int 0 on success, 1 if the file isn't a plain gzip file or SeqFile
+ * was built with ISA-L, -1 on error
+ */
+int seqfindex(const char *path);
+
+
+/**
+ * @brief Stop keeping the access points of `path`, see `seqfindex`.
+ * 
+ * @param path Path the file was kept with
+ * @return int 0 on success, 1 if the file wasn't kept
+ */
+int seqfunindex(const char *path);
+
+
+/**
+ * @brief Bytes and records read by every SeqFile since the program started, see `seqfstats`
+ */
+struct SeqfStats {
+	uint64_t bytes_read;      /** Bytes read from files and buffers, compressed or not */
+	uint64_t bytes_inflated;  /** Bytes decompressed from compressed files */
+	uint64_t records;         /** Sequences, or fasta/fastq records, parsed */
+	uint64_t load_ns;         /** Nanoseconds spent reading and decompressing */
+	uint64_t lock_wait_ns;    /** Nanoseconds the locking seqf* functions waited on other threads */
+};
+
+
+/**
+ * @brief Start or stop counting what is read into the totals of `seqfstats`.
+ * 
+ * Counting is off until turned on, and is a no-op unless SeqFile was built with
+ * SEQF_WITH_STATS.
+ * 
+ * @param enable Count from now on if true, stop counting if false
+ */
+void seqfsetstats(bool enable);
+
+
+/**
+ * @brief Fill `stats` with the totals counted while `seqfsetstats` was on. The totals are never
+ * reset, take the difference of two calls to count what was read between them.
+ * 
+ * @param stats Totals to fill
+ * @return int 0 on success, -1 if SeqFile was built without SEQF_WITH_STATS, which leaves
+ * `stats` zeroed
+ */
+int seqfstats(struct SeqfStats *stats);
+
+
 /**
  * @brief Return an allocated string detailing the error encountered from SeqFile
  * 
@@ -216,6 +394,68 @@ size_t seqfread(SeqFile file, char *buffer, size_t bufsize);
 size_t seqfread_unlocked(SeqFile file, char *buffer, size_t bufsize);
 
 
+/**
+ * @brief Read only the sequences of whole records into a buffer, one per line.
+ * 
+ * Headers, and the '+' and quality lines of fastq files, are left out, and the lines of a fasta
+ * or fastq sequence are joined into one. Blank lines are skipped. What is read is then the
+ * same as a sequence file ("s") of the records, read as `seqfread` would, so that it can be
+ * hashed by the same readers. Sequence files are read as `seqfread` does.
+ * 
+ * @param file    SeqFile opened with "a", "q" or "s" to read from
+ * @param buffer  Buffer to write sequences to
+ * @param bufsize Size of the buffer being passed
+ * @return size_t Number of bytes read into buffer. 0 if end of file, or error encountered,
+ * e.g. a sequence longer than the buffer.
+ */
+size_t seqfreadseqs(SeqFile file, char *buffer, size_t bufsize);
+
+
+/**
+ * @brief Same as `seqfreadseqs`, without locking the SeqFile.
+ * 
+ * @note
+ * This function does not use a mutex to lock access to the SeqFile buffer. As such, it is not
+ * thread safe. Only use in single-threaded applications
+ */
+size_t seqfreadseqs_unlocked(SeqFile file, char *buffer, size_t bufsize);
+
+
+/**
+ * @brief View the next bytes of a file mapped into memory, without copying them.
+ * 
+ * Sets `span` to the next bytes of the file and returns how many it holds, at
+ * most `maxsize` of them. Sequence files ("s") end the span on the last full
+ * sequence, unless the sequence is longer than `maxsize`, which is then given
+ * whole. Other files are cut at `maxsize` bytes, fasta and fastq files being
+ * given as they are in the file. The span isn't null terminated, and stays
+ * valid until the file is closed.
+ * 
+ * @param file    SeqFile opened with "m", see `seqfismapped`
+ * @param span    Pointer set to the first byte of the span
+ * @param maxsize Most bytes wanted in the span
+ * @return size_t Number of bytes in the span. 0 if end of file, or the file is
+ * not mapped.
+ */
+size_t seqfview(SeqFile file, const char **span, size_t maxsize);
+
+
+/**
+ * @brief Same as `seqfview`, without locking the SeqFile.
+ * 
+ * @param file    SeqFile opened with "m", see `seqfismapped`
+ * @param span    Pointer set to the first byte of the span
+ * @param maxsize Most bytes wanted in the span
+ * @return size_t Number of bytes in the span. 0 if end of file, or the file is
+ * not mapped.
+ * 
+ * @note
+ * This function does not use a mutex to lock access to the SeqFile. As such, it is not thread
+ * safe. Only use in single-threaded applications
+ */
+size_t seqfview_unlocked(SeqFile file, const char **span, size_t maxsize);
+
+
 /** Undocumented read functions. See `seqfread()` for more information. */
 size_t seqfqread(SeqFile file, char *buffer, size_t bufsize);
 size_t seqfqread_unlocked(SeqFile file, char *buffer, size_t bufsize);
@@ -268,6 +508,38 @@ char *seqfqgets(SeqFile file, char *buffer, size_t bufsize);
 char *seqfqgets_unlocked(SeqFile file, char *buffer, size_t bufsize);
 
 
+/**
+ * @brief Read a batch of whole records' sequences into `buffer`, locking the SeqFile once.
+ * 
+ * Each record is read as `seqfgets()` would with a buffer of `recsize` bytes, and stored right
+ * after the previous one with its own `'\0'`. Reading stops after `maxrecords` records, or once
+ * fewer than `recsize` bytes are left in `buffer`, so no record is cut by the end of the batch.
+ * `ends[i]` is set to the offset of the `'\0'` of record `i`, which starts right after the one
+ * of record `i - 1` (or at 0), so the length of every record is known without `strlen`.
+ * 
+ * @param file       SeqFile to read from
+ * @param buffer     Buffer to fill, of at least `recsize` bytes
+ * @param bufsize    Size of the buffer being passed
+ * @param recsize    Most bytes a record takes, including its `'\0'`
+ * @param ends       Offsets of the end of every record read, of at least `maxrecords` elements
+ * @param maxrecords Most records to read
+ * @return size_t Number of records read into buffer. 0 if end of file, or error encountered.
+ */
+size_t seqfreadbatch(SeqFile file, char *buffer, size_t bufsize, size_t recsize, size_t *ends,
+                     size_t maxrecords);
+
+
+/**
+ * @brief Same as `seqfreadbatch`, without locking the SeqFile.
+ * 
+ * @note
+ * This function does not use a mutex to lock access to the SeqFile internal buffer. As such, it is
+ * not thread-safe. Only use in single-threaded applications.
+ */
+size_t seqfreadbatch_unlocked(SeqFile file, char *buffer, size_t bufsize, size_t recsize,
+                              size_t *ends, size_t maxrecords);
+
+
 /**
  * @brief Read only one nucleotide from the SeqFile stream. 
  * 
@@ -34,6 +34,7 @@ seqf_aread(seqf_statep state, unsigned char *buffer, size_t bufsize)
 	}
 
 	buffer[buffer_end] = 0;
+	SEQF_STAT_RECORDS(buffer, buffer_end, 'a');
 	return buffer_end;
 }
 
@@ -41,10 +42,13 @@ size_t
 seqfaread(SeqFile file, char *buffer, size_t bufsize)
 {
 	seqf_statep state = (seqf_statep)file;
+	if(state->list != NULL)
+		return seqf_listread(state, seqf_aread, (unsigned char *)buffer, bufsize);
 
 	mtx_lock(&state->mutex);
 	size_t bytes_read = seqf_aread(state, (unsigned char *)buffer, bufsize);
 	mtx_unlock(&state->mutex);
+	seqf_prefetch(state);
 
 	return bytes_read;
 }
@@ -52,16 +56,16 @@ seqfaread(SeqFile file, char *buffer, size_t bufsize)
 size_t
 seqfaread_unlocked(SeqFile file, char *buffer, size_t bufsize)
 {
-	return seqf_aread((seqf_statep)file, (unsigned char *)buffer, bufsize);
+	seqf_statep state = (seqf_statep)file;
+	if(state->list != NULL)
+		return seqf_listread_unlocked(state, seqf_aread, (unsigned char *)buffer, bufsize);
+	return seqf_aread(state, (unsigned char *)buffer, bufsize);
 }
 
 char *
-seqfagets_unlocked(SeqFile file, char *buffer, size_t bufsize)
+seqf_agets(seqf_statep state, unsigned char *buffer, size_t bufsize)
 {
-	/* Sanity checks & early return in case we're at eof */
-	if(file == NULL)
-		return NULL;
-	seqf_statep state = (seqf_statep)file;
+	/* Early return in case we're at eof */
 	if(state->eof)
 		return NULL;
 
@@ -70,7 +74,7 @@ seqfagets_unlocked(SeqFile file, char *buffer, size_t bufsize)
 		return NULL;
 	
 	/* Variables to be used in obtaining the sequence */
-	unsigned char *buf = (unsigned char *)buffer;
+	unsigned char *buf = buffer;
 	unsigned char *eol;
 	size_t left = bufsize - 1; // -1 to make space for null terminator
 
@@ -91,7 +95,19 @@ seqfagets_unlocked(SeqFile file, char *buffer, size_t bufsize)
 	} while(left);
 	buf[0] = '\0';
 
-	return buffer;
+	SEQF_STAT_ADD(records, 1);
+	return (char *)buf;
+}
+
+char *
+seqfagets_unlocked(SeqFile file, char *buffer, size_t bufsize)
+{
+	/* Sanity checks */
+	if(file == NULL)
+		return NULL;
+	if(((seqf_statep)file)->list != NULL)
+		return seqf_listgets((seqf_statep)file, seqfagets_unlocked, buffer, bufsize);
+	return seqf_agets((seqf_statep)file, (unsigned char *)buffer, bufsize) ? buffer : NULL;
 }
 
 char *
@@ -110,6 +126,8 @@ int
 seqfagetnt_unlocked(SeqFile file)
 {
 	seqf_statep state = (seqf_statep)file;
+	if(state != NULL && state->list != NULL)
+		return seqf_listgetc(state, seqfagetnt_unlocked);
 	if(state == NULL || state->eof)
 		return EOF;
 	if(state->have == 0 && seqf_fetch(state) != 0)
@@ -45,6 +45,7 @@ seqf_qread(seqf_statep state, unsigned char *buffer, size_t bufsize)
 		memset(state->out_buf, 0, state->out_bufsiz);
 	}
 	buffer[buffer_end] = 0;
+	SEQF_STAT_RECORDS(buffer, buffer_end, 'q');
 	return buffer_end;
 }
 
@@ -52,10 +53,13 @@ size_t
 seqfqread(SeqFile file, char *buffer, size_t bufsize)
 {
 	seqf_statep state = (seqf_statep)file;
+	if(state->list != NULL)
+		return seqf_listread(state, seqf_qread, (unsigned char *)buffer, bufsize);
 
 	mtx_lock(&state->mutex);
 	size_t bytes_read = seqf_qread(state, (unsigned char *)buffer, bufsize);
 	mtx_unlock(&state->mutex);
+	seqf_prefetch(state);
 
 	return bytes_read;
 }
@@ -63,15 +67,15 @@ seqfqread(SeqFile file, char *buffer, size_t bufsize)
 size_t
 seqfqread_unlocked(SeqFile file, char *buffer, size_t bufsize)
 {
-	return seqf_qread((seqf_statep)file, (unsigned char *)buffer, bufsize);
+	seqf_statep state = (seqf_statep)file;
+	if(state->list != NULL)
+		return seqf_listread_unlocked(state, seqf_qread, (unsigned char *)buffer, bufsize);
+	return seqf_qread(state, (unsigned char *)buffer, bufsize);
 }
 
 char *
-seqfqgets_unlocked(SeqFile file, char *buffer, size_t bufsize)
+seqf_qgets(seqf_statep state, unsigned char *buffer, size_t bufsize)
 {
-	if(file == NULL)
-		return NULL;
-	seqf_statep state = (seqf_statep)file;
 	if(state->eof)
 		return NULL;
 	
@@ -80,7 +84,7 @@ seqfqgets_unlocked(SeqFile file, char *buffer, size_t bufsize)
 		return NULL;
 
 	/* Declare variables */
-	unsigned char *buf = (unsigned char *)buffer;
+	unsigned char *buf = buffer;
 	unsigned char *eol;
 	size_t left = bufsize - 1;
 
@@ -99,9 +103,20 @@ seqfqgets_unlocked(SeqFile file, char *buffer, size_t bufsize)
 	seqf_skipline(state); /* Skip '+' line */
 	seqf_skipline(state); /* Skip quality scores */
 
-	/* Null terminate and return buffer */
+	/* Null terminate and return the end of the sequence */
 	buf[0] = '\0';
-	return buffer;
+	SEQF_STAT_ADD(records, 1);
+	return (char *)buf;
+}
+
+char *
+seqfqgets_unlocked(SeqFile file, char *buffer, size_t bufsize)
+{
+	if(file == NULL)
+		return NULL;
+	if(((seqf_statep)file)->list != NULL)
+		return seqf_listgets((seqf_statep)file, seqfqgets_unlocked, buffer, bufsize);
+	return seqf_qgets((seqf_statep)file, (unsigned char *)buffer, bufsize) ? buffer : NULL;
 }
 
 char *
@@ -120,6 +135,8 @@ int
 seqfqgetnt_unlocked(SeqFile file)
 {
 	seqf_statep state = (seqf_statep)file;
+	if(state != NULL && state->list != NULL)
+		return seqf_listgetc(state, seqfqgetnt_unlocked);
 	if(state == NULL || state->eof)
 		return EOF;
 	if(state->have == 0 && seqf_fetch(state) != 0)
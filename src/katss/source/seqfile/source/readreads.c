@@ -31,6 +31,7 @@ seqf_sread(seqf_statep state, unsigned char *buffer, size_t bufsize)
 	}
 
 	buffer[buffer_end] = '\0';
+	SEQF_STAT_RECORDS(buffer, buffer_end, 's');
 	return buffer_end;
 }
 
@@ -38,10 +39,13 @@ size_t
 seqfsread(SeqFile file, char *buffer, size_t bufsize)
 {
 	seqf_statep state = (seqf_statep)file;
+	if(state->list != NULL)
+		return seqf_listread(state, seqf_sread, (unsigned char *)buffer, bufsize);
 
 	mtx_lock(&state->mutex);
 	size_t bytes_read = seqf_sread(state, (unsigned char *)buffer, bufsize);
 	mtx_unlock(&state->mutex);
+	seqf_prefetch(state);
 
 	return bytes_read;
 }
@@ -49,20 +53,20 @@ seqfsread(SeqFile file, char *buffer, size_t bufsize)
 size_t
 seqfsread_unlocked(SeqFile file, char *buffer, size_t bufsize)
 {
-	return seqf_sread((seqf_statep)file, (unsigned char *)buffer, bufsize);
+	seqf_statep state = (seqf_statep)file;
+	if(state->list != NULL)
+		return seqf_listread_unlocked(state, seqf_sread, (unsigned char *)buffer, bufsize);
+	return seqf_sread(state, (unsigned char *)buffer, bufsize);
 }
 
 char *
-seqfsgets_unlocked(SeqFile file, char *buffer, size_t bufsize)
+seqf_sgets(seqf_statep state, unsigned char *buffer, size_t bufsize)
 {
-	if(file == NULL)
-		return NULL;
-	seqf_statep state = (seqf_statep)file;
 	if(state->eof)
 		return NULL;
 
 	/* Declare variables */
-	unsigned char *buf = (unsigned char *)buffer;
+	unsigned char *buf = buffer;
 	unsigned char *eol;
 	size_t left = bufsize - 1;
 
@@ -77,13 +81,24 @@ seqfsgets_unlocked(SeqFile file, char *buffer, size_t bufsize)
 	} while(left && eol == NULL);
 
 	/* seqfsgets read 0 bytes (at EOF) */
-	if((unsigned char *)buffer == buf)
+	if(buffer == buf)
 		return NULL;
 	
 	/* Null terminate the string */
 	*buf = '\0';
 
-	return buffer;
+	SEQF_STAT_ADD(records, 1);
+	return (char *)buf;
+}
+
+char *
+seqfsgets_unlocked(SeqFile file, char *buffer, size_t bufsize)
+{
+	if(file == NULL)
+		return NULL;
+	if(((seqf_statep)file)->list != NULL)
+		return seqf_listgets((seqf_statep)file, seqfsgets_unlocked, buffer, bufsize);
+	return seqf_sgets((seqf_statep)file, (unsigned char *)buffer, bufsize) ? buffer : NULL;
 }
 
 char *
@@ -102,6 +117,8 @@ int
 seqfsgetnt_unlocked(SeqFile file)
 {
 	seqf_statep state = (seqf_statep)file;
+	if(state != NULL && state->list != NULL)
+		return seqf_listgetc(state, seqfsgetnt_unlocked);
 	if(state == NULL || state->eof)
 		return EOF;
 	if(state->have == 0 && seqf_fetch(state) != 0)
@@ -0,0 +1,183 @@
+/* seqf_ahead.c - Reading and inflating a file ahead of its reader on a thread of its own
+ *
+ * Copyright (c) 2024-2025 Francisco F. Cavazos
+ * Subject to the MIT License
+ */
+
+#include <stdlib.h>
+
+#include "seqf_read.h"
+
+static int read_ahead(void *arg);
+
+/*
+Notes:
+The thread loads the file into a ring of SEQF_AHEAD buffers with `seqf_loadnow`, the way the
+reader would have, while the reader parses the buffers loaded before. Reading and inflating the
+file then overlaps with whatever the reader does with the bytes. Each buffer keeps what loading it
+returned, so errors are given to the reader in the order they were found, with their seqferrno.
+
+The thread owns the file while it runs: its stream, blocks and access points are only touched by
+it, and blocks are not inflated ahead by the readers (`seqf_prefetch`). The reader only takes the
+buffers, so it never waits on the thread unless every buffer was read.
+*/
+
+
+/*===================================
+|  Internal functions               |
+===================================*/
+extern int
+seqf_startahead(seqf_statep state)
+{
+	struct seqf_ahead *ahead = state->ahead;
+	if(ahead == NULL) {
+		if((ahead = calloc(1, sizeof *ahead)) == NULL)
+			return -1;
+		if(mtx_init(&ahead->mutex, mtx_plain) != thrd_success)
+			goto free_ahead;
+		if(cnd_init(&ahead->filled) != thrd_success)
+			goto destroy_mutex;
+		if(cnd_init(&ahead->drained) != thrd_success)
+			goto destroy_filled;
+
+		ahead->bufsize = state->out_bufsiz;
+		for(int i=0; i<SEQF_AHEAD; i++) {
+			if((ahead->bufs[i].buf = malloc(ahead->bufsize)) == NULL)
+				goto free_bufs;
+		}
+		state->ahead = ahead;
+	}
+	if(ahead->running)
+		return 0;
+
+	ahead->stop = false;
+	if(thrd_create(&ahead->thread, read_ahead, state) != thrd_success)
+		return -1;
+	ahead->running = true;
+	return 0;
+
+free_bufs:
+	for(int i=0; i<SEQF_AHEAD; i++)
+		free(ahead->bufs[i].buf);
+	cnd_destroy(&ahead->drained);
+destroy_filled:
+	cnd_destroy(&ahead->filled);
+destroy_mutex:
+	mtx_destroy(&ahead->mutex);
+free_ahead:
+	free(ahead);
+	return -1;
+}
+
+extern void
+seqf_pauseahead(seqf_statep state)
+{
+	struct seqf_ahead *ahead = state->ahead;
+	if(ahead == NULL || !ahead->running)
+		return;
+
+	mtx_lock(&ahead->mutex);
+	ahead->stop = true;
+	cnd_broadcast(&ahead->drained);
+	mtx_unlock(&ahead->mutex);
+	thrd_join(ahead->thread, NULL);
+	ahead->running = false;
+}
+
+extern void
+seqf_stopahead(seqf_statep state)
+{
+	struct seqf_ahead *ahead = state->ahead;
+	if(ahead == NULL)
+		return;
+
+	seqf_pauseahead(state);
+	for(int i=0; i<SEQF_AHEAD; i++)
+		free(ahead->bufs[i].buf);
+	cnd_destroy(&ahead->drained);
+	cnd_destroy(&ahead->filled);
+	mtx_destroy(&ahead->mutex);
+	free(ahead);
+	state->ahead = NULL;
+}
+
+extern int
+seqf_loadahead(seqf_statep state, unsigned char *buffer, size_t bufsize, size_t *nread)
+{
+	struct seqf_ahead *ahead = state->ahead;
+	size_t left = bufsize;
+	*nread = 0;
+	while(left) {
+		/* Wait for the thread to load the next buffer, unless it loaded the last one */
+		mtx_lock(&ahead->mutex);
+		while(ahead->head == ahead->tail && !ahead->done)
+			cnd_wait(&ahead->filled, &ahead->mutex);
+		bool empty = ahead->head == ahead->tail;
+		mtx_unlock(&ahead->mutex);
+		if(empty)
+			break;
+
+		/* The last buffer is kept, so reading past the end or an error keeps returning it */
+		struct seqf_ahead_buf *slot = &ahead->bufs[ahead->head % SEQF_AHEAD];
+		if(slot->ret != 0) {
+			seqferrno_ = slot->err;
+			return slot->ret;
+		}
+		if(slot->len == 0)
+			break;
+
+		size_t n = MIN2(left, slot->len - slot->pos);
+		memcpy(buffer, slot->buf + slot->pos, n);
+		buffer += n;
+		left -= n;
+		slot->pos += n;
+		if(slot->pos == slot->len) {
+			mtx_lock(&ahead->mutex);
+			ahead->head++;
+			cnd_signal(&ahead->drained);
+			mtx_unlock(&ahead->mutex);
+		}
+	}
+
+	*nread = bufsize - left;
+	return 0;
+}
+
+
+/*===================================
+|  Helper functions                 |
+===================================*/
+
+/**
+ * @brief Thread loading the buffers of the state until the end of the file, an error, or it is
+ * asked to stop.
+ */
+static int
+read_ahead(void *arg)
+{
+	seqf_statep state = arg;
+	struct seqf_ahead *ahead = state->ahead;
+
+	mtx_lock(&ahead->mutex);
+	while(!ahead->done) {
+		while(ahead->tail - ahead->head == SEQF_AHEAD && !ahead->stop)
+			cnd_wait(&ahead->drained, &ahead->mutex);
+		if(ahead->stop)
+			break;
+		struct seqf_ahead_buf *slot = &ahead->bufs[ahead->tail % SEQF_AHEAD];
+		mtx_unlock(&ahead->mutex);
+
+		/* The reader never touches the buffers the thread has yet to load */
+		seqferrno_ = 0;
+		slot->pos = 0;
+		slot->ret = seqf_loadnow(state, slot->buf, ahead->bufsize, &slot->len);
+		slot->err = seqferrno_;
+
+		mtx_lock(&ahead->mutex);
+		ahead->tail++;
+		ahead->done = slot->ret != 0 || slot->len == 0;
+		cnd_signal(&ahead->filled);
+	}
+	mtx_unlock(&ahead->mutex);
+	return 0;
+}
@@ -0,0 +1,519 @@
+/* seqf_blocks.c - Inflating the blocks of a compressed file on several threads
+ *
+ * Copyright (c) 2024-2025 Francisco F. Cavazos
+ * Subject to the MIT License
+ */
+
+#include <stdlib.h>
+
+#include "seqf_read.h"
+
+#ifdef _WIN32
+    #include <windows.h>
+    #include <io.h>
+	#include <basetsd.h>
+    #define read _read
+    #define lseek _lseeki64
+	typedef SSIZE_T ssize_t;
+#else
+    #include <unistd.h>
+#endif
+
+#define BGZF_BLOCK 65536U  /* Most bytes a BGZF block holds, compressed or not */
+
+enum {
+	BLOCK_FREE,      /* Block can be taken to be inflated */
+	BLOCK_TAKEN,     /* Block is being inflated by a thread */
+	BLOCK_READY,     /* Block is inflated and can be read */
+	BLOCK_FAILED     /* Block could not be read or inflated */
+};
+
+static int take_block(seqf_statep state, struct seqf_block *block);
+static int take_bgzf(seqf_statep state, struct seqf_block *block);
+static int take_span(seqf_statep state, struct seqf_block *block);
+static int inflate_block(const seqf_statep state, struct seqf_block *block);
+#if defined ZSTD_VERSION_NUMBER
+static int take_zstd(seqf_statep state, struct seqf_block *block);
+static int take_bytes(int fd, struct seqf_block *block, size_t len);
+static int decompress_frame(struct seqf_block *block);
+#endif
+static int fit_buffer(unsigned char **buffer, size_t *size, size_t len);
+static int read_fully(int fd, unsigned char *buffer, size_t len, size_t *nread);
+static inline uint32_t load_le32(const unsigned char *bytes);
+
+/*
+Notes:
+Blocks are inflated in the order they are found in the file, into a ring of SEQF_BLOCKS blocks
+read in the same order. Reading the compressed bytes of a block takes the lock of the file, since
+they follow each other in it, but inflating them does not. Threads reading a file with the locking
+seqf* functions inflate a block ahead of the reader each time, see `seqf_prefetch`, so the blocks
+are inflated on all of them while they are read in order.
+
+BGZF files are gzip files made of blocks of at most 64 KiB, each of them a gzip member of its own
+with its size in the header. Plain gzip files are one deflate stream, which can only be inflated
+from the start unless its access points were kept with `seqfindex`. Then every span between two
+points is a block, inflated from the window of history at its point.
+
+Zstd files are made of frames that decompress on their own, like BGZF blocks, but their compressed
+size is not in their header. A frame is taken by reading the headers of its blocks, which give
+their sizes, and files are only read this way if their first frame is at most SEQF_FRAME bytes.
+Files written as a single large frame, or with streaming (no size), are decompressed in order.
+*/
+
+
+/*===================================
+|  Internal functions               |
+===================================*/
+extern int
+seqf_initblocks(seqf_statep state)
+{
+	if(state->blocks != NULL)
+		return 0;
+	if(!state->block_sync_is_init) {
+		if(mtx_init(&state->block_mutex, mtx_plain) != thrd_success)
+			return -1;
+		if(cnd_init(&state->block_ready) != thrd_success) {
+			mtx_destroy(&state->block_mutex);
+			return -1;
+		}
+		state->block_sync_is_init = true;
+	}
+
+	state->blocks = calloc(SEQF_BLOCKS, sizeof *state->blocks);
+	if(state->blocks == NULL)
+		return -1;
+	for(int i=0; i<SEQF_BLOCKS; i++)
+		state->blocks[i].status = BLOCK_FREE;
+	state->block_head = 0;
+	state->block_tail = 0;
+	state->blocks_done = false;
+	return 0;
+}
+
+extern void
+seqf_freeblocks(seqf_statep state)
+{
+	if(state->block_sync_is_init) {
+		mtx_destroy(&state->block_mutex);
+		cnd_destroy(&state->block_ready);
+	}
+	state->block_sync_is_init = false;
+	if(state->blocks == NULL)
+		return;
+
+	for(int i=0; i<SEQF_BLOCKS; i++) {
+		struct seqf_block *block = &state->blocks[i];
+		free(block->in);
+		free(block->out);
+#if defined _IGZIP_H
+		free(block->stream);
+#else
+		if(block->stream_is_init)
+			inflateEnd(&block->stream);
+#endif
+#if defined ZSTD_VERSION_NUMBER
+		ZSTD_freeDCtx(block->zstd);
+#endif
+	}
+	free(state->blocks);
+	state->blocks = NULL;
+}
+
+extern void
+seqf_resetblocks(seqf_statep state)
+{
+	if(state->blocks == NULL)
+		return;
+	for(int i=0; i<SEQF_BLOCKS; i++)
+		state->blocks[i].status = BLOCK_FREE;
+	state->block_head = 0;
+	state->block_tail = 0;
+	state->blocks_done = false;
+}
+
+extern int
+seqf_loadblocks(seqf_statep state, unsigned char *buffer, size_t bufsize, size_t *nread)
+{
+	size_t left = bufsize;
+	*nread = 0;
+	while(left) {
+		struct seqf_block *block = &state->blocks[state->block_head % SEQF_BLOCKS];
+
+		/* Nothing was inflated ahead, so inflate the next block here */
+		if(state->block_head == state->block_tail) {
+			if(state->blocks_done)
+				break;
+			int ret = take_block(state, block);
+			if(ret > 0)
+				break;
+			state->block_tail++;
+			block->status = ret == 0 && inflate_block(state, block) == 0 ? BLOCK_READY
+			                                                              : BLOCK_FAILED;
+		}
+
+		/* Wait for the thread inflating it, still holding the state so reads stay in order */
+		mtx_lock(&state->block_mutex);
+		while(block->status == BLOCK_TAKEN)
+			cnd_wait(&state->block_ready, &state->block_mutex);
+		int status = block->status;
+		mtx_unlock(&state->block_mutex);
+		if(status == BLOCK_FAILED) {
+			seqferrno_ = 8;
+			return 3;
+		}
+
+		size_t n = MIN2(left, block->out_len - block->out_pos);
+		memcpy(buffer, block->out + block->out_pos, n);
+		buffer += n;
+		left -= n;
+		block->out_pos += n;
+		if(block->out_pos == block->out_len) {
+			block->status = BLOCK_FREE;
+			state->block_head++;
+		}
+	}
+
+	*nread = bufsize - left;
+	return 0;
+}
+
+extern void
+seqf_prefetch(seqf_statep state)
+{
+	/* Files read ahead have their blocks inflated by the thread reading them */
+	if(state->blocks == NULL || state->ahead != NULL)
+		return;
+
+	mtx_lock(&state->mutex);
+	if(state->blocks_done || state->block_tail - state->block_head >= SEQF_BLOCKS) {
+		mtx_unlock(&state->mutex);
+		return;
+	}
+	struct seqf_block *block = &state->blocks[state->block_tail % SEQF_BLOCKS];
+	int ret = take_block(state, block);
+	if(ret > 0) {
+		mtx_unlock(&state->mutex);
+		return;
+	}
+	state->block_tail++;
+	mtx_lock(&state->block_mutex);
+	block->status = ret == 0 ? BLOCK_TAKEN : BLOCK_FAILED;
+	mtx_unlock(&state->block_mutex);
+	mtx_unlock(&state->mutex);
+	if(ret != 0)
+		return;
+
+	/* Inflate without the state, other threads keep reading the blocks before this one */
+	ret = inflate_block(state, block);
+	mtx_lock(&state->block_mutex);
+	block->status = ret == 0 ? BLOCK_READY : BLOCK_FAILED;
+	cnd_broadcast(&state->block_ready);
+	mtx_unlock(&state->block_mutex);
+}
+
+
+/*===================================
+|  Helper functions                 |
+===================================*/
+
+/**
+ * @brief Read the compressed bytes of the next block of the file into `block`. Returns 0 on
+ * success, 1 once every block was taken, and -1 on error.
+ */
+static int
+take_block(seqf_statep state, struct seqf_block *block)
+{
+#if defined ZSTD_VERSION_NUMBER
+	int ret = state->compression == BGZF ? take_bgzf(state, block) :
+	          state->compression == ZSTD ? take_zstd(state, block) : take_span(state, block);
+#else
+	int ret = state->compression == BGZF ? take_bgzf(state, block) : take_span(state, block);
+#endif
+	if(ret > 0)
+		state->blocks_done = true;
+	block->out_pos = 0;
+	return ret;
+}
+
+static int
+take_bgzf(seqf_statep state, struct seqf_block *block)
+{
+	if(fit_buffer(&block->in, &block->in_size, BGZF_BLOCK) != 0 ||
+	   fit_buffer(&block->out, &block->out_size, BGZF_BLOCK) != 0)
+		return -1;
+
+	/* Fixed part of the gzip header, then its extra field with the size of the block */
+	unsigned char header[12];
+	size_t n;
+	if(read_fully(state->fd, header, sizeof header, &n) != 0)
+		return -1;
+	if(n == 0)
+		return 1;
+	if(n < sizeof header || header[0] != 0x1F || header[1] != 0x8B || !(header[3] & 4))
+		return -1;
+
+	size_t xlen = (size_t)header[10] | (size_t)header[11] << 8;
+	if(read_fully(state->fd, block->in, xlen, &n) != 0 || n < xlen)
+		return -1;
+	size_t bsize = 0;
+	for(size_t i=0; i + 4 <= xlen; ) {
+		size_t slen = (size_t)block->in[i+2] | (size_t)block->in[i+3] << 8;
+		if(block->in[i] == 'B' && block->in[i+1] == 'C' && slen == 2 && i + 6 <= xlen)
+			bsize = ((size_t)block->in[i+4] | (size_t)block->in[i+5] << 8) + 1;
+		i += 4 + slen;
+	}
+	if(bsize < sizeof header + xlen + 8)
+		return -1;
+
+	/* Deflated bytes, then the CRC32 and size of the inflated bytes */
+	block->in_len = bsize - sizeof header - xlen;
+	if(read_fully(state->fd, block->in, block->in_len, &n) != 0 || n < block->in_len)
+		return -1;
+	block->out_len = load_le32(block->in + block->in_len - 4);
+	if(block->out_len > BGZF_BLOCK)
+		return -1;
+	return 0;
+}
+
+static int
+take_span(seqf_statep state, struct seqf_block *block)
+{
+	const struct seqf_index *index = state->index;
+	uint64_t span = state->block_tail;
+	if(span >= index->num_points)
+		return 1;
+
+	/* The span ends on the byte the next point is in, or the end of the stream */
+	const struct seqf_point *point = &index->points[span];
+	uint64_t start = point->in - (point->bits ? 1 : 0);
+	uint64_t end = span + 1 < index->num_points ? index->points[span + 1].in : index->in_end;
+	uint64_t out_end = span + 1 < index->num_points ? index->points[span + 1].out
+	                                                : index->out_end;
+	if(end < start || fit_buffer(&block->in, &block->in_size, (size_t)(end - start)) != 0 ||
+	   fit_buffer(&block->out, &block->out_size, (size_t)(out_end - point->out)) != 0)
+		return -1;
+
+	size_t n;
+	block->span = span;
+	block->in_len = (size_t)(end - start);
+	block->out_len = (size_t)(out_end - point->out);
+	if(lseek(state->fd, start, SEEK_SET) == -1) {
+		seqferrno_ = 1;
+		return -1;
+	}
+	if(read_fully(state->fd, block->in, block->in_len, &n) != 0 || n < block->in_len)
+		return -1;
+	return 0;
+}
+
+/**
+ * @brief Inflate the compressed bytes of `block`, taken with `take_block`. Returns 0 on success.
+ */
+static int
+inflate_block(const seqf_statep state, struct seqf_block *block)
+{
+#if defined ZSTD_VERSION_NUMBER
+	if(state->compression == ZSTD)
+		return decompress_frame(block);
+#endif
+#if defined _IGZIP_H
+	/* Only BGZF blocks are inflated with ISA-L, they are whole deflate streams */
+	if(state->compression != BGZF)
+		return -1;
+	if(block->stream == NULL && (block->stream = malloc(sizeof *block->stream)) == NULL)
+		return -1;
+	isal_inflate_init(block->stream);
+	block->stream->crc_flag = ISAL_DEFLATE;
+	block->stream->next_in = block->in;
+	block->stream->avail_in = (uint32_t)(block->in_len - 8);
+	block->stream->next_out = block->out;
+	block->stream->avail_out = (uint32_t)block->out_len;
+	if(isal_inflate_stateless(block->stream) != ISAL_DECOMP_OK)
+		return -1;
+	return block->stream->avail_out == 0 ? 0 : -1;
+#else
+	z_stream *stream = &block->stream;
+	int ret = block->stream_is_init ? inflateReset(stream) : inflateInit2(stream, -MAX_WBITS);
+	if(ret != Z_OK)
+		return -1;
+	block->stream_is_init = true;
+
+	unsigned char *in = block->in;
+	size_t in_len = block->in_len;
+	if(state->compression == BGZF) {
+		in_len -= 8; /* CRC32 and size of the inflated bytes */
+	} else {
+		/* Continue the stream from the access point, mid-byte and with its history */
+		const struct seqf_point *point = &state->index->points[block->span];
+		if(point->bits) {
+			if(inflatePrime(stream, point->bits, in[0] >> (8 - point->bits)) != Z_OK)
+				return -1;
+			in++;
+			in_len--;
+		}
+		if(point->window_len &&
+		   inflateSetDictionary(stream, point->window, point->window_len) != Z_OK)
+			return -1;
+	}
+
+	stream->next_in = in;
+	stream->avail_in = (uInt)in_len;
+	stream->next_out = block->out;
+	stream->avail_out = (uInt)block->out_len;
+	ret = inflate(stream, state->compression == BGZF ? Z_FINISH : Z_NO_FLUSH);
+	if(ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)
+		return -1;
+	if(stream->avail_out != 0)
+		return -1;
+	if(state->compression == BGZF &&
+	   crc32(0L, block->out, (uInt)block->out_len) != load_le32(block->in + in_len))
+		return -1;
+	return 0;
+#endif
+}
+
+#if defined ZSTD_VERSION_NUMBER
+static int
+take_zstd(seqf_statep state, struct seqf_block *block)
+{
+	/* Skippable frames only hold metadata, skip them to the next frame */
+	int ret;
+	uint32_t magic;
+	do {
+		block->in_len = 0;
+		if((ret = take_bytes(state->fd, block, 4)) != 0)
+			return ret;
+		magic = load_le32(block->in);
+		if((magic & 0xFFFFFFF0U) == 0x184D2A50U) {
+			if(take_bytes(state->fd, block, 4) != 0)
+				return -1;
+			if(lseek(state->fd, load_le32(block->in + 4), SEEK_CUR) == -1) {
+				seqferrno_ = 1;
+				return -1;
+			}
+		}
+	} while((magic & 0xFFFFFFF0U) == 0x184D2A50U);
+	if(magic != 0xFD2FB528U || take_bytes(state->fd, block, 1) != 0)
+		return -1;
+
+	/* Rest of the frame header, its size is given by the frame header descriptor */
+	static const size_t dict_sizes[4] = { 0, 1, 2, 4 };
+	const unsigned char descriptor = block->in[4];
+	const bool single = descriptor >> 5 & 1, checksum = descriptor >> 2 & 1;
+	const size_t size_sizes[4] = { single ? 1 : 0, 2, 4, 8 };
+	if(take_bytes(state->fd, block, !single + dict_sizes[descriptor & 3] +
+	              size_sizes[descriptor >> 6]) != 0)
+		return -1;
+
+	/* Blocks, each a 3 byte header with the size of the block, then the checksum if any */
+	bool last;
+	do {
+		if(take_bytes(state->fd, block, 3) != 0)
+			return -1;
+		const unsigned char *bh = block->in + block->in_len - 3;
+		const uint32_t header = (uint32_t)bh[0] | (uint32_t)bh[1] << 8 | (uint32_t)bh[2] << 16;
+		const unsigned int type = header >> 1 & 3;
+		last = header & 1;
+		if(type == 3 || take_bytes(state->fd, block, type == 1 ? 1 : header >> 3) != 0)
+			return -1; /* Reserved block type, or the frame was cut short */
+	} while(!last);
+	if(checksum && take_bytes(state->fd, block, 4) != 0)
+		return -1;
+	return 0;
+}
+
+/**
+ * @brief Read `len` more bytes of the file into the compressed bytes of `block`. Returns 0 on
+ * success, 1 if the file had no bytes left, and -1 on error or if it ended before `len` bytes.
+ */
+static int
+take_bytes(int fd, struct seqf_block *block, size_t len)
+{
+	size_t n, need = block->in_len + len;
+	if(need > block->in_size && fit_buffer(&block->in, &block->in_size, 2 * need) != 0)
+		return -1;
+	if(read_fully(fd, block->in + block->in_len, len, &n) != 0)
+		return -1;
+	block->in_len += n;
+	if(n == 0 && len != 0)
+		return 1;
+	return n == len ? 0 : -1;
+}
+
+/**
+ * @brief Decompress the zstd frame of `block`, taken with `take_zstd`. Returns 0 on success.
+ */
+static int
+decompress_frame(struct seqf_block *block)
+{
+	if(block->zstd == NULL && (block->zstd = ZSTD_createDCtx()) == NULL)
+		return -1;
+	unsigned long long size = ZSTD_getFrameContentSize(block->in, block->in_len);
+	if(size == ZSTD_CONTENTSIZE_ERROR)
+		return -1;
+	ZSTD_DCtx_reset(block->zstd, ZSTD_reset_session_only);
+
+	/* Frames without their size in the header grow the buffer until they fit */
+	size_t capacity = size != ZSTD_CONTENTSIZE_UNKNOWN ? (size_t)size : 4 * block->in_len;
+	ZSTD_inBuffer in = { block->in, block->in_len, 0 };
+	block->out_len = 0;
+	while(true) {
+		if(fit_buffer(&block->out, &block->out_size, capacity) != 0)
+			return -1;
+		ZSTD_outBuffer out = { block->out, block->out_size, block->out_len };
+		size_t ret = ZSTD_decompressStream(block->zstd, &out, &in);
+		block->out_len = out.pos;
+		if(ZSTD_isError(ret))
+			return -1;
+		if(ret == 0)
+			return 0;
+		if(in.pos == in.size && out.pos < out.size)
+			return -1; /* The frame was cut short */
+		capacity = 2 * block->out_size;
+	}
+}
+#endif
+
+static int
+fit_buffer(unsigned char **buffer, size_t *size, size_t len)
+{
+	/* Keep at least a byte, inflating into a NULL buffer fails even if nothing is written */
+	len = len ? len : 1;
+	if(*size >= len)
+		return 0;
+	unsigned char *t = realloc(*buffer, len);
+	if(t == NULL) {
+		seqferrno_ = 6;
+		return -1;
+	}
+	*buffer = t;
+	*size = len;
+	return 0;
+}
+
+static int
+read_fully(int fd, unsigned char *buffer, size_t len, size_t *nread)
+{
+	size_t left = len;
+	while(left) {
+		ssize_t n = read(fd, buffer, left);
+		if(n == -1) {
+			seqferrno_ = 1;
+			return -1;
+		}
+		if(n == 0)
+			break;
+		left -= (size_t)n;
+		buffer += n;
+	}
+	*nread = len - left;
+	SEQF_STAT_ADD(bytes_read, *nread);
+	return 0;
+}
+
+static inline uint32_t
+load_le32(const unsigned char *bytes)
+{
+	return (uint32_t)bytes[0] | (uint32_t)bytes[1] << 8 | (uint32_t)bytes[2] << 16 |
+	       (uint32_t)bytes[3] << 24;
+}
@@ -13,6 +13,12 @@
 #else
 #  include <zlib.h>
 #endif
+#if (_HAS_ZSTD_ == 1)
+#  include <zstd.h>
+#endif
+#if (_HAS_LZ4_ == 1)
+#  include <lz4frame.h>
+#endif
 
 #if defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L) && !defined(__STDC_NO_THREADS__)
 #  include <threads.h>
@@ -20,6 +26,8 @@
 #  include <tinycthread.h>
 #endif
 
+#include <stdint.h>
+
 #include "seqfile.h"
 
 extern _Thread_local int seqferrno_;
@@ -27,19 +35,118 @@ extern _Thread_local int seqferrno_;
 typedef enum SEQF_COMPRESSION {
 	GZIP,
 	ZLIB,
+	BGZF,
+	ZSTD,
+	LZ4,
 	PLAIN
 } SEQF_COMPRESSION;
 
+#define SEQF_BLOCKS 16              /* Most blocks inflated ahead of the reader */
+#define SEQF_SPAN   (1UL << 20)     /* Least bytes inflated between two access points */
+#define SEQF_WINDOW 32768U          /* Bytes of history a deflate stream refers back to */
+#define SEQF_AHEAD  4               /* Buffers read ahead of the reader, see seqf_ahead.c */
+#define SEQF_FRAME  (1UL << 23)     /* Most bytes of a zstd frame decompressed as a block */
+
+/* Part of a compressed file inflated on its own, see seqf_blocks.c */
+struct seqf_block {
+	int status;                    /** If the block is free, being inflated, or inflated */
+	unsigned char *in;             /** Compressed bytes of the block */
+	size_t in_len;                 /** Number of compressed bytes */
+	size_t in_size;                /** Size of `in` */
+	unsigned char *out;            /** Inflated bytes of the block */
+	size_t out_len;                /** Number of inflated bytes */
+	size_t out_size;               /** Size of `out` */
+	size_t out_pos;                /** Next inflated byte to read */
+	uint64_t span;                 /** Access point the block starts at, for indexed files */
+#if defined _IGZIP_H
+	struct inflate_state *stream;  /** ISA-L Decompressor */
+#else
+	z_stream stream;               /** ZLIB Decompressor */
+	bool stream_is_init;           /** Check is stream is initialized */
+#endif
+#if defined ZSTD_VERSION_NUMBER
+	ZSTD_DCtx *zstd;               /** Zstandard decompressor, for zstd frames */
+#endif
+};
+
+/* Place a gzip file can be inflated from, see seqfindex.c */
+struct seqf_point {
+	uint64_t in;                   /** First byte of the file after the point */
+	uint64_t out;                  /** Inflated bytes before the point */
+	int bits;                      /** Bits of the byte before `in` that come after the point */
+	unsigned int window_len;       /** Bytes in `window` */
+	unsigned char *window;         /** Inflated bytes right before the point */
+};
+
+/* Access points of a gzip file, kept with `seqfindex` */
+struct seqf_index {
+	char *path;                    /** File the index was kept for */
+	uint64_t dev, ino;             /** Identity of the file */
+	uint64_t size;                 /** Size of the file when it was kept */
+	int64_t mtime;                 /** Modification time of the file when it was kept */
+	int keeps;                     /** Times kept and not dropped yet */
+	int refs;                      /** Keeps plus the files reading it, freed once 0 */
+	bool built;                    /** If every access point was found */
+	bool building;                 /** If a file is finding the access points */
+	uint64_t num_points;           /** Points in `points` */
+	uint64_t points_size;          /** Points `points` has room for */
+	struct seqf_point *points;     /** Access points, in order */
+	uint64_t in_end;               /** Size of the gzip stream */
+	uint64_t out_end;              /** Size of the inflated file */
+	struct seqf_index *next;       /** Next index kept */
+};
+
+/* Buffer of bytes read ahead of the reader */
+struct seqf_ahead_buf {
+	unsigned char *buf;            /** Bytes read ahead */
+	size_t len;                    /** Number of bytes in `buf` */
+	size_t pos;                    /** Next byte of `buf` to read */
+	int ret;                       /** What loading the buffer returned, 0 on success */
+	int err;                       /** seqferrno of the thread that loaded the buffer */
+};
+
+/* Thread reading and inflating a file ahead of its reader, see seqf_ahead.c */
+struct seqf_ahead {
+	thrd_t thread;                 /** Thread loading the buffers */
+	mtx_t mutex;                   /** Guards `head`, `tail`, `done`, and `stop` */
+	cnd_t filled;                  /** Signaled once a buffer was loaded */
+	cnd_t drained;                 /** Signaled once a buffer was read */
+	uint64_t head;                 /** Number of the buffer being read */
+	uint64_t tail;                 /** Number of the next buffer to load */
+	bool done;                     /** If the last buffer was loaded, at end of file or error */
+	bool stop;                     /** If the thread was asked to stop */
+	bool running;                  /** If the thread was started and not joined yet */
+	size_t bufsize;                /** Size of each buffer */
+	struct seqf_ahead_buf bufs[SEQF_AHEAD];
+};
+
+/* Files read as one, see seqf_list.c */
+struct seqf_list {
+	struct seqf_state **files;     /** Files of the list, in order */
+	int num_files;                 /** Number of files in `files` */
+	int *readers;                  /** Readers sharing the list reading each file at the moment */
+	bool *done;                    /** If each file was read to its end by a reader sharing it */
+	bool *open_lines;              /** If the last bytes taken from each file lack a newline */
+	int current;                   /** File read next by a single reader */
+};
+
 struct seqf_state {
 	int fd;                        /** File descriptor */
 	SEQF_COMPRESSION compression;  /** Type of compression, if any */
 	unsigned char type;            /** Type of file, e.g FASTA, FASTQ, or reads */
+	unsigned char detected;        /** Type found from the first lines with "d", see seqftype */
 #if defined _IGZIP_H               /** Use isa-l if available, otherwise zlib */
 	struct inflate_state stream;   /** ISA-L Decompressor */
 #else
 	z_stream stream;               /** ZLIB Decompressor */
 	bool stream_is_init;           /** Check is stream is initialized */
 #endif
+#if defined ZSTD_VERSION_NUMBER
+	ZSTD_DCtx *zstd;               /** Zstandard decompressor, NULL unless streamed */
+#endif
+#if defined LZ4F_VERSION
+	LZ4F_dctx *lz4;                /** LZ4 decompressor, NULL unless LZ4 */
+#endif
 
 	unsigned char *in_buf;         /** Input buffer*/
 	size_t in_bufsiz;              /** Size of the input buffer */
@@ -47,11 +154,79 @@ struct seqf_state {
 	size_t out_bufsiz;             /** Size of the output buffer */
 	unsigned char *next;           /** Next available byte in output buffer */
 	size_t have;                   /** Numberof bytes available in next */
+	size_t in_pos;                 /** Next byte of `in_buf` to decompress, for zstd and lz4 */
+	size_t in_len;                 /** Bytes in `in_buf`, for zstd and lz4 */
+	unsigned char peek[18];        /** Bytes read to tell the compression of a pipe */
+	size_t peek_pos;               /** Next byte of `peek` to read */
+	size_t peek_len;               /** Bytes in `peek`, 0 unless the file can't be seeked */
+
+	unsigned char *map;            /** Plain file mapped into memory, NULL when read */
+	size_t map_size;               /** Size of the mapped file */
+	size_t map_pos;                /** Next byte of the mapping to read */
+	const unsigned char *mem;      /** Caller's buffer read instead of `fd`, see seqfmemopen */
+	size_t mem_size;               /** Size of the caller's buffer */
+	size_t mem_pos;                /** Next byte of the caller's buffer to read */
+	bool in_memory;                /** If read from the caller's buffer, which is never freed */
+	bool seekable;                 /** If the file can be read again from the start */
+	uint64_t loaded;               /** Bytes loaded into the output buffer since the start */
 
 	mtx_t mutex;                   /** Mutex for thread safe functions */
 	bool mutex_is_init;            /** Check if mutex is initialized (for rnafclose) */
 
 	bool eof;                      /** Flag to test if at end of rnafile */
+	unsigned char seqs_skip;       /** Lines `seqf_seqs` skips before the next one, e.g. scores */
+
+	struct seqf_block *blocks;     /** Blocks inflated on several threads, NULL if streamed */
+	uint64_t block_head;           /** Number of the block being read */
+	uint64_t block_tail;           /** Number of the next block to inflate */
+	bool blocks_done;              /** If every block was taken to be inflated */
+	mtx_t block_mutex;             /** Guards the status of the blocks being inflated */
+	cnd_t block_ready;             /** Signaled once a block is inflated */
+	bool block_sync_is_init;       /** Check if block_mutex and block_ready are initialized */
+
+	struct seqf_index *index;      /** Access points read from or being found, if kept */
+	uint64_t index_in;             /** Compressed bytes inflated while finding access points */
+	uint64_t index_out;            /** Inflated bytes while finding access points */
+
+	struct seqf_ahead *ahead;      /** Thread reading the file ahead, NULL if read when needed */
+	struct seqf_list *list;        /** Files read in its place, NULL unless opened with a list */
 };
 
 typedef struct seqf_state *seqf_statep;
+
+/* Counters of the reads of every file, see seqf_stats.c */
+#if (_SEQF_STATS_ == 1)
+#  include <stdatomic.h>
+
+struct seqf_counters {
+	atomic_bool on;                /** If the counters are added to, see seqfsetstats */
+	atomic_uint_fast64_t bytes_read;
+	atomic_uint_fast64_t bytes_inflated;
+	atomic_uint_fast64_t records;
+	atomic_uint_fast64_t load_ns;
+	atomic_uint_fast64_t lock_wait_ns;
+};
+extern struct seqf_counters seqf_counters_;
+
+/* Nanoseconds since some point in the past, only told apart from other calls */
+extern uint64_t seqf_clock(void);
+
+/* Add the records of the `n` bytes of `buffer`, read from a file of `type` */
+extern void seqf_countrecords(const unsigned char *buffer, size_t n, unsigned char type);
+
+/* Lock `mutex`, timing how long it waited for it when it was held by another thread */
+extern void seqf_lock(mtx_t *mutex);
+
+#  define SEQF_STATS_ON() atomic_load_explicit(&seqf_counters_.on, memory_order_relaxed)
+#  define SEQF_STAT_ADD(field, n) \
+	do { if(SEQF_STATS_ON()) \
+		atomic_fetch_add_explicit(&seqf_counters_.field, (n), memory_order_relaxed); } while(0)
+#  define SEQF_STAT_RECORDS(buffer, n, type) \
+	do { if(SEQF_STATS_ON()) seqf_countrecords((buffer), (n), (type)); } while(0)
+#else
+#  define SEQF_STATS_ON() false
+#  define SEQF_STAT_ADD(field, n) ((void)0)
+#  define SEQF_STAT_RECORDS(buffer, n, type) ((void)0)
+#  define seqf_clock() UINT64_C(0)
+#  define seqf_lock(mutex) mtx_lock(mutex)
+#endif
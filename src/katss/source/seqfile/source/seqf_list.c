@@ -0,0 +1,239 @@
+/* seqf_list.c - Reading a list of files as one, several of them at once
+ *
+ * Copyright (c) 2024-2025 Francisco F. Cavazos
+ * Subject to the MIT License
+ */
+
+#include <stdlib.h>
+
+#include "seqf_read.h"
+
+static seqf_statep current_file(seqf_statep state, int *err);
+static bool next_file(seqf_statep state, int err);
+static size_t end_line(struct seqf_list *list, int file, unsigned char *buffer);
+
+/*
+Notes:
+A list reads its files as if they were concatenated, e.g. the lanes of a sequencing run split in
+several files. A single reader (the `_unlocked` functions) reads them one after the other. Files
+whose last line has no newline are given one once read, so no line runs into the next file, or
+into the next bytes of the reader that took it.
+
+Readers sharing the list (the locking seqf* functions) each take the file with the fewest readers
+at the moment, so with as many readers as files all of them are read, and inflated, at the same
+time. A single file only ever has one reader inflating it at a time. Each reader still gets whole
+records of a file, as when sharing a single file, so which file they come from doesn't matter.
+
+The list is the state of a SeqFile with no file of its own. Its files are regular SeqFiles, read
+through their own state and mutex, and `seqferrno` is only kept from a file that failed.
+*/
+
+
+/*===================================
+|  Internal functions               |
+===================================*/
+extern size_t
+seqf_listread(seqf_statep state, seqf_reader read, unsigned char *buffer, size_t bufsize)
+{
+	struct seqf_list *list = state->list;
+	int err = seqferrno_;
+	while(true) {
+		/* Take the file with the fewest readers, the first of them on ties */
+		mtx_lock(&state->mutex);
+		int pick = -1;
+		for(int i=0; i<list->num_files; i++) {
+			if(!list->done[i] && (pick < 0 || list->readers[i] < list->readers[pick]))
+				pick = i;
+		}
+		if(pick < 0) {
+			state->eof = true;
+			mtx_unlock(&state->mutex);
+			return 0;
+		}
+		list->readers[pick]++;
+		mtx_unlock(&state->mutex);
+
+		seqf_statep file = list->files[pick];
+		seqferrno_ = 0;
+		seqf_lock(&file->mutex);
+		size_t n = read(file, buffer, bufsize);
+		if(n != 0)
+			list->open_lines[pick] = state->type != 'b' && buffer[n - 1] != '\n';
+		else if(seqferrno_ == 0 && list->open_lines[pick] && bufsize >= 2)
+			n = end_line(list, pick, buffer);
+		mtx_unlock(&file->mutex);
+		seqf_prefetch(file);
+
+		/* Nothing read without an error is the end of the file */
+		bool failed = n == 0 && seqferrno_ != 0;
+		mtx_lock(&state->mutex);
+		list->readers[pick]--;
+		if(n == 0 && !failed)
+			list->done[pick] = true;
+		mtx_unlock(&state->mutex);
+		if(n != 0 || failed)
+			return n;
+		seqferrno_ = err;
+	}
+}
+
+extern size_t
+seqf_listread_unlocked(seqf_statep state, seqf_reader read, unsigned char *buffer, size_t bufsize)
+{
+	struct seqf_list *list = state->list;
+	int err;
+	seqf_statep file;
+	while((file = current_file(state, &err)) != NULL) {
+		int current = list->current;
+		size_t n = read(file, buffer, bufsize);
+		if(n != 0) {
+			seqferrno_ = err;
+			list->open_lines[current] = state->type != 'b' && buffer[n - 1] != '\n';
+			return n;
+		}
+		if(!next_file(state, err))
+			return 0;
+
+		/* The last line of a file ends before the next file starts */
+		if(list->open_lines[current] && bufsize >= 2)
+			return end_line(list, current, buffer);
+	}
+	return 0;
+}
+
+extern char *
+seqf_listgets(seqf_statep state, char *(*gets)(SeqFile, char *, size_t), char *buffer,
+              size_t bufsize)
+{
+	int err;
+	seqf_statep file;
+	while((file = current_file(state, &err)) != NULL) {
+		char *ret = gets((SeqFile)file, buffer, bufsize);
+		if(ret != NULL) {
+			seqferrno_ = err;
+			return ret;
+		}
+		if(!next_file(state, err))
+			return NULL;
+	}
+	return NULL;
+}
+
+extern int
+seqf_listgetc(seqf_statep state, int (*getc)(SeqFile))
+{
+	int err;
+	seqf_statep file;
+	while((file = current_file(state, &err)) != NULL) {
+		int c = getc((SeqFile)file);
+		if(c >= 0) {
+			seqferrno_ = err;
+			return c;
+		}
+		if(!next_file(state, err))
+			return EOF;
+	}
+	return EOF;
+}
+
+extern size_t
+seqf_listbatch(seqf_statep state, char *buffer, size_t bufsize, size_t recsize, size_t *ends,
+               size_t maxrecords)
+{
+	int err;
+	seqf_statep file;
+	while((file = current_file(state, &err)) != NULL) {
+		size_t records = seqfreadbatch_unlocked((SeqFile)file, buffer, bufsize, recsize, ends,
+		                                        maxrecords);
+		if(records != 0) {
+			seqferrno_ = err;
+			return records;
+		}
+		if(!next_file(state, err))
+			return 0;
+	}
+	return 0;
+}
+
+extern int
+seqf_rewindlist(seqf_statep state)
+{
+	struct seqf_list *list = state->list;
+	int ret = 0;
+	for(int i=0; i<list->num_files; i++) {
+		if(seqfrewind((SeqFile)list->files[i]) != 0)
+			ret = -1;
+		list->readers[i] = 0;
+		list->done[i] = false;
+		list->open_lines[i] = false;
+	}
+	list->current = 0;
+	state->eof = false;
+	return ret;
+}
+
+extern int
+seqf_closelist(seqf_statep state)
+{
+	struct seqf_list *list = state->list;
+	int ret = 0;
+	for(int i=0; i<list->num_files; i++) {
+		if(seqfclose((SeqFile)list->files[i]) != 0)
+			ret = 1;
+	}
+	free(list->files);
+	free(list->readers);
+	free(list->done);
+	free(list->open_lines);
+	free(list);
+	state->list = NULL;
+	return ret;
+}
+
+
+/*===================================
+|  Helper functions                 |
+===================================*/
+
+/**
+ * @brief File a single reader reads next, or NULL once every file was read (setting the eof
+ * flag). Clears seqferrno to tell the errors of the file apart, keeping it in `err`.
+ */
+static seqf_statep
+current_file(seqf_statep state, int *err)
+{
+	struct seqf_list *list = state->list;
+	*err = seqferrno_;
+	if(list->current == list->num_files) {
+		state->eof = true;
+		return NULL;
+	}
+	seqferrno_ = 0;
+	return list->files[list->current];
+}
+
+/**
+ * @brief Move on to the next file once the current one read nothing, unless it failed. Restores
+ * seqferrno to `err` if it didn't, and returns whether it didn't.
+ */
+static bool
+next_file(seqf_statep state, int err)
+{
+	if(seqferrno_ != 0)
+		return false;
+	seqferrno_ = err;
+	state->list->current++;
+	return true;
+}
+
+/**
+ * @brief Write the newline the last line of `file` is missing to `buffer`, returning its length.
+ */
+static size_t
+end_line(struct seqf_list *list, int file, unsigned char *buffer)
+{
+	list->open_lines[file] = false;
+	buffer[0] = '\n';
+	buffer[1] = '\0';
+	return 1;
+}
@@ -26,8 +26,12 @@
  * buffer with the requested number of bytes. As such, keep track of how many
  * bytes it has read, and request the bytes that it needs.
  * 
- * EOF if set in the state when `read` function returns 0 (signifying EOF in 
- * file descriptor) **AND** `nread` is 0, meaning the buffer is empty.
+ * EOF is set by `seqf_load` once no bytes are left, meaning the buffer is
+ * empty.
+ * 
+ * Files mapped into memory are copied from the mapping instead, which is
+ * already the whole file, and buffers opened with `seqfmemopen` from the
+ * buffer.
  * 
  * @param state    File state to read from
  * @param buffer   Buffer to fill with bytes
@@ -38,8 +42,32 @@
 static int
 seqf_loadp(seqf_statep state, unsigned char *buffer, size_t bufsize, size_t *nread)
 {
-	size_t left = bufsize;
-	ssize_t n;
+	/* Mapped files are copied out of the mapping */
+	if(state->map != NULL) {
+		*nread = MIN2(bufsize, state->map_size - state->map_pos);
+		memcpy(buffer, state->map + state->map_pos, *nread);
+		state->map_pos += *nread;
+		SEQF_STAT_ADD(bytes_read, *nread);
+		return 0;
+	}
+
+	/* So are buffers in memory, whatever they hold */
+	if(state->in_memory) {
+		*nread = MIN2(bufsize, state->mem_size - state->mem_pos);
+		memcpy(buffer, state->mem + state->mem_pos, *nread);
+		state->mem_pos += *nread;
+		SEQF_STAT_ADD(bytes_read, *nread);
+		return 0;
+	}
+
+	/* Bytes read from a pipe to tell its compression come first */
+	size_t peeked = MIN2(bufsize, state->peek_len - state->peek_pos);
+	memcpy(buffer, state->peek + state->peek_pos, peeked);
+	state->peek_pos += peeked;
+	buffer += peeked;
+
+	size_t left = bufsize - peeked;
+	ssize_t n = 0;
 	*nread = 0;
 	if(left) do {
 		n = read(state->fd, buffer, left);
@@ -53,14 +81,109 @@ seqf_loadp(seqf_statep state, unsigned char *buffer, size_t bufsize, size_t *nre
 		return -1;
 	}
 	*nread = bufsize - left;
-	if(n == 0 && *nread == 0)
-		state->eof = true;
+	SEQF_STAT_ADD(bytes_read, *nread);
 	return 0;
 }
 
+#if defined ZSTD_VERSION_NUMBER
+/**
+ * @brief Load the state's buffer for ZSTD compression, decompressing the frames of the file one
+ * after another. Same as `seqf_loadp` otherwise, and returns 3 if the file is corrupt.
+ */
+static int
+seqf_loadzstd(seqf_statep state, unsigned char *buffer, size_t bufsize, size_t *nread)
+{
+	ZSTD_outBuffer out = { buffer, bufsize, 0 };
+	while(out.pos < out.size) {
+		/* Refill input buffer if empty, flushing what the decompressor has left at the end */
+		bool at_end = false;
+		if(state->in_pos == state->in_len) {
+			size_t got;
+			if(seqf_loadp(state, state->in_buf, state->in_bufsiz, &got) != 0)
+				return -1;
+			state->in_pos = 0;
+			state->in_len = got;
+			at_end = got == 0;
+		}
+
+		size_t before = out.pos;
+		ZSTD_inBuffer in = { state->in_buf, state->in_len, state->in_pos };
+		size_t ret = ZSTD_decompressStream(state->zstd, &out, &in);
+		state->in_pos = in.pos;
+		if(ZSTD_isError(ret)) {
+			seqferrno_ = 8;
+			return 3;
+		}
+		if(at_end && out.pos == before)
+			break;
+	}
+	*nread = out.pos;
+	return 0;
+}
+#endif
+
+#if defined LZ4F_VERSION
+/**
+ * @brief Load the state's buffer for LZ4 compression, the same way as `seqf_loadzstd`.
+ */
+static int
+seqf_loadlz4(seqf_statep state, unsigned char *buffer, size_t bufsize, size_t *nread)
+{
+	size_t have = 0;
+	while(have < bufsize) {
+		bool at_end = false;
+		if(state->in_pos == state->in_len) {
+			size_t got;
+			if(seqf_loadp(state, state->in_buf, state->in_bufsiz, &got) != 0)
+				return -1;
+			state->in_pos = 0;
+			state->in_len = got;
+			at_end = got == 0;
+		}
+
+		size_t out_len = bufsize - have, in_len = state->in_len - state->in_pos;
+		size_t ret = LZ4F_decompress(state->lz4, buffer + have, &out_len,
+		                             state->in_buf + state->in_pos, &in_len, NULL);
+		state->in_pos += in_len;
+		have += out_len;
+		if(LZ4F_isError(ret)) {
+			seqferrno_ = 8;
+			return 3;
+		}
+		if(at_end && out_len == 0)
+			break;
+	}
+	*nread = have;
+	return 0;
+}
+#endif
+
 extern int
 seqf_load(seqf_statep state, unsigned char *buffer, size_t bufsize, size_t *nread)
 {
+	/* Bytes read ahead are loaded by another thread, which leaves the eof flag to the reader */
+	uint64_t start = SEQF_STATS_ON() ? seqf_clock() : 0;
+	int ret = state->ahead != NULL ? seqf_loadahead(state, buffer, bufsize, nread)
+	                               : seqf_loadnow(state, buffer, bufsize, nread);
+	if(ret == 0 && *nread == 0 && bufsize != 0)
+		state->eof = true;
+	if(ret == 0)
+		state->loaded += *nread;
+	if(start != 0) {
+		SEQF_STAT_ADD(load_ns, seqf_clock() - start);
+		if(ret == 0 && state->compression != PLAIN)
+			SEQF_STAT_ADD(bytes_inflated, *nread);
+	}
+	return ret;
+}
+
+extern int
+seqf_loadnow(seqf_statep state, unsigned char *buffer, size_t bufsize, size_t *nread)
+{
+	/* Process blocks inflated on their own */
+	if(state->blocks != NULL)
+		return seqf_loadblocks(state, buffer, bufsize, nread);
+
 	/* Process plain file */
 	if(state->compression == PLAIN) {
 		if(seqf_loadp(state, buffer, bufsize, nread) != 0)
@@ -68,6 +191,16 @@ seqf_load(seqf_statep state, unsigned char *buffer, size_t bufsize, size_t *nrea
 		return 0;
 	}
 
+	/* Process zstd and lz4 files, their decompressor was made when they were opened */
+#if defined ZSTD_VERSION_NUMBER
+	if(state->compression == ZSTD)
+		return seqf_loadzstd(state, buffer, bufsize, nread);
+#endif
+#if defined LZ4F_VERSION
+	if(state->compression == LZ4)
+		return seqf_loadlz4(state, buffer, bufsize, nread);
+#endif
+
 	/* Process compressed file */
 	register int ret;
 	register size_t left = bufsize;
@@ -94,11 +227,33 @@ seqf_load(seqf_statep state, unsigned char *buffer, size_t bufsize, size_t *nrea
 		left = state->stream.avail_out;
 	} while(left && ret != ISAL_END_INPUT);
 #else
-		ret = inflate(&state->stream, Z_NO_FLUSH);
+		/* Finding access points stops at every deflate block for them */
+		uInt avail_in = state->stream.avail_in;
+		uInt avail_out = state->stream.avail_out;
+		bool finding = state->index != NULL && !state->index->built;
+		ret = inflate(&state->stream, finding ? Z_BLOCK : Z_NO_FLUSH);
 		if(ret != Z_BUF_ERROR && ret != Z_OK && ret != Z_STREAM_END) {
 			seqferrno_ = 1;
 			return 3;
 		}
+		if(finding)
+			seqf_markpoint(state, avail_in - state->stream.avail_in,
+			               avail_out - state->stream.avail_out);
+		if(finding && state->index != NULL && ret == Z_STREAM_END)
+			seqf_endindex(state);
+
+		/* Gzip members after the first, as in BGZF files read from a pipe, are inflated on */
+		if(!finding && ret == Z_STREAM_END && state->compression == GZIP) {
+			if(state->stream.avail_in == 0) {
+				size_t nread;
+				if(seqf_loadp(state, state->in_buf, state->in_bufsiz, &nread) != 0)
+					return -1;
+				state->stream.avail_in = nread;
+				state->stream.next_in = state->in_buf;
+			}
+			if(state->stream.avail_in != 0 && inflateReset(&state->stream) == Z_OK)
+				ret = Z_OK;
+		}
 		left = state->stream.avail_out;
 	} while(left && ret != Z_STREAM_END);
 #endif
@@ -41,6 +41,111 @@
 extern int seqf_load(seqf_statep state, unsigned char *buffer, size_t bufsize, size_t *nread);
 
 
+/**
+ * @brief Same as `seqf_load`, loading the bytes from the file right away even if it is read
+ * ahead, and without setting the eof flag. Used by the thread reading ahead.
+ */
+extern int seqf_loadnow(seqf_statep state, unsigned char *buffer, size_t bufsize, size_t *nread);
+
+
+/**
+ * @brief Same as `seqf_load`, for files read ahead by another thread. Waits for the thread when
+ * no bytes were read ahead yet.
+ */
+extern int seqf_loadahead(seqf_statep state, unsigned char *buffer, size_t bufsize, size_t *nread);
+
+
+/**
+ * @brief Start reading the file ahead of the reader on a thread of its own, into buffers as
+ * large as the output buffer. A file paused with `seqf_pauseahead` is read ahead from where it
+ * was paused. Returns 0 on success, -1 if the thread could not be started.
+ */
+extern int seqf_startahead(seqf_statep state);
+
+
+/**
+ * @brief Wait for the thread reading the file ahead to stop, keeping the bytes it read ahead.
+ * Used to change the buffers the thread reads with.
+ */
+extern void seqf_pauseahead(seqf_statep state);
+
+
+/**
+ * @brief Stop reading the file ahead, if it was. Bytes read ahead and not read yet are dropped,
+ * so it is only stopped to close or rewind the file.
+ */
+extern void seqf_stopahead(seqf_statep state);
+
+
+/**
+ * @brief Same as `seqf_load`, for files read from blocks inflated on their own (BGZF files, gzip
+ * files with access points, and the frames of zstd files). A block that wasn't inflated ahead by
+ * `seqf_prefetch` is inflated right away.
+ */
+extern int seqf_loadblocks(seqf_statep state, unsigned char *buffer, size_t bufsize, size_t *nread);
+
+
+/**
+ * @brief Inflate the next block of the file ahead of the reader, if there is room for one. Called
+ * by the locking functions once they unlocked the state, which is only locked to take the block.
+ */
+extern void seqf_prefetch(seqf_statep state);
+
+
+/**
+ * @brief Start reading the file from blocks inflated on their own. Returns 0 on success, -1 when
+ * out of memory.
+ */
+extern int seqf_initblocks(seqf_statep state);
+
+
+/**
+ * @brief Read the blocks from the start of the file again.
+ */
+extern void seqf_resetblocks(seqf_statep state);
+
+
+/**
+ * @brief Free the blocks of the state, if any.
+ */
+extern void seqf_freeblocks(seqf_statep state);
+
+
+/**
+ * @brief Find the access points kept for the file of `fd`, see `seqfindex`. Returns NULL if
+ * there are none, or if another file is finding them. When they weren't found yet, it is up to
+ * the state to find them, passing every inflated block to `seqf_markpoint` and ending with
+ * `seqf_endindex`.
+ */
+extern struct seqf_index *seqf_findindex(int fd);
+
+
+/**
+ * @brief Stop reading or finding the access points of the state, if any.
+ */
+extern void seqf_closeindex(seqf_statep state);
+
+
+/**
+ * @brief Drop a reference to `index`, freeing it if it was the last one. Only called with the
+ * lock of all indexes held.
+ */
+extern void seqf_releaseindex(struct seqf_index *index);
+
+
+/**
+ * @brief Add an access point if the stream of the state stopped at the end of a deflate block,
+ * after inflating `out` bytes from `in` bytes.
+ */
+extern void seqf_markpoint(seqf_statep state, size_t in, size_t out);
+
+
+/**
+ * @brief Keep the access points found once the stream of the state ended.
+ */
+extern void seqf_endindex(seqf_statep state);
+
+
 /**
  * @brief Fills the internal output buffer with decompressed bytes. Assumes that
  * state->have is 0 since it will overwrite everything in the output buffer. If
@@ -143,12 +248,71 @@ extern unsigned char *seqf_skipline(seqf_statep state);
 // end seqfshiftcpy
 
 
+/**
+ * @brief Fill `buffer` with the sequences of whole fasta or fastq records, one per line, leaving
+ * out headers and quality scores, see seqf_seqs.c. Sequences files are read as `seqf_sread` does.
+ * Returns the number of bytes written, 0 at end of file or on error.
+ */
+extern size_t seqf_seqs(seqf_statep state, unsigned char *buffer, size_t bufsize);
+
+
+/* Reads sequences from a state into a buffer, e.g. `seqf_seqs` */
+typedef size_t (*seqf_reader)(seqf_statep state, unsigned char *buffer, size_t bufsize);
+
+/**
+ * @brief Read the list of files of `state` with `read`, from whichever of them has the fewest
+ * readers, for the locking seqf* functions, see seqf_list.c. Returns 0 once every file was read,
+ * setting `state->eof`, or on error.
+ */
+extern size_t seqf_listread(seqf_statep state, seqf_reader read, unsigned char *buffer,
+                            size_t bufsize);
+
+/**
+ * @brief Same as `seqf_listread` for the `_unlocked` functions, reading the files one after the
+ * other, with a newline between files that don't end with one.
+ */
+extern size_t seqf_listread_unlocked(seqf_statep state, seqf_reader read, unsigned char *buffer,
+                                     size_t bufsize);
+
+/**
+ * @brief Call `gets`, one of the seqf*gets_unlocked functions, on the files of the list of
+ * `state` one after the other. Returns what `gets` returned, or NULL once every file was read.
+ */
+extern char *seqf_listgets(seqf_statep state, char *(*gets)(SeqFile, char *, size_t),
+                           char *buffer, size_t bufsize);
+
+/**
+ * @brief Same as `seqf_listgets` for `getc`, one of the seqf*getnt_unlocked functions or
+ * `seqfgetc_unlocked`. Returns EOF once every file was read.
+ */
+extern int seqf_listgetc(seqf_statep state, int (*getc)(SeqFile));
+
+/**
+ * @brief Same as `seqf_listgets` for `seqfreadbatch_unlocked`.
+ */
+extern size_t seqf_listbatch(seqf_statep state, char *buffer, size_t bufsize, size_t recsize,
+                             size_t *ends, size_t maxrecords);
+
+/**
+ * @brief Rewind every file of the list of `state`. Returns 0 on success, -1 if any failed.
+ */
+extern int seqf_rewindlist(seqf_statep state);
+
+/**
+ * @brief Close every file of the list of `state` and free the list. Returns 0 on success, 1 if
+ * closing any of them failed.
+ */
+extern int seqf_closelist(seqf_statep state);
+
+
 /* Undocumented functions. Used for file-specific reading */
 
 size_t seqf_qread(seqf_statep state, unsigned char *buffer, size_t bufsize);
 size_t seqf_aread(seqf_statep state, unsigned char *buffer, size_t bufsize);
 size_t seqf_sread(seqf_statep state, unsigned char *buffer, size_t bufsize);
 
+/* Same as the seqf*gets_unlocked functions, returning the end of the sequence (its null
+   terminator) instead of its start, or NULL at end of file */
 char *seqf_qgets(seqf_statep state, unsigned char *buffer, size_t bufsize);
 char *seqf_agets(seqf_statep state, unsigned char *buffer, size_t bufsize);
 char *seqf_sgets(seqf_statep state, unsigned char *buffer, size_t bufsize);
@@ -0,0 +1,267 @@
+/* seqf_seqs.c - Reading only the sequences of fasta and fastq records
+ *
+ * Copyright (c) 2024-2025 Francisco F. Cavazos
+ * Subject to the MIT License
+ */
+
+#include "seqf_read.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  include <immintrin.h>
+#  define SEQF_X86_SIMD 1
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#  include <arm_neon.h>
+#  define SEQF_NEON_SIMD 1
+#endif
+
+/* Finds the newlines of a buffer one 64 byte block at a time */
+struct seqf_lines {
+	const unsigned char *block;    /** Block the newlines in `mask` are in */
+	const unsigned char *end;      /** End of the buffer */
+	uint64_t mask;                 /** Newlines of the block not given out yet, one bit each */
+};
+
+typedef uint64_t (*newlines_fn)(const unsigned char *block);
+
+#ifdef SEQF_X86_SIMD
+static uint64_t newlines_sse2(const unsigned char *block);
+static uint64_t newlines_avx2(const unsigned char *block);
+#endif
+#ifdef SEQF_NEON_SIMD
+static uint64_t newlines_neon(const unsigned char *block);
+#endif
+
+static void select_newlines(void);
+static void init_lines(struct seqf_lines *lines, const unsigned char *start,
+                       const unsigned char *end);
+static inline const unsigned char *next_line(struct seqf_lines *lines, const unsigned char *from);
+static inline void load_block(struct seqf_lines *lines);
+
+static newlines_fn newlines = NULL;
+static once_flag newlines_flag = ONCE_FLAG_INIT;
+
+/*
+Notes:
+Records are read a line at a time, with the newlines of 64 bytes found at once with SIMD and given
+out from a bit mask, so short lines (e.g. quality scores) are never read more than once. Without
+SIMD, every line is found with memchr instead.
+
+Headers break the sequence, as do '+' lines in fastq files along with the quality line after them,
+and the end of the file. Blank lines are skipped, and the other lines are sequence, joined into one
+sequence until it is broken. So the sequences can be written as reads, one per line, with the same
+k-mers as their records.
+*/
+
+
+/*===================================
+|  Internal functions               |
+===================================*/
+extern size_t
+seqf_seqs(seqf_statep state, unsigned char *buffer, size_t bufsize)
+{
+	if(state->type == 's')
+		return seqf_sread(state, buffer, bufsize);
+	if(state->type != 'a' && state->type != 'q') {
+		seqferrno_ = 4;
+		return 0;
+	}
+	if(bufsize < 2)
+		return 0;
+	call_once(&newlines_flag, select_newlines);
+
+	const unsigned char header = state->type == 'q' ? '@' : '>';
+	const size_t space = bufsize - 1; /* Leave space for null terminator */
+	size_t used = 0;                  /* Bytes of the sequences written whole */
+	size_t unit = 0;                  /* Bytes of the sequence being written after them */
+	bool in_seq = false;
+
+	/* `done` is the first byte of the file not written whole, where the next call starts */
+	unsigned char *done = state->next, *line = state->next, *end = state->next + state->have;
+	struct seqf_lines lines;
+	init_lines(&lines, line, end);
+	while(true) {
+		const unsigned char *eol = line < end ? next_line(&lines, line) : NULL;
+
+		/* The last line is cut short, load more bytes after the ones not written whole */
+		if(eol == NULL) {
+			size_t keep = (size_t)(end - done), offset = (size_t)(line - done);
+			if(keep == state->out_bufsiz) {
+				if(used != 0)
+					break;
+				seqferrno_ = 5; /* The sequence is longer than the internal buffer */
+				return 0;
+			}
+			memmove(state->out_buf, done, keep);
+			size_t nread;
+			if(seqf_load(state, state->out_buf + keep, state->out_bufsiz - keep, &nread) != 0)
+				return 0;
+			done = state->out_buf;
+			line = done + offset;
+			end = done + keep + nread;
+			init_lines(&lines, line, end);
+			if(nread != 0)
+				continue;
+			if(line == end) { /* End of file */
+				if(in_seq) {
+					buffer[used + unit] = '\n';
+					used += unit + 1;
+				}
+				done = end;
+				break;
+			}
+			eol = end; /* The last line has no newline */
+		}
+
+		size_t length = (size_t)(eol - line);
+
+		/* Blank lines are skipped, the same way `seqfagets` skips them */
+		if(length == 0 && state->seqs_skip == 0) {
+			line = (unsigned char *)eol + (eol < end);
+			if(!in_seq)
+				done = line;
+			continue;
+		}
+		bool is_seq = state->seqs_skip == 0 && *line != header && !(header == '@' && *line == '+');
+
+		/* Another sequence line is joined to the sequence, if all of it still fits */
+		if(is_seq) {
+			if(used + unit + length + 1 > space) {
+				if(used != 0)
+					break;
+				seqferrno_ = 5; /* The sequence is longer than the buffer */
+				return 0;
+			}
+			memcpy(buffer + used + unit, line, length);
+			unit += length;
+			in_seq = true;
+			line = (unsigned char *)eol + (eol < end);
+			continue;
+		}
+
+		/* Anything else ends the sequence, which is then written whole */
+		if(in_seq) {
+			buffer[used + unit] = '\n';
+			used += unit + 1;
+			unit = 0;
+			in_seq = false;
+		}
+		if(state->seqs_skip != 0)
+			state->seqs_skip--;
+		else if(length != 0 && *line == '+' && header == '@')
+			state->seqs_skip = 1; /* Quality scores follow */
+		line = (unsigned char *)eol + (eol < end);
+		done = line;
+	}
+
+	state->next = done;
+	state->have = (size_t)(end - done);
+	buffer[used] = '\0';
+	SEQF_STAT_RECORDS(buffer, used, 's');
+	return used;
+}
+
+
+/*===================================
+|  Helper functions                 |
+===================================*/
+static void
+select_newlines(void)
+{
+#ifdef SEQF_X86_SIMD
+	__builtin_cpu_init();
+	newlines = __builtin_cpu_supports("avx2") ? newlines_avx2 : newlines_sse2;
+#elif defined(SEQF_NEON_SIMD)
+	newlines = newlines_neon; /* NEON is part of the aarch64 baseline */
+#endif
+}
+
+static void
+init_lines(struct seqf_lines *lines, const unsigned char *start, const unsigned char *end)
+{
+	lines->block = start;
+	lines->end = end;
+	lines->mask = 0;
+	if(newlines != NULL && start < end)
+		load_block(lines);
+}
+
+/**
+ * @brief Find the first newline of the buffer at or after `from`, or NULL if there is none. Lines
+ * are found in order, so `from` never goes back.
+ */
+static inline const unsigned char *
+next_line(struct seqf_lines *lines, const unsigned char *from)
+{
+	if(newlines == NULL)
+		return memchr(from, '\n', (size_t)(lines->end - from));
+
+	while(true) {
+		while(lines->mask) {
+			const unsigned char *eol = lines->block + __builtin_ctzll(lines->mask);
+			lines->mask &= lines->mask - 1;
+			if(eol >= from)
+				return eol;
+		}
+		lines->block += 64;
+		if(lines->block >= lines->end)
+			return NULL;
+		load_block(lines);
+	}
+}
+
+static inline void
+load_block(struct seqf_lines *lines)
+{
+	size_t left = (size_t)(lines->end - lines->block);
+	if(left >= 64) {
+		lines->mask = newlines(lines->block);
+		return;
+	}
+
+	/* Bytes past the end of the buffer may not be readable */
+	lines->mask = 0;
+	for(size_t i=0; i<left; i++)
+		lines->mask |= (uint64_t)(lines->block[i] == '\n') << i;
+}
+
+#ifdef SEQF_X86_SIMD
+static uint64_t
+newlines_sse2(const unsigned char *block)
+{
+	const __m128i nl = _mm_set1_epi8('\n');
+	uint64_t mask = 0;
+	for(int i=0; i<4; i++) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(block + 16*i));
+		mask |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)) << 16*i;
+	}
+	return mask;
+}
+
+__attribute__((target("avx2"))) static uint64_t
+newlines_avx2(const unsigned char *block)
+{
+	const __m256i nl = _mm256_set1_epi8('\n');
+	__m256i lo = _mm256_loadu_si256((const __m256i *)block);
+	__m256i hi = _mm256_loadu_si256((const __m256i *)(block + 32));
+	uint32_t mask_lo = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, nl));
+	uint32_t mask_hi = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, nl));
+	return (uint64_t)mask_hi << 32 | mask_lo;
+}
+#endif
+
+#ifdef SEQF_NEON_SIMD
+static uint64_t
+newlines_neon(const unsigned char *block)
+{
+	/* Weigh every byte by its bit, then add up neighbours until each byte holds 8 of them */
+	static const uint8_t weights[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+	const uint8x16_t bits = vld1q_u8(weights), nl = vdupq_n_u8('\n');
+	uint8x16_t m0 = vandq_u8(vceqq_u8(vld1q_u8(block), nl), bits);
+	uint8x16_t m1 = vandq_u8(vceqq_u8(vld1q_u8(block + 16), nl), bits);
+	uint8x16_t m2 = vandq_u8(vceqq_u8(vld1q_u8(block + 32), nl), bits);
+	uint8x16_t m3 = vandq_u8(vceqq_u8(vld1q_u8(block + 48), nl), bits);
+	uint8x16_t sum = vpaddq_u8(vpaddq_u8(m0, m1), vpaddq_u8(m2, m3));
+	sum = vpaddq_u8(sum, sum);
+	return vgetq_lane_u64(vreinterpretq_u64_u8(sum), 0);
+}
+#endif
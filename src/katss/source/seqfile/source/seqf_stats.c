@@ -0,0 +1,105 @@
+/* seqf_stats.c - Counters of the bytes and records read by every SeqFile
+ *
+ * Copyright (c) 2024-2025 Francisco F. Cavazos
+ * Subject to the MIT License
+ */
+
+#include <time.h>
+
+#include "seqf_read.h"
+
+/*
+Notes:
+The counters are shared by every file and thread, and only added to once `seqfsetstats` turned
+them on, so a build with them costs a relaxed load per read when they are off. They are never
+reset, callers take the difference of two `seqfstats` calls around the reads they care about.
+
+The lock of a file is only timed when another thread holds it, so uncontended reads never read
+the clock.
+*/
+
+#if (_SEQF_STATS_ == 1)
+struct seqf_counters seqf_counters_;
+
+extern uint64_t
+seqf_clock(void)
+{
+	struct timespec now;
+	timespec_get(&now, TIME_UTC);
+	return (uint64_t)now.tv_sec * 1000000000U + (uint64_t)now.tv_nsec;
+}
+
+static uint64_t
+count_byte(const unsigned char *buffer, size_t n, unsigned char byte)
+{
+	uint64_t count = 0;
+	const unsigned char *end = buffer + n;
+	while((buffer = memchr(buffer, byte, (size_t)(end - buffer))) != NULL) {
+		count++;
+		buffer++;
+	}
+	return count;
+}
+
+extern void
+seqf_countrecords(const unsigned char *buffer, size_t n, unsigned char type)
+{
+	if(n == 0)
+		return;
+
+	/* Fasta records start with a header, fastq records are four lines, the rest one line */
+	uint64_t records;
+	if(type == 'a') {
+		records = count_byte(buffer, n, '>');
+	} else {
+		records = count_byte(buffer, n, '\n') + (buffer[n - 1] != '\n');
+		if(type == 'q')
+			records = (records + 3) / 4;
+	}
+	atomic_fetch_add_explicit(&seqf_counters_.records, records, memory_order_relaxed);
+}
+
+extern void
+seqf_lock(mtx_t *mutex)
+{
+	if(!SEQF_STATS_ON()) {
+		mtx_lock(mutex);
+		return;
+	}
+	if(mtx_trylock(mutex) == thrd_success)
+		return;
+	uint64_t start = seqf_clock();
+	mtx_lock(mutex);
+	SEQF_STAT_ADD(lock_wait_ns, seqf_clock() - start);
+}
+#endif
+
+
+/*===================================
+|  Public functions                 |
+===================================*/
+void
+seqfsetstats(bool enable)
+{
+#if (_SEQF_STATS_ == 1)
+	atomic_store(&seqf_counters_.on, enable);
+#else
+	(void)enable;
+#endif
+}
+
+int
+seqfstats(struct SeqfStats *stats)
+{
+#if (_SEQF_STATS_ == 1)
+	stats->bytes_read = atomic_load(&seqf_counters_.bytes_read);
+	stats->bytes_inflated = atomic_load(&seqf_counters_.bytes_inflated);
+	stats->records = atomic_load(&seqf_counters_.records);
+	stats->load_ns = atomic_load(&seqf_counters_.load_ns);
+	stats->lock_wait_ns = atomic_load(&seqf_counters_.lock_wait_ns);
+	return 0;
+#else
+	memset(stats, 0, sizeof *stats);
+	return -1;
+#endif
+}
@@ -0,0 +1,271 @@
+/* seqfindex.c - Keeping the access points of gzip files to inflate them on several threads
+ *
+ * Copyright (c) 2024-2025 Francisco F. Cavazos
+ * Subject to the MIT License
+ */
+
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include "seqf_read.h"
+
+static struct seqf_index *indexes = NULL;
+static mtx_t indexes_lock;
+static once_flag indexes_once = ONCE_FLAG_INIT;
+
+static void init_indexes(void);
+static bool same_file(const struct seqf_index *index, const struct stat *st);
+static void drop_points(struct seqf_index *index);
+static void free_index(struct seqf_index *index);
+
+/*
+Notes:
+The access points are found the first time a kept file is read through to its end, at most
+every SEQF_SPAN inflated bytes. Each point only takes the SEQF_WINDOW bytes before it. Files
+opened after that are inflated from the points on several threads, see seqf_blocks.c.
+Indexes are found by the identity of the file, so a file changed since it was kept is streamed.
+*/
+
+
+/*===================================
+|  Public functions                 |
+===================================*/
+int
+seqfindex(const char *path)
+{
+#if defined _IGZIP_H
+	(void)path;
+	return 1; /* Only zlib inflates from the middle of a stream */
+#else
+	call_once(&indexes_once, init_indexes);
+	struct stat st;
+	if(path == NULL || stat(path, &st) != 0)
+		return -1;
+
+	/* Keeping a file again keeps it until it is dropped as many times */
+	mtx_lock(&indexes_lock);
+	struct seqf_index *index = indexes;
+	while(index != NULL && (index->keeps == 0 || strcmp(index->path, path) != 0))
+		index = index->next;
+	if(index != NULL) {
+		index->keeps++;
+		index->refs++;
+	}
+	mtx_unlock(&indexes_lock);
+	if(index != NULL)
+		return 0;
+
+	/* Only plain gzip files need access points, BGZF files are made of blocks */
+	SeqFile file = seqfopen(path, "b");
+	if(file == NULL)
+		return -1;
+	bool is_gzip = ((seqf_statep)file)->compression == GZIP;
+	seqfclose(file);
+	if(!is_gzip)
+		return 1;
+
+	index = calloc(1, sizeof *index);
+	if(index == NULL || (index->path = malloc(strlen(path) + 1)) == NULL) {
+		free(index);
+		seqferrno_ = 6;
+		return -1;
+	}
+	strcpy(index->path, path);
+	index->dev = (uint64_t)st.st_dev;
+	index->ino = (uint64_t)st.st_ino;
+	index->size = (uint64_t)st.st_size;
+	index->mtime = (int64_t)st.st_mtime;
+	index->keeps = 1;
+	index->refs = 1;
+
+	mtx_lock(&indexes_lock);
+	index->next = indexes;
+	indexes = index;
+	mtx_unlock(&indexes_lock);
+	return 0;
+#endif
+}
+
+int
+seqfunindex(const char *path)
+{
+	if(path == NULL)
+		return -1;
+	call_once(&indexes_once, init_indexes);
+
+	mtx_lock(&indexes_lock);
+	struct seqf_index *index = indexes;
+	while(index != NULL && (index->keeps == 0 || strcmp(index->path, path) != 0))
+		index = index->next;
+	if(index != NULL) {
+		index->keeps--;
+		seqf_releaseindex(index);
+	}
+	mtx_unlock(&indexes_lock);
+	return index != NULL ? 0 : 1;
+}
+
+
+/*===================================
+|  Internal functions               |
+===================================*/
+extern struct seqf_index *
+seqf_findindex(int fd)
+{
+	call_once(&indexes_once, init_indexes);
+	struct stat st;
+	if(fstat(fd, &st) != 0)
+		return NULL;
+
+	mtx_lock(&indexes_lock);
+	struct seqf_index *index = indexes;
+	while(index != NULL && (index->keeps == 0 || !same_file(index, &st)))
+		index = index->next;
+
+	/* Only one file finds the access points, the others stream it meanwhile */
+	if(index != NULL && !index->built && index->building)
+		index = NULL;
+	if(index != NULL) {
+		index->building = !index->built;
+		index->refs++;
+	}
+	mtx_unlock(&indexes_lock);
+	return index;
+}
+
+extern void
+seqf_closeindex(seqf_statep state)
+{
+	struct seqf_index *index = state->index;
+	if(index == NULL)
+		return;
+	state->index = NULL;
+
+	mtx_lock(&indexes_lock);
+	if(!index->built && index->building) {
+		drop_points(index);
+		index->building = false;
+	}
+	seqf_releaseindex(index);
+	mtx_unlock(&indexes_lock);
+}
+
+extern void
+seqf_releaseindex(struct seqf_index *index)
+{
+	if(--index->refs > 0)
+		return;
+	struct seqf_index **link = &indexes;
+	while(*link != index)
+		link = &(*link)->next;
+	*link = index->next;
+	free_index(index);
+}
+
+#if !defined _IGZIP_H
+extern void
+seqf_markpoint(seqf_statep state, size_t in, size_t out)
+{
+	struct seqf_index *index = state->index;
+	state->index_in += in;
+	state->index_out += out;
+
+	/* Points go at the end of a deflate block, the header counts as the end of none */
+	int type = state->stream.data_type;
+	if(!(type & 128) || (type & 64))
+		return;
+	if(index->num_points != 0 &&
+	   state->index_out - index->points[index->num_points - 1].out < SEQF_SPAN)
+		return;
+
+	if(index->num_points == index->points_size) {
+		uint64_t size = index->points_size ? 2 * index->points_size : 64;
+		struct seqf_point *t = realloc(index->points, size * sizeof *t);
+		if(t == NULL)
+			goto fail;
+		index->points = t;
+		index->points_size = size;
+	}
+
+	struct seqf_point *point = &index->points[index->num_points];
+	point->in = state->index_in;
+	point->out = state->index_out;
+	point->bits = type & 7;
+	point->window_len = 0;
+	point->window = NULL;
+	uInt len = 0;
+	if(state->index_out != 0) {
+		if((point->window = malloc(SEQF_WINDOW)) == NULL ||
+		   inflateGetDictionary(&state->stream, point->window, &len) != Z_OK) {
+			free(point->window);
+			goto fail;
+		}
+		point->window_len = len;
+	}
+	index->num_points++;
+	return;
+
+fail:
+	/* Stream the file from now on, the next reader of the file finds the points */
+	mtx_lock(&indexes_lock);
+	drop_points(index);
+	index->building = false;
+	seqf_releaseindex(index);
+	mtx_unlock(&indexes_lock);
+	state->index = NULL;
+}
+
+extern void
+seqf_endindex(seqf_statep state)
+{
+	struct seqf_index *index = state->index;
+
+	/* Files of several gzip members are streamed, the points only cover the first of them */
+	mtx_lock(&indexes_lock);
+	index->building = false;
+	if(state->index_in == index->size && index->num_points != 0) {
+		index->in_end = state->index_in;
+		index->out_end = state->index_out;
+		index->built = true;
+	} else {
+		drop_points(index);
+		seqf_releaseindex(index);
+		state->index = NULL;
+	}
+	mtx_unlock(&indexes_lock);
+}
+#endif
+
+
+/*===================================
+|  Helper functions                 |
+===================================*/
+static void
+init_indexes(void)
+{
+	mtx_init(&indexes_lock, mtx_plain);
+}
+
+static bool
+same_file(const struct seqf_index *index, const struct stat *st)
+{
+	return index->dev == (uint64_t)st->st_dev && index->ino == (uint64_t)st->st_ino &&
+	       index->size == (uint64_t)st->st_size && index->mtime == (int64_t)st->st_mtime;
+}
+
+static void
+drop_points(struct seqf_index *index)
+{
+	for(uint64_t i=0; i<index->num_points; i++)
+		free(index->points[i].window);
+	index->num_points = 0;
+}
+
+static void
+free_index(struct seqf_index *index)
+{
+	drop_points(index);
+	free(index->points);
+	free(index->path);
+	free(index);
+}
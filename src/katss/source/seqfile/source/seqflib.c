@@ -4,6 +4,7 @@
  * Subject to the MIT License
  */
 
+#include <stdint.h>
 #include <stdlib.h>
 
 #include <fcntl.h>
@@ -20,9 +21,11 @@
     #define O_CREAT _O_CREAT
 #else
     #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
 #endif
 
-#include "seqf_core.h"
+#include "seqf_read.h"
 
 #define EXIT_AND_SETERR(state, _seqferrno) \
 	do { \
@@ -37,20 +40,143 @@ init_seqfstatep(seqf_statep state)
 	state->fd = -1;
 	state->compression = PLAIN;
 	state->type = 'b';
+	state->detected = '\0';
 #ifndef _IGZIP_H
 	state->stream_is_init = false;
+#endif
+#if defined ZSTD_VERSION_NUMBER
+	state->zstd = NULL;
+#endif
+#if defined LZ4F_VERSION
+	state->lz4 = NULL;
 #endif
 	state->in_buf = NULL;
 	state->out_buf = NULL;
 	state->next = NULL;
 	state->have = 0;
+	state->in_pos = 0;
+	state->in_len = 0;
+	state->peek_pos = 0;
+	state->peek_len = 0;
+	state->map = NULL;
+	state->map_size = 0;
+	state->map_pos = 0;
+	state->mem = NULL;
+	state->mem_size = 0;
+	state->mem_pos = 0;
+	state->in_memory = false;
+	state->seekable = false;
+	state->loaded = 0;
 	state->mutex_is_init = false;
 	state->eof = false;
+	state->seqs_skip = 0;
+	state->blocks = NULL;
+	state->block_head = 0;
+	state->block_tail = 0;
+	state->blocks_done = false;
+	state->block_sync_is_init = false;
+	state->index = NULL;
+	state->index_in = 0;
+	state->index_out = 0;
+	state->ahead = NULL;
+	state->list = NULL;
+}
+
+/**
+ * @brief Map a plain file into memory to read it without any system call. Reads of the file
+ * copy out of the mapping, and `seqfview` returns spans of it. The file is read as usual when
+ * it can't be mapped, e.g. a pipe or an empty file.
+ */
+static void
+map_file(seqf_statep state)
+{
+#ifndef _WIN32
+	struct stat st;
+	if(fstat(state->fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0)
+		return;
+	if((unsigned long long)st.st_size > SIZE_MAX)
+		return;
+
+	void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, state->fd, 0);
+	if(map == MAP_FAILED)
+		return;
+#  ifdef MADV_SEQUENTIAL
+	madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+#  endif
+	state->map = map;
+	state->map_size = (size_t)st.st_size;
+	state->map_pos = 0;
+#else
+	(void)state;
+#endif
+}
+
+/**
+ * @brief Tell the type of a file from its first lines, the way katss always has: fastq if at least
+ * two of its first 10 lines are a header or '+' line where they would be, or else fasta if any is a
+ * fasta header. Sequence files need all 10 lines to be mostly nucleotides. Lines are looked for in
+ * the bytes the file is read from first, which are then read as usual, so nothing is read twice.
+ * Sets `detected` to the type found, or '\0' if it could not be told.
+ */
+static int
+detect_type(seqf_statep state)
+{
+	/* Mapped files are looked at where they are, the others through their output buffer */
+	const unsigned char *next, *end;
+	if(state->map != NULL) {
+		next = state->map;
+		end = state->map + state->map_size;
+	} else {
+		if(seqf_fetch(state) != 0)
+			return -1;
+		next = state->next;
+		end = state->next + state->have;
+	}
+	const bool cut = state->map == NULL && state->have == state->out_bufsiz;
+
+	int lines = 0, fastq = 0, fasta = 0, sequences = 0;
+	while(next < end && lines < 10) {
+		const unsigned char *eol = memchr(next, '\n', (size_t)(end - next));
+		const unsigned char *line = next;
+		next = eol != NULL ? eol + 1 : end;
+		lines++;
+
+		if(*line == '@' && lines % 4 == 1) {
+			fastq++;
+		} else if(*line == '+' && lines % 4 == 3) {
+			fastq++;
+		} else if(*line == '>' || *line == ';') {
+			fasta++;
+		} else {
+			/* Nucleotides out of every byte of the line, its newline included */
+			size_t nt = 0, length = (size_t)(next - line);
+			for(size_t i=0; i<length; i++) {
+				switch(line[i] | 0x20) {
+				case 'a': case 'c': case 'g': case 't': case 'u': nt++;
+				}
+			}
+			sequences += (double)nt / length > 0.9;
+		}
+	}
+
+	/* Lines cut short by the end of the buffer, on files of long reads, still count */
+	if(fastq >= 2)
+		state->detected = 'q';
+	else if(fasta > 0)
+		state->detected = 'a';
+	else if(lines > 0 && sequences == lines && (lines == 10 || (cut && next == end)))
+		state->detected = 's';
+	else
+		state->detected = '\0';
+	return 0;
 }
 
 static bool
-extract_mode(seqf_statep state, const char *mode)
+extract_mode(seqf_statep state, const char *mode, bool *map, bool *ahead, bool *detect)
 {
+	*map = false;
+	*ahead = false;
+	*detect = false;
 	if(mode == NULL)
 		return true;
 
@@ -59,25 +185,42 @@ extract_mode(seqf_statep state, const char *mode)
 		switch(*mode++) {
 		case 'a': 
 			if(type_set) return false;
-			state->type = 'a'; break; /* fasta file */
+			state->type = 'a'; type_set = true; break; /* fasta file */
 		case 'q': 
 			if(type_set) return false;
-			state->type = 'q'; break; /* fastq file */
+			state->type = 'q'; type_set = true; break; /* fastq file */
 		case 's':
 			if(type_set) return false;
-			state->type = 's'; break; /* sequences file */
+			state->type = 's'; type_set = true; break; /* sequences file */
 		case 'b':
 			if(type_set) return false;
-			state->type = 'b'; break; /* binary file*/
-		case '\0': return true;
+			state->type = 'b'; type_set = true; break; /* binary file*/
+		case 'm':
+			if(*map) return false;
+			*map = true; break; /* map plain file into memory */
+		case 't':
+			if(*ahead) return false;
+			*ahead = true; break; /* read file ahead on a thread */
+		case 'd':
+			if(*detect) return false;
+			*detect = true; break; /* detect type of file */
+		case '\0':
+			if(*detect && !type_set)
+				state->type = '\0'; /* read as the type detected */
+			return true;
 		default: return false;
 		}
 	} while(true);
 }
 
 
-SeqFile
-seqfdopen(int fd, const char *mode)
+/**
+ * @brief Open the SeqFile of a file descriptor, or of the buffer `mem` of `mem_size` bytes when it
+ * isn't NULL (`fd` is then -1). Buffers are read the way a file holding them would be, but never
+ * in blocks, since they have no file to read blocks from.
+ */
+static SeqFile
+open_source(int fd, const unsigned char *mem, size_t mem_size, const char *mode)
 {
 	seqferrno_ = 0; // no error encountered. yet.
 
@@ -91,7 +234,10 @@ seqfdopen(int fd, const char *mode)
 
 	/* Open file and check for errors */
 	seq_file->fd = fd;
-	if(fd < 0)
+	seq_file->in_memory = mem != NULL;
+	seq_file->mem = mem;
+	seq_file->mem_size = mem_size;
+	if(fd < 0 && mem == NULL)
 		EXIT_AND_SETERR(seq_file, 1);
 
 	/* Initialize mutex */
@@ -110,29 +256,73 @@ seqfdopen(int fd, const char *mode)
 	seq_file->out_bufsiz = 2*SEQFBUFSIZ;
 	seq_file->next = seq_file->out_buf;
 
-	/* Determine type of compression, if any */
+	/* Determine type of compression, if any. BGZF has its block size in the gzip header */
 	size_t nread = 0;
-	do {
-		size_t n = read(seq_file->fd, seq_file->in_buf, 2);
+	if(seq_file->in_memory) {
+		nread = MIN2(mem_size, 18);
+		memcpy(seq_file->in_buf, mem, nread);
+	} else do {
+		size_t n = read(seq_file->fd, seq_file->in_buf + nread, 18 - nread);
 		if(n == -1) EXIT_AND_SETERR(seq_file, 3);
 		if(n == 0) break; // reached EOF before reading magic bytes
 		nread += n;
-	} while(nread != 2);
+	} while(nread != 18);
+	const unsigned char *magic = seq_file->in_buf;
 	if(nread < 2) {
 		seq_file->compression = PLAIN;
-	} if(seq_file->in_buf[0] == 0x1F && seq_file->in_buf[1] == 0x8B) {
+	} else if(nread == 18 && magic[0] == 0x1F && magic[1] == 0x8B && (magic[3] & 4) &&
+	  magic[12] == 'B' && magic[13] == 'C' && magic[14] == 2 && magic[15] == 0) {
+		seq_file->compression = BGZF;
+	} else if(magic[0] == 0x1F && magic[1] == 0x8B) {
 		seq_file->compression = GZIP;
 	} else if (seq_file->in_buf[0] == 0x78 && (seq_file->in_buf[1] == 0x01 || 
 	  seq_file->in_buf[1] == 0x5E || seq_file->in_buf[1] == 0x9C || 
 	  seq_file->in_buf[1] == 0xDA)) {
         seq_file->compression = ZLIB;
-    } else {
+    } else if(nread >= 4 && ((magic[0] == 0x28 && magic[1] == 0xB5 && magic[2] == 0x2F &&
+	  magic[3] == 0xFD) || ((magic[0] & 0xF0) == 0x50 && magic[1] == 0x2A && magic[2] == 0x4D &&
+	  magic[3] == 0x18))) { /* zstd frame, or a skippable frame */
+		seq_file->compression = ZSTD;
+	} else if(nread >= 4 && magic[0] == 0x04 && magic[1] == 0x22 && magic[2] == 0x4D &&
+	  magic[3] == 0x18) {
+		seq_file->compression = LZ4;
+	} else {
 		seq_file->compression = PLAIN;
 	}
-	lseek(seq_file->fd, 0, SEEK_SET);
+
+	/* Pipes can't be read from the start again, so the bytes read are kept to be read first. Their
+	   blocks can't be found ahead either, BGZF files are inflated as the gzip files they are, and
+	   so are buffers, which were only looked at */
+	const bool seekable = !seq_file->in_memory && lseek(seq_file->fd, 0, SEEK_SET) != -1;
+	seq_file->seekable = seekable || seq_file->in_memory;
+	if(seq_file->in_memory) {
+		if(seq_file->compression == BGZF)
+			seq_file->compression = GZIP;
+	} else if(!seekable) {
+		memcpy(seq_file->peek, magic, nread);
+		seq_file->peek_len = nread;
+		if(seq_file->compression == BGZF)
+			seq_file->compression = GZIP;
+	}
+
+	/* BGZF blocks are inflated on their own, as are gzip files with access points and zstd
+	   files whose first frame is small enough to be a block, e.g. files of many frames */
+	if(seq_file->compression == GZIP && seekable)
+		seq_file->index = seqf_findindex(seq_file->fd);
+	bool frames = false;
+#if defined ZSTD_VERSION_NUMBER
+	if(seq_file->compression == ZSTD && seekable) {
+		unsigned long long size = ZSTD_getFrameContentSize(magic, nread);
+		frames = size <= SEQF_FRAME; /* Unknown sizes and errors are above it */
+	}
+#endif
+	if(seq_file->compression == BGZF || frames || (seq_file->index && seq_file->index->built)) {
+		if(seqf_initblocks(seq_file) != 0)
+			EXIT_AND_SETERR(seq_file, 6);
+	}
 
 	/* Initialize decompressor */
-	if(seq_file->compression != PLAIN) {
+	if(seq_file->compression == GZIP || seq_file->compression == ZLIB) {
 #if defined _IGZIP_H
 		isal_inflate_init(&seq_file->stream);
 		seq_file->stream.crc_flag = seq_file->compression == GZIP ? ISAL_GZIP : ISAL_ZLIB;
@@ -160,12 +350,116 @@ seqfdopen(int fd, const char *mode)
 #endif
 	}
 
-	if(!extract_mode(seq_file, mode))
+	/* Zstd and lz4 files need a decompressor of their own, when SeqFile was built with one */
+	if(seq_file->compression == ZSTD && !frames) {
+#if defined ZSTD_VERSION_NUMBER
+		if((seq_file->zstd = ZSTD_createDCtx()) == NULL)
+			EXIT_AND_SETERR(seq_file, 6);
+#else
+		EXIT_AND_SETERR(seq_file, 9);
+#endif
+	} else if(seq_file->compression == LZ4) {
+#if defined LZ4F_VERSION
+		if(LZ4F_isError(LZ4F_createDecompressionContext(&seq_file->lz4, LZ4F_VERSION)))
+			EXIT_AND_SETERR(seq_file, 6);
+#else
+		EXIT_AND_SETERR(seq_file, 9);
+#endif
+	}
+
+	bool map, ahead, detect;
+	if(!extract_mode(seq_file, mode, &map, &ahead, &detect))
 		EXIT_AND_SETERR(seq_file, 3);
+	if(map && seq_file->compression == PLAIN && seq_file->in_memory) {
+		seq_file->map = (unsigned char *)mem; /* Only ever read */
+		seq_file->map_size = mem_size;
+	} else if(map && seq_file->compression == PLAIN) {
+		map_file(seq_file);
+	}
+
+	/* Mapped files are already in memory, there is nothing to read ahead */
+	if(ahead && seq_file->map == NULL && seqf_startahead(seq_file) != 0)
+		EXIT_AND_SETERR(seq_file, 2);
+
+	/* The type is told from the first bytes read, without reading them again */
+	if(!detect) {
+		seq_file->detected = seq_file->type;
+	} else {
+		if(detect_type(seq_file) != 0)
+			EXIT_AND_SETERR(seq_file, seqferrno_ ? seqferrno_ : 3);
+		if(seq_file->type == '\0')
+			seq_file->type = seq_file->detected ? seq_file->detected : 'b';
+	}
 
 	return (SeqFile)seq_file;
 }
 
+
+SeqFile
+seqfdopen(int fd, const char *mode)
+{
+	return open_source(fd, NULL, 0, mode);
+}
+
+SeqFile
+seqfopenlist(const char *const *paths, int num_paths, const char *mode)
+{
+	seqferrno_ = 0;
+	if(paths == NULL || num_paths < 1) {
+		seqferrno_ = 10;
+		return NULL;
+	}
+
+	/* The list has no file of its own, only the mutex its readers take files with */
+	seqf_statep state = malloc(sizeof *state);
+	if(state == NULL)
+		EXIT_AND_SETERR(state, 6);
+	init_seqfstatep(state);
+	if(mtx_init(&state->mutex, mtx_plain) != thrd_success)
+		EXIT_AND_SETERR(state, 2);
+	state->mutex_is_init = true;
+
+	struct seqf_list *list = calloc(1, sizeof *list);
+	if(list == NULL)
+		EXIT_AND_SETERR(state, 6);
+	state->list = list;
+	list->files = calloc(num_paths, sizeof *list->files);
+	list->readers = calloc(num_paths, sizeof *list->readers);
+	list->done = calloc(num_paths, sizeof *list->done);
+	list->open_lines = calloc(num_paths, sizeof *list->open_lines);
+	if(list->files == NULL || list->readers == NULL || list->done == NULL ||
+	   list->open_lines == NULL)
+		EXIT_AND_SETERR(state, 6);
+
+	/* Open every file, all of them with the same mode */
+	for(int i=0; i<num_paths; i++) {
+		list->files[i] = (seqf_statep)seqfopen(paths[i], mode);
+		if(list->files[i] == NULL)
+			EXIT_AND_SETERR(state, seqferrno_);
+		list->num_files++;
+	}
+
+	/* Files of different types have none as a list, and are read as the type of the first one */
+	state->type = list->files[0]->type;
+	state->detected = list->files[0]->detected;
+	for(int i=1; i<num_paths; i++) {
+		if(list->files[i]->detected != state->detected)
+			state->detected = '\0';
+	}
+	return (SeqFile)state;
+}
+
+SeqFile
+seqfmemopen(const void *buffer, size_t size, const char *mode)
+{
+	static const unsigned char empty[1];
+	if(buffer == NULL && size != 0) {
+		seqferrno_ = 3;
+		return NULL;
+	}
+	return open_source(-1, buffer != NULL ? buffer : empty, size, mode);
+}
+
 SeqFile
 seqfopen(const char *path, const char *mode)
 {
@@ -188,8 +482,17 @@ seqfclose(SeqFile file)
 		return 1;
 	int return_code = 0;
 	seqf_statep state = (seqf_statep)file;
+	if(state->list != NULL && seqf_closelist(state) != 0)
+		return_code = 1;
+	seqf_stopahead(state);
 	if(state->fd > 2 && close(state->fd) == -1)
 		return_code = seqferrno_ = 1;
+#ifndef _WIN32
+	if(state->map && !state->in_memory)
+		munmap(state->map, state->map_size);
+#endif
+	seqf_freeblocks(state);
+	seqf_closeindex(state);
 	if(state->mutex_is_init)
 		mtx_destroy(&state->mutex);
 	if(state->in_buf)
@@ -199,6 +502,13 @@ seqfclose(SeqFile file)
 #ifndef _IGZIP_H
 	if(state->stream_is_init)
 		inflateEnd(&state->stream);
+#endif
+#if defined ZSTD_VERSION_NUMBER
+	ZSTD_freeDCtx(state->zstd);
+#endif
+#if defined LZ4F_VERSION
+	if(state->lz4)
+		LZ4F_freeDecompressionContext(state->lz4);
 #endif
 	free(state);
 	return return_code;
@@ -210,12 +520,36 @@ seqfrewind(SeqFile file)
 	if(file == NULL)
 		return -1;
 	seqf_statep state = (seqf_statep)file;
-	if(lseek(state->fd, 0, SEEK_SET)==-1) {
+	if(state->list != NULL)
+		return seqf_rewindlist(state);
+
+	/* Pipes are only at their start again if no byte was taken from them yet, e.g. to tell their
+	   type, which leaves every byte they loaded in the output buffer */
+	if(!state->seekable && state->next == state->out_buf && state->have == state->loaded)
+		return 0;
+	bool ahead = state->ahead != NULL;
+	seqf_stopahead(state);
+	if(!state->in_memory && lseek(state->fd, 0, SEEK_SET)==-1) {
 		seqferrno_ = 1;
 		return -1;
 	}
 	state->have = 0;
+	state->loaded = 0;
+	state->map_pos = 0;
+	state->mem_pos = 0;
 	state->eof = false;
+	state->seqs_skip = 0;
+
+	/* Access points found in the last pass are read from, or found again if it stopped early */
+	if(state->index != NULL && !state->index->built) {
+		seqf_closeindex(state);
+		state->index = seqf_findindex(state->fd);
+	}
+	if(state->index != NULL && state->index->built && seqf_initblocks(state) != 0)
+		return -1;
+	seqf_resetblocks(state);
+	state->index_in = 0;
+	state->index_out = 0;
 #if defined _IGZIP_H
 	isal_inflate_reset(&state->stream);
 	state->stream.crc_flag = state->compression == GZIP ? ISAL_GZIP : ISAL_ZLIB;
@@ -235,6 +569,18 @@ seqfrewind(SeqFile file)
 		state->stream.avail_in = 0;
 	}
 #endif
+	state->in_pos = 0;
+	state->in_len = 0;
+#if defined ZSTD_VERSION_NUMBER
+	if(state->zstd)
+		ZSTD_DCtx_reset(state->zstd, ZSTD_reset_session_only);
+#endif
+#if defined LZ4F_VERSION
+	if(state->lz4)
+		LZ4F_resetDecompressionContext(state->lz4);
+#endif
+	if(ahead && seqf_startahead(state) != 0)
+		return -1;
 	return 0;
 }
 
@@ -244,18 +590,88 @@ seqfeof(SeqFile file)
 	return ((seqf_statep)file)->eof;
 }
 
+char
+seqftype(SeqFile file)
+{
+	return file != NULL ? (char)((seqf_statep)file)->detected : '\0';
+}
+
+bool
+seqfismapped(SeqFile file)
+{
+	return file != NULL && ((seqf_statep)file)->map != NULL;
+}
+
+bool
+seqfisahead(SeqFile file)
+{
+	if(file == NULL)
+		return false;
+	const struct seqf_list *list = ((seqf_statep)file)->list;
+	if(list != NULL)
+		return seqfisahead((SeqFile)list->files[0]);
+	return ((seqf_statep)file)->ahead != NULL;
+}
+
+int
+seqfsetahead(SeqFile file, bool ahead)
+{
+	if(file == NULL)
+		return -1;
+	seqf_statep state = (seqf_statep)file;
+	if(state->list != NULL) {
+		int ret = 0;
+		for(int i=0; i<state->list->num_files; i++) {
+			int r = seqfsetahead((SeqFile)state->list->files[i], ahead);
+			if(r != 0 && ret >= 0)
+				ret = r;
+		}
+		return ret;
+	}
+	if(!ahead) {
+		if(state->ahead == NULL)
+			return 0;
+
+		/* Bytes read ahead were taken from the file, so they must be read first */
+		seqf_pauseahead(state);
+		const struct seqf_ahead *t = state->ahead;
+		for(uint64_t i=t->head; i<t->tail; i++) {
+			const struct seqf_ahead_buf *slot = &t->bufs[i % SEQF_AHEAD];
+			if(slot->ret == 0 && slot->pos < slot->len)
+				return seqf_startahead(state) == 0 ? 1 : -1;
+		}
+		seqf_stopahead(state);
+		return 0;
+	}
+	if(state->map != NULL)
+		return 0;
+	return seqf_startahead(state);
+}
+
 int
 seqfsetibuf(SeqFile file, size_t bufsize)
 {
 	if(file == NULL)
 		return -1;
 	seqf_statep state = (seqf_statep)file;
+	if(state->list != NULL) {
+		for(int i=0; i<state->list->num_files; i++) {
+			if(seqfsetibuf((SeqFile)state->list->files[i], bufsize) != 0)
+				return -1;
+		}
+		return 0;
+	}
 
+	/* The thread reading ahead inflates from the input buffer */
+	seqf_pauseahead(state);
 	unsigned char *t = realloc(state->in_buf, bufsize);
-	if(t == NULL) return -1;
-	state->in_buf = t;
-	state->in_bufsiz = bufsize;
-	return 0;
+	if(t != NULL) {
+		state->in_buf = t;
+		state->in_bufsiz = bufsize;
+	}
+	if(state->ahead != NULL && seqf_startahead(state) != 0)
+		return -1;
+	return t != NULL ? 0 : -1;
 }
 
 int
@@ -264,6 +680,13 @@ seqfsetobuf(SeqFile file, size_t bufsize)
 	if(file == NULL)
 		return -1;
 	seqf_statep state = (seqf_statep)file;
+	if(state->list != NULL) {
+		for(int i=0; i<state->list->num_files; i++) {
+			if(seqfsetobuf((SeqFile)state->list->files[i], bufsize) != 0)
+				return -1;
+		}
+		return 0;
+	}
 
 	unsigned char *t = realloc(state->out_buf, bufsize);
 	if(t == NULL) return -1;
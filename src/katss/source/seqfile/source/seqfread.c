@@ -24,10 +24,13 @@ size_t
 seqfread(SeqFile file, char *buffer, size_t bufsize)
 {
 	seqf_statep state = (seqf_statep)file;
+	if(state->list != NULL)
+		return seqf_listread(state, seqf_read, (unsigned char *)buffer, bufsize);
 
-	mtx_lock(&state->mutex);
+	seqf_lock(&state->mutex);
 	size_t bytes_read = seqf_read(state, (unsigned char *)buffer, bufsize);
 	mtx_unlock(&state->mutex);
+	seqf_prefetch(state);
 
 	return bytes_read;
 }
@@ -35,7 +38,87 @@ seqfread(SeqFile file, char *buffer, size_t bufsize)
 size_t
 seqfread_unlocked(SeqFile file, char *buffer, size_t bufsize)
 {
-	return seqf_read((seqf_statep)file, (unsigned char *)buffer, bufsize);
+	seqf_statep state = (seqf_statep)file;
+	if(state->list != NULL)
+		return seqf_listread_unlocked(state, seqf_read, (unsigned char *)buffer, bufsize);
+	return seqf_read(state, (unsigned char *)buffer, bufsize);
+}
+
+size_t
+seqfreadseqs(SeqFile file, char *buffer, size_t bufsize)
+{
+	seqf_statep state = (seqf_statep)file;
+	if(state->list != NULL)
+		return seqf_listread(state, seqf_seqs, (unsigned char *)buffer, bufsize);
+
+	seqf_lock(&state->mutex);
+	size_t bytes_read = seqf_seqs(state, (unsigned char *)buffer, bufsize);
+	mtx_unlock(&state->mutex);
+	seqf_prefetch(state);
+
+	return bytes_read;
+}
+
+size_t
+seqfreadseqs_unlocked(SeqFile file, char *buffer, size_t bufsize)
+{
+	seqf_statep state = (seqf_statep)file;
+	if(state->list != NULL)
+		return seqf_listread_unlocked(state, seqf_seqs, (unsigned char *)buffer, bufsize);
+	return seqf_seqs(state, (unsigned char *)buffer, bufsize);
+}
+
+size_t
+seqfview_unlocked(SeqFile file, const char **span, size_t maxsize)
+{
+	seqf_statep state = (seqf_statep)file;
+	*span = NULL;
+	if(state->map == NULL) {
+		seqferrno_ = 7;
+		return 0;
+	}
+
+	/* Bytes still buffered by the other readers are the ones right before the mapping's position */
+	state->map_pos -= state->have;
+	state->have = 0;
+
+	size_t left = state->map_size - state->map_pos;
+	size_t n = MIN2(left, maxsize);
+	if(n == 0) {
+		state->eof = true;
+		return 0;
+	}
+
+	/* Sequences end the span on the last full line, or the end of a line too long for it */
+	const unsigned char *start = state->map + state->map_pos;
+	if(state->type == 's' && n < left) {
+		size_t end = n;
+		while(end && start[end - 1] != '\n')
+			end--;
+		if(end == 0) {
+			const unsigned char *eol = memchr(start + n, '\n', left - n);
+			end = eol != NULL ? (size_t)(eol - start) + 1 : left;
+		}
+		n = end;
+	}
+
+	state->map_pos += n;
+	*span = (const char *)start;
+	SEQF_STAT_ADD(bytes_read, n);
+	SEQF_STAT_RECORDS(start, n, state->type);
+	return n;
+}
+
+size_t
+seqfview(SeqFile file, const char **span, size_t maxsize)
+{
+	seqf_statep state = (seqf_statep)file;
+
+	seqf_lock(&state->mutex);
+	size_t bytes_viewed = seqfview_unlocked(file, span, maxsize);
+	mtx_unlock(&state->mutex);
+
+	return bytes_viewed;
 }
 
 static char *
@@ -49,7 +132,6 @@ seqf_line(seqf_statep state, unsigned char *buffer, size_t bufsize)
 
 	/* Declare variables */
 	register size_t n, left = bufsize - 1;
-	register unsigned char *str = buffer;
 	register unsigned char *eol;
 
 	/* Begin filling buffer */
@@ -73,7 +155,8 @@ seqf_line(seqf_statep state, unsigned char *buffer, size_t bufsize)
 	} while(left && eol == NULL);
 
 	buffer[0] = '\0';
-	return (char *)str;
+	SEQF_STAT_ADD(records, 1);
+	return (char *)buffer;
 }
 
 char *
@@ -82,6 +165,8 @@ seqfgets_unlocked(SeqFile file, char *buffer, size_t bufsize)
 	if(file == NULL)
 		return NULL;
 	seqf_statep state = (seqf_statep)file;
+	if(state->list != NULL)
+		return seqf_listgets(state, seqfgets_unlocked, buffer, bufsize);
 
 	switch(state->type) {
 	case 'a':
@@ -91,7 +176,7 @@ seqfgets_unlocked(SeqFile file, char *buffer, size_t bufsize)
 	case 's':
 		return seqfsgets_unlocked(file, buffer, bufsize);
 	case 'b':
-		return seqf_line(state, (unsigned char *)buffer, bufsize);
+		return seqf_line(state, (unsigned char *)buffer, bufsize) ? buffer : NULL;
 	default:
 		seqferrno_ = 5;
 		return NULL;
@@ -105,17 +190,79 @@ seqfgets(SeqFile file, char *buffer, size_t bufsize)
 		return NULL;
 	seqf_statep state = (seqf_statep)file;
 
-	mtx_lock(&state->mutex);
+	seqf_lock(&state->mutex);
 	char *ret = seqfgets_unlocked(file, buffer, bufsize);
 	mtx_unlock(&state->mutex);
+	seqf_prefetch(state);
 
 	return ret;
 }
 
+static size_t
+seqf_readbatch(seqf_statep state, unsigned char *buffer, size_t bufsize, size_t recsize,
+               size_t *ends, size_t maxrecords)
+{
+	if(recsize == 0) {
+		seqferrno_ = 5;
+		return 0;
+	}
+	if(state->list != NULL)
+		return seqf_listbatch(state, (char *)buffer, bufsize, recsize, ends, maxrecords);
+
+	/* Every record gets `recsize` bytes, so none of them is cut short by the end of the batch */
+	size_t used = 0, records = 0;
+	while(records < maxrecords && bufsize - used >= recsize) {
+		char *end;
+		switch(state->type) {
+		case 'a': end = seqf_agets(state, buffer + used, recsize); break;
+		case 'q': end = seqf_qgets(state, buffer + used, recsize); break;
+		case 's': end = seqf_sgets(state, buffer + used, recsize); break;
+		case 'b': end = seqf_line(state, buffer + used, recsize); break;
+		default:
+			seqferrno_ = 5;
+			return 0;
+		}
+		if(end == NULL)
+			break;
+		ends[records++] = (size_t)((unsigned char *)end - buffer);
+		used = ends[records - 1] + 1;
+	}
+	return records;
+}
+
+size_t
+seqfreadbatch(SeqFile file, char *buffer, size_t bufsize, size_t recsize, size_t *ends,
+              size_t maxrecords)
+{
+	if(file == NULL)
+		return 0;
+	seqf_statep state = (seqf_statep)file;
+
+	seqf_lock(&state->mutex);
+	size_t records = seqf_readbatch(state, (unsigned char *)buffer, bufsize, recsize, ends,
+	                                maxrecords);
+	mtx_unlock(&state->mutex);
+	seqf_prefetch(state);
+
+	return records;
+}
+
+size_t
+seqfreadbatch_unlocked(SeqFile file, char *buffer, size_t bufsize, size_t recsize, size_t *ends,
+                       size_t maxrecords)
+{
+	if(file == NULL)
+		return 0;
+	return seqf_readbatch((seqf_statep)file, (unsigned char *)buffer, bufsize, recsize, ends,
+	                      maxrecords);
+}
+
 int
 seqfgetc_unlocked(SeqFile file)
 {
 	seqf_statep state = (seqf_statep)file;
+	if(state != NULL && state->list != NULL)
+		return seqf_listgetc(state, seqfgetc_unlocked);
 	if(state == NULL || state->eof)
 		return EOF;
 	if(state->have == 0 && seqf_fetch(state) != 0)
@@ -131,7 +278,7 @@ seqfgetc(SeqFile file)
 {
 	seqf_statep state = (seqf_statep)file;
 
-	mtx_lock(&state->mutex);
+	seqf_lock(&state->mutex);
 	int ret = seqfgetc_unlocked(file);
 	mtx_unlock(&state->mutex);
 
@@ -141,7 +288,11 @@ seqfgetc(SeqFile file)
 int
 seqfgetnt_unlocked(SeqFile file)
 {
-	switch(((seqf_statep)file)->type) {
+	seqf_statep state = (seqf_statep)file;
+	if(state->list != NULL)
+		return seqf_listgetc(state, seqfgetnt_unlocked);
+
+	switch(state->type) {
 	case 'a': return seqfagetnt_unlocked(file);
 	case 'q': return seqfqgetnt_unlocked(file);
 	case 's': return seqfsgetnt_unlocked(file);
@@ -155,7 +306,7 @@ seqfgetnt(SeqFile file)
 {
 	seqf_statep state = (seqf_statep)file;
 
-	mtx_lock(&state->mutex);
+	seqf_lock(&state->mutex);
 	int ret = seqfgetnt_unlocked(file);
 	mtx_unlock(&state->mutex);
 
@@ -17,14 +17,18 @@ strerror_r(int errnum, char *buf, size_t bufsize)
 }
 #endif
 
-static const char seqf_err_msg[7][60] = {
+static const char seqf_err_msg[11][60] = {
 	"No error",
 	"Mutex failed to initialize",
 	"Invalid mode passed to seqfopen",
 	"Read failed, could not determine type of file",
 	"Read failed, sequence is larger than input buffer",
 	"Out of memory",
-	"gets failed, sequence is larger than passed buffer"
+	"gets failed, sequence is larger than passed buffer",
+	"View failed, file is not mapped into memory",
+	"Inflate failed, compressed block is corrupt",
+	"Open failed, compression not supported by this build",
+	"Open failed, list of files is empty"
 };
 
 static const char seqf_undeferr[19] = "Unrecognized error";
@@ -34,7 +38,7 @@ seqfstrerror_r(int _rnaferrno, char *buffer, size_t bufsize)
 {
 	if(_rnaferrno == 1)
 		return strerror_r(errno, buffer, bufsize);
-	if(0 <= _rnaferrno && _rnaferrno <= 7)
+	if(0 <= _rnaferrno && _rnaferrno <= 10)
 		strncpy(buffer, seqf_err_msg[_rnaferrno], bufsize);
 	else
 		strncpy(buffer, seqf_undeferr, bufsize);
@@ -48,7 +52,7 @@ seqfstrerror(int _rnaferrno)
 {
 	if(_rnaferrno == 1)
 		return strerror(errno);
-	if(0 <= _rnaferrno && _rnaferrno <= 7)
+	if(0 <= _rnaferrno && _rnaferrno <= 10)
 		return seqf_err_msg[_rnaferrno];
 	return seqf_undeferr;
 }
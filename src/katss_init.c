@@ -7,20 +7,41 @@ tools::package_native_routine_registration_skeleton(".")
 #include <stdlib.h> // for NULL
 #include <R_ext/Rdynload.h>
 
+#include "counter.h"
+
 /* FIXME: 
    Check these declarations against the C/Fortran source code.
 */
 
+/* ALTREP classes, see katss_wrapper.c */
+extern void katss_init_altrep(DllInfo *dll);
+
 /* .Call calls */
-extern SEXP count_kmers_R(void *, void *, void *, void *, void *, void *, void *, void *, void *);
-extern SEXP enrichments_R(void *, void *, void *, void *, void *, void *, void *, void *, void *, void *);
+extern SEXP cache_counts_R(void *, void *, void *, void *);
+extern SEXP count_kmers_R(void *, void *, void *, void *, void *, void *, void *, void *, void *, void *, void *, void *, void *, void *);
+extern SEXP counter_source_R(void *);
+extern SEXP enrichments_R(void *, void *, void *, void *, void *, void *, void *, void *, void *, void *, void *, void *, void *, void *);
+extern SEXP enrichments_batch_R(void *, void *, void *, void *, void *, void *, void *, void *, void *, void *, void *, void *);
+extern SEXP handle_name_R(void *);
 extern SEXP ikke_R(void *, void *, void *, void *, void *, void *, void *);
+extern SEXP katss_counter_R(void *, void *, void *, void *);
+extern SEXP katss_sequences_R(void *);
+extern SEXP save_counts_R(void *, void *, void *, void *, void *);
+extern SEXP seqmatches_R(void *, void *, void *, void *);
 extern SEXP seqseq_R(void *, void *, void *);
 
 static const R_CallMethodDef CallEntries[] = {
-    {"count_kmers_R", (DL_FUNC) &count_kmers_R,  9},
-    {"enrichments_R", (DL_FUNC) &enrichments_R, 10},
+    {"cache_counts_R", (DL_FUNC) &cache_counts_R, 4},
+    {"count_kmers_R", (DL_FUNC) &count_kmers_R, 14},
+    {"counter_source_R", (DL_FUNC) &counter_source_R, 1},
+    {"enrichments_R", (DL_FUNC) &enrichments_R, 14},
+    {"enrichments_batch_R", (DL_FUNC) &enrichments_batch_R, 12},
+    {"handle_name_R", (DL_FUNC) &handle_name_R, 1},
     {"ikke_R",        (DL_FUNC) &ikke_R,         7},
+    {"katss_counter_R", (DL_FUNC) &katss_counter_R, 4},
+    {"katss_sequences_R", (DL_FUNC) &katss_sequences_R, 1},
+    {"save_counts_R", (DL_FUNC) &save_counts_R,  5},
+    {"seqmatches_R",  (DL_FUNC) &seqmatches_R,   4},
     {"seqseq_R",      (DL_FUNC) &seqseq_R,       3},
     {NULL, NULL, 0}
 };
@@ -29,4 +50,12 @@ void R_init_rkats(DllInfo *dll)
 {
     R_registerRoutines(dll, NULL, CallEntries, NULL, NULL);
     R_useDynamicSymbols(dll, FALSE);
+    katss_init_altrep(dll);
+}
+
+void R_unload_rkats(DllInfo *dll)
+{
+    /* Worker threads would be left running code that is no longer mapped */
+    katss_shutdown_pool();
+    katss_disable_count_cache();
 }
@@ -1,5 +1,10 @@
+#include <limits.h>
+#include <string.h>
+
 #include <R.h>
 #include <Rinternals.h>
+#include <R_ext/Rdynload.h>
+#include <R_ext/Altrep.h>
 
 #include "katss.h"
 
@@ -13,109 +18,274 @@
 #define ALGO_RVALS 1
 #define ALGO_IKKES 2
 
+/* K-mer strings of a data.frame, made from their hashes only once R reads them */
+static R_altrep_class_t kmers_class;
+
+/* Largest k-mer whose hashes R doubles hold exactly */
+#define HASHES_MAX_KMER 26
+
+
+/* kmers_length: number of k-mers, from the raw vector holding their hashes */
+static R_xlen_t
+kmers_length(SEXP x)
+{
+	return XLENGTH(VECTOR_ELT(R_altrep_data1(x), 0)) / sizeof(uint64_t);
+}
+
+
+/* kmers_elt: string of the i-th k-mer, decoded from its hash unless every string was made */
+static SEXP
+kmers_elt(SEXP x, R_xlen_t i)
+{
+	SEXP strings = R_altrep_data2(x);
+	if(strings != R_NilValue)
+		return STRING_ELT(strings, i);
+
+	SEXP state = R_altrep_data1(x);
+	uint64_t hash;
+	memcpy(&hash, RAW(VECTOR_ELT(state, 0)) + i * sizeof hash, sizeof hash);
+	char kseq[33];
+	katss_unhash64(kseq, hash, INTEGER(VECTOR_ELT(state, 1))[0], true);
+	return mkChar(kseq);
+}
+
+
+/* kmers_materialize: make every string at once, for code that reads the vector as an array */
+static SEXP
+kmers_materialize(SEXP x)
+{
+	SEXP strings = R_altrep_data2(x);
+	if(strings != R_NilValue)
+		return strings;
+
+	R_xlen_t length = kmers_length(x);
+	strings = PROTECT(allocVector(STRSXP, length));
+	for(R_xlen_t i=0; i < length; i++)
+		SET_STRING_ELT(strings, i, kmers_elt(x, i));
+	R_set_altrep_data2(x, strings);
+	UNPROTECT(1);
+	return strings;
+}
+
+
+static void *
+kmers_dataptr(SEXP x, Rboolean writeable)
+{
+	return (void *)STRING_PTR_RO(kmers_materialize(x));
+}
+
+
+static const void *
+kmers_dataptr_or_null(SEXP x)
+{
+	SEXP strings = R_altrep_data2(x);
+	return strings == R_NilValue ? NULL : (const void *)STRING_PTR_RO(strings);
+}
+
+
+static void
+kmers_set_elt(SEXP x, R_xlen_t i, SEXP value)
+{
+	SET_STRING_ELT(kmers_materialize(x), i, value);
+}
+
+
+/* Decoded k-mers are never NA, strings set in their place may be */
+static int
+kmers_no_na(SEXP x)
+{
+	return R_altrep_data2(x) == R_NilValue;
+}
+
+
+/* Saved as the hashes and k-mer length, which are a fraction of the strings */
+static SEXP
+kmers_serialized_state(SEXP x)
+{
+	return R_altrep_data2(x) == R_NilValue ? R_altrep_data1(x) : NULL;
+}
+
+
+static SEXP
+kmers_unserialize(SEXP class, SEXP state)
+{
+	return R_new_altrep(kmers_class, state, R_NilValue);
+}
+
+
+/* katss_init_altrep: register the class of the k-mer columns, when the package is loaded */
+void
+katss_init_altrep(DllInfo *dll)
+{
+	kmers_class = R_make_altstring_class("katss_kmers", "rkats", dll);
+	R_set_altrep_Length_method(kmers_class, kmers_length);
+	R_set_altrep_Serialized_state_method(kmers_class, kmers_serialized_state);
+	R_set_altrep_Unserialize_method(kmers_class, kmers_unserialize);
+	R_set_altvec_Dataptr_method(kmers_class, kmers_dataptr);
+	R_set_altvec_Dataptr_or_null_method(kmers_class, kmers_dataptr_or_null);
+	R_set_altstring_Elt_method(kmers_class, kmers_elt);
+	R_set_altstring_Set_elt_method(kmers_class, kmers_set_elt);
+	R_set_altstring_No_NA_method(kmers_class, kmers_no_na);
+}
+
+
+/* kmer_column: the k-mer strings of `data`, decoded as R reads them, along with their hashes
+   as integers (or doubles past 15 bases) in `hash_column` if it isn't NULL */
+static SEXP
+kmer_column(KatssData *data, unsigned int kmer, SEXP *hash_column)
+{
+	uint64_t capacity = data->num_kmers;
+	SEXP hashes = PROTECT(allocVector(RAWSXP, capacity * sizeof(uint64_t)));
+	uint64_t *hashes_p = (uint64_t *)RAW(hashes);
+	for(uint64_t i=0; i < capacity; i++)
+		hashes_p[i] = data->kmers[i].kmer;
+
+	if(hash_column != NULL && kmer <= 15) {
+		*hash_column = PROTECT(allocVector(INTSXP, capacity));
+		int *column_p = INTEGER(*hash_column);
+		for(uint64_t i=0; i < capacity; i++)
+			column_p[i] = (int)hashes_p[i];
+	} else if(hash_column != NULL) {
+		*hash_column = PROTECT(allocVector(REALSXP, capacity));
+		double *column_p = REAL(*hash_column);
+		for(uint64_t i=0; i < capacity; i++)
+			column_p[i] = (double)hashes_p[i];
+	}
+
+	SEXP state = PROTECT(allocVector(VECSXP, 2));
+	SET_VECTOR_ELT(state, 0, hashes);
+	SET_VECTOR_ELT(state, 1, ScalarInteger(kmer));
+	SEXP strings = R_new_altrep(kmers_class, state, R_NilValue);
+	UNPROTECT(hash_column != NULL ? 3 : 2);
+	return strings;
+}
+
+
+/* Named list of the statistics of a run, counts as doubles since they may not fit an int */
+static SEXP
+stats_list(const KatssStats *stats)
+{
+	static const char *names[] = {
+		"bytes_read", "bytes_inflated", "records", "kmers_hashed", "invalid_resets",
+		"seconds", "load_seconds", "read_wait_seconds", "increment_wait_seconds",
+		"iteration_seconds"
+	};
+	const double values[] = {
+		(double)stats->bytes_read, (double)stats->bytes_inflated, (double)stats->records,
+		(double)stats->kmers_hashed, (double)stats->invalid_resets, stats->seconds,
+		stats->load_seconds, stats->read_wait_seconds, stats->increment_wait_seconds
+	};
+	int num_values = sizeof values / sizeof *values;
+
+	SEXP list = PROTECT(allocVector(VECSXP, num_values + 1));
+	SEXP list_names = PROTECT(allocVector(STRSXP, num_values + 1));
+	for(int i=0; i < num_values; i++) {
+		SET_VECTOR_ELT(list, i, ScalarReal(values[i]));
+		SET_STRING_ELT(list_names, i, mkChar(names[i]));
+	}
+	SEXP iterations = allocVector(REALSXP, stats->num_iterations);
+	SET_VECTOR_ELT(list, num_values, iterations);
+	SET_STRING_ELT(list_names, num_values, mkChar(names[num_values]));
+	for(int i=0; i < stats->num_iterations; i++)
+		REAL(iterations)[i] = stats->iteration_seconds[i];
+
+	setAttrib(list, R_NamesSymbol, list_names);
+	UNPROTECT(2);
+	return list;
+}
+
+
 SEXP
-katssdata_to_df(KatssData *data, KatssOptions *opts, int algo)
+katssdata_to_df(KatssData *data, KatssOptions *opts, int algo, bool hashes)
 {
 	/* Ensure data was succesfully obtained, return null otherwise */
 	if(data == NULL)
 		return R_NilValue;
+
+	/* Rows of a data.frame are numbered by an int, which every 16-mer doesn't fit */
+	if(data->num_kmers > INT_MAX) {
+		double num_rows = (double)data->num_kmers;
+		katss_free_kdata(data);
+		error("%.0f k-mers are more rows than a data.frame holds, keep fewer with `top` or "
+		      "`min_count`", num_rows);
+	}
 	
-	/* Size of the data.frame */
+	/* Size of the data.frame, and which columns it has */
 	uint64_t capacity = data->num_kmers;
-
-	/* Dataframe that will store data */
-	SEXP df = NULL;
-	SEXP col_names = NULL;
-	SEXP row_names = NULL;
-
-	/* Vectors that will store columns */
-	SEXP kmers = NULL;
-	SEXP rvals = NULL;
-	SEXP stdev = NULL;
-	SEXP pvals = NULL;
+	bool has_stdev = opts->bootstrap_iters > 0;
+	bool has_pvals = opts->bootstrap_iters > 0 && algo != ALGO_COUNT;
+	bool has_hash = hashes && opts->kmer <= HASHES_MAX_KMER;
+	int num_columns = 2 + has_stdev + has_pvals + has_hash;
 
 	/* Create vectors that will store data in R */
-	kmers = PROTECT(allocVector(STRSXP, capacity));
-	rvals = PROTECT(allocVector(REALSXP, capacity));
-	if(opts->bootstrap_iters > 0)
-		stdev = PROTECT(allocVector(REALSXP, capacity));
-	if(opts->bootstrap_iters > 0 && algo != ALGO_COUNT)
-		pvals = PROTECT(allocVector(REALSXP, capacity));
-
-	/* Create pointers to SEXP vectors to write into them */
+	SEXP hash = NULL;
+	SEXP kmers = PROTECT(kmer_column(data, opts->kmer, has_hash ? &hash : NULL));
+	if(has_hash)
+		PROTECT(hash);
+	SEXP rvals = PROTECT(allocVector(REALSXP, capacity));
+	SEXP stdev = has_stdev ? PROTECT(allocVector(REALSXP, capacity)) : NULL;
+	SEXP pvals = has_pvals ? PROTECT(allocVector(REALSXP, capacity)) : NULL;
+
+	/* Move data into vectors, a column at a time */
 	double *rvals_p = REAL(rvals);
-	double *stdev_p = stdev == NULL ? NULL : REAL(stdev);
-	double *pvals_p = pvals == NULL ? NULL : REAL(pvals);
-
-	/* Move data into vectors */
-	char *kseq = s_malloc(opts->kmer + 1); // where kmer str will be stored
-	for(uint64_t i=0; i < data->num_kmers; i++) {
-		/* Set the kmer string in dataframe */
-		katss_unhash(kseq, data->kmers[i].kmer, opts->kmer, true);
-		SET_STRING_ELT(kmers, i, mkChar(kseq));
-
-		/* Write values */
-		if(algo == ALGO_COUNT && opts->bootstrap_iters == 0)
+	if(algo == ALGO_COUNT && opts->bootstrap_iters == 0) {
+		for(uint64_t i=0; i < capacity; i++)
 			rvals_p[i] = data->kmers[i].count;
-		else
+	} else {
+		for(uint64_t i=0; i < capacity; i++)
 			rvals_p[i] = data->kmers[i].rval;
-		if(opts->bootstrap_iters > 0)
+	}
+	if(has_stdev) {
+		double *stdev_p = REAL(stdev);
+		for(uint64_t i=0; i < capacity; i++)
 			stdev_p[i] = data->kmers[i].stdev;
-		if(opts->bootstrap_iters > 0 && algo != ALGO_COUNT)
+	}
+	if(has_pvals) {
+		double *pvals_p = REAL(pvals);
+		for(uint64_t i=0; i < capacity; i++)
 			pvals_p[i] = data->kmers[i].pval;
 	}
-	free(kseq);
+
+	SEXP stats = data->stats != NULL ? PROTECT(stats_list(data->stats)) : NULL;
 
 	/* Free resources allocated to kdata since we are done copying values */
 	katss_free_kdata(data);
 
 	/* Create data.frame from values alongside col & row names */
-	if(opts->bootstrap_iters > 0 && algo != ALGO_COUNT) {
-		df = PROTECT(allocVector(VECSXP, 4));
-		col_names = PROTECT(allocVector(STRSXP, 4));
-	} else if(opts->bootstrap_iters > 0) {
-		df = PROTECT(allocVector(VECSXP, 3));
-		col_names = PROTECT(allocVector(STRSXP, 3));
-	} else {
-		df = PROTECT(allocVector(VECSXP, 2));
-		col_names = PROTECT(allocVector(STRSXP, 2));
+	SEXP df = PROTECT(allocVector(VECSXP, num_columns));
+	SEXP col_names = PROTECT(allocVector(STRSXP, num_columns));
+	int column = 0;
+	SET_STRING_ELT(col_names, column, mkChar("kmer"));
+	SET_VECTOR_ELT(df, column++, kmers);
+	SET_STRING_ELT(col_names, column, mkChar(algo == ALGO_COUNT ? "count" : "rval"));
+	SET_VECTOR_ELT(df, column++, rvals);
+	if(has_stdev) {
+		SET_STRING_ELT(col_names, column, mkChar("stdev"));
+		SET_VECTOR_ELT(df, column++, stdev);
 	}
-	row_names = PROTECT(allocVector(INTSXP, capacity));
-
-	/* Set column and row names */
-	SET_STRING_ELT(col_names, 0, mkChar("kmer"));
-	if(algo == ALGO_COUNT)
-		SET_STRING_ELT(col_names, 1, mkChar("count"));
-	else 
-		SET_STRING_ELT(col_names, 1, mkChar("rval"));
-	if(opts->bootstrap_iters > 0 && algo != ALGO_COUNT)
-		SET_STRING_ELT(col_names, 3, mkChar("pval"));
-	if(opts->bootstrap_iters > 0)
-		SET_STRING_ELT(col_names, 2, mkChar("stdev"));
-	for(uint64_t i=0; i < capacity; i++) {
-		INTEGER(row_names)[i] = i+1;
+	if(has_pvals) {
+		SET_STRING_ELT(col_names, column, mkChar("pval"));
+		SET_VECTOR_ELT(df, column++, pvals);
+	}
+	if(has_hash) {
+		SET_STRING_ELT(col_names, column, mkChar("hash"));
+		SET_VECTOR_ELT(df, column++, hash);
 	}
 
-	/* Set columns of dataframe from computes values */
-	SET_VECTOR_ELT(df, 0, kmers);
-	SET_VECTOR_ELT(df, 1, rvals);
-	if(opts->bootstrap_iters > 0)
-		SET_VECTOR_ELT(df, 2, stdev);
-	if(opts->bootstrap_iters > 0 && algo != ALGO_COUNT)
-		SET_VECTOR_ELT(df, 3, pvals);
+	/* Compact row names, c(NA, -n), instead of a vector of 1 to n */
+	SEXP row_names = PROTECT(allocVector(INTSXP, 2));
+	INTEGER(row_names)[0] = NA_INTEGER;
+	INTEGER(row_names)[1] = -(int)capacity;
 	
 	/* Set attributes to ensure R recognizes names and data frame */
 	setAttrib(df, R_NamesSymbol, col_names);
 	setAttrib(df, R_RowNamesSymbol, row_names);
 	setAttrib(df, R_ClassSymbol, mkString("data.frame"));
+	if(stats != NULL)
+		setAttrib(df, install("stats"), stats);
 
 	/* Release protected vectors */
-	if(opts->bootstrap_iters > 0 && algo != ALGO_COUNT)
-		UNPROTECT(7);
-	else if(opts->bootstrap_iters > 0)
-		UNPROTECT(6);
-	else
-		UNPROTECT(5);
+	UNPROTECT(5 + has_hash + has_stdev + has_pvals + (stats != NULL));
 	
 	/* Return data.frame */
 	return df;
@@ -124,8 +294,9 @@ katssdata_to_df(KatssData *data, KatssOptions *opts, int algo)
 
 // Function to convert R inputs to C and call count_kmers
 SEXP
-count_kmers_R(SEXP filename, SEXP kmer, SEXP klet, SEXP sort, SEXP iters, 
-              SEXP sample, SEXP algo, SEXP seed, SEXP threads)
+count_kmers_R(SEXP filename, SEXP kmer, SEXP klet, SEXP sort, SEXP top, SEXP min_count,
+              SEXP iters, SEXP sample, SEXP algo, SEXP seed, SEXP threads, SEXP hashes,
+              SEXP canonical, SEXP stats)
 {
 	const char *c_filename = CHAR(STRING_ELT(filename, 0));
 
@@ -137,10 +308,14 @@ count_kmers_R(SEXP filename, SEXP kmer, SEXP klet, SEXP sort, SEXP iters,
 	opts.kmer = INTEGER(kmer)[0];
 	opts.probs_ntprec = INTEGER(klet)[0];
 	opts.sort_enrichments = INTEGER(sort)[0];
+	opts.top_kmers = INTEGER(top)[0];
+	opts.min_count = INTEGER(min_count)[0];
 	opts.bootstrap_iters = INTEGER(iters)[0];
 	opts.bootstrap_sample = INTEGER(sample)[0];
 	opts.seed = INTEGER(seed)[0];
 	opts.threads = INTEGER(threads)[0];
+	opts.canonical = INTEGER(canonical)[0];
+	opts.collect_stats = INTEGER(stats)[0];
 	opts.enable_warnings = true;
 	switch(INTEGER(algo)[0]) {
 	case 1: opts.probs_algo = KATSS_PROBS_NONE;     break;
@@ -152,13 +327,14 @@ count_kmers_R(SEXP filename, SEXP kmer, SEXP klet, SEXP sort, SEXP iters,
 	KatssData *result = katss_count(c_filename, &opts);
 
 	/* Turn result into an R data.frame and return it */
-	return katssdata_to_df(result, &opts, ALGO_COUNT);
+	return katssdata_to_df(result, &opts, ALGO_COUNT, INTEGER(hashes)[0]);
 }
 
 
 SEXP
 enrichments_R(SEXP test, SEXP ctrl, SEXP kmer, SEXP algo, SEXP bs_iters, 
-              SEXP bs_sample, SEXP seed, SEXP klet, SEXP sort, SEXP threads)
+              SEXP bs_sample, SEXP seed, SEXP klet, SEXP sort, SEXP top,
+              SEXP min_count, SEXP threads, SEXP hashes, SEXP stats)
 {
 	const char *test_name = CHAR(STRING_ELT(test, 0));
 	const char *ctrl_name = isNull(ctrl) ? NULL : CHAR(STRING_ELT(ctrl, 0));
@@ -174,7 +350,10 @@ enrichments_R(SEXP test, SEXP ctrl, SEXP kmer, SEXP algo, SEXP bs_iters,
 	opts.seed             = INTEGER(seed)[0];
 	opts.probs_ntprec     = INTEGER(klet)[0];
 	opts.sort_enrichments = INTEGER(sort)[0];
+	opts.top_kmers        = INTEGER(top)[0];
+	opts.min_count        = INTEGER(min_count)[0];
 	opts.threads          = INTEGER(threads)[0];
+	opts.collect_stats    = INTEGER(stats)[0];
 	opts.enable_warnings  = true;
 	switch(INTEGER(algo)[0]) {
 	case 0: opts.probs_algo = KATSS_PROBS_NONE;     break;
@@ -188,7 +367,232 @@ enrichments_R(SEXP test, SEXP ctrl, SEXP kmer, SEXP algo, SEXP bs_iters,
 	KatssData *result = katss_enrichment(test_name, ctrl_name, &opts);
 
 	/* Turn result into an R data.frame and return it */
-	return katssdata_to_df(result, &opts, ALGO_RVALS);
+	return katssdata_to_df(result, &opts, ALGO_RVALS, INTEGER(hashes)[0]);
+}
+
+
+/* enrichments_batch_R: C wrapper to compute the enrichments of many tests against one control */
+SEXP
+enrichments_batch_R(SEXP tests, SEXP ctrl, SEXP kmer, SEXP bs_iters, SEXP bs_sample, SEXP seed,
+                    SEXP sort, SEXP top, SEXP min_count, SEXP threads, SEXP hashes, SEXP stats)
+{
+	int num_tests = LENGTH(tests);
+	const char **test_names = (const char **)R_alloc(num_tests, sizeof *test_names);
+	for(int t=0; t<num_tests; t++)
+		test_names[t] = CHAR(STRING_ELT(tests, t));
+	const char *ctrl_name = CHAR(STRING_ELT(ctrl, 0));
+
+	/* Initialize the options */
+	KatssOptions opts;
+	katss_init_options(&opts);
+
+	/* Modify the options based on input */
+	opts.kmer             = INTEGER(kmer)[0];
+	opts.bootstrap_iters  = INTEGER(bs_iters)[0];
+	opts.bootstrap_sample = INTEGER(bs_sample)[0];
+	opts.seed             = INTEGER(seed)[0];
+	opts.sort_enrichments = INTEGER(sort)[0];
+	opts.top_kmers        = INTEGER(top)[0];
+	opts.min_count        = INTEGER(min_count)[0];
+	opts.threads          = INTEGER(threads)[0];
+	opts.collect_stats    = INTEGER(stats)[0];
+	opts.enable_warnings  = true;
+
+	/* Compute the result */
+	KatssData **result = katss_enrichment_batch(test_names, num_tests, ctrl_name, &opts);
+	if(result == NULL)
+		return R_NilValue;
+
+	/* One data.frame per test, the statistics of the batch on the list. Tests with too many rows
+	   for one are found before any is made, as the others would be left allocated */
+	for(int t=0; t<num_tests; t++) {
+		if(result[t]->num_kmers > INT_MAX) {
+			double num_rows = (double)result[t]->num_kmers;
+			for(int i=0; i<num_tests; i++)
+				katss_free_kdata(result[i]);
+			free(result);
+			error("%.0f k-mers are more rows than a data.frame holds, keep fewer with `top` or "
+			      "`min_count`", num_rows);
+		}
+	}
+	SEXP list = PROTECT(allocVector(VECSXP, num_tests));
+	for(int t=0; t<num_tests; t++)
+		SET_VECTOR_ELT(list, t, katssdata_to_df(result[t], &opts, ALGO_RVALS, INTEGER(hashes)[0]));
+	free(result);
+	SEXP first = VECTOR_ELT(list, 0);
+	SEXP batch_stats = getAttrib(first, install("stats"));
+	if(batch_stats != R_NilValue) {
+		setAttrib(list, install("stats"), batch_stats);
+		setAttrib(first, install("stats"), R_NilValue);
+	}
+	UNPROTECT(1);
+	return list;
+}
+
+
+/* save_counts_R: C wrapper to count a file and save its counts to a counter file */
+SEXP
+save_counts_R(SEXP filename, SEXP outfile, SEXP kmer, SEXP level, SEXP threads)
+{
+	const char *c_filename = CHAR(STRING_ELT(filename, 0));
+	const char *c_outfile = CHAR(STRING_ELT(outfile, 0));
+
+	KatssCounter *counter = katss_count_kmers_mt(c_filename, INTEGER(kmer)[0],
+	                                             INTEGER(threads)[0]);
+	if(counter == NULL)
+		return ScalarLogical(FALSE);
+	int ret = katss_save_counter(counter, c_outfile, INTEGER(level)[0]);
+	katss_free_counter(counter);
+
+	return ScalarLogical(ret == 0);
+}
+
+
+/* Unname the counter of a handle once R collects it, which frees the counter */
+static void
+free_counter_handle(SEXP handle)
+{
+	if(R_ExternalPtrAddr(handle) == NULL)
+		return;
+	katss_unname_counter(CHAR(STRING_ELT(R_ExternalPtrTag(handle), 0)));
+	R_ClearExternalPtr(handle);
+}
+
+
+/* katss_counter_R: C wrapper to count a file once, and hold its counts for later calls. The
+   handle keeps `file`, the path or katss_sequences counted, alive for as long as it lives */
+SEXP
+katss_counter_R(SEXP file, SEXP filename, SEXP kmer, SEXP threads)
+{
+	const char *c_filename = CHAR(STRING_ELT(filename, 0));
+	KatssCounter *counter = katss_count_kmers_mt(c_filename, INTEGER(kmer)[0],
+	                                             INTEGER(threads)[0]);
+	if(counter == NULL)
+		return R_NilValue;
+	double total = (double)katss_get_total(counter);
+
+	/* The counts are read under a name no file has, for as long as the handle lives */
+	char name[64];
+	snprintf(name, sizeof name, "<katss_counter %p>", (void *)counter);
+	if(katss_name_counter(name, counter) != 0) {
+		katss_free_counter(counter);
+		return R_NilValue;
+	}
+
+	SEXP tag = PROTECT(mkString(name));
+	SEXP handle = PROTECT(R_MakeExternalPtr(counter, tag, file));
+	R_RegisterCFinalizerEx(handle, free_counter_handle, TRUE);
+	setAttrib(handle, install("file"), filename);
+	setAttrib(handle, install("kmer"), kmer);
+	setAttrib(handle, install("total"), ScalarReal(total));
+	setAttrib(handle, R_ClassSymbol, mkString("katss_counter"));
+	UNPROTECT(2);
+	return handle;
+}
+
+
+/* Unload the sequences of a handle once R collects it, the address being their name */
+static void
+free_sequences_handle(SEXP handle)
+{
+	char *name = R_ExternalPtrAddr(handle);
+	if(name == NULL)
+		return;
+	katss_unload_file(name);
+	free(name);
+	R_ClearExternalPtr(handle);
+}
+
+
+/* katss_sequences_R: C wrapper to load sequences of R in memory, to be read as if a file */
+SEXP
+katss_sequences_R(SEXP sequences)
+{
+	/* NA strings aren't sequences, the rest are read as is */
+	R_xlen_t length = XLENGTH(sequences);
+	const char **c_sequences = (const char **)R_alloc(length, sizeof *c_sequences);
+	uint64_t num_sequences = 0;
+	for(R_xlen_t i=0; i < length; i++) {
+		if(STRING_ELT(sequences, i) != NA_STRING)
+			c_sequences[num_sequences++] = CHAR(STRING_ELT(sequences, i));
+	}
+
+	/* The sequences are read under a name no file has, for as long as the handle lives */
+	char *name = s_malloc(64);
+	snprintf(name, 64, "<katss_sequences %p>", (void *)name);
+	if(katss_preload_sequences(name, c_sequences, num_sequences, UINT64_MAX) != 0) {
+		free(name);
+		return R_NilValue;
+	}
+
+	SEXP tag = PROTECT(mkString(name));
+	SEXP handle = PROTECT(R_MakeExternalPtr(name, tag, R_NilValue));
+	R_RegisterCFinalizerEx(handle, free_sequences_handle, TRUE);
+	setAttrib(handle, install("num_sequences"), ScalarReal((double)num_sequences));
+	setAttrib(handle, R_ClassSymbol, mkString("katss_sequences"));
+	UNPROTECT(2);
+	return handle;
+}
+
+
+/* handle_name_R: C wrapper giving the name the counts or sequences of a handle are read under */
+SEXP
+handle_name_R(SEXP handle)
+{
+	if(TYPEOF(handle) != EXTPTRSXP || R_ExternalPtrAddr(handle) == NULL)
+		error("the handle no longer points to data in memory, e.g. it was saved and loaded again");
+	return R_ExternalPtrTag(handle);
+}
+
+
+/* counter_source_R: C wrapper giving what the counts of a handle were counted from, the path of
+   a file or the katss_sequences handle it keeps alive */
+SEXP
+counter_source_R(SEXP handle)
+{
+	if(TYPEOF(handle) != EXTPTRSXP)
+		error("the counter is not a katss_counter handle");
+	return R_ExternalPtrProtected(handle);
+}
+
+
+/* cache_counts_R: C wrapper to start or stop caching the counts of the files counted */
+SEXP
+cache_counts_R(SEXP enable, SEXP max_bytes, SEXP directory, SEXP hash)
+{
+	if(asLogical(enable) != TRUE) {
+		katss_disable_count_cache();
+		return ScalarLogical(TRUE);
+	}
+
+	const char *c_directory = isNull(directory) ? NULL : CHAR(STRING_ELT(directory, 0));
+	int ret = katss_enable_count_cache((uint64_t)REAL(max_bytes)[0], c_directory,
+	                                   asLogical(hash) == TRUE);
+	return ScalarLogical(ret == 0);
+}
+
+
+/* First iteration of IKKE through katss_ikke, which reads the counts of named counters */
+static KatssEnrichments *
+single_ikke(const char *test, const char *ctrl, int kmer, bool normalize, int threads)
+{
+	KatssOptions opts;
+	katss_init_options(&opts);
+	opts.kmer = kmer;
+	opts.iters = 1;
+	opts.normalize = normalize;
+	opts.threads = threads;
+
+	KatssData *data = katss_ikke(test, ctrl, &opts);
+	if(data == NULL)
+		return NULL;
+	KatssEnrichments *result = s_malloc(sizeof *result);
+	result->enrichments = s_malloc(sizeof *result->enrichments);
+	result->enrichments[0].key = data->kmers[0].kmer;
+	result->enrichments[0].enrichment = data->kmers[0].rval;
+	result->num_enrichments = 1;
+	katss_free_kdata(data);
+	return result;
 }
 
 
@@ -214,8 +618,12 @@ ikke_R(SEXP test_file, SEXP ctrl_file, SEXP kmer, SEXP iterations, SEXP probabil
 			result = katss_prob_ikke_mt(test_filename, c_kmer, c_iterations, c_normalize, c_threads);
 	} else {
 		const char *ctrl_filename = CHAR(STRING_ELT(ctrl_file, 0));
+		/* A single iteration reads the counts of held counters instead of counting again */
+		if(c_iterations == 1)
+			result = single_ikke(test_filename, ctrl_filename, c_kmer, c_normalize, c_threads);
+
 		/* If single threaded, use regular ikke*/
-		if(c_threads < 2)
+		else if(c_threads < 2)
 			result = katss_ikke_(test_filename, ctrl_filename, c_kmer, c_iterations, c_normalize);
 		
 		/* Else if multithreaded, use mt version */
@@ -240,7 +648,7 @@ ikke_R(SEXP test_file, SEXP ctrl_file, SEXP kmer, SEXP iterations, SEXP probabil
 
 		/* Set k-mer string */
 		char kseq[c_kmer + 1U];
-		katss_unhash(kseq, result->enrichments[i].key, c_kmer, 1);
+		katss_unhash64(kseq, result->enrichments[i].key, c_kmer, 1);
 		SET_STRING_ELT(kmer_strings, i, mkChar(kseq));
 	}
 
@@ -328,3 +736,68 @@ SEXP seqseq_R(SEXP seq, SEXP search, SEXP all_matches) {
 		return ScalarReal(seqseq_single_R(seq_ptr, search_ptr));
 	}
 }
+
+
+/* Search for many sequences within many sequences, giving every match found */
+SEXP
+seqmatches_R(SEXP sequences, SEXP patterns, SEXP overlapping, SEXP threads)
+{
+	/* Indices of the sequences and patterns are ints, as are the row names of the matches */
+	R_xlen_t num_sequences = XLENGTH(sequences);
+	if(num_sequences > INT_MAX || XLENGTH(patterns) > INT_MAX)
+		error("sequences and patterns can't be indexed by an int, search fewer of them at once");
+
+	/* NA sequences are skipped, patterns were checked to be neither NA nor empty */
+	const char **c_sequences = (const char **)R_alloc(num_sequences, sizeof *c_sequences);
+	for(R_xlen_t i=0; i < num_sequences; i++) {
+		SEXP sequence = STRING_ELT(sequences, i);
+		c_sequences[i] = sequence == NA_STRING ? NULL : CHAR(sequence);
+	}
+	R_xlen_t num_patterns = XLENGTH(patterns);
+	const char **c_patterns = (const char **)R_alloc(num_patterns, sizeof *c_patterns);
+	for(R_xlen_t i=0; i < num_patterns; i++)
+		c_patterns[i] = CHAR(STRING_ELT(patterns, i));
+
+	uint64_t num_matches;
+	SeqMatch *matches = seqseq_many(c_sequences, (uint64_t)num_sequences, c_patterns,
+	                                (uint32_t)num_patterns, asLogical(overlapping) == TRUE,
+	                                asInteger(threads), &num_matches);
+	if(num_matches > INT_MAX) {
+		free(matches);
+		error("%.0f matches are more rows than a data.frame holds, search fewer sequences or "
+		      "patterns at once", (double)num_matches);
+	}
+
+	/* Indices and positions start at 1, as with `seqseq` */
+	SEXP df = PROTECT(allocVector(VECSXP, 3));
+	SEXP sequence = PROTECT(allocVector(INTSXP, (R_xlen_t)num_matches));
+	SEXP pattern = PROTECT(allocVector(INTSXP, (R_xlen_t)num_matches));
+	SEXP position = PROTECT(allocVector(REALSXP, (R_xlen_t)num_matches));
+	int *sequence_ptr = INTEGER(sequence), *pattern_ptr = INTEGER(pattern);
+	double *position_ptr = REAL(position);
+	for(uint64_t i=0; i < num_matches; i++) {
+		sequence_ptr[i] = (int)matches[i].sequence + 1;
+		pattern_ptr[i] = (int)matches[i].pattern + 1;
+		position_ptr[i] = (double)matches[i].position + 1;
+	}
+	free(matches);
+	SET_VECTOR_ELT(df, 0, sequence);
+	SET_VECTOR_ELT(df, 1, pattern);
+	SET_VECTOR_ELT(df, 2, position);
+
+	SEXP col_names = PROTECT(allocVector(STRSXP, 3));
+	SET_STRING_ELT(col_names, 0, mkChar("sequence"));
+	SET_STRING_ELT(col_names, 1, mkChar("pattern"));
+	SET_STRING_ELT(col_names, 2, mkChar("position"));
+
+	/* Compact row names, c(NA, -n), instead of a vector of 1 to n */
+	SEXP row_names = PROTECT(allocVector(INTSXP, 2));
+	INTEGER(row_names)[0] = NA_INTEGER;
+	INTEGER(row_names)[1] = -(int)num_matches;
+
+	setAttrib(df, R_NamesSymbol, col_names);
+	setAttrib(df, R_RowNamesSymbol, row_names);
+	setAttrib(df, R_ClassSymbol, mkString("data.frame"));
+	UNPROTECT(6);
+	return df;
+}